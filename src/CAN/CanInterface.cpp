@@ -13,18 +13,51 @@
 #include "CanSender.h"
 #include "Movement/DDA.h"
 #include "Movement/DriveMovement.h"
+#include "Movement/Kinematics/LinearDeltaKinematics.h"
+#include "Heating/FOPDT.h"
+#include "Platform.h"
+#include "RepRap.h"
 
 const unsigned int NumCanBuffers = 40;
 
 const size_t NumCanBoards = (MaxCanDrivers + DriversPerCanBoard - 1)/DriversPerCanBoard;
+static_assert(NumCanBoards <= MaxCanBoards, "Too many CAN boards");
+
+// Preparing a move may need a movement message and a new batch for every board, and a driver parameters message for every driver.
+// We don't prepare a move unless we have this many free buffers, so that we never lose part of a move.
+const unsigned int MaxBuffersNeededPerMove = 2 * NumCanBoards + MaxCanDrivers;
+static_assert(NumCanBuffers >= MaxBuffersNeededPerMove + NumCanBoards, "Too few CAN buffers");
+
+static unsigned int numMovesHeldBack = 0;				// how many times CanPrepareMove stopped a move being prepared
+
+// Batched short moves are held back until a batch is full or its first move is due to start within this time
+constexpr uint32_t BatchSendLeadClocks = StepTimer::StepClockRate/20;	// 50ms
 
 static CanMessageBuffer *movementBuffers[NumCanBoards];
+static CanMessageBuffer *batchBuffers[NumCanBoards];		// batches of short moves that we haven't sent yet
+static uint32_t lastBatchedMoveStartTime[NumCanBoards];	// the start time of the last move added to each batch
+
+// The parameters we last sent for each driver. The ones we haven't sent are zero.
+struct DriverParameters
+{
+	float towerX, towerY, diagonalSquared;
+	float pressureAdvance;
+	bool valid;
+};
+
+static DriverParameters driverParameters[MaxCanDrivers];
+
+// The latest heater report from each board, written by the CAN interrupt handler
+static CanHeaterReportMessage heaterReports[NumCanBoards];
+static uint32_t whenHeaterReportReceived[NumCanBoards];		// the millis() time when we received it
+static bool haveHeaterReport[NumCanBoards];
+static volatile unsigned int heaterReportsReceived = 0;
 
 // CanMovementMessage is declared in project Duet3Expansion, so we need to implement its members here
 void CanMovementMessage::DebugPrint()
 {
-	debugPrintf("Can: %08" PRIx32 " %08" PRIx32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %.2f %.2f:",
-		timeNow, moveStartTime, accelerationClocks, steadyClocks, decelClocks, (double)initialSpeedFraction, (double)finalSpeedFraction);
+	debugPrintf("Can: %08" PRIx32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %.2f %.2f:",
+		moveStartTime, accelerationClocks, steadyClocks, decelClocks, (double)initialSpeedFraction, (double)finalSpeedFraction);
 	for (size_t i = 0; i < DriversPerCanBoard; ++i)
 	{
 		debugPrintf(" %" PRIi32, perDrive[i].steps);
@@ -32,13 +65,110 @@ void CanMovementMessage::DebugPrint()
 	debugPrintf("\n");
 }
 
+void CanBatchedMovementMessage::DebugPrint()
+{
+	debugPrintf("Can batch: %08" PRIx32 " %" PRIu32 " moves\n", startTime, numMoves);
+	for (size_t i = 0; i < numMoves; ++i)
+	{
+		const CanShortMove& move = moves[i];
+		debugPrintf(" %u %u %u %u %u %u:", move.startDelay, move.accelerationClocks, move.steadyClocks, move.decelClocks, move.initialSpeedFraction, move.finalSpeedFraction);
+		for (size_t j = 0; j < DriversPerCanBoard; ++j)
+		{
+			debugPrintf(" %d", move.steps[j]);
+		}
+		debugPrintf("\n");
+	}
+}
+
+// Convert a speed fraction to the format used in short moves
+static uint16_t ShortMoveSpeedFraction(float f)
+{
+	return (uint16_t)constrain<long>(lrintf(f * 65535.0), 0, 65535);
+}
+
+// Return true if a move can be sent as a short move, given how long after the previous move in the batch it starts
+static bool IsShortMove(const CanMovementMessage& msg, uint32_t startDelay)
+{
+	if (msg.flags.u32 != 0 || startDelay > 65535 || msg.accelerationClocks > 65535 || msg.steadyClocks > 65535 || msg.decelClocks > 65535)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < DriversPerCanBoard; ++i)
+	{
+		if (msg.perDrive[i].steps > 32767 || msg.perDrive[i].steps < -32768)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Send the batch of short moves for one board, if there is one
+static void SendBatch(size_t board)
+{
+	CanMessageBuffer*& batch = batchBuffers[board];
+	if (batch != nullptr)
+	{
+		batch->dataLength = sizeof(CanBatchedMovementMessage) - (CanBatchedMovementMessage::MaxMoves - batch->msg.batch.numMoves) * sizeof(CanShortMove);
+		CanSender::Send(batch);						// queues the buffer for sending and frees it when done
+		batch = nullptr;
+	}
+}
+
+// Add a move to the batch for a board, starting a new batch if necessary. Return true if successful.
+static bool AddToBatch(size_t board, const CanMovementMessage& msg)
+{
+	CanMessageBuffer*& batch = batchBuffers[board];
+	const uint32_t startDelay = msg.moveStartTime - ((batch != nullptr) ? lastBatchedMoveStartTime[board] : msg.moveStartTime);
+	if (!IsShortMove(msg, startDelay))
+	{
+		return false;
+	}
+
+	if (batch == nullptr)
+	{
+		batch = CanMessageBuffer::Allocate();
+		if (batch == nullptr)
+		{
+			return false;
+		}
+		batch->id = (board + 1) | CanBatchedMovementMessageIdBase;
+		batch->msg.batch.startTime = msg.moveStartTime;
+		batch->msg.batch.numMoves = 0;
+	}
+
+	CanShortMove& move = batch->msg.batch.moves[batch->msg.batch.numMoves++];
+	move.startDelay = (uint16_t)startDelay;
+	move.accelerationClocks = (uint16_t)msg.accelerationClocks;
+	move.steadyClocks = (uint16_t)msg.steadyClocks;
+	move.decelClocks = (uint16_t)msg.decelClocks;
+	move.initialSpeedFraction = ShortMoveSpeedFraction(msg.initialSpeedFraction);
+	move.finalSpeedFraction = ShortMoveSpeedFraction(msg.finalSpeedFraction);
+	for (size_t i = 0; i < DriversPerCanBoard; ++i)
+	{
+		move.steps[i] = (int16_t)msg.perDrive[i].steps;
+	}
+	lastBatchedMoveStartTime[board] = msg.moveStartTime;
+
+	if (batch->msg.batch.numMoves == CanBatchedMovementMessage::MaxMoves)
+	{
+		SendBatch(board);
+	}
+	return true;
+}
+
 void CanInterface::Init()
 {
 	CanMessageBuffer::Init(NumCanBuffers);
-	CanSender::Init();
 	for (size_t i = 0; i < NumCanBoards; ++i)
 	{
-		movementBuffers[i] = nullptr;
+		movementBuffers[i] = batchBuffers[i] = nullptr;
+		haveHeaterReport[i] = false;
+	}
+	CanSender::Init();
+	for (DriverParameters& dp : driverParameters)
+	{
+		dp.valid = false;
 	}
 }
 
@@ -51,9 +181,8 @@ void CanInterface::StartMovement(const DDA& dda)
 	}
 }
 
-// This is called by DDA::Prepare for each active CAN DM in the move
-// If steps == 0 then the drivers just need to be enabled
-void CanInterface::AddMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps)
+// Get the movement message for the board that a driver is on, allocating and setting it up if this is the first driver on that board in this move
+static CanMessageBuffer *GetMovementBuffer(const PrepParams& params, size_t canDriver)
 {
 	const size_t expansionBoardNumber = canDriver/DriversPerCanBoard;
 	CanMessageBuffer*& buf = movementBuffers[expansionBoardNumber];
@@ -62,55 +191,269 @@ void CanInterface::AddMovement(const DDA& dda, const PrepParams& params, size_t
 		buf = CanMessageBuffer::Allocate();
 		if (buf == nullptr)
 		{
-			return;		//TODO error handling
+			return nullptr;		// this doesn't happen unless CanPrepareMove is not called first, and the allocation failure is counted
 		}
 
-		buf->expansionBoardId = expansionBoardNumber + 1;
+		buf->id = (expansionBoardNumber + 1) | CanMovementMessageIdBase;
+		buf->dataLength = sizeof(CanMovementMessage);
 
 		// Common parameters
-		buf->msg.accelerationClocks = lrintf(params.accelTime * StepTimer::StepClockRate);
-		buf->msg.steadyClocks = lrintf(params.steadyTime * StepTimer::StepClockRate);
-		buf->msg.decelClocks = lrintf(params.decelTime * StepTimer::StepClockRate);
-		buf->msg.initialSpeedFraction = params.initialSpeedFraction;
-		buf->msg.finalSpeedFraction = params.finalSpeedFraction;
-		buf->msg.flags.deltaDrives = 0;							//TODO
-		buf->msg.flags.endStopsToCheck = 0;						//TODO
-		buf->msg.flags.pressureAdvanceDrives = 0;				//TODO
-		buf->msg.flags.stopAllDrivesOnEndstopHit = false;		//TODO
+		CanMovementMessage& msg = buf->msg.move;
+		msg.accelerationClocks = lrintf(params.accelTime * StepTimer::StepClockRate);
+		msg.steadyClocks = lrintf(params.steadyTime * StepTimer::StepClockRate);
+		msg.decelClocks = lrintf(params.decelTime * StepTimer::StepClockRate);
+		msg.initialSpeedFraction = params.initialSpeedFraction;
+		msg.finalSpeedFraction = params.finalSpeedFraction;
+		msg.flags.u32 = 0;
 		// Additional parameters for delta movements
-		buf->msg.initialX = params.initialX;
-		buf->msg.finalX = params.finalX;
-		buf->msg.initialY = params.initialY;
-		buf->msg.finalY = params.finalY;
-		buf->msg.zMovement = params.zMovement;
+		msg.initialX = params.initialX;
+		msg.finalX = params.finalX;
+		msg.initialY = params.initialY;
+		msg.finalY = params.finalY;
+		msg.zMovement = params.zMovement;
 
 		// Clear out the per-drive fields
 		for (size_t drive = 0; drive < DriversPerCanBoard; ++drive)
 		{
-			buf->msg.perDrive[drive].steps = 0;
+			msg.perDrive[drive].steps = 0;
 		}
 	}
+	return buf;
+}
 
-	buf->msg.perDrive[canDriver % DriversPerCanBoard].steps = steps;
+// Make sure that the expansion board has the current parameters for a driver, sending them if they have changed
+static void UpdateDriverParameters(size_t canDriver, float towerX, float towerY, float diagonalSquared, float pressureAdvance)
+{
+	DriverParameters& dp = driverParameters[canDriver];
+	if (!dp.valid || dp.towerX != towerX || dp.towerY != towerY || dp.diagonalSquared != diagonalSquared || dp.pressureAdvance != pressureAdvance)
+	{
+		CanMessageBuffer * const buf = CanMessageBuffer::Allocate();
+		if (buf != nullptr)										// if we can't get a buffer then we try again on the next move
+		{
+			buf->id = (canDriver/DriversPerCanBoard + 1) | CanDriverParametersMessageIdBase;
+			buf->dataLength = sizeof(CanDriverParametersMessage);
+			CanDriverParametersMessage& msg = buf->msg.driverParameters;
+			msg.driver = canDriver % DriversPerCanBoard;
+			msg.towerX = dp.towerX = towerX;
+			msg.towerY = dp.towerY = towerY;
+			msg.diagonalSquared = dp.diagonalSquared = diagonalSquared;
+			msg.pressureAdvance = dp.pressureAdvance = pressureAdvance;
+			dp.valid = true;
+			CanSender::Send(buf);
+		}
+	}
 }
 
-// This is called by DDA::Prepare when all DMs for CAN drives` have been processed
+// This is called by DDA::Prepare for each active CAN DM in the move
+// If steps == 0 then the drivers just need to be enabled
+void CanInterface::AddMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps)
+{
+	CanMessageBuffer * const buf = GetMovementBuffer(params, canDriver);
+	if (buf != nullptr)
+	{
+		buf->msg.move.perDrive[canDriver % DriversPerCanBoard].steps = steps;
+	}
+}
+
+// This is called by DDA::Prepare for each CAN driver of a delta tower. The expansion board runs the delta algorithm using the tower parameters.
+void CanInterface::AddDeltaMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps, size_t tower)
+{
+	CanMessageBuffer * const buf = GetMovementBuffer(params, canDriver);
+	if (buf != nullptr)
+	{
+		const DriverParameters& dp = driverParameters[canDriver];
+		UpdateDriverParameters(canDriver, params.dparams->GetTowerX(tower), params.dparams->GetTowerY(tower), params.dparams->GetDiagonalSquared(tower),
+								dp.pressureAdvance);
+		const size_t localDriver = canDriver % DriversPerCanBoard;
+		buf->msg.move.perDrive[localDriver].steps = steps;
+		buf->msg.move.flags.deltaDrives |= 1u << localDriver;
+	}
+}
+
+// This is called by DDA::Prepare for each CAN extruder driver. pressureAdvance is the pressure advance time in seconds, or zero if it is not used in this move.
+void CanInterface::AddExtruderMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps, float pressureAdvance)
+{
+	CanMessageBuffer * const buf = GetMovementBuffer(params, canDriver);
+	if (buf != nullptr)
+	{
+		const size_t localDriver = canDriver % DriversPerCanBoard;
+		buf->msg.move.perDrive[localDriver].steps = steps;
+		if (pressureAdvance > 0.0)
+		{
+			const DriverParameters& dp = driverParameters[canDriver];
+			UpdateDriverParameters(canDriver, dp.towerX, dp.towerY, dp.diagonalSquared, pressureAdvance);
+			buf->msg.move.flags.pressureAdvanceDrives |= 1u << localDriver;
+		}
+	}
+}
+
+// This is called by DDA::Prepare for each CAN driver whose endstop the expansion board must check during the move
+void CanInterface::CheckEndstop(size_t canDriver, bool stopAllDrives)
+{
+	CanMessageBuffer * const buf = movementBuffers[canDriver/DriversPerCanBoard];
+	if (buf != nullptr)
+	{
+		buf->msg.move.flags.endStopsToCheck |= 1u << (canDriver % DriversPerCanBoard);
+		if (stopAllDrives)
+		{
+			buf->msg.move.flags.stopAllDrivesOnEndstopHit = true;
+		}
+	}
+}
+
+// This is called by DDA::Prepare when all DMs for CAN drives` have been processed.
+// Short moves are added to the batch for the board, anything else is sent on its own after any batch for the same board.
 void CanInterface::FinishMovement(uint32_t moveStartTime)
 {
-	for (CanMessageBuffer*& buf : movementBuffers)
+	for (size_t board = 0; board < NumCanBoards; ++board)
 	{
+		CanMessageBuffer*& buf = movementBuffers[board];
 		if (buf != nullptr)
 		{
-			buf->msg.moveStartTime = moveStartTime;
-			CanSender::Send(buf);					// queues the buffer for sending and frees it when done
-			buf = nullptr;
+			buf->msg.move.moveStartTime = moveStartTime;
+			if (AddToBatch(board, buf->msg.move))
+			{
+				CanMessageBuffer::Free(buf);
+			}
+			else
+			{
+				SendBatch(board);
+				CanSender::Send(buf);				// queues the buffer for sending and frees it when done
+				buf = nullptr;
+			}
+		}
+	}
+	SendDueBatches();
+}
+
+// Send any batches of short moves whose first move is due to start soon. This is called by DDA::Prepare and DDARing::Spin.
+void CanInterface::SendDueBatches()
+{
+	const uint32_t now = StepTimer::GetInterruptClocks();
+	for (size_t board = 0; board < NumCanBoards; ++board)
+	{
+		const CanMessageBuffer * const batch = batchBuffers[board];
+		if (batch != nullptr && (int32_t)(batch->msg.batch.startTime + batch->msg.batch.moves[0].startDelay - now) < (int32_t)BatchSendLeadClocks)
+		{
+			SendBatch(board);
 		}
 	}
 }
 
+// Return true if there are enough free buffers to prepare a move. This is how DDARing::PrepareMoves waits for the CAN sender to catch up.
 bool CanInterface::CanPrepareMove()
 {
-	return CanMessageBuffer::FreeBuffers() >= NumCanBoards;
+	if (CanMessageBuffer::FreeBuffers() >= MaxBuffersNeededPerMove)
+	{
+		return true;
+	}
+	++numMovesHeldBack;
+	return false;
+}
+
+void CanInterface::Diagnostics(MessageType mtype)
+{
+	uint32_t maxLatency, averageLatency;
+	CanSender::GetAndClearLatencies(maxLatency, averageLatency);
+	reprap.GetPlatform().MessageF(mtype, "CAN: %u buffers, %u free, min free %u, allocation failures %u, moves held back %u, queue latency max %.2fms avg %.2fms\n",
+									NumCanBuffers, CanMessageBuffer::FreeBuffers(), CanMessageBuffer::GetAndClearMinFreeBuffers(),
+									CanMessageBuffer::GetAndClearAllocationFailures(), numMovesHeldBack,
+									(double)(maxLatency * StepTimer::StepClocksToMillis), (double)(averageLatency * StepTimer::StepClocksToMillis));
+	reprap.GetPlatform().MessageF(mtype, "CAN heater reports received %u\n", heaterReportsReceived);
+	numMovesHeldBack = heaterReportsReceived = 0;
+}
+
+// Allocate a buffer for a housekeeping message. We leave enough buffers free for the Move task to prepare a move, so that heater messages never stall movement.
+static CanMessageBuffer *AllocateHousekeepingBuffer()
+{
+	return (CanMessageBuffer::FreeBuffers() > MaxBuffersNeededPerMove) ? CanMessageBuffer::Allocate() : nullptr;
+}
+
+// Process a message received from an expansion board. This is called by the CAN interrupt handler, so it must be quick.
+void CanInterface::ProcessReceivedMessage(uint32_t id, const uint8_t *data, size_t length)
+{
+	if (id >= CanHeaterReportMessageIdBase && id < CanHeaterReportMessageIdBase + NumCanBoards)
+	{
+		const size_t board = id - CanHeaterReportMessageIdBase;
+		CanHeaterReportMessage& msg = heaterReports[board];
+		memcpy(&msg, data, min<size_t>(length, sizeof(msg)));
+		if (length < sizeof(msg.numReports) + msg.numReports * sizeof(msg.reports[0]))
+		{
+			msg.numReports = (length <= sizeof(msg.numReports)) ? 0 : (length - sizeof(msg.numReports))/sizeof(msg.reports[0]);
+		}
+		whenHeaterReportReceived[board] = millis();
+		haveHeaterReport[board] = true;
+		++heaterReportsReceived;
+	}
+}
+
+// Get the latest report for heater and sensor n on a board. Return false if we don't have one from the last CanHeaterReportTimeout milliseconds.
+bool CanInterface::GetHeaterReport(size_t board, size_t heater, CanHeaterReport& report)
+{
+	if (board >= NumCanBoards)
+	{
+		return false;
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	const bool ok = haveHeaterReport[board] && heater < heaterReports[board].numReports && millis() - whenHeaterReportReceived[board] < CanHeaterReportTimeout;
+	if (ok)
+	{
+		report = heaterReports[board].reports[heater];
+	}
+	cpu_irq_restore(flags);
+	return ok;
+}
+
+// Tell a board the setpoint of one of its heaters. Return false if we couldn't, in which case the caller should try again later.
+bool CanInterface::SendHeaterSetpoint(size_t board, size_t heater, float setpoint, bool on, bool resetFault)
+{
+	CanMessageBuffer * const buf = AllocateHousekeepingBuffer();
+	if (buf == nullptr)
+	{
+		return false;
+	}
+
+	buf->id = CanHeaterSetpointMessageIdBase + board;
+	buf->dataLength = sizeof(CanHeaterSetpointMessage);
+	CanHeaterSetpointMessage& msg = buf->msg.heaterSetpoint;
+	msg.heater = heater;
+	msg.setpoint = setpoint;
+	msg.on = (on) ? 1 : 0;
+	msg.resetFault = (resetFault) ? 1 : 0;
+	msg.spare = 0;
+	CanSender::Send(buf, CanQueue::housekeeping);
+	return true;
+}
+
+// Tell a board the model and fault detection parameters of one of its heaters. Return false if we couldn't, in which case the caller should try again later.
+bool CanInterface::SendHeaterModel(size_t board, size_t heater, const FopDt& model, float maxTempExcursion, float maxFaultTime, bool invertPwmSignal)
+{
+	CanMessageBuffer * const buf = AllocateHousekeepingBuffer();
+	if (buf == nullptr)
+	{
+		return false;
+	}
+
+	buf->id = CanHeaterModelMessageIdBase + board;
+	buf->dataLength = sizeof(CanHeaterModelMessage);
+	CanHeaterModelMessage& msg = buf->msg.heaterModel;
+	msg.heater = heater;
+	msg.gain = model.GetGain();
+	msg.timeConstant = model.GetTimeConstant();
+	msg.deadTime = model.GetDeadTime();
+	msg.maxPwm = model.GetMaxPwm();
+	msg.voltage = model.GetVoltage();
+	msg.maxTempExcursion = maxTempExcursion;
+	msg.maxFaultTime = maxFaultTime;
+	msg.pwmFrequency = model.GetPwmFrequency();
+	msg.usePid = (model.UsePid()) ? 1 : 0;
+	msg.inverted = (model.IsInverted()) ? 1 : 0;
+	msg.invertPwmSignal = (invertPwmSignal) ? 1 : 0;
+	msg.enabled = (model.IsEnabled()) ? 1 : 0;
+	msg.spare = 0;
+	CanSender::Send(buf, CanQueue::housekeeping);
+	return true;
 }
 
 void CanInterface::InsertHiccup(uint32_t numClocks)
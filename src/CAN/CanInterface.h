@@ -9,21 +9,35 @@
 #define SRC_CAN_CANINTERFACE_H_
 
 #include "RepRapFirmware.h"
+#include "MessageType.h"
 
 #if SUPPORT_CAN_EXPANSION
 
 class DDA;
 class DriveMovement;
+class FopDt;
 struct PrepParams;
+struct CanHeaterReport;
 
 namespace CanInterface
 {
 	void Init();
 	void StartMovement(const DDA& dda);
 	void AddMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps);
+	void AddDeltaMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps, size_t tower);
+	void AddExtruderMovement(const DDA& dda, const PrepParams& params, size_t canDriver, int32_t steps, float pressureAdvance);
+	void CheckEndstop(size_t canDriver, bool stopAllDrives);
 	void FinishMovement(uint32_t moveStartTime);
+	void SendDueBatches();
 	bool CanPrepareMove();
 	void InsertHiccup(uint32_t numClocks);
+	void Diagnostics(MessageType mtype);
+
+	// Remote heaters and sensors
+	bool GetHeaterReport(size_t board, size_t heater, CanHeaterReport& report);	// get the latest report for a remote heater and sensor, returning false if it isn't recent
+	bool SendHeaterSetpoint(size_t board, size_t heater, float setpoint, bool on, bool resetFault);
+	bool SendHeaterModel(size_t board, size_t heater, const FopDt& model, float maxTempExcursion, float maxFaultTime, bool invertPwmSignal);
+	void ProcessReceivedMessage(uint32_t id, const uint8_t *data, size_t length);	// called by the CAN interrupt handler
 }
 
 #endif
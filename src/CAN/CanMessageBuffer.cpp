@@ -13,6 +13,8 @@
 
 CanMessageBuffer *CanMessageBuffer::freelist = nullptr;
 unsigned int CanMessageBuffer::numFree = 0;
+unsigned int CanMessageBuffer::minFree = 0;
+unsigned int CanMessageBuffer::allocationFailures = 0;
 
 void CanMessageBuffer::Init(unsigned int numCanBuffers)
 {
@@ -23,6 +25,7 @@ void CanMessageBuffer::Init(unsigned int numCanBuffers)
 		--numCanBuffers;
 		++numFree;
 	}
+	minFree = numFree;
 }
 
 CanMessageBuffer *CanMessageBuffer::Allocate()
@@ -34,6 +37,14 @@ CanMessageBuffer *CanMessageBuffer::Allocate()
 	{
 		freelist = ret->next;
 		--numFree;
+		if (numFree < minFree)
+		{
+			minFree = numFree;
+		}
+	}
+	else
+	{
+		++allocationFailures;
 	}
 	return ret;
 }
@@ -50,6 +61,22 @@ void CanMessageBuffer::Free(CanMessageBuffer*& buf)
 	}
 }
 
+unsigned int CanMessageBuffer::GetAndClearMinFreeBuffers()
+{
+	TaskCriticalSectionLocker lock;
+	const unsigned int ret = minFree;
+	minFree = numFree;
+	return ret;
+}
+
+unsigned int CanMessageBuffer::GetAndClearAllocationFailures()
+{
+	TaskCriticalSectionLocker lock;
+	const unsigned int ret = allocationFailures;
+	allocationFailures = 0;
+	return ret;
+}
+
 #endif
 
 // End
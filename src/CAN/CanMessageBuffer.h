@@ -24,14 +24,27 @@ public:
 	static CanMessageBuffer *Allocate();
 	static void Free(CanMessageBuffer*& buf);
 	static unsigned int FreeBuffers() { return numFree; }
+	static unsigned int GetAndClearMinFreeBuffers();			// the lowest number of free buffers since we last called this
+	static unsigned int GetAndClearAllocationFailures();
 
 	CanMessageBuffer *next;
-	unsigned int expansionBoardId;
-	CanMovementMessage msg;
+	uint32_t id;								// the CAN message ID
+	size_t dataLength;							// the number of bytes of msg to send
+	uint32_t whenQueued;						// the step clock when the buffer was queued for sending
+	union
+	{
+		CanMovementMessage move;
+		CanBatchedMovementMessage batch;
+		CanDriverParametersMessage driverParameters;
+		CanHeaterSetpointMessage heaterSetpoint;
+		CanHeaterModelMessage heaterModel;
+	} msg;
 
 private:
 	static CanMessageBuffer *freelist;
 	static unsigned int numFree;
+	static unsigned int minFree;
+	static unsigned int allocationFailures;
 };
 
 #endif
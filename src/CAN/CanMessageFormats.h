@@ -10,23 +10,40 @@
 
 constexpr unsigned int DriversPerCanBoard = 3;
 
+// CAN message IDs
+constexpr uint32_t CanTimeSyncMessageId = 0x0100;			// broadcast, so it has a lower ID than any message addressed to a particular board
+constexpr uint32_t CanMovementMessageIdBase = 0x0300;		// the expansion board ID is added to this
+constexpr uint32_t CanBatchedMovementMessageIdBase = 0x0400;	// the expansion board ID is added to this
+constexpr uint32_t CanDriverParametersMessageIdBase = 0x0500;	// the expansion board ID is added to this
+constexpr uint32_t CanHousekeepingMessageIdBase = 0x0700;	// all housekeeping and telemetry messages have IDs from here upwards, so that motion messages win arbitration
+constexpr uint32_t CanHeaterSetpointMessageIdBase = 0x0710;	// the expansion board ID is added to this
+constexpr uint32_t CanHeaterModelMessageIdBase = 0x0720;	// the expansion board ID is added to this
+constexpr uint32_t CanHeaterReportMessageIdBase = 0x0780;	// sent by the expansion boards, the expansion board ID is added to this
+constexpr uint32_t MaxCanBoards = 16;						// the number of board IDs available for each message type
+
+constexpr uint32_t CanTimeSyncInterval = 100;				// how often the main board sends time sync messages, in milliseconds
+constexpr uint32_t CanHeaterReportInterval = 250;			// how often each expansion board sends a heater report message, in milliseconds
+constexpr uint32_t CanHeaterReportTimeout = 1000;			// if the main board hasn't had a heater report from a board for this long, it treats the temperatures as bad
+constexpr uint32_t CanHeaterSetpointRefreshInterval = 1000;	// the main board resends the setpoint of each remote heater at least this often
+constexpr uint32_t CanHeaterSetpointTimeout = 3000;		// an expansion board turns off any heater whose setpoint it hasn't received for this long
+
+// In each bitmap, bit n refers to driver n on the expansion board
 union MovementFlags
 {
 	uint32_t u32;
 	struct
 	{
-		uint32_t	deltaDrives : 4,
-					pressureAdvanceDrives : 4,
-					endStopsToCheck : 4,
-					stopAllDrivesOnEndstopHit : 1;
+		uint32_t	deltaDrives : 4,				// the drivers that move delta towers, using the tower parameters from the last driver parameters message
+					pressureAdvanceDrives : 4,		// the extruder drivers that use pressure advance, using the time from the last driver parameters message
+					endStopsToCheck : 4,			// the drivers whose endstops the board must check, stopping the driver when its endstop is hit
+					stopAllDrivesOnEndstopHit : 1;	// when an endstop is hit stop all drivers on the board, not just the one whose endstop was hit
 	};
 };
 
 struct CanMovementMessage
 {
 	// Timing information
-	uint32_t timeNow;					// the time now, temporary until we have separate clock sync messages
-	uint32_t moveStartTime;				// when this move should start
+	uint32_t moveStartTime;				// when this move should start, in main board step clocks
 	uint32_t accelerationClocks;
 	uint32_t steadyClocks;
 	uint32_t decelClocks;
@@ -49,4 +66,162 @@ struct CanMovementMessage
 	void DebugPrint();
 };
 
+// Driver parameters message. The main board sends this before the first movement message that needs the parameters, and whenever they change.
+struct CanDriverParametersMessage
+{
+	uint32_t driver;					// the driver number on the expansion board
+	float towerX;						// delta tower position, used if the driver is in the deltaDrives bitmap of a movement message
+	float towerY;
+	float diagonalSquared;				// square of the delta diagonal rod length
+	float pressureAdvance;				// pressure advance in seconds, used if the driver is in the pressureAdvanceDrives bitmap of a movement message
+};
+
+// Short move within a batched movement message. Moves that take fewer than 65536 step clocks, each drive moving fewer than 32768 steps, with no delta,
+// pressure advance or endstop flags can be sent this way, so that a board executing many short moves gets several in each CAN frame.
+struct CanShortMove
+{
+	uint16_t startDelay;				// step clocks from when the previous move in the batch started, or from the batch start time for the first move
+	uint16_t accelerationClocks;
+	uint16_t steadyClocks;
+	uint16_t decelClocks;
+	uint16_t initialSpeedFraction;		// scaled so that 65535 is 1.0
+	uint16_t finalSpeedFraction;		// scaled so that 65535 is 1.0
+	int16_t steps[DriversPerCanBoard];	// net steps moved
+};
+
+struct CanBatchedMovementMessage
+{
+	static constexpr size_t MaxMoves = 3;
+
+	uint32_t startTime;					// the time that the first move's startDelay is relative to
+	uint32_t numMoves;
+	CanShortMove moves[MaxMoves];
+
+	void DebugPrint();
+};
+
+// Heater messages. Each expansion board runs the control loops of its own heaters, using sensor n on the board to control heater n.
+// The main board sends it the model and the setpoint of each heater, and the board sends back a single report message covering all its heaters and sensors.
+constexpr size_t MaxHeatersPerCanBoard = 7;
+
+enum class CanHeaterState : uint8_t
+{
+	off = 0,
+	active,
+	fault
+};
+
+struct CanHeaterSetpointMessage
+{
+	uint32_t heater;					// the heater number on the expansion board
+	float setpoint;						// the target temperature
+	uint8_t on;							// nonzero to control the heater at the setpoint, zero to turn it off
+	uint8_t resetFault;					// nonzero to clear a heater fault
+	uint16_t spare;
+};
+
+struct CanHeaterModelMessage
+{
+	uint32_t heater;					// the heater number on the expansion board
+	float gain;
+	float timeConstant;
+	float deadTime;
+	float maxPwm;
+	float voltage;						// the supply voltage when the heater was tuned, 0 if unknown
+	float maxTempExcursion;				// the fault detection parameters
+	float maxFaultTime;
+	uint16_t pwmFrequency;				// 0 to use the default frequency
+	uint8_t usePid;						// zero to use bang-bang control
+	uint8_t inverted;					// nonzero for inverse temperature control, e.g. a Peltier cooler
+	uint8_t invertPwmSignal;
+	uint8_t enabled;					// zero if the heater is disabled
+	uint16_t spare;
+};
+
+struct CanHeaterReport
+{
+	float temperature;					// the temperature of sensor n on the board
+	uint8_t error;						// a TemperatureError code, 0 if the temperature is good
+	uint8_t state;						// a CanHeaterState for heater n on the board
+	uint8_t averagePwm;					// the average PWM of heater n, scaled so that 255 is full power
+	uint8_t spare;
+};
+
+struct CanHeaterReportMessage
+{
+	uint32_t numReports;				// how many of the reports are valid, starting at sensor and heater 0
+	CanHeaterReport reports[MaxHeatersPerCanBoard];
+};
+
+// Time sync message. The sender timestamps each one in hardware when it starts to be transmitted, and sends that time in the next one,
+// so the time in the message isn't affected by how long the message waited for the bus. The receiver timestamps the start of each one that it receives.
+struct CanTimeSyncMessage
+{
+	uint32_t previousSendTime;			// the main board step clock when the time sync message with the previous sequence number started transmission
+	uint16_t sequenceNumber;			// incremented for each time sync message
+	uint16_t previousSendTimeValid;		// nonzero if previousSendTime is valid
+};
+
+// Model of the main board step clock, used by the expansion boards to convert movement start times to their own step clocks.
+// It is updated from pairs of main board and local times of the same time sync message, and tracks both the offset and the drift between the two clocks.
+class CanClockModel
+{
+public:
+	CanClockModel() : masterReference(0), localReference(0), localTimeReceived(0), ratio(1.0), sequenceNumber(0), haveLocalTime(false), synced(false) { }
+
+	// Process a time sync message. localTimeStarted is the local step clock when the message started, from the receive timestamp.
+	void ProcessTimeSync(const CanTimeSyncMessage& msg, uint32_t localTimeStarted)
+	{
+		if (msg.previousSendTimeValid != 0 && haveLocalTime && msg.sequenceNumber == (uint16_t)(sequenceNumber + 1))
+		{
+			Update(msg.previousSendTime, localTimeReceived);
+		}
+		localTimeReceived = localTimeStarted;
+		sequenceNumber = msg.sequenceNumber;
+		haveLocalTime = true;
+	}
+
+	bool IsSynced() const { return synced; }
+	uint32_t ToMaster(uint32_t localTime) const { return masterReference + lrintf((float)(int32_t)(localTime - localReference) * ratio); }
+	uint32_t ToLocal(uint32_t masterTime) const { return localReference + lrintf((float)(int32_t)(masterTime - masterReference)/ratio); }
+
+private:
+	static constexpr int32_t MaxSyncError = 1000;		// if the prediction is out by more than this many step clocks, start again
+	static constexpr float PhaseGain = 0.5;				// the fraction of the offset error we correct at each sync
+	static constexpr float RateGain = 0.25;				// the fraction of the drift error we correct at each sync
+
+	// Update the model from a main board time and the corresponding local time
+	void Update(uint32_t masterTime, uint32_t localTime)
+	{
+		const uint32_t predicted = ToMaster(localTime);
+		const int32_t error = (int32_t)(masterTime - predicted);
+		if (!synced || error > MaxSyncError || error < -MaxSyncError)
+		{
+			masterReference = masterTime;
+			localReference = localTime;
+			ratio = 1.0;
+			synced = true;
+		}
+		else
+		{
+			// Correct the drift using the error accumulated since the previous update, then move the reference point to this update and correct some of the offset
+			const int32_t localElapsed = (int32_t)(localTime - localReference);
+			if (localElapsed > 0)
+			{
+				ratio += RateGain * (float)error/(float)localElapsed;
+			}
+			masterReference = predicted + lrintf(PhaseGain * (float)error);
+			localReference = localTime;
+		}
+	}
+
+	uint32_t masterReference;			// a main board step clock time...
+	uint32_t localReference;			// ...and the corresponding local step clock time
+	uint32_t localTimeReceived;			// the local time when the last time sync message started
+	float ratio;						// the main board step clock rate divided by the local step clock rate
+	uint16_t sequenceNumber;			// the sequence number of the last time sync message
+	bool haveLocalTime;					// true if localTimeReceived is valid
+	bool synced;						// true if the model has been initialised
+};
+
 #endif /* SRC_CAN_CANMESSAGEFORMATS_H_ */
@@ -10,6 +10,7 @@
 #if SUPPORT_CAN_EXPANSION
 
 #include "CanMessageBuffer.h"
+#include "CanInterface.h"
 #include "Movement/StepTimer.h"
 #include "RTOSIface/RTOSIface.h"
 
@@ -28,13 +29,30 @@ const IRQn MCanIRQn = MCAN1_INT0_IRQn;
 constexpr size_t CanSenderTaskStackWords = 400;
 static Task<CanSenderTaskStackWords> canSenderTask;
 
-static CanMessageBuffer *pendingBuffers;
-static CanMessageBuffer *lastBuffer;			// only valid when pendingBuffers != nullptr
+// Send queues, one for each CanQueue value. We always send everything in the motion queue before anything in the housekeeping queue.
+constexpr size_t NumCanQueues = 2;
+static CanMessageBuffer *pendingBuffers[NumCanQueues];
+static CanMessageBuffer *lastBuffer[NumCanQueues];	// only valid when the corresponding pendingBuffers entry != nullptr
 
 static mcan_module mcan_instance;
 
 static volatile uint32_t canStatus = 0;
 
+// Time sync
+constexpr uint8_t TimeSyncMessageMarker = 1;	// the message marker we use in the transmit event FIFO to identify time sync messages
+constexpr uint32_t TimestampCalibrationMillis = 20;	// how long we measure the timestamp counter for, which must be less than the time it takes to wrap round
+
+static float stepClocksPerTimestampTick = 0.0;	// step clocks per tick of the CAN timestamp counter, or zero if the counter isn't running
+static volatile uint32_t lastTimeSyncSendTime;	// the step clock when the last time sync message started transmission
+static volatile bool haveTimeSyncSendTime = false;	// true if we have captured lastTimeSyncSendTime for the last time sync message
+static uint32_t whenLastTimeSyncQueued;			// the millis() time when we last sent a time sync message
+static uint16_t timeSyncSequenceNumber = 0;
+
+// Statistics of how long messages wait in the queue, in step clocks
+static uint32_t maxQueueLatency = 0;
+static uint32_t totalQueueLatency = 0;
+static uint32_t numMessagesSent = 0;
+
 enum class CanStatusBits : uint32_t
 {
 	receivedStandardFDMessage = 1,
@@ -75,13 +93,36 @@ static uint32_t GetAndClearStatusBits()
 /* mcan_transfer_message_setting */
 #define MCAN_TX_BUFFER_INDEX    0
 
+// Dedicated transmit buffers. When more than one of them has a message pending, the MCAN sends the one with the lowest ID first.
+// Motion message IDs are lower than housekeeping message IDs, so a pending motion message always wins over a pending housekeeping message.
+constexpr uint32_t TimeSyncTxBufferIndex = 0;
+constexpr uint32_t MotionTxBufferIndex = 1;
+constexpr uint32_t HousekeepingTxBufferIndex = 2;
+static_assert(CONF_MCAN1_TX_BUFFER_NUM > HousekeepingTxBufferIndex, "Not enough MCAN transmit buffers");
+
+constexpr uint32_t TxBufferWaitMillis = 10;		// how long we wait for a transmit buffer to be free before we cancel the message in it
+
 /* mcan_receive_message_setting */
-static volatile uint32_t standard_receive_index = 0;
 static volatile uint32_t extended_receive_index = 0;
 static struct mcan_rx_element_fifo_0 rx_element_fifo_0;
 static struct mcan_rx_element_fifo_1 rx_element_fifo_1;
 static struct mcan_rx_element_buffer rx_element_buffer;
 
+constexpr uint32_t HeaterReportFilterIndex = 0;
+constexpr uint32_t HeaterReportFilterMask = 0x7F0;	// accept heater reports from all board IDs
+static_assert(MaxCanBoards <= 16 && (CanHeaterReportMessageIdBase & ~HeaterReportFilterMask) == 0, "Heater report filter doesn't match the message IDs");
+
+// Set up a classic standard filter that puts heater reports from the expansion boards in receive FIFO 0
+static void SetHeaterReportFilter()
+{
+	mcan_standard_message_filter_element sd_filter;
+	mcan_get_standard_message_filter_element_default(&sd_filter);		// this gives us a classic filter that stores matching messages in FIFO 0
+	sd_filter.S0.bit.SFID1 = CanHeaterReportMessageIdBase;
+	sd_filter.S0.bit.SFID2 = HeaterReportFilterMask;
+	mcan_set_rx_standard_filter(&mcan_instance, &sd_filter, HeaterReportFilterIndex);
+	mcan_enable_interrupt(&mcan_instance, MCAN_RX_FIFO_0_NEW_MESSAGE);
+}
+
 // MCAN module initialization.
 static void configure_mcan()
 {
@@ -98,7 +139,23 @@ static void configure_mcan()
 	NVIC_ClearPendingIRQ(MCanIRQn);
 	NVIC_SetPriority(MCanIRQn, NvicPriorityMCan);
 	NVIC_EnableIRQ(MCanIRQn);
-	mcan_enable_interrupt(&mcan_instance, (mcan_interrupt_source)(MCAN_FORMAT_ERROR | MCAN_ACKNOWLEDGE_ERROR | MCAN_BUS_OFF));
+	mcan_enable_interrupt(&mcan_instance, (mcan_interrupt_source)(MCAN_FORMAT_ERROR | MCAN_ACKNOWLEDGE_ERROR | MCAN_BUS_OFF | MCAN_TX_EVENT_FIFO_NEW_ENTRY));
+	SetHeaterReportFilter();
+}
+
+// Measure the rate of the CAN timestamp counter, which counts CAN bit times, so that we can convert hardware timestamps to step clocks
+static void CalibrateTimestampCounter()
+{
+	irqflags_t flags = cpu_irq_save();
+	const uint16_t startTicks = (uint16_t)MCAN_MODULE->MCAN_TSCV;
+	const uint32_t startClocks = StepTimer::GetInterruptClocks();
+	cpu_irq_restore(flags);
+	delay(TimestampCalibrationMillis);
+	flags = cpu_irq_save();
+	const uint16_t ticks = (uint16_t)MCAN_MODULE->MCAN_TSCV - startTicks;
+	const uint32_t clocks = StepTimer::GetInterruptClocks() - startClocks;
+	cpu_irq_restore(flags);
+	stepClocksPerTimestampTick = (ticks != 0) ? (float)clocks/(float)ticks : 0.0;
 }
 
 #if 0
@@ -187,28 +244,67 @@ static status_code mcan_send_standard_message(uint32_t id_value, const uint8_t *
 
 #endif
 
-// Send standard CAN message in fd mode,
-static status_code mcan_fd_send_standard_message(uint32_t id_value, const uint8_t *data)
+// Return the data length code for a CAN FD message, rounding the length up to the next size that CAN FD supports
+static uint32_t GetDataLengthCode(size_t length)
+{
+	return (length <= 8) ? length
+			: (length <= 24) ? (length + 3)/4 + 6
+				: (length <= 32) ? MCAN_TX_ELEMENT_T1_DLC_DATA32_Val
+					: (length <= 48) ? MCAN_TX_ELEMENT_T1_DLC_DATA48_Val
+						: MCAN_TX_ELEMENT_T1_DLC_DATA64_Val;
+}
+
+// Return the number of data bytes in a CAN FD message from its data length code
+static size_t GetDataLength(uint32_t dlc)
+{
+	return (dlc <= 8) ? dlc
+			: (dlc <= 12) ? (dlc - 6) * 4
+				: (dlc == 13) ? 32
+					: (dlc == 14) ? 48
+						: 64;
+}
+
+// Wait until a transmit buffer is free. If the message in it hasn't been sent in time, for example because no other node is acknowledging messages, cancel it.
+static void WaitForTxBuffer(uint32_t bufferIndex)
+{
+	for (uint32_t i = 0; (MCAN_MODULE->MCAN_TXBRP & (1u << bufferIndex)) != 0; ++i)
+	{
+		if (i == TxBufferWaitMillis)
+		{
+			MCAN_MODULE->MCAN_TXBCR = 1u << bufferIndex;
+			while ((MCAN_MODULE->MCAN_TXBRP & (1u << bufferIndex)) != 0) { }
+			break;
+		}
+		delay(1);
+	}
+}
+
+// Send standard CAN message in fd mode using the specified dedicated transmit buffer, padding the data with zeros up to the next length that CAN FD supports.
+// If eventMarker is nonzero then we request a transmit event carrying that marker, which gives us the time at which the message started transmission.
+static status_code mcan_fd_send_standard_message(uint32_t id_value, const uint8_t *data, size_t length, uint8_t eventMarker, uint32_t bufferIndex)
 {
 	struct mcan_tx_element tx_element;
 
 	mcan_get_tx_buffer_element_defaults(&tx_element);
 	tx_element.T0.reg |= MCAN_TX_ELEMENT_T0_STANDARD_ID(id_value);
-	tx_element.T1.reg = (MCAN_TX_ELEMENT_T1_DLC(MCAN_TX_ELEMENT_T1_DLC_DATA64_Val) | MCAN_TX_ELEMENT_T1_FDF /*| MCAN_TX_ELEMENT_T1_BRS*/);
+	tx_element.T1.reg = (MCAN_TX_ELEMENT_T1_DLC(GetDataLengthCode(length)) | MCAN_TX_ELEMENT_T1_FDF /*| MCAN_TX_ELEMENT_T1_BRS*/);
+	if (eventMarker != 0)
+	{
+		tx_element.T1.reg |= MCAN_TX_ELEMENT_T1_EFC | MCAN_TX_ELEMENT_T1_MM(eventMarker);
+	}
 	for (uint32_t i = 0; i < CONF_MCAN_ELEMENT_DATA_SIZE; i++)
 	{
-		tx_element.data[i] = *data;
-		data++;
+		tx_element.data[i] = (i < length) ? data[i] : 0;
 	}
 
-	status_code rc = mcan_set_tx_buffer_element(&mcan_instance, &tx_element, MCAN_TX_BUFFER_INDEX);
+	status_code rc = mcan_set_tx_buffer_element(&mcan_instance, &tx_element, bufferIndex);
 	if (rc != STATUS_OK)
 	{
 		DEBUG_HERE;
 	}
 	else
 	{
-		rc = mcan_tx_transfer_request(&mcan_instance, 1 << MCAN_TX_BUFFER_INDEX);
+		rc = mcan_tx_transfer_request(&mcan_instance, 1 << bufferIndex);
 		if (rc != STATUS_OK)
 		{
 			DEBUG_HERE;
@@ -278,21 +374,26 @@ void MCAN1_INT0_Handler(void)
 	if (status & MCAN_RX_FIFO_0_NEW_MESSAGE)
 	{
 		mcan_clear_interrupt_status(&mcan_instance, MCAN_RX_FIFO_0_NEW_MESSAGE);
-		mcan_get_rx_fifo_0_element(&mcan_instance, &rx_element_fifo_0, standard_receive_index);
-		mcan_rx_fifo_acknowledge(&mcan_instance, 0, standard_receive_index);
-		standard_receive_index++;
-		if (standard_receive_index == CONF_MCAN1_RX_FIFO_0_NUM)
+		while ((MCAN_MODULE->MCAN_RXF0S & MCAN_RXF0S_F0FL_Msk) != 0)
 		{
-			standard_receive_index = 0;
-		}
+			const uint32_t index = (MCAN_MODULE->MCAN_RXF0S & MCAN_RXF0S_F0GI_Msk) >> MCAN_RXF0S_F0GI_Pos;
+			mcan_get_rx_fifo_0_element(&mcan_instance, &rx_element_fifo_0, index);
+			mcan_rx_fifo_acknowledge(&mcan_instance, 0, index);
 
-		if (rx_element_fifo_0.R1.bit.EDL)
-		{
-			canStatus |= (uint32_t)CanStatusBits::receivedStandardFDMessageInFIFO0;
-		}
-		else
-		{
-			canStatus |= (uint32_t)CanStatusBits::receivedStandardNormalMessageInFIFO0;
+			if (rx_element_fifo_0.R1.bit.EDL)
+			{
+				canStatus |= (uint32_t)CanStatusBits::receivedStandardFDMessageInFIFO0;
+			}
+			else
+			{
+				canStatus |= (uint32_t)CanStatusBits::receivedStandardNormalMessageInFIFO0;
+			}
+
+			if (!rx_element_fifo_0.R0.bit.XTD)
+			{
+				// Standard IDs are held in the top 11 bits of the 29-bit ID field
+				CanInterface::ProcessReceivedMessage((rx_element_fifo_0.R0.bit.ID >> 18) & 0x7FF, rx_element_fifo_0.data, GetDataLength(rx_element_fifo_0.R1.bit.DLC));
+			}
 		}
 	}
 
@@ -329,76 +430,169 @@ void MCAN1_INT0_Handler(void)
 		canStatus |= (uint32_t)CanStatusBits::busOff;
 		configure_mcan();
 	}
+
+	// Transmit events are only requested for time sync messages. Use the hardware timestamp to find the step clock when the message started transmission.
+	if (status & MCAN_TX_EVENT_FIFO_NEW_ENTRY)
+	{
+		mcan_clear_interrupt_status(&mcan_instance, MCAN_TX_EVENT_FIFO_NEW_ENTRY);
+		const uint32_t stepClocksNow = StepTimer::GetInterruptClocks();
+		const uint16_t timestampNow = (uint16_t)MCAN_MODULE->MCAN_TSCV;
+		while ((MCAN_MODULE->MCAN_TXEFS & MCAN_TXEFS_EFFL_Msk) != 0)
+		{
+			const uint32_t index = (MCAN_MODULE->MCAN_TXEFS & MCAN_TXEFS_EFGI_Msk) >> MCAN_TXEFS_EFGI_Pos;
+			mcan_tx_event_element txEvent;
+			mcan_get_tx_event_fifo_element(&mcan_instance, &txEvent, index);
+			mcan_tx_event_fifo_acknowledge(&mcan_instance, index);
+			if (txEvent.E1.bit.MM == TimeSyncMessageMarker)
+			{
+				const uint16_t ticksSinceStarted = timestampNow - (uint16_t)txEvent.E1.bit.TXTS;
+				lastTimeSyncSendTime = stepClocksNow - lrintf(ticksSinceStarted * stepClocksPerTimestampTick);
+				haveTimeSyncSendTime = true;
+			}
+		}
+	}
 }
 
 // -------------------- End of code adapted from Atmel quick start example ----------------------------------
 
-static_assert(CONF_MCAN_ELEMENT_DATA_SIZE == sizeof(CanMovementMessage), "Mismatched message sizes");
+// Send a time sync message, including the time at which the previous one started transmission
+static void SendTimeSync()
+{
+	CanTimeSyncMessage msg;
+	const irqflags_t flags = cpu_irq_save();
+	msg.previousSendTime = lastTimeSyncSendTime;
+	msg.previousSendTimeValid = (haveTimeSyncSendTime && stepClocksPerTimestampTick != 0.0) ? 1 : 0;
+	haveTimeSyncSendTime = false;
+	cpu_irq_restore(flags);
+	msg.sequenceNumber = ++timeSyncSequenceNumber;
+	WaitForTxBuffer(TimeSyncTxBufferIndex);
+	mcan_fd_send_standard_message(CanTimeSyncMessageId, reinterpret_cast<const uint8_t*>(&msg), sizeof(msg), TimeSyncMessageMarker, TimeSyncTxBufferIndex);
+	whenLastTimeSyncQueued = millis();
+}
+
+// Remove the first buffer from the highest priority queue that isn't empty
+static CanMessageBuffer *GetNextBuffer(size_t& queue)
+{
+	TaskCriticalSectionLocker lock;
+	for (queue = 0; queue < NumCanQueues; ++queue)
+	{
+		CanMessageBuffer * const buf = pendingBuffers[queue];
+		if (buf != nullptr)
+		{
+			pendingBuffers[queue] = buf->next;
+			return buf;
+		}
+	}
+	return nullptr;
+}
+
+static_assert(sizeof(CanMovementMessage) <= CONF_MCAN_ELEMENT_DATA_SIZE, "Movement message too long");
+static_assert(sizeof(CanBatchedMovementMessage) <= CONF_MCAN_ELEMENT_DATA_SIZE, "Batched movement message too long");
+static_assert(sizeof(CanTimeSyncMessage) <= CONF_MCAN_ELEMENT_DATA_SIZE, "Time sync message too long");
+static_assert(sizeof(CanHeaterModelMessage) <= CONF_MCAN_ELEMENT_DATA_SIZE, "Heater model message too long");
+static_assert(sizeof(CanHeaterReportMessage) <= CONF_MCAN_ELEMENT_DATA_SIZE, "Heater report message too long");
 
+// The sender task sends the queued messages in priority order, and sends a time sync message every CanTimeSyncInterval milliseconds
 extern "C" void CanSenderLoop(void *)
 {
 	for (;;)
 	{
-		TaskBase::Take(Mutex::TimeoutUnlimited);
-		while (pendingBuffers != nullptr)
+		const uint32_t timeSinceTimeSync = millis() - whenLastTimeSyncQueued;
+		if (timeSinceTimeSync >= CanTimeSyncInterval)
+		{
+			SendTimeSync();
+			continue;
+		}
+
+		size_t queue;
+		CanMessageBuffer * const buf = GetNextBuffer(queue);
+		if (buf == nullptr)
+		{
+			TaskBase::Take(CanTimeSyncInterval - timeSinceTimeSync);
+			continue;
+		}
+
+		// Send the message
+		const uint32_t latency = StepTimer::GetInterruptClocks() - buf->whenQueued;
 		{
-			CanMessageBuffer *buf;
+			TaskCriticalSectionLocker lock;
+			if (latency > maxQueueLatency)
 			{
-				TaskCriticalSectionLocker lock;
-				buf = pendingBuffers;
-				pendingBuffers = buf->next;
+				maxQueueLatency = latency;
 			}
-
-			// Send the message
-			buf->msg.timeNow = StepTimer::GetInterruptClocks();
-			mcan_fd_send_standard_message(buf->expansionBoardId | 0x0300, reinterpret_cast<uint8_t*>(&(buf->msg)));
+			totalQueueLatency += latency;
+			++numMessagesSent;
+		}
+		const uint32_t bufferIndex = ((CanQueue)queue == CanQueue::motion) ? MotionTxBufferIndex : HousekeepingTxBufferIndex;
+		WaitForTxBuffer(bufferIndex);
+		mcan_fd_send_standard_message(buf->id, reinterpret_cast<const uint8_t*>(&(buf->msg)), buf->dataLength, 0, bufferIndex);
 #ifdef CAN_DEBUG
-			// Display a debug message too
-			debugPrintf("CCCR %08" PRIx32 ", PSR %08" PRIx32 ", ECR %08" PRIx32 ", TXBRP %08" PRIx32 ", TXBTO %08" PRIx32 ", st %08" PRIx32 "\n",
-						MCAN1->MCAN_CCCR, MCAN1->MCAN_PSR, MCAN1->MCAN_ECR, MCAN1->MCAN_TXBRP, MCAN1->MCAN_TXBTO, GetAndClearStatusBits());
-			buf->msg.DebugPrint();
-			delay(50);
-			debugPrintf("CCCR %08" PRIx32 ", PSR %08" PRIx32 ", ECR %08" PRIx32 ", TXBRP %08" PRIx32 ", TXBTO %08" PRIx32 ", st %08" PRIx32 "\n",
-						MCAN1->MCAN_CCCR, MCAN1->MCAN_PSR, MCAN1->MCAN_ECR, MCAN1->MCAN_TXBRP, MCAN1->MCAN_TXBTO, GetAndClearStatusBits());
-#else
-			delay(2);		// until we have the transmit fifo working, we need to delay to allow the message to be sent
-#endif
-			// Free the message buffer.
-			CanMessageBuffer::Free(buf);
+		// Display a debug message too
+		debugPrintf("CCCR %08" PRIx32 ", PSR %08" PRIx32 ", ECR %08" PRIx32 ", TXBRP %08" PRIx32 ", TXBTO %08" PRIx32 ", st %08" PRIx32 "\n",
+					MCAN1->MCAN_CCCR, MCAN1->MCAN_PSR, MCAN1->MCAN_ECR, MCAN1->MCAN_TXBRP, MCAN1->MCAN_TXBTO, GetAndClearStatusBits());
+		if (buf->id >= CanMovementMessageIdBase && buf->id < CanBatchedMovementMessageIdBase)
+		{
+			buf->msg.move.DebugPrint();
+		}
+		else if (buf->id >= CanBatchedMovementMessageIdBase && buf->id < CanDriverParametersMessageIdBase)
+		{
+			buf->msg.batch.DebugPrint();
 		}
+		delay(50);
+		debugPrintf("CCCR %08" PRIx32 ", PSR %08" PRIx32 ", ECR %08" PRIx32 ", TXBRP %08" PRIx32 ", TXBTO %08" PRIx32 ", st %08" PRIx32 "\n",
+					MCAN1->MCAN_CCCR, MCAN1->MCAN_PSR, MCAN1->MCAN_ECR, MCAN1->MCAN_TXBRP, MCAN1->MCAN_TXBTO, GetAndClearStatusBits());
+#endif
+		// The MCAN has its own copy of the message, so we can free the message buffer
+		CanMessageBuffer::Free(buf);
 	}
 }
 
 void CanSender::Init()
 {
-	pendingBuffers = nullptr;
+	for (size_t i = 0; i < NumCanQueues; ++i)
+	{
+		pendingBuffers[i] = nullptr;
+	}
 
 	ConfigurePin(g_APinDescription[APIN_CAN1_TX]);
 	ConfigurePin(g_APinDescription[APIN_CAN1_RX]);
 	pmc_enable_upll_clock();			// configure_mcan sets up PCLK5 to be the UPLL divided by something, so make sure the UPLL is running
 	configure_mcan();
+	CalibrateTimestampCounter();
+	whenLastTimeSyncQueued = millis() - CanTimeSyncInterval;
 
 	// Create the task that sends CAN messages
 	canSenderTask.Create(CanSenderLoop, "CanSender", nullptr, TaskPriority::CanSenderPriority);
 }
 
-// Add a buffer to the end of the send queue
-void CanSender::Send(CanMessageBuffer *buf)
+// Add a buffer to the end of a send queue. Messages in the same queue are sent in the order they were queued.
+void CanSender::Send(CanMessageBuffer *buf, CanQueue queue)
 {
 	buf->next = nullptr;
+	buf->whenQueued = StepTimer::GetInterruptClocks();
+	const size_t q = (size_t)queue;
 	TaskCriticalSectionLocker lock;
 
-	if (pendingBuffers == nullptr)
+	if (pendingBuffers[q] == nullptr)
 	{
-		pendingBuffers = lastBuffer = buf;
+		pendingBuffers[q] = lastBuffer[q] = buf;
 	}
 	else
 	{
-		lastBuffer->next = buf;
+		lastBuffer[q]->next = buf;
+		lastBuffer[q] = buf;
 	}
 	canSenderTask.Give();
 }
 
+void CanSender::GetAndClearLatencies(uint32_t& maxLatency, uint32_t& averageLatency)
+{
+	TaskCriticalSectionLocker lock;
+	maxLatency = maxQueueLatency;
+	averageLatency = (numMessagesSent == 0) ? 0 : totalQueueLatency/numMessagesSent;
+	maxQueueLatency = totalQueueLatency = numMessagesSent = 0;
+}
+
 #endif
 
 // End
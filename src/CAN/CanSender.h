@@ -14,10 +14,18 @@
 
 class CanMessageBuffer;
 
+// The send queues in priority order. Housekeeping messages must use IDs from CanHousekeepingMessageIdBase upwards, so that they lose arbitration to motion messages.
+enum class CanQueue : uint8_t
+{
+	motion = 0,							// movement messages and the driver parameters they depend on
+	housekeeping						// everything else, e.g. requests for temperatures, driver status and fan speeds
+};
+
 namespace CanSender
 {
 	void Init();
-	void Send(CanMessageBuffer *buf);
+	void Send(CanMessageBuffer *buf, CanQueue queue = CanQueue::motion);
+	void GetAndClearLatencies(uint32_t& maxLatency, uint32_t& averageLatency);	// get the time in step clocks that messages waited in the queue
 }
 
 #endif
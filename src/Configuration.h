@@ -57,6 +57,7 @@ constexpr uint32_t FanCheckInterval = 500;				// Milliseconds
 constexpr uint32_t OpenLoadTimeout = 500;				// Milliseconds
 constexpr uint32_t MinimumWarningInterval = 4000;		// Milliseconds, must be at least as long as FanCheckInterval
 constexpr uint32_t LogFlushInterval = 15000;			// Milliseconds
+constexpr uint32_t LogFileExtent = 16 * 1024;			// The log file is extended by this much at a time so that its clusters are allocated together
 constexpr uint32_t DriverCoolingTimeout = 4000;			// Milliseconds
 constexpr float DefaultMessageTimeout = 10.0;			// How long a message is displayed by default, in seconds
 
@@ -72,8 +73,12 @@ constexpr unsigned int AUX2_BAUD_RATE = 115200;			// Ditto - for second auxiliar
 constexpr uint32_t SERIAL_MAIN_TIMEOUT = 1000;			// timeout in ms for sending data to the main serial/USB port
 
 // Heater values
-constexpr uint32_t HeatSampleIntervalMillis = 250;		// interval between taking temperature samples
+constexpr uint32_t HeatSampleIntervalMillis = 250;		// default interval between taking temperature samples
+constexpr uint32_t MinHeatSampleIntervalMillis = 50;	// shortest sample interval that M570 can set for a heater
+constexpr uint32_t MaxHeatSampleIntervalMillis = 2000;	// longest sample interval that M570 can set for a heater, must be well below maxPidSpinDelay
 constexpr float HeatPwmAverageTime = 5.0;				// Seconds
+constexpr unsigned int MaxHeatersTunedAtOnce = 4;		// how many heaters we allow to be auto tuned at the same time, to limit the total power drawn
+constexpr unsigned int MaxBedOrChamberHeatersTunedAtOnce = 1;	// how many of them may be bed or chamber heaters, which draw the most power
 
 constexpr float TEMPERATURE_CLOSE_ENOUGH = 1.0;			// Celsius
 constexpr float TEMPERATURE_LOW_SO_DONT_CARE = 40.0;	// Celsius
@@ -139,7 +144,7 @@ constexpr float DefaultMaxHeatingFaultTime = 5.0;		// How many seconds we allow
 constexpr float AllowedTemperatureDerivativeNoise = 0.25;	// How much fluctuation in the averaged temperature derivative we allow
 constexpr float MaxAmbientTemperature = 45.0;			// We expect heaters to cool to this temperature or lower when switched off
 constexpr float NormalAmbientTemperature = 25.0;		// The ambient temperature we assume - allow for the printer heating its surroundings a little
-constexpr float DefaultMaxTempExcursion = 15.0;			// How much error we tolerate when maintaining temperature before deciding that a heater fault has occurred
+constexpr float DefaultMaxTempExcursion = 15.0;			// How much error we tolerate when maintaining temperature, or departure from the model prediction, before deciding that a heater fault has occurred
 constexpr float MinimumConnectedTemperature = -5.0;		// Temperatures below this we treat as a disconnected thermistor
 
 static_assert(DefaultMaxTempExcursion > TEMPERATURE_CLOSE_ENOUGH, "DefaultMaxTempExcursion is too low");
@@ -156,6 +161,8 @@ constexpr unsigned int FirstPT1000Channel = 500;		// Temperature sensor channels
 constexpr unsigned int CpuTemperatureSenseChannel = 1000;  // Sensor 1000 is the MCU's own temperature sensor
 constexpr unsigned int FirstTmcDriversSenseChannel = 1001; // Sensors 1001..1002 are the TMC2660 driver temperature sense
 constexpr unsigned int NumTmcDriversSenseChannels = 2;	// Sensors 1001..1002 are the TMC2660 driver temperature sense
+constexpr unsigned int FirstRemoteSensorChannel = 2000;	// Sensors 2000... are on CAN expansion boards, e.g. 2102 is sensor 2 on board 1. A heater that uses one runs on that board.
+constexpr unsigned int RemoteSensorChannelsPerBoard = 100;
 
 // PWM frequencies
 constexpr PwmFrequency SlowHeaterPwmFreq = 10;			// slow PWM frequency for bed and chamber heaters, compatible with DC/AC SSRs
@@ -216,10 +223,18 @@ constexpr float DefaultZProbeTravelSpeed = 100.0;		// Default speed for travel t
 constexpr float ZProbeMaxAcceleration = 250.0;			// Maximum Z acceleration to use at the start of a probing move
 constexpr size_t MaxZProbeProgramBytes = 8;				// Maximum number of bytes in a Z probe program
 constexpr uint32_t ProbingSpeedReductionFactor = 3;		// The factor by which we reduce the Z probing speed when we get a 'near' indication
+constexpr float ZProbeApproachBackOff = 1.0;				// How far we raise the probe after the fast approach tap before probing slowly, in mm
 constexpr float DefaultZProbeTolerance = 0.03;			// How close the Z probe trigger height from consecutive taps must be
 constexpr uint8_t DefaultZProbeTaps = 1;				// The maximum number of times we probe each point
 constexpr int DefaultZProbeADValue = 500;				// Default trigger threshold
 
+// Cornering when junction deviation is enabled
+constexpr float MaxArcJunctionAngle = 0.2618;			// 15 degrees in radians. Junctions that turn through less than this between segments of similar length are taken to be part of a curve
+constexpr float MaxArcSegmentLengthRatio = 2.0;			// The most that the lengths of two segments of a curve may differ by
+
+// Baby stepping
+constexpr float MaxBabySteppingSpeedFraction = 0.1;		// The fastest that we superimpose Z baby stepping on a move, as a fraction of the move speed
+
 constexpr float TRIANGLE_ZERO = -0.001;					// Millimetres
 constexpr float SILLY_Z_VALUE = -9999.0;				// Millimetres
 
@@ -234,6 +249,7 @@ constexpr size_t MaxVariableNameLength = 120;
 constexpr size_t MaxFilenameLength = 100;
 constexpr size_t MaxVariableNameLength = 100;
 #endif
+constexpr size_t MaxObjectModelSubscriptions = 10;		// Maximum number of named object model reports that clients can register with M408
 
 constexpr size_t StringLength20 = 20;
 constexpr size_t StringLength40 = 40;
@@ -250,13 +266,14 @@ constexpr size_t MediumStringLength = MaxFilenameLength;
 #if SAM4E || SAM4S || SAME70
 // Increased GCODE_LENGTH on the SAM4 because M587 and M589 commands on the Duet WiFi can get very long
 constexpr size_t GCODE_LENGTH = 161;					// maximum number of non-comment characters in a line of GCode including the null terminator
-constexpr size_t SHORT_GCODE_LENGTH = 61;				// maximum length of a GCode that we can queue to synchronise it to a move
+constexpr size_t SHORT_GCODE_LENGTH = 61;				// maximum length of a short GCode that we generate internally
 #else
 constexpr size_t GCODE_LENGTH = 101;					// maximum number of non-comment characters in a line of GCode including the null terminator
-constexpr size_t SHORT_GCODE_LENGTH = 61;				// maximum length of a GCode that we can queue to synchronise it to a move
+constexpr size_t SHORT_GCODE_LENGTH = 61;				// maximum length of a short GCode that we generate internally
 #endif
 
 // Output buffer length and number of buffers
+// There are two sizes of buffer. Short replies such as "ok" use the small ones, and long responses are continued in the large ones.
 // When using RTOS, it is best if it is possible to fit an HTTP response header in a single buffer. Our headers are currently about 230 bytes long.
 // A note on reserved buffers: the worst case is when a GCode with a long response is processed. After string the response, there must be enough buffer space
 // for the HTTP responder to return a status response. Otherwise DWC never gets to know that it needs to make a rr_reply call and the system deadlocks.
@@ -264,23 +281,35 @@ constexpr size_t SHORT_GCODE_LENGTH = 61;				// maximum length of a GCode that w
 constexpr size_t OUTPUT_BUFFER_SIZE = 256;				// How many bytes does each OutputBuffer hold?
 constexpr size_t OUTPUT_BUFFER_COUNT = 32;				// How many OutputBuffer instances do we have?
 constexpr size_t RESERVED_OUTPUT_BUFFERS = 4;			// Number of reserved output buffers after long responses, enough to hold a status response
+constexpr size_t SMALL_OUTPUT_BUFFER_SIZE = 64;			// How many bytes does each small OutputBuffer hold?
+constexpr size_t SMALL_OUTPUT_BUFFER_COUNT = 24;		// How many small OutputBuffer instances do we have?
 #elif SAM4E || SAM4S
 constexpr size_t OUTPUT_BUFFER_SIZE = 256;				// How many bytes does each OutputBuffer hold?
-constexpr size_t OUTPUT_BUFFER_COUNT = 24;				// How many OutputBuffer instances do we have?
+constexpr size_t OUTPUT_BUFFER_COUNT = 20;				// How many OutputBuffer instances do we have?
 constexpr size_t RESERVED_OUTPUT_BUFFERS = 4;			// Number of reserved output buffers after long responses, enough to hold a status response
+constexpr size_t SMALL_OUTPUT_BUFFER_SIZE = 64;			// How many bytes does each small OutputBuffer hold?
+constexpr size_t SMALL_OUTPUT_BUFFER_COUNT = 16;		// How many small OutputBuffer instances do we have?
 #elif SAM3XA
 constexpr size_t OUTPUT_BUFFER_SIZE = 256;				// How many bytes does each OutputBuffer hold?
-constexpr size_t OUTPUT_BUFFER_COUNT = 16;				// How many OutputBuffer instances do we have?
+constexpr size_t OUTPUT_BUFFER_COUNT = 14;				// How many OutputBuffer instances do we have?
 constexpr size_t RESERVED_OUTPUT_BUFFERS = 2;			// Number of reserved output buffers after long responses
+constexpr size_t SMALL_OUTPUT_BUFFER_SIZE = 64;			// How many bytes does each small OutputBuffer hold?
+constexpr size_t SMALL_OUTPUT_BUFFER_COUNT = 8;			// How many small OutputBuffer instances do we have?
 #elif __LPC17xx__
 constexpr uint16_t OUTPUT_BUFFER_SIZE = 256;            // How many bytes does each OutputBuffer hold?
 constexpr size_t OUTPUT_BUFFER_COUNT = 15;              // How many OutputBuffer instances do we have?
 constexpr size_t RESERVED_OUTPUT_BUFFERS = 2;           // Number of reserved output buffers after long responses. Must be enough for an HTTP header
+constexpr size_t SMALL_OUTPUT_BUFFER_SIZE = 64;         // How many bytes does each small OutputBuffer hold?
+constexpr size_t SMALL_OUTPUT_BUFFER_COUNT = 0;         // How many small OutputBuffer instances do we have? We are too short of RAM to have any.
 #else
 # error
 #endif
 
-const size_t maxQueuedCodes = 16;						// How many codes can be queued?
+const size_t DefaultQueuedCodes = 16;					// How many codes can be queued to synchronise them to moves, unless M595 increases it
+const size_t MaxQueuedCodes = 200;						// The most codes that M595 may allow to be queued
+const size_t DefaultCodeQueueBufferSize = 1024;			// The default size of the buffer that holds the text of queued codes
+const size_t MaxCodeQueueBufferSize = 8192;				// The largest buffer for queued codes that M595 may allocate
+const size_t MaxLaserRasterPixels = 48;					// The most laser power values that a single G1 raster move may have
 
 // Move system
 constexpr float DefaultFeedRate = 3000.0;				// The initial requested feed rate after resetting the printer, in mm/min
@@ -292,11 +321,13 @@ constexpr float MaxArcDeviation = 0.02;					// maximum deviation from ideal arc
 constexpr float MinArcSegmentLength = 0.1;				// G2 and G3 arc movement commands get split into segments at least this long
 constexpr float MaxArcSegmentLength = 2.0;				// G2 and G3 arc movement commands get split into segments at most this long
 constexpr float MinArcSegmentsPerSec = 50;
+constexpr unsigned int ArcCorrectionSegments = 16;		// when generating arc segments by rotation, calculate the position exactly this often to stop rounding errors building up
 
 constexpr uint32_t DefaultIdleTimeout = 30000;			// Milliseconds
 constexpr float DefaultIdleCurrentFactor = 0.3;			// Proportion of normal motor current that we use for idle hold
 
 constexpr float DefaultNonlinearExtrusionLimit = 0.2;	// Maximum additional commanded extrusion to compensate for nonlinearity
+constexpr float MaxPressureAdvanceSmoothing = 0.2;		// Maximum time in seconds over which pressure advance may be smoothed
 constexpr size_t NumRestorePoints = 6;					// Number of restore points, must be at least 3
 
 constexpr float AxisRoundingError = 0.02;				// Maximum possible error when we round trip a machine position to motor coordinates and back
@@ -329,14 +360,28 @@ constexpr size_t MaxI2cBytes = 32;						// max bytes in M260 or M261 command
 #if defined(__LPC17xx__)
 # if defined (ESP_NETWORKING)
 constexpr size_t MAX_FILES = 10;						// Must be large enough to handle the max number of concurrent web requests + file being printed + macros being executed + log file
+constexpr size_t FilesReservedForJobs = 3;				// how many of those may only be used by the file being printed, macros and the resume file
 # else
 constexpr size_t MAX_FILES = 4;							// Must be large enough to handle the max number of concurrent web requests + file being printed + macros being executed + log file
+constexpr size_t FilesReservedForJobs = 2;				// how many of those may only be used by the file being printed, macros and the resume file
 # endif
 #else
-constexpr size_t MAX_FILES = 10;						// Must be large enough to handle the max number of concurrent web requests + file being printed + macros being executed + log file
+constexpr size_t MAX_FILES = 18;						// Must be large enough to handle the max number of concurrent web requests + file being printed + macros being executed + log file
+constexpr size_t FilesReservedForJobs = MaxStackDepth + 3;	// enough for the file being printed, a full macro stack, the resume file and the next queued job
 #endif
 
+static_assert(FilesReservedForJobs < MAX_FILES, "Not enough file entries for general use");
+
 constexpr size_t FILE_BUFFER_SIZE = 128;
+constexpr size_t MaxQueuedJobs = 8;						// the most files that can be queued with M33 to print after the current one
+constexpr size_t SectorCacheEntries = 8;				// number of FAT and directory sectors that we keep in RAM if SUPPORT_SECTOR_CACHE is set
+
+constexpr size_t MaxClusterMaps = 2;					// How many files may have cluster maps for fast seeking, normally the file being printed and the one being parsed
+constexpr size_t ClusterMapEntries = 64;				// Size of a cluster map, which needs 2 entries per fragment of the file plus 2
+
+constexpr size_t MaxCachedMacroFileSize = 1024;			// Macro files larger than this are always read from the SD card
+constexpr size_t MacroCacheSize = 8192;					// The most RAM that the macro cache may use, including its own overheads
+constexpr size_t DirectoryCacheSize = 8192;				// The size of the buffer that holds a directory listing, which needs 16 to 24 bytes per file plus the file name
 
 // Webserver stuff
 #define DEFAULT_PASSWORD		"reprap"				// Default machine password
@@ -368,7 +413,11 @@ static_assert(MaxExpectedWebDirFilenameLength + strlen(WEB_DIR) + strlen(".gz")
 
 #define CONFIG_FILE "config.g"
 #define CONFIG_BACKUP_FILE "config.g.bak"
+#define CONFIG_CACHE_FILE "config.g.cache"			// Binary copy of config.g, kept in the system directory
+#define CONFIG_CACHE_TEMP_FILE "config.g.cache.part"	// Name of the config cache while we are building it
 #define DEFAULT_LOG_FILE "eventlog.txt"
+#define DEFAULT_DATA_LOG_FILE "datalog.bin"
+#define FILE_INFO_INDEX_FILE "fileinfo.idx"				// Index of parsed G-code file information, kept in the system directory
 
 #define EOF_STRING "<!-- **EoF** -->"
 
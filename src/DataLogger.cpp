@@ -0,0 +1,188 @@
+/*
+ * DataLogger.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "DataLogger.h"
+#include "RepRap.h"
+#include "Platform.h"
+#include "Heating/Heat.h"
+#include "Movement/Move.h"
+
+#if SUPPORT_TMC2660
+# include "Movement/StepperDrivers/TMC2660.h"
+#endif
+#if SUPPORT_TMC22xx
+# include "Movement/StepperDrivers/TMC22xx.h"
+#endif
+#if SUPPORT_TMC51xx
+# include "Movement/StepperDrivers/TMC51xx.h"
+#endif
+
+DataLogger::DataLogger()
+	: logFile(), ringStart(0), ringCount(0), sequenceNumber(0), droppedRecords(0), sampleInterval(100), lastSampleTime(0), lastFlushTime(0), rate(0), dirty(false)
+{
+}
+
+// Start logging. We open the file in write mode so that it gets a write buffer, which lets the file system pass full buffers to the file writer task.
+bool DataLogger::Start(time_t time, const StringRef& filename, unsigned int r)
+{
+	Stop();
+	FileStore * const f = reprap.GetPlatform().OpenSysFile(filename.c_str(), OpenMode::write);
+	if (f == nullptr)
+	{
+		return false;
+	}
+	logFile.Set(f);
+
+	rate = constrain<unsigned int>(r, MinRate, MaxRate);
+	sampleInterval = 1000/rate;
+	ringStart = ringCount = 0;
+	sequenceNumber = droppedRecords = 0;
+	dirty = false;
+
+	// The header takes the place of the first record, so that the records that follow it are sector aligned
+	Header& header = *reinterpret_cast<Header*>(&ring[0]);
+	memset(&header, 0, sizeof(header));
+	header.magic = Magic;
+	header.version = 1;
+	header.recordSize = sizeof(Record);
+	header.sampleRate = rate;
+	header.startTime = (uint32_t)time;
+	header.numAxes = NumLoggedAxes;
+	header.numHeaters = NumLoggedHeaters;
+	header.numDrivers = NumLoggedDrivers;
+	ringCount = 1;
+
+	lastSampleTime = lastFlushTime = millis();
+	return true;
+}
+
+void DataLogger::Stop()
+{
+	if (logFile.IsLive())
+	{
+		(void)WriteRecords(ringCount);							// write any partial sector that we have
+		logFile.Close();
+	}
+}
+
+// This is called regularly by Platform
+void DataLogger::Spin()
+{
+	if (logFile.IsLive())
+	{
+		const uint32_t now = millis();
+		if (now - lastSampleTime >= sampleInterval)
+		{
+			// Keep to the requested rate on average, but don't try to catch up if we fell a long way behind
+			lastSampleTime = (now - lastSampleTime < 2 * sampleInterval) ? lastSampleTime + sampleInterval : now;
+			TakeSample(now);
+		}
+
+		// Write whole sectors only, except that we write what we have every LogFlushInterval so that not much is lost if the power fails
+		if (ringCount >= RecordsPerSector)
+		{
+			if (!WriteRecords(RecordsPerSector))
+			{
+				reprap.GetPlatform().Message(ErrorMessage, "Failed to write data log, logging stopped\n");
+				logFile.Close();
+				return;
+			}
+		}
+		else if (dirty && now - lastFlushTime >= LogFlushInterval)
+		{
+			(void)WriteRecords(ringCount);
+			logFile.Flush();
+			lastFlushTime = now;
+			dirty = false;
+		}
+	}
+}
+
+void DataLogger::TakeSample(uint32_t now)
+{
+	if (ringCount == RingRecords)
+	{
+		++droppedRecords;
+		++sequenceNumber;
+		return;
+	}
+
+	size_t index = ringStart + ringCount;
+	if (index >= RingRecords)
+	{
+		index -= RingRecords;
+	}
+	Record& rec = ring[index];
+	rec.timeMillis = now;
+	rec.sequenceNumber = sequenceNumber++;
+
+	float liveCoordinates[MaxTotalDrivers];
+	reprap.GetMove().LiveCoordinates(liveCoordinates, reprap.GetCurrentTool());
+	for (size_t axis = 0; axis < NumLoggedAxes; ++axis)
+	{
+		rec.axisPositions[axis] = liveCoordinates[axis];
+	}
+
+	const Heat& heat = reprap.GetHeat();
+	for (size_t heater = 0; heater < NumLoggedHeaters; ++heater)
+	{
+		if (heater < NumHeaters)
+		{
+			rec.temperatures[heater] = (int16_t)constrain<float>(heat.GetTemperature(heater) * 10.0, -32768.0, 32767.0);
+			rec.pwm[heater] = (uint8_t)lrintf(heat.GetAveragePWM(heater) * 255.0);
+		}
+		else
+		{
+			rec.temperatures[heater] = 0;
+			rec.pwm[heater] = 0;
+		}
+	}
+
+	for (size_t driver = 0; driver < NumLoggedDrivers; ++driver)
+	{
+		uint8_t flags = 0;
+#if HAS_SMART_DRIVERS
+		if (driver < reprap.GetPlatform().GetNumSmartDrivers())
+		{
+			const uint32_t status = SmartDrivers::GetLiveStatus(driver);
+			if (status & TMC_RR_OTPW) { flags |= DriverOverTemperatureWarning; }
+			if (status & TMC_RR_OT) { flags |= DriverOverTemperature; }
+			if (status & TMC_RR_S2G) { flags |= DriverShortToGround; }
+			if (status & (TMC_RR_OLA | TMC_RR_OLB)) { flags |= DriverOpenLoad; }
+		}
+#endif
+		rec.driverStatus[driver] = flags;
+	}
+
+	rec.machineStatus = reprap.GetStatusCharacter();
+	memset(rec.reserved, 0, sizeof(rec.reserved));
+	++ringCount;
+	dirty = true;
+}
+
+// Write the oldest records. Because the ring is a whole number of sectors long and we normally write a sector at a time, the records written are normally contiguous.
+bool DataLogger::WriteRecords(size_t numRecords)
+{
+	while (numRecords != 0)
+	{
+		const size_t numContiguous = min<size_t>(numRecords, RingRecords - ringStart);
+		if (!logFile.Write(reinterpret_cast<const char*>(&ring[ringStart]), numContiguous * sizeof(Record)))
+		{
+			return false;
+		}
+		ringStart += numContiguous;
+		if (ringStart == RingRecords)
+		{
+			ringStart = 0;
+		}
+		ringCount -= numContiguous;
+		numRecords -= numContiguous;
+	}
+	return true;
+}
+
+// End
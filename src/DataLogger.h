@@ -0,0 +1,91 @@
+/*
+ * DataLogger.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_DATALOGGER_H_
+#define SRC_DATALOGGER_H_
+
+#include "RepRapFirmware.h"
+#include "Storage/FileData.h"
+
+// Class to log machine data at a fixed rate in binary form, for process control. Records are collected in a RAM ring and written out a sector at a time,
+// so that we don't spend time formatting text and we write to the SD card only once every few records. The file starts with a header record.
+class DataLogger
+{
+public:
+	static constexpr unsigned int MinRate = 1;							// minimum sample rate in Hz
+	static constexpr unsigned int MaxRate = 100;						// maximum sample rate in Hz
+	static constexpr size_t NumLoggedAxes = 4;
+	static constexpr size_t NumLoggedHeaters = 8;
+	static constexpr size_t NumLoggedDrivers = 12;
+
+	// The format of a record in the file. All values are little-endian.
+	struct Record
+	{
+		uint32_t timeMillis;											// milliseconds since power up
+		uint32_t sequenceNumber;										// incremented for every record, so that records dropped because the ring was full can be detected
+		float axisPositions[NumLoggedAxes];								// user coordinates of the end of the last completed move
+		int16_t temperatures[NumLoggedHeaters];							// heater temperatures in units of 0.1C
+		uint8_t pwm[NumLoggedHeaters];									// average heater PWM, 0 to 255
+		uint8_t driverStatus[NumLoggedDrivers];							// driver flags as below
+		char machineStatus;												// the status character that M408 reports
+		uint8_t reserved[3];
+	};
+
+	// The format of the header record at the start of the file
+	struct Header
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t recordSize;
+		uint32_t sampleRate;
+		uint32_t startTime;												// the real time when logging started, or 0 if the time was not set
+		uint8_t numAxes, numHeaters, numDrivers;
+		uint8_t reserved[sizeof(Record) - 19];
+	};
+
+	// Driver status flags
+	static constexpr uint8_t DriverOverTemperatureWarning = 0x01;
+	static constexpr uint8_t DriverOverTemperature = 0x02;
+	static constexpr uint8_t DriverShortToGround = 0x04;
+	static constexpr uint8_t DriverOpenLoad = 0x08;
+
+	DataLogger();
+
+	bool Start(time_t time, const StringRef& filename, unsigned int rate);		// start logging, returning true if successful
+	void Stop();
+	void Spin();
+	bool IsActive() const { return logFile.IsLive(); }
+	unsigned int GetRate() const { return rate; }
+	uint32_t GetDroppedRecords() const { return droppedRecords; }
+
+private:
+	static constexpr uint32_t Magic = 0x44465252;						// "RRFD"
+	static constexpr size_t SectorSize = 512;
+	static constexpr size_t RecordsPerSector = SectorSize/sizeof(Record);
+	static constexpr size_t RingRecords = 4 * RecordsPerSector;		// enough to keep logging while a sector is being written at the highest rate
+	static_assert(SectorSize % sizeof(Record) == 0, "Data log records must fit exactly in a sector");
+
+	void TakeSample(uint32_t now);
+	bool WriteRecords(size_t numRecords);
+
+	FileData logFile;
+	Record ring[RingRecords];
+	size_t ringStart;													// index of the oldest record that hasn't been written
+	size_t ringCount;													// number of records that haven't been written
+	uint32_t sequenceNumber;
+	uint32_t droppedRecords;
+	uint32_t sampleInterval;											// in milliseconds
+	uint32_t lastSampleTime;
+	uint32_t lastFlushTime;
+	unsigned int rate;
+	bool dirty;
+};
+
+static_assert(sizeof(DataLogger::Record) == 64, "Unexpected data log record size");
+static_assert(sizeof(DataLogger::Header) == sizeof(DataLogger::Record), "Data log header must be the same size as a record");
+
+#endif /* SRC_DATALOGGER_H_ */
@@ -86,14 +86,31 @@ Menu::Menu(Lcd7920& refLcd)
 	  timeoutValue(0), lastActionTime(0),
 	  selectableItems(nullptr), unSelectableItems(nullptr), highlightedItem(nullptr), numNestedMenus(0),
 	  itemIsSelected(false), displayingFixedMenu(false), displayingErrorMessage(false), displayingMessageBox(false),
-	  errorColumn(0), rowOffset(0)
+	  currentFileTime(0), errorColumn(0), rowOffset(0)
 {
+	for (SavedMenu& sm : savedMenus)
+	{
+		sm.valid = false;
+	}
 }
 
 void Menu::Load(const char* filename)
 {
 	if (numNestedMenus < MaxMenuNesting)
 	{
+		if (numNestedMenus != 0)
+		{
+			// Keep the items of the current menu so that we can go straight back to it
+			SavedMenu& sm = savedMenus[numNestedMenus - 1];
+			sm.selectableItems = selectableItems;
+			sm.unSelectableItems = unSelectableItems;
+			sm.highlightedItem = highlightedItem;
+			sm.commandBufferEnd = commandBufferIndex;
+			sm.fileTime = currentFileTime;
+			sm.rowOffset = rowOffset;
+			sm.valid = true;
+			selectableItems = unSelectableItems = highlightedItem = nullptr;
+		}
 		filenames[numNestedMenus].copy(filename);
 		++numNestedMenus;
 		rowOffset = 0;
@@ -104,6 +121,7 @@ void Menu::Load(const char* filename)
 void Menu::LoadFixedMenu()
 {
 	displayingFixedMenu = true;
+	(void)DiscardSavedMenus();
 	numNestedMenus = 0;
 	rowOffset = 0;
 	currentMargin = 0;
@@ -207,7 +225,67 @@ void Menu::Pop()
 	lcd.Clear();
 	rowOffset = 0;
 	--numNestedMenus;
-	Reload();
+	if (!RestoreSavedMenu())
+	{
+		Reload();
+	}
+}
+
+// Go back to the saved items of the menu at the current nesting level, returning true if we did.
+// We don't use the saved items if the menu file has been changed since we loaded it.
+bool Menu::RestoreSavedMenu()
+{
+	if (numNestedMenus == 0 || !savedMenus[numNestedMenus - 1].valid)
+	{
+		return false;
+	}
+
+	ResetCache();									// delete the items of the menu we are leaving
+	SavedMenu& sm = savedMenus[numNestedMenus - 1];
+	sm.valid = false;
+	selectableItems = sm.selectableItems;
+	unSelectableItems = sm.unSelectableItems;
+	if (reprap.GetPlatform().GetLastModifiedTime(MENU_DIR, filenames[numNestedMenus - 1].c_str()) != sm.fileTime)
+	{
+		ResetCache();
+		return false;
+	}
+
+	highlightedItem = sm.highlightedItem;
+	commandBufferIndex = sm.commandBufferEnd;
+	currentFileTime = sm.fileTime;
+	rowOffset = sm.rowOffset;
+	displayingFixedMenu = displayingErrorMessage = false;
+	currentMargin = 0;
+	lcd.SetRightMargin(NumCols - currentMargin);
+
+	// We cleared the display, so all the items need to be drawn again
+	for (MenuItem *item = selectableItems; item != nullptr; item = item->GetNext())
+	{
+		item->SetChanged();
+	}
+	for (MenuItem *item = unSelectableItems; item != nullptr; item = item->GetNext())
+	{
+		item->SetChanged();
+	}
+	return true;
+}
+
+// Delete the items of all the saved menus and free their strings, returning true if there were any
+bool Menu::DiscardSavedMenus()
+{
+	bool discarded = false;
+	for (SavedMenu& sm : savedMenus)
+	{
+		if (sm.valid)
+		{
+			DeleteItems(sm.selectableItems);
+			DeleteItems(sm.unSelectableItems);
+			sm.valid = false;
+			discarded = true;
+		}
+	}
+	return discarded;
 }
 
 void Menu::LoadError(const char *msg, unsigned int line)
@@ -411,16 +489,16 @@ void Menu::ResetCache()
 	highlightedItem = nullptr;
 
 	// Delete the existing items
-	while (selectableItems != nullptr)
-	{
-		MenuItem * const current = selectableItems;
-		selectableItems = selectableItems->GetNext();
-		delete current;
-	}
-	while (unSelectableItems != nullptr)
+	DeleteItems(selectableItems);
+	DeleteItems(unSelectableItems);
+}
+
+/*static*/ void Menu::DeleteItems(MenuItem *&list)
+{
+	while (list != nullptr)
 	{
-		MenuItem * const current = unSelectableItems;
-		unSelectableItems = unSelectableItems->GetNext();
+		MenuItem * const current = list;
+		list = list->GetNext();
 		delete current;
 	}
 }
@@ -454,6 +532,7 @@ void Menu::Reload()
 
 	lcd.SetRightMargin(NumCols - currentMargin);
 	const char * const fname = filenames[numNestedMenus - 1].c_str();
+	currentFileTime = reprap.GetPlatform().GetLastModifiedTime(MENU_DIR, fname);
 	FileStore * const file = reprap.GetPlatform().OpenFile(MENU_DIR, fname, OpenMode::read);
 	if (file == nullptr)
 	{
@@ -461,29 +540,52 @@ void Menu::Reload()
 	}
 	else
 	{
-		row = 0;
-		column = 0;
-		fontNumber = 0;
-		commandBufferIndex = 0;						// Free the string buffer, which contains layout elements from an old menu
-		for (unsigned int line = 1; ; ++line)
+		for (;;)
 		{
-			char buffer[MaxMenuLineLength];
-			if (file->ReadLine(buffer, sizeof(buffer)) < 0)
+			row = 0;
+			column = 0;
+			fontNumber = 0;
+
+			// Free the part of the string buffer that contains layout elements from an old menu, keeping the strings of the saved outer menus
+			const SavedMenu * const outerMenu = (numNestedMenus >= 2) ? &savedMenus[numNestedMenus - 2] : nullptr;
+			commandBufferIndex = (outerMenu != nullptr && outerMenu->valid) ? outerMenu->commandBufferEnd : 0;
+			bool bufferFull = false;
+			for (unsigned int line = 1; ; ++line)
 			{
-				break;
+				char buffer[MaxMenuLineLength];
+				if (file->ReadLine(buffer, sizeof(buffer)) < 0)
+				{
+					break;
+				}
+				char * const pcMenuLine = SkipWhitespace(buffer);
+				const char * const errMsg = ParseMenuLine(pcMenuLine);
+				if (errMsg != nullptr)
+				{
+					LoadError(errMsg, line);
+					break;
+				}
+
+				// Check for string buffer full
+				if (commandBufferIndex == sizeof(commandBuffer))
+				{
+					bufferFull = true;
+					if (outerMenu == nullptr || !outerMenu->valid)
+					{
+						LoadError("|Menu buffer full", line);
+					}
+					break;
+				}
 			}
-			char * const pcMenuLine = SkipWhitespace(buffer);
-			const char * const errMsg = ParseMenuLine(pcMenuLine);
-			if (errMsg != nullptr)
+
+			// If the saved outer menus took up space that this menu needs, discard them and load this one again
+			if (!bufferFull || outerMenu == nullptr || !outerMenu->valid)
 			{
-				LoadError(errMsg, line);
 				break;
 			}
-
-			// Check for string buffer full
-			if (commandBufferIndex == sizeof(commandBuffer))
+			(void)DiscardSavedMenus();
+			ResetCache();
+			if (!file->Seek(0))
 			{
-				LoadError("|Menu buffer full", line);
 				break;
 			}
 		}
@@ -679,6 +781,7 @@ void Menu::Refresh()
 		// Showing fixed menu but SD card is now mounted, or 6 seconds following latest user action
 		// Go to the top menu (just discard information)
 		timeoutValue = 0;
+		(void)DiscardSavedMenus();
 		numNestedMenus = 0;
 		Load("main");
 	}
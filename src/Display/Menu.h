@@ -34,6 +34,9 @@ private:
 	void LoadFixedMenu();
 	void ResetCache();
 	void Reload();
+	bool RestoreSavedMenu();
+	bool DiscardSavedMenus();
+	static void DeleteItems(MenuItem *&list);
 	void DrawAll();
 	const char *ParseMenuLine(char * s);
 	void LoadError(const char *msg, unsigned int line);
@@ -69,6 +72,21 @@ private:
 	MenuItem *highlightedItem;									// which item is selected, or nullptr if nothing selected
 	String<MaxMenuFilenameLength> filenames[MaxMenuNesting];
 	size_t numNestedMenus;
+
+	// When we go into a nested menu we keep the items of the outer menus, so that we don't need to read and parse their files again when we return.
+	// Their strings stay in the command buffer below those of the nested menu.
+	struct SavedMenu
+	{
+		MenuItem *selectableItems;
+		MenuItem *unSelectableItems;
+		MenuItem *highlightedItem;
+		size_t commandBufferEnd;								// the end of this menu's strings in the command buffer
+		time_t fileTime;										// the modification time of the menu file when we loaded it
+		PixelNumber rowOffset;
+		bool valid;
+	};
+	SavedMenu savedMenus[MaxMenuNesting - 1];
+	time_t currentFileTime;										// the modification time of the innermost menu file when we loaded it
 	bool itemIsSelected;
 	bool displayingFixedMenu;
 	bool displayingErrorMessage;
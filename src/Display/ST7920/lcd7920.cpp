@@ -29,6 +29,8 @@ constexpr unsigned int LcdCommandDelayMicros = 72 - 8;	// 72us required, less 7u
 constexpr unsigned int LcdDataDelayMicros = 4;			// delay between sending data bytes
 constexpr unsigned int LcdDisplayClearDelayMillis = 3;	// 1.6ms should be enough
 
+static_assert(NumCols/16 <= 8, "dirtyWords elements are too small");
+
 inline void Lcd7920::CommandDelay()
 {
 	delayMicroseconds(LcdCommandDelayMicros);
@@ -61,9 +63,8 @@ void Lcd7920::Init()
 {
 	sspi_master_init(&device, 8);
 	numContinuationBytesLeft = 0;
-	startRow = NumRows;
-	startCol = NumCols;
-	endRow = endCol = nextFlushRow = 0;
+	nextFlushRow = 0;
+	memset(dirtyWords, 0, sizeof(dirtyWords));
 
 	{
 		MutexLocker lock(Tasks::GetSpiMutex());
@@ -133,10 +134,22 @@ void Lcd7920::SetDirty(PixelNumber r, PixelNumber c)
 //	if (r >= NumRows) { debugPrintf("r=%u\n", r); return; }
 //	if (c >= NumCols) { debugPrintf("c=%u\n", c); return; }
 
-	if (c < startCol) { startCol = c; }
-	if (c >= endCol) { endCol = c + 1; }
-	if (r < startRow) { startRow = r; }
-	if (r >= endRow) { endRow = r + 1; }
+	dirtyWords[r] |= 1u << (c/16);
+}
+
+// Flag a rectangular block of pixels starting at sRow, sCol and ending just before eRow, eCol as dirty
+void Lcd7920::SetDirty(PixelNumber sRow, PixelNumber sCol, PixelNumber eRow, PixelNumber eCol)
+{
+	if (eCol > NumCols) { eCol = NumCols; }
+	if (eRow > NumRows) { eRow = NumRows; }
+	if (sCol < eCol)
+	{
+		const uint8_t words = (uint8_t)((1u << ((eCol + 15)/16)) - (1u << (sCol/16)));
+		for (PixelNumber r = sRow; r < eRow; ++r)
+		{
+			dirtyWords[r] |= words;
+		}
+	}
 }
 
 // Write a UTF8 byte.
@@ -448,10 +461,7 @@ void Lcd7920::Clear(PixelNumber sRow, PixelNumber sCol, PixelNumber eRow, PixelN
 		}
 
 		// Flag cleared part as dirty
-		if (sCol < startCol) { startCol = sCol; }
-		if (eCol >= endCol) { endCol = eCol; }
-		if (sRow < startRow) { startRow = sRow; }
-		if (eRow >= endRow) { endRow = eRow; }
+		SetDirty(sRow, sCol, eRow, eCol);
 
 		SetCursor(sRow, sCol);
 		textInverted = false;
@@ -543,10 +553,7 @@ void Lcd7920::Bitmap(PixelNumber x0, PixelNumber y0, PixelNumber width, PixelNum
 	}
 
 	// Assume the whole area has changed
-	if (x0 < startCol) startCol = x0;
-	if (x0 + width > endCol) endCol = x0 + width;
-	if (y0 < startRow) startRow = y0;
-	if (y0 + height > endRow) endRow = y0 + height;
+	SetDirty(y0, x0, min<unsigned int>(y0 + height, NumRows), min<unsigned int>(x0 + width, NumCols));
 }
 
 // Draw a single bitmap row. 'left' and 'width' do not need to be divisible by 8.
@@ -600,36 +607,30 @@ void Lcd7920::FlushAll()
 	}
 }
 
-// Flush some of the dirty part of the image to the LCD, returning true if there is more to do
+// Flush one dirty row of the image to the LCD, returning true if we flushed anything.
+// We only send the words of the row between the first and last dirty ones, and we skip rows that aren't dirty at all, so small changes in different
+// parts of the display cost no more than the changes themselves. We carry on from the row after the one we flushed last, so that frequent changes
+// near the top of the display don't hold up the rest of it.
 bool Lcd7920::FlushSome()
 {
-	// See if there is anything to flush
-	if (endCol > startCol && endRow > startRow)
+	for (unsigned int i = 0; i < NumRows; ++i)
 	{
-		// Decide which row to flush next
-		if (nextFlushRow < startRow || nextFlushRow >= endRow)
+		const PixelNumber flushRow = (nextFlushRow + i) % NumRows;
+		const uint32_t dirty = dirtyWords[flushRow];
+		if (dirty != 0)
 		{
-			nextFlushRow = startRow;	// start from the beginning
-		}
-
-		if (nextFlushRow == startRow)	// if we are starting form the beginning
-		{
-			++startRow;					// flag this row as flushed because it will be soon
-		}
-
-		// Flush that row
-		{
-			uint8_t startColNum = startCol/16;
-			const uint8_t endColNum = (endCol + 15)/16;
-//			debugPrintf("flush %u %u %u\n", nextFlushRow, startColNum, endColNum);
+			dirtyWords[flushRow] = 0;
+			uint8_t startColNum = __builtin_ctz(dirty);
+			const uint8_t endColNum = 32 - __builtin_clz(dirty);
+//			debugPrintf("flush %u %u %u\n", flushRow, startColNum, endColNum);
 
 			MutexLocker lock(Tasks::GetSpiMutex());
 			sspi_master_setup_device(&device);
 			sspi_select_device(&device);
 			delayMicroseconds(1);
 
-			setGraphicsAddress(nextFlushRow, startColNum);
-			uint8_t *ptr = image + (((NumCols/8) * nextFlushRow) + (2 * startColNum));
+			setGraphicsAddress(flushRow, startColNum);
+			uint8_t *ptr = image + (((NumCols/8) * flushRow) + (2 * startColNum));
 			while (startColNum < endColNum)
 			{
 				sendLcdData(*ptr++);
@@ -638,17 +639,10 @@ bool Lcd7920::FlushSome()
 				DataDelay();
 			}
 			sspi_deselect_device(&device);
-		}
 
-		if (startRow != endRow)
-		{
-			++nextFlushRow;
+			nextFlushRow = (flushRow + 1) % NumRows;
 			return true;
 		}
-
-		startRow = NumRows;
-		startCol = NumCols;
-		endCol = endRow = nextFlushRow = 0;
 	}
 	return false;
 }
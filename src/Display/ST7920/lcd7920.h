@@ -150,8 +150,8 @@ private:
 	uint16_t lastCharColData;						// data for the last non-space column, used for kerning
 	uint8_t numContinuationBytesLeft;
 	PixelNumber row, column;
-	PixelNumber startRow, startCol, endRow, endCol;	// coordinates of the dirty rectangle
-	PixelNumber nextFlushRow;						// which row we need to flush next
+	PixelNumber nextFlushRow;						// which row we look at first when we next flush
+	uint8_t dirtyWords[NumRows];					// for each row, a bitmap of the 16-pixel words that need to be flushed
 	PixelNumber leftMargin, rightMargin;
 	uint8_t image[(NumRows * NumCols)/8];			// image buffer, 1K in size
 	bool textInverted;
@@ -165,6 +165,7 @@ private:
 	void setGraphicsAddress(unsigned int r, unsigned int c);
 	size_t writeNative(uint16_t c);					// write a decoded character
 	void SetDirty(PixelNumber r, PixelNumber c);
+	void SetDirty(PixelNumber sRow, PixelNumber sCol, PixelNumber eRow, PixelNumber eCol);
 };
 
 #endif
@@ -23,6 +23,7 @@ constexpr size_t NumFirmwareUpdateModules = 1;
 #define SUPPORT_SCANNER		0					// set nonzero to support FreeLSS scanners
 #define SUPPORT_DHT_SENSOR	0					// set nonzero to support DHT temperature/humidity sensors
 #define SUPPORT_LASER		1					// set nonzero to support laser cutters
+#define USE_INCREMENTAL_SQRT	1					// set nonzero to seed the step time square roots from the previous step (faster without an FPU)
 
 // The physical capabilities of the machine
 constexpr size_t NumDirectDrivers = 9;
@@ -395,13 +395,16 @@ void ProtocolInterpreter::CancelUpload()
 	}
 }
 
+// Write all the data in the current transaction to the file. We write each pbuf in full;
+// the file's write buffer collects the data so that the SD card sees whole sectors. The receive window only reopens when the transaction is discarded,
+// so handling one pbuf per call would hold up the client for as long as it takes us to get round to all of them.
 void ProtocolInterpreter::DoFastUpload()
 {
 	NetworkTransaction *transaction = webserver->currentTransaction;
 
 	const char *buffer;
 	size_t len;
-	if (transaction->ReadBuffer(buffer, len))
+	while (transaction->ReadBuffer(buffer, len))
 	{
 		// See if we can output a debug message
 		if (reprap.Debug(moduleWebserver))
@@ -442,7 +445,7 @@ bool ProtocolInterpreter::FinishUpload(uint32_t fileLength)
 	if (uploadState == uploadOK && fileLength != 0 && fileBeingUploaded.Length() != fileLength)
 	{
 		uploadState = uploadError;
-		platform->MessageF(GenericMessage, "Error: Uploaded file size is different (%" PRIu32 " vs. expected %" PRIu32 " bytes)!\n", fileBeingUploaded.Length(), fileLength);
+		platform->MessageF(GenericMessage, "Error: Uploaded file size is different (%" PRIuFilePos " vs. expected %" PRIu32 " bytes)!\n", fileBeingUploaded.Length(), fileLength);
 	}
 
 	// Close the file
@@ -546,13 +549,13 @@ bool Webserver::HttpInterpreter::DoingFastUpload() const
 	return false;
 }
 
-// Write some data on the SD card
+// Write the data in the current transaction to the SD card. As for the other protocols, we write every pbuf we have been given in one go.
 void Webserver::HttpInterpreter::DoFastUpload()
 {
 	NetworkTransaction * const transaction = webserver->currentTransaction;
 	const char *buffer;
 	size_t len;
-	if (transaction->ReadBuffer(buffer, len))
+	while (uploadedBytes < postFileLength && transaction->ReadBuffer(buffer, len))
 	{
 		network->Unlock();
 		const bool success = fileBeingUploaded.Write(buffer, len);
@@ -734,7 +737,7 @@ void Webserver::HttpInterpreter::SendFile(const char* nameOfFileToSend, bool isW
 		transaction->Write("Content-Encoding: gzip\r\n");
 	}
 
-	transaction->Printf("Content-Length: %lu\r\n", fileToSend->Length());
+	transaction->Printf("Content-Length: %" PRIuFilePos "\r\n", fileToSend->Length());
 	transaction->Write("Connection: close\r\n\r\n");
 	transaction->Commit(false);
 }
@@ -1549,7 +1552,7 @@ bool Webserver::HttpInterpreter::ProcessMessage()
 				}
 
 				// Start a new file upload
-				FileStore *file = platform->OpenFile(FS_PREFIX, filename, OpenMode::write);
+				FileStore *file = platform->OpenFile(FS_PREFIX, filename, OpenMode::write, postFileLength);
 				if (!StartUpload(file, filename))
 				{
 					return RejectMessage("could not start file upload");
@@ -2272,7 +2275,7 @@ void Webserver::FtpInterpreter::ProcessLine()
 					{
 						// send announcement via main ftp port
 						NetworkTransaction *transaction = webserver->currentTransaction;
-						transaction->Printf("150 Opening data connection for %s (%lu bytes).\r\n", filename, file->Length());
+						transaction->Printf("150 Opening data connection for %s (%" PRIuFilePos " bytes).\r\n", filename, file->Length());
 						transaction->Commit(true);
 
 						// send the file via data port
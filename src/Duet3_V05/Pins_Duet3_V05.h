@@ -216,6 +216,6 @@ constexpr uint8_t DmacChanWiFiRx = 2;
 constexpr uint8_t DmacChanTmcTx = 3;
 constexpr uint8_t DmacChanTmcRx = 4;
 
-constexpr size_t NumDmaChannelsUsed = 5;
+constexpr size_t NumDmaChannelsUsed = 5;			// further channels are allocated at run time by DmacManager::AllocateChannel
 
 #endif
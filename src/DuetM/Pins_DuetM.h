@@ -36,6 +36,13 @@ constexpr size_t NumFirmwareUpdateModules = 1;		// 1 module
 #define SUPPORT_WORKPLACE_COORDINATES	1			// set nonzero to support G10 L2 and G53..59
 #define SUPPORT_12864_LCD		1					// set nonzero to support 12864 LCD and rotary encoder
 #define SUPPORT_OBJECT_MODEL	1
+#define SUPPORT_SEGMENT_FREE_STREAMING	1			// set nonzero to support streaming SCARA and rotary delta moves, and mesh compensation (M376 C1), without segmentation
+#define SUPPORT_INPUT_SHAPING	1					// set nonzero to support ZV, ZVD and EI input shaping (M593) and jerk-limited acceleration (M204 J)
+#define SUPPORT_PRESSURE_ADVANCE_SMOOTHING	1		// set nonzero to support smoothing pressure advance over time (M572 W parameter)
+#define SUPPORT_MACRO_CACHE		1					// set nonzero to keep small macro files such as tool change files in RAM
+#define SUPPORT_DIRECTORY_CACHE	1					// set nonzero to keep a sorted listing of the last directory that was listed in RAM
+#define SUPPORT_SECTOR_CACHE	1					// set nonzero to keep recently used FAT and directory sectors in RAM
+#define SUPPORT_RESUME_JOURNAL	1					// set nonzero to record the resume point periodically while printing (M916 J)
 #define SUPPORT_FTP				1
 #define SUPPORT_TELNET			1
 
@@ -180,7 +187,7 @@ constexpr uint32_t IAP_FLASH_END = 0x0047FFFF;								// we allow a full 64K on
 // Duet pin numbers to control the W5500 interface
 constexpr Pin W5500ResetPin = PortCPin(13);									// Low on this in holds the W5500 in reset
 constexpr Pin W5500SsPin = PortAPin(11);									// SPI NPCS pin to W5500
-constexpr Pin W5500IntPin = PortAPin(23);									// Interrupt from W5500
+constexpr Pin W5500InterruptPin = PortAPin(23);								// Interrupt from W5500, active low
 
 // Timer allocation
 // TC0 channel 0 is used for step pulse generation and software timers
@@ -11,6 +11,7 @@
 #include "RepRap.h"
 #include "Wire.h"
 #include "Hardware/I2C.h"
+#include "Movement/StepTimer.h"
 
 namespace DuetExpansion
 {
@@ -19,7 +20,7 @@ namespace DuetExpansion
 
 	static SX1509 dueXnExpander;
 	static uint16_t dueXnInputMask;
-	static uint16_t dueXnInputBits = 0;
+	static volatile uint16_t dueXnInputBits = 0;				// the input image, read by the DueX task when the inputs change and read by endstop checks in the step ISR
 	static ExpansionBoardType dueXnBoardType = ExpansionBoardType::none;
 
 	const uint8_t AdditionalIoExpanderAddress = 0x71;	// address of the SX1509B we allow for general I/O expansion
@@ -31,6 +32,15 @@ namespace DuetExpansion
 	static volatile bool taskWaiting = false;
 	static volatile bool inputsChanged = false;
 
+	// Statistics for M122, so that we can see how stale the input image can be when an endstop is checked
+	static volatile uint32_t inputsChangedStepClocks = 0;		// when the SX1509B told us that the inputs changed and we hadn't already started reading them
+	static uint32_t numInputReads = 0;
+	static uint32_t maxInputReadLatency = 0;					// in step clocks
+
+	// PWM values for the DueXn that are waiting for the DueX task to send them, so that callers of AnalogOut don't wait for the I2C bus
+	static volatile uint16_t pendingPwmBits = 0;
+	static volatile uint8_t pendingPwmValues[16];
+
 	Task<DueXTaskStackWords> *dueXTask = nullptr;
 
 	// The original DueX2 and DueX5 boards had 2 board ID pins, bits 14 and 15.
@@ -67,6 +77,10 @@ namespace DuetExpansion
 	// Otherwise we might wake it prematurely when it is waiting for an I2C transaction to be completed.
 	static void DueXIrq(CallbackParameter p)
 	{
+		if (!inputsChanged)
+		{
+			inputsChangedStepClocks = StepTimer::GetInterruptClocks();
+		}
 		inputsChanged = true;
 		if (taskWaiting)
 		{
@@ -75,15 +89,58 @@ namespace DuetExpansion
 		}
 	}
 
+	// Wake up the DueX task if it is waiting for something to do. Must not be called from an ISR.
+	static void WakeDueXTask()
+	{
+		cpu_irq_disable();
+		const bool wasWaiting = taskWaiting;
+		taskWaiting = false;
+		cpu_irq_enable();
+		if (wasWaiting)
+		{
+			dueXTask->Give();
+		}
+	}
+
+	// Send any PWM values that AnalogOut has left for us
+	static void WritePendingPwm()
+	{
+		cpu_irq_disable();
+		uint16_t bits = pendingPwmBits;
+		pendingPwmBits = 0;
+		cpu_irq_enable();
+
+		while (bits != 0)
+		{
+			const unsigned int pin = __builtin_ctz(bits);
+			bits &= ~(1u << pin);
+			dueXnExpander.analogWrite(pin, pendingPwmValues[pin]);
+		}
+	}
+
+	// The DueX task reads the inputs whenever the SX1509B says that they have changed, so that DigitalRead can return them without waiting for the I2C bus.
+	// It also sends PWM changes for the DueX outputs.
 	extern "C" [[noreturn]] void DueXTask(void * pvParameters)
 	{
 		for (;;)
 		{
+			const bool wasInterrupted = inputsChanged;
+			const uint32_t whenChanged = inputsChangedStepClocks;
 			inputsChanged = false;
 			dueXnInputBits = dueXnExpander.digitalReadAll();
+			if (wasInterrupted)
+			{
+				++numInputReads;
+				const uint32_t latency = StepTimer::GetInterruptClocks() - whenChanged;
+				if (latency > maxInputReadLatency)
+				{
+					maxInputReadLatency = latency;
+				}
+			}
+			WritePendingPwm();
 
 			cpu_irq_disable();
-			if (!inputsChanged)
+			if (!inputsChanged && pendingPwmBits == 0)
 			{
 				taskWaiting = true;
 				cpu_irq_enable();
@@ -251,7 +308,8 @@ namespace DuetExpansion
 		{
 			if (dueXnBoardType != ExpansionBoardType::none)
 			{
-				if (!digitalRead(DueX_INT) && !inInterrupt() && __get_BASEPRI() == 0)	// we must not call expander.digitalRead() from within an ISR or if the tick interrupt is disabled
+				// Once the DueX task is running it reads the inputs as soon as they change, so we just return the last values it read
+				if (dueXTask == nullptr && !digitalRead(DueX_INT) && !inInterrupt() && __get_BASEPRI() == 0)	// we must not call expander.digitalRead() from within an ISR or if the tick interrupt is disabled
 				{
 					// Interrupt is active, so input data may have changed
 					dueXnInputBits = dueXnExpander.digitalReadAll();
@@ -304,7 +362,21 @@ namespace DuetExpansion
 		{
 			if (dueXnBoardType != ExpansionBoardType::none)
 			{
-				dueXnExpander.analogWrite(pin - DueXnExpansionStart, (uint8_t)(constrain<float>(pwm, 0.0, 1.0) * 255));
+				const uint8_t val = (uint8_t)(constrain<float>(pwm, 0.0, 1.0) * 255);
+				if (dueXTask == nullptr || inInterrupt())
+				{
+					dueXnExpander.analogWrite(pin - DueXnExpansionStart, val);
+				}
+				else
+				{
+					// Leave the DueX task to send the new value
+					pin -= DueXnExpansionStart;
+					pendingPwmValues[pin] = val;
+					cpu_irq_disable();
+					pendingPwmBits |= 1u << pin;
+					cpu_irq_enable();
+					WakeDueXTask();
+				}
 			}
 		}
 		else if (pin >= AdditionalIoExpansionStart && pin < AdditionalIoExpansionStart + 16)
@@ -317,9 +389,15 @@ namespace DuetExpansion
 	}
 
 	// Print diagnostic data
-	// I2C error counts are now reported by Platform, so nothing to report here.
+	// I2C error counts are now reported by Platform, so we just report how quickly we update the input image after the inputs change.
 	void Diagnostics(MessageType mtype)
 	{
+		if (dueXTask != nullptr)
+		{
+			reprap.GetPlatform().MessageF(mtype, "DueX input reads %" PRIu32 ", max latency %.2fms\n",
+											numInputReads, (double)(maxInputReadLatency * StepTimer::StepClocksToMillis));
+			maxInputReadLatency = 0;
+		}
 	}
 
 	// Diagnose the SX1509 by setting all pins as inputs and reading them
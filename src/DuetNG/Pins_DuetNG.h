@@ -30,6 +30,13 @@ constexpr size_t NumFirmwareUpdateModules = 4;		// 3 modules, plus one for manua
 #define SUPPORT_WORKPLACE_COORDINATES	1			// set nonzero to support G10 L2 and G53..59
 #define SUPPORT_12864_LCD		0					// set nonzero to support 12864 LCD and rotary encoder
 #define SUPPORT_OBJECT_MODEL	1
+#define SUPPORT_SEGMENT_FREE_STREAMING	1			// set nonzero to support streaming SCARA and rotary delta moves, and mesh compensation (M376 C1), without segmentation
+#define SUPPORT_INPUT_SHAPING	1					// set nonzero to support ZV, ZVD and EI input shaping (M593) and jerk-limited acceleration (M204 J)
+#define SUPPORT_PRESSURE_ADVANCE_SMOOTHING	1		// set nonzero to support smoothing pressure advance over time (M572 W parameter)
+#define SUPPORT_MACRO_CACHE		1					// set nonzero to keep small macro files such as tool change files in RAM
+#define SUPPORT_DIRECTORY_CACHE	1					// set nonzero to keep a sorted listing of the last directory that was listed in RAM
+#define SUPPORT_SECTOR_CACHE	1					// set nonzero to keep recently used FAT and directory sectors in RAM
+#define SUPPORT_RESUME_JOURNAL	1					// set nonzero to record the resume point periodically while printing (M916 J)
 #define SUPPORT_FTP				1
 #define SUPPORT_TELNET			1
 
@@ -21,7 +21,11 @@ namespace DotStarLed
 	static unsigned int totalSent = 0;						// total amount of data sent since the start frame
 	static bool needStartFrame = true;						// true if we need to send a start frame with the next command
 	static bool busy = false;
-	static uint32_t chunkBuffer[MaxChunkSize];
+
+	// We have two chunk buffers, so that we can set up the next chunk in one of them while the other is being sent.
+	// The PDC has a 'next' pointer and counter, so it starts sending the second chunk as soon as it finishes the first.
+	static uint32_t chunkBuffers[2][MaxChunkSize];
+	static unsigned int nextChunkBuffer = 0;				// which chunk buffer we fill next
 
 	void Init()
 	{
@@ -49,17 +53,22 @@ namespace DotStarLed
 		numRemaining = totalSent = 0;
 		needStartFrame = true;
 		busy = false;
+		nextChunkBuffer = 0;
 	}
 
 	GCodeResult SetColours(GCodeBuffer& gb, const StringRef& reply)
 	{
+		Pdc * const usartPdc = usart_get_pdc_base(DotStarUsart);
 		if (busy)											// if we sent something
 		{
-			if ((DotStarUsart->US_CSR & US_CSR_ENDTX) == 0)	// if we are still sending
+			if ((DotStarUsart->US_CSR & US_CSR_ENDTX) != 0)
+			{
+				busy = false;								// we finished the last transfer
+			}
+			else if (usartPdc->PERIPH_TNCR != 0)			// if both chunk buffers are still in use
 			{
 				return GCodeResult::notFinished;
 			}
-			busy = false;									// we finished the last transfer
 		}
 
 		bool seen = false;
@@ -88,6 +97,7 @@ namespace DotStarLed
 		// white LED at the end if we don't provide data for all the LEDs. So instead we send 32 or more bits of zeros.
 		// See https://cpldcpu.wordpress.com/2014/11/30/understanding-the-apa102-superled/ for more.
 		unsigned int spaceLeft = MaxChunkSize;
+		uint32_t * const chunkBuffer = chunkBuffers[nextChunkBuffer];
 		uint32_t *p = chunkBuffer;
 		if (needStartFrame)
 		{
@@ -125,15 +135,29 @@ namespace DotStarLed
 		}
 
 		// DMA the data
-		DotStarUsart->US_CR = US_CR_RSTRX | US_CR_RSTTX | US_CR_TXDIS;			// reset transmitter and receiver, disable transmitter
-		Pdc * const usartPdc = usart_get_pdc_base(DotStarUsart);
-		usartPdc->PERIPH_PTCR = PERIPH_PTCR_RXTDIS | PERIPH_PTCR_TXTDIS;		// disable the PDC
-		usartPdc->PERIPH_TPR = reinterpret_cast<uint32_t>(&chunkBuffer);
-		usartPdc->PERIPH_TCR = 4 * (p - chunkBuffer);							// number of bytes to transfer
-		usartPdc->PERIPH_PTCR = PERIPH_PTCR_TXTEN;								// enable the PDC to send data
+		if (busy)
+		{
+			// The other chunk buffer is still being sent, so queue this one to be sent after it
+			usartPdc->PERIPH_TNPR = reinterpret_cast<uint32_t>(chunkBuffer);
+			usartPdc->PERIPH_TNCR = 4 * (p - chunkBuffer);						// number of bytes to transfer
+
+			// If the other transfer finished just before we queued this one, the PDC may have stopped, in which case we start this one ourselves
+			busy = (DotStarUsart->US_CSR & US_CSR_ENDTX) == 0 || usartPdc->PERIPH_TNCR == 0;
+		}
 
-		DotStarUsart->US_CR = US_CR_TXEN;										// enable transmitter
+		if (!busy)
+		{
+			DotStarUsart->US_CR = US_CR_RSTRX | US_CR_RSTTX | US_CR_TXDIS;		// reset transmitter and receiver, disable transmitter
+			usartPdc->PERIPH_PTCR = PERIPH_PTCR_RXTDIS | PERIPH_PTCR_TXTDIS;	// disable the PDC
+			usartPdc->PERIPH_TNCR = 0;											// cancel any chunk that we queued but the PDC didn't pick up
+			usartPdc->PERIPH_TPR = reinterpret_cast<uint32_t>(chunkBuffer);
+			usartPdc->PERIPH_TCR = 4 * (p - chunkBuffer);						// number of bytes to transfer
+			usartPdc->PERIPH_PTCR = PERIPH_PTCR_TXTEN;							// enable the PDC to send data
+
+			DotStarUsart->US_CR = US_CR_TXEN;									// enable transmitter
+		}
 
+		nextChunkBuffer ^= 1;
 		busy = true;
 		return (numRemaining == 0) ? GCodeResult::ok : GCodeResult::notFinished;
 	}
@@ -317,9 +317,10 @@ void Fan::Refresh()
 #endif
 			if (reqVal < 1.0 && blipTime != 0)
 			{
-				// Starting the fan from standstill, so blip the fan
+				// Starting the fan from standstill, so blip the fan, and make sure that we end the blip on time instead of at the next regular check
 				blipping = true;
 				blipStartTime = millis();
+				reprap.GetPlatform().ScheduleFanCheck(blipTime);
 			}
 		}
 
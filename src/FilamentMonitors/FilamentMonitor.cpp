@@ -128,6 +128,20 @@ bool FilamentMonitor::ConfigurePin(GCodeBuffer& gb, const StringRef& reply, Inte
 	return GCodeResult::ok;
 }
 
+// Return true if a filament monitor is using the specified pin
+/*static*/ bool FilamentMonitor::IsUsingPin(Pin p)
+{
+	MutexLocker lock(filamentSensorsMutex);
+	for (const FilamentMonitor *fs : filamentSensors)
+	{
+		if (fs != nullptr && fs->pin == p)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 // Factory function
 /*static*/ FilamentMonitor *FilamentMonitor::Create(unsigned int extruder, int type)
 {
@@ -169,6 +183,21 @@ bool FilamentMonitor::ConfigurePin(GCodeBuffer& gb, const StringRef& reply, Inte
 	}
 }
 
+// Update the commanded and measured flow rates from a measurement that was synced to the sensor. Both amounts cover the interval since the previous
+// synced measurement. We time that interval in step clocks from the interrupts that the two measurements were synced to, so the rates are as accurate as the sensor allows.
+void FilamentMonitor::RecordSyncedMeasurement(uint32_t syncStepClocks, bool usable, float commanded, float measured)
+{
+	const uint32_t interval = syncStepClocks - lastSyncStepClocks;
+	if (usable && haveSyncStepClocks && interval != 0 && interval < MaxFlowRateSyncInterval)
+	{
+		const float seconds = (float)interval/(float)StepTimer::StepClockRate;
+		commandedFlowRate += (commanded/seconds - commandedFlowRate) * FlowRateSmoothing;
+		measuredFlowRate += (measured/seconds - measuredFlowRate) * FlowRateSmoothing;
+	}
+	lastSyncStepClocks = syncStepClocks;
+	haveSyncStepClocks = true;
+}
+
 // ISR
 /*static*/ void FilamentMonitor::InterruptEntry(CallbackParameter param)
 {
@@ -178,6 +207,7 @@ bool FilamentMonitor::ConfigurePin(GCodeBuffer& gb, const StringRef& reply, Inte
 		fm->isrExtruderStepsCommanded = reprap.GetMove().GetAccumulatedExtrusion(fm->extruderNumber, fm->isrWasPrinting);
 		fm->haveIsrStepsCommanded = true;
 		fm->isrMillis = millis();
+		fm->isrStepClocks = StepTimer::GetInterruptClocks();
 	}
 }
 
@@ -202,6 +232,7 @@ bool FilamentMonitor::ConfigurePin(GCodeBuffer& gb, const StringRef& reply, Inte
 				extruderStepsCommanded = fs.isrExtruderStepsCommanded;
 				isPrinting = fs.isrWasPrinting;
 				isrMillis = fs.isrMillis;
+				fs.lastIsrStepClocks = fs.isrStepClocks;
 				fs.haveIsrStepsCommanded = false;
 				cpu_irq_enable();
 				fromIsr = true;
@@ -12,6 +12,8 @@
 #include "MessageType.h"
 #include "GCodes/GCodeResult.h"
 #include "RTOSIface/RTOSIface.h"
+#include "Movement/StepTimer.h"
+#include "General/FreelistManager.h"
 
 enum class FilamentSensorStatus : uint8_t
 {
@@ -66,8 +68,13 @@ public:
 	// Send diagnostics info
 	static void Diagnostics(MessageType mtype);
 
+	// Return true if a filament monitor is using the specified pin
+	static bool IsUsingPin(Pin p);
+
 protected:
-	FilamentMonitor(unsigned int extruder, int t) : extruderNumber(extruder), type(t), pin(NoPin) { }
+	FilamentMonitor(unsigned int extruder, int t)
+		: lastIsrStepClocks(0), lastSyncStepClocks(0), commandedFlowRate(0.0), measuredFlowRate(0.0),
+		  extruderNumber(extruder), type(t), pin(NoPin), haveSyncStepClocks(false) { }
 
 	bool ConfigurePin(GCodeBuffer& gb, const StringRef& reply, InterruptMode interruptMode, bool& seen);
 
@@ -75,6 +82,11 @@ protected:
 
 	Pin GetPin() const { return pin; }
 	bool HaveIsrStepsCommanded() const { return haveIsrStepsCommanded; }
+	uint32_t GetIsrStepClocks() const { return lastIsrStepClocks; }		// the step clock time of the interrupt that the current call to Check is synced to
+
+	void RecordSyncedMeasurement(uint32_t syncStepClocks, bool usable, float commanded, float measured);
+	float GetCommandedFlowRate() const { return commandedFlowRate; }
+	float GetMeasuredFlowRate() const { return measuredFlowRate; }
 
 private:
 	// Create a filament sensor returning null if not a valid sensor type
@@ -85,14 +97,23 @@ private:
 	static Mutex filamentSensorsMutex;
 	static FilamentMonitor *filamentSensors[MaxExtruders];
 
+	static constexpr float FlowRateSmoothing = 0.25;					// how much of each new measurement goes into the flow rates
+	static constexpr uint32_t MaxFlowRateSyncInterval = StepTimer::StepClockRate;	// we don't update the flow rates from synced measurements further apart than this
+
 	int32_t isrExtruderStepsCommanded;
 	uint32_t isrMillis;
+	uint32_t isrStepClocks;
+	uint32_t lastIsrStepClocks;
+	uint32_t lastSyncStepClocks;
+	float commandedFlowRate;											// mm/sec
+	float measuredFlowRate;												// mm/sec
 	unsigned int extruderNumber;
 	int type;
 	int endstopNumber;
 	Pin pin;
 	bool isrWasPrinting;
 	bool haveIsrStepsCommanded;
+	bool haveSyncStepClocks;
 };
 
 #endif /* SRC_FILAMENTSENSORS_FILAMENTMONITOR_H_ */
@@ -233,6 +233,7 @@ void LaserFilamentMonitor::HandleIncomingData()
 
 			if (haveStartBitData)	// if we have a synchronised  value for the amount of extrusion commanded
 			{
+				bool usable = false;
 				if (synced)
 				{
 					if (   checkNonPrintingMoves
@@ -242,8 +243,10 @@ void LaserFilamentMonitor::HandleIncomingData()
 						// We can use this measurement
 						extrusionCommandedThisSegment += extrusionCommandedAtCandidateStartBit;
 						movementMeasuredThisSegment += movementMeasuredSinceLastSync;
+						usable = true;
 					}
 				}
+				RecordSyncedMeasurement(candidateStartBitStepClocks, usable, extrusionCommandedAtCandidateStartBit, (backwards) ? -movementMeasuredSinceLastSync : movementMeasuredSinceLastSync);
 				lastSyncTime = candidateStartBitTime;
 				extrusionCommandedSinceLastSync -= extrusionCommandedAtCandidateStartBit;
 				movementMeasuredSinceLastSync = 0.0;
@@ -269,6 +272,7 @@ FilamentSensorStatus LaserFilamentMonitor::Check(bool isPrinting, bool fromIsr,
 		extrusionCommandedAtCandidateStartBit = extrusionCommandedSinceLastSync;
 		wasPrintingAtStartBit = isPrinting;
 		candidateStartBitTime = isrMillis;
+		candidateStartBitStepClocks = GetIsrStepClocks();
 		haveStartBitData = true;
 	}
 
@@ -400,8 +404,8 @@ void LaserFilamentMonitor::Diagnostics(MessageType mtype, unsigned int extruder)
 	buf.printf("Extruder %u: ", extruder);
 	if (dataReceived)
 	{
-		buf.catf("pos %.2f, errs: frame %" PRIu32 " parity %" PRIu32 " ovrun %" PRIu32 " pol %" PRIu32 " ovdue %" PRIu32 "\n",
-					(double)GetCurrentPosition(), framingErrorCount, parityErrorCount, overrunErrorCount, polarityErrorCount, overdueCount);
+		buf.catf("pos %.2f, flow commanded %.2f measured %.2fmm/s, errs: frame %" PRIu32 " parity %" PRIu32 " ovrun %" PRIu32 " pol %" PRIu32 " ovdue %" PRIu32 "\n",
+					(double)GetCurrentPosition(), (double)GetCommandedFlowRate(), (double)GetMeasuredFlowRate(), framingErrorCount, parityErrorCount, overrunErrorCount, polarityErrorCount, overdueCount);
 	}
 	else
 	{
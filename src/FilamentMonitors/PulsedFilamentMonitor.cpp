@@ -117,18 +117,16 @@ bool PulsedFilamentMonitor::Configure(GCodeBuffer& gb, const StringRef& reply, b
 // ISR for when the pin state changes. It should return true if the ISR wants the commanded extrusion to be fetched.
 bool PulsedFilamentMonitor::Interrupt()
 {
+	// Keep this as short as possible, because a high-resolution sensor can interrupt us thousands of times per second.
+	// Counting the samples received and everything else is done in bulk in Poll.
 	++sensorValue;
-	if (samplesReceived < 100)
-	{
-		++samplesReceived;
-	}
 
 	// Most pulsed filament monitors have low resolution, but at least one user has a high-resolution one.
 	// So don't automatically try to sync on every interrupt.
 	const uint32_t now = millis();
-	if (now - lastMeasurementTime >= 50)
+	if (now - lastMeasurementTime >= SyncIntervalMillis)
 	{
-		lastMeasurementTime = millis();
+		lastMeasurementTime = now;
 		return true;
 	}
 	return false;
@@ -142,15 +140,18 @@ void PulsedFilamentMonitor::Poll()
 	sensorValue = 0;
 	cpu_irq_enable();
 	movementMeasuredSinceLastSync += (float)locSensorVal;
+	samplesReceived = (uint8_t)min<uint32_t>(samplesReceived + locSensorVal, 100);
 
 	if (haveInterruptData)					// if we have a synchronised value for the amount of extrusion commanded
 	{
-		if (wasPrintingAtInterrupt && (int32_t)(lastSyncTime - reprap.GetMove().ExtruderPrintingSince()) > SyncDelayMillis)
+		const bool usable = wasPrintingAtInterrupt && (int32_t)(lastSyncTime - reprap.GetMove().ExtruderPrintingSince()) > SyncDelayMillis;
+		if (usable)
 		{
 			// We can use this measurement
 			extrusionCommandedThisSegment += extrusionCommandedAtInterrupt;
 			movementMeasuredThisSegment += movementMeasuredSinceLastSync;
 		}
+		RecordSyncedMeasurement(lastInterruptStepClocks, usable, extrusionCommandedAtInterrupt, movementMeasuredSinceLastSync * mmPerPulse);
 		lastSyncTime = lastIsrTime;
 		extrusionCommandedSinceLastSync -= extrusionCommandedAtInterrupt;
 		movementMeasuredSinceLastSync = 0.0;
@@ -174,6 +175,7 @@ FilamentSensorStatus PulsedFilamentMonitor::Check(bool isPrinting, bool fromIsr,
 		extrusionCommandedAtInterrupt = extrusionCommandedSinceLastSync;
 		wasPrintingAtInterrupt = isPrinting;
 		lastIsrTime = isrMillis;
+		lastInterruptStepClocks = GetIsrStepClocks();
 		haveInterruptData = true;
 	}
 
@@ -274,7 +276,8 @@ void PulsedFilamentMonitor::Diagnostics(MessageType mtype, unsigned int extruder
 {
 	Poll();
 	const char* const statusText = (samplesReceived < 2) ? "no data received" : "ok";
-	reprap.GetPlatform().MessageF(mtype, "Extruder %u sensor: %s\n", extruder, statusText);
+	reprap.GetPlatform().MessageF(mtype, "Extruder %u sensor: %s, flow commanded %.2f measured %.2fmm/s\n",
+									extruder, statusText, (double)GetCommandedFlowRate(), (double)GetMeasuredFlowRate());
 }
 
 // End
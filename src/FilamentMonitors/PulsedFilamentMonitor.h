@@ -13,6 +13,9 @@
 class PulsedFilamentMonitor : public FilamentMonitor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<PulsedFilamentMonitor>(); }
+	void operator delete(void* p) { Release<PulsedFilamentMonitor>(p); }
+
 	PulsedFilamentMonitor(unsigned int extruder, int type);
 
 	bool Configure(GCodeBuffer& gb, const StringRef& reply, bool& seen) override;
@@ -26,6 +29,7 @@ private:
 	static constexpr float DefaultMinMovementAllowed = 0.6;
 	static constexpr float DefaultMaxMovementAllowed = 1.6;
 	static constexpr float DefaultMinimumExtrusionCheckLength = 5.0;
+	static constexpr uint32_t SyncIntervalMillis = 50;		// the minimum interval between pulses that we sync the commanded extrusion to
 
 	void Init();
 	void Reset();
@@ -41,6 +45,7 @@ private:
 	// Other data
 	uint32_t sensorValue;									// how many pulses received
 	uint32_t lastIsrTime;									// the time we recorded an interrupt
+	uint32_t lastInterruptStepClocks;						// the step clock time we recorded an interrupt
 	uint32_t lastSyncTime;									// the last time we synced a measurement
 	uint32_t lastMeasurementTime;							// the last time we received a value
 
@@ -264,6 +264,7 @@ void RotatingMagnetFilamentMonitor::HandleIncomingData()
 
 			if (haveStartBitData)					// if we have a synchronised value for the amount of extrusion commanded
 			{
+				bool usable = false;
 				if (synced)
 				{
 					if (   checkNonPrintingMoves
@@ -273,8 +274,10 @@ void RotatingMagnetFilamentMonitor::HandleIncomingData()
 						// We can use this measurement
 						extrusionCommandedThisSegment += extrusionCommandedAtCandidateStartBit;
 						movementMeasuredThisSegment += movementMeasuredSinceLastSync;
+						usable = true;
 					}
 				}
+				RecordSyncedMeasurement(candidateStartBitStepClocks, usable, extrusionCommandedAtCandidateStartBit, movementMeasuredSinceLastSync * mmPerRev);
 				lastSyncTime = candidateStartBitTime;
 				extrusionCommandedSinceLastSync -= extrusionCommandedAtCandidateStartBit;
 				movementMeasuredSinceLastSync = 0.0;
@@ -300,6 +303,7 @@ FilamentSensorStatus RotatingMagnetFilamentMonitor::Check(bool isPrinting, bool
 		extrusionCommandedAtCandidateStartBit = extrusionCommandedSinceLastSync;
 		wasPrintingAtStartBit = isPrinting;
 		candidateStartBitTime = isrMillis;
+		candidateStartBitStepClocks = GetIsrStepClocks();
 		haveStartBitData = true;
 	}
 
@@ -436,8 +440,8 @@ void RotatingMagnetFilamentMonitor::Diagnostics(MessageType mtype, unsigned int
 	buf.printf("Extruder %u: ", extruder);
 	if (dataReceived)
 	{
-		buf.catf("pos %.2f, errs: frame %" PRIu32 " parity %" PRIu32 " ovrun %" PRIu32 " pol %" PRIu32 " ovdue %" PRIu32 "\n",
-					(double)GetCurrentPosition(), framingErrorCount, parityErrorCount, overrunErrorCount, polarityErrorCount, overdueCount);
+		buf.catf("pos %.2f, flow commanded %.2f measured %.2fmm/s, errs: frame %" PRIu32 " parity %" PRIu32 " ovrun %" PRIu32 " pol %" PRIu32 " ovdue %" PRIu32 "\n",
+					(double)GetCurrentPosition(), (double)GetCommandedFlowRate(), (double)GetMeasuredFlowRate(), framingErrorCount, parityErrorCount, overrunErrorCount, polarityErrorCount, overdueCount);
 	}
 	else
 	{
@@ -13,6 +13,9 @@
 class RotatingMagnetFilamentMonitor : public Duet3DFilamentMonitor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<RotatingMagnetFilamentMonitor>(); }
+	void operator delete(void* p) { Release<RotatingMagnetFilamentMonitor>(p); }
+
 	RotatingMagnetFilamentMonitor(unsigned int extruder, int type);
 
 	bool Configure(GCodeBuffer& gb, const StringRef& reply, bool& seen) override;
@@ -69,6 +72,7 @@ private:
 	uint32_t overdueCount;									// the number of times a position report was overdue
 
 	uint32_t candidateStartBitTime;							// the time that we received a possible start bit
+	uint32_t candidateStartBitStepClocks;					// the step clock time that we received a possible start bit
 	float extrusionCommandedAtCandidateStartBit;			// the amount of extrusion commanded since the previous comparison when we received the possible start bit
 
 	uint32_t lastSyncTime;									// the last time we took a measurement that was synced to a start bit
@@ -13,6 +13,9 @@
 class SimpleFilamentMonitor : public FilamentMonitor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<SimpleFilamentMonitor>(); }
+	void operator delete(void* p) { Release<SimpleFilamentMonitor>(p); }
+
 	SimpleFilamentMonitor(unsigned int extruder, int type);
 
 	bool Configure(GCodeBuffer& gb, const StringRef& reply, bool& seen) override;
@@ -0,0 +1,232 @@
+/*
+ * AuxStatusFilter.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "AuxStatusFilter.h"
+#include "OutputMemory.h"
+
+namespace
+{
+	constexpr uint32_t FnvOffsetBasis = 2166136261u;
+	constexpr uint32_t FnvPrime = 16777619u;
+
+	inline uint32_t HashChar(uint32_t hash, char c)
+	{
+		return (hash ^ (uint8_t)c) * FnvPrime;
+	}
+
+	// Return true if a value with this key must be sent in every response
+	bool IsAlwaysWanted(const char *key)
+	{
+		return strcmp(key, "status") == 0 || strcmp(key, "seq") == 0 || strcmp(key, "resp") == 0;
+	}
+
+	// Append the characters of buf between the start and end offsets to dst
+	void CopyRange(OutputBuffer *dst, const OutputBuffer *buf, size_t start, size_t end)
+	{
+		size_t base = 0;
+		for (const OutputBuffer *b = buf; b != nullptr && base < end; b = b->Next())
+		{
+			const size_t length = b->DataLength();
+			if (base + length > start)
+			{
+				const size_t from = (start > base) ? start - base : 0;
+				const size_t to = min<size_t>(end - base, length);
+				dst->cat(b->Data() + from, to - from);
+			}
+			base += length;
+		}
+	}
+}
+
+void AuxStatusFilter::Reset()
+{
+	numRecords = 0;
+	whenLastFullResponse = 0;
+	lastType = -1;
+}
+
+// Return the response to send in place of buf. If we return a different buffer then we have released buf.
+// If buf isn't a simple JSON object or has too many values for us to track, we just return it.
+OutputBuffer *AuxStatusFilter::Apply(OutputBuffer *buf, int type)
+{
+	const uint32_t now = millis();
+	const bool fullResponse = (type != lastType || now - whenLastFullResponse >= FullResponseInterval);
+
+	// Pass 1: find the top-level members of the object and decide which ones to send. A member runs from the opening quote of the key up to the following comma or closing brace.
+	struct Member
+	{
+		uint16_t start, end;
+	};
+	Member members[MaxMembers];
+	ValueRecord newRecords[MaxMembers];
+	size_t numMembers = 0;
+	uint64_t membersToSend = 0;
+
+	size_t offset = 0, memberStart = 1;
+	unsigned int depth = 0;
+	bool inString = false, escaped = false, inKey = true, finished = false;
+	uint32_t keyHash = FnvOffsetBasis, valueHash = FnvOffsetBasis;
+	char key[MaxKeyLength + 1];
+	size_t keyLength = 0;
+
+	for (const OutputBuffer *b = buf; b != nullptr; b = b->Next())
+	{
+		const char * const data = b->Data();
+		for (size_t i = 0; i < b->DataLength(); ++i, ++offset)
+		{
+			const char c = data[i];
+			if (offset == 0)
+			{
+				if (c != '{')
+				{
+					return buf;
+				}
+				depth = 1;
+				continue;
+			}
+			if (finished)
+			{
+				if (c != '\n')
+				{
+					return buf;
+				}
+				continue;
+			}
+
+			if (!inString && depth == 1 && (c == ',' || c == '}'))
+			{
+				// We have reached the end of a member
+				if (offset > memberStart)
+				{
+					if (inKey || numMembers == MaxMembers || offset > UINT16_MAX)
+					{
+						return buf;
+					}
+					key[keyLength] = 0;
+					bool changed = true;
+					for (size_t j = 0; j < numRecords; ++j)
+					{
+						if (records[j].keyHash == keyHash)
+						{
+							changed = (records[j].valueHash != valueHash);
+							break;
+						}
+					}
+					if (fullResponse || changed || IsAlwaysWanted(key))
+					{
+						membersToSend |= (uint64_t)1 << numMembers;
+					}
+					newRecords[numMembers] = { keyHash, valueHash };
+					members[numMembers] = { (uint16_t)memberStart, (uint16_t)offset };
+					++numMembers;
+				}
+				memberStart = offset + 1;
+				inKey = true;
+				keyHash = valueHash = FnvOffsetBasis;
+				keyLength = 0;
+				if (c == '}')
+				{
+					finished = true;
+				}
+				continue;
+			}
+
+			if (!inString && depth == 1 && c == ':' && inKey)
+			{
+				inKey = false;
+				continue;
+			}
+
+			if (inKey)
+			{
+				keyHash = HashChar(keyHash, c);
+				if (c != '"' && keyLength < MaxKeyLength)
+				{
+					key[keyLength++] = c;
+				}
+			}
+			else
+			{
+				valueHash = HashChar(valueHash, c);
+			}
+
+			if (inString)
+			{
+				if (escaped)
+				{
+					escaped = false;
+				}
+				else if (c == '\\')
+				{
+					escaped = true;
+				}
+				else if (c == '"')
+				{
+					inString = false;
+				}
+			}
+			else if (c == '"')
+			{
+				inString = true;
+			}
+			else if (c == '{' || c == '[')
+			{
+				++depth;
+			}
+			else if (c == '}' || c == ']')
+			{
+				--depth;
+			}
+		}
+	}
+
+	if (!finished)
+	{
+		return buf;
+	}
+
+	// Remember what we are about to report. Values that were not in this response are forgotten, so that if they come back they will be sent.
+	memcpy(records, newRecords, numMembers * sizeof(ValueRecord));
+	numRecords = numMembers;
+	if (fullResponse)
+	{
+		lastType = type;
+		whenLastFullResponse = now;
+		return buf;
+	}
+
+	// Pass 2: build the shorter response. If we run out of buffers then send the complete one instead.
+	OutputBuffer *delta;
+	if (!OutputBuffer::Allocate(delta))
+	{
+		return buf;
+	}
+	delta->cat('{');
+	bool first = true;
+	for (size_t i = 0; i < numMembers; ++i)
+	{
+		if ((membersToSend & ((uint64_t)1 << i)) != 0)
+		{
+			if (!first)
+			{
+				delta->cat(',');
+			}
+			first = false;
+			CopyRange(delta, buf, members[i].start, members[i].end);
+		}
+	}
+	delta->cat("}\n");
+	if (delta->HadOverflow())
+	{
+		OutputBuffer::ReleaseAll(delta);
+		return buf;
+	}
+	OutputBuffer::ReleaseAll(buf);
+	return delta;
+}
+
+// End
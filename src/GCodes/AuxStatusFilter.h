@@ -0,0 +1,44 @@
+/*
+ * AuxStatusFilter.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_GCODES_AUXSTATUSFILTER_H_
+#define SRC_GCODES_AUXSTATUSFILTER_H_
+
+#include "RepRapFirmware.h"
+
+class OutputBuffer;
+
+// This class cuts the JSON status responses that we send to PanelDue down to the top-level values that have changed since the last response.
+// PanelDue only updates the fields that are present in a response, so once it has seen a complete response it can be kept up to date this way.
+// We send a complete response at intervals and whenever a different type of response is requested, so that a panel that has been reset catches up.
+// Values that are always wanted (the status and the reply sequence number and text) are never left out.
+class AuxStatusFilter
+{
+public:
+	AuxStatusFilter() { Reset(); }
+
+	void Reset();										// forget what we sent, so that the next response is sent complete
+	OutputBuffer *Apply(OutputBuffer *buf, int type);	// return either buf or a shorter response that replaces it, in which case buf has been released
+
+private:
+	static constexpr size_t MaxMembers = 48;			// the most top-level values we can track, which must not exceed 64
+	static constexpr size_t MaxKeyLength = 15;			// keys longer than this are never treated as always wanted
+	static constexpr uint32_t FullResponseInterval = 5000;	// how often we send a complete response, in milliseconds
+
+	struct ValueRecord
+	{
+		uint32_t keyHash;
+		uint32_t valueHash;
+	};
+
+	ValueRecord records[MaxMembers];					// the hash of each value we reported last time
+	size_t numRecords;
+	uint32_t whenLastFullResponse;
+	int lastType;
+};
+
+#endif /* SRC_GCODES_AUXSTATUSFILTER_H_ */
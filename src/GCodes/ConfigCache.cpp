@@ -0,0 +1,264 @@
+/*
+ * ConfigCache.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "ConfigCache.h"
+#include "GCodeBuffer.h"
+#include "GCodeInput.h"
+#include "Platform.h"
+#include "RepRap.h"
+
+namespace ConfigCache
+{
+	static const char *SkipSpaces(const char *p)
+	{
+		while (*p == ' ' || *p == '\t')
+		{
+			++p;
+		}
+		return p;
+	}
+
+	// Return true if the specified M command takes a parameter that isn't preceded by a letter, such as a filename or a message
+	static bool HasUnprecedentedString(uint32_t commandNumber)
+	{
+		switch (commandNumber)
+		{
+		case 23: case 28: case 29: case 30: case 32: case 36: case 38: case 117:
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	// Try to convert a line of G-code to a binary record. Return the length of the record, or zero if the line must be left as text.
+	// We only convert lines that hold a single G, M or T command whose parameters are all plain decimal numbers, so that the binary record behaves
+	// exactly like the text it came from. Integer values must be small enough to be held exactly in a float.
+	static size_t CompileLine(const char *p, uint8_t record[])
+	{
+		const char letter = *p++;
+		if ((letter != 'G' && letter != 'M' && letter != 'T') || !isdigit(*p))
+		{
+			return 0;
+		}
+
+		uint32_t commandNumber = 0;
+		do
+		{
+			commandNumber = (10 * commandNumber) + (*p++ - '0');
+			if (commandNumber >= BinaryNoCommandNumber)
+			{
+				return 0;
+			}
+		} while (isdigit(*p));
+
+		int8_t commandFraction = -1;
+		if (*p == '.')
+		{
+			++p;
+			if (!isdigit(*p))
+			{
+				return 0;
+			}
+			commandFraction = *p++ - '0';
+		}
+
+		if (letter == 'M' && HasUnprecedentedString(commandNumber))
+		{
+			return 0;
+		}
+
+		uint32_t params = 0;
+		float values[26];
+		for (;;)
+		{
+			p = SkipSpaces(p);
+			if (*p == 0 || *p == ';')
+			{
+				break;
+			}
+
+			// G and M parameters would start a new command, and lower case letters are usually part of a string
+			const char paramLetter = *p++;
+			if (paramLetter < 'A' || paramLetter > 'Z' || paramLetter == 'G' || paramLetter == 'M' || IsBitSet(params, paramLetter - 'A'))
+			{
+				return 0;
+			}
+
+			// Copy the value into a buffer of its own, because strtof would take a following E parameter as an exponent
+			char valueText[16];
+			size_t valueLength = 0;
+			bool seenDigit = false, seenPoint = false;
+			if (*p == '-' || *p == '+')
+			{
+				valueText[valueLength++] = *p++;
+			}
+			while (isdigit(*p) || (*p == '.' && !seenPoint))
+			{
+				if (*p == '.')
+				{
+					seenPoint = true;
+				}
+				else
+				{
+					seenDigit = true;
+				}
+				if (valueLength == ARRAY_SIZE(valueText) - 1)
+				{
+					return 0;
+				}
+				valueText[valueLength++] = *p++;
+			}
+			if (!seenDigit || (*p != ' ' && *p != '\t' && *p != ';' && *p != 0 && (*p < 'A' || *p > 'Z')))
+			{
+				return 0;
+			}
+			valueText[valueLength] = 0;
+
+			const float val = strtof(valueText, nullptr);
+			if (!seenPoint && fabsf(val) >= 16777216.0)
+			{
+				return 0;
+			}
+			values[paramLetter - 'A'] = val;
+			SetBit(params, paramLetter - 'A');
+		}
+
+		if ((size_t)__builtin_popcount(params) > GCodeBuffer::MaxBinaryParameters)
+		{
+			return 0;
+		}
+
+		record[0] = (uint8_t)letter | BinaryRecordFlag;
+		record[1] = (uint8_t)commandNumber;
+		record[2] = (uint8_t)(commandNumber >> 8);
+		record[3] = (uint8_t)commandFraction;
+		memcpy(record + 4, &params, sizeof(params));
+		size_t recordLength = BinaryRecordHeaderLength;
+		for (unsigned int i = 0; i < 26; ++i)
+		{
+			if (IsBitSet(params, i))
+			{
+				memcpy(record + recordLength, &values[i], sizeof(float));
+				recordLength += sizeof(float);
+			}
+		}
+		return recordLength;
+	}
+
+	// Return true if the cache exists and was built from the version of config.g described by sourceLine
+	static bool IsValid(const char *sourceLine)
+	{
+		FileStore * const f = reprap.GetPlatform().OpenSysFile(CONFIG_CACHE_FILE, OpenMode::read);
+		if (f == nullptr)
+		{
+			return false;
+		}
+
+		char line[MaxFilenameLength + 40];
+		const bool valid = f->ReadLine(line, sizeof(line)) == (int)BinaryGCodeSignatureLength - 1
+						&& memcmp(line, BinaryGCodeSignature, BinaryGCodeSignatureLength - 1) == 0
+						&& f->ReadLine(line, sizeof(line)) >= 0
+						&& strcmp(line, sourceLine) == 0;
+		f->Close();
+		return valid;
+	}
+
+	// Build the cache from config.g. We write it to a temporary file first, so that if we are reset part way through we don't leave an incomplete cache.
+	static bool Build(const char *configFile, const char *sourceLine)
+	{
+		Platform& platform = reprap.GetPlatform();
+		FileStore * const src = platform.OpenSysFile(configFile, OpenMode::read);
+		if (src == nullptr)
+		{
+			return false;
+		}
+		FileStore * const dst = platform.OpenSysFile(CONFIG_CACHE_TEMP_FILE, OpenMode::write);
+		if (dst == nullptr)
+		{
+			src->Close();
+			return false;
+		}
+
+		bool ok = dst->Write(BinaryGCodeSignature) && dst->Write(sourceLine) && dst->Write('\n');
+		char line[GCODE_LENGTH + 1];
+		uint8_t record[BinaryRecordHeaderLength + 26 * sizeof(float)];
+		while (ok)
+		{
+			const int len = src->ReadLine(line, sizeof(line));
+			if (len < 0)
+			{
+				break;											// end of file
+			}
+			if (len >= (int)sizeof(line) - 1)
+			{
+				ok = false;										// the line may have been split, so don't cache this file
+				break;
+			}
+
+			const char * const p = SkipSpaces(line);
+			if (*p == 0 || *p == ';')
+			{
+				continue;										// leave out blank lines and comments
+			}
+
+			const size_t recordLength = CompileLine(p, record);
+			if (recordLength != 0)
+			{
+				ok = dst->Write(record, recordLength);
+			}
+			else
+			{
+				// A text line mustn't start with a byte that has the top bit set, because that would be taken as the start of a binary record
+				ok = ((*p & BinaryRecordFlag) == 0 || dst->Write(' ')) && dst->Write(p) && dst->Write('\n');
+			}
+		}
+		src->Close();
+		ok = dst->Close() && ok;
+
+		String<MaxFilenameLength> tempPath, cachePath;
+		if (ok && platform.MakeSysFileName(tempPath.GetRef(), CONFIG_CACHE_TEMP_FILE) && platform.MakeSysFileName(cachePath.GetRef(), CONFIG_CACHE_FILE))
+		{
+			if (platform.SysFileExists(CONFIG_CACHE_FILE))
+			{
+				platform.DeleteSysFile(CONFIG_CACHE_FILE);
+			}
+			if (platform.GetMassStorage()->Rename(tempPath.c_str(), cachePath.c_str()))
+			{
+				return true;
+			}
+		}
+		platform.DeleteSysFile(CONFIG_CACHE_TEMP_FILE);
+		return false;
+	}
+}
+
+// Return the name of the system file to run instead of configFile. This is the cache if it is up to date or we could rebuild it, else configFile itself.
+const char *ConfigCache::GetFileToRun(const char *configFile)
+{
+	Platform& platform = reprap.GetPlatform();
+	String<MaxFilenameLength> configPath;
+	if (!platform.MakeSysFileName(configPath.GetRef(), configFile))
+	{
+		return configFile;
+	}
+
+	FileStore * const f = platform.OpenSysFile(configFile, OpenMode::read);
+	if (f == nullptr)
+	{
+		return configFile;
+	}
+	const FilePosition size = f->Length();
+	f->Close();
+
+	// We identify the version of config.g by its modification time and size. The time alone isn't enough, because the clock may not have been set.
+	String<MaxFilenameLength + 40> sourceLine;
+	sourceLine.printf("; source %s %" PRIu32 " %" PRIu32, configFile, (uint32_t)platform.GetMassStorage()->GetLastModifiedTime(configPath.c_str()), (uint32_t)size);
+	return (IsValid(sourceLine.c_str()) || Build(configFile, sourceLine.c_str())) ? CONFIG_CACHE_FILE : configFile;
+}
+
+// End
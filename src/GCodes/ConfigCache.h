@@ -0,0 +1,22 @@
+/*
+ * ConfigCache.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_GCODES_CONFIGCACHE_H_
+#define SRC_GCODES_CONFIGCACHE_H_
+
+#include "RepRapFirmware.h"
+
+// The config cache is a copy of config.g in binary G-code format (see GCodeInput.h), which we build the first time we run config.g after it has changed.
+// Commands that have only numeric parameters are held as binary records, so running them needs no parsing. Everything else is copied as text,
+// apart from comments and blank lines which are left out. The second line of the cache records the modification time and size of config.g when we
+// built it, so that we can tell when the cache is out of date. Macros that config.g calls with M98 are always run from their own files.
+namespace ConfigCache
+{
+	const char *GetFileToRun(const char *configFile);		// Return the name of the system file to run instead of configFile, rebuilding the cache if necessary
+}
+
+#endif /* SRC_GCODES_CONFIGCACHE_H_ */
@@ -13,15 +13,19 @@
 #include "Platform.h"
 #include "RepRap.h"
 #include "General/IP4String.h"
+#include "Movement/StepTimer.h"
 
 static constexpr char eofString[] = EOF_STRING;		// What's at the end of an HTML file?
 
+static_assert(GCODE_LENGTH <= 256, "GCODE_LENGTH too large for parameterOffsets");
+static_assert(GCodeBuffer::MaxBinaryParameters >= 16, "GCODE_LENGTH too small for binary commands");
+
 // Create a default GCodeBuffer
 GCodeBuffer::GCodeBuffer(const char* id, MessageType mt, bool usesCodeQueue)
 	: machineState(new GCodeMachineState()), identity(id), fileBeingWritten(nullptr), writingFileSize(0), eofStringCounter(0),
 	  toolNumberAdjust(0), responseMessageType(mt),
 	  hasCommandNumber(false), commandLetter('Q'),
-	  checksumRequired(false), queueCodes(usesCodeQueue), binaryWriting(false)
+	  checksumRequired(false), reportBufferSpace(false), queueCodes(usesCodeQueue), binaryWriting(false)
 {
 	Init();
 }
@@ -37,6 +41,8 @@ void GCodeBuffer::Init()
 	gcodeLineEnd = 0;
 	commandLength = 0;
 	readPointer = -1;
+	parameterLetters = 0;
+	binaryCommand = false;
 	hadLineNumber = hadChecksum = timerRunning = false;
 	computedChecksum = 0;
 	bufferState = GCodeBufferState::parseNotStarted;
@@ -335,12 +341,14 @@ void GCodeBuffer::DecodeCommand()
 		}
 
 		// Find where the end of the command is. We assume that a G or M preceded by a space and not inside quotes is the start of a new command.
+		// Index the parameter letters in the same pass, because most commands are short G0 or G1 commands and this is the only time we need to look at them.
+		parameterLetters = 0;
 		bool inQuotes = false;
 		bool primed = false;
+		unsigned int inBrackets = 0;
 		for (commandEnd = parameterStart; commandEnd < gcodeLineEnd; ++commandEnd)
 		{
 			const char c = gcodeBuffer[commandEnd];
-			char c2;
 			if (c == '"')
 			{
 				inQuotes = !inQuotes;
@@ -348,11 +356,24 @@ void GCodeBuffer::DecodeCommand()
 			}
 			else if (!inQuotes)
 			{
-				if (primed && ((c2 = toupper(c)) == 'G' || c2 == 'M'))
+				const char c2 = toupper(c);
+				if (primed && (c2 == 'G' || c2 == 'M'))
 				{
 					break;
 				}
 				primed = (c == ' ' || c == '\t');
+				if (inBrackets == 0)
+				{
+					IndexParameter(c2, commandEnd);
+				}
+				if (c == '[')
+				{
+					++inBrackets;
+				}
+				else if (c == ']' && inBrackets != 0)
+				{
+					--inBrackets;
+				}
 			}
 		}
 	}
@@ -368,6 +389,7 @@ void GCodeBuffer::DecodeCommand()
 		// Fanuc-style GCode, repeat the existing G0/G1/G2/G3 command with the new parameters
 		parameterStart = commandStart;
 		commandEnd = gcodeLineEnd;
+		IndexParameters();
 	}
 	else
 	{
@@ -378,11 +400,58 @@ void GCodeBuffer::DecodeCommand()
 		commandFraction = -1;
 		parameterStart = commandStart;
 		commandEnd = gcodeLineEnd;
+		IndexParameters();
 	}
 
 	bufferState = GCodeBufferState::ready;
 }
 
+// Record the position of parameter letter 'c' at index 'i' in the buffer if it is the first occurrence of that letter. 'c' must be uppercase.
+// E preceded by a digit is part of a number in exponent format.
+inline void GCodeBuffer::IndexParameter(char c, unsigned int i)
+{
+	if (   c >= 'A' && c <= 'Z'
+		&& !IsBitSet(parameterLetters, c - 'A')
+		&& (c != 'E' || i == parameterStart || !isdigit(gcodeBuffer[i - 1]))
+	   )
+	{
+		SetBit(parameterLetters, c - 'A');
+		parameterOffsets[c - 'A'] = (uint8_t)i;
+	}
+}
+
+// Find the first occurrence of each parameter letter in the command, so that Seen doesn't need to search for it.
+// A letter counts if it is not inside a quoted string or an expression in brackets.
+void GCodeBuffer::IndexParameters()
+{
+	parameterLetters = 0;
+	bool inQuotes = false;
+	unsigned int inBrackets = 0;
+	for (unsigned int i = parameterStart; i < commandEnd; ++i)
+	{
+		const char b = gcodeBuffer[i];
+		if (b == '"')
+		{
+			inQuotes = !inQuotes;
+		}
+		else if (!inQuotes)
+		{
+			if (inBrackets == 0)
+			{
+				IndexParameter(toupper(b), i);
+			}
+			if (b == '[')
+			{
+				++inBrackets;
+			}
+			else if (b == ']' && inBrackets != 0)
+			{
+				--inBrackets;
+			}
+		}
+	}
+}
+
 // Add an entire string, overwriting any existing content and adding '\n' at the end if necessary to make it a complete line
 void GCodeBuffer::Put(const char *str, size_t len)
 {
@@ -404,6 +473,88 @@ void GCodeBuffer::Put(const char *str)
 	Put(str, strlen(str));
 }
 
+// Set up a command that was read from a binary G-code file. A negative command number means there wasn't one.
+// 'params' is a bitmap of the parameter letters A to Z and 'values' holds their values as little-endian floats in the order of the letters.
+// 'recordLength' is the number of bytes the command occupied in the file, so that GetFilePosition still works.
+void GCodeBuffer::PutBinary(char letter, int number, int8_t fraction, uint32_t params, const uint8_t *values, unsigned int recordLength)
+pre(__builtin_popcount(params) <= MaxBinaryParameters)
+{
+	Init();
+	commandLetter = letter;
+	hasCommandNumber = (number >= 0);
+	commandNumber = number;
+	commandFraction = fraction;
+
+	// Keep the command letter and number as text so that messages that quote the command make sense
+	if (hasCommandNumber)
+	{
+		String<BinaryCommandTextLength> text;
+		PrintCommand(text.GetRef());
+		SafeStrncpy(gcodeBuffer, text.c_str(), BinaryCommandTextLength);
+	}
+	else
+	{
+		gcodeBuffer[0] = letter;
+		gcodeBuffer[1] = 0;
+	}
+
+	// Store the values after the text and index them, so that Seen works in the same way as it does for text commands
+	parameterLetters = params;
+	unsigned int offset = BinaryCommandTextLength;
+	for (unsigned int i = 0; i < 26; ++i)
+	{
+		if (IsBitSet(params, i))
+		{
+			parameterOffsets[i] = (uint8_t)offset;
+			memcpy(gcodeBuffer + offset, values, sizeof(float));
+			values += sizeof(float);
+			offset += sizeof(float);
+		}
+	}
+	gcodeBuffer[offset] = 0;							// so that GetUnprecedentedString finds an empty string
+
+	commandStart = 0;
+	parameterStart = commandEnd = gcodeLineEnd = offset;
+	commandLength = recordLength;
+	binaryCommand = true;
+	bufferState = GCodeBufferState::ready;
+}
+
+// Convert a command that was read from a binary G-code file to text. This is needed when the command is to be queued or written to a file.
+void GCodeBuffer::MakeTextCommand()
+{
+	if (binaryCommand)
+	{
+		String<GCODE_LENGTH> text;
+		text.copy(gcodeBuffer);
+		for (unsigned int i = 0; i < 26; ++i)
+		{
+			if (IsBitSet(parameterLetters, i))
+			{
+				float val;
+				memcpy(&val, gcodeBuffer + parameterOffsets[i], sizeof(float));
+				if (val == (float)(int32_t)val && fabsf(val) < 1000000.0)
+				{
+					text.catf(" %c%" PRIi32, 'A' + i, (int32_t)val);
+				}
+				else
+				{
+					text.catf(" %c%.5f", 'A' + i, (double)val);
+				}
+			}
+		}
+
+		// Decode the text in the same way as a line we received, keeping the length of the binary record for GetFilePosition
+		const unsigned int recordLength = commandLength;
+		SafeStrncpy(gcodeBuffer, text.c_str(), ARRAY_SIZE(gcodeBuffer));
+		binaryCommand = false;
+		gcodeLineEnd = strlen(gcodeBuffer);
+		commandStart = 0;
+		commandLength = recordLength;
+		DecodeCommand();
+	}
+}
+
 void GCodeBuffer::SetFinished(bool f)
 {
 	if (f)
@@ -440,6 +591,18 @@ FilePosition GCodeBuffer::GetFilePosition(size_t bytesCached) const
 // Leave the pointer there for a subsequent read.
 bool GCodeBuffer::Seen(char c)
 {
+	if (c >= 'A' && c <= 'Z')
+	{
+		// Letters were indexed when we decoded the command
+		if (IsBitSet(parameterLetters, c - 'A'))
+		{
+			readPointer = parameterOffsets[c - 'A'];
+			return true;
+		}
+		readPointer = -1;
+		return false;
+	}
+
 	bool inQuotes = false;
 	unsigned int inBrackets = 0;
 	for (readPointer = parameterStart; (unsigned int)readPointer < commandEnd; ++readPointer)
@@ -469,11 +632,44 @@ bool GCodeBuffer::Seen(char c)
 	return false;
 }
 
+// Get the value of a parameter of a command from a binary G-code file, after a call to Seen() found it
+inline float GCodeBuffer::ReadBinaryValue()
+{
+	float result;
+	memcpy(&result, gcodeBuffer + readPointer, sizeof(float));
+	readPointer = -1;
+	return result;
+}
+
+// Return a single value as an array, filling the array with it if doPad is true
+template<class T> static void SetSingleValueArray(T arr[], size_t& returnedLength, bool doPad, T val)
+{
+	if (returnedLength != 0)
+	{
+		arr[0] = val;
+		if (doPad)
+		{
+			for (size_t i = 1; i < returnedLength; i++)
+			{
+				arr[i] = val;
+			}
+		}
+		else
+		{
+			returnedLength = 1;
+		}
+	}
+}
+
 // Get a float after a G Code letter found by a call to Seen()
 float GCodeBuffer::GetFValue()
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			return ReadBinaryValue();
+		}
 		const float result = ReadFloatValue(&gcodeBuffer[readPointer + 1], nullptr);
 		readPointer = -1;
 		return result;
@@ -495,6 +691,13 @@ void GCodeBuffer::GetFloatArray(float arr[], size_t& returnedLength, bool doPad)
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			// Binary commands only have single values
+			SetSingleValueArray(arr, returnedLength, doPad, ReadBinaryValue());
+			return;
+		}
+
 		size_t length = 0;
 		const char *p = gcodeBuffer + readPointer + 1;
 		for (;;)
@@ -543,6 +746,12 @@ void GCodeBuffer::GetIntArray(int32_t arr[], size_t& returnedLength, bool doPad)
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			SetSingleValueArray(arr, returnedLength, doPad, GetIValue());
+			return;
+		}
+
 		size_t length = 0;
 		const char *p = gcodeBuffer + readPointer + 1;
 		for (;;)
@@ -590,6 +799,12 @@ void GCodeBuffer::GetUnsignedArray(uint32_t arr[], size_t& returnedLength, bool
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			SetSingleValueArray(arr, returnedLength, doPad, GetUIValue());
+			return;
+		}
+
 		size_t length = 0;
 		const char *p = gcodeBuffer + readPointer + 1;
 		for (;;)
@@ -639,6 +854,11 @@ bool GCodeBuffer::GetQuotedString(const StringRef& str)
 	str.Clear();
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			readPointer = -1;		// binary commands don't have string parameters
+			return false;
+		}
 		++readPointer;				// skip the character that introduced the string
 		switch (gcodeBuffer[readPointer])
 		{
@@ -702,6 +922,12 @@ bool GCodeBuffer::GetPossiblyQuotedString(const StringRef& str)
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			str.Clear();
+			readPointer = -1;
+			return false;
+		}
 		++readPointer;
 		return InternalGetPossiblyQuotedString(str);
 	}
@@ -727,6 +953,7 @@ bool GCodeBuffer::InternalGetPossiblyQuotedString(const StringRef& str)
 #endif
 
 	commandEnd = gcodeLineEnd;				// the string is the remainder of the line of gcode
+	IndexParameters();						// the command may now include more parameter letters
 	for (;;)
 	{
 		const char c = gcodeBuffer[readPointer++];
@@ -761,6 +988,10 @@ int32_t GCodeBuffer::GetIValue()
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			return (int32_t)ReadBinaryValue();
+		}
 		const int32_t result = ReadIValue(&gcodeBuffer[readPointer + 1], nullptr);
 		readPointer = -1;
 		return result;
@@ -775,6 +1006,11 @@ uint32_t GCodeBuffer::GetUIValue()
 {
 	if (readPointer >= 0)
 	{
+		if (binaryCommand)
+		{
+			const float val = ReadBinaryValue();
+			return (val > 0.0) ? (uint32_t)val : 0;
+		}
 		const uint32_t result = ReadUIValue(&gcodeBuffer[readPointer + 1], nullptr);
 		readPointer = -1;
 		return result;
@@ -784,6 +1020,25 @@ uint32_t GCodeBuffer::GetUIValue()
 	return 0;
 }
 
+// Get a file position after a G Code letter. Files on exFAT cards may be larger than 4Gb, so we can't use GetUIValue.
+FilePosition GCodeBuffer::GetFilePositionValue()
+{
+	if (readPointer >= 0)
+	{
+		if (binaryCommand)
+		{
+			const float val = ReadBinaryValue();
+			return (val > 0.0) ? (FilePosition)val : 0;
+		}
+		const FilePosition result = strtoull(&gcodeBuffer[readPointer + 1], nullptr, 10);
+		readPointer = -1;
+		return result;
+	}
+
+	INTERNAL_ERROR;
+	return 0;
+}
+
 // If the specified parameter character is found, fetch 'value' and set 'seen'. Otherwise leave val and seen alone.
 bool GCodeBuffer::TryGetFValue(char c, float& val, bool& seen)
 {
@@ -908,6 +1163,11 @@ bool GCodeBuffer::GetIPAddress(IPAddress& returnedIp)
 		INTERNAL_ERROR;
 		return false;
 	}
+	if (binaryCommand)
+	{
+		readPointer = -1;
+		return false;
+	}
 
 	const char* p = &gcodeBuffer[readPointer + 1];
 	uint8_t ip[4];
@@ -953,6 +1213,11 @@ bool GCodeBuffer::GetMacAddress(uint8_t mac[6])
 		INTERNAL_ERROR;
 		return false;
 	}
+	if (binaryCommand)
+	{
+		readPointer = -1;
+		return false;
+	}
 
 	const char* p = gcodeBuffer + readPointer + 1;
 	unsigned int n = 0;
@@ -1114,7 +1379,7 @@ void GCodeBuffer::PrintCommand(const StringRef& s) const
 // Open a file to write to
 bool GCodeBuffer::OpenFileToWrite(const char* directory, const char* fileName, const FilePosition size, const bool binaryWrite, const uint32_t fileCRC32)
 {
-	fileBeingWritten = reprap.GetPlatform().OpenFile(directory, fileName, OpenMode::write);
+	fileBeingWritten = reprap.GetPlatform().OpenFile(directory, fileName, OpenMode::write, size);		// preallocate contiguous space if we know the size
 	eofStringCounter = 0;
 	writingFileSize = size;
 	if (fileBeingWritten == nullptr)
@@ -1251,17 +1516,25 @@ float GCodeBuffer::ReadFloatValue(const char *p, const char **endptr)
 	if (*p == '[')
 	{
 		ExpressionValue val;
+		// Numeric values are used directly in their own types, never converted to text and back
 		switch (EvaluateExpression(p, endptr, val))
 		{
 		case TYPE_OF(float):
+		case TYPE_OF(Float2):
+		case TYPE_OF(Float3):
 			return val.fVal;
 
 		case TYPE_OF(int32_t):
 			return (float)val.iVal;
 
 		case TYPE_OF(uint32_t):
+		case TYPE_OF(Bitmap32):
+		case TYPE_OF(Enum32):
 			return (float)val.uVal;
 
+		case TYPE_OF(bool):
+			return (val.bVal) ? 1.0 : 0.0;
+
 		default:
 			//TODO report error
 			return 1.0;
@@ -1269,7 +1542,181 @@ float GCodeBuffer::ReadFloatValue(const char *p, const char **endptr)
 	}
 #endif
 
-	return SafeStrtof(p, endptr);
+	return ReadDecimalFloat(p, endptr);
+}
+
+// Convert a number in a line of GCode to a float. Numbers in GCode nearly always have the form [+|-]digits[.digits] with no exponent and not many significant digits.
+// We convert those here without using double precision arithmetic or the library. The digits form an integer less than 2^24, which is exact as a float, and the powers of ten
+// in the table are exact too, so a single multiplication or division gives the correctly rounded result, the same as the library.
+// Anything else, such as a number with an exponent or too many significant digits, is passed to SafeStrtof.
+/*static*/ float GCodeBuffer::ReadDecimalFloat(const char *p, const char **endptr)
+{
+	static constexpr float PowersOfTen[] = { 1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9, 1.0e10 };		// all exactly representable
+	constexpr unsigned int MaxDigits = 9;						// so that the mantissa can't overflow
+	constexpr uint32_t MaxExactMantissa = 1u << 24;
+	constexpr int MaxExponent = (int)ARRAY_SIZE(PowersOfTen) - 1;
+
+	const char * const start = p;
+	while (*p == ' ' || *p == '\t')
+	{
+		++p;
+	}
+	const bool negative = (*p == '-');
+	if (negative || *p == '+')
+	{
+		++p;
+	}
+
+	uint32_t mantissa = 0;
+	unsigned int numDigits = 0;									// the number of significant digits in the mantissa
+	int exponent = 0;
+	bool seenDigit = false;
+	while (isdigit(*p))
+	{
+		seenDigit = true;
+		if (numDigits < MaxDigits)
+		{
+			mantissa = (10 * mantissa) + (*p - '0');
+			if (mantissa != 0)
+			{
+				++numDigits;
+			}
+		}
+		else
+		{
+			++exponent;											// the mantissa is already too large to be exact, so we will use the library
+		}
+		++p;
+	}
+	if (*p == '.')
+	{
+		++p;
+		while (isdigit(*p))
+		{
+			seenDigit = true;
+			if (numDigits < MaxDigits)
+			{
+				mantissa = (10 * mantissa) + (*p - '0');
+				if (mantissa != 0)
+				{
+					++numDigits;
+				}
+				--exponent;
+			}
+			++p;
+		}
+	}
+
+	if (   !seenDigit || *p == 'e' || *p == 'E' || *p == 'x' || *p == 'X'
+		|| mantissa >= MaxExactMantissa || exponent > MaxExponent || exponent < -MaxExponent
+	   )
+	{
+		return SafeStrtof(start, endptr);						// not a simple decimal number, or we can't convert it exactly
+	}
+
+	if (endptr != nullptr)
+	{
+		*endptr = p;
+	}
+	float rslt = (float)mantissa;
+	if (exponent < 0)
+	{
+		rslt /= PowersOfTen[-exponent];
+	}
+	else if (exponent > 0)
+	{
+		rslt *= PowersOfTen[exponent];
+	}
+	return (negative) ? -rslt : rslt;
+}
+
+// Canned lines from a sliced file, used by the parsing benchmark
+static const char * const BenchmarkLines[] =
+{
+	"G1 X102.347 Y87.512 E0.04213",
+	"G1 X103.118 Y88.004 E0.03307",
+	"G1 X103.905 Y88.921 E0.04376 F1800",
+	"G1 F3000 X98.5 Y91.25 E-0.8",
+	"G0 X115.762 Y64.028 Z0.35",
+	"G1 X-12.5 Y0.005 E1.05",
+	"G1 Z2.35 F7800",
+	"G1 X114.44 Y65.35 E0.06014 F2400",
+	"M204 S1000",
+	"G1 X110.001 Y69.789 E0.20185",
+	"G1 E0.8 F2100",
+	"M106 S127.5",
+};
+
+// Parse the canned lines repeatedly and report how long it took. Also check that our number conversion agrees with the library.
+/*static*/ GCodeResult GCodeBuffer::RunParseBenchmark(GCodeBuffer& gb, const StringRef& reply)
+{
+	const unsigned int numRepeats = (gb.Seen('S')) ? constrain<unsigned int>(gb.GetUIValue(), 1, 1000) : 100;
+
+	// Use a buffer of our own, so that we don't disturb the one that holds this command
+	static GCodeBuffer *benchmarkBuffer = nullptr;
+	if (benchmarkBuffer == nullptr)
+	{
+		benchmarkBuffer = new GCodeBuffer("benchmark", GenericMessage, false);
+	}
+
+	uint32_t parseClocks = 0, numValues = 0;
+	float total = 0.0;											// so that the compiler can't leave out the conversions
+	for (unsigned int i = 0; i < numRepeats; ++i)
+	{
+		for (const char *line : BenchmarkLines)
+		{
+			const uint32_t now = StepTimer::GetInterruptClocks();
+			benchmarkBuffer->Put(line);
+			for (char c : "XYZEFS")
+			{
+				if (c != 0 && benchmarkBuffer->Seen(c))
+				{
+					total += benchmarkBuffer->GetFValue();
+					++numValues;
+				}
+			}
+			parseClocks += StepTimer::GetInterruptClocks() - now;
+			benchmarkBuffer->SetFinished(true);
+		}
+	}
+
+	// Time the number conversions on their own, and compare them with the library
+	uint32_t fastClocks = 0, libraryClocks = 0, numConversions = 0, numMismatches = 0;
+	for (const char *line : BenchmarkLines)
+	{
+		for (const char *p = line; *p != 0; ++p)
+		{
+			if (*p == ' ' && p[1] != 'G' && p[1] != 'M' && p[1] != 0)
+			{
+				const char * const number = p + 2;
+				const uint32_t now1 = StepTimer::GetInterruptClocks();
+				const float f1 = ReadDecimalFloat(number, nullptr);
+				const uint32_t now2 = StepTimer::GetInterruptClocks();
+				const float f2 = SafeStrtof(number, nullptr);
+				libraryClocks += StepTimer::GetInterruptClocks() - now2;
+				fastClocks += now2 - now1;
+				++numConversions;
+				if (f1 != f2)
+				{
+					++numMismatches;
+				}
+			}
+		}
+	}
+
+	if (numConversions == 0 || numValues == 0)
+	{
+		reply.copy("Parse benchmark: nothing was parsed");
+		return GCodeResult::error;
+	}
+
+	reply.printf("Parse benchmark: %u lines, %" PRIu32 " values in %.2fms, %.2fus per line, check %.1f; number conversion %.2fus, library %.2fus, %" PRIu32 " mismatches",
+					numRepeats * ARRAY_SIZE(BenchmarkLines), numValues, (double)((float)parseClocks * 1000.0/StepTimer::StepClockRate),
+					(double)((float)parseClocks * 1000000.0/((float)StepTimer::StepClockRate * (float)(numRepeats * ARRAY_SIZE(BenchmarkLines)))), (double)total,
+					(double)((float)fastClocks * 1000000.0/((float)StepTimer::StepClockRate * (float)numConversions)),
+					(double)((float)libraryClocks * 1000000.0/((float)StepTimer::StepClockRate * (float)numConversions)),
+					numMismatches);
+	return (numMismatches == 0) ? GCodeResult::ok : GCodeResult::warning;
 }
 
 uint32_t GCodeBuffer::ReadUIValue(const char *p, const char **endptr)
@@ -1281,6 +1728,8 @@ uint32_t GCodeBuffer::ReadUIValue(const char *p, const char **endptr)
 		switch (EvaluateExpression(p, endptr, val))
 		{
 		case TYPE_OF(uint32_t):
+		case TYPE_OF(Bitmap32):
+		case TYPE_OF(Enum32):
 			return val.uVal;
 
 		case TYPE_OF(int32_t):
@@ -1291,6 +1740,19 @@ uint32_t GCodeBuffer::ReadUIValue(const char *p, const char **endptr)
 			//TODO report error
 			return 0;
 
+		case TYPE_OF(bool):
+			return (val.bVal) ? 1 : 0;
+
+		case TYPE_OF(float):
+		case TYPE_OF(Float2):
+		case TYPE_OF(Float3):
+			if (val.fVal >= 0.0)
+			{
+				return (uint32_t)lrintf(val.fVal);
+			}
+			//TODO report error
+			return 0;
+
 		default:
 			//TODO report error
 			return 0;
@@ -1343,8 +1805,18 @@ int32_t GCodeBuffer::ReadIValue(const char *p, const char **endptr)
 			return val.iVal;
 
 		case TYPE_OF(uint32_t):
+		case TYPE_OF(Bitmap32):
+		case TYPE_OF(Enum32):
 			return (int32_t)val.uVal;
 
+		case TYPE_OF(bool):
+			return (val.bVal) ? 1 : 0;
+
+		case TYPE_OF(float):
+		case TYPE_OF(Float2):
+		case TYPE_OF(Float3):
+			return lrintf(val.fVal);
+
 		default:
 			//TODO report error
 			return 0;
@@ -1403,6 +1875,49 @@ bool GCodeBuffer::GetStringExpression(const StringRef& str)
 	return true;
 }
 
+// Cache of the variable names that we evaluated most recently, resolved to object model table entries.
+// Macros that run repeatedly, such as daemon.g, tend to evaluate the same few expressions, so this saves parsing the names and searching the tables each time.
+// All the GCodeBuffers are processed by the same task, so they can share it.
+struct CachedVariable
+{
+	static constexpr size_t MaxNameLength = 40;			// longer names are not cached
+
+	char name[MaxNameLength + 1];
+	CompiledObjectPath path;
+};
+
+static CachedVariable variableCache[4];
+static size_t nextVariableCacheSlot = 0;
+
+// Get the value of a variable, using the cache if possible
+static TypeCode GetVariableValue(ExpressionValue& rslt, const char *varName)
+{
+	const size_t len = strlen(varName);
+	if (len > CachedVariable::MaxNameLength)
+	{
+		return reprap.GetObjectValue(rslt, varName);
+	}
+
+	for (CachedVariable& cv : variableCache)
+	{
+		if (cv.path.IsValid() && strcmp(cv.name, varName) == 0)
+		{
+			return cv.path.GetValue(&reprap, rslt);
+		}
+	}
+
+	CompiledObjectPath path;
+	if (path.Compile(&reprap, varName))
+	{
+		CachedVariable& cv = variableCache[nextVariableCacheSlot];
+		memcpy(cv.name, varName, len + 1);
+		cv.path = path;
+		nextVariableCacheSlot = (nextVariableCacheSlot + 1) % ARRAY_SIZE(variableCache);
+		return path.GetValue(&reprap, rslt);
+	}
+	return reprap.GetObjectValue(rslt, varName);			// the name doesn't resolve to a primitive value, so let GetObjectValue deal with it
+}
+
 // Evaluate an expression. the current character is '['.
 TypeCode GCodeBuffer::EvaluateExpression(const char *p, const char **endptr, ExpressionValue& rslt)
 {
@@ -1432,7 +1947,7 @@ TypeCode GCodeBuffer::EvaluateExpression(const char *p, const char **endptr, Exp
 			return NoType;
 		}
 		//TODO consider supporting standard CNC functions here
-		const TypeCode tc = reprap.GetObjectValue(rslt, varName.c_str());
+		const TypeCode tc = GetVariableValue(rslt, varName.c_str());
 		if (tc != NoType && (tc & IsArray) == 0 && *p == ']')
 		{
 			if (endptr != nullptr)
@@ -12,6 +12,7 @@
 #include "GCodeMachineState.h"
 #include "MessageType.h"
 #include "ObjectModel/ObjectModel.h"
+#include "GCodeResult.h"
 
 // Class to hold an individual GCode and provide functions to allow it to be parsed
 class GCodeBuffer
@@ -24,6 +25,8 @@ public:
 	bool Put(char c) __attribute__((hot));				// Add a character to the end
 	void Put(const char *str, size_t len);				// Add an entire string, overwriting any existing content
 	void Put(const char *str);							// Add a null-terminated string, overwriting any existing content
+	void PutBinary(char letter, int number, int8_t fraction, uint32_t params, const uint8_t *values, unsigned int recordLength);	// Set up a command from a binary G-code file
+	void MakeTextCommand();								// Convert a command from a binary G-code file to text
 	void FileEnded();									// Called when we reach the end of the file we are reading from
 	bool Seen(char c) __attribute__((hot));				// Is a character present?
 
@@ -36,6 +39,7 @@ public:
 	float GetDistance();								// Get a distance or coordinate and convert it from inches to mm if necessary
 	int32_t GetIValue() __attribute__((hot));			// Get an integer after a key letter
 	uint32_t GetUIValue();								// Get an unsigned integer value
+	FilePosition GetFilePositionValue();				// Get a file position, which may need more than 32 bits
 	bool GetIPAddress(IPAddress& returnedIp);			// Get an IP address quad after a key letter
 	bool GetMacAddress(uint8_t mac[6]);					// Get a MAC address sextet after a key letter
 	bool GetUnprecedentedString(const StringRef& str);	// Get a string with no preceding key letter
@@ -56,13 +60,18 @@ public:
 
 	const char* Buffer() const;
 	bool IsIdle() const;
+	bool IsAtStartOfLine() const { return bufferState == GCodeBufferState::parseNotStarted && commandLength == 0; }	// Return true if we have not been given any of the next line
+	bool IsBinaryCommand() const { return binaryCommand; }	// Return true if the current command came from a binary G-code file
+	bool IsDiscarding() const { return bufferState == GCodeBufferState::discarding; }	// Return true if we are throwing away the rest of the line, e.g. because it is a comment
+	void SkipDiscarded(size_t numChars) { commandLength += numChars; }	// Account for characters of the line that the input skipped instead of passing them to us
 	bool IsCompletelyIdle() const;
 	bool IsReady() const;								// Return true if a gcode is ready but hasn't been started yet
 	bool IsExecuting() const;							// Return true if a gcode has been started and is not paused
 	void SetFinished(bool f);							// Set the G Code executed (or not)
 	int GetToolNumberAdjust() const { return toolNumberAdjust; }
 	void SetToolNumberAdjust(int arg) { toolNumberAdjust = arg; }
-	void SetCommsProperties(uint32_t arg) { checksumRequired = (arg & 1); }
+	void SetCommsProperties(uint32_t arg) { checksumRequired = (arg & 1); reportBufferSpace = (arg & 2); }
+	bool ReportsBufferSpace() const { return reportBufferSpace; }	// Return true if we tell the host how much more it may send when we acknowledge a command
 	MessageType GetResponseMessageType() const { return responseMessageType; }
 
 	GCodeMachineState& MachineState() const { return *machineState; }
@@ -96,6 +105,12 @@ public:
 
 	void PrintCommand(const StringRef& s) const;
 
+	static GCodeResult RunParseBenchmark(GCodeBuffer& gb, const StringRef& reply);	// process M122 P108
+
+	// The binary command text is just the command letter and number, e.g. "M106" or "G29.1". The parameter values are stored after it.
+	static constexpr size_t BinaryCommandTextLength = 12;
+	static constexpr size_t MaxBinaryParameters = (GCODE_LENGTH - 1 - BinaryCommandTextLength)/sizeof(float);
+
 	uint32_t whenTimerStarted;							// when we started waiting
 	bool timerRunning;									// true if we are waiting
 
@@ -119,11 +134,15 @@ private:
 	void StoreAndAddToChecksum(char c);
 	bool LineFinished();								// Deal with receiving end-of-line and return true if we have a command
 	void DecodeCommand();
+	void IndexParameters();								// Record where each parameter letter is in the current command
+	void IndexParameter(char c, unsigned int i);
 	bool InternalGetQuotedString(const StringRef& str)
 		pre (readPointer >= 0; gcodeBuffer[readPointer] == '"'; str.IsEmpty());
 	bool InternalGetPossiblyQuotedString(const StringRef& str)
 		pre (readPointer >= 0);
+	float ReadBinaryValue();
 	float ReadFloatValue(const char *p, const char **endptr);
+	static float ReadDecimalFloat(const char *p, const char **endptr) __attribute__((hot));
 	uint32_t ReadUIValue(const char *p, const char **endptr);
 	int32_t ReadIValue(const char *p, const char **endptr);
 
@@ -138,6 +157,8 @@ private:
 	const char* const identity;							// Where we are from (web, file, serial line etc)
 	unsigned int commandStart;							// Index in the buffer of the command letter of this command
 	unsigned int parameterStart;
+	uint32_t parameterLetters;							// Bitmap of the parameter letters A to Z present in the current command
+	uint8_t parameterOffsets[26];						// Index in the buffer of the first occurrence of each parameter letter that is present
 	unsigned int commandEnd;							// Index in the buffer of one past the last character of this command
 	unsigned int commandLength;							// Number of characters we read to build this command including the final \r or \n
 	unsigned int gcodeLineEnd;							// Number of characters in the entire line of gcode
@@ -163,9 +184,11 @@ private:
 
 	char gcodeBuffer[GCODE_LENGTH];						// The G Code
 	bool checksumRequired;								// True if we only accept commands with a valid checksum
+	bool reportBufferSpace;								// True if acknowledgements include the free input buffer space, so that the host can stream without waiting for each one
 	int8_t commandFraction;
 
 	bool queueCodes;									// Can we queue certain G-codes from this source?
+	bool binaryCommand;									// True if the current command was read from a binary G-code file
 	bool binaryWriting;									// Executing gcode or writing binary file?
 };
 
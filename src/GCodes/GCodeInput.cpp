@@ -16,20 +16,8 @@ bool GCodeInput::FillBuffer(GCodeBuffer *gb)
 	const size_t bytesToPass = min<size_t>(BytesCached(), GCODE_LENGTH);
 	for (size_t i = 0; i < bytesToPass; i++)
 	{
-		const char c = ReadByte();
-
-		if (gb->IsWritingBinary())
-		{
-			// HTML uploads are handled by the GCodes class
-			gb->WriteBinaryToFile(c);
-		}
-		else if (gb->Put(c))
+		if (PutByte(gb, ReadByte()))
 		{
-			if (gb->IsWritingFile())
-			{
-				gb->WriteToFile();
-			}
-
 			// Code is complete or has been written to file, so stop here
 			return true;
 		}
@@ -38,6 +26,24 @@ bool GCodeInput::FillBuffer(GCodeBuffer *gb)
 	return false;
 }
 
+bool GCodeInput::PutByte(GCodeBuffer *gb, char c)
+{
+	if (gb->IsWritingBinary())
+	{
+		// HTML uploads are handled by the GCodes class
+		gb->WriteBinaryToFile(c);
+	}
+	else if (gb->Put(c))
+	{
+		if (gb->IsWritingFile())
+		{
+			gb->WriteToFile();
+		}
+		return true;
+	}
+	return false;
+}
+
 // G-code input class for wrapping around Stream-based hardware ports
 
 void StreamGCodeInput::Reset()
@@ -48,6 +54,22 @@ void StreamGCodeInput::Reset()
 	}
 }
 
+// Fill a GCodeBuffer from the device. This is the same as GCodeInput::FillBuffer except that we read the device directly, to save a virtual call per byte.
+bool StreamGCodeInput::FillBuffer(GCodeBuffer *gb)
+{
+	const size_t bytesToPass = min<size_t>(device.available(), GCODE_LENGTH);
+	for (size_t i = 0; i < bytesToPass; i++)
+	{
+		if (PutByte(gb, static_cast<char>(device.read())))
+		{
+			// Code is complete or has been written to file, so stop here
+			return true;
+		}
+	}
+
+	return false;
+}
+
 char StreamGCodeInput::ReadByte()
 {
 	return static_cast<char>(device.read());
@@ -58,6 +80,12 @@ size_t StreamGCodeInput::BytesCached() const
 	return device.available();
 }
 
+size_t StreamGCodeInput::BufferSpaceLeft() const
+{
+	const size_t bytesCached = BytesCached();
+	return (bytesCached < StreamInputWindowSize) ? StreamInputWindowSize - bytesCached : 0;
+}
+
 // Dynamic G-code input class for caching codes from software-defined sources
 
 RegularGCodeInput::RegularGCodeInput()
@@ -162,7 +190,7 @@ void NetworkGCodeInput::Put(MessageType mtype, char c)
 				// Don't use the Network task itself to send them because this may result in deadlock if there is insufficient buffer space,
 				// because the Network task itself is used to send the output to the clients and free the buffers.
 				// Ask the main task to do it instead.
-				reprap.DeferredDiagnostics(mtype);
+				reprap.Diagnostics(mtype);
 
 				// But don't report them twice
 				Reset();
@@ -215,7 +243,8 @@ bool NetworkGCodeInput::FillBuffer(GCodeBuffer *gb) /*override*/
 void FileGCodeInput::Reset()
 {
 	lastFile = nullptr;
-	RegularGCodeInput::Reset();
+	readingPointer = bytesCached = 0;
+	lastFileIsBinary = lastFileEnded = badBinaryRecord = false;
 }
 
 // Reset this input. Should be called when a specific G-code or macro file is closed outside of the reading context
@@ -227,11 +256,20 @@ void FileGCodeInput::Reset(const FileData &file)
 	}
 }
 
+char FileGCodeInput::ReadByte()
+{
+	const char c = buffer[readingPointer++];
+	if (readingPointer == FileInputBufferSize)
+	{
+		readingPointer = 0;
+	}
+	--bytesCached;
+	return c;
+}
+
 // Read another chunk of G-codes from the file and return true if more data is available
 GCodeInputReadResult FileGCodeInput::ReadFromFile(FileData &file)
 {
-	const size_t bytesCached = BytesCached();
-
 	// Keep track of the last file we read from
 	if (lastFile != nullptr && lastFile != file.f)
 	{
@@ -242,35 +280,171 @@ GCodeInputReadResult FileGCodeInput::ReadFromFile(FileData &file)
 			lastFile->Seek(lastFile->Position() - bytesCached);
 		}
 
-		RegularGCodeInput::Reset();
+		readingPointer = bytesCached = 0;
+		lastFileEnded = badBinaryRecord = false;
 	}
 	lastFile = file.f;
 
-	// Read more from the file
-	if (bytesCached < GCodeInputFileReadThreshold)
+	if (badBinaryRecord)
+	{
+		return GCodeInputReadResult::error;
+	}
+	if (!file.formatChecked)
+	{
+		CheckFileFormat(file);
+	}
+	lastFileIsBinary = file.isBinaryGCode;
+
+	// Read more from the file if at least half the buffer is free, so that we read several sectors at a time
+	if (FileInputBufferSize - bytesCached >= FileInputReadThreshold)
 	{
-		// Reset the read+write pointers for better performance if possible
-		if (readingPointer == writingPointer)
+		// Reset the read pointer for better performance if possible
+		if (bytesCached == 0)
+		{
+			readingPointer = 0;
+		}
+
+		// Read as much as will fit before the end of the buffer, but stop at a sector boundary in the file if we can
+		const size_t writingPointer = (readingPointer + bytesCached) % FileInputBufferSize;
+		size_t bytesToRead = min<size_t>(FileInputBufferSize - bytesCached, FileInputBufferSize - writingPointer);
+		const size_t overrun = (size_t)((file.GetPosition() + bytesToRead) % FileInputSectorSize);
+		if (overrun < bytesToRead)
 		{
-			readingPointer = writingPointer = 0;
+			bytesToRead -= overrun;
 		}
 
-		// The code here used to read into a local buffer in blocks that are multiples of 4 bytes.
-		// However, unless we can use a buffer of at least 512 bytes then that is redundant,
-		// because the data will be copied via the sector buffer in FatFS anyway. So we don't do that any more.
-		const int bytesRead = file.Read(buffer + writingPointer, min<size_t>(BufferSpaceLeft(), GCodeInputBufferSize - writingPointer));
+		const int bytesRead = file.Read(buffer + writingPointer, bytesToRead);
 		if (bytesRead < 0)
 		{
 			return GCodeInputReadResult::error;
 		}
 		if (bytesRead > 0)
 		{
-			writingPointer = (writingPointer + (size_t)bytesRead) % GCodeInputBufferSize;
+			bytesCached += (size_t)bytesRead;
+			lastFileEnded = false;
 			return GCodeInputReadResult::haveData;
 		}
+		lastFileEnded = true;
 	}
 
 	return (bytesCached > 0) ? GCodeInputReadResult::haveData : GCodeInputReadResult::noData;
 }
 
+// Find out whether a file is a binary G-code file by looking at its first line. We only do this once for each file we open.
+// This is called before anything from the file is in our buffer, but the file may already have been positioned to resume a print.
+void FileGCodeInput::CheckFileFormat(FileData &file)
+{
+	const FilePosition pos = file.GetPosition();
+	char signature[BinaryGCodeSignatureLength];
+	file.isBinaryGCode = (pos == 0 || file.Seek(0))
+						&& file.Read(signature, BinaryGCodeSignatureLength) == (int)BinaryGCodeSignatureLength
+						&& memcmp(signature, BinaryGCodeSignature, BinaryGCodeSignatureLength) == 0;
+	file.Seek(pos);										// the signature is a comment, so we leave it to be read as text
+	file.formatChecked = true;
+}
+
+// Fill a GCodeBuffer with the next command. In a binary G-code file, a byte with the top bit set at the start of a line starts a binary record.
+// Slicers often put long comments and base64 thumbnails at the start of the file, so once the GCodeBuffer is discarding the rest of a line we skip it here instead of passing it one character at a time
+bool FileGCodeInput::FillBuffer(GCodeBuffer *gb)
+{
+	for (size_t i = 0; i < GCODE_LENGTH && bytesCached != 0; i++)
+	{
+		if (!gb->IsWritingBinary())
+		{
+			if (lastFileIsBinary && gb->IsAtStartOfLine() && (PeekByte(0) & BinaryRecordFlag) != 0)
+			{
+				return FillBinaryCommand(gb);
+			}
+			if (gb->IsDiscarding())
+			{
+				SkipDiscardedText(gb);
+				if (bytesCached == 0)
+				{
+					break;
+				}
+			}
+		}
+		if (PutByte(gb, ReadByte()))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Skip characters up to but not including the next line ending. The GCodeBuffer is told how many we skipped so that it still knows where the command started in the file.
+void FileGCodeInput::SkipDiscardedText(GCodeBuffer *gb)
+{
+	size_t skipped = 0;
+	while (bytesCached != 0)
+	{
+		const char *p = buffer + readingPointer;
+		const char * const end = p + min<size_t>(bytesCached, FileInputBufferSize - readingPointer);
+		while (p != end && *p != '\n' && *p != '\r' && *p != 0)
+		{
+			++p;
+		}
+		const size_t count = p - (buffer + readingPointer);
+		skipped += count;
+		bytesCached -= count;
+		readingPointer += count;
+		if (readingPointer == FileInputBufferSize)
+		{
+			readingPointer = 0;
+		}
+		if (p != end)
+		{
+			break;										// we found the line ending
+		}
+	}
+	gb->SkipDiscarded(skipped);
+}
+
+// Pass the binary record at the read pointer to the GCodeBuffer. Return false if we don't have all of it yet.
+bool FileGCodeInput::FillBinaryCommand(GCodeBuffer *gb)
+{
+	size_t numParams = 0;
+	uint32_t params = 0;
+	if (bytesCached >= BinaryRecordHeaderLength)
+	{
+		params = (uint32_t)PeekByte(4) | ((uint32_t)PeekByte(5) << 8) | ((uint32_t)PeekByte(6) << 16) | ((uint32_t)PeekByte(7) << 24);
+		numParams = __builtin_popcount(params);
+		const char letter = (char)(PeekByte(0) & ~BinaryRecordFlag);
+		if ((letter != 'G' && letter != 'M' && letter != 'T') || (params >> 26) != 0 || numParams > GCodeBuffer::MaxBinaryParameters)
+		{
+			reprap.GetPlatform().MessageF(ErrorMessage, "Bad binary G-code record at file position %" PRIuFilePos "\n", lastFile->Position() - bytesCached);
+			badBinaryRecord = true;
+			return false;
+		}
+	}
+
+	const size_t recordLength = BinaryRecordHeaderLength + numParams * sizeof(float);
+	if (bytesCached < recordLength)
+	{
+		// ReadFromFile will read more data unless we have reached the end of the file
+		if (lastFileEnded)
+		{
+			reprap.GetPlatform().Message(ErrorMessage, "Binary G-code file ends with an incomplete record\n");
+			badBinaryRecord = true;
+		}
+		return false;
+	}
+
+	uint8_t record[BinaryRecordHeaderLength + GCodeBuffer::MaxBinaryParameters * sizeof(float)];
+	for (size_t i = 0; i < recordLength; ++i)
+	{
+		record[i] = (uint8_t)ReadByte();
+	}
+
+	const uint16_t number = (uint16_t)record[1] | ((uint16_t)record[2] << 8);
+	gb->PutBinary((char)(record[0] & ~BinaryRecordFlag), (number == BinaryNoCommandNumber) ? -1 : (int)number, (int8_t)record[3],
+					params, record + BinaryRecordHeaderLength, recordLength);
+	if (gb->IsWritingFile())
+	{
+		gb->MakeTextCommand();
+		gb->WriteToFile();
+	}
+	return true;
+}
+
 // End
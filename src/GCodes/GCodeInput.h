@@ -14,7 +14,27 @@
 #include "RTOSIface/RTOSIface.h"
 
 const size_t GCodeInputBufferSize = 256;				// How many bytes can we cache per input source?
-const size_t GCodeInputFileReadThreshold = 128;			// How many free bytes must be available before data is read from the SD card?
+const size_t StreamInputWindowSize = 128;				// How many bytes a host may send ahead over a serial link when we report buffer space. Must not exceed the receive buffer of the serial drivers.
+const size_t FileInputSectorSize = 512;					// The sector size of the SD card, which is the unit that FatFS can transfer straight into our buffer
+const size_t FileInputBufferSize = 4 * FileInputSectorSize;	// How many bytes can we cache from files?
+const size_t FileInputReadThreshold = FileInputBufferSize/2;	// How many free bytes must be available before data is read from the SD card?
+
+// Binary G-code files.
+// A binary G-code file starts with the line in BinaryGCodeSignature. After that, each line is either an ordinary line of text G-code,
+// or a binary record that holds a single command. A binary record is recognised by the top bit of its first byte being set. It consists of:
+//  1 byte:		the command letter ('G', 'M' or 'T') with the top bit set
+//  2 bytes:	the command number, or 0xFFFF if there isn't one
+//  1 byte:		the command fraction as a signed number, or -1 if there isn't one
+//  4 bytes:	a bitmap of the parameter letters that are present, with bit 0 for A up to bit 25 for Z
+//  4 bytes:	for each parameter letter present, in alphabetical order, its value as a float
+// All values are little-endian, which is the native byte order of all the processors we support. There is no terminator.
+// Commands with string, array or expression parameters, more than GCodeBuffer::MaxBinaryParameters parameters, or values that can't be held exactly
+// in a float must be left as text. File positions are byte offsets as usual, and each binary record starts a new line, so saved positions remain valid.
+const char BinaryGCodeSignature[] = ";binary G-code 1\n";
+const size_t BinaryGCodeSignatureLength = sizeof(BinaryGCodeSignature) - 1;
+const uint8_t BinaryRecordFlag = 0x80;
+const size_t BinaryRecordHeaderLength = 8;
+const uint16_t BinaryNoCommandNumber = 0xFFFF;
 
 
 // This base class is intended to provide incoming G-codes for the GCodeBuffer class
@@ -27,6 +47,7 @@ public:
 
 protected:
 	virtual char ReadByte() = 0;						// Get the next byte from the source
+	bool PutByte(GCodeBuffer *gb, char c);				// Pass a byte to a GCodeBuffer, returning true if it completed a command
 };
 
 // This class wraps around an existing Stream device which lets us avoid double buffering.
@@ -36,7 +57,9 @@ public:
 	StreamGCodeInput(Stream &dev) : device(dev) { }
 
 	void Reset() override;
+	bool FillBuffer(GCodeBuffer *gb) override;			// Fill a GCodeBuffer with the last available G-code
 	size_t BytesCached() const override;				// How many bytes have been cached?
+	size_t BufferSpaceLeft() const;						// How many more bytes can the host send before we read some?
 
 protected:
 	char ReadByte() override;
@@ -83,21 +106,39 @@ protected:
 
 enum class GCodeInputReadResult : uint8_t { haveData, noData, error };
 
-// This class is an expansion of the RegularGCodeInput class to buffer G-codes and to rewind file positions when
-// nested G-code files are started. However buffered codes are not explicitly checked for M112.
-class FileGCodeInput : public RegularGCodeInput
+// This class buffers G-codes read from files and rewinds file positions when nested G-code files are started. Buffered codes are not checked for M112.
+// It has a larger buffer than the other inputs, which it fills several sectors at a time. The reads are arranged to end on sector boundaries, so that
+// after the first read of a file FatFS can transfer whole sectors straight into the buffer instead of copying them through its own sector buffer.
+// It also reads binary G-code files, passing binary commands to the GCodeBuffer without parsing them.
+class FileGCodeInput : public GCodeInput
 {
 public:
 
-	FileGCodeInput() : RegularGCodeInput(), lastFile(nullptr) { }
+	FileGCodeInput() : lastFile(nullptr), readingPointer(0), bytesCached(0), lastFileIsBinary(false), lastFileEnded(false), badBinaryRecord(false) { }
 
 	void Reset() override;								// This should be called when the associated file is being closed
 	void Reset(const FileData &file);					// Should be called when a specific G-code or macro file is closed or re-opened outside the reading context
+	bool FillBuffer(GCodeBuffer *gb) override;			// Fill a GCodeBuffer with the last available G-code
+	size_t BytesCached() const override { return bytesCached; }	// How many bytes have been cached?
 
 	GCodeInputReadResult ReadFromFile(FileData &file);	// Read another chunk of G-codes from the file and return true if more data is available
 
+protected:
+	char ReadByte() override;
+
 private:
+	void CheckFileFormat(FileData &file);				// Find out whether a file is a binary G-code file
+	bool FillBinaryCommand(GCodeBuffer *gb);			// Pass the binary record at the read pointer to a GCodeBuffer
+	void SkipDiscardedText(GCodeBuffer *gb);			// Skip the buffered characters up to the end of the line that a GCodeBuffer would throw away
+	uint8_t PeekByte(size_t offset) const { return (uint8_t)buffer[(readingPointer + offset) % FileInputBufferSize]; }
+
 	FileStore *lastFile;
+	size_t readingPointer;								// where in the buffer the next byte to read is
+	size_t bytesCached;									// how many bytes there are in the buffer
+	bool lastFileIsBinary;								// true if the last file we read from is a binary G-code file
+	bool lastFileEnded;									// true if the last read from the file returned no data
+	bool badBinaryRecord;								// true if we found a binary record that was corrupt or truncated
+	alignas(4) char buffer[FileInputBufferSize];		// word aligned so that the SD card driver can use DMA
 };
 
 // This class receives its data from the network task
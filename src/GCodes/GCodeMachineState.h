@@ -18,6 +18,7 @@ enum class GCodeState : uint8_t
 
 	waitingForSpecialMoveToComplete,					// doing a special move, so we must wait for it to finish before processing another GCode
 	waitingForSegmentedMoveToGo,						// doing an arc move, so we must check whether it completes normally
+	homingLeadscrews,									// doing a G1 H4 move, so we must wait for it to finish and report the Z motor offsets
 
 	probingToolOffset,
 
@@ -68,6 +69,10 @@ enum class GCodeState : uint8_t
 	gridProbing6,
 	gridProbing7,
 
+	// States used for probing the grid while moving, which finish in state gridProbing7
+	gridScanning1,
+	gridScanning2,
+
 	// These next 10 must be contiguous
 	probingAtPoint0,
 	probingAtPoint1,
@@ -86,6 +91,9 @@ enum class GCodeState : uint8_t
 	unloadingFilament,
 
 	timingSDwrite,
+	timingSDread,
+	timingSDrandomRead,
+	timingSDrandomWrite,
 
 #if HAS_VOLTAGE_MONITOR
 	powerFailPausing1
@@ -10,18 +10,64 @@
 #include "RepRap.h"
 #include "GCodes.h"
 #include "Movement/Move.h"
+#include "Tasks.h"
 
 // GCodeQueue class
 
-GCodeQueue::GCodeQueue() : freeItems(nullptr), queuedItems(nullptr)
+GCodeQueue::GCodeQueue()
+	: freeItems(nullptr), queuedItems(nullptr), lastQueuedItem(nullptr), buffer(new char[DefaultCodeQueueBufferSize]), bufferSize(DefaultCodeQueueBufferSize),
+	  nextFree(0), numItems(0), numQueued(0), bytesQueued(0), maxQueued(0), maxBytesQueued(0), numWaits(0), waitingForSpace(false)
 {
-	for (size_t i = 0; i < maxQueuedCodes; i++)
+	while (numItems < DefaultQueuedCodes)
 	{
 		freeItems = new QueuedCode(freeItems);
+		++numItems;
 	}
 }
 
+// Increase the number of codes we can queue and the size of the buffer that holds them. The queue must be empty if the buffer size is to be increased.
+bool GCodeQueue::Extend(size_t newNumItems, size_t newBufferSize)
+{
+	const size_t extraItems = (newNumItems > numItems) ? newNumItems - numItems : 0;
+	const size_t newBufferBytes = (newBufferSize > bufferSize) ? newBufferSize : 0;		// we need to allocate the whole of a new buffer
+	if ((newBufferBytes != 0 && queuedItems != nullptr) || Tasks::GetNeverUsedRam() < extraItems * sizeof(QueuedCode) + newBufferBytes + MinRamToLeave)
+	{
+		return false;
+	}
+
+	while (numItems < newNumItems)
+	{
+		freeItems = new QueuedCode(freeItems);
+		++numItems;
+	}
+
+	if (newBufferBytes != 0)
+	{
+		delete[] buffer;
+		buffer = new char[newBufferSize];
+		bufferSize = newBufferSize;
+		nextFree = 0;
+	}
+	return true;
+}
+
+
 // Return true if the move in the GCodeBuffer should be queued
+// Return true if the command has a parameter for any axis or the extruders
+/*static*/ bool GCodeQueue::SeenAnyDriveLetter(GCodeBuffer &gb)
+{
+	const GCodes& gCodes = reprap.GetGCodes();
+	const char * const axisLetters = gCodes.GetAxisLetters();
+	for (size_t axis = 0; axis < gCodes.GetTotalAxes(); ++axis)
+	{
+		if (gb.Seen(axisLetters[axis]))
+		{
+			return true;
+		}
+	}
+	return gb.Seen(extrudeLetter);
+}
+
 /*static*/ bool GCodeQueue::ShouldQueueCode(GCodeBuffer &gb)
 {
 #if SUPPORT_ROLAND
@@ -49,11 +95,19 @@ GCodeQueue::GCodeQueue() : freeItems(nullptr), queuedItems(nullptr)
 				switch (gb.GetCommandNumber())
 				{
 				case 3:		// spindle or laser control
+				case 4:		// spindle control
+					// On laser devices we use M3 to set the default laser power for the next G1 command.
+					// If the spindle has to get up to speed before we continue, M3 and M4 wait for the moves to finish instead of being queued.
+					if (reprap.GetGCodes().GetMachineType() == MachineType::cnc)
+					{
+						const uint32_t slot = (gb.Seen('P')) ? gb.GetUIValue() : 0;
+						return slot >= MaxSpindles || !reprap.GetPlatform().AccessSpindle(slot).WaitsForSpeed();
+					}
+					return reprap.GetGCodes().GetMachineType() != MachineType::laser;
+
 				case 5:		// spindle or laser control
-					// On laser devices we use these codes to set the default laser power for the next G1 command
 					return reprap.GetGCodes().GetMachineType() != MachineType::laser;
 
-				case 4:		// spindle control
 				case 42:	// set IO pin
 				case 106:	// fan control
 				case 107:	// fan off
@@ -67,6 +121,23 @@ GCodeQueue::GCodeQueue() : freeItems(nullptr), queuedItems(nullptr)
 				case 420:	// set RGB colour
 					return true;
 
+				case 118:	// echo message
+					return true;
+
+#if SUPPORT_DOTSTAR_LED
+				case 150:	// set LED colours
+					return true;
+#endif
+
+				case 906:	// set motor currents
+				case 913:	// set motor current percentages
+#if HAS_SMART_DRIVERS
+				case 917:	// set standstill current percentages
+#endif
+					// These only change the drivers, so they can take effect at the right point in the move stream without stopping the machine.
+					// Requests to report the values are not queued because the reply would be lost.
+					return SeenAnyDriveLetter(gb);
+
 				case 291:
 					{
 						bool seen = false;
@@ -95,17 +166,32 @@ GCodeQueue::GCodeQueue() : freeItems(nullptr), queuedItems(nullptr)
 bool GCodeQueue::QueueCode(GCodeBuffer &gb)
 {
 	// Can we queue this code somewhere?
-	if (freeItems == nullptr || gb.CommandLength() > SHORT_GCODE_LENGTH - 1)
+	gb.MakeTextCommand();								// if the command came from a binary G-code file then we need to store it as text
+	const size_t length = gb.CommandLength() + 1;
+	char * const space = (freeItems == nullptr) ? nullptr : AllocateSpace(length);
+	if (space == nullptr)
 	{
+		// We get called repeatedly for the same code while it waits, so count the wait only once
+		if (!waitingForSpace)
+		{
+			++numWaits;
+			waitingForSpace = true;
+		}
 		return false;
 	}
+	waitingForSpace = false;
 
 	// Unlink a free element and assign gb's code to it
 	QueuedCode * const code = freeItems;
 	freeItems = code->next;
-	code->AssignFrom(gb);
+	code->code = space;
+	code->length = (uint16_t)length;
+	memcpy(space, gb.CommandStart(), length - 1);
+	space[length - 1] = 0;
+	code->toolNumberAdjust = gb.GetToolNumberAdjust();
 	code->executeAtMove = reprap.GetMove().GetScheduledMoves();
 	code->next = nullptr;
+	nextFree = (space - buffer) + length;
 
 	// Append it to the list of queued codes
 	if (queuedItems == nullptr)
@@ -114,15 +200,48 @@ bool GCodeQueue::QueueCode(GCodeBuffer &gb)
 	}
 	else
 	{
-		QueuedCode *last = queuedItems;
-		while (last->Next() != nullptr)
+		lastQueuedItem->next = code;
+	}
+	lastQueuedItem = code;
+
+	++numQueued;
+	bytesQueued += length;
+	maxQueued = max<size_t>(maxQueued, numQueued);
+	maxBytesQueued = max<size_t>(maxBytesQueued, bytesQueued);
+	return true;
+}
+
+// Find space in the buffer for a code. The codes in use run from the oldest queued code to nextFree, wrapping round at the end of the buffer.
+// Each code must be contiguous, so if it doesn't fit at the end of the buffer then we put it at the start and leave the space at the end unused.
+char *GCodeQueue::AllocateSpace(size_t length)
+{
+	if (queuedItems == nullptr)
+	{
+		return (length <= bufferSize) ? buffer : nullptr;
+	}
+
+	const size_t oldest = queuedItems->code - buffer;
+	if (nextFree > oldest)
+	{
+		// The codes in use don't wrap round, so there may be space at the end of the buffer and at the start
+		if (bufferSize - nextFree >= length)
 		{
-			last = last->Next();
+			return buffer + nextFree;
 		}
-		last->next = code;
+		return (oldest >= length) ? buffer : nullptr;
 	}
 
-	return true;
+	// The codes in use wrap round, so the only free space is between nextFree and the oldest code
+	return (oldest - nextFree >= length) ? buffer + nextFree : nullptr;
+}
+
+// Return an item that has been unlinked from the queue to the free list
+void GCodeQueue::ReleaseItem(QueuedCode *item)
+{
+	item->next = freeItems;
+	freeItems = item;
+	--numQueued;
+	bytesQueued -= item->length;
 }
 
 bool GCodeQueue::FillBuffer(GCodeBuffer *gb)
@@ -140,8 +259,11 @@ bool GCodeQueue::FillBuffer(GCodeBuffer *gb)
 
 	// Release this item again
 	queuedItems = queuedItems->next;
-	code->next = freeItems;
-	freeItems = code;
+	ReleaseItem(code);
+	if (queuedItems == nullptr)
+	{
+		nextFree = 0;
+	}
 	return true;
 }
 
@@ -162,8 +284,7 @@ void GCodeQueue::PurgeEntries()
 		{
 			// Release this item
 			QueuedCode *nextItem = item->Next();
-			item->next = freeItems;
-			freeItems = item;
+			ReleaseItem(item);
 
 			// Unlink it from the list
 			if (lastItem == nullptr)
@@ -182,6 +303,10 @@ void GCodeQueue::PurgeEntries()
 			item = item->Next();
 		}
 	}
+
+	// The codes we removed are the most recent ones, so the codes that remain still occupy a single run of the buffer
+	lastQueuedItem = lastItem;
+	nextFree = (lastItem == nullptr) ? 0 : (lastItem->code - buffer) + lastItem->length;
 }
 
 void GCodeQueue::Clear()
@@ -190,9 +315,11 @@ void GCodeQueue::Clear()
 	{
 		QueuedCode * const item = queuedItems;
 		queuedItems = item->Next();
-		item->next = freeItems;
-		freeItems = item;
+		ReleaseItem(item);
 	}
+	lastQueuedItem = nullptr;
+	nextFree = 0;
+	waitingForSpace = false;
 }
 
 void GCodeQueue::Diagnostics(MessageType mtype)
@@ -207,20 +334,17 @@ void GCodeQueue::Diagnostics(MessageType mtype)
 			queueLength++;
 			reprap.GetPlatform().MessageF(mtype, "Queued '%s' for move %" PRIu32 "\n", item->code, item->executeAtMove);
 		} while ((item = item->Next()) != nullptr);
-		reprap.GetPlatform().MessageF(mtype, "%d of %d codes have been queued.\n", queueLength, maxQueuedCodes);
+		reprap.GetPlatform().MessageF(mtype, "%u of %u codes have been queued.\n", queueLength, numItems);
 	}
+	reprap.GetPlatform().MessageF(mtype, "Code queue peak %u of %u codes, %u of %u bytes, waits %" PRIu32 "\n",
+									maxQueued, numItems, maxBytesQueued, bufferSize, numWaits);
+	maxQueued = numQueued;
+	maxBytesQueued = bytesQueued;
+	numWaits = 0;
 }
 
 // QueuedCode class
 
-void QueuedCode::AssignFrom(GCodeBuffer &gb)
-{
-	toolNumberAdjust = gb.GetToolNumberAdjust();
-	const size_t length = min<size_t>(gb.CommandLength(), ARRAY_SIZE(code) - 1);
-	memcpy(code, gb.CommandStart(), length);
-	code[length] = 0;
-}
-
 void QueuedCode::AssignTo(GCodeBuffer *gb)
 {
 	gb->SetToolNumberAdjust(toolNumberAdjust);
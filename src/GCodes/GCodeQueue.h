@@ -12,6 +12,8 @@
 
 class QueuedCode;
 
+// Class to hold codes that must be executed in sync with moves. The text of the codes is stored in a shared ring buffer, so that short codes don't waste space.
+// Codes are always released in the order they were queued, except that PurgeEntries releases the most recent ones.
 class GCodeQueue
 {
 public:
@@ -23,12 +25,33 @@ public:
 	void PurgeEntries();										// Remove stored codes when a print is being paused
 	void Clear();												// Clean up all the stored codes
 	bool IsIdle() const;										// Return true if there is nothing to do
+	bool IsEmpty() const { return queuedItems == nullptr; }		// Return true if no codes are queued
+	size_t GetMaxCodes() const { return numItems; }
+	size_t GetBufferSize() const { return bufferSize; }
+	bool Extend(size_t newNumItems, size_t newBufferSize);		// Increase the number of codes and the buffer size, returning false if we can't
 
 	void Diagnostics(MessageType mtype);
 
 private:
+	static bool SeenAnyDriveLetter(GCodeBuffer &gb);			// Return true if the command has a parameter for any axis or the extruders
+	char *AllocateSpace(size_t length);							// Find space in the buffer for a code of the specified length including the null terminator
+	void ReleaseItem(QueuedCode *item);
+
 	QueuedCode *freeItems;
 	QueuedCode *queuedItems;
+	QueuedCode *lastQueuedItem;
+	char *buffer;												// the buffer that holds the text of the queued codes
+	size_t bufferSize;
+	size_t nextFree;											// the offset in the buffer after the most recently queued code
+	size_t numItems;											// how many codes we can queue
+
+	// Statistics
+	size_t numQueued;
+	size_t bytesQueued;
+	size_t maxQueued;
+	size_t maxBytesQueued;
+	uint32_t numWaits;											// how many codes had to wait because the queue was full
+	bool waitingForSpace;										// true if the last code we were asked to queue didn't fit
 };
 
 class QueuedCode
@@ -42,11 +65,11 @@ public:
 private:
 	QueuedCode *next;
 
-	char code[SHORT_GCODE_LENGTH];
+	char *code;													// the text of the code, in the buffer of the GCodeQueue
 	uint32_t executeAtMove;
+	uint16_t length;											// the number of bytes of the buffer that the code uses, including the null terminator
 	int toolNumberAdjust;
 
-	void AssignFrom(GCodeBuffer &gb);
 	void AssignTo(GCodeBuffer *gb);
 };
 
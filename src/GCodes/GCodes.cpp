@@ -31,6 +31,7 @@
 #include "Heating/HeaterProtection.h"
 #include "Platform.h"
 #include "Movement/Move.h"
+#include "Movement/StepTimer.h"
 #include "Scanner.h"
 #include "PrintMonitor.h"
 #include "RepRap.h"
@@ -40,10 +41,17 @@
 # include "FirmwareUpdater.h"
 #endif
 
+#if SUPPORT_PLAN_TRACE
+# include "Movement/PlanTrace.h"
+#endif
+
 #if SUPPORT_DOTSTAR_LED
 # include "Fans/DotStarLed.h"
 #endif
 
+// When simulating, the file gets this many turns in a row before another source gets one, so that the simulation runs as fast as possible but can still be cancelled
+constexpr unsigned int SimulationFileGCodeTurns = 8;
+
 #if SUPPORT_OBJECT_MODEL
 
 // Object model table and functions
@@ -53,7 +61,7 @@
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(GCodes, _ret)
 
-const ObjectModelTableEntry GCodes::objectModelTable[] =
+constexpr ObjectModelTableEntry GCodes::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "speedFactor", OBJECT_MODEL_FUNC(&(self->speedFactor)), TYPE_OF(float), ObjectModelTableEntry::none }
@@ -67,6 +75,7 @@ DEFINE_GET_OBJECT_MODEL_TABLE(GCodes)
 void GCodes::RawMove::SetDefaults(size_t firstDriveToZero)
 {
 	moveType = 0;
+	scanProbePoint = -1;
 	isCoordinated = false;
 	usingStandardFeedrate = false;
 	usePressureAdvance = false;
@@ -74,6 +83,9 @@ void GCodes::RawMove::SetDefaults(size_t firstDriveToZero)
 	endStopsToCheck = 0;
 	filePos = noFilePosition;
 	tool = nullptr;
+#if SUPPORT_LASER
+	numLaserRasterPixels = 0;
+#endif
 	for (size_t drive = firstDriveToZero; drive < MaxTotalDrivers; ++drive)
 	{
 		coords[drive] = 0.0;			// clear extrusion
@@ -171,7 +183,12 @@ void GCodes::Init()
 	retractHop = 0.0;
 	retractSpeed = unRetractSpeed = DefaultRetractSpeed * SecondsToMinutes;
 	isRetracted = false;
+	fuseRetractHop = false;
+	zProbeTriggerClocks = 0;
+	zProbeTriggerSpeed = 0.0;
+	approachTapPending = false;
 	lastAuxStatusReportType = -1;						// no status reports requested yet
+	auxStatusFilter.Reset();
 
 	laserMaxPower = DefaultMaxLaserPower;
 	laserPowerSticky = false;
@@ -180,6 +197,14 @@ void GCodes::Init()
 	heaterFaultTime = 0;
 	heaterFaultTimeout = DefaultHeaterFaultTimeout;
 
+#if SUPPORT_RESUME_JOURNAL
+	resumeJournalInterval = 0;							// journaling is off until M916 J enables it
+	lastResumeJournalTime = 0;
+# if HAS_BACKUP_RESUME_RECORD
+	lastBackupResumeTime = 0;
+# endif
+#endif
+
 #if SUPPORT_SCANNER
 	reprap.GetScanner().SetGCodeBuffer(serialGCode);
 #endif
@@ -212,14 +237,19 @@ void GCodes::Reset()
 	}
 
 	nextGcodeSource = 0;
+	fileGCodeHadTurn = false;
+	fileGCodeTurnsInRow = 0;
 
 	fileToPrint.Close();
+	jobQueue.Clear();
 	speedFactor = 100.0;
 
 	for (size_t i = 0; i < MaxExtruders; ++i)
 	{
 		extrusionFactors[i] = volumetricExtrusionFactors[i] = 1.0;
 	}
+	extrusionFactorsVersion = 0;
+	extruderMix.tool = nullptr;
 
 	for (size_t i = 0; i < MaxAxes; ++i)
 	{
@@ -249,6 +279,7 @@ void GCodes::Reset()
 	{
 		f = 0.0;										// clear babystepping before calling ToolOffsetInverseTransform
 	}
+	pendingZBabyStepping = 0.0;
 
 	currentZHop = 0.0;									// clear this before calling ToolOffsetInverseTransform
 	lastPrintingMoveHeight = -1.0;
@@ -373,6 +404,18 @@ void GCodes::InitialiseTaps()
 	tapsDone = 0;
 	g30zHeightErrorSum = 0.0;
 	g30zHeightErrorLowestDiff = 1000.0;
+	const ZProbe& params = platform.GetCurrentZProbeParameters();
+	approachTapPending = (params.fastProbeSpeed > params.probeSpeed);
+}
+
+// After the fast approach tap of two-speed probing, raise the probe just far enough to tap again slowly
+void GCodes::BackOffAfterApproachTap()
+{
+	approachTapPending = false;
+	SetMoveBufferDefaults();
+	moveBuffer.coords[Z_AXIS] += min<float>(ZProbeApproachBackOff, platform.GetZProbeDiveHeight());
+	moveBuffer.feedRate = platform.GetZProbeTravelSpeed();
+	NewMoveAvailable(1);
 }
 
 void GCodes::Spin()
@@ -395,20 +438,35 @@ void GCodes::Spin()
 	CheckTriggers();
 	CheckHeaterFault();
 	CheckFilament();
+#if SUPPORT_PLAN_TRACE
+	PlanTrace::Spin();
+#endif
 
 	// Get the GCodeBuffer that we want to process a command from. Give priority to auto-pause.
+	// While a file is being printed it gets every other turn, so that commands from the other sources add as little latency to the print as possible.
 	GCodeBuffer *gbp = autoPauseGCode;
 	if (gbp->IsCompletelyIdle() && !(gbp->MachineState().fileState.IsLive()))
 	{
-		do
+		if (!fileGCodeHadTurn && (!fileGCode->IsCompletelyIdle() || fileGCode->MachineState().fileState.IsLive()))
+		{
+			gbp = fileGCode;
+			++fileGCodeTurnsInRow;
+			fileGCodeHadTurn = (simulationMode == 0 || fileGCodeTurnsInRow >= SimulationFileGCodeTurns);
+		}
+		else
 		{
-			gbp = gcodeSources[nextGcodeSource];
-			++nextGcodeSource;										// move on to the next gcode source ready for next time
-			if (nextGcodeSource == ARRAY_SIZE(gcodeSources) - 1)	// the last one is autoPauseGCode, so don't do it again
+			do
 			{
-				nextGcodeSource = 0;
-			}
-		} while (gbp == nullptr);									// we must have at least one GCode source, so this can't loop indefinitely
+				gbp = gcodeSources[nextGcodeSource];
+				++nextGcodeSource;										// move on to the next gcode source ready for next time
+				if (nextGcodeSource == ARRAY_SIZE(gcodeSources) - 1)	// the last one is autoPauseGCode, so don't do it again
+				{
+					nextGcodeSource = 0;
+				}
+			} while (gbp == nullptr);									// we must have at least one GCode source, so this can't loop indefinitely
+			fileGCodeHadTurn = false;
+			fileGCodeTurnsInRow = 0;
+		}
 	}
 	GCodeBuffer& gb = *gbp;
 
@@ -444,6 +502,23 @@ void GCodes::Spin()
 		RunStateMachine(gb, reply.GetRef());			// Execute the state machine
 	}
 
+#ifdef RTOS
+	if (simulationMode != 0 && segmentsLeft != 0)
+	{
+		Move::WakeMoveTask();							// when simulating, don't make the new move wait for the Move task's next tick
+	}
+#endif
+
+	if (simulationMode == 0 && !isPaused && fileGCode->OriginalMachineState().fileState.IsLive())
+	{
+		toolPreheater.Spin(GetFilePosition(), fileGCode->GetToolNumberAdjust());
+		jobQueue.Spin();
+	}
+
+#if SUPPORT_RESUME_JOURNAL
+	UpdateResumeJournal();
+#endif
+
 	// Check if we need to display a warning
 	const uint32_t now = millis();
 	if (now - lastWarningMillis >= MinimumWarningInterval)
@@ -495,6 +570,29 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 		}
 		break;
 
+	case GCodeState::homingLeadscrews:
+		// Finished a G1 H4 move, so report how far each Z motor moved relative to the first one. These are the corrections that leadscrew levelling would have made.
+		if (LockMovementAndWaitForStandstill(gb))
+		{
+			const Move& move = reprap.GetMove();
+			const AxisDriversConfig& config = platform.GetAxisDriversConfig(Z_AXIS);
+			const float stepsPerMm = platform.DriveStepsPerUnit(Z_AXIS);
+			reply.copy("Z motor offsets:");
+			for (size_t i = 0; i < config.numDrivers; ++i)
+			{
+				const size_t driver = config.driverNumbers[i];
+				if (!move.IsLeadscrewHomed(driver))
+				{
+					reply.printf("Z motor on driver %u did not reach its endstop", driver);
+					error = true;
+					break;
+				}
+				reply.catf(" %.3f", (double)((float)(move.GetLeadscrewHomingSteps(driver) - move.GetLeadscrewHomingSteps(config.driverNumbers[0]))/stepsPerMm));
+			}
+			gb.SetState(GCodeState::normal);
+		}
+		break;
+
 	case GCodeState::waitingForSegmentedMoveToGo:
 		// Wait for all segments of the arc move to go into the movement queue and check whether an error occurred
 		switch (segMoveState)
@@ -666,6 +764,15 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 		SaveFanSpeeds();
 		SavePosition(toolChangeRestorePoint, gb);
 		gb.AdvanceState();
+		if ((gb.MachineState().toolChangeParam & TQueuedBit) != 0)
+		{
+			// Start heating the new tool now, so that it warms up while the old one is being freed
+			Tool * const newTool = reprap.GetTool(gb.MachineState().newToolNumber);
+			if (newTool != nullptr)
+			{
+				newTool->Preheat(reprap.GetCurrentTool());
+			}
+		}
 		if ((gb.MachineState().toolChangeParam & TFreeBit) != 0)
 		{
 			const Tool * const oldTool = reprap.GetCurrentTool();
@@ -680,7 +787,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 
 	case GCodeState::toolChange1:		// Release the old tool (if any), then run tpre for the new tool
 	case GCodeState::m109ToolChange1:	// Release the old tool (if any), then run tpre for the new tool
-		if (LockMovementAndWaitForStandstill(gb))		// wait for tfree.g to finish executing
+		if (WaitForToolChangeStep(gb))					// wait for tfree.g to finish executing
 		{
 			const Tool * const oldTool = reprap.GetCurrentTool();
 			if (oldTool != nullptr)
@@ -700,7 +807,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 
 	case GCodeState::toolChange2:		// Select the new tool (even if it doesn't exist - that just deselects all tools) and run tpost
 	case GCodeState::m109ToolChange2:	// Select the new tool (even if it doesn't exist - that just deselects all tools) and run tpost
-		if (LockMovementAndWaitForStandstill(gb))		// wait for tpre.g to finish executing
+		if (WaitForToolChangeStep(gb))					// wait for tpre.g to finish executing
 		{
 			reprap.SelectTool(gb.MachineState().newToolNumber, simulationMode != 0);
 			UpdateCurrentUserPosition();					// get the actual position of the new tool
@@ -720,7 +827,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 
 	case GCodeState::toolChangeComplete:
 	case GCodeState::m109ToolChangeComplete:
-		if (LockMovementAndWaitForStandstill(gb))		// wait for tpost.g to finish executing
+		if (WaitForToolChangeStep(gb))					// wait for tpost.g to finish executing
 		{
 			// Restore the original Z axis user position, so that different tool Z offsets work even if the first move after the tool change doesn't have a Z coordinate
 			// Only do this if we are running as an FDM printer, because it's not appropriate for CNC machines.
@@ -919,9 +1026,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 					moveBuffer.feedRate = platform.GetZProbeTravelSpeed();
 					NewMoveAvailable(1);
 
-					tapsDone = 0;
-					g30zHeightErrorSum = 0.0;
-					g30zHeightErrorLowestDiff = 1000.0;
+					InitialiseTaps();
 
 					gb.AdvanceState();
 				}
@@ -992,7 +1097,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 				SetMoveBufferDefaults();
 				moveBuffer.endStopsToCheck = ZProbeActive;
 				moveBuffer.coords[Z_AXIS] = -platform.GetZProbeDiveHeight();
-				moveBuffer.feedRate = platform.GetCurrentZProbeParameters().probeSpeed;
+				moveBuffer.feedRate = (approachTapPending) ? platform.GetCurrentZProbeParameters().fastProbeSpeed : platform.GetCurrentZProbeParameters().probeSpeed;
 				NewMoveAvailable(1);
 				gb.AdvanceState();
 			}
@@ -1003,8 +1108,20 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 		if (LockMovementAndWaitForStandstill(gb))
 		{
 			doingManualBedProbe = false;
-			++tapsDone;
 			reprap.GetHeat().SuspendHeaters(false);
+			if (approachTapPending && zProbeTriggered && platform.GetZProbeType() != ZProbeType::none)
+			{
+				// That was the fast approach tap, which we don't count. Back off a little and tap again slowly.
+				platform.SetProbing(false);
+				BackOffAfterApproachTap();
+				gb.SetState(GCodeState::gridProbing2a);
+				if (platform.GetZProbeType() == ZProbeType::blTouch)
+				{
+					DoFileMacro(gb, RETRACTPROBE_G, false);			// bltouch needs to be retracted when it triggers
+				}
+				break;
+			}
+			++tapsDone;
 			if (platform.GetZProbeType() == ZProbeType::none)
 			{
 				// No Z probe, so we are doing manual mesh levelling. Take the current Z height as the height error.
@@ -1024,7 +1141,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 					break;
 				}
 
-				g30zHeightError = moveBuffer.coords[Z_AXIS] - platform.GetZProbeStopHeight();
+				g30zHeightError = moveBuffer.coords[Z_AXIS] + GetZProbeTriggerCorrection() - platform.GetZProbeStopHeight();
 				g30zHeightErrorSum += g30zHeightError;
 			}
 
@@ -1098,45 +1215,18 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 		break;
 
 	case GCodeState::gridProbing6:	// ready to compute the next probe point
+		++gridProbeStep;
+		if (gridProbeOrder.GetPoint(gridProbeStep, gridXindex, gridYindex))
 		{
-			const HeightMap& hm = reprap.GetMove().AccessHeightMap();
-			if (gridYindex & 1)
-			{
-				// Odd row, so decreasing X
-				if (gridXindex == 0)
-				{
-					++gridYindex;
-				}
-				else
-				{
-					--gridXindex;
-				}
-			}
-			else
-			{
-				// Even row, so increasing X
-				if (gridXindex + 1 == hm.GetGrid().NumXpoints())
-				{
-					++gridYindex;
-				}
-				else
-				{
-					++gridXindex;
-				}
-			}
-
-			if (gridYindex == hm.GetGrid().NumYpoints())
-			{
-				// Done all the points
-				gb.AdvanceState();
-				if (platform.GetZProbeType() != ZProbeType::none && !probeIsDeployed)
-				{
-					DoFileMacro(gb, RETRACTPROBE_G, false);
-				}
-			}
-			else
+			gb.SetState(GCodeState::gridProbing1);
+		}
+		else
+		{
+			// Done all the points
+			gb.AdvanceState();
+			if (platform.GetZProbeType() != ZProbeType::none && !probeIsDeployed)
 			{
-				gb.SetState(GCodeState::gridProbing1);
+				DoFileMacro(gb, RETRACTPROBE_G, false);
 			}
 		}
 		break;
@@ -1172,6 +1262,59 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 		gb.SetState(GCodeState::normal);
 		break;
 
+	// States used for probing the grid while moving. We queue a move to each grid point in turn at the scanning height and the step ISR records the Z probe reading when each move completes.
+	// Consecutive points in a row are collinear, so the moves between them are done at full speed.
+	case GCodeState::gridScanning1:		// ready to queue the move to the next grid point
+		StoreScanReadings();
+		if (segmentsLeft == 0)
+		{
+			Move& move = reprap.GetMove();
+			const GridDefinition& grid = move.AccessHeightMap().GetGrid();
+			const float x = grid.GetXCoordinate(gridXindex);
+			const float y = grid.GetYCoordinate(gridYindex);
+			if (grid.IsInRadius(x, y))
+			{
+				if (move.IsAccessibleProbePoint(x, y))
+				{
+					SetMoveBufferDefaults();
+					moveBuffer.coords[X_AXIS] = x - platform.GetCurrentZProbeParameters().xOffset;
+					moveBuffer.coords[Y_AXIS] = y - platform.GetCurrentZProbeParameters().yOffset;
+					moveBuffer.coords[Z_AXIS] = gridScanHeight;
+					moveBuffer.feedRate = platform.GetZProbeTravelSpeed();
+					moveBuffer.scanProbePoint = (int16_t)(gridYindex * grid.NumXpoints() + gridXindex);
+					NewMoveAvailable(1);
+				}
+				else
+				{
+					platform.MessageF(WarningMessage, "Skipping grid point (%.1f, %.1f) because Z probe cannot reach it\n", (double)x, (double)y);
+				}
+			}
+
+			if (!AdvanceGridProbePoint())
+			{
+				gb.AdvanceState();
+			}
+		}
+		break;
+
+	case GCodeState::gridScanning2:		// queued the moves to all the grid points, waiting for them to complete
+		if (LockMovementAndWaitForStandstill(gb))
+		{
+			StoreScanReadings();
+			reprap.GetHeat().SuspendHeaters(false);
+			const unsigned int numLost = reprap.GetMove().GetNumLostScanReadings();
+			if (gridScanPointsOutOfRange + numLost != 0)
+			{
+				platform.MessageF(WarningMessage, "%u grid points were out of range of the Z probe and %u readings were lost\n", gridScanPointsOutOfRange, numLost);
+			}
+			gb.SetState(GCodeState::gridProbing7);
+			if (!probeIsDeployed)
+			{
+				DoFileMacro(gb, RETRACTPROBE_G, false);
+			}
+		}
+		break;
+
 	// States used for G30 probing
 	case GCodeState::probingAtPoint0:
 		// Initial state when executing G30 with a P parameter. Start by moving to the dive height at the current position.
@@ -1262,7 +1405,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 				moveBuffer.coords[Z_AXIS] = (IsAxisHomed(Z_AXIS))
 											? platform.AxisMinimum(Z_AXIS) - platform.GetZProbeDiveHeight() + platform.GetZProbeStopHeight()	// Z axis has been homed, so no point in going very far
 											: -1.1 * platform.AxisTotalLength(Z_AXIS);	// Z axis not homed yet, so treat this as a homing move
-				moveBuffer.feedRate = platform.GetCurrentZProbeParameters().probeSpeed;
+				moveBuffer.feedRate = (approachTapPending) ? platform.GetCurrentZProbeParameters().fastProbeSpeed : platform.GetCurrentZProbeParameters().probeSpeed;
 				NewMoveAvailable(1);
 				gb.AdvanceState();
 			}
@@ -1277,6 +1420,18 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 			reprap.GetHeat().SuspendHeaters(false);
 			doingManualBedProbe = false;
 			hadProbingError = false;
+			if (approachTapPending && zProbeTriggered && platform.GetZProbeType() != ZProbeType::none)
+			{
+				// That was the fast approach tap, which we don't count. Back off a little and tap again slowly.
+				platform.SetProbing(false);
+				BackOffAfterApproachTap();
+				gb.SetState(GCodeState::probingAtPoint2a);
+				if (platform.GetZProbeType() == ZProbeType::blTouch)
+				{
+					DoFileMacro(gb, RETRACTPROBE_G, false);							// bltouch needs to be retracted when it triggers
+				}
+				break;
+			}
 			++tapsDone;
 			if (platform.GetZProbeType() == ZProbeType::none)
 			{
@@ -1297,7 +1452,7 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 					// Successful probing
 					float m[MaxAxes];
 					reprap.GetMove().GetCurrentMachinePosition(m, false);		// get height without bed compensation
-					g30zStoppedHeight = m[Z_AXIS] - g30HValue;					// save for later
+					g30zStoppedHeight = m[Z_AXIS] + GetZProbeTriggerCorrection() - g30HValue;	// save for later
 					g30zHeightError = g30zStoppedHeight - platform.GetZProbeStopHeight();
 					g30zHeightErrorSum += g30zHeightError;
 				}
@@ -1420,10 +1575,33 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 			}
 			else if (g30SValue >= -1)
 			{
-				error = reprap.GetMove().FinishedBedProbing(g30SValue, reply);
-				if (!error && reprap.GetMove().GetKinematics().SupportsAutoCalibration())
+				if (g30PointsToReprobe == 0)
+				{
+					error = reprap.GetMove().FinishedBedProbing(g30SValue, reply);
+					if (!error && reprap.GetMove().GetKinematics().SupportsAutoCalibration())
+					{
+						zDatumSetByProbing = true;			// if we successfully auto calibrated or adjusted leadscrews, we've set the Z datum by probing
+						++g30CalibrationPassesDone;
+						if (reprap.GetMove().GetKinematics().WantsAnotherCalibrationPass(g30CalibrationPassesDone, g30PointsToReprobe))
+						{
+							// Report this pass now, because the reply only reports the last one
+							platform.MessageF(gb.GetResponseMessageType(), "%s\n", reply.c_str());
+							reply.Clear();
+						}
+					}
+				}
+
+				if (g30PointsToReprobe != 0)
 				{
-					zDatumSetByProbing = true;			// if we successfully auto calibrated or adjusted leadscrews, we've set the Z datum by probing
+					// Probe the next point that was still out of tolerance after the last adjustment, without going back to the bed.g macro
+					g30ProbePointIndex = LowestSetBit(g30PointsToReprobe);
+					ClearBit(g30PointsToReprobe, g30ProbePointIndex);
+					gb.SetState(GCodeState::probingAtPoint0);
+					if (platform.GetZProbeType() != ZProbeType::none && platform.GetZProbeType() != ZProbeType::blTouch && !probeIsDeployed)
+					{
+						DoFileMacro(gb, DEPLOYPROBE_G, false);
+					}
+					break;
 				}
 			}
 			gb.SetState(GCodeState::normal);
@@ -1553,8 +1731,24 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 				sdTimingFile->Close();
 				const uint32_t ms = millis() - timingStartMillis;
 				const float fileMbytes = (float)timingBytesWritten/(float)(1024 * 1024);
-				const float mbPerSec = (fileMbytes * 1000.0)/(float)ms;
-				reply.printf("SD write speed for %.1fMbyte file was %.2fMbytes/sec", (double)fileMbytes, (double)mbPerSec);
+				timingWriteSpeed = (fileMbytes * 1000.0)/(float)ms;
+				if (timingFullBenchmark)
+				{
+					sdTimingFile = platform.OpenFile(platform.GetGCodeDir(), TimingFileName, OpenMode::read);
+					if (sdTimingFile == nullptr)
+					{
+						platform.Delete(platform.GetGCodeDir(), TimingFileName);
+						reply.copy("Failed to open timing file");
+						error = true;
+						gb.SetState(GCodeState::normal);
+						break;
+					}
+					timingBytesWritten = 0;
+					timingStartMillis = millis();
+					gb.SetState(GCodeState::timingSDread);
+					break;
+				}
+				reply.printf("SD write speed for %.1fMbyte file was %.2fMbytes/sec", (double)fileMbytes, (double)timingWriteSpeed);
 				platform.Delete(platform.GetGCodeDir(), TimingFileName);
 				gb.SetState(GCodeState::normal);
 				break;
@@ -1574,6 +1768,95 @@ void GCodes::RunStateMachine(GCodeBuffer& gb, const StringRef& reply)
 		}
 		break;
 
+	case GCodeState::timingSDread:
+		for (uint32_t readThisTime = 0; readThisTime < 100 * 1024; )
+		{
+			if (timingBytesWritten >= timingBytesRequested)
+			{
+				const uint32_t ms = millis() - timingStartMillis;
+				timingReadSpeed = ((float)timingBytesWritten * 1000.0)/((float)(1024 * 1024) * (float)ms);
+				timingOpsDone = 0;
+				timingStartMillis = millis();
+				gb.SetState(GCodeState::timingSDrandomRead);
+				break;
+			}
+
+			const int bytesRead = sdTimingFile->Read(reply.Pointer(), reply.Capacity());
+			if (bytesRead <= 0)
+			{
+				sdTimingFile->Close();
+				platform.Delete(platform.GetGCodeDir(), TimingFileName);
+				reply.copy("Error reading timing file");
+				error = true;
+				gb.SetState(GCodeState::normal);
+				break;
+			}
+			timingBytesWritten += bytesRead;
+			readThisTime += bytesRead;
+		}
+		break;
+
+	case GCodeState::timingSDrandomRead:
+	case GCodeState::timingSDrandomWrite:
+		// Each operation reads or writes part of a randomly-chosen sector, so it measures how many commands per second the card can handle
+		for (unsigned int opsThisTime = 0; opsThisTime < 20; ++opsThisTime)
+		{
+			const bool writing = (gb.GetState() == GCodeState::timingSDrandomWrite);
+			if (timingOpsDone == SdTimingRandomOps)
+			{
+				sdTimingFile->Close();
+				const float opsPerSecond = ((float)timingOpsDone * 1000.0)/(float)(millis() - timingStartMillis);
+				if (!writing)
+				{
+					timingRandomReadRate = opsPerSecond;
+					sdTimingFile = platform.OpenFile(platform.GetGCodeDir(), TimingFileName, OpenMode::append);
+					if (sdTimingFile == nullptr)
+					{
+						platform.Delete(platform.GetGCodeDir(), TimingFileName);
+						reply.copy("Failed to open timing file");
+						error = true;
+						gb.SetState(GCodeState::normal);
+						break;
+					}
+					timingOpsDone = 0;
+					timingStartMillis = millis();
+					gb.SetState(GCodeState::timingSDrandomWrite);
+					break;
+				}
+
+				platform.Delete(platform.GetGCodeDir(), TimingFileName);
+				reply.printf("SD card benchmark with %.1fMbyte file: write %.2fMbytes/sec, read %.2fMbytes/sec, random %u-byte reads %.0f/sec, random writes %.0f/sec",
+								(double)((float)timingBytesRequested/(float)(1024 * 1024)), (double)timingWriteSpeed, (double)timingReadSpeed,
+								(unsigned int)reply.Capacity(), (double)timingRandomReadRate, (double)opsPerSecond);
+				uint64_t capacity, freeSpace;
+				uint32_t speed, clSize;
+				if (platform.GetMassStorage()->GetCardInfo(0, capacity, freeSpace, speed, clSize) == MassStorage::InfoResult::ok)
+				{
+					reply.catf(", interface speed %.1fMbytes/sec", (double)((float)speed/(float)(1000 * 1000)));
+				}
+				reply.catf(", max retries %u", FileStore::GetAndClearMaxRetryCount());
+				gb.SetState(GCodeState::normal);
+				break;
+			}
+
+			const FilePosition pos = (FilePosition)random(timingBytesRequested/512) * 512;
+			const bool ok = sdTimingFile->Seek(pos)
+							&& ((writing)
+								? sdTimingFile->Write(reply.c_str(), reply.Capacity()) && sdTimingFile->Flush()
+									: sdTimingFile->Read(reply.Pointer(), reply.Capacity()) == (int)reply.Capacity());
+			if (!ok)
+			{
+				sdTimingFile->Close();
+				platform.Delete(platform.GetGCodeDir(), TimingFileName);
+				reply.copy("Error accessing timing file");
+				error = true;
+				gb.SetState(GCodeState::normal);
+				break;
+			}
+			++timingOpsDone;
+		}
+		break;
+
 	default:				// should not happen
 		platform.Message(ErrorMessage, "Undefined GCodeState\n");
 		gb.SetState(GCodeState::normal);
@@ -1635,8 +1918,12 @@ void GCodes::StartNextGCode(GCodeBuffer& gb, const StringRef& reply)
 #endif
 			)
 	{
-		// USB interface. This line may be shared with a 3D scanner
-		serialInput->FillBuffer(serialGCode);
+		// USB interface. This line may be shared with a 3D scanner.
+		// If we get a complete command then run it straight away like we do for files, so that a host streaming G-code isn't held up waiting for our next turn.
+		if (serialInput->FillBuffer(serialGCode) && gb.IsReady())
+		{
+			gb.SetFinished(ActOnCode(gb, reply));
+		}
 	}
 #ifdef SERIAL_AUX_DEVICE
 	else if (&gb == auxGCode)
@@ -1691,11 +1978,24 @@ void GCodes::DoFilePrint(GCodeBuffer& gb, const StringRef& reply)
 			// We never get here if the file ends in M0 because CancelPrint gets called directly in that case.
 			// Don't close the file until all moves have been completed, in case the print gets paused.
 			// Also, this keeps the state as 'Printing' until the print really has finished.
+			if (simulationMode == 0)
+			{
+				PreheatNextQueuedJob();									// start heating for the next job while the last moves of this one finish
+			}
 			if (   LockMovementAndWaitForStandstill(gb)					// wait until movement has finished
 				&& IsCodeQueueIdle()									// must also wait until deferred command queue has caught up
 			   )
 			{
+				const bool wasSimulating = (simulationMode != 0);
 				StopPrint(StopPrintReason::normalCompletion);
+				if (!wasSimulating && jobQueue.GetNumJobs() != 0)
+				{
+					String<FormatStringLength> jobReply;
+					if (!StartNextQueuedJob(jobReply.GetRef()))
+					{
+						platform.MessageF(ErrorMessage, "%s\n", jobReply.c_str());
+					}
+				}
 			}
 		}
 		else
@@ -1829,7 +2129,10 @@ void GCodes::FilamentError(size_t extruder, FilamentSensorStatus fstat)
 void GCodes::DoEmergencyStop()
 {
 	reprap.EmergencyStop();
-	Reset();
+	{
+		MutexLocker moveLock(Move::GetMoveMutex());		// Reset abandons any waiting move, which the Move task may be part way through taking
+		Reset();
+	}
 	platform.Message(GenericMessage, "Emergency Stop! Reset the controller to continue.");
 }
 
@@ -1845,6 +2148,9 @@ void GCodes::DoPause(GCodeBuffer& gb, PauseReason reason, const char *msg)
 	{
 		// Pausing a file print via another input source or for some other reason
 		pauseRestorePoint.feedRate = fileGCode->MachineState().feedRate;				// set up the default
+
+		// Hold the Move mutex until we have dealt with the waiting move, otherwise the Move task could take it after PausePrint returns and it would be done twice
+		MutexLocker moveLock(Move::GetMoveMutex());
 		const bool movesSkipped = reprap.GetMove().PausePrint(pauseRestorePoint);		// tell Move we wish to pause the current print
 
 		if (movesSkipped)
@@ -1872,7 +2178,7 @@ void GCodes::DoPause(GCodeBuffer& gb, PauseReason reason, const char *msg)
 			pauseRestorePoint.virtualExtruderPosition = virtualExtruderPosition;
 			pauseRestorePoint.proportionDone = 0.0;
 
-			// TODO: when using RTOS there is a possible race condition in the following,
+			// TODO: there is a possible race condition in the following,
 			// because we might try to pause when a waiting move has just been added but before the gcode buffer has been re-initialised ready for the next command
 			pauseRestorePoint.filePos = fileGCode->GetFilePosition(fileInput->BytesCached());
 #if SUPPORT_LASER || SUPPORT_IOBITS
@@ -1901,7 +2207,7 @@ void GCodes::DoPause(GCodeBuffer& gb, PauseReason reason, const char *msg)
 
 		if (reprap.Debug(moduleGcodes))
 		{
-			platform.MessageF(GenericMessage, "Paused print, file offset=%" PRIu32 "\n", pauseRestorePoint.filePos);
+			platform.MessageF(GenericMessage, "Paused print, file offset=%" PRIuFilePos "\n", pauseRestorePoint.filePos);
 		}
 	}
 
@@ -2006,9 +2312,9 @@ bool GCodes::DoEmergencyPause()
 	// Save the resume info, stop movement immediately and run the low voltage pause script to lift the nozzle etc.
 	GrabMovement(*autoPauseGCode);
 
-	// When we use RTOS there is a possible race condition in the following, because we might try to pause when a waiting move has just been added
-	// but before the gcode buffer has been re-initialised ready for the next command. So start a critical section.
-	TaskCriticalSectionLocker lock;
+	// Hold the Move mutex so that the Move task can't take the waiting move while we work out where to resume from.
+	// We mustn't use a task critical section here, because LowPowerOrStallPause takes the same mutex and we can't block on a mutex with the scheduler suspended.
+	MutexLocker moveLock(Move::GetMoveMutex());
 
 	const bool movesSkipped = reprap.GetMove().LowPowerOrStallPause(pauseRestorePoint);
 	if (movesSkipped)
@@ -2100,6 +2406,18 @@ bool GCodes::LowVoltagePause()
 			return false;
 		}
 
+#if SUPPORT_RESUME_JOURNAL
+# if HAS_BACKUP_RESUME_RECORD
+		// Writing the backup registers takes microseconds, so do it before anything else
+		if (resumeJournal.IsActive() && pauseRestorePoint.proportionDone == 0.0)
+		{
+			ResumeJournal::WriteBackupRecord(pauseRestorePoint, ResumeJournalRecord::FlagPowerFailure | GetResumeStateFlags());
+		}
+# endif
+		// Writing one journal sector takes much less time than writing resurrect.g, so do it next in case the power runs out
+		AppendResumeJournalRecord(pauseRestorePoint, ResumeJournalRecord::FlagPowerFailure);
+#endif
+
 		// Run the auto-pause script
 		if (powerFailScript != nullptr)
 		{
@@ -2182,7 +2500,7 @@ void GCodes::SaveResumeInfo(bool wasPowerFailure)
 	const char* const printingFilename = reprap.GetPrintMonitor().GetPrintingFilename();
 	if (printingFilename != nullptr)
 	{
-		FileStore * const f = platform.OpenSysFile(RESUME_AFTER_POWER_FAIL_G, OpenMode::write);
+		FileStore * const f = platform.OpenSysFile(RESUME_AFTER_POWER_FAIL_G, OpenMode::write, FileUser::job);
 		if (f == nullptr)
 		{
 			platform.MessageF(ErrorMessage, "Failed to create file %s\n", RESUME_AFTER_POWER_FAIL_G);
@@ -2304,75 +2622,316 @@ void GCodes::SaveResumeInfo(bool wasPowerFailure)
 			}
 			if (ok)
 			{
-				buf.printf("M23 \"%s\"\nM26 S%" PRIu32, printingFilename, pauseRestorePoint.filePos);
-				if (pauseRestorePoint.proportionDone > 0.0)
-				{
-					buf.catf(" P%.3f X%.3f Y%.3f", (double)pauseRestorePoint.proportionDone, (double)pauseRestorePoint.initialUserX, (double)pauseRestorePoint.initialUserY);
-				}
-				buf.cat('\n');
-				ok = f->Write(buf.c_str());									// write filename and file position, and if necessary proportion done and initial XY position
+				ok = WriteResumePositionAndStart(f, pauseRestorePoint, printingFilename, fileGCode->OriginalMachineState().usingInches);
+			}
+			if (!f->Close())
+			{
+				ok = false;
 			}
 			if (ok)
 			{
-				// Build the commands to restore the head position. These assume that we are working in mm.
-				// Start with a vertical move to 2mm above the final Z position
-				buf.printf("G0 F6000 Z%.3f\n", (double)(pauseRestorePoint.moveCoords[Z_AXIS] + 2.0));
+				platform.Message(LoggedGenericMessage, "Resume state saved\n");
+#if SUPPORT_RESUME_JOURNAL
+				AppendResumeJournalRecord(pauseRestorePoint, ResumeJournalRecord::FlagResumeFileWritten);	// so that M916 knows that resurrect.g is up to date
+# if HAS_BACKUP_RESUME_RECORD
+				ResumeJournal::ClearBackupRecord();
+# endif
+#endif
+			}
+			else
+			{
+				platform.DeleteSysFile(RESUME_AFTER_POWER_FAIL_G);
+				platform.MessageF(ErrorMessage, "Failed to write or close file %s\n", RESUME_AFTER_POWER_FAIL_G);
+			}
+		}
+	}
+}
 
-				// Now set all the other axes
-				buf.cat("G0 F6000");
-				for (size_t axis = 0; axis < numVisibleAxes; ++axis)
-				{
-					if (axis != Z_AXIS)
-					{
-						buf.catf(" %c%.3f", axisLetters[axis], (double)pauseRestorePoint.moveCoords[axis]);
-					}
-				}
+// Write the commands at the end of resurrect.g that select the file, restore the head position and feed rate and resume printing
+bool GCodes::WriteResumePositionAndStart(FileStore *f, const RestorePoint& rp, const char *printingFilename, bool usingInches) const
+{
+	String<FormatStringLength> buf;
+	buf.printf("M23 \"%s\"\nM26 S%" PRIuFilePos, printingFilename, rp.filePos);
+	if (rp.proportionDone > 0.0)
+	{
+		buf.catf(" P%.3f X%.3f Y%.3f", (double)rp.proportionDone, (double)rp.initialUserX, (double)rp.initialUserY);
+	}
+	buf.cat('\n');
+	bool ok = f->Write(buf.c_str());									// write filename and file position, and if necessary proportion done and initial XY position
+	if (ok)
+	{
+		// Build the commands to restore the head position. These assume that we are working in mm.
+		// Start with a vertical move to 2mm above the final Z position
+		buf.printf("G0 F6000 Z%.3f\n", (double)(rp.moveCoords[Z_AXIS] + 2.0));
+
+		// Now set all the other axes
+		buf.cat("G0 F6000");
+		for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+		{
+			if (axis != Z_AXIS)
+			{
+				buf.catf(" %c%.3f", axisLetters[axis], (double)rp.moveCoords[axis]);
+			}
+		}
 
-				// Now move down to the correct Z height
-				buf.catf("\nG0 F6000 Z%.3f\n", (double)pauseRestorePoint.moveCoords[Z_AXIS]);
+		// Now move down to the correct Z height
+		buf.catf("\nG0 F6000 Z%.3f\n", (double)rp.moveCoords[Z_AXIS]);
 
-				// Set the feed rate
-				buf.catf("G1 F%.1f", (double)(pauseRestorePoint.feedRate * MinutesToSeconds));
+		// Set the feed rate
+		buf.catf("G1 F%.1f", (double)(rp.feedRate * MinutesToSeconds));
 #if SUPPORT_LASER
-				if (machineType == MachineType::laser)
-				{
-					buf.catf(" S%u", (unsigned int)pauseRestorePoint.laserPwmOrIoBits.laserPwm);
-				}
-				else
-				{
+		if (machineType == MachineType::laser)
+		{
+			buf.catf(" S%u", (unsigned int)rp.laserPwmOrIoBits.laserPwm);
+		}
+		else
+		{
 #endif
 #if SUPPORT_IOBITS
-					buf.catf(" P%u", (unsigned int)pauseRestorePoint.laserPwmOrIoBits.ioBits);
+			buf.catf(" P%u", (unsigned int)rp.laserPwmOrIoBits.ioBits);
 #endif
 #if SUPPORT_LASER
-				}
+		}
 #endif
-				buf.cat("\n");
-				ok = f->Write(buf.c_str());									// restore feed rate and output bits or laser power
-			}
+		buf.cat("\n");
+		ok = f->Write(buf.c_str());									// restore feed rate and output bits or laser power
+	}
 
-			if (ok)
+	if (ok)
+	{
+		buf.printf("%s\nM24\n", (usingInches) ? "G20" : "G21");
+		ok = f->Write(buf.c_str());									// restore inches/mm and resume printing
+	}
+	return ok;
+}
+
+#if SUPPORT_RESUME_JOURNAL
+
+// If it is time to, record the point that we would resume from if the power failed now in the journal and/or the backup registers
+void GCodes::UpdateResumeJournal()
+{
+	if (!resumeJournal.IsActive() || isPaused || IsPausing())
+	{
+		return;
+	}
+
+	const uint32_t now = millis();
+	const bool journalDue = (now - lastResumeJournalTime >= resumeJournalInterval);
+#if HAS_BACKUP_RESUME_RECORD
+	const bool backupDue = (now - lastBackupResumeTime >= BackupResumeRecordInterval);
+#else
+	const bool backupDue = false;
+#endif
+	if (journalDue || backupDue)
+	{
+		RestorePoint rp;
+		rp.feedRate = fileGCode->MachineState().feedRate;						// set up the default
+		if (reprap.GetMove().GetResumePoint(rp))
+		{
+			// GetResumePoint returned machine coordinates, so convert them to user coordinates
+			float userCoords[MaxAxes];
+			ToolOffsetInverseTransform(rp.moveCoords, userCoords);
+			for (size_t axis = 0; axis < numVisibleAxes; ++axis)
 			{
-				buf.printf("%s\nM24\n", (fileGCode->OriginalMachineState().usingInches) ? "G20" : "G21");
-				ok = f->Write(buf.c_str());									// restore inches/mm and resume printing
+				rp.moveCoords[axis] = userCoords[axis];
 			}
-			if (!f->Close())
+			rp.toolNumber = reprap.GetCurrentToolNumber();
+			if (journalDue)
 			{
-				ok = false;
+				AppendResumeJournalRecord(rp, 0);
+				lastResumeJournalTime = now;
 			}
-			if (ok)
+#if HAS_BACKUP_RESUME_RECORD
+			if (backupDue && rp.proportionDone == 0.0)			// the backup record has no room for the initial XY position of a segmented move
 			{
-				platform.Message(LoggedGenericMessage, "Resume state saved\n");
+				ResumeJournal::WriteBackupRecord(rp, GetResumeStateFlags());
+				lastBackupResumeTime = now;
 			}
-			else
+#endif
+		}
+	}
+}
+
+// Get the resume journal flags that describe how the file is being printed
+uint32_t GCodes::GetResumeStateFlags() const
+{
+	uint32_t flags = 0;
+	if (reprap.GetMove().IsUsingMesh())
+	{
+		flags |= ResumeJournalRecord::FlagUsingMesh;
+	}
+	if (fileGCode->OriginalMachineState().drivesRelative)
+	{
+		flags |= ResumeJournalRecord::FlagDrivesRelative;
+	}
+	if (fileGCode->OriginalMachineState().usingInches)
+	{
+		flags |= ResumeJournalRecord::FlagUsingInches;
+	}
+	return flags;
+}
+
+// Record a resume point in the journal, along with the rest of the print state that we need to rebuild resurrect.g
+void GCodes::AppendResumeJournalRecord(const RestorePoint& rp, uint32_t flags)
+{
+	const char* const printingFilename = reprap.GetPrintMonitor().GetPrintingFilename();
+	if (printingFilename == nullptr || !resumeJournal.IsActive())
+	{
+		return;
+	}
+
+	ResumeJournalRecord record;
+	record.flags = flags | GetResumeStateFlags();
+	record.restorePoint = rp;
+	for (size_t axis = 0; axis < MaxAxes; ++axis)
+	{
+		record.babyStepOffsets[axis] = currentBabyStepOffsets[axis];
+		record.currentToolOffsets[axis] = (axis < numVisibleAxes) ? GetCurrentToolOffset(axis) : 0.0;
+	}
+
+	const Tool * const ct = reprap.GetCurrentTool();
+	for (size_t i = 0; i < MaxHeatersPerTool; ++i)
+	{
+		const bool valid = (ct != nullptr && i < ct->HeaterCount());
+		record.toolActiveTemperatures[i] = (valid) ? ct->GetToolHeaterActiveTemperature(i) : 0.0;
+		record.toolStandbyTemperatures[i] = (valid) ? ct->GetToolHeaterStandbyTemperature(i) : 0.0;
+	}
+
+	const Heat& heat = reprap.GetHeat();
+	const int8_t bedHeater = heat.GetBedHeater(0);
+	record.bedTemperature = (heat.GetStatus(bedHeater) == Heat::HS_active) ? heat.GetActiveTemperature(bedHeater) : -1.0;
+	const int8_t chamberHeater = heat.GetChamberHeater(0);
+	record.chamberTemperature = (heat.GetStatus(chamberHeater) == Heat::HS_active) ? heat.GetActiveTemperature(chamberHeater) : -1.0;
+	record.fanSpeed = lastDefaultFanSpeed;
+#if SUPPORT_WORKPLACE_COORDINATES
+	record.coordinateSystem = currentCoordinateSystem;
+#else
+	record.coordinateSystem = 0;
+#endif
+	SafeStrncpy(record.fileName, printingFilename, ARRAY_SIZE(record.fileName));
+
+	if (!resumeJournal.Append(record))
+	{
+		platform.Message(ErrorMessage, "Failed to write the resume journal, journaling stopped\n");
+		resumeJournal.Stop(true);
+	}
+}
+
+// Write resurrect.g from a journal record. We do this after a restart, so config.g has already set up the machine, tools and heaters.
+bool GCodes::RebuildResumeFile(const ResumeJournalRecord& record)
+{
+	FileStore * const f = platform.OpenSysFile(RESUME_AFTER_POWER_FAIL_G, OpenMode::write, FileUser::job);
+	if (f == nullptr)
+	{
+		platform.MessageF(ErrorMessage, "Failed to create file %s\n", RESUME_AFTER_POWER_FAIL_G);
+		return false;
+	}
+
+	const RestorePoint& rp = record.restorePoint;
+	String<FormatStringLength> buf;
+	buf.printf("; File \"%s\" resume print after %s, rebuilt from the resume journal\nG21\n",
+				record.fileName, ((record.flags & ResumeJournalRecord::FlagPowerFailure) != 0) ? "power failure" : "restart");
+	if (record.bedTemperature >= 0.0)
+	{
+		buf.catf("M140 P0 S%.1f\n", (double)record.bedTemperature);
+	}
+	if (record.chamberTemperature >= 0.0)
+	{
+		buf.catf("M141 P0 S%.1f\n", (double)record.chamberTemperature);
+	}
+	bool ok = f->Write(buf.c_str())
+			&& reprap.GetMove().GetKinematics().WriteResumeSettings(f)
+			&& ((record.flags & ResumeJournalRecord::FlagUsingMesh) == 0 || f->Write("G29 S1\n"));
+	if (ok)
+	{
+		// Say where the head is, without any tool offsets and baby step offsets
+		buf.copy("T-1 P0\nG92");
+		for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+		{
+			const float totalOffset = record.babyStepOffsets[axis] - record.currentToolOffsets[axis];
+			buf.catf(" %c%.3f", axisLetters[axis], (double)(rp.moveCoords[axis] - totalOffset));
+		}
+		buf.cat("\nG60 S1\n");
+		ok = f->Write(buf.c_str());
+	}
+
+	const Tool * const tool = reprap.GetTool(rp.toolNumber);
+	if (ok && tool != nullptr)
+	{
+		// Set the tool temperatures and select the tool without running the tool change files, so that it starts heating
+		buf.Clear();
+		if (tool->HeaterCount() != 0)
+		{
+			buf.printf("G10 P%d ", rp.toolNumber);
+			char c = 'S';
+			for (size_t i = 0; i < tool->HeaterCount(); ++i)
 			{
-				platform.DeleteSysFile(RESUME_AFTER_POWER_FAIL_G);
-				platform.MessageF(ErrorMessage, "Failed to write or close file %s\n", RESUME_AFTER_POWER_FAIL_G);
+				buf.catf("%c%d", c, (int)record.toolActiveTemperatures[i]);
+				c = ':';
+			}
+			buf.cat(' ');
+			c = 'R';
+			for (size_t i = 0; i < tool->HeaterCount(); ++i)
+			{
+				buf.catf("%c%d", c, (int)record.toolStandbyTemperatures[i]);
+				c = ':';
 			}
+			buf.cat('\n');
+		}
+		buf.catf("T%d P0\n", rp.toolNumber);
+		ok = f->Write(buf.c_str());
+	}
+	if (ok)
+	{
+		buf.printf("M98 P\"%s\"\nM116\nM290", RESUME_PROLOGUE_G);		// call the prologue, wait for temperatures and restore the baby stepping offsets
+		for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+		{
+			buf.catf(" %c%.3f", axisLetters[axis], (double)record.babyStepOffsets[axis]);
 		}
+		buf.cat(" R0\n");
+		if (tool != nullptr)
+		{
+			buf.catf("T-1 P0\nT%d P6\n", rp.toolNumber);					// deselect the tool without running tfree, and select it running tpre and tpost
+		}
+		ok = f->Write(buf.c_str());
 	}
+	if (ok)
+	{
+#if SUPPORT_WORKPLACE_COORDINATES
+		if (record.coordinateSystem <= 5)
+		{
+			buf.printf("G%" PRIu32 "\n", 54 + record.coordinateSystem);
+		}
+		else
+		{
+			buf.printf("G59.%" PRIu32 "\n", record.coordinateSystem - 5);
+		}
+#else
+		buf.Clear();
+#endif
+		buf.catf("M106 S%.2f\nM116\nG92 E%.5f\n%s\n",
+					(double)record.fanSpeed, (double)rp.virtualExtruderPosition,
+					((record.flags & ResumeJournalRecord::FlagDrivesRelative) != 0) ? "M83" : "M82");
+		ok = f->Write(buf.c_str());
+	}
+	if (ok)
+	{
+		ok = WriteResumePositionAndStart(f, rp, record.fileName, (record.flags & ResumeJournalRecord::FlagUsingInches) != 0);
+	}
+	if (!f->Close())
+	{
+		ok = false;
+	}
+	if (!ok)
+	{
+		platform.DeleteSysFile(RESUME_AFTER_POWER_FAIL_G);
+		platform.MessageF(ErrorMessage, "Failed to write or close file %s\n", RESUME_AFTER_POWER_FAIL_G);
+	}
+	return ok;
 }
 
+#endif
+
 void GCodes::Diagnostics(MessageType mtype)
 {
 	platform.Message(mtype, "=== GCodes ===\n");
@@ -2414,11 +2973,31 @@ bool GCodes::LockMovementAndWaitForStandstill(const GCodeBuffer& gb)
 		return false;
 	}
 
-	// Get the current positions. These may not be the same as the ones we remembered from last time if we just did a special move.
+	// Get the current positions. These may not be the same as the ones we remembered from last time if we just did a special move.
+	UpdateCurrentUserPosition();
+	return true;
+}
+
+// Lock movement and wait until all the moves we have generated are in the queue, but not for them to finish.
+// The current user position is then the one at the end of the last queued move, so we can change the tool offset at that point in the move stream.
+bool GCodes::LockMovementAndWaitForQueuedMoves(const GCodeBuffer& gb)
+{
+	if (!LockMovement(gb) || segmentsLeft != 0)
+	{
+		return false;
+	}
+
 	UpdateCurrentUserPosition();
 	return true;
 }
 
+// Wait until the previous step of a tool change has finished executing. If the T command asked for a queued tool change then we only wait
+// for its moves to be queued; otherwise we wait for them to finish, because the tool change macros may switch outputs that must not change while the tool is moving.
+bool GCodes::WaitForToolChangeStep(const GCodeBuffer& gb)
+{
+	return ((gb.MachineState().toolChangeParam & TQueuedBit) != 0) ? LockMovementAndWaitForQueuedMoves(gb) : LockMovementAndWaitForStandstill(gb);
+}
+
 // Save (some of) the state of the machine for recovery in the future.
 bool GCodes::Push(GCodeBuffer& gb)
 {
@@ -2515,37 +3094,28 @@ bool GCodes::LoadExtrusionAndFeedrateFromGCode(GCodeBuffer& gb, bool isPrintingM
 					rawExtruderTotal += requestedExtrusionAmount;
 				}
 
-				float totalMix = 0.0;
-				for (size_t eDrive = 0; eDrive < eMoveCount; eDrive++)
+				const ExtruderMix& em = GetExtruderMix(tool, gb.MachineState().volumetricExtrusion);
+				const bool addToRawTotals = (moveBuffer.moveType == 0 && !gb.IsDoingFileMacro());
+				for (size_t i = 0; i < em.numDrives; ++i)
 				{
-					const float thisMix = tool->GetMix()[eDrive];
-					if (thisMix != 0.0)
+					const size_t drive = em.drives[i];
+					if (addToRawTotals)
 					{
-						totalMix += thisMix;
-						const int drive = tool->Drive(eDrive);
-						float extrusionAmount = requestedExtrusionAmount * thisMix;
-						if (gb.MachineState().volumetricExtrusion)
-						{
-							extrusionAmount *= volumetricExtrusionFactors[drive];
-						}
-						if (moveBuffer.moveType == 0 && !gb.IsDoingFileMacro())
-						{
-							rawExtruderTotalByDrive[drive] += extrusionAmount;
-						}
+						rawExtruderTotalByDrive[drive] += requestedExtrusionAmount * em.rawFactors[i];
+					}
 
-						moveBuffer.coords[drive + numTotalAxes] = extrusionAmount * extrusionFactors[drive];
+					moveBuffer.coords[drive + numTotalAxes] = requestedExtrusionAmount * em.factors[i];
 #if HAS_SMART_DRIVERS
-						if (moveBuffer.moveType == 1)
-						{
-							SetBit(moveBuffer.endStopsToCheck, drive + numTotalAxes);
-						}
-#endif
+					if (moveBuffer.moveType == 1)
+					{
+						SetBit(moveBuffer.endStopsToCheck, drive + numTotalAxes);
 					}
+#endif
 				}
 				if (!isPrintingMove && moveBuffer.usingStandardFeedrate)
 				{
 					// For E3D: If the total mix ratio is greater than 1.0 then we should scale the feed rate accordingly, e.g. for dual serial extruder drives
-					moveBuffer.feedRate *= totalMix;
+					moveBuffer.feedRate *= em.totalMix;
 				}
 			}
 			else
@@ -2618,6 +3188,9 @@ const char* GCodes::DoStraightMove(GCodeBuffer& gb, bool isCoordinated)
 	moveBuffer.moveType = 0;
 	moveBuffer.tool = reprap.GetCurrentTool();
 	moveBuffer.usePressureAdvance = false;
+#if SUPPORT_LASER
+	moveBuffer.numLaserRasterPixels = 0;
+#endif
 	axesToSenseLength = 0;
 
 	// Check to see if the move is a 'homing' move that endstops are checked on.
@@ -2625,7 +3198,7 @@ const char* GCodes::DoStraightMove(GCodeBuffer& gb, bool isCoordinated)
 	if (gb.Seen('H') || (machineType != MachineType::laser && gb.Seen('S')))
 	{
 		const int ival = gb.GetIValue();
-		if (ival >= 1 && ival <= 3)
+		if (ival >= 1 && ival <= 4)
 		{
 			moveBuffer.moveType = ival;
 			moveBuffer.tool = nullptr;
@@ -2658,7 +3231,27 @@ const char* GCodes::DoStraightMove(GCodeBuffer& gb, bool isCoordinated)
 	{
 		if (gb.Seen('S'))
 		{
-			moveBuffer.laserPwmOrIoBits.laserPwm = ConvertLaserPwm(gb.GetFValue());
+			// A list of S values such as S255:0:128 makes this a raster move, along which the laser power changes at evenly spaced positions
+			float pwmValues[MaxLaserRasterPixels];
+			size_t numValues = MaxLaserRasterPixels;
+			gb.GetFloatArray(pwmValues, numValues, false);
+			if (numValues == 0)
+			{
+				return "G0/G1: too many laser power values";
+			}
+			if (numValues > 1)
+			{
+				if (reprap.GetMove().GetKinematics().UseSegmentation())
+				{
+					return "G0/G1: laser raster moves are not supported with segmented kinematics";
+				}
+				for (size_t i = 0; i < numValues; ++i)
+				{
+					moveBuffer.laserRasterPwm[i] = ConvertLaserPwm(pwmValues[i]);
+				}
+				moveBuffer.numLaserRasterPixels = numValues;
+			}
+			moveBuffer.laserPwmOrIoBits.laserPwm = ConvertLaserPwm(pwmValues[0]);
 		}
 		else if (moveBuffer.moveType != 0)
 		{
@@ -2776,6 +3369,35 @@ const char* GCodes::DoStraightMove(GCodeBuffer& gb, bool isCoordinated)
 			axesToSenseLength = moveBuffer.endStopsToCheck;
 		}
 	}
+	else if (moveBuffer.moveType == 4)
+	{
+		// Homing the individual motors of the Z axis. Each one stops when the endstop input with the same number as its driver is triggered.
+		if (axesMentioned != MakeBitmap<AxesBitmap>(Z_AXIS))
+		{
+			return "G0/G1: H4 moves must move the Z axis only";
+		}
+		if (reprap.GetMove().GetKinematics().GetConnectedAxes(Z_AXIS) != MakeBitmap<AxesBitmap>(Z_AXIS))
+		{
+			return "G0/G1: H4 moves need Z motors that move the Z axis only";
+		}
+		EndStopPosition stopType;
+		EndStopInputType inputType;
+		platform.GetEndStopConfiguration(Z_AXIS, stopType, inputType);
+		if (inputType != EndStopInputType::activeHigh && inputType != EndStopInputType::activeLow)
+		{
+			return "G0/G1: H4 moves need Z endstop switches";
+		}
+		const AxisDriversConfig& config = platform.GetAxisDriversConfig(Z_AXIS);
+		for (size_t i = 0; i < config.numDrivers; ++i)
+		{
+			if (config.driverNumbers[i] >= NumEndstops || config.driverNumbers[i] >= NumDirectDrivers)
+			{
+				return "G0/G1: H4 moves need an endstop input for the driver of each Z motor";
+			}
+		}
+		moveBuffer.endStopsToCheck = MotorEndstops | ((inputType == EndStopInputType::activeLow) ? ActiveLowEndstop : 0);
+		SetAxisNotHomed(Z_AXIS);				// the Z motors move independently, so we don't know where the Z axis is until they have all reached their endstops
+	}
 
 	LoadExtrusionAndFeedrateFromGCode(gb, axesMentioned != 0);
 
@@ -2785,7 +3407,7 @@ const char* GCodes::DoStraightMove(GCodeBuffer& gb, bool isCoordinated)
 	{
 		// It's a raw motor move, so do it in a single segment and wait for it to complete
 		totalSegments = 1;
-		gb.SetState(GCodeState::waitingForSpecialMoveToComplete);
+		gb.SetState((moveBuffer.moveType == 4) ? GCodeState::homingLeadscrews : GCodeState::waitingForSpecialMoveToComplete);
 	}
 	else if (axesMentioned == 0)
 	{
@@ -2874,16 +3496,45 @@ const char* GCodes::DoStraightMove(GCodeBuffer& gb, bool isCoordinated)
 			const float xyLength = sqrtf(fsquare(currentUserPosition[X_AXIS] - initialX) + fsquare(currentUserPosition[Y_AXIS] - initialY));
 			const float moveTime = xyLength/moveBuffer.feedRate;			// this is a best-case time, often the move will take longer
 			totalSegments = (unsigned int)max<int>(1, min<int>(rintf(xyLength/kin.GetMinSegmentLength()), rintf(moveTime * kin.GetSegmentsPerSecond())));
+#if SUPPORT_SEGMENT_FREE_STREAMING
+			if (kin.UseSegmentFreeStreaming())
+			{
+				// Each DDA streams up to MaxStreamedSubSegments segments, but we still need one DDA per mesh cell if we are using mesh compensation
+				totalSegments = (totalSegments + MaxStreamedSubSegments - 1)/MaxStreamedSubSegments;
+				if (reprap.GetMove().IsUsingMesh())
+				{
+					const HeightMap& heightMap = reprap.GetMove().AccessHeightMap();
+					totalSegments = max<unsigned int>(totalSegments, heightMap.GetMinimumSegments(currentUserPosition[X_AXIS] - initialX, currentUserPosition[Y_AXIS] - initialY));
+				}
+			}
+#endif
 		}
 		else if (reprap.GetMove().IsUsingMesh() && (moveBuffer.isCoordinated || machineType == MachineType::fff))
 		{
 			const HeightMap& heightMap = reprap.GetMove().AccessHeightMap();
-			totalSegments = max<unsigned int>(1, heightMap.GetMinimumSegments(currentUserPosition[X_AXIS] - initialX, currentUserPosition[Y_AXIS] - initialY));
+#if SUPPORT_SEGMENT_FREE_STREAMING
+			if (reprap.GetMove().UseMeshStreaming())
+			{
+				// The Move code streams the Z motor across the grid lines, but each DDA can only stream a limited number of sub-segments
+				totalSegments = heightMap.GetMinimumStreamedSegments(currentUserPosition[X_AXIS] - initialX, currentUserPosition[Y_AXIS] - initialY, MaxStreamedSubSegments - 1);
+			}
+			else
+#endif
+			{
+				totalSegments = max<unsigned int>(1, heightMap.GetMinimumSegments(currentUserPosition[X_AXIS] - initialX, currentUserPosition[Y_AXIS] - initialY));
+			}
 		}
 		else
 		{
 			totalSegments = 1;
 		}
+
+#if SUPPORT_LASER
+		if (moveBuffer.numLaserRasterPixels > 1)
+		{
+			totalSegments = 1;											// the pixels are spaced along the whole move, so it must not be split
+		}
+#endif
 	}
 
 	doingArcMove = false;
@@ -3068,6 +3719,9 @@ const char* GCodes::DoArcMove(GCodeBuffer& gb, bool clockwise)
 	moveBuffer.moveType = 0;
 	moveBuffer.tool = reprap.GetCurrentTool();
 	moveBuffer.isCoordinated = true;
+#if SUPPORT_LASER
+	moveBuffer.numLaserRasterPixels = 0;
+#endif
 
 	// Set up the arc centre coordinates and record which axes behave like an X axis.
 	// The I and J parameters are always relative to present position.
@@ -3158,6 +3812,12 @@ const char* GCodes::DoArcMove(GCodeBuffer& gb, bool clockwise)
 		arcAngleIncrement = -arcAngleIncrement;
 	}
 
+	// We generate the segments by rotating the radius vector, so we only need to evaluate the trig functions once for each few segments
+	arcCurrentSin = sinf(arcCurrentAngle);
+	arcCurrentCos = cosf(arcCurrentAngle);
+	arcIncrementSin = sinf(arcAngleIncrement);
+	arcIncrementCos = cosf(arcAngleIncrement);
+
 	doingArcMove = true;
 	FinaliseMove(gb);
 	UnlockAll(gb);			// allow pause
@@ -3211,6 +3871,7 @@ bool GCodes::ReadMove(RawMove& m)
 	}
 
 	m = moveBuffer;
+	const float startX = moveBuffer.initialCoords[X_AXIS], startY = moveBuffer.initialCoords[Y_AXIS];
 
 	if (segmentsLeft == 1)
 	{
@@ -3237,6 +3898,18 @@ bool GCodes::ReadMove(RawMove& m)
 		if (doingArcMove)
 		{
 			arcCurrentAngle += arcAngleIncrement;
+			if (segmentsLeft % ArcCorrectionSegments == 0)
+			{
+				// Recalculate the position exactly now and again, so that rounding errors in the rotation don't build up
+				arcCurrentSin = sinf(arcCurrentAngle);
+				arcCurrentCos = cosf(arcCurrentAngle);
+			}
+			else
+			{
+				const float newSin = arcCurrentSin * arcIncrementCos + arcCurrentCos * arcIncrementSin;
+				arcCurrentCos = arcCurrentCos * arcIncrementCos - arcCurrentSin * arcIncrementSin;
+				arcCurrentSin = newSin;
+			}
 		}
 
 		for (size_t drive = 0; drive < numVisibleAxes; ++drive)
@@ -3244,12 +3917,12 @@ bool GCodes::ReadMove(RawMove& m)
 			if (doingArcMove && drive != Z_AXIS && IsBitSet(Tool::GetYAxes(moveBuffer.tool), drive))
 			{
 				// Y axis or a substitute Y axis
-				moveBuffer.initialCoords[drive] = arcCentre[drive] + arcRadius * axisScaleFactors[drive] * sinf(arcCurrentAngle);
+				moveBuffer.initialCoords[drive] = arcCentre[drive] + arcRadius * axisScaleFactors[drive] * arcCurrentSin;
 			}
 			else if (doingArcMove && drive != Z_AXIS && IsBitSet(Tool::GetXAxes(moveBuffer.tool), drive))
 			{
 				// X axis or a substitute X axis
-				moveBuffer.initialCoords[drive] = arcCentre[drive] + arcRadius * axisScaleFactors[drive] * cosf(arcCurrentAngle);
+				moveBuffer.initialCoords[drive] = arcCentre[drive] + arcRadius * axisScaleFactors[drive] * arcCurrentCos;
 			}
 			else
 			{
@@ -3288,9 +3961,34 @@ bool GCodes::ReadMove(RawMove& m)
 		m.proportionDone = (float)(totalSegments - segmentsLeft)/(float)totalSegments;
 	}
 
+	// Superimpose some of any pending Z baby stepping on this move. We limit the Z speed to a fraction of the move speed and to half the Z jerk,
+	// so big changes are spread over several moves instead of being done in one. We only change moves that haven't been queued,
+	// so nothing needs to be planned again. The offset is added to the rest of the move too, so it carries over into following segments and moves.
+	{
+		TaskCriticalSectionLocker lock;			// M290 may change the pending amount
+		if (pendingZBabyStepping != 0.0 && m.moveType == 0 && m.endStopsToCheck == 0 && m.feedRate > 0.0)
+		{
+			const float xyLength = sqrtf(fsquare(m.coords[X_AXIS] - startX) + fsquare(m.coords[Y_AXIS] - startY));
+			const float maxAmount = xyLength * min<float>(MaxBabySteppingSpeedFraction, 0.5 * platform.GetInstantDv(Z_AXIS)/m.feedRate);
+			const float amount = constrain<float>(pendingZBabyStepping, -maxAmount, maxAmount);
+			if (amount != 0.0)
+			{
+				m.coords[Z_AXIS] += amount;
+				moveBuffer.coords[Z_AXIS] += amount;
+				if (segmentsLeft != 0)
+				{
+					moveBuffer.initialCoords[Z_AXIS] += amount;
+				}
+				currentBabyStepOffsets[Z_AXIS] += amount;
+				pendingZBabyStepping -= amount;
+			}
+		}
+	}
+
 	return true;
 }
 
+// Abandon the waiting move. If a move may be waiting, the caller must hold the Move mutex, or be the Move task.
 void GCodes::ClearMove()
 {
 	TaskCriticalSectionLocker lock;				// make sure that other tasks sees a consistent memory state
@@ -3300,7 +3998,11 @@ void GCodes::ClearMove()
 	doingArcMove = false;
 	moveBuffer.endStopsToCheck = 0;
 	moveBuffer.moveType = 0;
+	moveBuffer.scanProbePoint = -1;
 	moveBuffer.isFirmwareRetraction = false;
+#if SUPPORT_LASER
+	moveBuffer.numLaserRasterPixels = 0;
+#endif
 	moveFractionToSkip = 0.0;
 }
 
@@ -3335,7 +4037,7 @@ void GCodes::EmergencyStop()
 // 0 = running a system macro automatically
 bool GCodes::DoFileMacro(GCodeBuffer& gb, const char* fileName, bool reportMissing, int codeRunning)
 {
-	FileStore * const f = platform.OpenSysFile(fileName, OpenMode::read);
+	FileStore * const f = platform.OpenSysMacroFile(fileName);
 	if (f == nullptr)
 	{
 		if (reportMissing)
@@ -3441,6 +4143,8 @@ GCodeResult GCodes::ExecuteG30(GCodeBuffer& gb, const StringRef& reply)
 
 	g30HValue = (gb.Seen('H')) ? gb.GetFValue() : 0.0;
 	g30ProbePointIndex = -1;
+	g30PointsToReprobe = 0;
+	g30CalibrationPassesDone = 0;
 	bool seenP = false;
 	gb.TryGetIValue('P', g30ProbePointIndex, seenP);
 	if (seenP)
@@ -3517,8 +4221,9 @@ void GCodes::DoManualProbe(GCodeBuffer& gb)
 }
 
 // Start probing the grid, returning true if we didn't because of an error.
+// If whileMoving is true then we sweep an analog Z probe over the grid at a fixed height and convert its readings to heights, instead of stopping to probe each point.
 // Prior to calling this the movement system must be locked.
-GCodeResult GCodes::ProbeGrid(GCodeBuffer& gb, const StringRef& reply)
+GCodeResult GCodes::ProbeGrid(GCodeBuffer& gb, const StringRef& reply, bool whileMoving)
 {
 	if (!defaultGrid.IsValid())
 	{
@@ -3532,10 +4237,53 @@ GCodeResult GCodes::ProbeGrid(GCodeBuffer& gb, const StringRef& reply)
 		return GCodeResult::error;
 	}
 
+	if (whileMoving)
+	{
+		const ZProbeType probeType = platform.GetZProbeType();
+		if (   (probeType != ZProbeType::analog && probeType != ZProbeType::dumbModulated && probeType != ZProbeType::alternateAnalog)
+			|| platform.GetCurrentZProbeParameters().sensitivity <= 0.0
+		   )
+		{
+			reply.copy("Probing while moving needs an analog Z probe with a sensitivity set by G31 K");
+			return GCodeResult::error;
+		}
+
+		bool dummy;
+		gridScanHeight = platform.GetZProbeStopHeight();	// by default, scan at the height where the probe is most sensitive
+		gb.TryGetFValue('H', gridScanHeight, dummy);
+		if (gridScanHeight <= 0.0)
+		{
+			reply.copy("Probing height must be positive");
+			return GCodeResult::error;
+		}
+	}
+
 	reprap.GetMove().AccessHeightMap().SetGrid(defaultGrid);
 	ClearBedMapping();
 	gridXindex = gridYindex = 0;
-	gb.SetState(GCodeState::gridProbing1);
+	if (whileMoving)
+	{
+		gridScanPointsOutOfRange = 0;
+		reprap.GetMove().ClearScanReadings();
+		if (platform.GetCurrentZProbeParameters().turnHeatersOff)
+		{
+			reprap.GetHeat().SuspendHeaters(true);
+		}
+		gb.SetState(GCodeState::gridScanning1);
+	}
+	else
+	{
+		// When we stop at each point, visit them in the order that needs the least travel. Unreachable points are left out of the order.
+		const ZProbe& params = platform.GetCurrentZProbeParameters();
+		gridProbeOrder.Prepare(defaultGrid, params.xOffset, params.yOffset);
+		if (gridProbeOrder.NumUnreachablePoints() != 0)
+		{
+			platform.MessageF(WarningMessage, "Skipping %u grid points because Z probe cannot reach them\n", gridProbeOrder.NumUnreachablePoints());
+		}
+		gridProbeStep = 0;
+		(void)gridProbeOrder.GetPoint(gridProbeStep, gridXindex, gridYindex);
+		gb.SetState(GCodeState::gridProbing1);
+	}
 
 	if (platform.GetZProbeType() != ZProbeType::none && platform.GetZProbeType() != ZProbeType::blTouch && !probeIsDeployed)
 	{
@@ -3544,6 +4292,60 @@ GCodeResult GCodes::ProbeGrid(GCodeBuffer& gb, const StringRef& reply)
 	return GCodeResult::ok;
 }
 
+// Move on to the next grid point, returning false if there are no more. We probe the rows alternately in increasing and decreasing X order.
+bool GCodes::AdvanceGridProbePoint()
+{
+	const GridDefinition& grid = reprap.GetMove().AccessHeightMap().GetGrid();
+	if (gridYindex & 1)
+	{
+		// Odd row, so decreasing X
+		if (gridXindex == 0)
+		{
+			++gridYindex;
+		}
+		else
+		{
+			--gridXindex;
+		}
+	}
+	else
+	{
+		// Even row, so increasing X
+		if (gridXindex + 1 == grid.NumXpoints())
+		{
+			++gridYindex;
+		}
+		else
+		{
+			++gridXindex;
+		}
+	}
+	return gridYindex < grid.NumYpoints();
+}
+
+// Convert the Z probe readings taken at the ends of the moves when probing while moving to height errors, and store them in the height map.
+// The reading is only meaningful if it isn't at either end of the probe's range.
+void GCodes::StoreScanReadings()
+{
+	Move& move = reprap.GetMove();
+	HeightMap& hm = move.AccessHeightMap();
+	const size_t numX = hm.GetGrid().NumXpoints();
+	const ZProbe& params = platform.GetCurrentZProbeParameters();
+	unsigned int point;
+	int reading;
+	while (move.GetScanReading(point, reading))
+	{
+		if (reading > 0 && reading < ZProbe::MaxReading)
+		{
+			hm.SetGridHeight(point % numX, point / numX, params.GetHeightError(reading, gridScanHeight, platform.GetZProbeTemperature()));
+		}
+		else
+		{
+			++gridScanPointsOutOfRange;
+		}
+	}
+}
+
 GCodeResult GCodes::LoadHeightMap(GCodeBuffer& gb, const StringRef& reply)
 {
 	ClearBedMapping();
@@ -3563,8 +4365,25 @@ GCodeResult GCodes::LoadHeightMap(GCodeBuffer& gb, const StringRef& reply)
 		return GCodeResult::error;
 	}
 
-	reply.printf("Failed to load height map from file %s: ", heightMapFileName.c_str());	// set up error message to append to
-	const bool err = reprap.GetMove().LoadHeightMapFromFile(f, reply);
+	// If there is an up-to-date binary copy of the height map then load that instead, because it is much faster
+	bool err = true;
+	String<MaxFilenameLength> binaryFileName;
+	binaryFileName.copy(heightMapFileName.c_str());
+	if (!binaryFileName.cat(BinaryHeightMapSuffix))
+	{
+		FileStore * const bf = platform.OpenSysFile(binaryFileName.c_str(), OpenMode::read);
+		if (bf != nullptr)
+		{
+			err = reprap.GetMove().LoadHeightMapFromBinaryFile(bf, f->Length(), GetSysFileTime(heightMapFileName.c_str()));
+			bf->Close();
+		}
+	}
+
+	if (err)
+	{
+		reply.printf("Failed to load height map from file %s: ", heightMapFileName.c_str());	// set up error message to append to
+		err = reprap.GetMove().LoadHeightMapFromFile(f, reply);
+	}
 	f->Close();
 	reprap.GetMove().UseMesh(!err);
 
@@ -3596,7 +4415,8 @@ bool GCodes::TrySaveHeightMap(const char *filename, const StringRef& reply) cons
 	else
 	{
 		err = reprap.GetMove().SaveHeightMapToFile(f);
-		f->Close();
+		const uint32_t csvLength = f->Length();
+		err = !f->Close() || err;
 		if (err)
 		{
 			platform.DeleteSysFile(filename);
@@ -3606,10 +4426,46 @@ bool GCodes::TrySaveHeightMap(const char *filename, const StringRef& reply) cons
 		{
 			reply.catf("Height map saved to file %s", filename);
 		}
+		TrySaveBinaryHeightMap(filename, (err) ? 0 : csvLength);
 	}
 	return err;
 }
 
+// Save a binary copy of the height map alongside the CSV file, or remove any old copy if the CSV file wasn't saved.
+// If we fail to save it then we delete it, so that the height map will be loaded from the CSV file.
+void GCodes::TrySaveBinaryHeightMap(const char *csvFilename, uint32_t csvLength) const
+{
+	String<MaxFilenameLength> binaryFileName;
+	binaryFileName.copy(csvFilename);
+	if (binaryFileName.cat(BinaryHeightMapSuffix))
+	{
+		return;
+	}
+
+	bool ok = false;
+	if (csvLength != 0)
+	{
+		FileStore * const f = platform.OpenSysFile(binaryFileName.c_str(), OpenMode::write);
+		if (f != nullptr)
+		{
+			ok = !reprap.GetMove().SaveHeightMapToBinaryFile(f, csvLength, GetSysFileTime(csvFilename));
+			ok = f->Close() && ok;
+		}
+	}
+	if (!ok && platform.SysFileExists(binaryFileName.c_str()))
+	{
+		platform.DeleteSysFile(binaryFileName.c_str());
+	}
+}
+
+// Get the modification time of a file in the system folder, or zero if it can't be found
+uint32_t GCodes::GetSysFileTime(const char *filename) const
+{
+	String<MaxFilenameLength> sysDir;
+	platform.GetSysDir(sysDir.GetRef());
+	return (uint32_t)platform.GetLastModifiedTime(sysDir.c_str(), filename);
+}
+
 // Save the height map to the file specified by P parameter
 GCodeResult GCodes::SaveHeightMap(GCodeBuffer& gb, const StringRef& reply) const
 {
@@ -3689,10 +4545,10 @@ void GCodes::GetCurrentCoordinates(const StringRef& s) const
 // If successful return true, else write an error message to reply and return false
 bool GCodes::QueueFileToPrint(const char* fileName, const StringRef& reply)
 {
-	FileStore * const f = platform.OpenFile(platform.GetGCodeDir(), fileName, OpenMode::read);
+	FileStore * const f = platform.OpenFile(platform.GetGCodeDir(), fileName, OpenMode::read, 0, FileUser::job);
 	if (f != nullptr)
 	{
-
+		(void)f->EnableFastSeek();						// so that resuming a print or seeking with M26 doesn't have to follow the cluster chain
 		fileToPrint.Set(f);
 		fileOffsetToPrint = 0;
 		restartMoveFractionDone = 0.0;
@@ -3703,6 +4559,57 @@ bool GCodes::QueueFileToPrint(const char* fileName, const StringRef& reply)
 	return false;
 }
 
+// Start printing the next file in the job queue. If the queue has already opened the file then we use that.
+bool GCodes::StartNextQueuedJob(const StringRef& reply)
+{
+	String<MaxFilenameLength> fileName;
+	FileStore * const f = jobQueue.TakeNext(fileName.GetRef());
+	if (fileName.IsEmpty())
+	{
+		return false;
+	}
+
+	if (f != nullptr)
+	{
+		fileToPrint.Set(f);
+		fileOffsetToPrint = 0;
+		restartMoveFractionDone = 0.0;
+	}
+	else if (!QueueFileToPrint(fileName.c_str(), reply))
+	{
+		return false;
+	}
+
+	reprap.GetPrintMonitor().StartingPrint(fileName.c_str());
+	StartPrinting(true);
+	return true;
+}
+
+// If the next job in the queue is ready and preheating is enabled, set the bed and tool temperatures that it starts with
+void GCodes::PreheatNextQueuedJob()
+{
+	float bedTemperature, toolTemperature;
+	int toolNumber;
+	if (jobQueue.GetPreheatTemperatures(bedTemperature, toolTemperature, toolNumber))
+	{
+		Heat& heat = reprap.GetHeat();
+		const int8_t bedHeater = heat.GetBedHeater(0);
+		if (bedTemperature > 0.0 && bedHeater >= 0)
+		{
+			heat.SetActiveTemperature(bedHeater, bedTemperature);
+			heat.Activate(bedHeater);
+		}
+		if (toolTemperature > 0.0)
+		{
+			Tool * const tool = (toolNumber >= 0) ? reprap.GetTool(toolNumber) : reprap.GetCurrentOrDefaultTool();
+			if (tool != nullptr)
+			{
+				SetToolHeaters(tool, toolTemperature, true);
+			}
+		}
+	}
+}
+
 // Start printing the file already selected
 void GCodes::StartPrinting(bool fromStart)
 {
@@ -3728,6 +4635,19 @@ void GCodes::StartPrinting(bool fromStart)
 	lastFilamentError = FilamentSensorStatus::ok;
 	lastPrintingMoveHeight = -1.0;
 	reprap.GetPrintMonitor().StartedPrint();
+	if (simulationMode == 0)
+	{
+		toolPreheater.Start(reprap.GetPrintMonitor().GetPrintingFilename());
+	}
+#if SUPPORT_RESUME_JOURNAL
+	if (simulationMode == 0 && resumeJournalInterval != 0 && resumeJournal.Start())
+	{
+		lastResumeJournalTime = millis();
+# if HAS_BACKUP_RESUME_RECORD
+		lastBackupResumeTime = lastResumeJournalTime;
+# endif
+	}
+#endif
 	platform.MessageF(LogMessage,
 						(simulationMode == 0) ? "Started printing file %s\n" : "Started simulating printing file %s\n",
 							reprap.GetPrintMonitor().GetPrintingFilename());
@@ -3804,6 +4724,47 @@ GCodeResult GCodes::DoDwellTime(GCodeBuffer& gb, uint32_t dwellMillis)
 	return GCodeResult::notFinished;
 }
 
+// Set the speed of a spindle. If it takes time to get up to speed, wait for the previous moves to finish first and then until it is at speed,
+// so that the following moves start as soon as the spindle is ready. Return false if we need to be called again.
+bool GCodes::SetSpindleRpmAndWait(GCodeBuffer& gb, const StringRef& reply, Spindle& spindle, float rpm)
+{
+	if (!spindle.WaitsForSpeed())
+	{
+		spindle.SetRpm(rpm);
+		return true;
+	}
+
+	if (!LockMovementAndWaitForStandstill(gb))
+	{
+		return false;
+	}
+
+	spindle.SetRpm(rpm);					// calling this again with the same RPM doesn't restart the ramp
+	if (!cancelWait && !spindle.IsAtSpeed())
+	{
+		CheckReportDue(gb, reply);			// check whether we need to send a temperature or status report
+		isWaiting = true;
+		return false;
+	}
+
+	cancelWait = isWaiting = false;
+	return true;
+}
+
+// Called from the step ISR when the Z probe is triggered, causing the move to be aborted
+void GCodes::MoveStoppedByZProbe(float speed)
+{
+	zProbeTriggerClocks = StepTimer::GetInterruptClocks();
+	zProbeTriggerSpeed = speed;
+	zProbeTriggered = true;
+}
+
+// Return how much higher the nozzle was when the Z probe reading reached the trigger value than when the step ISR saw it and stopped the move
+float GCodes::GetZProbeTriggerCorrection() const
+{
+	return zProbeTriggerSpeed * platform.GetZProbeTriggerLatency(zProbeTriggerClocks);
+}
+
 // Set offset, working and standby temperatures for a tool. I.e. handle a G10.
 GCodeResult GCodes::SetOrReportOffsets(GCodeBuffer &gb, const StringRef& reply)
 {
@@ -3913,6 +4874,12 @@ GCodeResult GCodes::ManageTool(GCodeBuffer& gb, const StringRef& reply)
 			int adjust = gb.GetIValue();
 			gb.SetToolNumberAdjust(adjust);
 		}
+
+		// M563 W sets how many seconds early we aim to have the next tool in the file at its active temperatures, or disables preheating if zero
+		if (gb.Seen('W'))
+		{
+			toolPreheater.SetMargin(max<float>(gb.GetFValue(), 0.0));
+		}
 		return GCodeResult::ok;
 	}
 
@@ -4104,6 +5071,33 @@ void GCodes::SaveFanSpeeds()
 	pausedDefaultFanSpeed = lastDefaultFanSpeed;
 }
 
+// Get the acknowledgement for a command in Marlin emulation. If the channel reports its buffer space then append the number of bytes the host may send ahead,
+// so that it can keep several commands in flight instead of waiting for the acknowledgement of each one before sending the next.
+void GCodes::GetAcknowledgement(const GCodeBuffer& gb, const StringRef& ack) const
+{
+	if (gb.GetCommandLetter() == 'M' && gb.GetCommandNumber() == 998)
+	{
+		ack.copy("rs ");
+	}
+	else
+	{
+		ack.copy("ok");
+		if (gb.ReportsBufferSpace())
+		{
+			if (&gb == serialGCode)
+			{
+				ack.catf(" B%u", serialInput->BufferSpaceLeft());
+			}
+#if HAS_NETWORKING
+			else if (&gb == telnetGCode)
+			{
+				ack.catf(" B%u", telnetInput->BufferSpaceLeft());
+			}
+#endif
+		}
+	}
+}
+
 // Handle sending a reply back to the appropriate interface(s).
 // Note that 'reply' may be empty. If it isn't, then we need to append newline when sending it.
 void GCodes::HandleReply(GCodeBuffer& gb, GCodeResult rslt, const char* reply)
@@ -4117,7 +5111,9 @@ void GCodes::HandleReply(GCodeBuffer& gb, GCodeResult rslt, const char* reply)
 
 	const Compatibility c = (&gb == serialGCode || &gb == telnetGCode) ? platform.Emulating() : Compatibility::me;
 	const MessageType type = gb.GetResponseMessageType();
-	const char* const response = (gb.GetCommandLetter() == 'M' && gb.GetCommandNumber() == 998) ? "rs " : "ok";
+	String<ShortScratchStringLength> ackString;
+	GetAcknowledgement(gb, ackString.GetRef());
+	const char* const response = ackString.c_str();
 	const char* emulationType = nullptr;
 
 	switch (c)
@@ -4195,7 +5191,9 @@ void GCodes::HandleReply(GCodeBuffer& gb, OutputBuffer *reply)
 
 	const Compatibility c = (&gb == serialGCode || &gb == telnetGCode) ? platform.Emulating() : Compatibility::me;
 	const MessageType type = gb.GetResponseMessageType();
-	const char* const response = (gb.GetCommandLetter() == 'M' && gb.GetCommandNumber() == 998) ? "rs " : "ok";
+	String<ShortScratchStringLength> ackString;
+	GetAcknowledgement(gb, ackString.GetRef());
+	const char* const response = ackString.c_str();
 	const char* emulationType = nullptr;
 
 	switch (c)
@@ -4519,7 +5517,7 @@ GCodeResult GCodes::RetractFilament(GCodeBuffer& gb, bool retract)
 			return GCodeResult::notFinished;
 		}
 
-		// New code does the retraction and the Z hop as separate moves
+		// New code does the retraction and the Z hop as separate moves, unless M207 C1 has asked for them to be combined
 		// Get ready to generate a move
 		moveBuffer.tool = reprap.GetCurrentTool();
 		reprap.GetMove().GetCurrentUserPosition(moveBuffer.coords, 0, moveBuffer.tool);
@@ -4527,7 +5525,23 @@ GCodeResult GCodes::RetractFilament(GCodeBuffer& gb, bool retract)
 		moveBuffer.isFirmwareRetraction = true;
 		moveBuffer.filePos = (&gb == fileGCode) ? gb.GetFilePosition(fileInput->BytesCached()) : noFilePosition;
 
-		if (retract)
+		const Tool * const fusedTool = (fuseRetractHop && retractHop > 0.0) ? reprap.GetCurrentTool() : nullptr;
+		if (fusedTool != nullptr)
+		{
+			// Do the retraction and the Z hop, or the reverse Z hop and the un-retraction, as one move so that there is no stop between them
+			const float extrusion = (retract) ? -retractLength : retractLength + retractExtra;
+			for (size_t i = 0; i < fusedTool->DriveCount(); ++i)
+			{
+				moveBuffer.coords[numTotalAxes + fusedTool->Drive(i)] = extrusion;
+			}
+			const float hop = (retract) ? retractHop : currentZHop;
+			moveBuffer.coords[Z_AXIS] += (retract) ? hop : -hop;
+			moveBuffer.feedRate = FusedRetractionFeedRate(fabsf(extrusion), (retract) ? retractSpeed : unRetractSpeed, hop);
+			currentZHop = (retract) ? retractHop : 0.0;
+			moveBuffer.canPauseAfter = !retract;			// don't pause after a retraction because that could cause too much retraction
+			NewMoveAvailable(1);
+		}
+		else if (retract)
 		{
 			// Set up the retract move
 			const Tool * const tool = reprap.GetCurrentTool();
@@ -4576,6 +5590,19 @@ GCodeResult GCodes::RetractFilament(GCodeBuffer& gb, bool retract)
 	return GCodeResult::ok;
 }
 
+// Return the feed rate for a combined retraction and Z hop move. The feed rate of a move that includes Z movement applies to the Z axis,
+// so choose it to make the move last as long as the slower of the retraction at the requested speed and the Z hop at the maximum Z speed.
+float GCodes::FusedRetractionFeedRate(float extrusion, float extrusionSpeed, float hop) const
+{
+	if (hop <= 0.0)
+	{
+		return extrusionSpeed;							// no Z movement, so the feed rate applies to the extruders
+	}
+	const float zSpeed = platform.MaxFeedrate(Z_AXIS);
+	const float duration = max<float>(extrusion/extrusionSpeed, hop/zSpeed);
+	return hop/duration;
+}
+
 // Load the specified filament into a tool
 GCodeResult GCodes::LoadFilament(GCodeBuffer& gb, const StringRef& reply)
 {
@@ -4695,7 +5722,10 @@ bool GCodes::IsCodeQueueIdle() const
 // This is called from Pid.cpp when there is a heater fault, and from elsewhere in this module.
 void GCodes::StopPrint(StopPrintReason reason)
 {
-	segmentsLeft = 0;
+	{
+		MutexLocker moveLock(Move::GetMoveMutex());		// the Move task may be part way through taking a segment of the waiting move
+		segmentsLeft = 0;
+	}
 	isPaused = pausePending = filamentChangePausePending = false;
 
 	FileData& fileBeingPrinted = fileGCode->OriginalMachineState().fileState;
@@ -4707,6 +5737,7 @@ void GCodes::StopPrint(StopPrintReason reason)
 	{
 		fileBeingPrinted.Close();
 	}
+	toolPreheater.Stop();
 
 	reprap.GetMove().ResetMoveCounters();
 	codeQueue->Clear();
@@ -4735,6 +5766,9 @@ void GCodes::StopPrint(StopPrintReason reason)
 			platform.GetMassStorage()->RecordSimulationTime(printingFilename, lrintf(simSeconds));
 		}
 
+#if SUPPORT_PLAN_TRACE
+		PlanTrace::Stop();
+#endif
 		exitSimulationWhenFileComplete = false;
 		simulationMode = 0;							// do this after we append the simulation info to the file so that DWC doesn't try to reload the file info too soon
 		reprap.GetMove().Simulate(simulationMode);
@@ -4745,6 +5779,10 @@ void GCodes::StopPrint(StopPrintReason reason)
 		{
 			platform.MessageF(LoggedGenericMessage, "File %s will print in %" PRIu32 "h %" PRIu32 "m plus heating time\n",
 									printingFilename, simMinutes/60u, simMinutes % 60u);
+			const uint32_t numPlannedMoves = reprap.GetMove().GetNumPlannedMoves();
+			const float planningTime = reprap.GetMove().GetPlanningTime();
+			platform.MessageF(GenericMessage, "Planning %" PRIu32 " moves took %.2f sec of CPU time, %.1fus per move\n",
+									numPlannedMoves, (double)planningTime, (numPlannedMoves == 0) ? 0.0 : (double)(planningTime * 1000000.0/(float)numPlannedMoves));
 		}
 		else
 		{
@@ -4788,6 +5826,9 @@ void GCodes::StopPrint(StopPrintReason reason)
 		{
 			platform.DeleteSysFile(RESUME_AFTER_POWER_FAIL_G);
 		}
+#if SUPPORT_RESUME_JOURNAL
+		resumeJournal.Stop(reason != StopPrintReason::normalCompletion);	// like resurrect.g, keep the journal if the print was cancelled
+#endif
 	}
 
 	updateFileWhenSimulationComplete = false;
@@ -5247,7 +6288,7 @@ void GCodes::GenerateTemperatureReport(const StringRef& reply) const
 
 // Check whether we need to report temperatures or status.
 // 'reply' is a convenient buffer that is free for us to use.
-void GCodes::CheckReportDue(GCodeBuffer& gb, const StringRef& reply) const
+void GCodes::CheckReportDue(GCodeBuffer& gb, const StringRef& reply)
 {
 	const uint32_t now = millis();
 	if (gb.timerRunning)
@@ -5264,7 +6305,7 @@ void GCodes::CheckReportDue(GCodeBuffer& gb, const StringRef& reply) const
 			if (lastAuxStatusReportType >= 0)
 			{
 				// Send a standard status response for PanelDue
-				OutputBuffer * const statusBuf = GenerateJsonStatusResponse(lastAuxStatusReportType, -1, ResponseSource::AUX);
+				OutputBuffer * const statusBuf = GenerateAuxStatusResponse(lastAuxStatusReportType, -1);
 				if (statusBuf != nullptr)
 				{
 					platform.AppendAuxReply(statusBuf, true);
@@ -5316,6 +6357,13 @@ OutputBuffer *GCodes::GenerateJsonStatusResponse(int type, int seq, ResponseSour
 	return statusResponse;
 }
 
+// Generate a M408 response for PanelDue. If bit 2 of the comms properties of the aux channel is set, the panel only wants the values that have changed.
+OutputBuffer *GCodes::GenerateAuxStatusResponse(int type, int seq)
+{
+	OutputBuffer * const statusResponse = GenerateJsonStatusResponse(type, seq, ResponseSource::AUX);
+	return (statusResponse != nullptr && (platform.GetCommsProperties(1) & 4) != 0) ? auxStatusFilter.Apply(statusResponse, type) : statusResponse;
+}
+
 // Set up some default values in the move buffer for special moves, e.g. for Z probing and firmware retraction
 void GCodes::SetMoveBufferDefaults()
 {
@@ -5534,7 +6582,43 @@ void GCodes::SetExtrusionFactor(size_t extruder, float factor)
 	if (extruder < numExtruders)
 	{
 		extrusionFactors[extruder] = constrain<float>(factor, 0.0, 200.0)/100.0;
+		++extrusionFactorsVersion;
+	}
+}
+
+// Return the mix ratios of the tool combined with the extrusion factors of its drives, recalculating them only if something has changed since the last call.
+// The mix can then be changed on every layer or even every move without the cost of a move growing with the number of drives that aren't in use.
+const GCodes::ExtruderMix& GCodes::GetExtruderMix(const Tool *tool, bool volumetric)
+{
+	if (   extruderMix.tool != tool
+		|| extruderMix.toolMixVersion != tool->GetMixVersion()
+		|| extruderMix.factorsVersion != extrusionFactorsVersion
+		|| extruderMix.volumetric != volumetric
+	   )
+	{
+		extruderMix.tool = tool;
+		extruderMix.toolMixVersion = tool->GetMixVersion();
+		extruderMix.factorsVersion = extrusionFactorsVersion;
+		extruderMix.volumetric = volumetric;
+		extruderMix.numDrives = 0;
+		extruderMix.totalMix = 0.0;
+		const float * const mix = tool->GetMix();
+		for (size_t eDrive = 0; eDrive < tool->DriveCount(); ++eDrive)
+		{
+			const float thisMix = mix[eDrive];
+			if (thisMix != 0.0)
+			{
+				extruderMix.totalMix += thisMix;
+				const size_t drive = tool->Drive(eDrive);
+				const float rawFactor = (volumetric) ? thisMix * volumetricExtrusionFactors[drive] : thisMix;
+				extruderMix.drives[extruderMix.numDrives] = drive;
+				extruderMix.rawFactors[extruderMix.numDrives] = rawFactor;
+				extruderMix.factors[extruderMix.numDrives] = rawFactor * extrusionFactors[drive];
+				++extruderMix.numDrives;
+			}
+		}
 	}
+	return extruderMix;
 }
 
 Pwm_t GCodes::ConvertLaserPwm(float reqVal) const
@@ -5553,11 +6637,12 @@ bool GCodes::GetLastPrintingHeight(float& height) const
 	return false;
 }
 
-// Start timing SD card file writing
-GCodeResult GCodes::StartSDTiming(GCodeBuffer& gb, const StringRef& reply)
+// Start timing SD card file writing. If fullBenchmark is true then we go on to time sequential reads, random reads and random writes of the same file.
+// The file must be at least one sector long for the random tests.
+GCodeResult GCodes::StartSDTiming(GCodeBuffer& gb, const StringRef& reply, bool fullBenchmark)
 {
 	const float bytesReq = (gb.Seen('S')) ? gb.GetFValue() : 10.0;
-	timingBytesRequested = (uint32_t)(bytesReq * (float)(1024 * 1024));
+	timingBytesRequested = max<uint32_t>((uint32_t)(bytesReq * (float)(1024 * 1024)), 1024);
 	FileStore * const f = platform.OpenFile(platform.GetGCodeDir(), TimingFileName, OpenMode::write, timingBytesRequested);
 	if (f == nullptr)
 	{
@@ -5566,7 +6651,9 @@ GCodeResult GCodes::StartSDTiming(GCodeBuffer& gb, const StringRef& reply)
 	}
 	sdTimingFile = f;
 
-	platform.Message(gb.GetResponseMessageType(), "Testing SD card write speed...\n");
+	platform.Message(gb.GetResponseMessageType(), (fullBenchmark) ? "Testing SD card speed...\n" : "Testing SD card write speed...\n");
+	timingFullBenchmark = fullBenchmark;
+	(void)FileStore::GetAndClearMaxRetryCount();
 	timingBytesWritten = 0;
 	timingStartMillis = millis();
 	gb.SetState(GCodeState::timingSDwrite);
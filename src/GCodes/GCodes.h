@@ -31,7 +31,12 @@ Licence: GPL
 #include "Tools/Filament.h"
 #include "FilamentMonitors/FilamentMonitor.h"
 #include "RestorePoint.h"
+#include "ResumeJournal.h"
+#include "ToolPreheater.h"
+#include "JobQueue.h"
+#include "AuxStatusFilter.h"
 #include "Movement/BedProbing/Grid.h"
+#include "Movement/BedProbing/GridProbeOrder.h"
 
 const char feedrateLetter = 'F';						// GCode feedrate
 const char extrudeLetter = 'E'; 						// GCode extrude
@@ -43,6 +48,7 @@ const EndstopsBitmap HomeAxes = 1 << 30;				// must be distinct from 1 << (any d
 const EndstopsBitmap LogProbeChanges = 1 << 29;			// must be distinct from 1 << (any drive number)
 const EndstopsBitmap UseSpecialEndstop = 1 << 28;		// must be distinct from 1 << (any drive number)
 const EndstopsBitmap ActiveLowEndstop = 1 << 27;		// must be distinct from 1 << (any drive number)
+const EndstopsBitmap MotorEndstops = 1 << 26;			// must be distinct from 1 << (any drive number)
 
 typedef uint32_t TriggerInputsBitmap;					// Bitmap of input pins that a single trigger number responds to
 typedef uint32_t TriggerNumbersBitmap;					// Bitmap of trigger numbers
@@ -70,6 +76,7 @@ struct Trigger
 constexpr uint8_t TFreeBit = 1 << 0;
 constexpr uint8_t TPreBit = 1 << 1;
 constexpr uint8_t TPostBit = 1 << 2;
+constexpr uint8_t TQueuedBit = 1 << 3;				// don't wait for the moves to finish between the tool change steps, and preheat the new tool while the old one is freed
 constexpr uint8_t DefaultToolChangeParam = TFreeBit | TPreBit | TPostBit;
 
 // Machine type enumeration. The numeric values must be in the same order as the corresponding M451..M453 commands.
@@ -127,8 +134,13 @@ public:
 		EndstopsBitmap endStopsToCheck;									// endstops to check
 #if SUPPORT_LASER || SUPPORT_IOBITS
 		LaserPwmOrIoBits laserPwmOrIoBits;								// the laser PWM or port bit settings required
+#endif
+#if SUPPORT_LASER
+		uint8_t numLaserRasterPixels;									// if greater than 1, this is a raster move and laserRasterPwm holds the laser power along it
+		Pwm_t laserRasterPwm[MaxLaserRasterPixels];						// the laser power values at evenly spaced positions along a raster move
 #endif
 		uint8_t moveType;												// the S parameter from the G0 or G1 command, 0 for a normal move
+		int16_t scanProbePoint;											// if not negative, the grid point at which to record the Z probe reading at the end of this move
 
 		uint8_t isFirmwareRetraction : 1;								// true if this is a firmware retraction/un-retraction move
 		uint8_t usePressureAdvance : 1;									// true if we want to us extruder pressure advance, if there is any extrusion
@@ -146,9 +158,12 @@ public:
 	void Exit();														// Shut it down
 	void Reset();														// Reset some parameter to defaults
 	bool ReadMove(RawMove& m);											// Called by the Move class to get a movement set by the last G Code
+	bool IsMoveAvailable() const { return segmentsLeft != 0; }			// Is there a move or part of a segmented move for the Move class to take?
 	void ClearMove();
 	bool QueueFileToPrint(const char* fileName, const StringRef& reply);	// Open a file of G Codes to run
 	void StartPrinting(bool fromStart);									// Start printing the file already selected
+	bool StartNextQueuedJob(const StringRef& reply);					// Start printing the next file in the job queue, returning false if there isn't one or it can't be opened
+	void PreheatNextQueuedJob();										// Set the starting temperatures of the next file in the job queue, if it is time to
 	void GetCurrentCoordinates(const StringRef& s) const;				// Write where we are into a string
 	bool DoingFileMacro() const;										// Or still busy processing a macro file?
 	float FractionOfFilePrinted() const;								// Get fraction of file printed
@@ -197,7 +212,7 @@ public:
 
 	void StopPrint(StopPrintReason reason);								// Stop the current print
 
-	void MoveStoppedByZProbe() { zProbeTriggered = true; }				// Called from the step ISR when the Z probe is triggered, causing the move to be aborted
+	void MoveStoppedByZProbe(float speed);								// Called from the step ISR when the Z probe is triggered, causing the move to be aborted
 
 	size_t GetTotalAxes() const { return numTotalAxes; }
 	size_t GetVisibleAxes() const { return numVisibleAxes; }
@@ -234,7 +249,7 @@ public:
 	void EmergencyStop();												// Cancel everything
 	bool GetLastPrintingHeight(float& height) const;					// Get the height in user coordinates of the last printing move
 
-	GCodeResult StartSDTiming(GCodeBuffer& gb, const StringRef& reply);	// Start timing SD card file writing
+	GCodeResult StartSDTiming(GCodeBuffer& gb, const StringRef& reply, bool fullBenchmark);	// Start timing SD card file writing, and reading too if fullBenchmark is true
 
 #if SUPPORT_WORKPLACE_COORDINATES
 	unsigned int GetWorkplaceCoordinateSystemNumber() const { return currentCoordinateSystem + 1; }
@@ -265,6 +280,8 @@ private:
 	bool LockFileSystem(const GCodeBuffer& gb);							// Lock the unshareable parts of the file system
 	bool LockMovement(const GCodeBuffer& gb);							// Lock movement
 	bool LockMovementAndWaitForStandstill(const GCodeBuffer& gb);		// Lock movement and wait for pending moves to finish
+	bool LockMovementAndWaitForQueuedMoves(const GCodeBuffer& gb);		// Lock movement and wait for pending moves to be queued
+	bool WaitForToolChangeStep(const GCodeBuffer& gb);					// Wait until we can do the next step of a tool change
 	void GrabResource(const GCodeBuffer& gb, Resource r);				// Grab a resource even if it is already owned
 	void GrabMovement(const GCodeBuffer& gb);							// Grab the movement lock even if it is already owned
 	void UnlockResource(const GCodeBuffer& gb, Resource r);				// Unlock the resource if we own it
@@ -280,12 +297,14 @@ private:
 
 	bool ActOnCode(GCodeBuffer& gb, const StringRef& reply);			// Do a G, M or T Code
 	bool HandleGcode(GCodeBuffer& gb, const StringRef& reply);			// Do a G code
+	bool HandleStraightMove(GCodeBuffer& gb, const StringRef& reply, bool isCoordinated) __attribute__ ((hot));	// Do a G0 or G1 command
 	bool HandleMcode(GCodeBuffer& gb, const StringRef& reply);			// Do an M code
 	bool HandleTcode(GCodeBuffer& gb, const StringRef& reply);			// Do a T code
 	bool HandleResult(GCodeBuffer& gb, GCodeResult rslt, const StringRef& reply, OutputBuffer *outBuf)
 		pre(outBuf == nullptr || rslt == GCodeResult::ok);
 
 	void HandleReply(GCodeBuffer& gb, OutputBuffer *reply);
+	void GetAcknowledgement(const GCodeBuffer& gb, const StringRef& ack) const;	// Get the "ok" or "rs" string to send in Marlin emulation
 
 	const char* DoStraightMove(GCodeBuffer& gb, bool isCoordinated) __attribute__((hot));	// Execute a straight move returning any error message
 	const char* DoArcMove(GCodeBuffer& gb, bool clockwise)						// Execute an arc move returning any error message
@@ -296,9 +315,12 @@ private:
 
 	GCodeResult DoDwell(GCodeBuffer& gb);										// Wait for a bit
 	GCodeResult DoDwellTime(GCodeBuffer& gb, uint32_t dwellMillis);				// Really wait for a bit
+	float GetZProbeTriggerCorrection() const;									// Get the height that the Z probe trigger was late by
+	bool SetSpindleRpmAndWait(GCodeBuffer& gb, const StringRef& reply, Spindle& spindle, float rpm);	// Set the spindle speed and wait until it is reached
 	GCodeResult DoHome(GCodeBuffer& gb, const StringRef& reply);				// Home some axes
 	GCodeResult ExecuteG30(GCodeBuffer& gb, const StringRef& reply);			// Probes at a given position - see the comment at the head of the function itself
 	void InitialiseTaps();														// Set up to do the first of a possibly multi-tap probe
+	void BackOffAfterApproachTap();												// Raise the probe a short distance after the fast approach tap
 	void SetBedEquationWithProbe(int sParam, const StringRef& reply);			// Probes a series of points and sets the bed equation
 	GCodeResult SetPrintZProbe(GCodeBuffer& gb, const StringRef& reply);		// Either return the probe value, or set its threshold
 	GCodeResult SetOrReportOffsets(GCodeBuffer& gb, const StringRef& reply);	// Deal with a G10
@@ -309,6 +331,7 @@ private:
 	GCodeResult SetDateTime(GCodeBuffer& gb,const  StringRef& reply);			// Deal with a M905
 	GCodeResult SavePosition(GCodeBuffer& gb,const  StringRef& reply);			// Deal with G60
 	GCodeResult ConfigureDriver(GCodeBuffer& gb,const  StringRef& reply);		// Deal with M569
+	GCodeResult ConfigureCodeQueue(GCodeBuffer& gb, const StringRef& reply);	// Deal with the code queue parameters of M595
 
 	bool LoadExtrusionAndFeedrateFromGCode(GCodeBuffer& gb, bool isPrintingMove);	// Set up the extrusion of a move
 
@@ -336,7 +359,8 @@ private:
 	void ReportToolTemperatures(const StringRef& reply, const Tool *tool, bool includeNumber) const;
 	void GenerateTemperatureReport(const StringRef& reply) const;				// Store a standard-format temperature report in reply
 	OutputBuffer *GenerateJsonStatusResponse(int type, int seq, ResponseSource source) const;	// Generate a M408 response
-	void CheckReportDue(GCodeBuffer& gb, const StringRef& reply) const;			// Check whether we need to report temperatures or status
+	OutputBuffer *GenerateAuxStatusResponse(int type, int seq);			// Generate a M408 response for PanelDue, leaving out unchanged values if it asked for that
+	void CheckReportDue(GCodeBuffer& gb, const StringRef& reply);			// Check whether we need to report temperatures or status
 
 	void SavePosition(RestorePoint& rp, const GCodeBuffer& gb) const;			// Save position to a restore point
 	void RestorePosition(const RestorePoint& rp, GCodeBuffer *gb);				// Restore user position from a restore point
@@ -349,7 +373,24 @@ private:
 	float GetCurrentToolOffset(size_t axis) const;								// Get an axis offset of the current tool
 
 	const char *TranslateEndStopResult(EndStopHit es);							// Translate end stop result to text
+
+	// The mix ratios of a tool combined with the extrusion factors of its drives, so that we don't need to combine them for every move
+	struct ExtruderMix
+	{
+		const Tool *tool;
+		uint32_t toolMixVersion;
+		uint32_t factorsVersion;
+		bool volumetric;
+		size_t numDrives;						// the number of drives with a nonzero mix ratio
+		float totalMix;
+		uint8_t drives[MaxExtrudersPerTool];
+		float rawFactors[MaxExtrudersPerTool];	// mix ratio times volumetric factor, which gives the extrusion that the slicer asked for
+		float factors[MaxExtrudersPerTool];		// the same times the extrusion factor, which gives the amount to extrude
+	};
+
 	GCodeResult RetractFilament(GCodeBuffer& gb, bool retract);					// Retract or un-retract filaments
+	const ExtruderMix& GetExtruderMix(const Tool *tool, bool volumetric);			// Get the combined mix and extrusion factors for a tool
+	float FusedRetractionFeedRate(float extrusion, float extrusionSpeed, float hop) const;	// Return the feed rate for a retraction move that includes the Z hop
 	GCodeResult LoadFilament(GCodeBuffer& gb, const StringRef& reply);			// Load the specified filament into a tool
 	GCodeResult UnloadFilament(GCodeBuffer& gb, const StringRef& reply);		// Unload the current filament from a tool
 	bool ChangeMicrostepping(size_t drive, unsigned int microsteps, bool interp) const; // Change microstepping on the specified drive
@@ -373,14 +414,19 @@ private:
 	GCodeResult DefineGrid(GCodeBuffer& gb, const StringRef &reply);			// Define the probing grid, returning true if error
 	GCodeResult LoadHeightMap(GCodeBuffer& gb, const StringRef& reply);			// Load the height map from file
 	bool TrySaveHeightMap(const char *filename, const StringRef& reply) const;	// Save the height map to the specified file
+	void TrySaveBinaryHeightMap(const char *csvFilename, uint32_t csvLength) const;	// Save a binary copy of the height map alongside the CSV file
+	uint32_t GetSysFileTime(const char *filename) const;						// Get the modification time of a file in the system folder
 	GCodeResult SaveHeightMap(GCodeBuffer& gb, const StringRef& reply) const;	// Save the height map to the file specified by P parameter
 	void ClearBedMapping();														// Stop using bed compensation
-	GCodeResult ProbeGrid(GCodeBuffer& gb, const StringRef& reply);				// Start probing the grid, returning true if we didn't because of an error
+	GCodeResult ProbeGrid(GCodeBuffer& gb, const StringRef& reply, bool whileMoving);	// Start probing the grid, returning true if we didn't because of an error
+	bool AdvanceGridProbePoint();												// Move on to the next grid point, returning false if there are no more
+	void StoreScanReadings();													// Convert the Z probe readings taken while moving to heights and store them in the height map
 	GCodeResult CheckOrConfigureTrigger(GCodeBuffer& gb, const StringRef& reply, int code);	// Handle M581 and M582
 	GCodeResult UpdateFirmware(GCodeBuffer& gb, const StringRef &reply);		// Handle M997
 	GCodeResult SendI2c(GCodeBuffer& gb, const StringRef &reply);				// Handle M260
 	GCodeResult ReceiveI2c(GCodeBuffer& gb, const StringRef &reply);			// Handle M261
 	GCodeResult SimulateFile(GCodeBuffer& gb, const StringRef &reply, const StringRef& file, bool updateFile);	// Handle M37 to simulate a whole file
+	GCodeResult ManageJobQueue(GCodeBuffer& gb, const StringRef &reply);		// Handle M33
 	GCodeResult ChangeSimulationMode(GCodeBuffer& gb, const StringRef &reply, uint32_t newSimulationMode);		// Handle M37 to change the simulation mode
 
 	GCodeResult WriteConfigOverrideFile(GCodeBuffer& gb, const StringRef& reply) const; // Write the config-override file
@@ -397,6 +443,14 @@ private:
 	bool IsCodeQueueIdle() const;										// Return true if the code queue is idle
 
 	void SaveResumeInfo(bool wasPowerFailure);
+	bool WriteResumePositionAndStart(FileStore *f, const RestorePoint& rp, const char *printingFilename, bool usingInches) const;
+																			// Write the commands that restore the head position and resume the print
+#if SUPPORT_RESUME_JOURNAL
+	void UpdateResumeJournal();												// Record the resume point in the journal if it is time to
+	void AppendResumeJournalRecord(const RestorePoint& rp, uint32_t flags);	// Record a resume point and the rest of the state needed to resume
+	bool RebuildResumeFile(const ResumeJournalRecord& record);				// Write resurrect.g from a journal record
+	uint32_t GetResumeStateFlags() const;									// Get the resume journal flags that describe how the file is being printed
+#endif
 
 	const char* GetMachineModeString() const;							// Get the name of the current machine mode
 
@@ -452,6 +506,25 @@ private:
 	GCodeBuffer*& autoPauseGCode = gcodeSources[8];						// ***THIS ONE MUST BE LAST*** GCode state machine used to run macros on power fail, heater faults and filament out
 
 	size_t nextGcodeSource;												// The one to check next
+	bool fileGCodeHadTurn;												// True if the last source we serviced was the file being printed
+	unsigned int fileGCodeTurnsInRow;									// How many turns in a row the file being simulated has had
+
+	ToolPreheater toolPreheater;										// Looks ahead in the file being printed for the next tool change
+	JobQueue jobQueue;													// Files to print when the current one has finished
+
+#if SUPPORT_OBJECT_MODEL
+	ObjectModelSubscription omSubscriptions[MaxObjectModelSubscriptions];	// Named object model reports registered by M408 S1 N"name" F"filter"
+#endif
+
+#if SUPPORT_RESUME_JOURNAL
+	ResumeJournal resumeJournal;										// Where we record the resume point periodically while printing
+	uint32_t resumeJournalInterval;										// Milliseconds between journal records, or zero if journaling is disabled
+	uint32_t lastResumeJournalTime;
+# if HAS_BACKUP_RESUME_RECORD
+	uint32_t lastBackupResumeTime;
+	static constexpr uint32_t BackupResumeRecordInterval = 200;		// Milliseconds between updates of the resume point in the backup registers
+# endif
+#endif
 
 	const GCodeBuffer* resourceOwners[NumResources];					// Which gcode buffer owns each resource
 
@@ -478,7 +551,7 @@ private:
 	// The following contain the details of moves that the Move module fetches
 	// CAUTION: segmentsLeft should ONLY be changed from 0 to not 0 by calling NewMoveAvailable()!
 	RawMove moveBuffer;							// Move details to pass to Move class
-	unsigned int segmentsLeft;					// The number of segments left to do in the current move, or 0 if no move available
+	volatile unsigned int segmentsLeft;			// The number of segments left to do in the current move, or 0 if no move available. Once nonzero, only change it holding the Move mutex.
 	unsigned int totalSegments;					// The total number of segments left in the complete move
 
 	unsigned int segmentsLeftToStartAt;
@@ -493,6 +566,8 @@ private:
 	float arcRadius;
 	float arcCurrentAngle;
 	float arcAngleIncrement;
+	float arcCurrentSin, arcCurrentCos;			// the sine and cosine of arcCurrentAngle, which we update incrementally
+	float arcIncrementSin, arcIncrementCos;		// the sine and cosine of arcAngleIncrement
 	bool doingArcMove;
 
 	enum class SegmentedMoveState : uint8_t
@@ -543,12 +618,18 @@ private:
 	float speedFactor;							// speed factor as a percentage (normally 100.0)
 	float extrusionFactors[MaxExtruders];		// extrusion factors (normally 1.0)
 	float volumetricExtrusionFactors[MaxExtruders]; // Volumetric extrusion factors
-	float currentBabyStepOffsets[MaxAxes];		// The accumulated axis offsets due to baby stepping requests
+	uint32_t extrusionFactorsVersion;			// incremented whenever an extrusion factor or a volumetric extrusion factor changes
+
+	ExtruderMix extruderMix;					// the mix of the tool we last extruded with, combined with the extrusion factors
+	float currentBabyStepOffsets[MaxAxes];		// The accumulated axis offsets due to baby stepping requests that have been applied to moves
+	float pendingZBabyStepping;					// Z baby stepping that has been requested but not yet superimposed on moves
 
 	// Z probe
 	GridDefinition defaultGrid;					// The grid defined by the M557 command in config.g
 	int32_t g30ProbePointIndex;					// the index of the point we are probing (G30 P parameter), or -1 if none
 	int g30SValue;								// S parameter in the G30 command, or -2 if there wasn't one
+	uint32_t g30PointsToReprobe;				// bitmap of the probe points that we still have to probe again for the next leadscrew adjustment pass
+	unsigned int g30CalibrationPassesDone;		// how many leadscrew adjustment passes we have done in this G32
 	float g30HValue;							// H parameter in the G30 command, or 0.0 if there wasn't on
 	float g30zStoppedHeight;					// the height to report after running G30 S-1
 	float g30zHeightError;						// the height error last time we probed
@@ -557,12 +638,19 @@ private:
 	float g30zHeightErrorLowestDiff;			// the lowest difference we have seen between consecutive readings
 	uint32_t lastProbedTime;					// time in milliseconds that the probe was last triggered
 	volatile bool zProbeTriggered;				// Set by the step ISR when a move is aborted because the Z probe is triggered
+	uint32_t zProbeTriggerClocks;				// Step clock time at which the step ISR saw the Z probe trigger
+	float zProbeTriggerSpeed;					// The speed of the probing move when it was aborted
 	size_t gridXindex, gridYindex;				// Which grid probe point is next
+	size_t gridProbeStep;						// How far through gridProbeOrder we are when stopping to probe each grid point
+	GridProbeOrder gridProbeOrder;				// The order in which we stop to probe the grid points
+	float gridScanHeight;						// the nozzle height when probing the grid while moving
+	unsigned int gridScanPointsOutOfRange;		// how many grid points were too far from the probe when probing while moving
 	bool doingManualBedProbe;					// true if we are waiting for the user to jog the nozzle until it touches the bed
 	bool probeIsDeployed;						// true if M401 has been used to deploy the probe and M402 has not yet been used t0 retract it
 	bool hadProbingError;						// true if there was an error probing the last point
 	bool zDatumSetByProbing;					// true if the Z position was last set by probing, not by an endstop switch or by G92
 	uint8_t tapsDone;							// how many times we tapped the current point
+	bool approachTapPending;					// true if the next tap is the fast approach tap of two-speed probing, which isn't counted
 
 	float simulationTime;						// Accumulated simulation time
 	uint8_t simulationMode;						// 0 = not simulating, 1 = simulating, >1 are simulation modes for debugging
@@ -575,6 +663,7 @@ private:
 	float unRetractSpeed;						// un=retract speed in mm/min
 	float retractHop;							// Z hop when retracting
 	bool isRetracted;							// true if filament has been firmware-retracted
+	bool fuseRetractHop;						// true to do the retraction and the Z hop together as a single move
 
 	// Triggers
 	Trigger triggers[MaxTriggers];				// Trigger conditions
@@ -616,10 +705,15 @@ private:
 	static constexpr const char *TimingFileName = "test.tst";	// the name of the file we write
 	FileStore *sdTimingFile;					// file handle being used for SD card write timing
 	uint32_t timingBytesRequested;				// how many bytes we were asked to write
-	uint32_t timingBytesWritten;				// how many timing bytes we have written so far
+	uint32_t timingBytesWritten;				// how many timing bytes we have written or read so far
 	uint32_t timingStartMillis;
+	static constexpr unsigned int SdTimingRandomOps = 500;		// how many random reads and writes we time in the full benchmark
+	unsigned int timingOpsDone;					// how many random reads or writes we have done so far
+	float timingWriteSpeed, timingReadSpeed, timingRandomReadRate;	// results of the earlier stages of the full benchmark
+	bool timingFullBenchmark;
 
 	int8_t lastAuxStatusReportType;				// The type of the last status report requested by PanelDue
+	AuxStatusFilter auxStatusFilter;			// Removes unchanged values from status reports to PanelDue when M575 P1 S4 is set
 	bool isWaiting;								// True if waiting to reach temperature
 	bool cancelWait;							// Set true to cancel waiting
 	bool displayNoToolWarning;					// True if we need to display a 'no tool selected' warning
@@ -638,6 +732,7 @@ private:
 	static constexpr const char* DEPLOYPROBE_G = "deployprobe.g";
 	static constexpr const char* RETRACTPROBE_G = "retractprobe.g";
 	static constexpr const char* DefaultHeightMapFile = "heightmap.csv";
+	static constexpr const char* BinaryHeightMapSuffix = ".bin";				// appended to the height map filename to give the name of its binary copy
 	static constexpr const char* LOAD_FILAMENT_G = "load.g";
 	static constexpr const char* CONFIG_FILAMENT_G = "config.g";
 	static constexpr const char* UNLOAD_FILAMENT_G = "unload.g";
@@ -670,10 +765,10 @@ inline void GCodes::NewMoveAvailable()
 	segmentsLeft = sl;			// set the number of segments to indicate that a move is available to be taken
 }
 
-// Get the total baby stepping offset for an axis
+// Get the total baby stepping offset for an axis, including any that we haven't applied yet
 inline float GCodes::GetTotalBabyStepOffset(size_t axis) const
 {
-	return currentBabyStepOffsets[axis];
+	return (axis == Z_AXIS) ? currentBabyStepOffsets[axis] + pendingZBabyStepping : currentBabyStepOffsets[axis];
 }
 
 //*****************************************************************************************************
@@ -9,6 +9,7 @@
 
 #include "GCodes.h"
 
+#include "ConfigCache.h"
 #include "GCodeBuffer.h"
 #include "GCodeQueue.h"
 #include "Heating/Heat.h"
@@ -39,12 +40,22 @@
 # include "Fans/DotStarLed.h"
 #endif
 
+#if SUPPORT_PLAN_TRACE
+# include "Movement/PlanTrace.h"
+#endif
+
 #include <utility>			// for std::swap
 
 // If the code to act on is completed, this returns true, otherwise false.
 // It is called repeatedly for a given code until it returns true for that code.
 bool GCodes::ActOnCode(GCodeBuffer& gb, const StringRef& reply)
 {
+	// G0 and G1 make up nearly all of a sliced file and are never queued, so deal with them first
+	if (gb.GetCommandLetter() == 'G' && (gb.GetCommandNumber() == 0 || gb.GetCommandNumber() == 1))
+	{
+		return HandleStraightMove(gb, reply, gb.GetCommandNumber() == 1);
+	}
+
 	// Can we queue this code?
 	if (gb.CanQueueCodes() && codeQueue->ShouldQueueCode(gb))
 	{
@@ -92,6 +103,27 @@ bool GCodes::ActOnCode(GCodeBuffer& gb, const StringRef& reply)
 	return true;
 }
 
+// Do a G0 or G1 command. These are always simulated.
+bool GCodes::HandleStraightMove(GCodeBuffer& gb, const StringRef& reply, bool isCoordinated)
+{
+	if (segmentsLeft != 0)			// do this check first to avoid locking movement unnecessarily
+	{
+		return false;
+	}
+	if (!LockMovement(gb))
+	{
+		return false;
+	}
+
+	const char* err = DoStraightMove(gb, isCoordinated);
+	if (err != nullptr)
+	{
+		AbortPrint(gb);
+		gb.SetState(GCodeState::waitingForSpecialMoveToComplete, err);	// force the user position to be restored
+	}
+	return HandleResult(gb, GCodeResult::ok, reply, nullptr);
+}
+
 bool GCodes::HandleGcode(GCodeBuffer& gb, const StringRef& reply)
 {
 	GCodeResult result = GCodeResult::ok;
@@ -105,23 +137,7 @@ bool GCodes::HandleGcode(GCodeBuffer& gb, const StringRef& reply)
 	{
 	case 0: // Rapid move
 	case 1: // Ordinary move
-		if (segmentsLeft != 0)			// do this check first to avoid locking movement unnecessarily
-		{
-			return false;
-		}
-		if (!LockMovement(gb))
-		{
-			return false;
-		}
-		{
-			const char* err = DoStraightMove(gb, code == 1);
-			if (err != nullptr)
-			{
-				AbortPrint(gb);
-				gb.SetState(GCodeState::waitingForSpecialMoveToComplete, err);	// force the user position to be restored
-			}
-		}
-		break;
+		return HandleStraightMove(gb, reply, code == 1);
 
 	case 2: // Clockwise arc
 	case 3: // Anti clockwise arc
@@ -232,7 +248,7 @@ bool GCodes::HandleGcode(GCodeBuffer& gb, const StringRef& reply)
 			switch(sparam)
 			{
 			case 0:		// probe and save height map
-				result = ProbeGrid(gb, reply);
+				result = ProbeGrid(gb, reply, false);
 				break;
 
 			case 1:		// load height map file
@@ -247,6 +263,10 @@ bool GCodes::HandleGcode(GCodeBuffer& gb, const StringRef& reply)
 				result = SaveHeightMap(gb, reply);
 				break;
 
+			case 4:		// probe while moving using an analog Z probe, and save height map
+				result = ProbeGrid(gb, reply, true);
+				break;
+
 			default:
 				result = GCodeResult::badOrMissingParameter;
 				break;
@@ -423,9 +443,9 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 						reply.copy("Invalid spindle index");
 						result = GCodeResult::error;
 					}
-					else
+					else if (!SetSpindleRpmAndWait(gb, reply, platform.AccessSpindle(slot), rpm))
 					{
-						platform.AccessSpindle(slot).SetRpm(rpm);
+						return false;
 					}
 				}
 				break;
@@ -464,9 +484,9 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 					reply.copy("Invalid spindle index");
 					result = GCodeResult::error;
 				}
-				else
+				else if (!SetSpindleRpmAndWait(gb, reply, platform.AccessSpindle(slot), -rpm))
 				{
-					platform.AccessSpindle(slot).SetRpm(-rpm);
+					return false;
 				}
 			}
 			else
@@ -863,7 +883,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		// This is used between executing M23 to set up the file to print, and M25 to print it
 		if (gb.Seen('S'))
 		{
-			fileOffsetToPrint = (FilePosition)gb.GetUIValue();
+			fileOffsetToPrint = gb.GetFilePositionValue();
 			restartMoveFractionDone = (gb.Seen('P')) ? constrain<float>(gb.GetFValue(), 0.0, 1.0) : 0.0;
 			restartInitialUserX = (gb.Seen('X')) ? gb.GetFValue() : 0.0;
 			restartInitialUserY = (gb.Seen('Y')) ? gb.GetFValue() : 0.0;
@@ -875,7 +895,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		{
 			// Pronterface keeps sending M27 commands if "Monitor status" is checked, and it specifically expects the following response syntax
 			FileData& fileBeingPrinted = fileGCode->OriginalMachineState().fileState;
-			reply.printf("SD printing byte %lu/%lu", fileBeingPrinted.GetPosition() - fileInput->BytesCached(), fileBeingPrinted.Length());
+			reply.printf("SD printing byte %" PRIuFilePos "/%" PRIuFilePos, fileBeingPrinted.GetPosition() - fileInput->BytesCached(), fileBeingPrinted.Length());
 		}
 		else
 		{
@@ -928,6 +948,15 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 
 		// For case 32, see case 23
 
+	case 33:	// Queue files to print after the current one
+		// If nothing is being printed then the new job starts at once, so wait for movement to stop first
+		if (gb.Seen('P') && !fileGCode->OriginalMachineState().fileState.IsLive() && !LockMovementAndWaitForStandstill(gb))
+		{
+			return false;
+		}
+		result = ManageJobQueue(gb, reply);
+		break;
+
 	case 36:	// Return file information
 		if (!LockFileSystem(gb))									// getting file info takes several calls and isn't reentrant
 		{
@@ -954,7 +983,27 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			if (seen)
 			{
 				const bool updateFile = !gb.Seen('F') || gb.GetUIValue() == 1;
+#if SUPPORT_PLAN_TRACE
+				// M37 P"file" T"tracefile" also writes the planned moves to a system file, for comparing the planner output of different builds
+				String<MaxFilenameLength> traceFileName;
+				bool traceSeen = false;
+				gb.TryGetPossiblyQuotedString('T', traceFileName.GetRef(), traceSeen);
+				if (traceSeen)
+				{
+					result = PlanTrace::Start(traceFileName.c_str(), reply);
+					if (result != GCodeResult::ok)
+					{
+						break;
+					}
+				}
+#endif
 				result = SimulateFile(gb, reply, simFileName.GetRef(), updateFile);
+#if SUPPORT_PLAN_TRACE
+				if (result != GCodeResult::ok)
+				{
+					PlanTrace::Stop();
+				}
+#endif
 			}
 			else
 			{
@@ -966,8 +1015,9 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				}
 				else
 				{
-					reply.printf("Simulation mode: %s, move time: %.1f sec, other time: %.1f sec",
-							(simulationMode != 0) ? "on" : "off", (double)reprap.GetMove().GetSimulationTime(), (double)simulationTime);
+					reply.printf("Simulation mode: %s, move time: %.1f sec, other time: %.1f sec, planning time: %.2f sec for %" PRIu32 " moves",
+							(simulationMode != 0) ? "on" : "off", (double)reprap.GetMove().GetSimulationTime(), (double)simulationTime,
+							(double)reprap.GetMove().GetPlanningTime(), reprap.GetMove().GetNumPlannedMoves());
 				}
 			}
 		}
@@ -1653,6 +1703,10 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			}
 			else
 			{
+				if (val == (int)DiagnosticTestType::StepRateBenchmark && !LockMovementAndWaitForStandstill(gb))
+				{
+					return false;
+				}
 				result = platform.DiagnosticTest(gb, reply, val);
 			}
 		}
@@ -1862,6 +1916,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				const float d = diameters[i];
 				volumetricExtrusionFactors[i] = (d <= 0.0) ? 1.0 : 4.0/(fsquare(d) * Pi);
 			}
+			++extrusionFactorsVersion;
 			gb.MachineState().volumetricExtrusion = (diameters[0] > 0.0);
 		}
 		else if (!gb.MachineState().volumetricExtrusion)
@@ -1886,14 +1941,22 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		}
 		break;
 
-	case 201: // Set/print axis accelerations
+	case 201: // Set/print axis accelerations. If there is an S parameter with value 1 then we set or print the decelerations instead.
 		{
+			const bool setDecel = (gb.Seen('S') ? (gb.GetIValue() == 1) : false);
 			bool seen = false;
 			for (size_t axis = 0; axis < numTotalAxes; axis++)
 			{
 				if (gb.Seen(axisLetters[axis]))
 				{
-					platform.SetAcceleration(axis, gb.GetDistance());
+					if (setDecel)
+					{
+						platform.SetDeceleration(axis, gb.GetDistance());
+					}
+					else
+					{
+						platform.SetAcceleration(axis, gb.GetDistance());
+					}
 					seen = true;
 				}
 			}
@@ -1906,22 +1969,29 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				gb.GetFloatArray(eVals, eCount, true);
 				for (size_t e = 0; e < eCount; e++)
 				{
-					platform.SetAcceleration(numTotalAxes + e, gb.ConvertDistance(eVals[e]));
+					if (setDecel)
+					{
+						platform.SetDeceleration(numTotalAxes + e, gb.ConvertDistance(eVals[e]));
+					}
+					else
+					{
+						platform.SetAcceleration(numTotalAxes + e, gb.ConvertDistance(eVals[e]));
+					}
 				}
 			}
 
 			if (!seen)
 			{
-				reply.printf("Accelerations (mm/sec^2): ");
+				reply.printf("%s (mm/sec^2): ", (setDecel) ? "Decelerations" : "Accelerations");
 				for (size_t axis = 0; axis < numTotalAxes; ++axis)
 				{
-					reply.catf("%c: %.1f, ", axisLetters[axis], (double)platform.Acceleration(axis));
+					reply.catf("%c: %.1f, ", axisLetters[axis], (double)((setDecel) ? platform.Deceleration(axis) : platform.Acceleration(axis)));
 				}
 				reply.cat("E:");
 				char sep = ' ';
 				for (size_t extruder = 0; extruder < numExtruders; extruder++)
 				{
-					reply.catf("%c%.1f", sep, (double)platform.Acceleration(extruder + numTotalAxes));
+					reply.catf("%c%.1f", sep, (double)((setDecel) ? platform.Deceleration(extruder + numTotalAxes) : platform.Acceleration(extruder + numTotalAxes)));
 					sep = ':';
 				}
 			}
@@ -1960,6 +2030,19 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				}
 			}
 
+			if (gb.Seen('Q'))
+			{
+				// Maximum volumetric flow in mm^3/sec for each extruder, zero meaning no limit
+				seen = true;
+				float qVals[MaxExtruders];
+				size_t qCount = numExtruders;
+				gb.GetFloatArray(qVals, qCount, true);
+				for (size_t e = 0; e < qCount; e++)
+				{
+					platform.SetMaxExtrusionFlow(e, qVals[e]);
+				}
+			}
+
 			if (!seen)
 			{
 				reply.copy("Max speeds (mm/sec): ");
@@ -1975,6 +2058,21 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 					sep = ':';
 				}
 				reply.catf(", min. speed %.2f", (double)platform.MinMovementSpeed());
+				reply.cat(", max. extrusion flow (mm^3/sec):");
+				sep = ' ';
+				for (size_t extruder = 0; extruder < numExtruders; extruder++)
+				{
+					const float flow = platform.GetMaxExtrusionFlow(extruder);
+					if (flow > 0.0)
+					{
+						reply.catf("%c%.1f", sep, (double)flow);
+					}
+					else
+					{
+						reply.catf("%cunlimited", sep);
+					}
+					sep = ':';
+				}
 			}
 		}
 		break;
@@ -2017,10 +2115,16 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				retractHop = max<float>(gb.GetFValue(), 0.0);
 				seen = true;
 			}
+			if (gb.Seen('C'))
+			{
+				fuseRetractHop = (gb.GetIValue() > 0);
+				seen = true;
+			}
 			if (!seen)
 			{
-				reply.printf("Retraction/un-retraction settings: length %.2f/%.2fmm, speed %d/%dmm/min, Z hop %.2fmm",
-					(double)retractLength, (double)(retractLength + retractExtra), (int)(retractSpeed * MinutesToSeconds), (int)(unRetractSpeed * MinutesToSeconds), (double)retractHop);
+				reply.printf("Retraction/un-retraction settings: length %.2f/%.2fmm, speed %d/%dmm/min, Z hop %.2fmm%s",
+					(double)retractLength, (double)(retractLength + retractExtra), (int)(retractSpeed * MinutesToSeconds), (int)(unRetractSpeed * MinutesToSeconds), (double)retractHop,
+					(fuseRetractHop) ? " combined with retraction" : "");
 			}
 		}
 		break;
@@ -2263,16 +2367,34 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 					return false;
 				}
 
-				// Perform babystepping synchronously with moves
+				// Z babystepping is superimposed on new moves by ReadMove at a limited speed, so we just add it to the pending amount.
+				// If no moves are being executed or queued then we do it straight away.
 				bool haveResidual = false;
+				{
+					TaskCriticalSectionLocker lock;
+					pendingZBabyStepping += differences[Z_AXIS];
+					if (pendingZBabyStepping != 0.0 && segmentsLeft == 0 && reprap.GetMove().AllMovesAreFinished())
+					{
+						currentBabyStepOffsets[Z_AXIS] += pendingZBabyStepping;
+						moveBuffer.coords[Z_AXIS] += pendingZBabyStepping;
+						pendingZBabyStepping = 0.0;
+						haveResidual = true;
+					}
+				}
+
+				// Other axes are pushed synchronously into the moves that have already been queued
 				for (size_t axis = 0; axis < numVisibleAxes; ++axis)
 				{
+					if (axis == Z_AXIS)
+					{
+						continue;
+					}
 					currentBabyStepOffsets[axis] += differences[axis];
 					const float amountPushed = reprap.GetMove().PushBabyStepping(axis, differences[axis]);
 					moveBuffer.initialCoords[axis] += amountPushed;
 
 					// The following causes all the remaining baby stepping that we didn't manage to push to be added to the [remainder of the] currently-executing move, if there is one.
-					// This could result in an abrupt Z movement, however the move will be processed as normal so the jerk limit will be honoured.
+					// This could result in an abrupt movement, however the move will be processed as normal so the jerk limit will be honoured.
 					moveBuffer.coords[axis] += differences[axis];
 					if (amountPushed != differences[axis])
 					{
@@ -2444,6 +2566,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 										: reprap.GetHeat().IsChamberHeater(heater) ? 50.0
 										: 200.0;
 			const float maxPwm = (gb.Seen('P')) ? gb.GetFValue() : reprap.GetHeat().GetHeaterModel(heater).GetMaxPwm();
+			const bool useRelay = gb.Seen('R') && gb.GetIValue() > 0;
 			if (heater >= NumHeaters)
 			{
 				reply.copy("Bad heater number in M303 command");
@@ -2458,7 +2581,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			}
 			else
 			{
-				reprap.GetHeat().StartAutoTune(heater, temperature, maxPwm, reply);
+				reprap.GetHeat().StartAutoTune(heater, temperature, maxPwm, useRelay, reply);
 			}
 		}
 		else
@@ -2479,6 +2602,75 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		result = SetHeaterModel(gb, reply);
 		break;
 
+	case 309: // Set heater feedforward
+		if (gb.Seen('P'))
+		{
+			const unsigned int heater = gb.GetUIValue();
+			if (heater < NumHeaters)
+			{
+				if (gb.Seen('S'))
+				{
+					reprap.GetHeat().SetExtrusionFeedForward(heater, gb.GetFValue());
+				}
+				else
+				{
+					reply.printf("Heater %u feedforward %.4f PWM per mm/sec extrusion", heater, (double)reprap.GetHeat().GetExtrusionFeedForward(heater));
+				}
+			}
+			else
+			{
+				reply.copy("Invalid heater number");
+				result = GCodeResult::error;
+			}
+		}
+		break;
+
+	case 310: // Set heater power budget
+		{
+			bool seen = false;
+			if (gb.Seen('S'))
+			{
+				seen = true;
+				reprap.GetHeat().SetPowerBudget(gb.GetFValue());
+			}
+			if (gb.Seen('P'))
+			{
+				const unsigned int heater = gb.GetUIValue();
+				if (heater >= NumHeaters)
+				{
+					reply.copy("Invalid heater number");
+					result = GCodeResult::error;
+					break;
+				}
+				float watts, priority;
+				reprap.GetHeat().GetHeaterPowerRating(heater, watts, priority);
+				bool seenRating = false;
+				gb.TryGetFValue('W', watts, seenRating);
+				gb.TryGetFValue('R', priority, seenRating);
+				if (seenRating)
+				{
+					reprap.GetHeat().SetHeaterPowerRating(heater, watts, priority);
+				}
+				else
+				{
+					reply.printf("Heater %u power %.0fW, priority %.2f", heater, (double)watts, (double)priority);
+				}
+			}
+			else if (!seen)
+			{
+				const float budget = reprap.GetHeat().GetPowerBudget();
+				if (budget > 0.0)
+				{
+					reply.printf("Heater power budget %.0fW", (double)budget);
+				}
+				else
+				{
+					reply.copy("Heater power is not limited");
+				}
+			}
+		}
+		break;
+
 	case 350: // Set/report microstepping
 		{
 			bool interp = (gb.Seen('I') && gb.GetIValue() > 0);
@@ -2560,17 +2752,40 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 	case 376: // Set taper height
 		{
 			Move& move = reprap.GetMove();
+			bool seen = false;
 			if (gb.Seen('H'))
 			{
+				seen = true;
 				move.SetTaperHeight(gb.GetFValue());
 			}
-			else if (move.GetTaperHeight() > 0.0)
+			if (gb.Seen('C'))
 			{
-				reply.printf("Bed compensation taper height is %.1fmm", (double)move.GetTaperHeight());
+				// C1 applies mesh compensation continuously along each move instead of segmenting moves where they cross the grid lines
+#if SUPPORT_SEGMENT_FREE_STREAMING
+				seen = true;
+				move.SetStreamMesh(gb.GetIValue() > 0);
+#else
+				reply.copy("Continuous mesh compensation is not supported by this firmware");
+				result = GCodeResult::error;
+				break;
+#endif
 			}
-			else
+			if (!seen)
 			{
-				reply.copy("Bed compensation is not tapered");
+				if (move.GetTaperHeight() > 0.0)
+				{
+					reply.printf("Bed compensation taper height is %.1fmm", (double)move.GetTaperHeight());
+				}
+				else
+				{
+					reply.copy("Bed compensation is not tapered");
+				}
+#if SUPPORT_SEGMENT_FREE_STREAMING
+				if (move.GetStreamMesh())
+				{
+					reply.cat(", mesh compensation is applied continuously");
+				}
+#endif
 			}
 		}
 		break;
@@ -2634,7 +2849,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 						lastAuxStatusReportType = type;
 					}
 
-					outBuf = GenerateJsonStatusResponse(type, seq, (&gb == auxGCode) ? ResponseSource::AUX : ResponseSource::Generic);
+					outBuf = (&gb == auxGCode) ? GenerateAuxStatusResponse(type, seq) : GenerateJsonStatusResponse(type, seq, ResponseSource::Generic);
 					if (outBuf == nullptr)
 					{
 						result = GCodeResult::notFinished;			// we ran out of buffers, so try again later
@@ -2646,12 +2861,85 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			case 1:
 				{
 					String<MediumStringLength> filter;
-					bool dummy;
-					gb.TryGetQuotedString('F', filter.GetRef(), dummy);
+					bool seenFilter = false;
+					gb.TryGetQuotedString('F', filter.GetRef(), seenFilter);
+					String<ObjectModelSubscription::MaxNameLength> subscriptionName;
+					bool seenName = false;
+					gb.TryGetQuotedString('N', subscriptionName.GetRef(), seenName);
+					ObjectModelSubscription *subscription = nullptr;
+					if (seenName)
+					{
+						// A named subscription. F"filter" registers or replaces it and F"" deletes it, otherwise we report using the filter we compiled earlier.
+						ObjectModelSubscription *freeSlot = nullptr;
+						for (ObjectModelSubscription& s : omSubscriptions)
+						{
+							if (s.IsNamed(subscriptionName.c_str()))
+							{
+								subscription = &s;
+								break;
+							}
+							if (freeSlot == nullptr && !s.IsInUse())
+							{
+								freeSlot = &s;
+							}
+						}
+
+						if (seenFilter && filter.IsEmpty())
+						{
+							if (subscription != nullptr)
+							{
+								subscription->Clear();
+							}
+							break;
+						}
+						if (seenFilter)
+						{
+							if (subscription == nullptr)
+							{
+								subscription = freeSlot;
+							}
+							if (subscription == nullptr)
+							{
+								reply.copy("Too many object model subscriptions");
+								result = GCodeResult::error;
+								break;
+							}
+							subscription->Compile(&reprap, subscriptionName.c_str(), filter.c_str(), ObjectModel::flagsNone);
+						}
+						else if (subscription == nullptr)
+						{
+							reply.printf("Object model subscription %s not found", subscriptionName.c_str());
+							result = GCodeResult::error;
+							break;
+						}
+					}
+
 					if (!OutputBuffer::Allocate(outBuf))
 					{
 						result = GCodeResult::notFinished;
 					}
+					else if (subscription != nullptr)
+					{
+						subscription->ReportAsJson(outBuf, &reprap, ObjectModel::flagsNone);
+					}
+					else if (gb.Seen('R'))
+					{
+						// The client wants just the values that have changed since the change sequence number it was given last time
+						const uint32_t since = gb.GetUIValue();
+						OutputBuffer *resultBuf;
+						if (!OutputBuffer::Allocate(resultBuf))
+						{
+							OutputBuffer::ReleaseAll(outBuf);
+							result = GCodeResult::notFinished;
+						}
+						else
+						{
+							reprap.ReportAsJson(resultBuf, filter.c_str(), ObjectModel::flagsNone, since);
+							outBuf->catf("{\"seq\":%" PRIu32 ",\"result\":", ObjectModel::GetChangeSequence());
+							outBuf->Append(resultBuf);
+							outBuf->cat('}');
+						}
+					}
 					else
 					{
 						reprap.ReportAsJson(outBuf, filter.c_str(), ObjectModel::flagsNone);
@@ -2769,6 +3057,22 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			{
 				spindle.SetToolNumber(gb.GetIValue());
 			}
+			if (gb.Seen('A'))
+			{
+				spindle.SetRampRate(max<float>(0.0, gb.GetFValue()));
+			}
+			if (gb.Seen('C'))
+			{
+				const int tacho = gb.GetIValue();
+				const uint32_t pulsesPerRev = (gb.Seen('Q')) ? max<uint32_t>(gb.GetUIValue(), 1) : 2;
+				if (tacho >= (int)NumTachos)
+				{
+					reply.copy("Invalid tacho number");
+					result = GCodeResult::error;
+					break;
+				}
+				spindle.SetTacho(max<int>(tacho, -1), pulsesPerRev);
+			}
 
 			// M453 may be repeated to set up multiple spindles, so only print the message on the initial switch
 			if (oldMachineType != MachineType::cnc)
@@ -2842,7 +3146,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			reprap.GetHeat().ResetHeaterModels();							// in case some heaters have no M307 commands in config.g
 			reprap.GetMove().GetKinematics().SetCalibrationDefaults();		// in case M665/M666/M667/M669 in config.g don't define all the parameters
 			platform.SetZProbeDefaults();
-			DoFileMacro(gb, CONFIG_FILE, true, code);
+			DoFileMacro(gb, ConfigCache::GetFileToRun(CONFIG_FILE), true, code);
 		}
 		break;
 
@@ -3169,7 +3473,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 			{
 				filename.copy(defaultFile);
 			}
-			const FilePosition size = (gb.Seen('S') ? (FilePosition)gb.GetIValue() : 0);
+			const FilePosition size = (gb.Seen('S') ? gb.GetFilePositionValue() : 0);
 			const uint32_t crc32 = (gb.Seen('C') ? gb.GetUIValue() : 0);
 			const bool ok = gb.OpenFileToWrite(folder, filename.c_str(), size, true, crc32);
 			if (ok)
@@ -3273,6 +3577,12 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				reprap.GetMove().SetJerkPolicy(gb.GetUIValue());
 			}
 
+			if (code == 566 && gb.Seen('J'))
+			{
+				seen = true;
+				reprap.GetMove().SetJunctionDeviation(gb.GetDistance());
+			}
+
 			if (!seen)
 			{
 				const float multiplier2 = (code == 566) ? MinutesToSeconds : 1.0;
@@ -3291,6 +3601,11 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				if (code == 566)
 				{
 					reply.catf(", jerk policy: %u", reprap.GetMove().GetJerkPolicy());
+					const float junctionDeviation = reprap.GetMove().GetJunctionDeviation();
+					if (junctionDeviation > 0.0)
+					{
+						reply.catf(", junction deviation %.3fmm", (double)junctionDeviation);
+					}
 				}
 			}
 		}
@@ -3361,9 +3676,15 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 					{
 						reprap.GetHeat().SetFaultDetectionParameters(heater, maxTempExcursion, maxFaultTime);
 					}
-					else if (!seen)
+					if (gb.Seen('R'))
 					{
-						reply.printf("Heater %u allowed excursion %.1f" DEGREE_SYMBOL "C, fault trigger time %.1f seconds", heater, (double)maxTempExcursion, (double)maxFaultTime);
+						seenValue = true;
+						reprap.GetHeat().SetSampleInterval(heater, gb.GetUIValue());
+					}
+					if (!seenValue && !seen)
+					{
+						reply.printf("Heater %u allowed excursion %.1f" DEGREE_SYMBOL "C, fault trigger time %.1f seconds, sample interval %" PRIu32 "ms",
+										heater, (double)maxTempExcursion, (double)maxFaultTime, reprap.GetHeat().GetSampleInterval(heater));
 					}
 				}
 				seen = true;
@@ -3412,53 +3733,87 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		break;
 
 	case 572: // Set/report pressure advance
-		if (gb.Seen('S'))
 		{
-			if (!LockMovementAndWaitForStandstill(gb))
+			const bool seenAdvance = gb.Seen('S');
+			const float advance = (seenAdvance) ? gb.GetFValue() : 0.0;
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+			const bool seenSmoothing = gb.Seen('W');
+			const float smoothing = (seenSmoothing) ? gb.GetFValue() : 0.0;
+			if (smoothing < 0.0 || smoothing > MaxPressureAdvanceSmoothing)
 			{
-				return false;
+				reply.printf("Pressure advance smoothing time must be between 0 and %.2f seconds", (double)MaxPressureAdvanceSmoothing);
+				result = GCodeResult::error;
+				break;
 			}
-			const float advance = gb.GetFValue();
-			if (gb.Seen('D'))
+			const auto setAdvance = [seenAdvance, advance, seenSmoothing, smoothing](unsigned int extruder)
+									{
+										if (seenAdvance)
+										{
+											reprap.GetPlatform().SetPressureAdvance(extruder, advance);
+										}
+										if (seenSmoothing)
+										{
+											reprap.GetPlatform().SetPressureAdvanceSmoothing(extruder, smoothing);
+										}
+									};
+#else
+			constexpr bool seenSmoothing = false;
+			const auto setAdvance = [advance](unsigned int extruder) { reprap.GetPlatform().SetPressureAdvance(extruder, advance); };
+#endif
+			if (seenAdvance || seenSmoothing)
 			{
-				uint32_t eDrive[MaxExtruders];
-				size_t eCount = MaxExtruders;
-				gb.GetUnsignedArray(eDrive, eCount, false);
-				for (size_t i = 0; i < eCount; i++)
+				if (!LockMovementAndWaitForStandstill(gb))
 				{
-					if (eDrive[i] >= numExtruders)
+					return false;
+				}
+				if (gb.Seen('D'))
+				{
+					uint32_t eDrive[MaxExtruders];
+					size_t eCount = MaxExtruders;
+					gb.GetUnsignedArray(eDrive, eCount, false);
+					for (size_t i = 0; i < eCount; i++)
 					{
-						reply.printf("Invalid extruder number '%" PRIu32 "'", eDrive[i]);
+						if (eDrive[i] >= numExtruders)
+						{
+							reply.printf("Invalid extruder number '%" PRIu32 "'", eDrive[i]);
+							result = GCodeResult::error;
+							break;
+						}
+						setAdvance(eDrive[i]);
+					}
+				}
+				else
+				{
+					const Tool * const ct = reprap.GetCurrentTool();
+					if (ct == nullptr)
+					{
+						reply.copy("No tool selected");
 						result = GCodeResult::error;
-						break;
 					}
-					platform.SetPressureAdvance(eDrive[i], advance);
+					else
+					{
+						ct->IterateExtruders(setAdvance);
+					}
 				}
 			}
 			else
 			{
-				const Tool * const ct = reprap.GetCurrentTool();
-				if (ct == nullptr)
+				reply.copy("Extruder pressure advance");
+				char c = ':';
+				for (size_t i = 0; i < numExtruders; ++i)
 				{
-					reply.copy("No tool selected");
-					result = GCodeResult::error;
-				}
-				else
-				{
-					ct->IterateExtruders([advance](unsigned int extruder) { reprap.GetPlatform().SetPressureAdvance(extruder, advance); });
+					reply.catf("%c %.3f", c, (double)platform.GetPressureAdvance(i));
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+					const float smoothingTime = platform.GetPressureAdvanceSmoothing(i);
+					if (smoothingTime > 0.0)
+					{
+						reply.catf(" smoothed over %.3fs", (double)smoothingTime);
+					}
+#endif
+					c = ',';
 				}
 			}
 		}
-		else
-		{
-			reply.copy("Extruder pressure advance");
-			char c = ':';
-			for (size_t i = 0; i < numExtruders; ++i)
-			{
-				reply.catf("%c %.3f", c, (double)platform.GetPressureAdvance(i));
-				c = ',';
-			}
-		}
 		break;
 
 	case 573: // Report heater average PWM
@@ -3556,6 +3911,7 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 							auxGCode->SetCommsProperties(val);
 							platform.SetAuxDetected();
 						}
+						auxStatusFilter.Reset();			// make sure the next status response is complete
 						break;
 					default:
 						break;
@@ -3565,10 +3921,16 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 				if (!seen)
 				{
 					uint32_t cp = platform.GetCommsProperties(chan);
-					reply.printf("Channel %d: baud rate %" PRIu32 ", %s checksum", chan, platform.GetBaudRate(chan), (cp & 1) ? "requires" : "does not require");
+					reply.printf("Channel %d: baud rate %" PRIu32 ", %s checksum%s%s", chan, platform.GetBaudRate(chan), (cp & 1) ? "requires" : "does not require",
+									(cp & 2) ? ", reports buffer space" : "", (chan == 1 && (cp & 4) != 0) ? ", sends status changes only" : "");
 				}
 			}
 		}
+		else if (gb.Seen('S'))
+		{
+			// No channel given, so set the properties of the channel that sent the command. This lets a telnet host turn on buffer space reporting.
+			gb.SetCommsProperties(gb.GetIValue());
+		}
 		break;
 
 	case 577: // Wait until endstop input is triggered
@@ -3692,10 +4054,24 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		{
 			const unsigned int interface = (gb.Seen('I') ? gb.GetUIValue() : 0);
 
-			if (gb.Seen('P'))
+			// M586 C<percent> A<actions> sets the CPU budget of the network task and how many responders may do significant work per loop
+			bool seenBudget = false;
+			uint32_t budget = reprap.GetNetwork().GetCpuBudget();
+			uint32_t actionsPerSpin = reprap.GetNetwork().GetResponderActionsPerSpin();
+			gb.TryGetUIValue('C', budget, seenBudget);
+			gb.TryGetUIValue('A', actionsPerSpin, seenBudget);
+			if (seenBudget)
+			{
+				result = reprap.GetNetwork().SetCpuBudget(budget, actionsPerSpin, reply);
+			}
+			else if (gb.Seen('P'))
 			{
 				const unsigned int protocol = gb.GetUIValue();
-				if (gb.Seen('S'))
+				if (protocol == HttpProtocol && gb.Seen('N'))
+				{
+					result = reprap.GetNetwork().SetNumHttpResponders(gb.GetUIValue(), reply);
+				}
+				if (result == GCodeResult::ok && gb.Seen('S'))
 				{
 					const bool enable = (gb.GetIValue() == 1);
 					if (enable)
@@ -3767,6 +4143,55 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		result = reprap.GetMove().ConfigureDynamicAcceleration(gb, reply);
 		break;
 
+	case 595: // Configure movement queue, step generation and code queue
+		if ((gb.Seen('P') || gb.Seen('Q') || gb.Seen('R')) && !LockMovementAndWaitForStandstill(gb))
+		{
+			return false;
+		}
+		if ((gb.Seen('Q') || gb.Seen('R')) && !codeQueue->IsEmpty())
+		{
+			return false;					// wait until the queued codes have been executed
+		}
+		result = reprap.GetMove().ConfigureMovementQueue(gb, reply);
+		if (result == GCodeResult::ok)
+		{
+			result = ConfigureCodeQueue(gb, reply);
+		}
+		break;
+
+#if SUPPORT_ASYNC_MOVES
+	case 596: // Queue an auxiliary extruder move that runs independently of the main moves
+		if (machineType == MachineType::laser)
+		{
+			reply.copy("Auxiliary moves are not supported in laser mode");
+			result = GCodeResult::error;
+		}
+		else if (gb.Seen('E'))
+		{
+			float eVals[MaxExtruders];
+			size_t eCount = numExtruders;
+			gb.GetFloatArray(eVals, eCount, false);
+			const float feedRate = ((gb.Seen('F')) ? gb.GetFValue() : DefaultFeedRate) * SecondsToMinutes;
+			if (feedRate <= 0.0)
+			{
+				reply.copy("Feed rate must be greater than zero");
+				result = GCodeResult::error;
+			}
+			else if (!reprap.GetMove().AddAuxiliaryMove(eVals, eCount, feedRate))
+			{
+				return false;				// the previous auxiliary move hasn't been taken yet
+			}
+		}
+		break;
+
+	case 598: // Wait for auxiliary moves to finish
+		if (!reprap.GetMove().AuxiliaryMovesFinished())
+		{
+			return false;
+		}
+		break;
+#endif
+
 	// For case 600, see 226
 
 	// M650 (set peel move parameters) and M651 (execute peel move) are no longer handled specially. Use macros to specify what they should do.
@@ -4324,6 +4749,33 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 #endif
 
 	case 916:
+#if SUPPORT_RESUME_JOURNAL
+		if (gb.Seen('J'))
+		{
+			// Set the interval between resume journal records. It applies from the next print started.
+			resumeJournalInterval = (uint32_t)max<float>(gb.GetFValue() * SecondsToMillis, 0.0);
+			break;
+		}
+
+		if (!resumeJournal.IsActive())
+		{
+			// If the journal holds a more recent resume point than resurrect.g, rebuild resurrect.g from it
+			ResumeJournalRecord record;
+			bool haveRecord = ResumeJournal::ReadLatest(record) && (record.flags & ResumeJournalRecord::FlagResumeFileWritten) == 0;
+# if HAS_BACKUP_RESUME_RECORD
+			// The backup registers are updated more often than the journal, so if they survived, use the position in them with the rest of the state from the journal
+			uint32_t backupFlags;
+			if (haveRecord && ResumeJournal::ReadBackupRecord(record.restorePoint, backupFlags))
+			{
+				record.flags = (record.flags & ~0xFFu) | backupFlags;
+			}
+# endif
+			if (haveRecord && RebuildResumeFile(record))
+			{
+				platform.MessageF(LoggedGenericMessage, "Rebuilt %s from the resume journal\n", RESUME_AFTER_POWER_FAIL_G);
+			}
+		}
+#endif
 		if (!platform.SysFileExists(RESUME_AFTER_POWER_FAIL_G))
 		{
 			reply.copy("No resume file found");
@@ -4407,6 +4859,27 @@ bool GCodes::HandleMcode(GCodeBuffer& gb, const StringRef& reply)
 		break;
 	}
 
+	switch (code)
+	{
+	case 18:	// the idle timeout
+	case 84:
+	case 201:	// accelerations
+	case 203:	// feed rates
+	case 205:	// jerk
+	case 566:
+	case 208:	// axis limits
+	case 505:	// system folder
+	case 584:	// number of axes
+	case 667:
+	case 669:
+	case 906:	// motor currents
+		reprap.ConfigResponseChanged();			// these change what the config response reports, so make sure it is rebuilt
+		break;
+
+	default:
+		break;
+	}
+
 	return HandleResult(gb, result, reply, outBuf);
 }
 
@@ -4443,7 +4916,11 @@ bool GCodes::HandleTcode(GCodeBuffer& gb, const StringRef& reply)
 
 	if (seen)
 	{
-		if (!LockMovementAndWaitForStandstill(gb))
+		// If the P parameter asks for a queued tool change then we don't need to wait for the moves already in the queue to finish
+		const uint8_t toolChangeParam = (simulationMode != 0) ? 0
+											: gb.Seen('P') ? gb.GetUIValue()
+												: DefaultToolChangeParam;
+		if (!(((toolChangeParam & TQueuedBit) != 0) ? LockMovementAndWaitForQueuedMoves(gb) : LockMovementAndWaitForStandstill(gb)))
 		{
 			return false;
 		}
@@ -4453,9 +4930,7 @@ bool GCodes::HandleTcode(GCodeBuffer& gb, const StringRef& reply)
 		if (oldTool == nullptr || oldTool->Number() != toolNum)
 		{
 			gb.MachineState().newToolNumber = toolNum;
-			gb.MachineState().toolChangeParam = (simulationMode != 0) ? 0
-													: gb.Seen('P') ? gb.GetUIValue()
-														: DefaultToolChangeParam;
+			gb.MachineState().toolChangeParam = toolChangeParam;
 			gb.SetState(GCodeState::toolChange0);
 			return true;							// proceeding with state machine, so don't unlock or send a reply
 		}
@@ -67,6 +67,7 @@ GCodeResult GCodes::SetPrintZProbe(GCodeBuffer& gb, const StringRef& reply)
 		seen = true;
 		params.adcValue = gb.GetIValue();
 	}
+	gb.TryGetFValue('K', params.sensitivity, seen);		// change in reading per mm, for probing while moving
 
 	if (gb.Seen('C'))
 	{
@@ -119,6 +120,10 @@ GCodeResult GCodes::SetPrintZProbe(GCodeBuffer& gb, const StringRef& reply)
 			}
 		}
 		reply.catf(", threshold %d, trigger height %.2f, offsets X%.1f Y%.1f", params.adcValue, (double)params.triggerHeight, (double)params.xOffset, (double)params.yOffset);
+		if (params.sensitivity != 0.0)
+		{
+			reply.catf(", sensitivity %.1f/mm", (double)params.sensitivity);
+		}
 	}
 	return GCodeResult::ok;
 }
@@ -471,6 +476,66 @@ GCodeResult GCodes::SimulateFile(GCodeBuffer& gb, const StringRef &reply, const
 	return GCodeResult::error;
 }
 
+// Handle M33 to add files to the job queue, clear it, enable or disable preheating for the next job, or report it
+GCodeResult GCodes::ManageJobQueue(GCodeBuffer& gb, const StringRef &reply)
+{
+	bool seen = false;
+	if (gb.Seen('R') && gb.GetIValue() > 0)
+	{
+		seen = true;
+		jobQueue.Clear();
+	}
+
+	if (gb.Seen('H'))
+	{
+		seen = true;
+		jobQueue.EnablePreheat(gb.GetIValue() > 0);
+	}
+
+	if (gb.Seen('P'))
+	{
+		seen = true;
+		String<MaxFilenameLength> fileName;
+		if (!gb.GetQuotedString(fileName.GetRef()))
+		{
+			reply.copy("Missing filename");
+			return GCodeResult::error;
+		}
+		if (!platform.FileExists(platform.GetGCodeDir(), fileName.c_str()))
+		{
+			reply.printf("GCode file \"%s\" not found", fileName.c_str());
+			return GCodeResult::error;
+		}
+		if (!jobQueue.Add(fileName.c_str()))
+		{
+			reply.copy("Job queue is full");
+			return GCodeResult::error;
+		}
+
+		// If nothing is being printed then start the job now
+		if (!fileGCode->OriginalMachineState().fileState.IsLive())
+		{
+			if (!StartNextQueuedJob(reply))
+			{
+				return GCodeResult::error;
+			}
+			reply.printf("Started printing file %s", fileName.c_str());
+		}
+	}
+
+	if (!seen)
+	{
+		const size_t numJobs = jobQueue.GetNumJobs();
+		reply.printf("Job queue: %u job%s", (unsigned int)numJobs, (numJobs == 1) ? "" : "s");
+		for (size_t i = 0; i < numJobs; ++i)
+		{
+			reply.catf("%c %s", (i == 0) ? ':' : ',', jobQueue.GetJob(i));
+		}
+		reply.catf(", preheating %s", (jobQueue.IsPreheatEnabled()) ? "enabled" : "disabled");
+	}
+	return GCodeResult::ok;
+}
+
 // handle M37 to change the simulation mode
 GCodeResult GCodes::ChangeSimulationMode(GCodeBuffer& gb, const StringRef &reply, uint32_t newSimulationMode)
 {
@@ -553,7 +618,12 @@ GCodeResult GCodes::SetOrReportZProbe(GCodeBuffer& gb, const StringRef &reply)
 	gb.TryGetFValue('H', params.diveHeight, seen);			// dive height
 	if (gb.Seen('F'))										// feed rate i.e. probing speed
 	{
-		params.probeSpeed = gb.GetFValue() * SecondsToMinutes;
+		// One value sets the probing speed. Two values set the speed of a fast approach tap and of the slow taps that follow it.
+		float speeds[2];
+		size_t numSpeeds = 2;
+		gb.GetFloatArray(speeds, numSpeeds, false);
+		params.fastProbeSpeed = speeds[0] * SecondsToMinutes;
+		params.probeSpeed = speeds[numSpeeds - 1] * SecondsToMinutes;
 		seen = true;
 	}
 
@@ -590,8 +660,13 @@ GCodeResult GCodes::SetOrReportZProbe(GCodeBuffer& gb, const StringRef &reply)
 	}
 	else
 	{
-		reply.printf("Z Probe type %u, input %u, invert %s, dive height %.1fmm, probe speed %dmm/min, travel speed %dmm/min, recovery time %.2f sec, heaters %s, max taps %u, max diff %.2f",
-						(unsigned int)platform.GetZProbeType(), params.inputChannel, (params.invertReading) ? "yes" : "no", (double)params.diveHeight,
+		reply.printf("Z Probe type %u, input %u, invert %s, dive height %.1fmm, probe speed ",
+						(unsigned int)platform.GetZProbeType(), params.inputChannel, (params.invertReading) ? "yes" : "no", (double)params.diveHeight);
+		if (params.fastProbeSpeed > params.probeSpeed)
+		{
+			reply.catf("%d:", (int)(params.fastProbeSpeed * MinutesToSeconds));
+		}
+		reply.catf("%dmm/min, travel speed %dmm/min, recovery time %.2f sec, heaters %s, max taps %u, max diff %.2f",
 						(int)(params.probeSpeed * MinutesToSeconds), (int)(params.travelSpeed * MinutesToSeconds),
 						(double)params.recoveryTime,
 						(params.turnHeatersOff) ? "suspended" : "normal",
@@ -1302,6 +1377,15 @@ GCodeResult GCodes::ConfigureDriver(GCodeBuffer& gb,const  StringRef& reply)
 						return GCodeResult::error;
 					}
 				}
+
+				if (gb.TryGetUIValue('L', val, seen))		// set the coolStep configuration bits of COOLCONF, which make the driver lower the current when the load is light
+				{
+					if (!SmartDrivers::SetRegister(drive, SmartDriverRegister::coolConf, val))
+					{
+						reply.printf("Bad coolStep configuration for driver %u", drive);
+						return GCodeResult::error;
+					}
+				}
 #endif
 			}
 
@@ -1397,6 +1481,7 @@ GCodeResult GCodes::ConfigureDriver(GCodeBuffer& gb,const  StringRef& reply)
 						bool bdummy;
 						const float mmPerSec = (12000000.0 * platform.GetDriverMicrostepping(drive, bdummy))/(256 * thigh * platform.DriveStepsPerUnit(axis));
 						reply.catf(", thigh %" PRIu32 " (%.1f mm/sec)", thigh, (double)mmPerSec);
+						reply.catf(", coolstep 0x%04" PRIx32, SmartDrivers::GetRegister(drive, SmartDriverRegister::coolConf));
 					}
 #endif
 				}
@@ -1486,6 +1571,35 @@ GCodeResult GCodes::SetHeaterModel(GCodeBuffer& gb, const StringRef& reply)
 	return GCodeResult::ok;
 }
 
+// Handle the Q and R parameters of M595, which set the number of codes that can be queued to synchronise them to moves and the size of the buffer that holds them.
+// The caller must have waited for movement to stop and for the code queue to be emptied if either parameter is present.
+GCodeResult GCodes::ConfigureCodeQueue(GCodeBuffer& gb, const StringRef& reply)
+{
+	bool seen = false;
+	uint32_t numCodes = codeQueue->GetMaxCodes(), bufferSize = codeQueue->GetBufferSize();
+	gb.TryGetUIValue('Q', numCodes, seen);
+	gb.TryGetUIValue('R', bufferSize, seen);
+	if (seen)
+	{
+		if (numCodes < codeQueue->GetMaxCodes() || numCodes > MaxQueuedCodes || bufferSize < codeQueue->GetBufferSize() || bufferSize > MaxCodeQueueBufferSize)
+		{
+			reply.printf("Code queue length must be between %u and %u, buffer size between %u and %u",
+							codeQueue->GetMaxCodes(), MaxQueuedCodes, codeQueue->GetBufferSize(), MaxCodeQueueBufferSize);
+			return GCodeResult::error;
+		}
+		if (!codeQueue->Extend(numCodes, bufferSize))
+		{
+			reply.copy("Failed to extend the code queue, not enough free RAM");
+			return GCodeResult::error;
+		}
+	}
+	else if (!reply.IsEmpty())
+	{
+		reply.catf(", code queue length %u, buffer size %u", codeQueue->GetMaxCodes(), codeQueue->GetBufferSize());
+	}
+	return GCodeResult::ok;
+}
+
 // Change a live extrusion factor
 void GCodes::ChangeExtrusionFactor(unsigned int extruder, float factor)
 {
@@ -1494,6 +1608,7 @@ void GCodes::ChangeExtrusionFactor(unsigned int extruder, float factor)
 		moveBuffer.coords[extruder + numTotalAxes] *= factor/extrusionFactors[extruder];	// last move not gone, so update it
 	}
 	extrusionFactors[extruder] = factor;
+	++extrusionFactorsVersion;
 }
 
 // End
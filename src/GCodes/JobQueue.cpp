@@ -0,0 +1,210 @@
+/*
+ * JobQueue.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "JobQueue.h"
+#include "GCodeInput.h"
+#include "Platform.h"
+#include "RepRap.h"
+
+JobQueue::JobQueue()
+	: numJobs(0), prepareState(PrepareState::notStarted), nextJobFile(nullptr), linesScanned(0),
+	  bedTemperature(0.0), toolTemperature(0.0), toolNumber(-1), preheated(false), preheatEnabled(false)
+{
+}
+
+bool JobQueue::Add(const char *fileName)
+{
+	if (numJobs == MaxQueuedJobs)
+	{
+		return false;
+	}
+	jobs[numJobs].copy(fileName);
+	++numJobs;
+	return true;
+}
+
+void JobQueue::Clear()
+{
+	StopPreparing();
+	numJobs = 0;
+}
+
+// Remove the next job from the queue. If we have already opened its file then return it, positioned at the start; else return nullptr and the caller must open it.
+FileStore *JobQueue::TakeNext(const StringRef& fileName)
+{
+	fileName.Clear();
+	if (numJobs == 0)
+	{
+		return nullptr;
+	}
+
+	fileName.copy(jobs[0].c_str());
+	for (size_t i = 1; i < numJobs; ++i)
+	{
+		jobs[i - 1].copy(jobs[i].c_str());
+	}
+	--numJobs;
+
+	FileStore *f = nullptr;
+	if (prepareState == PrepareState::ready && nextJobFile != nullptr && nextJobFile->Seek(0))
+	{
+		f = nextJobFile;
+		nextJobFile = nullptr;
+	}
+	StopPreparing();
+	return f;
+}
+
+void JobQueue::StopPreparing()
+{
+	if (nextJobFile != nullptr)
+	{
+		nextJobFile->Close();
+		nextJobFile = nullptr;
+	}
+	prepareState = PrepareState::notStarted;
+}
+
+// Do a little more of the preparation of the next job. Called from the GCodes task while a job is being printed, so each call must be quick.
+void JobQueue::Spin()
+{
+	if (numJobs == 0)
+	{
+		return;
+	}
+
+	MassStorage * const massStorage = reprap.GetPlatform().GetMassStorage();
+	switch (prepareState)
+	{
+	case PrepareState::notStarted:
+		if (MassStorage::CombineName(nextJobPath.GetRef(), reprap.GetPlatform().GetGCodeDir(), jobs[0].c_str()))
+		{
+			bedTemperature = toolTemperature = 0.0;
+			toolNumber = -1;
+			linesScanned = 0;
+			preheated = false;
+			prepareState = PrepareState::parsingInfo;
+		}
+		else
+		{
+			prepareState = PrepareState::ready;										// the name is too long, so leave it to M32 to report the error
+		}
+		break;
+
+	case PrepareState::parsingInfo:
+		// The file info parser stores what it finds in the file info index, so when the job starts the print monitor gets the information at once
+		if (massStorage->GetFileInfo(nextJobPath.c_str(), nextJobInfo, false))
+		{
+			nextJobFile = massStorage->OpenFile(nextJobPath.c_str(), OpenMode::read, 0, FileUser::job);
+			if (nextJobFile == nullptr)
+			{
+				prepareState = PrepareState::ready;
+				break;
+			}
+			(void)nextJobFile->EnableFastSeek();
+
+			// Binary G-code files hold their commands in binary records, so we don't look for temperatures in them
+			char signature[BinaryGCodeSignatureLength];
+			prepareState = (   nextJobFile->Read(signature, BinaryGCodeSignatureLength) == (int)BinaryGCodeSignatureLength
+							&& memcmp(signature, BinaryGCodeSignature, BinaryGCodeSignatureLength) == 0
+						   )
+							? PrepareState::ready
+							: PrepareState::scanningTemperatures;
+			(void)nextJobFile->Seek(0);
+		}
+		break;
+
+	case PrepareState::scanningTemperatures:
+		for (size_t i = 0; i < TemperatureScanLinesPerSpin; ++i)
+		{
+			char line[MaxScanLineLength];
+			if (   linesScanned == TemperatureScanLines
+				|| (bedTemperature > 0.0 && toolTemperature > 0.0)
+				|| nextJobFile->ReadLine(line, sizeof(line)) <= 0
+			   )
+			{
+				prepareState = PrepareState::ready;
+				break;
+			}
+			++linesScanned;
+			ScanLine(line);
+		}
+		break;
+
+	case PrepareState::ready:
+	default:
+		break;
+	}
+}
+
+// Look for M140, M190, M104 or M109 with a nonzero S parameter. We only want the first of each kind.
+void JobQueue::ScanLine(const char *line)
+{
+	while (*line == ' ' || *line == '\t')
+	{
+		++line;
+	}
+	if (*line != 'M' && *line != 'm')
+	{
+		return;
+	}
+
+	const char *p;
+	const unsigned long code = SafeStrtoul(line + 1, &p);
+	if (p == line + 1 || (code != 140 && code != 190 && code != 104 && code != 109))
+	{
+		return;
+	}
+
+	float temperature = 0.0;
+	int tool = -1;
+	for (; *p != 0 && *p != ';'; ++p)
+	{
+		if (*p == 'S' || *p == 's')
+		{
+			temperature = SafeStrtof(p + 1, &p);
+			--p;
+		}
+		else if (*p == 'T' || *p == 't')
+		{
+			tool = (int)SafeStrtol(p + 1, &p);
+			--p;
+		}
+	}
+
+	if (temperature > 0.0)
+	{
+		if (code == 140 || code == 190)
+		{
+			if (bedTemperature <= 0.0)
+			{
+				bedTemperature = temperature;
+			}
+		}
+		else if (toolTemperature <= 0.0)
+		{
+			toolTemperature = temperature;
+			toolNumber = tool;
+		}
+	}
+}
+
+// Return the temperatures that the next job starts with, if we have found them and haven't returned them already
+bool JobQueue::GetPreheatTemperatures(float& bedTemp, float& toolTemp, int& toolNum)
+{
+	if (!preheatEnabled || preheated || numJobs == 0 || prepareState != PrepareState::ready || (bedTemperature <= 0.0 && toolTemperature <= 0.0))
+	{
+		return false;
+	}
+	preheated = true;
+	bedTemp = bedTemperature;
+	toolTemp = toolTemperature;
+	toolNum = toolNumber;
+	return true;
+}
+
+// End
@@ -0,0 +1,63 @@
+/*
+ * JobQueue.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_GCODES_JOBQUEUE_H_
+#define SRC_GCODES_JOBQUEUE_H_
+
+#include "RepRapFirmware.h"
+#include "Storage/FileInfoParser.h"
+
+// This class holds the files that are to be printed after the current one (M33).
+// While the current job is printing, it gets the file information of the next job so that it is in the file info index when the job starts,
+// opens the file and builds its cluster map so that the job can start without searching the SD card, and finds the first bed and tool temperatures in it.
+class JobQueue
+{
+public:
+	JobQueue();
+
+	bool Add(const char *fileName);												// Add a file to the end of the queue, returning false if the queue is full
+	void Clear();																// Remove all the queued jobs
+	size_t GetNumJobs() const { return numJobs; }
+	const char *GetJob(size_t n) const { return jobs[n].c_str(); }
+	FileStore *TakeNext(const StringRef& fileName);								// Remove the next job from the queue and return its file if we have already opened it
+	void Spin();																// Do a little more of the preparation of the next job. Called while a job is being printed.
+
+	bool GetPreheatTemperatures(float& bedTemp, float& toolTemp, int& toolNumber);	// Return true the first time it is called for a job whose temperatures we have found
+	bool IsPreheatEnabled() const { return preheatEnabled; }
+	void EnablePreheat(bool enable) { preheatEnabled = enable; }
+
+private:
+	static constexpr size_t TemperatureScanLines = 200;						// How many lines at the start of the file we look at for temperatures
+	static constexpr size_t TemperatureScanLinesPerSpin = 10;
+	static constexpr size_t MaxScanLineLength = 100;
+
+	enum class PrepareState : uint8_t
+	{
+		notStarted,
+		parsingInfo,
+		scanningTemperatures,
+		ready
+	};
+
+	void StopPreparing();
+	void ScanLine(const char *line);											// Look for a bed or tool temperature in a line of G-code
+
+	String<MaxFilenameLength> jobs[MaxQueuedJobs];								// the file names as they were given to M33, relative to the G-code directory
+	size_t numJobs;
+
+	PrepareState prepareState;
+	String<MaxFilenameLength> nextJobPath;										// the full path of the job we are preparing
+	FileStore *nextJobFile;														// the file of the job we are preparing, once we have opened it
+	GCodeFileInfo nextJobInfo;
+	size_t linesScanned;
+	float bedTemperature, toolTemperature;										// the temperatures we found, or zero if we didn't find them
+	int toolNumber;																// the tool that toolTemperature applies to, or -1 for the current or default tool
+	bool preheated;																// true if we have already returned the temperatures for this job
+	bool preheatEnabled;
+};
+
+#endif /* SRC_GCODES_JOBQUEUE_H_ */
@@ -0,0 +1,192 @@
+/*
+ * ResumeJournal.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "ResumeJournal.h"
+
+#if SUPPORT_RESUME_JOURNAL
+
+#include "Platform.h"
+#include "RepRap.h"
+#include "Storage/CRC32.h"
+
+// Create the journal for a new print, writing all the slots so that later writes don't extend the file
+bool ResumeJournal::Start()
+{
+	Stop(false);
+
+	Platform& platform = reprap.GetPlatform();
+	file = platform.OpenSysFile(JournalFileName, OpenMode::write);
+	if (file == nullptr)
+	{
+		platform.MessageF(ErrorMessage, "Failed to create file %s\n", JournalFileName);
+		return false;
+	}
+
+	const uint8_t zeros[64] = { 0 };
+	bool ok = true;
+	for (size_t i = 0; i < (NumSlots * SlotSize)/sizeof(zeros) && ok; ++i)
+	{
+		ok = file->Write(zeros, sizeof(zeros));
+	}
+	if (!ok || !file->Flush())
+	{
+		platform.MessageF(ErrorMessage, "Failed to write file %s\n", JournalFileName);
+		Stop(false);
+		return false;
+	}
+
+	nextSlot = 0;
+	nextSequenceNumber = 1;
+#if HAS_BACKUP_RESUME_RECORD
+	ClearBackupRecord();
+#endif
+	return true;
+}
+
+// Write a record to the next slot, setting its sequence number and CRC. We flush it straight away because the power may fail at any time.
+bool ResumeJournal::Append(ResumeJournalRecord& record)
+{
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	record.magic = JournalMagic;
+	record.sequenceNumber = nextSequenceNumber++;
+	record.crc = CalcCrc(record);
+	const bool ok = file->Seek(nextSlot * SlotSize)
+				&& file->Write(reinterpret_cast<const uint8_t*>(&record), sizeof(record))
+				&& file->Flush();
+	nextSlot = (nextSlot + 1) % NumSlots;
+	return ok;
+}
+
+// Close the journal at the end of a print, deleting it unless we are told to keep the records
+void ResumeJournal::Stop(bool keepRecords)
+{
+	if (file != nullptr)
+	{
+		file->Close();
+		file = nullptr;
+		if (!keepRecords)
+		{
+			reprap.GetPlatform().DeleteSysFile(JournalFileName);
+#if HAS_BACKUP_RESUME_RECORD
+			ClearBackupRecord();
+#endif
+		}
+	}
+}
+
+// Fetch the most recent valid record from the journal file, returning true if we found one
+/*static*/ bool ResumeJournal::ReadLatest(ResumeJournalRecord& record)
+{
+	FileStore * const f = reprap.GetPlatform().OpenSysFile(JournalFileName, OpenMode::read);
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	bool found = false;
+	ResumeJournalRecord candidate;
+	for (size_t slot = 0; slot < NumSlots; ++slot)
+	{
+		if (   f->Seek(slot * SlotSize)
+			&& f->Read(reinterpret_cast<uint8_t*>(&candidate), sizeof(candidate)) == (int)sizeof(candidate)
+			&& candidate.magic == JournalMagic
+			&& candidate.crc == CalcCrc(candidate)
+			&& (!found || candidate.sequenceNumber > record.sequenceNumber)
+		   )
+		{
+			record = candidate;
+			found = true;
+		}
+	}
+	f->Close();
+	return found;
+}
+
+/*static*/ uint32_t ResumeJournal::CalcCrc(const ResumeJournalRecord& record)
+{
+	CRC32 crc;
+	crc.Update(reinterpret_cast<const char*>(&record), offsetof(ResumeJournalRecord, crc));
+	return crc.Get();
+}
+
+#if HAS_BACKUP_RESUME_RECORD
+
+// Save the XYZ position, extruder position, feed rate and file position of a resume point in the backup registers.
+// We only keep the flags that fit in the low 8 bits. The caller must not pass a resume point part way through a segmented move, because there is no room for the initial XY position.
+/*static*/ void ResumeJournal::WriteBackupRecord(const RestorePoint& rp, uint32_t flags)
+{
+	uint32_t regs[NumBackupRegisters];
+	regs[brHeader] = BackupMagic | ((uint32_t)(rp.toolNumber + 1) & 0xFF) << 8 | (flags & 0xFF);
+	regs[brFilePos] = rp.filePos;
+	memcpy(&regs[brX], &rp.moveCoords[X_AXIS], sizeof(float));
+	memcpy(&regs[brY], &rp.moveCoords[Y_AXIS], sizeof(float));
+	memcpy(&regs[brZ], &rp.moveCoords[Z_AXIS], sizeof(float));
+	memcpy(&regs[brExtruder], &rp.virtualExtruderPosition, sizeof(float));
+	memcpy(&regs[brFeedRate], &rp.feedRate, sizeof(float));
+	regs[brChecksum] = BackupChecksum(regs);
+
+	// Invalidate the record while we change it, in case we are reset part way through
+	GPBR->SYS_GPBR[brChecksum] = ~regs[brChecksum];
+	for (size_t i = 0; i < NumBackupRegisters; ++i)
+	{
+		GPBR->SYS_GPBR[i] = regs[i];
+	}
+}
+
+// Fetch the resume point from the backup registers, returning true if it is valid. Only the fields that we saved are changed.
+/*static*/ bool ResumeJournal::ReadBackupRecord(RestorePoint& rp, uint32_t& flags)
+{
+	uint32_t regs[NumBackupRegisters];
+	for (size_t i = 0; i < NumBackupRegisters; ++i)
+	{
+		regs[i] = GPBR->SYS_GPBR[i];
+	}
+	if ((regs[brHeader] & 0xFFFF0000) != BackupMagic || regs[brChecksum] != BackupChecksum(regs))
+	{
+		return false;
+	}
+
+	flags = regs[brHeader] & 0xFF;
+	rp.toolNumber = (int)((regs[brHeader] >> 8) & 0xFF) - 1;
+	rp.filePos = regs[brFilePos];
+	memcpy(&rp.moveCoords[X_AXIS], &regs[brX], sizeof(float));
+	memcpy(&rp.moveCoords[Y_AXIS], &regs[brY], sizeof(float));
+	memcpy(&rp.moveCoords[Z_AXIS], &regs[brZ], sizeof(float));
+	memcpy(&rp.virtualExtruderPosition, &regs[brExtruder], sizeof(float));
+	memcpy(&rp.feedRate, &regs[brFeedRate], sizeof(float));
+	rp.proportionDone = 0.0;
+	return true;
+}
+
+/*static*/ void ResumeJournal::ClearBackupRecord()
+{
+	for (size_t i = 0; i < NumBackupRegisters; ++i)
+	{
+		GPBR->SYS_GPBR[i] = 0;
+	}
+}
+
+/*static*/ uint32_t ResumeJournal::BackupChecksum(const uint32_t regs[])
+{
+	// The backup registers are only lost or scrambled as a whole, so a rotate and xor checksum is enough to tell a valid record from power-up garbage
+	uint32_t sum = 0x1F2E3D4C;
+	for (size_t i = 0; i < brChecksum; ++i)
+	{
+		sum = ((sum << 5) | (sum >> 27)) ^ regs[i];
+	}
+	return sum;
+}
+
+#endif
+
+#endif
+
+// End
@@ -0,0 +1,97 @@
+/*
+ * ResumeJournal.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_GCODES_RESUMEJOURNAL_H_
+#define SRC_GCODES_RESUMEJOURNAL_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_RESUME_JOURNAL
+
+#include "RestorePoint.h"
+
+// The SAM4E, SAM4S and SAME70 have 8 general purpose backup registers, which keep their contents through a reset and for as long as VDDBU is powered.
+// Writing them takes a few processor cycles, so we can keep a minimal copy of the resume point in them that is always up to date.
+#if SAM4E || SAM4S || SAME70
+# define HAS_BACKUP_RESUME_RECORD	1
+#else
+# define HAS_BACKUP_RESUME_RECORD	0
+#endif
+
+// The state that we need to rebuild resurrect.g, recorded periodically while printing.
+// Everything else that resurrect.g needs, such as the kinematics, tools and heaters, is set up by config.g after a restart.
+struct ResumeJournalRecord
+{
+	// Values of the flags field
+	static constexpr uint32_t FlagPowerFailure = 1u << 0;		// this record was written when the power failed
+	static constexpr uint32_t FlagResumeFileWritten = 1u << 1;	// resurrect.g was written completely after this record was taken, so it is more complete than the journal
+	static constexpr uint32_t FlagUsingMesh = 1u << 2;			// mesh bed compensation was in use
+	static constexpr uint32_t FlagDrivesRelative = 1u << 3;	// extrusion was relative (M83)
+	static constexpr uint32_t FlagUsingInches = 1u << 4;		// the file uses inches (G20)
+
+	uint32_t magic;
+	uint32_t sequenceNumber;
+	uint32_t flags;
+	RestorePoint restorePoint;									// in user coordinates, as for the pause restore point
+	float babyStepOffsets[MaxAxes];
+	float currentToolOffsets[MaxAxes];
+	float toolActiveTemperatures[MaxHeatersPerTool];
+	float toolStandbyTemperatures[MaxHeatersPerTool];
+	float bedTemperature;										// less than zero if the bed heater was off
+	float chamberTemperature;									// less than zero if the chamber heater was off
+	float fanSpeed;												// the speed of the print fan, 0.0 to 1.0
+	uint32_t coordinateSystem;									// zero-based
+	char fileName[MaxFilenameLength];							// the file being printed
+	uint32_t crc;												// the CRC of all of the above
+};
+
+// A ring of journal records in a system file that we preallocate when the print starts. Each record starts on its own sector so that writing one
+// touches only that sector, and it never extends the file so FatFS doesn't need to update the FAT. A record that was only partly written when
+// the power failed fails its CRC check, and we use the one before it.
+class ResumeJournal
+{
+public:
+	ResumeJournal() : file(nullptr), nextSlot(0), nextSequenceNumber(0) { }
+
+	bool Start();												// Create the journal for a new print, discarding any old records
+	bool Append(ResumeJournalRecord& record);					// Write a record to the next slot, setting its sequence number and CRC
+	void Stop(bool keepRecords);								// Close the journal at the end of a print, deleting it unless we are told to keep the records
+	bool IsActive() const { return file != nullptr; }
+
+	static bool ReadLatest(ResumeJournalRecord& record);		// Fetch the most recent valid record from the journal file
+
+#if HAS_BACKUP_RESUME_RECORD
+	static void WriteBackupRecord(const RestorePoint& rp, uint32_t flags);	// Save the XYZ position, file position etc. of a resume point in the backup registers
+	static bool ReadBackupRecord(RestorePoint& rp, uint32_t& flags);			// Fetch the resume point from the backup registers, returning true if it is valid
+	static void ClearBackupRecord();
+#endif
+
+private:
+	static constexpr const char* JournalFileName = "resurrect.jnl";
+	static constexpr uint32_t JournalMagic = 0x4A464652;		// "RRFJ" in little-endian order
+	static constexpr size_t SlotSize = 512;					// one sector per record
+	static constexpr size_t NumSlots = 8;
+
+	static_assert(sizeof(ResumeJournalRecord) <= SlotSize, "Resume journal record doesn't fit in a slot");
+
+	static uint32_t CalcCrc(const ResumeJournalRecord& record);
+
+#if HAS_BACKUP_RESUME_RECORD
+	// Layout of the backup registers. The first one holds the magic value, the tool number plus one and the flags.
+	enum BackupRegister : size_t { brHeader = 0, brFilePos, brX, brY, brZ, brExtruder, brFeedRate, brChecksum, NumBackupRegisters };
+	static constexpr uint32_t BackupMagic = 0x52520000;		// "RR" in the top 16 bits
+	static uint32_t BackupChecksum(const uint32_t regs[]);
+#endif
+
+	FileStore *file;
+	size_t nextSlot;
+	uint32_t nextSequenceNumber;
+};
+
+#endif
+
+#endif /* SRC_GCODES_RESUMEJOURNAL_H_ */
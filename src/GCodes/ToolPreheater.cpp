@@ -0,0 +1,222 @@
+/*
+ * ToolPreheater.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "ToolPreheater.h"
+#include "GCodeInput.h"
+#include "Platform.h"
+#include "RepRap.h"
+#include "Heating/Heat.h"
+#include "Tools/Tool.h"
+
+ToolPreheater::ToolPreheater()
+	: file(nullptr), scanPos(0), scanState(ScanState::lineStart), scannedToolNumber(0), scannedToolFilePos(0),
+	  haveNextTool(false), preheated(false), nextToolNumber(0), nextToolFilePos(0),
+	  lastSampleTime(0), lastSamplePos(0), bytesPerSecond(0.0), margin(0.0)
+{
+}
+
+// Start scanning a file that we are about to print. We don't scan binary G-code files, because T commands in them may be in binary records.
+void ToolPreheater::Start(const char *fileName)
+{
+	Stop();
+	if (margin <= 0.0 || fileName == nullptr)
+	{
+		return;
+	}
+
+	file = reprap.GetPlatform().GetMassStorage()->OpenFile(fileName, OpenMode::read, 0);
+	if (file != nullptr)
+	{
+		char signature[BinaryGCodeSignatureLength];
+		if (   file->Read(signature, BinaryGCodeSignatureLength) == (int)BinaryGCodeSignatureLength
+			&& memcmp(signature, BinaryGCodeSignature, BinaryGCodeSignatureLength) == 0
+		   )
+		{
+			Stop();
+			return;
+		}
+
+		scanPos = 0;
+		scanState = ScanState::lineStart;
+		haveNextTool = preheated = false;
+		lastSampleTime = millis();
+		lastSamplePos = 0;
+		bytesPerSecond = 0.0;
+	}
+}
+
+void ToolPreheater::Stop()
+{
+	if (file != nullptr)
+	{
+		file->Close();
+		file = nullptr;
+	}
+}
+
+// Scan a little more of the file, and preheat the next tool if it is time to. Called from the GCodes task while the file is being printed.
+void ToolPreheater::Spin(FilePosition filePos, int toolNumberAdjust)
+{
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	// Update our estimate of how fast we are getting through the file
+	const uint32_t now = millis();
+	if (now - lastSampleTime >= RateSampleInterval)
+	{
+		const float sampleRate = (filePos > lastSamplePos) ? (float)(filePos - lastSamplePos) * SecondsToMillis/(float)(now - lastSampleTime) : 0.0;
+		bytesPerSecond = (bytesPerSecond == 0.0) ? sampleRate : 0.75 * bytesPerSecond + 0.25 * sampleRate;
+		lastSampleTime = now;
+		lastSamplePos = filePos;
+	}
+
+	if (haveNextTool && filePos > nextToolFilePos)
+	{
+		haveNextTool = false;					// we have passed the T command we found, so look for the next one
+	}
+
+	if (!haveNextTool)
+	{
+		if (scanPos < filePos)
+		{
+			// We have fallen behind the print, e.g. because it was resumed part way through the file. We don't know where the line starts, so skip to the next one.
+			scanPos = filePos;
+			scanState = ScanState::restOfLine;
+		}
+		haveNextTool = ScanChunk();
+		preheated = false;
+		return;
+	}
+
+	if (!preheated && bytesPerSecond > 0.0)
+	{
+		Tool * const currentTool = reprap.GetCurrentTool();
+		Tool * const nextTool = reprap.GetTool(nextToolNumber + toolNumberAdjust);
+		if (nextTool == nullptr || nextTool == currentTool || nextTool->GetState() != ToolState::standby)
+		{
+			preheated = true;					// nothing to do, or the user has turned the tool off so we mustn't heat it
+		}
+		else if ((float)(nextToolFilePos - filePos) <= (GetHeatingTime(*nextTool) + margin) * bytesPerSecond)
+		{
+			nextTool->Preheat(currentTool);
+			preheated = true;
+		}
+	}
+}
+
+// Scan the next chunk of the file for a line that starts with a T command, optionally after a line number
+bool ToolPreheater::ScanChunk()
+{
+	char buf[ScanChunkSize];
+	const int nRead = (file->Seek(scanPos)) ? file->Read(buf, sizeof(buf)) : -1;
+	if (nRead <= 0)
+	{
+		Stop();									// end of file or read error
+		return false;
+	}
+
+	for (int i = 0; i < nRead; ++i)
+	{
+		const char c = buf[i];
+		if (c == '\n')
+		{
+			if (scanState == ScanState::toolNumber && scanPos + i > scannedToolFilePos + 1)
+			{
+				nextToolNumber = scannedToolNumber;
+				nextToolFilePos = scannedToolFilePos;
+				scanState = ScanState::lineStart;
+				scanPos += i + 1;
+				return true;
+			}
+			scanState = ScanState::lineStart;
+			continue;
+		}
+
+		switch (scanState)
+		{
+		case ScanState::lineStart:
+			if (c == 'T' || c == 't')
+			{
+				scannedToolNumber = 0;
+				scannedToolFilePos = scanPos + i;
+				scanState = ScanState::toolNumber;
+			}
+			else if (c == 'N' || c == 'n')
+			{
+				scanState = ScanState::lineNumber;
+			}
+			else if (c != ' ' && c != '\t' && c != '\r')
+			{
+				scanState = ScanState::restOfLine;
+			}
+			break;
+
+		case ScanState::lineNumber:
+			if (c == ' ' || c == '\t')
+			{
+				scanState = ScanState::lineStart;
+			}
+			else if (!isdigit(c))
+			{
+				scanState = ScanState::restOfLine;
+			}
+			break;
+
+		case ScanState::toolNumber:
+			if (isdigit(c))
+			{
+				scannedToolNumber = scannedToolNumber * 10 + (c - '0');
+			}
+			else if (scanPos + i == scannedToolFilePos + 1)
+			{
+				scanState = ScanState::restOfLine;		// T without a tool number, or T-1
+			}
+			else
+			{
+				nextToolNumber = scannedToolNumber;
+				nextToolFilePos = scannedToolFilePos;
+				scanState = ScanState::restOfLine;
+				scanPos += i + 1;
+				return true;
+			}
+			break;
+
+		case ScanState::restOfLine:
+			break;
+		}
+	}
+
+	scanPos += nRead;
+	return false;
+}
+
+// Estimate how long the tool will take to reach its active temperatures at full power, using the heater models
+/*static*/ float ToolPreheater::GetHeatingTime(const Tool& tool)
+{
+	Heat& heat = reprap.GetHeat();
+	float heatingTime = 0.0;
+	for (size_t i = 0; i < tool.HeaterCount(); ++i)
+	{
+		const int heater = tool.Heater(i);
+		const FopDt& model = heat.GetHeaterModel(heater);
+		const float currentTemperature = heat.GetTemperature(heater);
+		const float targetTemperature = tool.GetToolHeaterActiveTemperature(i);
+		if (model.IsEnabled() && targetTemperature > currentTemperature)
+		{
+			const float maxTemperature = NormalAmbientTemperature + model.GetGain() * model.GetMaxPwm();
+			const float t = (maxTemperature <= targetTemperature)
+								? MaxHeatingTime
+								: model.GetDeadTime() + model.GetTimeConstant() * logf((maxTemperature - currentTemperature)/(maxTemperature - targetTemperature));
+			heatingTime = max<float>(heatingTime, min<float>(t, MaxHeatingTime));
+		}
+	}
+	return heatingTime;
+}
+
+// End
@@ -0,0 +1,56 @@
+/*
+ * ToolPreheater.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_GCODES_TOOLPREHEATER_H_
+#define SRC_GCODES_TOOLPREHEATER_H_
+
+#include "RepRapFirmware.h"
+
+// This class reads ahead of the file being printed to find the next T command. When the print is close enough to it that the new tool's heaters
+// would only just reach their active temperatures in time, it switches them from standby to active so that the tool change doesn't have to wait.
+// How close is close enough is worked out from the heater models and the rate at which we have been getting through the file.
+class ToolPreheater
+{
+public:
+	ToolPreheater();
+
+	void Start(const char *fileName);											// Start scanning a file that we are about to print
+	void Stop();																// Stop scanning at the end of a print
+	void Spin(FilePosition filePos, int toolNumberAdjust);						// Scan a little more of the file and preheat the next tool if it is time to
+
+	float GetMargin() const { return margin; }
+	void SetMargin(float seconds) { margin = seconds; }							// a margin of zero disables preheating
+
+private:
+	static constexpr size_t ScanChunkSize = 128;								// How many bytes of the file we scan per call to Spin
+	static constexpr uint32_t RateSampleInterval = 2000;						// Milliseconds between updates to our print rate estimate
+	static constexpr float MaxHeatingTime = 300.0;								// Limit on our estimate of how long a tool takes to heat up
+
+	enum class ScanState : uint8_t { lineStart, lineNumber, toolNumber, restOfLine };
+
+	bool ScanChunk();															// Scan the next chunk of the file, returning true if we found a T command
+	static float GetHeatingTime(const Tool& tool);								// Estimate how long the tool will take to reach its active temperatures
+
+	FileStore *file;
+	FilePosition scanPos;														// where in the file we scan next
+	ScanState scanState;
+	int scannedToolNumber;														// the tool number of the T command we are scanning
+	FilePosition scannedToolFilePos;											// the file position of the T command we are scanning
+
+	bool haveNextTool;															// true if we found the next T command
+	bool preheated;																// true if we have acted on the next T command
+	int nextToolNumber;															// the tool number of the next T command, before adjustment
+	FilePosition nextToolFilePos;												// the file position of the next T command
+
+	uint32_t lastSampleTime;
+	FilePosition lastSamplePos;
+	float bytesPerSecond;														// our estimate of how fast we are getting through the file
+
+	float margin;																// how many seconds early we aim to reach the active temperatures, or zero to disable preheating
+};
+
+#endif /* SRC_GCODES_TOOLPREHEATER_H_ */
@@ -48,6 +48,7 @@ extern uint32_t _nocache_ram_end;
 #endif
 
 static bool enabled = false;
+static uint32_t invalidateCount = 0;
 
 void Cache::Init()
 {
@@ -80,10 +81,14 @@ void Cache::Init()
 			ARM_MPU_RASR_EX(1u, ARM_MPU_AP_FULL, ARM_MPU_ACCESS_ORDERED, 0, ARM_MPU_REGION_SIZE_64KB)
 		},
 		// RAMFUNC memory. Read-only (the code has already been written to it), execution allowed. The initialised data memory follows, so it must be RW.
-		// 256 bytes is enough at present (check the linker memory map if adding more RAMFUNCs).
+		// 256 bytes is enough at present (check the linker memory map if adding more RAMFUNCs). The step ISR code needs more when it runs from RAM.
 		{
 			ARM_MPU_RBAR(4, IRAM_ADDR + 0x00010000),
+#  if SUPPORT_RAM_STEP_ISR
+			ARM_MPU_RASR_EX(0u, ARM_MPU_AP_FULL, ARM_MPU_ACCESS_NORMAL(ARM_MPU_CACHEP_WB_WRA, ARM_MPU_CACHEP_WB_WRA, 1u), 0u, ARM_MPU_REGION_SIZE_16KB)
+#  else
 			ARM_MPU_RASR_EX(0u, ARM_MPU_AP_FULL, ARM_MPU_ACCESS_NORMAL(ARM_MPU_CACHEP_WB_WRA, ARM_MPU_CACHEP_WB_WRA, 1u), 0u, ARM_MPU_REGION_SIZE_256B)
+#  endif
 		},
 		// Peripherals
 		{
@@ -182,6 +187,7 @@ void Cache::Invalidate(const volatile void *start, size_t length)
 {
 	if (enabled)
 	{
+		++invalidateCount;
 #if SAME70
 		// We assume that the DMA buffer is entirely inside or entirely outside the non-cached RAM area
 		if (start < (void*)&_nocache_ram_start || start >= (void*)&_nocache_ram_end)
@@ -206,6 +212,13 @@ uint32_t Cache::GetHitCount()
 
 #endif
 
+uint32_t Cache::GetInvalidateCount()
+{
+	const uint32_t ret = invalidateCount;
+	invalidateCount = 0;
+	return ret;
+}
+
 #endif
 
 // Entry points that can be called from ASF C code
@@ -25,6 +25,7 @@ namespace Cache
 #if SAM4E
 	uint32_t GetHitCount();
 #endif
+	uint32_t GetInvalidateCount();			// return the number of invalidations since the last call, on the SAM4E each one discards the whole cache
 };
 
 // Entry points that can be called from ASF C code
@@ -48,6 +49,7 @@ inline void Cache::Enable() {}
 inline void Cache::Disable() {}
 inline void Cache::Flush(const volatile void *start, size_t length) {}
 inline void Cache::Invalidate(const volatile void *start, size_t length) {}
+inline uint32_t Cache::GetInvalidateCount() { return 0; }
 
 #endif
 
@@ -6,45 +6,134 @@
  *
  * The purpose of this module is to service the DMA Complete interrupt from the XDMAC on the SAME70
  * and route the interrupts caused by the various DMA channels to the corresponding drivers.
+ * It also hands out the channels that are not hard coded in the pins file to drivers that ask for one, and keeps usage counts for M122.
  */
 
 #include "DmacManager.h"
+#include "Cache.h"
+#include "Platform.h"
+#include "RepRap.h"
 
 #if SAME70
 
+constexpr size_t NumDmaChannels = XDMACCHID_NUMBER;
+static_assert(NumDmaChannelsUsed <= NumDmaChannels, "Too many fixed DMA channels");
+
+void DmaDescriptor::Init(const volatile void *src, volatile void *dst, uint32_t length, DmaDescriptor *next)
+{
+	nextDescriptor = reinterpret_cast<uint32_t>(next);
+	microblockControl = XDMAC_UBC_UBLEN(length) | XDMAC_UBC_NVIEW_NDV1 | XDMAC_UBC_NSEN_UPDATED | XDMAC_UBC_NDEN_UPDATED
+						| ((next != nullptr) ? XDMAC_UBC_NDE_FETCH_EN : XDMAC_UBC_NDE_FETCH_DIS);
+	sourceAddress = reinterpret_cast<uint32_t>(src);
+	destinationAddress = reinterpret_cast<uint32_t>(dst);
+}
+
 namespace DmacManager
 {
-	static StandardCallbackFunction callbackFunctions[NumDmaChannelsUsed] = { 0 };
-	static CallbackParameter callbackParameters[NumDmaChannelsUsed];
+	static StandardCallbackFunction callbackFunctions[NumDmaChannels] = { 0 };
+	static CallbackParameter callbackParameters[NumDmaChannels];
+	static const char *channelOwners[NumDmaChannels] = { 0 };
+	static uint32_t transferCounts[NumDmaChannels] = { 0 };
+	static volatile uint32_t interruptCounts[NumDmaChannels] = { 0 };
 
 	void Init()
 	{
 		pmc_enable_periph_clk(ID_XDMAC);
-		for (unsigned int i = 0; i < NumDmaChannelsUsed; ++i)
+		for (unsigned int i = 0; i < NumDmaChannels; ++i)
 		{
 			XDMAC->XDMAC_CHID[i].XDMAC_CID = 0xFFFFFFFF;	// disable all XDMAC interrupts from the channel
 		}
+		for (unsigned int i = 0; i < NumDmaChannelsUsed; ++i)
+		{
+			channelOwners[i] = "fixed";
+		}
 		NVIC_EnableIRQ(XDMAC_IRQn);
 	}
 
 	void SetInterruptCallback(const uint8_t channel, StandardCallbackFunction fn, CallbackParameter param)
 	{
-		if (channel < NumDmaChannelsUsed)
+		if (channel < NumDmaChannels)
 		{
 			callbackFunctions[channel] = fn;
 			callbackParameters[channel] = param;
 		}
 	}
+
+	uint8_t AllocateChannel(const char *owner)
+	{
+		const irqflags_t flags = cpu_irq_save();
+		for (size_t i = NumDmaChannelsUsed; i < NumDmaChannels; ++i)
+		{
+			if (channelOwners[i] == nullptr)
+			{
+				channelOwners[i] = owner;
+				cpu_irq_restore(flags);
+				transferCounts[i] = interruptCounts[i] = 0;
+				return i;
+			}
+		}
+		cpu_irq_restore(flags);
+		return NoDmaChannel;
+	}
+
+	void ReleaseChannel(uint8_t channel)
+	{
+		if (channel >= NumDmaChannelsUsed && channel < NumDmaChannels)
+		{
+			xdmac_channel_disable(XDMAC, channel);
+			XDMAC->XDMAC_GID = 1u << channel;
+			XDMAC->XDMAC_CHID[channel].XDMAC_CID = 0xFFFFFFFF;
+			callbackFunctions[channel] = nullptr;
+			channelOwners[channel] = nullptr;
+		}
+	}
+
+	void StartLinkedTransfer(uint8_t channel, uint32_t config, const DmaDescriptor *first)
+	{
+		// The XDMAC fetches the descriptors from memory, so make sure that they are not still sitting in the cache
+		for (const DmaDescriptor *d = first; ; d = reinterpret_cast<const DmaDescriptor*>(d->nextDescriptor))
+		{
+			Cache::FlushBeforeDMASend(d, sizeof(DmaDescriptor));
+			if ((d->microblockControl & XDMAC_UBC_NDE) == 0)
+			{
+				break;
+			}
+		}
+
+		(void)XDMAC->XDMAC_CHID[channel].XDMAC_CIS;			// clear any pending status
+		XDMAC->XDMAC_CHID[channel].XDMAC_CC = config;
+		XDMAC->XDMAC_CHID[channel].XDMAC_CNDA = reinterpret_cast<uint32_t>(first);
+		XDMAC->XDMAC_CHID[channel].XDMAC_CNDC = XDMAC_CNDC_NDE_DSCR_FETCH_EN | XDMAC_CNDC_NDVIEW_NDV1 | XDMAC_CNDC_NDSUP_SRC_PARAMS_UPDATED | XDMAC_CNDC_NDDUP_DST_PARAMS_UPDATED;
+		XDMAC->XDMAC_CHID[channel].XDMAC_CBC = 0;
+		XDMAC->XDMAC_CHID[channel].XDMAC_CDS_MSP = 0;
+		XDMAC->XDMAC_CHID[channel].XDMAC_CSUS = 0;
+		XDMAC->XDMAC_CHID[channel].XDMAC_CDUS = 0;
+		++transferCounts[channel];
+		xdmac_channel_enable(XDMAC, channel);
+	}
+
+	void Diagnostics(MessageType mtype)
+	{
+		Platform& p = reprap.GetPlatform();
+		for (size_t i = 0; i < NumDmaChannels; ++i)
+		{
+			if (channelOwners[i] != nullptr)
+			{
+				p.MessageF(mtype, "DMA channel %u (%s): transfers %" PRIu32 ", interrupts %" PRIu32 "\n", (unsigned int)i, channelOwners[i], transferCounts[i], interruptCounts[i]);
+			}
+		}
+	}
 }
 
 // DMAC interrupt service routine
 extern "C" void XDMAC_Handler()
 {
 	uint32_t pendingChannels = XDMAC->XDMAC_GIS;
-	for (size_t i = 0; i < NumDmaChannelsUsed; ++i)
+	for (size_t i = 0; i < NumDmaChannels && pendingChannels != 0; ++i)
 	{
 		if ((pendingChannels & 1u) != 0)
 		{
+			++DmacManager::interruptCounts[i];
 			if (DmacManager::callbackFunctions[i] != nullptr)
 			{
 				DmacManager::callbackFunctions[i](DmacManager::callbackParameters[i]);	// we rely on the callback to clear the interrupt
@@ -72,10 +72,33 @@ enum class DmaTrigSource : uint32_t
 
 static_assert((uint32_t)DmaTrigSource::numPeripheralIds == 52, "Error in peripheral ID table");
 
+constexpr uint8_t NoDmaChannel = 0xFF;
+
+// Linked list descriptor in the XDMAC view 1 format, which holds both the source and the destination address
+struct DmaDescriptor
+{
+	uint32_t nextDescriptor;				// address of the next descriptor, ignored in the last one
+	uint32_t microblockControl;				// the microblock length in data units and the XDMAC_UBC flags that say how to fetch the next descriptor
+	uint32_t sourceAddress;
+	uint32_t destinationAddress;
+
+	void Init(const volatile void *src, volatile void *dst, uint32_t length, DmaDescriptor *next);
+};
+
 namespace DmacManager
 {
 	void Init();
 	void SetInterruptCallback(const uint8_t channel, StandardCallbackFunction fn, CallbackParameter param);
+
+	// Dynamic channels. The channels below NumDmaChannelsUsed are hard coded in the pins file and are never allocated.
+	uint8_t AllocateChannel(const char *owner);		// return the channel allocated, or NoDmaChannel if they are all in use
+	void ReleaseChannel(uint8_t channel);
+
+	// Start a transfer on an allocated channel that runs through a chain of descriptors, which must stay valid until the transfer has completed.
+	// The config argument is the value for the channel configuration register.
+	void StartLinkedTransfer(uint8_t channel, uint32_t config, const DmaDescriptor *first);
+
+	void Diagnostics(MessageType mtype);
 }
 
 #endif
@@ -25,6 +25,10 @@ void IoPort::Clear()
 	logicalPort = NoLogicalPin;
 	pin = NoPin;
 	invert = false;
+#ifndef __LPC17xx__
+	pio = nullptr;
+	pinMask = setMask = clearMask = 0;
+#endif
 }
 
 bool IoPort::Set(LogicalPin lp, PinAccess access, bool pInvert)
@@ -36,6 +40,27 @@ bool IoPort::Set(LogicalPin lp, PinAccess access, bool pInvert)
 		{
 			invert = !invert;
 		}
+
+#ifndef __LPC17xx__
+		// Look up the PIO controller and bit mask now, so that we don't need to do it every time we write to the port
+# ifdef DUET_NG
+		const bool isDirect = (pin < DueXnExpansionStart);
+# else
+		const bool isDirect = true;
+# endif
+		if (isDirect && pin != NoPin)
+		{
+			const PinDescription& pinDesc = g_APinDescription[pin];
+			pio = pinDesc.pPort;
+			pinMask = pinDesc.ulPin;
+			setMask = (invert) ? 0 : pinMask;
+			clearMask = (invert) ? pinMask : 0;
+		}
+		else
+		{
+			pio = nullptr;
+		}
+#endif
 	}
 	else
 	{
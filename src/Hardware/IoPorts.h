@@ -29,7 +29,13 @@ public:
 
 	LogicalPin GetLogicalPin() const { return logicalPort; }
 	LogicalPin GetLogicalPin(bool& pInvert) const { pInvert = invert; return logicalPort; }
-	void WriteDigital(bool high) const { if (pin != NoPin) { WriteDigital(pin, (invert) ? !high : high); } }
+	void WriteDigital(bool high) const;
+
+	// Fast access for time-critical code. FastSet and FastClear set the port to its active and inactive states respectively, taking account of inversion.
+	// They must only be called if HasFastAccess returns true, which it does if the pin is connected directly to the processor.
+	bool HasFastAccess() const;
+	void FastSet() const;
+	void FastClear() const;
 
 	// Low level port access
 	static void SetPinMode(Pin p, PinMode mode);
@@ -41,8 +47,64 @@ protected:
 	LogicalPin logicalPort;
 	Pin pin;
 	bool invert;
+#ifndef __LPC17xx__
+	Pio *pio;									// the PIO controller for the pin if it is connected directly to the processor, else nullptr
+	uint32_t pinMask;							// the bit in the PIO registers for the pin
+	uint32_t setMask, clearMask;				// the bits to write to the set and clear registers to make the port active, taking account of inversion
+#endif
 };
 
+inline bool IoPort::HasFastAccess() const
+{
+#ifndef __LPC17xx__
+	return pio != nullptr;
+#else
+	return false;
+#endif
+}
+
+inline void IoPort::FastSet() const
+{
+#ifndef __LPC17xx__
+	pio->PIO_SODR = setMask;
+	pio->PIO_CODR = clearMask;
+#else
+	WriteDigital(true);
+#endif
+}
+
+inline void IoPort::FastClear() const
+{
+#ifndef __LPC17xx__
+	pio->PIO_SODR = clearMask;
+	pio->PIO_CODR = setMask;
+#else
+	WriteDigital(false);
+#endif
+}
+
+inline void IoPort::WriteDigital(bool high) const
+{
+#ifndef __LPC17xx__
+	if (pio != nullptr)
+	{
+		if (high)
+		{
+			FastSet();
+		}
+		else
+		{
+			FastClear();
+		}
+		return;
+	}
+#endif
+	if (pin != NoPin)
+	{
+		WriteDigital(pin, (invert) ? !high : high);
+	}
+}
+
 // Class to represent a PWM output port
 class PwmPort : public IoPort
 {
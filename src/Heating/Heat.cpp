@@ -23,14 +23,21 @@ Licence: GPL
 #include "Platform.h"
 #include "RepRap.h"
 #include "Sensors/TemperatureSensor.h"
+#include "Tools/Tool.h"
+#include "Movement/StepTimer.h"
 
 #if SUPPORT_DHT_SENSOR
 # include "Sensors/DhtSensor.h"
 #endif
 
+#if SUPPORT_CAN_EXPANSION
+# include "Sensors/RemoteSensor.h"
+#endif
+
 #ifdef RTOS
 
 # include "Tasks.h"
+# include "Sensors/SpiTemperatureSensor.h"
 
 constexpr uint32_t HeaterTaskStackWords = 400;			// task stack size in dwords, must be large enough for auto tuning
 static Task<HeaterTaskStackWords> heaterTask;
@@ -43,12 +50,18 @@ extern "C" void HeaterTask(void * pvParameters)
 #endif
 
 Heat::Heat(Platform& p)
-	: platform(p),
+	: platform(p), longestSpinTime(0), numSpins(0),
 #ifndef RTOS
 	  active(false),
 #endif
-	  coldExtrude(false), heaterBeingTuned(-1), lastHeaterTuned(-1)
+	  coldExtrude(false), heatersBeingTuned(0), lastHeaterTuned(-1), powerBudget(0.0)
 {
+	for (size_t heater = 0; heater < NumHeaters; ++heater)
+	{
+		heaterPowers[heater] = requestedPowers[heater] = powerWeights[heater] = 0.0;
+		heaterPriorities[heater] = 1.0;
+	}
+
 	ARRAY_INIT(bedHeaters, DefaultBedHeaters);
 	ARRAY_INIT(chamberHeaters, DefaultChamberHeaters);
 
@@ -72,11 +85,11 @@ void Heat::ResetHeaterModels()
 		{
 			if (IsBedOrChamberHeater(heater))
 			{
-				pids[heater]->SetModel(DefaultBedHeaterGain, DefaultBedHeaterTimeConstant, DefaultBedHeaterDeadTime, 1.0, 0.0, false, false, 0);
+				pids[heater]->SetModel(DefaultBedHeaterGain, DefaultBedHeaterTimeConstant, DefaultBedHeaterDeadTime, 1.0, 0.0, false, false, 0, true);
 			}
 			else
 			{
-				pids[heater]->SetModel(DefaultHotEndHeaterGain, DefaultHotEndHeaterTimeConstant, DefaultHotEndHeaterDeadTime, 1.0, 0.0, true, false, 0);
+				pids[heater]->SetModel(DefaultHotEndHeaterGain, DefaultHotEndHeaterTimeConstant, DefaultHotEndHeaterDeadTime, 1.0, 0.0, true, false, 0, true);
 			}
 		}
 	}
@@ -122,6 +135,7 @@ void Heat::Init()
 			pids[heater]->Init(DefaultHotEndHeaterGain, DefaultHotEndHeaterTimeConstant, DefaultHotEndHeaterDeadTime, true, false);
 		}
 #endif
+		nextSpinTimes[heater] = millis();			// flag the PID as due for spinning
 		lastStandbyTools[heater] = nullptr;
 	}
 
@@ -144,6 +158,11 @@ void Heat::Init()
 #endif
 #endif
 
+#ifdef RTOS
+	// Initialise static fields of the SPI sensors, which are read by their own task
+	SpiTemperatureSensor::InitStatic();
+#endif
+
 #if SUPPORT_DHT_SENSOR
 	// Initialise static fields of the DHT sensor
 	DhtSensorHardwareInterface::InitStatic();
@@ -156,7 +175,7 @@ void Heat::Init()
 #ifdef RTOS
 	heaterTask.Create(HeaterTask, "HEAT", nullptr, TaskPriority::HeatPriority);
 #else
-	lastTime = millis() - HeatSampleIntervalMillis;		// flag the PIDS as due for spinning
+	nextSpinTime = millis();
 	active = true;
 #endif
 }
@@ -179,25 +198,13 @@ void Heat::Exit()
 
 void Heat::Task()
 {
-	lastWakeTime = xTaskGetTickCount();
 	for (;;)
 	{
-		for (PID *& p : pids)
-		{
-			p->Spin();
-		}
-
-		// See if we have finished tuning a PID
-		if (heaterBeingTuned != -1 && !pids[heaterBeingTuned]->IsTuning())
-		{
-			lastHeaterTuned = heaterBeingTuned;
-			heaterBeingTuned = -1;
-		}
-
+		const uint32_t delayTime = SpinDuePids(millis());
 		reprap.KickHeatTaskWatchdog();
 
-		// Delay until it is time again
-		vTaskDelayUntil(&lastWakeTime, HeatSampleIntervalMillis);
+		// Delay until the next PID is due
+		delay(delayTime);
 	}
 }
 
@@ -209,20 +216,9 @@ void Heat::Spin()
 	{
 		// See if it is time to spin the PIDs
 		const uint32_t now = millis();
-		if (now - lastTime >= HeatSampleIntervalMillis)
+		if ((int32_t)(now - nextSpinTime) >= 0)
 		{
-			lastTime = now;
-			for (PID *& p : pids)
-			{
-				p->Spin();
-			}
-
-			// See if we have finished tuning a PID
-			if (heaterBeingTuned != -1 && !pids[heaterBeingTuned]->IsTuning())
-			{
-				lastHeaterTuned = heaterBeingTuned;
-				heaterBeingTuned = -1;
-			}
+			nextSpinTime = now + SpinDuePids(now);
 		}
 
 #if SUPPORT_DHT_SENSOR
@@ -234,6 +230,68 @@ void Heat::Spin()
 
 #endif
 
+// Spin the PIDs that are due. Each one runs at its own sample interval, so slow heaters such as beds don't use CPU time that fast hot ends need.
+// We keep each PID on its schedule even if we wake up a little late, unless it has fallen a whole interval behind.
+// We return how long it is until the next PID is due, which is never more than the default sample interval so that we still check tuning regularly.
+uint32_t Heat::SpinDuePids(uint32_t now)
+{
+	const uint32_t startClocks = StepTimer::GetInterruptClocks();
+	bool spunAny = false;
+	uint32_t timeToNextSpin = HeatSampleIntervalMillis;
+	for (size_t heater : ARRAY_INDICES(pids))
+	{
+		int32_t timeToDue = (int32_t)(nextSpinTimes[heater] - now);
+		if (timeToDue <= 0)
+		{
+			spunAny = true;
+			PID * const p = pids[heater];
+			p->Spin();
+			const uint32_t interval = p->GetSampleInterval();
+			nextSpinTimes[heater] = ((uint32_t)(-timeToDue) >= interval) ? now + interval : nextSpinTimes[heater] + interval;
+			timeToDue = (int32_t)(nextSpinTimes[heater] - now);
+		}
+		timeToNextSpin = min<uint32_t>(timeToNextSpin, (uint32_t)timeToDue);
+	}
+
+	// See if we have finished tuning any PIDs
+	for (size_t heater = 0; heater < NumHeaters; ++heater)
+	{
+		if (IsBitSet(heatersBeingTuned, heater) && !pids[heater]->IsTuning())
+		{
+			lastHeaterTuned = (int8_t)heater;
+			ClearBit(heatersBeingTuned, heater);
+		}
+	}
+
+	if (spunAny)
+	{
+		++numSpins;
+		const uint32_t spinTime = StepTimer::GetInterruptClocks() - startClocks;
+		if (spinTime > longestSpinTime)
+		{
+			longestSpinTime = spinTime;
+		}
+	}
+	return timeToNextSpin;
+}
+
+// Tell the heaters of a tool the average extrusion speed of a move that has just been prepared and how long it is until the move ends.
+// This is called by the Move task, so we only store the speed and leave the PIDs to use it when they next spin.
+void Heat::SetExtrusionSpeed(const Tool *tool, float speed, uint32_t durationMillis)
+{
+	if (tool != nullptr)
+	{
+		for (size_t i = 0; i < tool->HeaterCount(); ++i)
+		{
+			const int heater = tool->Heater(i);
+			if (heater >= 0 && heater < (int)NumHeaters)
+			{
+				pids[heater]->SetExtrusionSpeed(speed, durationMillis);
+			}
+		}
+	}
+}
+
 void Heat::Diagnostics(MessageType mtype)
 {
 	platform.Message(mtype, "=== Heat ===\nBed heaters =");
@@ -247,6 +305,8 @@ void Heat::Diagnostics(MessageType mtype)
 		platform.MessageF(mtype, " %d", chamberHeater);
 	}
 	platform.Message(mtype, "\n");
+	platform.MessageF(mtype, "Longest PID spin %.2fms\n", (double)(longestSpinTime * StepTimer::StepClocksToMillis));
+	longestSpinTime = 0;
 
 	for (size_t heater : ARRAY_INDICES(pids))
 	{
@@ -485,17 +545,124 @@ bool Heat::IsBedOrChamberHeater(int8_t heater) const
 }
 
 // Auto tune a PID
-void Heat::StartAutoTune(size_t heater, float temperature, float maxPwm, const StringRef& reply)
+// Limit the PWM of a heater so that the total power drawn by all the heaters doesn't exceed the power budget. This is called by each PID when it is spun.
+// 'error' is how far the heater is below its target temperature. We share the power between the heaters that want it in proportion to their priorities and errors,
+// so a cold heater gets more than one that is nearly at temperature. A heater that needs less than its share gets what it needs and the rest is shared among the others.
+// Heaters being tuned get the power they ask for, because tuning relies on knowing the PWM.
+float Heat::LimitHeaterPwm(size_t heater, float pwm, float error, bool isTuning)
+{
+	float fullPower = heaterPowers[heater];
+#if HAS_VOLTAGE_MONITOR
+	// The power is rated at the voltage that the heater model was tuned at, so allow for the supply voltage being different
+	const float modelVoltage = pids[heater]->GetModel().GetVoltage();
+	const float currentVoltage = platform.GetCurrentPowerVoltage();
+	if (modelVoltage >= 10.0 && currentVoltage >= 10.0)
+	{
+		fullPower *= fsquare(currentVoltage/modelVoltage);
+	}
+#endif
+	requestedPowers[heater] = pwm * fullPower;
+	powerWeights[heater] = (isTuning) ? 0.0 : heaterPriorities[heater] * max<float>(error, 1.0);
+	if (powerBudget <= 0.0 || requestedPowers[heater] <= 0.0 || isTuning)
+	{
+		return pwm;
+	}
+
+	// Take off the power used by the heaters that get all they ask for
+	float available = powerBudget;
+	uint32_t sharing = 0;
+	for (size_t h = 0; h < NumHeaters; ++h)
+	{
+		if (requestedPowers[h] > 0.0)
+		{
+			if (powerWeights[h] > 0.0)
+			{
+				SetBit(sharing, h);
+			}
+			else
+			{
+				available -= requestedPowers[h];
+			}
+		}
+	}
+
+	// Share out the rest. Each pass either satisfies at least one more heater or finishes.
+	for (;;)
+	{
+		float totalWeight = 0.0;
+		for (size_t h = 0; h < NumHeaters; ++h)
+		{
+			if (IsBitSet(sharing, h))
+			{
+				totalWeight += powerWeights[h];
+			}
+		}
+
+		const float powerPerWeight = max<float>(available, 0.0)/totalWeight;
+		if (requestedPowers[heater] > powerPerWeight * powerWeights[heater])
+		{
+			// This heater can't have all it wants. See if any other heaters need less than their share, in which case we can give this one more.
+			float satisfiedPower = 0.0;
+			uint32_t satisfied = 0;
+			for (size_t h = 0; h < NumHeaters; ++h)
+			{
+				if (IsBitSet(sharing, h) && requestedPowers[h] <= powerPerWeight * powerWeights[h])
+				{
+					satisfiedPower += requestedPowers[h];
+					SetBit(satisfied, h);
+				}
+			}
+			if (satisfied == 0)
+			{
+				return pwm * powerPerWeight * powerWeights[heater]/requestedPowers[heater];
+			}
+			available -= satisfiedPower;
+			sharing &= ~satisfied;
+		}
+		else
+		{
+			return pwm;
+		}
+	}
+}
+
+// Several heaters may be tuned at the same time, but we limit how many so that we don't exceed the power supply capacity
+void Heat::StartAutoTune(size_t heater, float temperature, float maxPwm, bool useRelay, const StringRef& reply)
 {
-	if (heaterBeingTuned == -1)
+	if (IsBitSet(heatersBeingTuned, heater))
 	{
-		heaterBeingTuned = (int8_t)heater;
-		pids[heater]->StartAutoTune(temperature, maxPwm, reply);
+		reply.printf("Error: heater %u is already being tuned", heater);
+		return;
+	}
+
+	unsigned int numBeingTuned = 0, numBedOrChamberBeingTuned = 0;
+	for (size_t h = 0; h < NumHeaters; ++h)
+	{
+		if (IsBitSet(heatersBeingTuned, h))
+		{
+			++numBeingTuned;
+			if (IsBedOrChamberHeater(h))
+			{
+				++numBedOrChamberBeingTuned;
+			}
+		}
+	}
+
+	if (numBeingTuned >= MaxHeatersTunedAtOnce)
+	{
+		reply.printf("Error: cannot start auto tuning heater %u because %u heaters are being tuned", heater, numBeingTuned);
+	}
+	else if (IsBedOrChamberHeater(heater) && numBedOrChamberBeingTuned >= MaxBedOrChamberHeatersTunedAtOnce)
+	{
+		reply.printf("Error: cannot start auto tuning heater %u because another bed or chamber heater is being tuned", heater);
 	}
 	else
 	{
-		// Trying to start a new auto tune, but we are already tuning a heater
-		reply.printf("Error: cannot start auto tuning heater %u because heater %d is being tuned", heater, heaterBeingTuned);
+		pids[heater]->StartAutoTune(temperature, maxPwm, useRelay, reply);
+		if (pids[heater]->IsTuning())
+		{
+			SetBit(heatersBeingTuned, heater);
+		}
 	}
 }
 
@@ -506,10 +673,25 @@ bool Heat::IsTuning(size_t heater) const
 
 void Heat::GetAutoTuneStatus(const StringRef& reply) const
 {
-	int8_t whichPid = (heaterBeingTuned == -1) ? lastHeaterTuned : heaterBeingTuned;
-	if (whichPid != -1)
+	if (heatersBeingTuned != 0)
 	{
-		pids[whichPid]->GetAutoTuneStatus(reply);
+		reply.Clear();
+		for (size_t heater = 0; heater < NumHeaters; ++heater)
+		{
+			if (IsBitSet(heatersBeingTuned, heater))
+			{
+				if (!reply.IsEmpty())
+				{
+					reply.cat('\n');
+				}
+				pids[heater]->GetAutoTuneStatus(reply);
+			}
+		}
+	}
+	else if (lastHeaterTuned != -1)
+	{
+		reply.Clear();
+		pids[lastHeaterTuned]->GetAutoTuneStatus(reply);
 	}
 	else
 	{
@@ -580,6 +762,22 @@ bool Heat::SetHeaterChannel(size_t heater, int channel)
 
 	delete *spp;			// release the old sensor object, if any
 	*spp = sp;
+
+#if SUPPORT_CAN_EXPANSION
+	// A heater that uses a sensor on an expansion board is controlled by that board, using the heater with the same number as the sensor
+	if (heater < NumHeaters)
+	{
+		if (RemoteSensor::IsRemoteChannel(channel))
+		{
+			const RemoteSensor * const rs = static_cast<const RemoteSensor*>(sp);
+			pids[heater]->SetRemote(rs->GetBoard(), rs->GetSensorNumber());
+		}
+		else
+		{
+			pids[heater]->SetRemote(-1, 0);
+		}
+	}
+#endif
 	return false;
 }
 
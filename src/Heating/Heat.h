@@ -87,6 +87,8 @@ public:
 	bool HeaterAtSetTemperature(int8_t heater, bool waitWhenCooling, float tolerance) const;
 																// Is a specific heater at temperature within tolerance?
 	void Diagnostics(MessageType mtype);						// Output useful information
+	uint32_t GetLongestSpinClocks() const { return longestSpinTime; }	// The longest time spinning the PIDs took since we last reported diagnostics
+	uint32_t GetNumSpins() const { return numSpins; }			// How many times we have spun the PIDs
 
 	float GetAveragePWM(size_t heater) const					// Return the running average PWM to the heater as a fraction in [0, 1].
 	pre(heater < NumHeaters);
@@ -96,13 +98,13 @@ public:
 	uint32_t GetLastSampleTime(size_t heater) const
 	pre(heater < NumHeaters);
 
-	void StartAutoTune(size_t heater, float temperature, float maxPwm, const StringRef& reply) // Auto tune a PID
+	void StartAutoTune(size_t heater, float temperature, float maxPwm, bool useRelay, const StringRef& reply) // Auto tune a PID
 	pre(heater < NumHeaters);
 
 	bool IsTuning(size_t heater) const							// Return true if the specified heater is auto tuning
 	pre(heater < NumHeaters);
 
-	void GetAutoTuneStatus(const StringRef& reply) const;		// Get the status of the current or last auto tune
+	void GetAutoTuneStatus(const StringRef& reply) const;		// Get the status of the current auto tunes or the last one
 
 	const FopDt& GetHeaterModel(size_t heater) const			// Get the process model for the specified heater
 	pre(heater < NumHeaters);
@@ -122,6 +124,29 @@ public:
 	void SetFaultDetectionParameters(size_t heater, float maxTempExcursion, float maxFaultTime)
 	pre(heater < NumHeaters);
 
+	uint32_t GetSampleInterval(size_t heater) const				// Get the sample and control interval of a heater in milliseconds
+	pre(heater < NumHeaters);
+
+	float GetExtrusionFeedForward(size_t heater) const			// Get the extra PWM a heater adds per mm/sec of extrusion
+	pre(heater < NumHeaters);
+
+	void SetExtrusionFeedForward(size_t heater, float pwmPerMmPerSec)	// Set the extra PWM a heater adds per mm/sec of extrusion
+	pre(heater < NumHeaters);
+
+	void SetExtrusionSpeed(const Tool *tool, float speed, uint32_t durationMillis);	// Tell the heaters of a tool how fast it is about to extrude
+
+	void SetSampleInterval(size_t heater, uint32_t interval)	// Set the sample and control interval of a heater
+	pre(heater < NumHeaters);
+
+	float GetPowerBudget() const { return powerBudget; }		// Get the total power in watts that the heaters may draw, or 0 if unlimited
+	void SetPowerBudget(float watts) { powerBudget = max<float>(watts, 0.0); }
+	void GetHeaterPowerRating(size_t heater, float& watts, float& priority) const	// Get the full power of a heater and its priority when sharing the power budget
+	pre(heater < NumHeaters);
+	void SetHeaterPowerRating(size_t heater, float watts, float priority)	// Set the full power of a heater and its priority when sharing the power budget
+	pre(heater < NumHeaters);
+	float LimitHeaterPwm(size_t heater, float pwm, float error, bool isTuning)	// Reduce the PWM of a heater if necessary to keep within the power budget
+	pre(heater < NumHeaters);
+
 	bool IsHeaterEnabled(size_t heater) const					// Is this heater enabled?
 	pre(heater < NumHeaters);
 
@@ -160,6 +185,7 @@ private:
 
 	TemperatureSensor **GetSensor(size_t heater);				// Get a pointer to the temperature sensor entry
 	TemperatureSensor * const *GetSensor(size_t heater) const;	// Get a pointer to the temperature sensor entry
+	uint32_t SpinDuePids(uint32_t now);							// Spin the PIDs that are due and return how long until the next one is due
 
 	Platform& platform;											// The instance of the RepRap hardware class
 
@@ -170,11 +196,12 @@ private:
 
 	TemperatureSensor *heaterSensors[NumHeaters];				// The sensor used by the real heaters
 	TemperatureSensor *virtualHeaterSensors[MaxVirtualHeaters];	// Sensors for virtual heaters
+	uint32_t nextSpinTimes[NumHeaters];							// When each PID is next due to be spun
+	uint32_t longestSpinTime;									// The longest time in step clocks that SpinDuePids took since we last reported it
+	uint32_t numSpins;											// How many times SpinDuePids has spun any PIDs
 
-#ifdef RTOS
-	uint32_t lastWakeTime;
-#else
-	uint32_t lastTime;											// The last time our Spin() was called
+#ifndef RTOS
+	uint32_t nextSpinTime;										// When our Spin() next needs to spin a PID
 	bool active;												// Are we active?
 #endif
 
@@ -183,8 +210,15 @@ private:
 	bool coldExtrude;											// Is cold extrusion allowed?
 	int8_t bedHeaters[NumBedHeaters];							// Indices of the hot bed heaters to use or -1 if none is available
 	int8_t chamberHeaters[NumChamberHeaters];					// Indices of the chamber heaters to use or -1 if none is available
-	int8_t heaterBeingTuned;									// which PID is currently being tuned
+	uint32_t heatersBeingTuned;									// bitmap of the PIDs that are currently being tuned
 	int8_t lastHeaterTuned;										// which PID we last finished tuning
+
+	// Power budget
+	float powerBudget;											// the total power in watts that the heaters may draw, or 0 if unlimited
+	float heaterPowers[NumHeaters];								// the power of each heater in watts at full PWM and the model voltage, or 0 if not known
+	float heaterPriorities[NumHeaters];							// how much weight we give to each heater when sharing out the power budget
+	float requestedPowers[NumHeaters];							// the power that each heater asked for when it was last spun
+	float powerWeights[NumHeaters];								// the weight of each heater's request, or 0 if it must get all the power it asks for
 };
 
 //***********************************************************************************************************
@@ -267,4 +301,36 @@ inline void Heat::SetFaultDetectionParameters(size_t heater, float maxTempExcurs
 	pids[heater]->SetFaultDetectionParameters(maxTempExcursion, maxFaultTime);
 }
 
+inline uint32_t Heat::GetSampleInterval(size_t heater) const
+{
+	return pids[heater]->GetSampleInterval();
+}
+
+inline float Heat::GetExtrusionFeedForward(size_t heater) const
+{
+	return pids[heater]->GetExtrusionFeedForward();
+}
+
+inline void Heat::SetExtrusionFeedForward(size_t heater, float pwmPerMmPerSec)
+{
+	pids[heater]->SetExtrusionFeedForward(pwmPerMmPerSec);
+}
+
+inline void Heat::GetHeaterPowerRating(size_t heater, float& watts, float& priority) const
+{
+	watts = heaterPowers[heater];
+	priority = heaterPriorities[heater];
+}
+
+inline void Heat::SetHeaterPowerRating(size_t heater, float watts, float priority)
+{
+	heaterPowers[heater] = max<float>(watts, 0.0);
+	heaterPriorities[heater] = max<float>(priority, 0.01);
+}
+
+inline void Heat::SetSampleInterval(size_t heater, uint32_t interval)
+{
+	pids[heater]->SetSampleInterval(constrain<uint32_t>(interval, MinHeatSampleIntervalMillis, MaxHeatSampleIntervalMillis));
+}
+
 #endif
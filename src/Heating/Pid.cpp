@@ -12,47 +12,47 @@
 #include "Platform.h"
 #include "RepRap.h"
 
+#if SUPPORT_CAN_EXPANSION
+# include "CAN/CanInterface.h"
+# include "CAN/CanMessageFormats.h"
+#endif
+
 // Private constants
 const uint32_t InitialTuningReadingInterval = 250;	// the initial reading interval in milliseconds
 const uint32_t TempSettleTimeout = 20000;	// how long we allow the initial temperature to settle
-
-// Static class variables
-
-float *PID::tuningTempReadings = nullptr;	// the readings from the heater being tuned
-float PID::tuningStartTemp;					// the temperature when we turned on the heater
-float PID::tuningPwm;						// the PWM to use
-float PID::tuningTargetTemp;				// the maximum temperature we are allowed to reach
-uint32_t PID::tuningBeginTime;				// when we started the tuning process
-uint32_t PID::tuningPhaseStartTime;			// when we started the current tuning phase
-uint32_t PID::tuningReadingInterval;		// how often we are sampling
-size_t PID::tuningReadingsTaken;			// how many samples we have taken
-
-float PID::tuningHeaterOffTemp;				// the temperature when we turned the heater off
-float PID::tuningPeakTemperature;			// the peak temperature reached, averaged over 3 readings (so slightly less than the true peak)
-uint32_t PID::tuningHeatingTime;			// how long we had the heating on for
-uint32_t PID::tuningPeakDelay;				// how many milliseconds the temperature continues to rise after turning the heater off
-
-#if HAS_VOLTAGE_MONITOR
-unsigned int voltageSamplesTaken;			// how many readings we accumulated
-float tuningVoltageAccumulator;				// sum of the voltage readings we take during the heating phase
-#endif
+const float MinRelayHysteresis = 2.0;		// the minimum difference between the temperatures at which we switch the heater off and on when relay tuning
+const float RelayHysteresisFraction = 0.05;	// the relay hysteresis as a fraction of the temperature rise
+const float MinRelayTemperatureRise = 20.0;	// the minimum difference between the starting and target temperatures when relay tuning
 
 // Member functions and constructors
 
-PID::PID(Platform& p, int8_t h) : platform(p), heaterProtection(nullptr), heater(h), mode(HeaterMode::off), invertPwmSignal(false)
+PID::PID(Platform& p, int8_t h) : platform(p), heaterProtection(nullptr), heater(h), mode(HeaterMode::off), invertPwmSignal(false),
+#if SUPPORT_CAN_EXPANSION
+	remoteBoard(-1), remoteHeater(0), remoteModelPending(false), remoteResetPending(false), remoteOn(false), remoteSetpoint(0.0), whenRemoteSetpointSent(0),
+#endif
+	tuning(nullptr)
 {
 }
 
+// Set the local heater output. Remote heaters have no local output, the expansion board drives them.
 inline void PID::SetHeater(float power) const
 {
-	platform.SetHeater(heater, invertPwmSignal ? (1.0 - power) : power, model.GetPwmFrequency());
+	if (!IsRemote())
+	{
+		platform.SetHeater(heater, invertPwmSignal ? (1.0 - power) : power, model.GetPwmFrequency());
+	}
 }
 
 void PID::Init(float pGain, float pTc, float pTd, bool usePid, bool inverted)
 {
 	maxTempExcursion = DefaultMaxTempExcursion;
 	maxHeatingFaultTime = DefaultMaxHeatingFaultTime;
+	sampleIntervalMillis = HeatSampleIntervalMillis;
+	extrusionFeedForward = 0.0;
+	extrusionSpeed = 0.0;
+	extrusionSpeedEndTime = millis();
 	model.SetParameters(pGain, pTc, pTd, 1.0, GetHighestTemperatureLimit(), 0.0, usePid, inverted, 0);
+	modelConfigured = false;
 	Reset();
 
 	SetHeater(0.0);							// set up the pin even if the heater is not enabled (for PCCB)
@@ -74,17 +74,22 @@ void PID::Reset()
 	active = false; 						// default to standby temperature
 	tuned = false;
 	averagePWM = lastPwm = 0.0;
-	heatingFaultCount = 0;
+	heatingFaultCount = modelFaultCount = 0;
 	temperature = BadErrorTemperature;
+	predictedTemperature = temperature;
+	delayedPwm = extraHeatLoss = 0.0;
 }
 
 // Set the process model
-bool PID::SetModel(float gain, float tc, float td, float maxPwm, float voltage, bool usePid, bool inverted, PwmFrequency pwmFreq)
+bool PID::SetModel(float gain, float tc, float td, float maxPwm, float voltage, bool usePid, bool inverted, PwmFrequency pwmFreq, bool isDefault)
 {
 	const float temperatureLimit = GetHighestTemperatureLimit();
 	const bool rslt = model.SetParameters(gain, tc, td, maxPwm, temperatureLimit, voltage, usePid, inverted, pwmFreq);
 	if (rslt)
 	{
+		modelConfigured = !isDefault;
+		modelFaultCount = 0;
+		RemoteModelChanged();
 #if defined(DUET_06_085)
 		if (heater == NumHeaters - 1)
 		{
@@ -153,7 +158,7 @@ void PID::SwitchOn()
 						: HeaterMode::stable;
 			if (mode != oldMode)
 			{
-				heatingFaultCount = 0;
+				heatingFaultCount = modelFaultCount = 0;
 				if (mode == HeaterMode::heating)
 				{
 					timeSetHeating = millis();
@@ -167,7 +172,7 @@ void PID::SwitchOn()
 	}
 }
 
-// Switch off the specified heater. If in tuning mode, delete the array used to store tuning temperature readings.
+// Switch off the specified heater. If in tuning mode, delete the tuning data.
 void PID::SwitchOff()
 {
 	lastPwm = 0.0;
@@ -176,8 +181,8 @@ void PID::SwitchOff()
 		SetHeater(0.0);
 		if (IsTuning())
 		{
-			delete tuningTempReadings;
-			tuningTempReadings = nullptr;
+			delete tuning;
+			tuning = nullptr;
 		}
 		if (mode > HeaterMode::off)
 		{
@@ -190,37 +195,51 @@ void PID::SwitchOff()
 	}
 }
 
+// Count a bad temperature reading. Errors may be temporary and correct themselves after a few more readings, so we only raise a fault if they persist.
+void PID::HandleBadReading(TemperatureError err)
+{
+	if (mode > HeaterMode::suspended)					// don't worry about errors when reading heaters that are switched off or flagged as having faults
+	{
+		badTemperatureCount++;
+		if (badTemperatureCount * sampleIntervalMillis > MaxBadTemperatureCount * HeatSampleIntervalMillis)	// allow the same time as at the default sample rate
+		{
+			lastPwm = 0.0;
+			SetHeater(0.0);								// do this here just to be sure, in case the call to platform.Message causes a delay
+			if (IsTuning())
+			{
+				delete tuning;
+				tuning = nullptr;
+			}
+			mode = HeaterMode::fault;
+			reprap.GetGCodes().HandleHeaterFault(heater);
+			platform.MessageF(ErrorMessage, "Temperature reading fault on heater %d: %s\n", heater, TemperatureErrorString(err));
+			reprap.FlagTemperatureFault(heater);
+		}
+	}
+}
+
 // This is the main heater control loop function
 void PID::Spin()
 {
+#if SUPPORT_CAN_EXPANSION
+	if (IsRemote())
+	{
+		SpinRemote();
+		return;
+	}
+#endif
+
 	if (model.IsEnabled())
 	{
 		// Read the temperature even if the heater is suspended
 		const TemperatureError err = ReadTemperature();
+		float powerError = 0.0;							// how far we are below the target temperature, used to share out the power budget
 
 		// Handle any temperature reading error and calculate the temperature rate of change, if possible
 		if (err != TemperatureError::success)
 		{
 			previousTemperaturesGood <<= 1;				// this reading isn't a good one
-			if (mode > HeaterMode::suspended)			// don't worry about errors when reading heaters that are switched off or flagged as having faults
-			{
-				// Error may be a temporary error and may correct itself after a few additional reads
-				badTemperatureCount++;
-				if (badTemperatureCount > MaxBadTemperatureCount)
-				{
-					lastPwm = 0.0;
-					SetHeater(0.0);						// do this here just to be sure, in case the call to platform.Message causes a delay
-					if (IsTuning())
-					{
-						delete tuningTempReadings;
-						tuningTempReadings = nullptr;
-					}
-					mode = HeaterMode::fault;
-					reprap.GetGCodes().HandleHeaterFault(heater);
-					platform.MessageF(ErrorMessage, "Temperature reading fault on heater %d: %s\n", heater, TemperatureErrorString(err));
-					reprap.FlagTemperatureFault(heater);
-				}
-			}
+			HandleBadReading(err);
 			// We leave lastPWM alone if we have a temporary temperature reading error
 		}
 		else
@@ -231,7 +250,7 @@ void PID::Spin()
 			badTemperatureCount = 0;
 			if ((previousTemperaturesGood & (1 << (NumPreviousTemperatures - 1))) != 0)
 			{
-				const float tentativeDerivative = ((float)SecondsToMillis/HeatSampleIntervalMillis) * (temperature - previousTemperatures[previousTemperatureIndex])
+				const float tentativeDerivative = ((float)SecondsToMillis/sampleIntervalMillis) * (temperature - previousTemperatures[previousTemperatureIndex])
 								/ (float)(NumPreviousTemperatures);
 				// Some sensors give occasional temperature spikes. We don't expect the temperature to increase by more than 10C/second.
 				if (fabsf(tentativeDerivative) <= 10.0)
@@ -246,6 +265,18 @@ void PID::Spin()
 			// Get the target temperature and the error
 			const float targetTemperature = (active) ? activeTemperature : standbyTemperature;
 			const float error = targetTemperature - temperature;
+			powerError = error;
+
+			// Update the temperature that the model predicts from the power we have been applying, and see how far the measured temperature is from it
+			float predictionError = 0.0;
+			if (mode > HeaterMode::suspended && mode < HeaterMode::tuning0)
+			{
+				predictionError = UpdatePrediction();
+			}
+			else
+			{
+				ResetPrediction();
+			}
 
 			// Do the heating checks
 			switch(mode)
@@ -264,7 +295,7 @@ void PID::Spin()
 							&& (float)(millis() - timeSetHeating) > model.GetDeadTime() * SecondsToMillis * 2)
 						{
 							++heatingFaultCount;
-							if (heatingFaultCount * HeatSampleIntervalMillis > maxHeatingFaultTime * SecondsToMillis)
+							if (heatingFaultCount * sampleIntervalMillis > maxHeatingFaultTime * SecondsToMillis)
 							{
 								SetHeater(0.0);					// do this here just to be sure
 								mode = HeaterMode::fault;
@@ -290,7 +321,7 @@ void PID::Spin()
 				if (fabsf(error) > maxTempExcursion && temperature > MaxAmbientTemperature)
 				{
 					++heatingFaultCount;
-					if (heatingFaultCount * HeatSampleIntervalMillis > maxHeatingFaultTime * SecondsToMillis)
+					if (heatingFaultCount * sampleIntervalMillis > maxHeatingFaultTime * SecondsToMillis)
 					{
 						SetHeater(0.0);					// do this here just to be sure
 						mode = HeaterMode::fault;
@@ -312,17 +343,40 @@ void PID::Spin()
 					mode = HeaterMode::stable;
 					heatingFaultCount = 0;
 				}
-				else
-				{
-					// We could check for temperature excessive or not falling here, but without an alarm or a power-off mechanism, there is not much we can do
-					// TODO emergency stop?
-				}
 				break;
 
 			default:		// this covers off, fault, suspended, and the auto tuning states
 				break;
 			}
 
+			// The checks above are the backstop. In addition, if the model has been configured, check that the temperature is following the trajectory
+			// that the model predicts. Gradual changes in heat loss such as a cooling fan starting are absorbed by the prediction, but a heater or sensor
+			// that has come loose, or a heater that is stuck on, makes the temperature depart from it faster. We allow for the model being slightly out
+			// at the start of heating in the same way as the heating rate check does.
+			if (   modelConfigured
+				&& mode > HeaterMode::suspended && mode < HeaterMode::tuning0
+				&& (mode != HeaterMode::heating || (float)(millis() - timeSetHeating) > model.GetDeadTime() * SecondsToMillis * 2)
+			   )
+			{
+				if (fabsf(predictionError) > maxTempExcursion)
+				{
+					++modelFaultCount;
+					if (modelFaultCount * sampleIntervalMillis > maxHeatingFaultTime * SecondsToMillis)
+					{
+						SetHeater(0.0);					// do this here just to be sure
+						mode = HeaterMode::fault;
+						reprap.GetGCodes().HandleHeaterFault(heater);
+						platform.MessageF(ErrorMessage, "Heating fault on heater %d, temperature %.1f" DEGREE_SYMBOL "C differs from the predicted %.1f" DEGREE_SYMBOL "C by more than %.1f" DEGREE_SYMBOL "C\n",
+											heater, (double)temperature, (double)predictedTemperature, (double)maxTempExcursion);
+						reprap.FlagTemperatureFault(heater);
+					}
+				}
+				else if (modelFaultCount != 0)
+				{
+					--modelFaultCount;
+				}
+			}
+
 			// Calculate the PWM
 			if (mode <= HeaterMode::suspended)
 			{
@@ -337,9 +391,15 @@ void PID::Spin()
 					const bool inLoadMode = (mode == HeaterMode::stable) || fabsf(error) < 3.0;		// use standard PID when maintaining temperature
 					const PidParameters& params = model.GetPidParameters(inLoadMode);
 
+					// Add the feedforward power for the extrusion that is about to happen, so that we don't wait for the temperature to drop before we respond to it.
+					// We include it with the P and D terms, so that a high extrusion rate doesn't wind up the I term.
+					const float feedForward = (extrusionFeedForward > 0.0 && (int32_t)(extrusionSpeedEndTime - millis()) > 0)
+												? extrusionFeedForward * extrusionSpeed
+													: 0.0;
+
 					// If the P and D terms together demand that the heater is full on or full off, disregard the I term
 					const float errorMinusDterm = error - (params.tD * derivative);
-					const float pPlusD = params.kP * errorMinusDterm;
+					const float pPlusD = params.kP * errorMinusDterm + feedForward;
 					const float expectedPwm = constrain<float>((temperature - NormalAmbientTemperature)/model.GetGain(), 0.0, model.GetMaxPwm());
 					if (pPlusD + expectedPwm > model.GetMaxPwm())
 					{
@@ -358,7 +418,7 @@ void PID::Spin()
 					{
 						const float errorToUse = error;
 						iAccumulator = constrain<float>
-										(iAccumulator + (errorToUse * params.kP * params.recipTi * HeatSampleIntervalMillis * MillisToSeconds),
+										(iAccumulator + (errorToUse * params.kP * params.recipTi * sampleIntervalMillis * MillisToSeconds),
 											0.0, model.GetMaxPwm());
 						lastPwm = constrain<float>(pPlusD + iAccumulator, 0.0, model.GetMaxPwm());
 					}
@@ -420,9 +480,10 @@ void PID::Spin()
 			}
 		}
 
-		// Set the heater power and update the average PWM
+		// Keep the total power drawn by the heaters within the power budget, then set the heater power and update the average PWM
+		lastPwm = reprap.GetHeat().LimitHeaterPwm(heater, lastPwm, powerError, IsTuning());
 		SetHeater(lastPwm);
-		averagePWM = averagePWM * (1.0 - HeatSampleIntervalMillis/(HeatPwmAverageTime * SecondsToMillis)) + lastPwm;
+		averagePWM = averagePWM * (1.0 - sampleIntervalMillis/(HeatPwmAverageTime * SecondsToMillis)) + lastPwm;
 		previousTemperatureIndex = (previousTemperatureIndex + 1) % NumPreviousTemperatures;
 
 		// For temperature sensors which do not require frequent sampling and averaging,
@@ -517,6 +578,9 @@ bool PID::CheckProtection() const
 void PID::ResetFault()
 {
 	badTemperatureCount = 0;
+#if SUPPORT_CAN_EXPANSION
+	remoteResetPending = IsRemote();
+#endif
 	if (mode == HeaterMode::fault)
 	{
 		mode = HeaterMode::off;
@@ -526,7 +590,52 @@ void PID::ResetFault()
 
 float PID::GetAveragePWM() const
 {
-	return averagePWM * HeatSampleIntervalMillis/(HeatPwmAverageTime * SecondsToMillis);
+	return averagePWM * sampleIntervalMillis/(HeatPwmAverageTime * SecondsToMillis);
+}
+
+// Record the extrusion speed of a move that is about to start and how long it is until it ends
+void PID::SetExtrusionSpeed(float speed, uint32_t durationMillis)
+{
+	extrusionSpeed = speed;
+	extrusionSpeedEndTime = millis() + durationMillis;
+}
+
+// Set the sample and control interval. The average PWM is a sum of samples, so rescale it to keep the same average.
+void PID::SetSampleInterval(uint32_t interval)
+{
+	averagePWM = averagePWM * sampleIntervalMillis/interval;
+	sampleIntervalMillis = interval;
+}
+
+// Tuning readings are taken no more often than at the default sample rate, and no more often than Spin is called
+uint32_t PID::GetInitialTuningReadingInterval() const
+{
+	return max<uint32_t>(sampleIntervalMillis, HeatSampleIntervalMillis);
+}
+
+// Return the power that the heater is delivering as a fraction of the power it delivers at full PWM and the voltage it was tuned at
+float PID::GetEffectivePwm() const
+{
+	float pwm = (model.IsInverted()) ? model.GetMaxPwm() - lastPwm : lastPwm;
+#if HAS_VOLTAGE_MONITOR
+	if (model.GetVoltage() >= 10.0 && !reprap.GetHeat().IsBedOrChamberHeater(heater))
+	{
+		const float currentVoltage = platform.GetCurrentPowerVoltage();
+		if (currentVoltage >= 10.0)
+		{
+			pwm *= fsquare(currentVoltage/model.GetVoltage());
+		}
+	}
+#endif
+	return pwm;
+}
+
+// Start predicting the temperature again from the current one
+void PID::ResetPrediction()
+{
+	predictedTemperature = temperature;
+	delayedPwm = GetEffectivePwm();
+	extraHeatLoss = 0.0;
 }
 
 // Get a conservative estimate of the expected heating rate at the current temperature and average PWM. The result may be negative.
@@ -540,14 +649,38 @@ float PID::GetExpectedHeatingRate() const
 			: 0.0;
 }
 
+// Advance the predicted temperature by one sample interval using the model, and return how far the measured temperature is above it.
+// The power we applied reaches the sensor after the dead time, which we approximate by a first order lag.
+// The prediction is corrected towards the measured temperature with a time constant about equal to the model time constant, and we estimate
+// the extra heat loss that the model doesn't know about at the same rate. This makes the observer critically damped, so that a step change in
+// heat loss that would change the steady temperature by dT makes the measured temperature depart from the prediction by at most 0.37 * dT.
+float PID::UpdatePrediction()
+{
+	const float interval = sampleIntervalMillis * MillisToSeconds;
+	const float gain = model.GetGain();
+	const float timeConstant = model.GetTimeConstant();
+	delayedPwm += (GetEffectivePwm() - delayedPwm) * min<float>(interval/model.GetDeadTime(), 1.0);
+	predictedTemperature += (gain * (delayedPwm - extraHeatLoss) + NormalAmbientTemperature - predictedTemperature) * interval/timeConstant;
+
+	const float predictionError = temperature - predictedTemperature;
+	const float correctionFactor = min<float>(interval/timeConstant, 1.0);
+	predictedTemperature += predictionError * correctionFactor;
+	extraHeatLoss -= (predictionError/gain) * correctionFactor;
+	return predictionError;
+}
+
 // Auto tune this PID
-void PID::StartAutoTune(float targetTemp, float maxPwm, const StringRef& reply)
+void PID::StartAutoTune(float targetTemp, float maxPwm, bool useRelay, const StringRef& reply)
 {
 	// Starting an auto tune
 	if (!model.IsEnabled())
 	{
 		reply.printf("Error: heater %d cannot be auto tuned while it is disabled", heater);
 	}
+	else if (IsRemote())
+	{
+		reply.printf("Error: heater %d is on an expansion board, so it can't be auto tuned from the main board", heater);
+	}
 	else if (lastPwm > 0.0 || GetAveragePWM() > 0.02)
 	{
 		reply.printf("Error: heater %d must be off and cold before auto tuning it", heater);
@@ -559,40 +692,50 @@ void PID::StartAutoTune(float targetTemp, float maxPwm, const StringRef& reply)
 		{
 			reply.printf("Error: heater %d reported error '%s' at start of auto tuning", heater, TemperatureErrorString(err));
 		}
+		else if (useRelay && targetTemp < temperature + MinRelayTemperatureRise)
+		{
+			reply.printf("Error: target temperature must be at least %.0f" DEGREE_SYMBOL "C above the current temperature for relay tuning", (double)MinRelayTemperatureRise);
+		}
 		else
 		{
+			// We don't normally allow dynamic memory allocation when running. However, auto tuning is rarely done and it
+			// would be wasteful to allocate permanent storage for each heater just in case we are going to run it, so we make an exception here.
+			tuning = new TuningData;
 			mode = HeaterMode::tuning0;
-			tuningReadingsTaken = 0;
+			tuning->readingsTaken = 0;
 			tuned = false;					// assume failure
-
-			// We don't normally allow dynamic memory allocation when running. However, auto tuning is rarely done and it
-			// would be wasteful to allocate a permanent array just in case we are going to run it, so we make an exception here.
-			tuningTempReadings = new float[MaxTuningTempReadings];
-			tuningTempReadings[0] = temperature;
-			tuningReadingInterval = HeatSampleIntervalMillis;
-			tuningPwm = maxPwm;
-			tuningTargetTemp = targetTemp;
-			reply.printf("Auto tuning heater %d using target temperature %.1f" DEGREE_SYMBOL "C and PWM %.2f - do not leave printer unattended", heater, (double)targetTemp, (double)maxPwm);
+			tuning->readings[0] = temperature;
+			tuning->readingInterval = GetInitialTuningReadingInterval();
+			tuning->pwm = maxPwm;
+			tuning->targetTemp = targetTemp;
+			tuning->useRelay = useRelay;
+			reply.printf("Auto tuning heater %d using target temperature %.1f" DEGREE_SYMBOL "C and PWM %.2f%s - do not leave printer unattended",
+							heater, (double)targetTemp, (double)maxPwm, (useRelay) ? " with relay feedback" : "");
 		}
 	}
 }
 
-void PID::GetAutoTuneStatus(const StringRef& reply)	// Get the auto tune status or last result
+void PID::GetAutoTuneStatus(const StringRef& reply)	// Append the auto tune status or last result
 {
-	if (mode >= HeaterMode::tuning0)
+	if (mode == HeaterMode::tuningRelay)
 	{
-		reply.printf("Heater %d is being tuned, phase %u of %u",
+		reply.catf("Heater %d is being tuned, relay cycle %u of %u",
+						heater, (unsigned int)tuning->relayCycles + 1, (unsigned int)(RelayCyclesToIgnore + RelayCyclesToMeasure));
+	}
+	else if (mode >= HeaterMode::tuning0)
+	{
+		reply.catf("Heater %d is being tuned, phase %u of %u",
 						heater,
 						(unsigned int)mode - (unsigned int)HeaterMode::tuning0 + 1,
 						(unsigned int)HeaterMode::lastTuningMode - (unsigned int)HeaterMode::tuning0 + 1);
 	}
 	else if (tuned)
 	{
-		reply.printf("Heater %d tuning succeeded, use M307 H%d to see result", heater, heater);
+		reply.catf("Heater %d tuning succeeded, use M307 H%d to see result", heater, heater);
 	}
 	else
 	{
-		reply.printf("Heater %d tuning failed", heater);
+		reply.catf("Heater %d tuning failed", heater);
 	}
 }
 
@@ -639,62 +782,81 @@ void PID::GetAutoTuneStatus(const StringRef& reply)	// Get the auto tune status
  *     Kc = (1.086/G) * (td/tc)^-0.869
  *     Ti = tc/(0.74 - 0.13 * td/tc)
  *     Td = 0.348 * tc * (td/tc)^0.914
+ *
+ * Waiting for a bed to cool down in step 4 can take a long time, so M303 R1 selects relay feedback tuning instead. Steps 1 to 3 are the same,
+ * then when the temperature reaches the target Th we use the heater as a relay: we turn it off at Th and back on when the temperature falls to Tl.
+ * Because of the dead time, the temperature continues to rise to Tmax after we turn the heater off and continues to fall to Tmin after we turn it on.
+ * After a few cycles we average the times and temperatures, then if T0 is the starting temperature and p is the tuning PWM the model says that:
+ *  (Tmin - T0) = (Tl - T0) * exp(-td/tc)								because the temperature decays towards T0 for td after we turn the heater on
+ *  toff = td + tc * ln((Tmax - T0)/(Tl - T0))							where toff is the time for which the heater was off
+ *  G * p - (Tmax - T0) = (G * p - (Th - T0)) * exp(-td/tc)				because the temperature rises towards T0 + G * p for td after we turn it off
+ * which we solve for G, tc and td. We only store four values per cycle, so this needs much less of the readings buffer.
  */
 
 // This is called on each temperature sample when auto tuning
 // It must set lastPWM to the required PWM, unless it is the same as last time.
 void PID::DoTuningStep()
 {
+	// Relay tuning looks at every sample and doesn't store them
+	if (mode == HeaterMode::tuningRelay)
+	{
+		if (!DoRelayTuningStep())
+		{
+			SwitchOff();						// sets mode and lastPWM, also deletes the tuning data
+		}
+		return;
+	}
+
 	// See if another sample is due
-	if (tuningReadingsTaken == 0)
+	if (tuning->readingsTaken == 0)
 	{
-		tuningPhaseStartTime = millis();
+		tuning->phaseStartTime = millis();
 		if (mode == HeaterMode::tuning0)
 		{
-			tuningBeginTime = tuningPhaseStartTime;
+			tuning->beginTime = tuning->phaseStartTime;
 		}
 	}
-	else if (millis() - tuningPhaseStartTime < tuningReadingsTaken * tuningReadingInterval)
+	else if (millis() - tuning->phaseStartTime < tuning->readingsTaken * tuning->readingInterval)
 	{
 		return;		// not due yet
 	}
 
 	// See if we have room to store the new reading, and if not, double the sample interval
-	if (tuningReadingsTaken == MaxTuningTempReadings)
+	if (tuning->readingsTaken == MaxTuningTempReadings)
 	{
 		// Double the sample interval
-		tuningReadingsTaken /= 2;
-		for (size_t i = 1; i < tuningReadingsTaken; ++i)
+		tuning->readingsTaken /= 2;
+		for (size_t i = 1; i < tuning->readingsTaken; ++i)
 		{
-			tuningTempReadings[i] = tuningTempReadings[i * 2];
+			tuning->readings[i] = tuning->readings[i * 2];
 		}
-		tuningReadingInterval *= 2;
+		tuning->readingInterval *= 2;
 	}
 
-	tuningTempReadings[tuningReadingsTaken] = temperature;
-	++tuningReadingsTaken;
+	tuning->readings[tuning->readingsTaken] = temperature;
+	++tuning->readingsTaken;
 
 	switch(mode)
 	{
 	case HeaterMode::tuning0:
 		// Waiting for initial temperature to settle after any thermostatic fans have turned on
-		if (ReadingsStable(6000/HeatSampleIntervalMillis, 2.0))			// expect temperature to be stable within a 2C band for 6 seconds
+		if (ReadingsStable(6000/tuning->readingInterval, 2.0))			// expect temperature to be stable within a 2C band for 6 seconds
 		{
 			// Starting temperature is stable, so move on
-			tuningReadingsTaken = 1;
+			tuning->readingsTaken = 1;
 #if HAS_VOLTAGE_MONITOR
-			tuningVoltageAccumulator = 0.0;
-			voltageSamplesTaken = 0;
+			tuning->voltageAccumulator = 0.0;
+			tuning->voltageSamplesTaken = 0;
 #endif
-			tuningTempReadings[0] = tuningStartTemp = temperature;
-			timeSetHeating = tuningPhaseStartTime = millis();
-			lastPwm = tuningPwm;										// turn on heater at specified power
-			tuningReadingInterval = HeatSampleIntervalMillis;			// reset sampling interval
+			tuning->readings[0] = tuning->startTemp = temperature;
+			timeSetHeating = tuning->phaseStartTime = millis();
+			lastPwm = tuning->pwm;										// turn on heater at specified power
+			tuning->readingInterval = GetInitialTuningReadingInterval();			// reset sampling interval
 			mode = HeaterMode::tuning1;
 			platform.Message(GenericMessage, "Auto tune phase 1, heater on\n");
 			return;
 		}
-		if (millis() - tuningPhaseStartTime < 20000)
+		if (millis() - tuning->phaseStartTime < 20000)
 		{
 			// Allow up to 20 seconds for starting temperature to settle
 			return;
@@ -706,9 +868,9 @@ void PID::DoTuningStep()
 		// Heating up
 		{
 			const bool isBedOrChamberHeater = reprap.GetHeat().IsBedOrChamberHeater(heater);
-			const uint32_t heatingTime = millis() - tuningPhaseStartTime;
+			const uint32_t heatingTime = millis() - tuning->phaseStartTime;
 			const float extraTimeAllowed = (isBedOrChamberHeater) ? 60.0 : 30.0;
-			if (heatingTime > (uint32_t)((model.GetDeadTime() + extraTimeAllowed) * SecondsToMillis) && (temperature - tuningStartTemp) < 3.0)
+			if (heatingTime > (uint32_t)((model.GetDeadTime() + extraTimeAllowed) * SecondsToMillis) && (temperature - tuning->startTemp) < 3.0)
 			{
 				platform.Message(GenericMessage, "Auto tune cancelled because temperature is not increasing\n");
 				break;
@@ -722,18 +884,34 @@ void PID::DoTuningStep()
 			}
 
 #if HAS_VOLTAGE_MONITOR
-			tuningVoltageAccumulator += platform.GetCurrentPowerVoltage();
-			++voltageSamplesTaken;
+			tuning->voltageAccumulator += platform.GetCurrentPowerVoltage();
+			++tuning->voltageSamplesTaken;
 #endif
-			if (temperature >= tuningTargetTemp)							// if reached target
+			if (temperature >= tuning->targetTemp)							// if reached target
 			{
-				tuningHeatingTime = heatingTime;
+				tuning->heatingTime = heatingTime;
+
+				if (tuning->useRelay)
+				{
+					// Start relay tuning with the heater off
+					const float hysteresis = max<float>((tuning->targetTemp - tuning->startTemp) * RelayHysteresisFraction, MinRelayHysteresis);
+					tuning->relayLowTemp = tuning->targetTemp - hysteresis;
+					tuning->relayExtremeTemp = temperature;
+					tuning->relaySwitchTime = millis();
+					tuning->relayCycles = 0;
+					mode = HeaterMode::tuningRelay;
+					lastPwm = 0.0;
+					SetHeater(0.0);
+					platform.MessageF(GenericMessage, "Auto tune phase 2, relay cycling between %.1f and %.1f" DEGREE_SYMBOL "C\n",
+										(double)tuning->relayLowTemp, (double)tuning->targetTemp);
+					return;
+				}
 
 				// Move on to next phase
-				tuningReadingsTaken = 1;
-				tuningHeaterOffTemp = tuningTempReadings[0] = temperature;
-				tuningPhaseStartTime = millis();
-				tuningReadingInterval = HeatSampleIntervalMillis;			// reset sampling interval
+				tuning->readingsTaken = 1;
+				tuning->heaterOffTemp = tuning->readings[0] = temperature;
+				tuning->phaseStartTime = millis();
+				tuning->readingInterval = GetInitialTuningReadingInterval();			// reset sampling interval
 				mode = HeaterMode::tuning2;
 				lastPwm = 0.0;
 				SetHeater(0.0);
@@ -748,7 +926,7 @@ void PID::DoTuningStep()
 			const int peakIndex = GetPeakTempIndex();
 			if (peakIndex < 0)
 			{
-				if (millis() - tuningPhaseStartTime < 60 * 1000)			// allow 1 minute for the bed temperature reach peak temperature
+				if (millis() - tuning->phaseStartTime < 60 * 1000)			// allow 1 minute for the bed temperature reach peak temperature
 				{
 					return;			// still waiting for peak temperature
 				}
@@ -764,16 +942,16 @@ void PID::DoTuningStep()
 			}
 			else
 			{
-				tuningPeakTemperature = tuningTempReadings[peakIndex];
-				tuningPeakDelay = peakIndex * tuningReadingInterval;
+				tuning->peakTemperature = tuning->readings[peakIndex];
+				tuning->peakDelay = peakIndex * tuning->readingInterval;
 
 				// Move on to next phase
-				tuningReadingsTaken = 1;
-				tuningTempReadings[0] = temperature;
-				tuningPhaseStartTime = millis();
-				tuningReadingInterval = HeatSampleIntervalMillis;			// reset sampling interval
+				tuning->readingsTaken = 1;
+				tuning->readings[0] = temperature;
+				tuning->phaseStartTime = millis();
+				tuning->readingInterval = GetInitialTuningReadingInterval();			// reset sampling interval
 				mode = HeaterMode::tuning3;
-				platform.MessageF(GenericMessage, "Auto tune phase 3, peak temperature was %.1f\n", (double)tuningPeakTemperature);
+				platform.MessageF(GenericMessage, "Auto tune phase 3, peak temperature was %.1f\n", (double)tuning->peakTemperature);
 				return;
 			}
 		}
@@ -785,7 +963,7 @@ void PID::DoTuningStep()
 			// In the case of a bed that shows a reservoir effect, the choice of how far we wait for it to cool down will effect the result.
 			// If we wait for it to cool down by 50% then we get a short time constant and a low gain, which causes overshoot. So try a bit more.
 			const float coolDownProportion = 0.6;
-			if (temperature > (tuningTempReadings[0] * (1.0 - coolDownProportion)) + (tuningStartTemp * coolDownProportion))
+			if (temperature > (tuning->readings[0] * (1.0 - coolDownProportion)) + (tuning->startTemp * coolDownProportion))
 			{
 				return;
 			}
@@ -799,22 +977,22 @@ void PID::DoTuningStep()
 	}
 
 	// If we get here, we have finished
-	SwitchOff();								// sets mode and lastPWM, also deletes tuningTempReadings
+	SwitchOff();								// sets mode and lastPWM, also deletes the tuning data
 }
 
 // Return true if the last 'numReadings' readings are stable
-/*static*/ bool PID::ReadingsStable(size_t numReadings, float maxDiff)
+bool PID::ReadingsStable(size_t numReadings, float maxDiff) const
 {
-	if (tuningTempReadings == nullptr || tuningReadingsTaken < numReadings)
+	if (tuning == nullptr || tuning->readingsTaken < numReadings)
 	{
 		return false;
 	}
 
-	float minReading = tuningTempReadings[tuningReadingsTaken - numReadings];
+	float minReading = tuning->readings[tuning->readingsTaken - numReadings];
 	float maxReading = minReading;
-	for (size_t i = tuningReadingsTaken - numReadings + 1; i < tuningReadingsTaken; ++i)
+	for (size_t i = tuning->readingsTaken - numReadings + 1; i < tuning->readingsTaken; ++i)
 	{
-		const float t = tuningTempReadings[i];
+		const float t = tuning->readings[i];
 		if (t < minReading) { minReading = t; }
 		if (t > maxReading) { maxReading = t; }
 	}
@@ -825,10 +1003,10 @@ void PID::DoTuningStep()
 // Calculate which reading gave us the peak temperature.
 // Return -1 if peak not identified yet, 0 if we are never going to find a peak, else the index of the peak
 // If the readings show a continuous decrease then we return 1, because zero dead time would lead to infinities
-/*static*/ int PID::GetPeakTempIndex()
+int PID::GetPeakTempIndex() const
 {
 	// Check we have enough readings to look for the peak
-	if (tuningReadingsTaken < 15)
+	if (tuning->readingsTaken < 15)
 	{
 		return -1;							// too few readings
 	}
@@ -853,22 +1031,22 @@ void PID::DoTuningStep()
 	}
 
 	// If we have found one peak and it's not too near the end of the readings, return it
-	return ((size_t)peakIndex + 3 < tuningReadingsTaken) ? max<int>(peakIndex, 1) : -1;
+	return ((size_t)peakIndex + 3 < tuning->readingsTaken) ? max<int>(peakIndex, 1) : -1;
 }
 
 // See if there is exactly one peak in the readings.
 // Return -1 if more than one peak, else the index of the peak. The so-called peak may be right at the end, in which case it isn't really a peak.
 // With a well-insulated bed heater the temperature may not start dropping appreciably within the 120 second time limit allowed.
-/*static*/ int PID::IdentifyPeak(size_t numToAverage)
+int PID::IdentifyPeak(size_t numToAverage) const
 {
 	int firstPeakIndex = -1, lastSameIndex = -1;
 	float peakTempTimesN = -999.0;
-	for (size_t i = 0; i + numToAverage <= tuningReadingsTaken; ++i)
+	for (size_t i = 0; i + numToAverage <= tuning->readingsTaken; ++i)
 	{
 		float peak = 0.0;
 		for (size_t j = 0; j < numToAverage; ++j)
 		{
-			peak += tuningTempReadings[i + j];
+			peak += tuning->readings[i + j];
 		}
 		if (peak > peakTempTimesN)
 		{
@@ -897,21 +1075,27 @@ void PID::CalculateModel()
 	{
 		DisplayBuffer("At completion");
 	}
-	const float tc = (float)((tuningReadingsTaken - 1) * tuningReadingInterval)
-						/(1000.0 * logf((tuningTempReadings[0] - tuningStartTemp)/(tuningTempReadings[tuningReadingsTaken - 1] - tuningStartTemp)));
-	const float heatingTime = (tuningHeatingTime - tuningPeakDelay) * 0.001;
-	const float gain = (tuningHeaterOffTemp - tuningStartTemp)/(1.0 - expf(-heatingTime/tc));
+	const float tc = (float)((tuning->readingsTaken - 1) * tuning->readingInterval)
+						/(1000.0 * logf((tuning->readings[0] - tuning->startTemp)/(tuning->readings[tuning->readingsTaken - 1] - tuning->startTemp)));
+	const float heatingTime = (tuning->heatingTime - tuning->peakDelay) * 0.001;
+	const float gain = (tuning->heaterOffTemp - tuning->startTemp)/(1.0 - expf(-heatingTime/tc));
 
 	// There are two ways of calculating the dead time:
 	// 1. Based on the delay to peak temperature after we turned the heater off. Adding 0.5sec and then taking 65% of the result is about right.
 	// 2. Based on the peak temperature compared to the temperature at which we turned the heater off.
 	// Try #2 because it is easier to identify the peak temperature than the delay to peak temperature. It can be slightly to aggressive, so add 30%.
-	//const float td = (float)(tuningPeakDelay + 500) * 0.00065;		// take the dead time as 65% of the delay to peak rounded up to a half second
-	const float td = tc * logf((gain + tuningStartTemp - tuningHeaterOffTemp)/(gain + tuningStartTemp - tuningPeakTemperature)) * 1.3;
+	//const float td = (float)(tuning->peakDelay + 500) * 0.00065;		// take the dead time as 65% of the delay to peak rounded up to a half second
+	const float td = tc * logf((gain + tuning->startTemp - tuning->heaterOffTemp)/(gain + tuning->startTemp - tuning->peakTemperature)) * 1.3;
+
+	SetTunedModel(gain, tc, td);
+}
 
-	tuned = SetModel(gain, tc, td, tuningPwm,
+// Set the model that tuning has found and report the result
+void PID::SetTunedModel(float gain, float tc, float td)
+{
+	tuned = SetModel(gain, tc, td, tuning->pwm,
 #if HAS_VOLTAGE_MONITOR
-						tuningVoltageAccumulator/voltageSamplesTaken,
+						tuning->voltageAccumulator/tuning->voltageSamplesTaken,
 #else
 						0.0,
 #endif
@@ -921,7 +1105,7 @@ void PID::CalculateModel()
 		platform.MessageF(LoggedGenericMessage,
 				"Auto tune heater %d completed in %" PRIu32 " sec\n"
 				"Use M307 H%d to see the result, or M500 to save the result in config-override.g\n",
-				heater, (millis() - tuningBeginTime)/(uint32_t)SecondsToMillis, heater);
+				heater, (millis() - tuning->beginTime)/(uint32_t)SecondsToMillis, heater);
 	}
 	else
 	{
@@ -929,21 +1113,249 @@ void PID::CalculateModel()
 	}
 }
 
+// This is called on each temperature sample when relay tuning. Return true to continue tuning, false if we have finished or failed.
+// It must set lastPWM to the required PWM, unless it is the same as last time.
+bool PID::DoRelayTuningStep()
+{
+	const uint32_t now = millis();
+	const uint32_t phaseTime = now - tuning->relaySwitchTime;
+	const uint32_t maxPhaseTime = ((reprap.GetHeat().IsBedOrChamberHeater(heater)) ? 10 * 60 : 2 * 60) * (uint32_t)SecondsToMillis;
+	if (phaseTime > maxPhaseTime)
+	{
+		platform.Message(GenericMessage, "Auto tune cancelled because temperature is not oscillating\n");
+		return false;
+	}
+
+	// The first cycles are overwritten by later ones, because we don't use them
+	float * const cycleValues = tuning->readings + RelayCycleValues * ((tuning->relayCycles > RelayCyclesToIgnore) ? tuning->relayCycles - RelayCyclesToIgnore : 0);
+	if (lastPwm > 0.0)
+	{
+		// Heater on, so the temperature falls for the dead time and then rises
+#if HAS_VOLTAGE_MONITOR
+		tuning->voltageAccumulator += platform.GetCurrentPowerVoltage();
+		++tuning->voltageSamplesTaken;
+#endif
+		tuning->relayExtremeTemp = min<float>(tuning->relayExtremeTemp, temperature);
+		if (temperature >= tuning->targetTemp)
+		{
+			cycleValues[2] = (float)phaseTime;
+			cycleValues[3] = tuning->relayExtremeTemp;
+			++tuning->relayCycles;
+			if (tuning->relayCycles == RelayCyclesToIgnore + RelayCyclesToMeasure)
+			{
+				CalculateRelayModel();
+				return false;
+			}
+			tuning->relayExtremeTemp = temperature;
+			tuning->relaySwitchTime = now;
+			lastPwm = 0.0;
+		}
+	}
+	else
+	{
+		// Heater off, so the temperature rises for the dead time and then falls
+		tuning->relayExtremeTemp = max<float>(tuning->relayExtremeTemp, temperature);
+		if (temperature <= tuning->relayLowTemp)
+		{
+			cycleValues[0] = (float)phaseTime;
+			cycleValues[1] = tuning->relayExtremeTemp;
+			tuning->relayExtremeTemp = temperature;
+			tuning->relaySwitchTime = now;
+			lastPwm = tuning->pwm;
+		}
+	}
+	return true;
+}
+
+// Calculate the heater model from the relay cycles
+void PID::CalculateRelayModel()
+{
+	float offTime = 0.0, maxTemp = 0.0, onTime = 0.0, minTemp = 0.0;
+	for (size_t i = 0; i < RelayCyclesToMeasure; ++i)
+	{
+		const float * const cycleValues = tuning->readings + RelayCycleValues * i;
+		offTime += cycleValues[0];
+		maxTemp += cycleValues[1];
+		onTime += cycleValues[2];
+		minTemp += cycleValues[3];
+	}
+	offTime *= MillisToSeconds/RelayCyclesToMeasure;
+	maxTemp *= 1.0/RelayCyclesToMeasure;
+	onTime *= MillisToSeconds/RelayCyclesToMeasure;
+	minTemp *= 1.0/RelayCyclesToMeasure;
+
+	if (reprap.Debug(moduleHeat))
+	{
+		platform.MessageF(UsbMessage, "Relay cycles: off %.1f sec max %.1f, on %.1f sec min %.1f\n", (double)offTime, (double)maxTemp, (double)onTime, (double)minTemp);
+	}
+
+	const float highRise = tuning->targetTemp - tuning->startTemp;
+	const float lowRise = tuning->relayLowTemp - tuning->startTemp;
+	const float deadTimeFactor = (minTemp - tuning->startTemp)/lowRise;				// this is exp(-td/tc)
+	if (deadTimeFactor <= 0.0 || deadTimeFactor >= 1.0 || maxTemp <= tuning->targetTemp)
+	{
+		platform.MessageF(WarningMessage, "Auto tune of heater %u failed because the temperature did not overshoot (min %.1f, max %.1f)\n", heater, (double)minTemp, (double)maxTemp);
+		return;
+	}
+
+	const float deadTimeRatio = -logf(deadTimeFactor);								// this is td/tc
+	const float tc = offTime/(deadTimeRatio + logf((maxTemp - tuning->startTemp)/lowRise));
+	const float td = deadTimeRatio * tc;
+	const float gain = ((maxTemp - tuning->startTemp) - deadTimeFactor * highRise)/(1.0 - deadTimeFactor);
+	SetTunedModel(gain, tc, td);
+}
+
 void PID::DisplayBuffer(const char *intro)
 {
 	OutputBuffer *buf;
 	if (OutputBuffer::Allocate(buf))
 	{
-		buf->catf("%s: interval %.1f sec, readings", intro, (double)(tuningReadingInterval * MillisToSeconds));
-		for (size_t i = 0; i < tuningReadingsTaken; ++i)
+		buf->catf("%s: interval %.1f sec, readings", intro, (double)(tuning->readingInterval * MillisToSeconds));
+		for (size_t i = 0; i < tuning->readingsTaken; ++i)
 		{
-			buf->catf(" %.1f", (double)tuningTempReadings[i]);
+			buf->catf(" %.1f", (double)tuning->readings[i]);
 		}
 		buf->cat('\n');
 		platform.Message(UsbMessage, buf);
 	}
 }
 
+#if SUPPORT_CAN_EXPANSION
+
+// Make this heater a proxy for heater n on an expansion board, or a local heater again if board < 0. This is called when the heater's sensor changes.
+void PID::SetRemote(int board, unsigned int remoteHeaterNumber)
+{
+	if (board != remoteBoard || remoteHeaterNumber != remoteHeater)
+	{
+		SwitchOff();								// turn off the local output or the remote heater that we were using
+		if (IsRemote())
+		{
+			CanInterface::SendHeaterSetpoint(remoteBoard, remoteHeater, 0.0, false, false);
+		}
+		remoteBoard = (int8_t)board;
+		remoteHeater = (uint8_t)remoteHeaterNumber;
+		remoteModelPending = IsRemote();
+		remoteResetPending = false;
+		remoteOn = false;
+		remoteSetpoint = 0.0;
+		whenRemoteSetpointSent = millis() - CanHeaterSetpointRefreshInterval;
+	}
+}
+
+// Spin a heater whose control loop runs on an expansion board. The temperature comes from the sensor on the board via the remote sensor, and the PWM and fault state from the board's reports.
+// We keep track of the heater mode and do the heater protection checks here, so that the heater looks exactly like a local one to the rest of the firmware.
+void PID::SpinRemote()
+{
+	// Send the model first, so that the board never uses a setpoint without it
+	if (remoteModelPending && CanInterface::SendHeaterModel(remoteBoard, remoteHeater, model, maxTempExcursion, maxHeatingFaultTime, invertPwmSignal))
+	{
+		remoteModelPending = false;
+	}
+
+	if (!model.IsEnabled())
+	{
+		return;
+	}
+
+	const TemperatureError err = ReadTemperature();
+	bool on = false;
+	if (err != TemperatureError::success)
+	{
+		HandleBadReading(err);
+		if (mode == HeaterMode::fault)
+		{
+			lastPwm = 0.0;
+		}
+	}
+	else
+	{
+		badTemperatureCount = 0;
+		const float targetTemperature = (active) ? activeTemperature : standbyTemperature;
+		const float error = targetTemperature - temperature;
+
+		CanHeaterReport report;
+		if (CanInterface::GetHeaterReport(remoteBoard, remoteHeater, report))
+		{
+			lastPwm = (float)report.averagePwm * (1.0/255.0);
+			if (report.state == (uint8_t)CanHeaterState::fault && mode > HeaterMode::off && !remoteResetPending)
+			{
+				lastPwm = 0.0;
+				mode = HeaterMode::fault;
+				reprap.GetGCodes().HandleHeaterFault(heater);
+				platform.MessageF(ErrorMessage, "Heating fault on heater %d, reported by expansion board %d heater %u\n", heater, remoteBoard, remoteHeater);
+				reprap.FlagTemperatureFault(heater);
+			}
+		}
+
+		switch (mode)
+		{
+		case HeaterMode::heating:
+			if (error <= TEMPERATURE_CLOSE_ENOUGH)
+			{
+				mode = HeaterMode::stable;
+			}
+			break;
+
+		case HeaterMode::cooling:
+			if (-error <= TEMPERATURE_CLOSE_ENOUGH && targetTemperature > MaxAmbientTemperature)
+			{
+				mode = HeaterMode::stable;
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		if (mode > HeaterMode::suspended)
+		{
+			on = true;
+			for (HeaterProtection *prot = heaterProtection; prot != nullptr; prot = prot->Next())
+			{
+				if (!prot->Check())
+				{
+					on = false;
+					switch (prot->GetAction())
+					{
+					case HeaterProtectionAction::GenerateFault:
+						mode = HeaterMode::fault;
+						reprap.GetGCodes().HandleHeaterFault(heater);
+						platform.MessageF(ErrorMessage, "Heating fault on heater %d\n", heater);
+						break;
+
+					case HeaterProtectionAction::TemporarySwitchOff:
+						break;
+
+					case HeaterProtectionAction::PermanentSwitchOff:
+						SwitchOff();
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// Tell the board the setpoint when it changes and at regular intervals, so that the board turns the heater off if we stop talking to it
+	const float setpoint = (active) ? activeTemperature : standbyTemperature;
+	const uint32_t now = millis();
+	if (   (on != remoteOn || (on && setpoint != remoteSetpoint) || remoteResetPending || now - whenRemoteSetpointSent >= CanHeaterSetpointRefreshInterval)
+		&& CanInterface::SendHeaterSetpoint(remoteBoard, remoteHeater, setpoint, on, remoteResetPending)
+	   )
+	{
+		remoteOn = on;
+		remoteSetpoint = setpoint;
+		remoteResetPending = false;
+		whenRemoteSetpointSent = now;
+	}
+
+	// We can't limit the power of a remote heater, but we register what it is using so that the local heaters share what is left of the power budget
+	(void)reprap.GetHeat().LimitHeaterPwm(heater, lastPwm, 0.0, true);
+	averagePWM = averagePWM * (1.0 - sampleIntervalMillis/(HeatPwmAverageTime * SecondsToMillis)) + lastPwm;
+	lastSampleTime = millis();
+}
+
+#endif
+
 // Suspend the heater, or resume it
 void PID::Suspend(bool sus)
 {
@@ -35,7 +35,8 @@ class PID
 		tuning1,
 		tuning2,
 		tuning3,
-		lastTuningMode = tuning3
+		lastTuningMode = tuning3,
+		tuningRelay										// relay feedback tuning, which replaces phases 2 and 3 when selected
 	};
 
 	static const size_t NumPreviousTemperatures = 4; // How many samples we average the temperature derivative over
@@ -64,20 +65,26 @@ public:
 	float GetTemperature() const;					// Get the current temperature
 	float GetAveragePWM() const;					// Return the running average PWM to the heater. Answer is a fraction in [0, 1].
 	uint32_t GetLastSampleTime() const;				// Return when the temp sensor was last sampled
+	uint32_t GetSampleInterval() const;				// Return how often Spin should be called in milliseconds
+	float GetExtrusionFeedForward() const { return extrusionFeedForward; }
+	void SetExtrusionFeedForward(float pwmPerMmPerSec) { extrusionFeedForward = max<float>(pwmPerMmPerSec, 0.0); }
+	void SetExtrusionSpeed(float speed, uint32_t durationMillis);	// Set the extrusion speed of the move about to start, called by the Move task
+	void SetSampleInterval(uint32_t interval)		// Set how often Spin should be called
+	pre(interval >= MinHeatSampleIntervalMillis; interval <= MaxHeatSampleIntervalMillis);
 	float GetAccumulator() const;					// Return the integral accumulator
-	void StartAutoTune(float targetTemp, float maxPwm, const StringRef& reply);	// Start an auto tune cycle for this PID
+	void StartAutoTune(float targetTemp, float maxPwm, bool useRelay, const StringRef& reply);	// Start an auto tune cycle for this PID
 	bool IsTuning() const;
-	void GetAutoTuneStatus(const StringRef& reply);	// Get the auto tune status or last result
+	void GetAutoTuneStatus(const StringRef& reply);	// Append the auto tune status or last result
 
 	const FopDt& GetModel() const					// Get the process model
 		{ return model; }
 
-	bool SetModel(float gain, float tc, float td, float maxPwm, float voltage, bool usePid, bool inverted, PwmFrequency pwmFreq);	// Set the process model
+	bool SetModel(float gain, float tc, float td, float maxPwm, float voltage, bool usePid, bool inverted, PwmFrequency pwmFreq, bool isDefault = false);	// Set the process model
 
 	bool IsHeaterSignalInverted() const				// Is the PWM output signal inverted?
 		{ return invertPwmSignal; }
 	void SetHeaterSignalInverted(bool inverted)		// Set PWM output signal inversion
-		{ invertPwmSignal = inverted; }
+		{ invertPwmSignal = inverted; RemoteModelChanged(); }
 
 	bool IsHeaterEnabled() const					// Is this heater enabled?
 		{ return model.IsEnabled(); }
@@ -86,26 +93,46 @@ public:
 		{ pMaxTempExcursion = maxTempExcursion; pMaxFaultTime = maxHeatingFaultTime; }
 
 	void SetFaultDetectionParameters(float pMaxTempExcursion, float pMaxFaultTime)
-		{ maxTempExcursion = pMaxTempExcursion; maxHeatingFaultTime = pMaxFaultTime; }
+		{ maxTempExcursion = pMaxTempExcursion; maxHeatingFaultTime = pMaxFaultTime; RemoteModelChanged(); }
 
 	void SetM301PidParameters(const M301PidParameters& params)
 		{ model.SetM301PidParameters(params); }
 
 	void Suspend(bool sus);							// Suspend the heater to conserve power or while doing Z probing
 
+#if SUPPORT_CAN_EXPANSION
+	void SetRemote(int board, unsigned int remoteHeaterNumber);	// Make this a proxy for a heater on an expansion board, or a local heater if board < 0
+	bool IsRemote() const { return remoteBoard >= 0; }
+#else
+	bool IsRemote() const { return false; }
+#endif
+
 private:
 
 	void SwitchOn();								// Turn the heater on and set the mode
 	void SetHeater(float power) const;				// Power is a fraction in [0,1]
 	TemperatureError ReadTemperature();				// Read and store the temperature of this heater
 	void DoTuningStep();							// Called on each temperature sample when auto tuning
-	static bool ReadingsStable(size_t numReadings, float maxDiff)
+	bool ReadingsStable(size_t numReadings, float maxDiff) const
 		pre(numReadings >= 2; numReadings <= MaxTuningTempReadings);
-	static int GetPeakTempIndex();					// Auto tune helper function
-	static int IdentifyPeak(size_t numToAverage);	// Auto tune helper function
+	int GetPeakTempIndex() const;					// Auto tune helper function
+	int IdentifyPeak(size_t numToAverage) const;	// Auto tune helper function
 	void CalculateModel();							// Calculate G, td and tc from the accumulated readings
+	bool DoRelayTuningStep();						// Called on each temperature sample when relay tuning, returns true if tuning should continue
+	void CalculateRelayModel();						// Calculate G, td and tc from the relay oscillation cycles
+	void SetTunedModel(float gain, float tc, float td);	// Set the model that tuning found and report the result
 	void DisplayBuffer(const char *intro);			// Debug helper
 	float GetExpectedHeatingRate() const;			// Get the minimum heating rate we expect
+	float GetEffectivePwm() const;					// Get the power we are applying as a fraction of full power at the tuning voltage
+	void ResetPrediction();							// Start predicting the temperature from the current one
+	float UpdatePrediction();						// Advance the predicted temperature and return how far the measured temperature is above it
+	uint32_t GetInitialTuningReadingInterval() const;	// Get the interval between tuning readings before any doubling
+	void HandleBadReading(TemperatureError err);	// Count a bad temperature reading and raise a fault if there have been too many
+	void RemoteModelChanged();						// Note that the model must be sent to the expansion board if this is a remote heater
+
+#if SUPPORT_CAN_EXPANSION
+	void SpinRemote();								// Spin a heater whose control loop runs on an expansion board
+#endif
 
 	Platform& platform;								// The instance of the class that is the RepRap hardware
 	HeaterProtection *heaterProtection;				// The first element of assigned heater protection items
@@ -120,10 +147,18 @@ private:
 	float iAccumulator;								// The integral PID component
 	float lastPwm;									// The last PWM value we output, before scaling by kS
 	float averagePWM;								// The running average of the PWM, after scaling.
+	float predictedTemperature;						// The temperature that the model predicts from the power we have been applying
+	float delayedPwm;								// The effective PWM delayed by the dead time of the model
+	float extraHeatLoss;							// The heat loss that the model doesn't account for, e.g. from cooling fans, as a fraction of full power
 	uint32_t timeSetHeating;						// When we turned on the heater
 	uint32_t lastSampleTime;						// Time when the temperature was last sampled by Spin()
+	uint32_t sampleIntervalMillis;					// How often Heat calls Spin(), which is also the PID control interval
+	float extrusionFeedForward;						// The extra PWM we add per mm/sec of extrusion by the tools that use this heater
+	volatile float extrusionSpeed;					// The extrusion speed of the move about to start or executing, in mm/sec
+	volatile uint32_t extrusionSpeedEndTime;		// When that move ends
 
 	uint16_t heatingFaultCount;						// Count of questionable heating behaviours
+	uint16_t modelFaultCount;						// Count of readings too far from the model prediction
 
 	int8_t heater;									// The index of our heater
 	uint8_t previousTemperaturesGood;				// Bitmap indicating which previous temperature were good readings
@@ -131,25 +166,59 @@ private:
 	bool invertPwmSignal;							// Invert the final PWM output signal (same behaviour as with HEAT_ON in earlier firmware versions)
 	bool active;									// Are we active or standby?
 	bool tuned;										// True if tuning was successful
+	bool modelConfigured;							// True if the model was set by M307 or tuning, so that we can trust its prediction
 	uint8_t badTemperatureCount;					// Count of sequential dud readings
 
+#if SUPPORT_CAN_EXPANSION
+	// Remote heater proxy state. The expansion board runs the control loop and we send it the model and setpoint.
+	int8_t remoteBoard;								// The expansion board that the heater is on, or -1 if it is a local heater
+	uint8_t remoteHeater;							// The heater number on that board
+	bool remoteModelPending;						// True if we need to send the model to the board
+	bool remoteResetPending;						// True if we need to tell the board to clear a heater fault
+	bool remoteOn;									// Whether the heater was on in the last setpoint we sent
+	float remoteSetpoint;							// The last setpoint we sent
+	uint32_t whenRemoteSetpointSent;				// When we sent it
+#endif
+
 	static_assert(sizeof(previousTemperaturesGood) * 8 >= NumPreviousTemperatures, "too few bits in previousTemperaturesGood");
 
-	// Variables used during heater tuning
+	// Variables used during heater tuning. These are allocated only while the heater is being tuned, so that several heaters can be tuned at the same time.
 	static const size_t MaxTuningTempReadings = 128; // The maximum number of readings we keep. Must be an even number.
 
-	static float *tuningTempReadings;				// the readings from the heater being tuned
-	static float tuningStartTemp;					// the temperature when we turned on the heater
-	static float tuningPwm;							// the PWM to use, 0..1
-	static float tuningTargetTemp;						// the maximum temperature we are allowed to reach
-	static uint32_t tuningBeginTime;				// when we started the tuning process
-	static uint32_t tuningPhaseStartTime;			// when we started the current tuning phase
-	static uint32_t tuningReadingInterval;			// how often we are sampling, in milliseconds
-	static size_t tuningReadingsTaken;				// how many temperature samples we have taken
-	static float tuningHeaterOffTemp;				// the temperature when we turned the heater off
-	static float tuningPeakTemperature;				// the peak temperature reached, averaged over 3 readings (so slightly less than the true peak)
-	static uint32_t tuningHeatingTime;				// how long we had the heating on for
-	static uint32_t tuningPeakDelay;				// how many milliseconds the temperature continues to rise after turning the heater off
+	// Variables used during relay tuning. The cycle measurements are stored in the readings buffer, because we don't need to keep the individual readings.
+	static const size_t RelayCycleValues = 4;		// the number of values we store for each relay cycle
+	static const size_t RelayCyclesToIgnore = 1;	// the number of cycles we allow for the oscillation to settle
+	static const size_t RelayCyclesToMeasure = 3;	// the number of cycles we average the results over
+	static_assert(RelayCycleValues * RelayCyclesToMeasure <= MaxTuningTempReadings, "MaxTuningTempReadings too small for relay tuning");
+
+	struct TuningData
+	{
+		float readings[MaxTuningTempReadings];		// the readings from the heater being tuned
+		float startTemp;							// the temperature when we turned on the heater
+		float pwm;									// the PWM to use, 0..1
+		float targetTemp;							// the maximum temperature we are allowed to reach
+		uint32_t beginTime;							// when we started the tuning process
+		uint32_t phaseStartTime;					// when we started the current tuning phase
+		uint32_t readingInterval;					// how often we are sampling, in milliseconds
+		size_t readingsTaken;						// how many temperature samples we have taken
+		float heaterOffTemp;						// the temperature when we turned the heater off
+		float peakTemperature;						// the peak temperature reached, averaged over 3 readings (so slightly less than the true peak)
+		uint32_t heatingTime;						// how long we had the heating on for
+		uint32_t peakDelay;							// how many milliseconds the temperature continues to rise after turning the heater off
+
+		bool useRelay;								// true to use relay feedback tuning instead of analysing the cooling curve
+		float relayLowTemp;							// the temperature at which the relay turns the heater back on
+		float relayExtremeTemp;						// the lowest or highest temperature since the relay last switched
+		uint32_t relaySwitchTime;					// when the relay last switched
+		size_t relayCycles;							// how many complete cycles we have seen
+
+#if HAS_VOLTAGE_MONITOR
+		unsigned int voltageSamplesTaken;			// how many readings we accumulated
+		float voltageAccumulator;					// sum of the voltage readings we take during the heating phase
+#endif
+	};
+
+	TuningData *tuning;								// the tuning variables, or nullptr if we are not tuning this heater
 };
 
 
@@ -188,6 +257,11 @@ inline uint32_t PID::GetLastSampleTime() const
 	return lastSampleTime;
 }
 
+inline uint32_t PID::GetSampleInterval() const
+{
+	return sampleIntervalMillis;
+}
+
 inline float PID::GetAccumulator() const
 {
 	return iAccumulator;
@@ -198,4 +272,11 @@ inline bool PID::IsTuning() const
 	return mode >= HeaterMode::tuning0;
 }
 
+inline void PID::RemoteModelChanged()
+{
+#if SUPPORT_CAN_EXPANSION
+	remoteModelPending = true;
+#endif
+}
+
 #endif /* SRC_PID_H_ */
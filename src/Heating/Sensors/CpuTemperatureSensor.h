@@ -15,6 +15,9 @@
 class CpuTemperatureSensor : public TemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<CpuTemperatureSensor>(); }
+	void operator delete(void* p) { Release<CpuTemperatureSensor>(p); }
+
 	CpuTemperatureSensor(unsigned int channel);
 	void Init() override;
 
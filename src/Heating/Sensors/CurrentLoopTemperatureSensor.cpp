@@ -15,9 +15,6 @@ const uint32_t MCP3204_Frequency = 1000000;		// maximum for MCP3204 is 1MHz @ 2.
 // The MCP3204 samples input data on the rising edge and changes the output data on the rising edge.
 const uint8_t MCP3204_SpiMode = SPI_MODE_0;
 
-// Define the minimum interval between readings
-const uint32_t MinimumReadInterval = 100;		// minimum interval between reads, in milliseconds
-
 CurrentLoopTemperatureSensor::CurrentLoopTemperatureSensor(unsigned int channel)
 	: SpiTemperatureSensor(channel, "Current Loop", channel - FirstLinearAdcChannel, MCP3204_SpiMode, MCP3204_Frequency),
 	  tempAt4mA(DefaultTempAt4mA), tempAt20mA(DefaultTempAt20mA), chipChannel(DefaultChipChannel), isDifferential(false)
@@ -32,7 +29,7 @@ void CurrentLoopTemperatureSensor::Init()
 
 	for (unsigned int i = 0; i < 3; ++i)		// try 3 times
 	{
-		TryGetLinearAdcTemperature();
+		ReadSensor();
 		if (lastResult == TemperatureError::success)
 		{
 			break;
@@ -73,17 +70,6 @@ GCodeResult CurrentLoopTemperatureSensor::Configure(unsigned int mCode, unsigned
 	return GCodeResult::ok;
 }
 
-TemperatureError CurrentLoopTemperatureSensor::TryGetTemperature(float& t)
-{
-	if (!inInterrupt() && millis() - lastReadingTime >= MinimumReadInterval)
-	{
-		TryGetLinearAdcTemperature();
-	}
-
-	t = lastTemperature;
-	return lastResult;
-}
-
 void CurrentLoopTemperatureSensor::CalcDerivedParameters()
 {
 	minLinearAdcTemp = tempAt4mA - 0.25 * (tempAt20mA - tempAt4mA);
@@ -91,7 +77,7 @@ void CurrentLoopTemperatureSensor::CalcDerivedParameters()
 }
 
 // Try to get a temperature reading from the linear ADC by doing an SPI transaction
-void CurrentLoopTemperatureSensor::TryGetLinearAdcTemperature()
+void CurrentLoopTemperatureSensor::ReadSensor()
 {
 	/*
 	 * The MCP3204 waits for a high input input bit before it does anything. Call this clock 1.
@@ -120,22 +106,24 @@ void CurrentLoopTemperatureSensor::TryGetLinearAdcTemperature()
 	const uint8_t channelByte = ((isDifferential) ? 0x80 : 0xC0) | (chipChannel * 0x08);
 	static const uint8_t adcData[] = { channelByte, 0x00, 0x00 };
 	uint32_t rawVal;
-	lastResult = DoSpiTransaction(adcData, 3, rawVal);
+	TemperatureError rslt = DoSpiTransaction(adcData, 3, rawVal);
 	//debugPrintf("ADC data %u\n", rawVal);
 
-	if (lastResult == TemperatureError::success)
+	if (rslt == TemperatureError::success)
 	{
+		lastReadingTime = millis();
 		const uint32_t adcVal1 = (rawVal >> 5) & ((1 << 13) - 1);
 		const uint32_t adcVal2 = ((rawVal & 1) << 5) | ((rawVal & 2) << 3) | ((rawVal & 4) << 1) | ((rawVal & 8) >> 1) | ((rawVal & 16) >> 3) | ((rawVal & 32) >> 5);
 		if (adcVal1 >= 4096 || adcVal2 != (adcVal1 & ((1 << 6) - 1)))
 		{
-			lastResult = TemperatureError::badResponse;
+			rslt = TemperatureError::badResponse;
 		}
 		else
 		{
 			lastTemperature = minLinearAdcTemp + (linearAdcDegCPerCount * (float)adcVal1);
 		}
 	}
+	lastResult = rslt;
 }
 
 // End
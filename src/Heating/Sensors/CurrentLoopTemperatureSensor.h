@@ -13,15 +13,17 @@
 class CurrentLoopTemperatureSensor : public SpiTemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<CurrentLoopTemperatureSensor>(); }
+	void operator delete(void* p) { Release<CurrentLoopTemperatureSensor>(p); }
+
 	CurrentLoopTemperatureSensor(unsigned int channel);
 	GCodeResult Configure(unsigned int mCode, unsigned int heater, GCodeBuffer& gb, const StringRef& reply) override;
 	void Init() override;
 
 protected:
-	TemperatureError TryGetTemperature(float& t) override;
+	void ReadSensor() override;
 
 private:
-	void TryGetLinearAdcTemperature();
 	void CalcDerivedParameters();
 
 	// Configurable parameters
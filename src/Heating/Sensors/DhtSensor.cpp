@@ -15,8 +15,8 @@
 
 constexpr uint32_t MinimumReadInterval = 2000;		// ms
 constexpr uint32_t MaximumReadTime = 20;			// ms
-constexpr uint32_t MinimumOneBitLength = 50;		// microseconds
-constexpr uint32_t MinimumOneBitStepClocks = (StepTimer::StepClockRate * MinimumOneBitLength)/1000000;
+constexpr uint32_t MinimumOneBitPeriod = 100;		// microseconds between falling edges. A 0 bit takes 76 to 78us and a 1 bit takes 120us.
+constexpr uint32_t MinimumOneBitStepClocks = (StepTimer::StepClockRate * MinimumOneBitPeriod)/1000000;
 
 # include "Tasks.h"
 
@@ -167,19 +167,18 @@ DhtSensorHardwareInterface *DhtSensorHardwareInterface::Create(unsigned int rela
 	return activeSensors[relativeChannel]->GetTemperatureOrHumidity(t, wantHumidity);
 }
 
+// Record the time between successive falling edges. We only interrupt on falling edges and we don't read the pin, to keep the time spent here to a minimum,
+// because the pin change interrupt has a higher priority than the step interrupt.
 void DhtSensorHardwareInterface::Interrupt()
 {
 	if (numPulses < ARRAY_SIZE(pulses))
 	{
 		const uint16_t now = StepTimer::GetInterruptClocks16();
-		if (IoPort::ReadPin(sensorPin))
-		{
-			lastPulseTime = now;
-		}
-		else if (lastPulseTime != 0)
+		if (lastPulseTime != 0)
 		{
 			pulses[numPulses++] = now - lastPulseTime;
 		}
+		lastPulseTime = now;
 	}
 }
 
@@ -202,10 +201,10 @@ void DhtSensorHardwareInterface::TakeReading()
 			// Now start reading the data line to get the value from the DHT sensor
 			IoPort::SetPinMode(sensorPin, INPUT_PULLUP);
 
-			// It appears that switching the pin to an output disables the interrupt, so we need to call attachInterrupt here
-			// We are likely to get an immediate interrupt at this point corresponding to the low-to-high transition. We must ignore this.
+			// It appears that switching the pin to an output disables the interrupt, so we need to call attachInterrupt here.
+			// The first falling edge is the start of the response from the sensor. Each bit starts with a falling edge, so the interval between falling edges tells us the value of the bit.
 			numPulses = ARRAY_SIZE(pulses);		// tell the ISR not to collect data yet
-			attachInterrupt(sensorPin, DhtDataTransition, INTERRUPT_MODE_CHANGE, this);
+			attachInterrupt(sensorPin, DhtDataTransition, INTERRUPT_MODE_FALLING, this);
 			lastPulseTime = 0;
 			numPulses = 0;						// tell the ISR to collect data
 		}
@@ -272,7 +271,7 @@ TemperatureError DhtSensorHardwareInterface::ProcessReadings()
 	// Reset 40 bits of received data to zero
 	uint8_t data[5] = { 0, 0, 0, 0, 0 };
 
-	// Inspect each high pulse and determine which ones are 0 (less than 50us) or 1 (more than 50us). Ignore the start bit.
+	// Inspect the interval between the start of each bit and the start of the next, to determine which ones are 0 (less than 100us) or 1 (more than 100us). Ignore the start bit.
 	for (size_t i = 0; i < 40; ++i)
 	{
 		data[i / 8] <<= 1;
@@ -61,13 +61,16 @@ private:
 
 	volatile uint16_t lastPulseTime;
 	volatile size_t numPulses;
-	uint16_t pulses[41];			// 1 start bit + 40 data bits
+	uint16_t pulses[41];			// step clocks between falling edges for 1 start bit + 40 data bits
 };
 
 // This class represents a DHT temperature sensor
 class DhtTemperatureSensor : public TemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<DhtTemperatureSensor>(); }
+	void operator delete(void* p) { Release<DhtTemperatureSensor>(p); }
+
 	DhtTemperatureSensor(unsigned int channel);
 	~DhtTemperatureSensor();
 
@@ -82,6 +85,9 @@ protected:
 class DhtHumiditySensor : public TemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<DhtHumiditySensor>(); }
+	void operator delete(void* p) { Release<DhtHumiditySensor>(p); }
+
 	DhtHumiditySensor(unsigned int channel);
 	~DhtHumiditySensor();
 
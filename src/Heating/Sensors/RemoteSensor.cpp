@@ -0,0 +1,47 @@
+/*
+ * RemoteSensor.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "RemoteSensor.h"
+
+#if SUPPORT_CAN_EXPANSION
+
+#include "CAN/CanInterface.h"
+#include "CAN/CanMessageFormats.h"
+
+RemoteSensor::RemoteSensor(unsigned int channel) : TemperatureSensor(channel, "remote sensor")
+{
+}
+
+void RemoteSensor::Init()
+{
+}
+
+/*static*/ bool RemoteSensor::IsRemoteChannel(unsigned int channel)
+{
+	return channel >= FirstRemoteSensorChannel
+		&& channel < FirstRemoteSensorChannel + MaxCanBoards * RemoteSensorChannelsPerBoard
+		&& (channel - FirstRemoteSensorChannel) % RemoteSensorChannelsPerBoard < MaxHeatersPerCanBoard;
+}
+
+TemperatureError RemoteSensor::TryGetTemperature(float& t)
+{
+	CanHeaterReport report;
+	if (!CanInterface::GetHeaterReport(GetBoard(), GetSensorNumber(), report))
+	{
+		return TemperatureError::timeout;
+	}
+	if (report.error != (uint8_t)TemperatureError::success)
+	{
+		return (TemperatureError)report.error;
+	}
+	t = report.temperature;
+	return TemperatureError::success;
+}
+
+#endif
+
+// End
@@ -0,0 +1,36 @@
+/*
+ * RemoteSensor.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_HEATING_SENSORS_REMOTESENSOR_H_
+#define SRC_HEATING_SENSORS_REMOTESENSOR_H_
+
+#include "TemperatureSensor.h"
+
+#if SUPPORT_CAN_EXPANSION
+
+// Class to represent a temperature sensor on a CAN expansion board. The board reports the readings of all its sensors in one message, so reading one is just a table lookup.
+class RemoteSensor : public TemperatureSensor
+{
+public:
+	void* operator new(size_t sz) { return Allocate<RemoteSensor>(); }
+	void operator delete(void* p) { Release<RemoteSensor>(p); }
+
+	RemoteSensor(unsigned int channel);
+	void Init() override;
+
+	size_t GetBoard() const { return (GetSensorChannel() - FirstRemoteSensorChannel)/RemoteSensorChannelsPerBoard; }
+	size_t GetSensorNumber() const { return (GetSensorChannel() - FirstRemoteSensorChannel) % RemoteSensorChannelsPerBoard; }
+
+	static bool IsRemoteChannel(unsigned int channel);
+
+protected:
+	TemperatureError TryGetTemperature(float& t) override;
+};
+
+#endif
+
+#endif /* SRC_HEATING_SENSORS_REMOTESENSOR_H_ */
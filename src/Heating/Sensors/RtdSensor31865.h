@@ -13,12 +13,15 @@
 class RtdSensor31865 : public SpiTemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<RtdSensor31865>(); }
+	void operator delete(void* p) { Release<RtdSensor31865>(p); }
+
 	RtdSensor31865(unsigned int channel);
 	GCodeResult Configure(unsigned int mCode, unsigned int heater, GCodeBuffer& gb, const StringRef& reply) override;
 	void Init() override;
 
 protected:
-	TemperatureError TryGetTemperature(float& t) override;
+	void ReadSensor() override;
 
 private:
 	TemperatureError TryInitRtd() const;
@@ -8,6 +8,20 @@
 #include "SpiTemperatureSensor.h"
 #include "Tasks.h"
 
+#ifdef RTOS
+
+// Static data members of class SpiTemperatureSensor
+Mutex SpiTemperatureSensor::sensorsMutex;
+Task<SpiTemperatureSensor::SpiSensorTaskStackWords> *SpiTemperatureSensor::sensorTask = nullptr;
+SpiTemperatureSensor *SpiTemperatureSensor::activeSensors = nullptr;
+
+extern "C" [[noreturn]] void SpiSensorTaskStart(void * pvParameters)
+{
+	SpiTemperatureSensor::SensorTask();
+}
+
+#endif
+
 SpiTemperatureSensor::SpiTemperatureSensor(unsigned int channel, const char *name, unsigned int relativeChannel, uint8_t spiMode, uint32_t clockFrequency)
 	: TemperatureSensor(channel, name)
 {
@@ -20,12 +34,97 @@ SpiTemperatureSensor::SpiTemperatureSensor(unsigned int channel, const char *nam
 #endif
 	lastTemperature = 0.0;
 	lastResult = TemperatureError::notInitialised;
+#ifdef RTOS
+	next = nullptr;
+	registered = false;
+#endif
+}
+
+SpiTemperatureSensor::~SpiTemperatureSensor()
+{
+#ifdef RTOS
+	// Make sure that the sensor task has finished with this sensor and won't read it again
+	MutexLocker lock(sensorsMutex);
+	for (SpiTemperatureSensor **link = &activeSensors; *link != nullptr; link = &(*link)->next)
+	{
+		if (*link == this)
+		{
+			*link = next;
+			break;
+		}
+	}
+#endif
 }
 
 void SpiTemperatureSensor::InitSpi()
 {
 	sspi_master_init(&device, 8);
 	lastReadingTime = millis();
+
+#ifdef RTOS
+	// Add this sensor to the list that the sensor task reads, creating the task if this is the first sensor
+	MutexLocker lock(sensorsMutex);
+	if (!registered)
+	{
+		next = activeSensors;
+		activeSensors = this;
+		registered = true;
+	}
+
+	if (sensorTask == nullptr)
+	{
+		sensorTask = new Task<SpiSensorTaskStackWords>;
+		sensorTask->Create(SpiSensorTaskStart, "SPISENSORS", nullptr, TaskPriority::SpiSensorPriority);
+	}
+#endif
+}
+
+#ifdef RTOS
+
+/*static*/ void SpiTemperatureSensor::InitStatic()
+{
+	sensorsMutex.Create("SPISensors");
+}
+
+// Code executed by the SPI sensor task. Each sensor is read when its reading is due, so the heater task always has a recent reading without having to wait for it.
+// This is run at the same priority as the Heat task, so it must not sit in any spin loops.
+/*static*/ [[noreturn]] void SpiTemperatureSensor::SensorTask()
+{
+	for (;;)
+	{
+		{
+			MutexLocker lock(sensorsMutex);
+			for (SpiTemperatureSensor *sensor = activeSensors; sensor != nullptr; sensor = sensor->next)
+			{
+				if (millis() - sensor->lastReadingTime >= MinimumReadInterval)
+				{
+					sensor->ReadSensor();
+				}
+			}
+		}
+		delay(MinimumReadInterval/10);
+	}
+}
+
+#endif
+
+// Return the latest reading
+TemperatureError SpiTemperatureSensor::TryGetTemperature(float& t)
+{
+#ifdef RTOS
+	if (lastResult == TemperatureError::success && millis() - lastReadingTime > MaximumReadingAge)
+	{
+		return TemperatureError::timeout;
+	}
+#else
+	if (!inInterrupt() && millis() - lastReadingTime >= MinimumReadInterval)
+	{
+		ReadSensor();
+	}
+#endif
+
+	t = lastTemperature;
+	return lastResult;
 }
 
 // Send and receive 1 to 8 bytes of data and return the result as a single 32-bit word
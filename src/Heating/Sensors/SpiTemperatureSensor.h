@@ -11,18 +11,52 @@
 #include "TemperatureSensor.h"
 #include "SharedSpi.h"				// for sspi_device
 
+#ifdef RTOS
+# include "RTOSIface/RTOSIface.h"
+#endif
+
+// Base class for sensors that we read over the shared SPI bus.
+// Under RTOS the readings are taken by a separate task, so that the heater task never waits for the SPI bus or for a slow sensor; TryGetTemperature just returns the latest reading.
 class SpiTemperatureSensor : public TemperatureSensor
 {
+public:
+	~SpiTemperatureSensor() override;
+
+#ifdef RTOS
+	static void InitStatic();
+	[[noreturn]] static void SensorTask();
+#endif
+
 protected:
 	SpiTemperatureSensor(unsigned int channel, const char *name, unsigned int relativeChannel, uint8_t spiMode, uint32_t clockFrequency);
 	void InitSpi();
 	TemperatureError DoSpiTransaction(const uint8_t dataOut[], size_t nbytes, uint32_t& rslt) const
 		pre(nbytes <= 8);
 
+	TemperatureError TryGetTemperature(float& t) override final;
+
+	// Read the sensor and update lastTemperature and lastResult. Update lastReadingTime if we communicated with it successfully.
+	virtual void ReadSensor() = 0;
+
+	static constexpr uint32_t MinimumReadInterval = 100;			// minimum interval between reads in milliseconds. The MAX31865 needs 62.5ms in 50Hz filter mode.
+
 	sspi_device device;
 	uint32_t lastReadingTime;
 	float lastTemperature;
 	TemperatureError lastResult;
+
+#ifdef RTOS
+private:
+	static constexpr uint32_t MaximumReadingAge = 500;				// if we haven't had a reading for this long then it is too old to use, in milliseconds
+	static constexpr unsigned int SpiSensorTaskStackWords = 120;	// task stack size in dwords
+
+	static Mutex sensorsMutex;
+	static Task<SpiSensorTaskStackWords> *sensorTask;
+	static SpiTemperatureSensor *activeSensors;						// linked list of sensors that the sensor task reads
+
+	SpiTemperatureSensor *next;
+	bool registered;
+#endif
 };
 
 #endif /* SRC_HEATING_SPITEMPERATURESENSOR_H_ */
@@ -18,6 +18,10 @@
 #include "TmcDriverTemperatureSensor.h"
 #endif
 
+#if SUPPORT_CAN_EXPANSION
+#include "RemoteSensor.h"
+#endif
+
 // Constructor
 TemperatureSensor::TemperatureSensor(unsigned int chan, const char *t) : sensorChannel(chan), sensorType(t), heaterName(nullptr), lastError(TemperatureError::success) {}
 
@@ -143,6 +147,12 @@ TemperatureSensor *TemperatureSensor::Create(unsigned int channel)
 		ts = new TmcDriverTemperatureSensor(channel);
 	}
 #endif
+#if SUPPORT_CAN_EXPANSION
+	else if (RemoteSensor::IsRemoteChannel(channel))
+	{
+		ts = new RemoteSensor(channel);
+	}
+#endif
 
 	if (ts != nullptr)
 	{
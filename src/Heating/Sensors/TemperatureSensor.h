@@ -4,6 +4,7 @@
 #include "RepRapFirmware.h"
 #include "Heating/TemperatureError.h"		// for result codes
 #include "GCodes/GCodeResult.h"
+#include "General/FreelistManager.h"
 
 class GCodeBuffer;
 
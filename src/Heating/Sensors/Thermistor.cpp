@@ -19,6 +19,8 @@
 //
 // The parameters that can be configured in RRF are R25 (the resistance at 25C), Beta, and optionally C.
 
+constexpr float MaxCheckedTemperature = 400.0;		// the highest temperature at which we require the temperature table to be accurate
+
 // Create an instance with default values
 Thermistor::Thermistor(unsigned int channel, bool p_isPT1000)
 	: TemperatureSensor(channel, (p_isPT1000) ? "PT1000" : "Thermistor"), isPT1000(p_isPT1000)
@@ -149,9 +151,11 @@ TemperatureError Thermistor::TryGetTemperature(float& t)
 
 #if HAS_VREF_MONITOR
 		const float resistance = seriesR * (float)(averagedTempReading - averagedVssaReading)/denom;
+		const float ratio = (float)(averagedTempReading - averagedVssaReading)/(float)(averagedVrefReading - averagedVssaReading);
 #else
 		const int32_t averagedVssaReading = 2 * adcLowOffset;					// double the offset because we increased AdcOversampleBits from 1 to 2
 		float resistance = seriesR * ((float)(averagedTempReading - averagedVssaReading) + 0.5)/denom;
+		const float ratio = ((float)(averagedTempReading - averagedVssaReading) + 0.5)/(float)(averagedVrefReading - averagedVssaReading);
 # ifdef DUET_NG
 		// The VSSA PTC fuse on the later Duets has a resistance of a few ohms. I measured 1.0 ohms on two revision 1.04 Duet WiFi boards.
 		resistance -= 1.0;														// assume 1.0 ohms and only one PT1000 sensor
@@ -165,9 +169,7 @@ TemperatureError Thermistor::TryGetTemperature(float& t)
 		}
 
 		// Else it's a thermistor
-		const float logResistance = log(resistance);
-		const float recipT = shA + shB * logResistance + shC * logResistance * logResistance * logResistance;
-		const float temp =  (recipT > 0.0) ? (1.0/recipT) + ABS_ZERO : BadErrorTemperature;
+		const float temp = (useTemperatureTable) ? LookupTemperature(ratio) : CalcTemperature(resistance);
 
 		if (temp < MinimumConnectedTemperature)
 		{
@@ -185,12 +187,70 @@ TemperatureError Thermistor::TryGetTemperature(float& t)
 	return TemperatureError::notReady;
 }
 
-// Calculate shA and shB from the other parameters
+// Calculate the temperature from the resistance of the thermistor
+float Thermistor::CalcTemperature(float resistance) const
+{
+	const float logResistance = logf(resistance);
+	const float recipT = shA + shB * logResistance + shC * logResistance * logResistance * logResistance;
+	return (recipT > 0.0) ? (1.0/recipT) + ABS_ZERO : BadErrorTemperature;
+}
+
+// Get the temperature from the table, given the ratio of the reading to the reference
+float Thermistor::LookupTemperature(float ratio) const
+{
+	const float position = (sqrtf(max<float>(ratio, 0.0)) - sqrtf(max<float>(1.0 - ratio, 0.0)) + 1.0) * (0.5 * TemperatureTableSize);
+	const size_t index = min<size_t>((size_t)position, TemperatureTableSize - 1);
+	const float t0 = (float)temperatureTable[index];
+	const float t1 = (float)temperatureTable[index + 1];
+	return (t0 + (t1 - t0) * (position - (float)index)) * (1.0/TemperatureTableScale);
+}
+
+// Return the thermistor resistance at a position in the temperature table, which may be between two entries but must be before the last one
+float Thermistor::TableResistance(float position) const
+{
+	// Invert position = (sqrt(r) - sqrt(1 - r) + 1) * TemperatureTableSize/2
+	const float d = (2.0 * position)/TemperatureTableSize - 1.0;
+	const float sqrtRatio = 0.5 * (d + sqrtf(max<float>(2.0 - d * d, 0.0)));
+	const float ratio = fsquare(sqrtRatio);
+	const float resistance = seriesR * ratio/(1.0 - ratio);
+#if !HAS_VREF_MONITOR && defined(DUET_NG)
+	return resistance - 1.0;													// allow for the VSSA fuse in the same way as TryGetTemperature does
+#else
+	return resistance;
+#endif
+}
+
+// Calculate shA and shB from the other parameters and build the temperature table
 void Thermistor::CalcDerivedParameters()
 {
 	shB = 1.0/beta;
 	const float lnR25 = logf(r25);
 	shA = 1.0/(25.0 - ABS_ZERO) - shB * lnR25 - shC * lnR25 * lnR25 * lnR25;
+
+	useTemperatureTable = false;
+	if (!isPT1000)
+	{
+		// The last entry is for infinite resistance
+		for (size_t i = 0; i < TemperatureTableSize; ++i)
+		{
+			const float temp = CalcTemperature(TableResistance((float)i));
+			temperatureTable[i] = (int16_t)lrintf(constrain<float>(temp, ABS_ZERO, BadErrorTemperature) * TemperatureTableScale);
+		}
+		temperatureTable[TemperatureTableSize] = (int16_t)lrintf(ABS_ZERO * TemperatureTableScale);
+
+		// Check the interpolation error half way along each segment over the range of temperatures that matter
+		useTemperatureTable = true;
+		for (size_t i = 0; i < TemperatureTableSize; ++i)
+		{
+			const float temp = CalcTemperature(TableResistance((float)i + 0.5));
+			const float tableTemp = 0.5 * (float)(temperatureTable[i] + temperatureTable[i + 1]) * (1.0/TemperatureTableScale);
+			if (temp >= MinimumConnectedTemperature && temp <= MaxCheckedTemperature && fabsf(temp - tableTemp) > MaxTemperatureTableError)
+			{
+				useTemperatureTable = false;
+				break;
+			}
+		}
+	}
 }
 
 // End
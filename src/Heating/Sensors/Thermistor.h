@@ -17,10 +17,17 @@
 // 1/T = A + (1/Beta) ln(R)
 //
 // The parameters that can be configured in RRF are R25 (the resistance at 25C), Beta, and optionally C.
+//
+// To avoid calculating a logarithm for each reading, we convert thermistor readings using a table of temperature against the ratio r of our reading to the reference.
+// The table is evenly spaced in (sqrt(r) - sqrt(1 - r) + 1)/2, which stretches both ends of the range where the temperature changes fastest, and we interpolate linearly.
+// It is rebuilt whenever the parameters change. If the table isn't accurate enough for the parameters then we use the equation instead.
 
 class Thermistor : public TemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<Thermistor>(); }
+	void operator delete(void* p) { Release<Thermistor>(p); }
+
 	Thermistor(unsigned int channel, bool p_isPT1000);						// create an instance with default values
 	GCodeResult Configure(unsigned int mCode, unsigned int heater, GCodeBuffer& gb, const StringRef& reply) override; // configure the sensor from M305 parameters
 	void Init() override;
@@ -32,7 +39,10 @@ private:
 	// For the theory behind ADC oversampling, see http://www.atmel.com/Images/doc8003.pdf
 	static constexpr unsigned int AdcOversampleBits = 2;					// we use 2-bit oversampling
 
-	void CalcDerivedParameters();											// calculate shA and shB
+	void CalcDerivedParameters();											// calculate shA and shB and build the temperature table
+	float CalcTemperature(float resistance) const;							// calculate the temperature from the thermistor resistance
+	float LookupTemperature(float ratio) const;								// get the temperature from the table
+	float TableResistance(float position) const;							// get the thermistor resistance at a position in the table
 
 	// The following are configurable parameters
 	unsigned int thermistorInputChannel;
@@ -46,6 +56,12 @@ private:
 	// The following are derived from the configurable parameters
 	float shA, shB;															// derived parameters
 
+	static constexpr size_t TemperatureTableSize = 128;						// the number of segments in the temperature table
+	static constexpr float TemperatureTableScale = 16.0;					// the table holds temperatures in 1/16C units
+	static constexpr float MaxTemperatureTableError = 0.5;					// if interpolating in the table gives errors bigger than this then we don't use it
+	int16_t temperatureTable[TemperatureTableSize + 1];						// the temperature at the end of each segment, in 1/16C units
+	bool useTemperatureTable;
+
 	static constexpr unsigned int AdcBits = 12;								// the ADCs in the SAM processors are 12-bit
 	static constexpr int32_t AdcRange = 1 << (AdcBits + AdcOversampleBits);	// The readings we pass in should be in range 0..(AdcRange - 1)
 };
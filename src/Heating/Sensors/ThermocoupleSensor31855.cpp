@@ -58,9 +58,6 @@ const uint32_t MAX31855_Frequency = 4000000;	// maximum for MAX31855 is 5MHz
 // So the SAM needs to sample data on the rising clock edge. This requires NCPHA = 1.
 const uint8_t MAX31855_SpiMode = SPI_MODE_0;
 
-// Define the minimum interval between readings
-const uint32_t MinimumReadInterval = 100;		// minimum interval between reads, in milliseconds
-
 ThermocoupleSensor31855::ThermocoupleSensor31855(unsigned int channel)
 	: SpiTemperatureSensor(channel, "Thermocouple (MAX31855)", channel - FirstMax31855ThermocoupleChannel, MAX31855_SpiMode, MAX31855_Frequency)
 {
@@ -73,84 +70,77 @@ void ThermocoupleSensor31855::Init()
 	lastReadingTime = millis();
 }
 
-TemperatureError ThermocoupleSensor31855::TryGetTemperature(float& t)
+// Read the sensor. This is called by the SPI sensor task when a reading is due.
+void ThermocoupleSensor31855::ReadSensor()
 {
-	if (inInterrupt() || millis() - lastReadingTime < MinimumReadInterval)
+	uint32_t rawVal;
+	TemperatureError sts = DoSpiTransaction(nullptr, 4, rawVal);
+	if (sts != TemperatureError::success)
 	{
-		t = lastTemperature;
+		lastResult = sts;
 	}
 	else
 	{
-		uint32_t rawVal;
-		TemperatureError sts = DoSpiTransaction(nullptr, 4, rawVal);
-		if (sts != TemperatureError::success)
+		lastReadingTime = millis();
+
+		if ((rawVal & 0x00020008) != 0)
 		{
-			lastResult = sts;
+			// These two bits should always read 0. Likely the entire read was 0xFF 0xFF which is not uncommon when first powering up
+			lastResult = TemperatureError::ioError;
 		}
-		else
+		else if ((rawVal & 0x00010007) != 0)		// check the fault bits
 		{
-			lastReadingTime = millis();
-
-			if ((rawVal & 0x00020008) != 0)
+			// Check for three more types of bad reads as we set the response code:
+			//   1. A read in which the fault indicator bit (16) is set but the fault reason bits (0:2) are all clear;
+			//   2. A read in which the fault indicator bit (16) is clear, but one or more of the fault reason bits (0:2) are set; and,
+			//   3. A read in which more than one of the fault reason bits (0:1) are set.
+			if ((rawVal & 0x00010000) == 0)
 			{
-				// These two bits should always read 0. Likely the entire read was 0xFF 0xFF which is not uncommon when first powering up
+				// One or more fault reason bits are set but the fault indicator bit is clear
 				lastResult = TemperatureError::ioError;
 			}
-			else if ((rawVal & 0x00010007) != 0)		// check the fault bits
+			else
 			{
-				// Check for three more types of bad reads as we set the response code:
-				//   1. A read in which the fault indicator bit (16) is set but the fault reason bits (0:2) are all clear;
-				//   2. A read in which the fault indicator bit (16) is clear, but one or more of the fault reason bits (0:2) are set; and,
-				//   3. A read in which more than one of the fault reason bits (0:1) are set.
-				if ((rawVal & 0x00010000) == 0)
+				// At this point we are assured that bit 16 (fault indicator) is set and that at least one of the fault reason bits (0:2) are set.
+				// We now need to ensure that only one fault reason bit is set.
+				uint8_t nbits = 0;
+				if (rawVal & 0x01)
 				{
-					// One or more fault reason bits are set but the fault indicator bit is clear
-					lastResult = TemperatureError::ioError;
+					// Open Circuit
+					++nbits;
+					lastResult = TemperatureError::openCircuit;
+				}
+				if (rawVal & 0x02)
+				{
+					// Short to ground;
+					++nbits;
+					lastResult = TemperatureError::shortToGround;
 				}
-				else
+				if (rawVal && 0x04)
 				{
-					// At this point we are assured that bit 16 (fault indicator) is set and that at least one of the fault reason bits (0:2) are set.
-					// We now need to ensure that only one fault reason bit is set.
-					uint8_t nbits = 0;
-					if (rawVal & 0x01)
-					{
-						// Open Circuit
-						++nbits;
-						lastResult = TemperatureError::openCircuit;
-					}
-					if (rawVal & 0x02)
-					{
-						// Short to ground;
-						++nbits;
-						lastResult = TemperatureError::shortToGround;
-					}
-					if (rawVal && 0x04)
-					{
-						// Short to Vcc
-						++nbits;
-						lastResult = TemperatureError::shortToVcc;
-					}
+					// Short to Vcc
+					++nbits;
+					lastResult = TemperatureError::shortToVcc;
+				}
 
-					if (nbits != 1)
-					{
-						// Fault indicator was set but a fault reason was not set (nbits == 0) or too many fault reason bits were set (nbits > 1).
-						// Assume that a communication error with the MAX31855 has occurred.
-						lastResult = TemperatureError::ioError;
-					}
+				if (nbits != 1)
+				{
+					// Fault indicator was set but a fault reason was not set (nbits == 0) or too many fault reason bits were set (nbits > 1).
+					// Assume that a communication error with the MAX31855 has occurred.
+					lastResult = TemperatureError::ioError;
 				}
 			}
-			else
-			{
-				rawVal >>= 18;							// shift the 14-bit temperature data to the bottom of the word
-				rawVal |= (0 - (rawVal & 0x2000));		// sign-extend the sign bit
+		}
+		else
+		{
+			rawVal >>= 18;							// shift the 14-bit temperature data to the bottom of the word
+			rawVal |= (0 - (rawVal & 0x2000));		// sign-extend the sign bit
 
-				// And convert to from units of 1/4C to 1C
-				t = lastTemperature = (float)(0.25 * (float)(int32_t)rawVal);
-				lastResult = TemperatureError::success;
-			}
+			// And convert to from units of 1/4C to 1C
+			lastTemperature = (float)(0.25 * (float)(int32_t)rawVal);
+			lastResult = TemperatureError::success;
 		}
 	}
-	return lastResult;
 }
 
 // End
@@ -13,11 +13,14 @@
 class ThermocoupleSensor31855 : public SpiTemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<ThermocoupleSensor31855>(); }
+	void operator delete(void* p) { Release<ThermocoupleSensor31855>(p); }
+
 	ThermocoupleSensor31855(unsigned int channel);
 	void Init() override;
 
 protected:
-	TemperatureError TryGetTemperature(float& t) override;
+	void ReadSensor() override;
 };
 
 #endif /* SRC_HEATING_THERMOCOUPLESENSOR31855_H_ */
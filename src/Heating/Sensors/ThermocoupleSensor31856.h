@@ -13,12 +13,15 @@
 class ThermocoupleSensor31856 : public SpiTemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<ThermocoupleSensor31856>(); }
+	void operator delete(void* p) { Release<ThermocoupleSensor31856>(p); }
+
 	ThermocoupleSensor31856(unsigned int channel);
 	GCodeResult Configure(unsigned int mCode, unsigned int heater, GCodeBuffer& gb, const StringRef& reply) override;
 	void Init() override;
 
 protected:
-	TemperatureError TryGetTemperature(float& t) override;
+	void ReadSensor() override;
 
 private:
 	TemperatureError TryInitThermocouple() const;
@@ -15,6 +15,9 @@
 class TmcDriverTemperatureSensor : public TemperatureSensor
 {
 public:
+	void* operator new(size_t sz) { return Allocate<TmcDriverTemperatureSensor>(); }
+	void operator delete(void* p) { Release<TmcDriverTemperatureSensor>(p); }
+
 	TmcDriverTemperatureSensor(unsigned int channel);
 	void Init() override;
 
@@ -62,6 +62,11 @@ unsigned int DiskioGetAndClearMaxRetryCount()
 	return ret;
 }
 
+unsigned int DiskioGetMaxRetryCount()
+{
+	return highestSdRetriesDone;
+}
+
 //void debugPrintf(const char*, ...);
 
 //#if (SAM3S || SAM3U || SAM3N || SAM3XA_SERIES || SAM4S)
@@ -87,6 +92,66 @@ unsigned int DiskioGetAndClearMaxRetryCount()
 #define SECTOR_SIZE_2048 4
 #define SECTOR_SIZE_4096 8
 
+#if SUPPORT_SECTOR_CACHE
+
+// Small write-through cache of FAT and directory sectors, shared by all the volumes.
+// FatFs only asks for cacheable sectors through disk_read_cached. All writes go to the card, and any copy that we hold is updated to match,
+// so the cache never holds data that differs from the card. The entries for a drive are discarded when it is mounted, unmounted or found to be missing.
+namespace
+{
+	struct CachedSector
+	{
+		uint32_t sector;
+		uint32_t lastUsed;					// when we last used this entry, 0 if the entry is free
+		BYTE drv;
+		alignas(4) BYTE data[SECTOR_SIZE_DEFAULT];
+	};
+
+	CachedSector sectorCache[SectorCacheEntries];
+	uint32_t sectorCacheUseCount = 0;
+	unsigned int sectorCacheHits = 0, sectorCacheMisses = 0;
+	Mutex sectorCacheMutex;
+
+	CachedSector *FindCachedSector(BYTE drv, uint32_t sector)
+	{
+		for (CachedSector& cs : sectorCache)
+		{
+			if (cs.lastUsed != 0 && cs.drv == drv && cs.sector == sector)
+			{
+				return &cs;
+			}
+		}
+		return nullptr;
+	}
+}
+
+void DiskioInitCache()
+{
+	sectorCacheMutex.Create("SectorCache");
+}
+
+// Forget all the sectors that we hold for a drive
+void DiskioInvalidateCache(unsigned int drv)
+{
+	MutexLocker lock(sectorCacheMutex);
+	for (CachedSector& cs : sectorCache)
+	{
+		if (cs.drv == drv)
+		{
+			cs.lastUsed = 0;
+		}
+	}
+}
+
+void DiskioGetAndClearCacheStats(unsigned int& hits, unsigned int& misses)
+{
+	hits = sectorCacheHits;
+	misses = sectorCacheMisses;
+	sectorCacheHits = sectorCacheMisses = 0;
+}
+
+#endif
+
 /**
  * \brief Initialize a disk.
  *
@@ -129,6 +194,10 @@ DSTATUS disk_initialize(BYTE drv)
 		return STA_PROTECT;
 	}
 
+#if SUPPORT_SECTOR_CACHE
+	DiskioInvalidateCache(drv);					// this may be a different card from the one we last saw in this slot
+#endif
+
 	/* The memory should already be initialized */
 	return 0;
 }
@@ -149,6 +218,9 @@ DSTATUS disk_status(BYTE drv)
 	case CTRL_GOOD:
 		return 0;
 	case CTRL_NO_PRESENT:
+#if SUPPORT_SECTOR_CACHE
+		DiskioInvalidateCache(drv);
+#endif
 		return STA_NOINIT | STA_NODISK;
 	default:
 		return STA_NOINIT;
@@ -217,6 +289,82 @@ DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count)
 #endif
 }
 
+/**
+ * \brief  Read a FAT or directory sector, using the sector cache if we have one.
+ *
+ * \param drv Physical drive number (0..).
+ * \param buff Data buffer to store read data.
+ * \param sector Sector address (LBA).
+ *
+ * \return RES_OK for success, otherwise DRESULT error code.
+ */
+DRESULT disk_read_cached(BYTE drv, BYTE *buff, DWORD sector)
+{
+#if SUPPORT_SECTOR_CACHE
+	{
+		MutexLocker lock(sectorCacheMutex);
+		CachedSector * const cs = FindCachedSector(drv, sector);
+		if (cs != nullptr)
+		{
+			memcpy(buff, cs->data, SECTOR_SIZE_DEFAULT);
+			cs->lastUsed = ++sectorCacheUseCount;
+			++sectorCacheHits;
+			return RES_OK;
+		}
+		++sectorCacheMisses;
+	}
+
+	const DRESULT res = disk_read(drv, buff, sector, 1);
+	if (res == RES_OK)
+	{
+		// Replace the least recently used entry. Another task may have read the same sector on the same drive meanwhile, in which case we already have it.
+		MutexLocker lock(sectorCacheMutex);
+		if (FindCachedSector(drv, sector) == nullptr)
+		{
+			CachedSector *victim = &sectorCache[0];
+			for (CachedSector& cs : sectorCache)
+			{
+				if (cs.lastUsed < victim->lastUsed)
+				{
+					victim = &cs;
+				}
+			}
+			memcpy(victim->data, buff, SECTOR_SIZE_DEFAULT);
+			victim->drv = drv;
+			victim->sector = sector;
+			victim->lastUsed = ++sectorCacheUseCount;
+		}
+	}
+	return res;
+#else
+	return disk_read(drv, buff, sector, 1);
+#endif
+}
+
+#if SUPPORT_SECTOR_CACHE
+
+// Bring any cached copies of sectors that we just tried to write up to date. If the write failed then we don't know what the card holds, so we discard them.
+static void UpdateCachedSectors(BYTE drv, BYTE const *buff, DWORD sector, BYTE count, bool ok)
+{
+	MutexLocker lock(sectorCacheMutex);
+	for (CachedSector& cs : sectorCache)
+	{
+		if (cs.lastUsed != 0 && cs.drv == drv && cs.sector - sector < count)
+		{
+			if (ok)
+			{
+				memcpy(cs.data, buff + (cs.sector - sector) * SECTOR_SIZE_DEFAULT, SECTOR_SIZE_DEFAULT);
+			}
+			else
+			{
+				cs.lastUsed = 0;
+			}
+		}
+	}
+}
+
+#endif
+
 /**
  * \brief  Write sector(s).
  *
@@ -267,6 +415,9 @@ DRESULT disk_write(BYTE drv, BYTE const *buff, DWORD sector, BYTE count)
 		++retryNumber;
 		if (retryNumber == MaxSdCardTries)
 		{
+#if SUPPORT_SECTOR_CACHE
+			UpdateCachedSectors(drv, buff, sector, count, false);
+#endif
 			return RES_ERROR;
 		}
 		delay(retryDelay);
@@ -279,6 +430,9 @@ DRESULT disk_write(BYTE drv, BYTE const *buff, DWORD sector, BYTE count)
 		highestSdRetriesDone = retryNumber;
 	}
 
+#if SUPPORT_SECTOR_CACHE
+	UpdateCachedSectors(drv, buff, sector, count, true);
+#endif
 	return RES_OK;
 
 #else
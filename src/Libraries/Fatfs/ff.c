@@ -1081,9 +1081,10 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 #endif
 
 
-static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
+static FRESULT load_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs,			/* Filesystem object */
-	DWORD sector		/* Sector number to make appearance in the fs->win[] */
+	DWORD sector,		/* Sector number to make appearance in the fs->win[] */
+	BYTE cacheable		/* Nonzero if the sector holds file system data (FAT or directory) that is worth keeping in the sector cache */
 )
 {
 	FRESULT res = FR_OK;
@@ -1094,7 +1095,7 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 		res = sync_window(fs);		/* Write-back changes */
 #endif
 		if (res == FR_OK) {			/* Fill sector window with new data */
-			if (disk_read(fs->pdrv, fs->win, sector, 1) != RES_OK) {
+			if ((cacheable ? disk_read_cached(fs->pdrv, fs->win, sector) : disk_read(fs->pdrv, fs->win, sector, 1)) != RES_OK) {
 				sector = 0xFFFFFFFF;	/* Invalidate window if read data is not valid */
 				res = FR_DISK_ERR;
 			}
@@ -1104,6 +1105,22 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 	return res;
 }
 
+static FRESULT move_window (	/* Move the window to a FAT or directory sector */
+	FATFS* fs,
+	DWORD sector
+)
+{
+	return load_window(fs, sector, 1);
+}
+
+static FRESULT move_data_window (	/* Move the window to a sector that we don't expect to read again soon, e.g. file data */
+	FATFS* fs,
+	DWORD sector
+)
+{
+	return load_window(fs, sector, 0);
+}
+
 
 
 
@@ -3863,7 +3880,7 @@ FRESULT f_read (
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes left in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+		if (move_data_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
 		mem_cpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #else
 		mem_cpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
@@ -3985,7 +4002,7 @@ FRESULT f_write (
 		wcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes left in the sector */
 		if (wcnt > btw) wcnt = btw;					/* Clip it by btw if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+		if (move_data_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
 		mem_cpy(fs->win + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
 		fs->wflag = 1;
 #else
@@ -4724,7 +4741,7 @@ FRESULT f_getfree (
 					i = 0;						/* Offset in the sector */
 					do {	/* Counts numbuer of bits with zero in the bitmap */
 						if (i == 0) {
-							res = move_window(fs, sect++);
+							res = move_data_window(fs, sect++);	/* don't flush the sector cache by scanning the whole bitmap */
 							if (res != FR_OK) break;
 						}
 						for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
@@ -4741,7 +4758,7 @@ FRESULT f_getfree (
 					i = 0;					/* Offset in the sector */
 					do {	/* Counts numbuer of entries with zero in the FAT */
 						if (i == 0) {
-							res = move_window(fs, sect++);
+							res = move_data_window(fs, sect++);	/* don't flush the sector cache by scanning the whole FAT */
 							if (res != FR_OK) break;
 						}
 						if (fs->fs_type == FS_FAT16) {
@@ -5547,7 +5564,7 @@ FRESULT f_forward (
 		if (sect == 0) ABORT(fs, FR_INT_ERR);
 		sect += csect;
 #if FF_FS_TINY
-		if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
+		if (move_data_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
 		dbuf = fs->win;
 #else
 		if (fp->sect != sect) {		/* Fill sector cache with file data */
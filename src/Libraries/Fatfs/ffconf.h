@@ -42,7 +42,7 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
@@ -230,7 +230,11 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
-#define FF_FS_EXFAT		0
+#ifdef __LPC17xx__
+#define FF_FS_EXFAT		0					// not enough RAM for the extra stack that the exFAT directory functions need
+#else
+#define FF_FS_EXFAT		1					// cards formatted as exFAT with large clusters are best for multi-GB G-code files. This makes FSIZE_t 64 bits.
+#endif
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
 /  Note that enabling exFAT discards ANSI C (C89) compatibility. */
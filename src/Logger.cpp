@@ -22,7 +22,7 @@ private:
 	bool& b;
 };
 
-Logger::Logger() : logFile(), lastFlushTime(0), lastFlushFileSize(0), dirty(false), inLogger(false)
+Logger::Logger() : logFile(), lastFlushTime(0), lastFlushFileSize(0), allocatedEnd(0), dirty(false), inLogger(false)
 {
 }
 
@@ -35,7 +35,8 @@ void Logger::Start(time_t time, const StringRef& filename)
 		if (f != nullptr)
 		{
 			logFile.Set(f);
-			lastFlushFileSize = logFile.Length();
+			allocatedEnd = logFile.Length();
+			lastFlushFileSize = FindEndOfData();
 			logFile.Seek(lastFlushFileSize);
 			InternalLogMessage(time, "Event logging started\n");
 		}
@@ -48,6 +49,7 @@ void Logger::Stop(time_t time)
 	{
 		Lock loggerLock(inLogger);
 		InternalLogMessage(time, "Event logging stopped\n");
+		logFile.Truncate();									// remove the preallocated space that we didn't use
 		logFile.Close();
 	}
 }
@@ -125,6 +127,10 @@ void Logger::Flush(bool forced)
 		if (forced || now - lastFlushTime >= LogFlushInterval || currentPos/512 != lastFlushFileSize/512)
 		{
 			Lock loggerLock(inLogger);
+			if (currentPos + LogFileExtent/2 > allocatedEnd)
+			{
+				Preallocate(currentPos);
+			}
 			logFile.Flush();
 			lastFlushTime = millis();
 			lastFlushFileSize = currentPos;
@@ -133,6 +139,51 @@ void Logger::Flush(bool forced)
 	}
 }
 
+// Find the end of the logged data. If the log file wasn't closed properly then the data is followed by preallocated zeros, which we skip back over.
+// Caller must already have checked and set inLogger.
+FilePosition Logger::FindEndOfData()
+{
+	FilePosition end = allocatedEnd;
+	char buf[64];
+	while (end != 0)
+	{
+		const size_t len = min<FilePosition>(end, sizeof(buf));
+		if (!logFile.Seek(end - len) || logFile.Read(buf, len) != (int)len)
+		{
+			break;
+		}
+		size_t i = len;
+		while (i != 0 && buf[i - 1] == 0)
+		{
+			--i;
+		}
+		end -= len - i;
+		if (i != 0)
+		{
+			break;
+		}
+	}
+	return end;
+}
+
+// Extend the file with zeros so that the clusters for the next LogFileExtent bytes of messages are allocated together, instead of being interleaved
+// with the clusters of files written while we are logging. The file is truncated to the logged data when logging is stopped.
+// Caller must already have checked and set inLogger.
+void Logger::Preallocate(FilePosition currentPos)
+{
+	allocatedEnd = max<FilePosition>(allocatedEnd, logFile.Length());
+	if (logFile.Seek(allocatedEnd))
+	{
+		const uint32_t zeros[64] = { 0 };
+		const FilePosition newEnd = currentPos + LogFileExtent;
+		while (allocatedEnd < newEnd && logFile.Write(reinterpret_cast<const char*>(zeros), sizeof(zeros)))
+		{
+			allocatedEnd += sizeof(zeros);
+		}
+	}
+	logFile.Seek(currentPos);
+}
+
 // Write the data and time to the file followed by a space.
 // Caller must already have checked and set inLogger.
 bool Logger::WriteDateTime(time_t time)
@@ -28,10 +28,13 @@ public:
 private:
 	bool WriteDateTime(time_t time);
 	void InternalLogMessage(time_t time, const char *message);
+	FilePosition FindEndOfData();
+	void Preallocate(FilePosition currentPos);
 
 	FileData logFile;
 	uint32_t lastFlushTime;
 	FilePosition lastFlushFileSize;
+	FilePosition allocatedEnd;						// the length of the file including the preallocated zeros after the logged data
 	bool dirty;
 	bool inLogger;
 };
@@ -0,0 +1,121 @@
+/*
+ * MessageLimiter.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "MessageLimiter.h"
+
+MessageLimiter::MessageLimiter()
+{
+	for (Source& s : sources)
+	{
+		s.hash = 0;
+		s.numSuppressed = 0;
+	}
+}
+
+void MessageLimiter::Init()
+{
+	mutex.Create("MessageLimiter");
+}
+
+// Hash the message type and source using FNV-1a. We never return zero, because that marks a free entry.
+/*static*/ uint32_t MessageLimiter::Hash(MessageType type, const char *source)
+{
+	uint32_t hash = (2166136261u ^ (uint32_t)type) * 16777619u;
+	while (*source != 0)
+	{
+		hash = (hash ^ (uint8_t)*source++) * 16777619u;
+	}
+	return (hash == 0) ? 1 : hash;
+}
+
+/*static*/ void MessageLimiter::MakeRepeatReport(const Source& s, const StringRef& repeatReport)
+{
+	repeatReport.copy(s.text.c_str());
+	const size_t len = repeatReport.strlen();
+	if (len != 0 && repeatReport[len - 1] == '\n')
+	{
+		repeatReport.Truncate(len - 1);
+	}
+	repeatReport.catf(" [repeated %" PRIu32 " times]\n", s.numSuppressed);
+}
+
+// Decide whether a message may be sent. If we suppressed earlier messages from the same source then we return true with the report of them in repeatReport,
+// which the caller should send first; otherwise repeatReport is empty.
+bool MessageLimiter::Allow(MessageType type, const char *source, const char *text, const StringRef& repeatReport)
+{
+	repeatReport.Clear();
+	const uint32_t hash = Hash(type, source);
+	const uint32_t now = millis();
+	MutexLocker lock(mutex);
+
+	Source *entry = nullptr;
+	for (Source& s : sources)
+	{
+		if (s.hash == hash)
+		{
+			if (now - s.whenAllowed < RepeatWindowMillis)
+			{
+				++s.numSuppressed;
+				return false;
+			}
+			if (s.numSuppressed != 0)
+			{
+				MakeRepeatReport(s, repeatReport);
+			}
+			entry = &s;
+			break;
+		}
+	}
+
+	if (entry == nullptr)
+	{
+		// This is a new source, so use a free entry or else the oldest one that has no suppressed messages to report
+		for (Source& s : sources)
+		{
+			if (s.hash == 0)
+			{
+				entry = &s;
+				break;
+			}
+			if (s.numSuppressed == 0 && (entry == nullptr || now - s.whenAllowed > now - entry->whenAllowed))
+			{
+				entry = &s;
+			}
+		}
+	}
+
+	// If every entry holds suppressed messages that we haven't reported yet then we send this message without tracking it
+	if (entry != nullptr)
+	{
+		entry->hash = hash;
+		entry->whenAllowed = now;
+		entry->numSuppressed = 0;
+		entry->type = type;
+		entry->text.copy(text);
+	}
+	return true;
+}
+
+// Find a source whose window has ended with messages suppressed, and report them. Called regularly by Platform::Spin.
+bool MessageLimiter::GetRepeatReport(const StringRef& repeatReport, MessageType& type)
+{
+	const uint32_t now = millis();
+	MutexLocker lock(mutex);
+	for (Source& s : sources)
+	{
+		if (s.hash != 0 && s.numSuppressed != 0 && now - s.whenAllowed >= RepeatWindowMillis)
+		{
+			MakeRepeatReport(s, repeatReport);
+			type = s.type;
+			s.numSuppressed = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+// End
@@ -0,0 +1,50 @@
+/*
+ * MessageLimiter.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MESSAGELIMITER_H_
+#define SRC_MESSAGELIMITER_H_
+
+#include "RepRapFirmware.h"
+#include "MessageType.h"
+#include "RTOSIface/RTOSIface.h"
+
+// This class limits how often error and warning messages from the same source are sent, so that a repeating error can't flood the output channels and use up the output buffers.
+// The source of a message is its format string, so messages that differ only in the values they report count as the same.
+// Each source may send one message per RepeatWindowMillis. We count the messages we suppress, and report the count when the next message is allowed or the window ends.
+class MessageLimiter
+{
+public:
+	static constexpr size_t MaxTextLength = 40;					// how much of the message we keep to identify it in the repeat report
+	static constexpr size_t MaxRepeatReportLength = MaxTextLength + 30;
+
+	MessageLimiter();
+
+	void Init();
+	bool Allow(MessageType type, const char *source, const char *text, const StringRef& repeatReport);	// Return true if the message may be sent, after any report of repeats
+	bool GetRepeatReport(const StringRef& repeatReport, MessageType& type);							// Return true if there are suppressed messages whose window has ended
+
+private:
+	static constexpr size_t NumSources = 8;
+	static constexpr uint32_t RepeatWindowMillis = 2000;
+
+	struct Source
+	{
+		uint32_t hash;											// the hash of the message type and source, or zero if this entry is free
+		uint32_t whenAllowed;									// when we last sent a message from this source
+		uint32_t numSuppressed;									// how many messages we have suppressed since then
+		MessageType type;
+		String<MaxTextLength> text;								// the start of the last message we sent from this source
+	};
+
+	static uint32_t Hash(MessageType type, const char *source);
+	static void MakeRepeatReport(const Source& s, const StringRef& repeatReport);
+
+	Source sources[NumSources];
+	Mutex mutex;
+};
+
+#endif /* SRC_MESSAGELIMITER_H_ */
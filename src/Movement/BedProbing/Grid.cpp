@@ -26,7 +26,7 @@ const char * const GridDefinition::HeightMapLabelLines[] =
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(GridDefinition, _ret)
 
-const ObjectModelTableEntry GridDefinition::objectModelTable[] =
+constexpr ObjectModelTableEntry GridDefinition::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "radius", OBJECT_MODEL_FUNC(&(self->radius)), TYPE_OF(float), ObjectModelTableEntry::none }
@@ -64,9 +64,9 @@ void GridDefinition::CheckValidity()
 	numX = (xMax - xMin >= MinRange && xSpacing >= MinSpacing) ? (uint32_t)((xMax - xMin)/xSpacing) + 1 : 0;
 	numY = (yMax - yMin >= MinRange && ySpacing >= MinSpacing) ? (uint32_t)((yMax - yMin)/ySpacing) + 1 : 0;
 
-	isValid = NumPoints() != 0 && NumPoints() <= MaxGridProbePoints
+	isValid = NumPoints() != 0 && NumPoints() <= MaxHeightMapPoints
 			&& (radius < 0.0 || radius >= 1.0)
-			&& NumXpoints() <= MaxXGridPoints;
+			&& NumXpoints() <= MaxHeightMapXPoints;
 
 	if (isValid)
 	{
@@ -90,6 +90,13 @@ bool GridDefinition::IsInRadius(float x, float y) const
 	return radius < 0.0 || x * x + y * y < radius * radius;
 }
 
+// Return true if the other grid has the same parameters as this one
+bool GridDefinition::IsSameGrid(const GridDefinition& other) const
+{
+	return xMin == other.xMin && xMax == other.xMax && yMin == other.yMin && yMax == other.yMax
+		&& radius == other.radius && xSpacing == other.xSpacing && ySpacing == other.ySpacing;
+}
+
 // Append the grid parameters to the end of a string
 void GridDefinition::PrintParameters(const StringRef& s) const
 {
@@ -213,15 +220,15 @@ void GridDefinition::PrintError(float originalXrange, float originalYrange, cons
 	{
 		r.cat("Y range too small");
 	}
-	else if (   numX > MaxXGridPoints
-			 || numX > MaxGridProbePoints || numY > MaxGridProbePoints		// check X and Y individually in case X*Y overflows
-			 || NumPoints() > MaxGridProbePoints
+	else if (   numX > MaxHeightMapXPoints
+			 || numX > MaxHeightMapPoints || numY > MaxHeightMapPoints		// check X and Y individually in case X*Y overflows
+			 || NumPoints() > MaxHeightMapPoints
 			)
 	{
 		const float totalRange = originalXrange + originalYrange;
 		const float area = originalXrange * originalYrange;
-		const float minSpacing = (totalRange + sqrtf(fsquare(totalRange) + 4.0 * (MaxGridProbePoints - 1) * area))/(2.0 * (MaxGridProbePoints - 1));
-		const float minXspacing = originalXrange/(MaxXGridPoints - 1);
+		const float minSpacing = (totalRange + sqrtf(fsquare(totalRange) + 4.0 * (MaxHeightMapPoints - 1) * area))/(2.0 * (MaxHeightMapPoints - 1));
+		const float minXspacing = originalXrange/(MaxHeightMapXPoints - 1);
 		r.catf("Too many grid points; suggest increase spacing to %.1fmm", (double)max<float>(minSpacing, minXspacing));
 	}
 	else
@@ -234,7 +241,13 @@ void GridDefinition::PrintError(float originalXrange, float originalYrange, cons
 // Increase the version number in the following string whenever we change the format of the height map file.
 const char * const HeightMap::HeightMapComment = "RepRapFirmware height map file v2";
 
-HeightMap::HeightMap() : useMap(false) { }
+HeightMap::HeightMap() : useMap(false),
+#if HEIGHTMAP_USE_COEFFICIENTS
+	coefficientsValid(false),
+#endif
+	lastCell(0)
+{
+}
 
 void HeightMap::SetGrid(const GridDefinition& gd)
 {
@@ -249,15 +262,21 @@ void HeightMap::ClearGridHeights()
 	{
 		gridHeightSet[i] = 0;
 	}
+#if HEIGHTMAP_USE_COEFFICIENTS
+	coefficientsValid = false;
+#endif
 }
 
 // Set the height of a grid point
 void HeightMap::SetGridHeight(size_t xIndex, size_t yIndex, float height)
 {
+#if HEIGHTMAP_USE_COEFFICIENTS
+	coefficientsValid = false;
+#endif
 	size_t index = yIndex * def.numX + xIndex;
-	if (index < MaxGridProbePoints)
+	if (index < MaxHeightMapPoints)
 	{
-		gridHeights[index] = height;
+		StoreHeight(index, height);
 		gridHeightSet[index/32] |= 1u << (index & 31u);
 	}
 }
@@ -275,6 +294,63 @@ unsigned int HeightMap::GetMinimumSegments(float deltaX, float deltaY) const
 	return max<unsigned int>(xSegments, ySegments);
 }
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+
+// Return the minimum number of segments for a move by this X or Y amount if each segment may cross up to maxCrossings grid lines, which must be at least 3.
+// A segment that spans N grid spacings may cross N + 1 grid lines, so we allow for one extra crossing in each direction.
+unsigned int HeightMap::GetMinimumStreamedSegments(float deltaX, float deltaY, size_t maxCrossings) const
+{
+	const float spacings = fabsf(deltaX) * def.recipXspacing + fabsf(deltaY) * def.recipYspacing;
+	return max<unsigned int>(1, (unsigned int)ceilf(spacings/(float)(maxCrossings - 2)));
+}
+
+// Find the fractions of the move from (x0, y0) to (x1, y1) at which it crosses the grid lines, in increasing order, ignoring crossings very close to either end.
+// Return the number of crossings. If there are more than maxCrossings then only the first maxCrossings are stored, but the return value is still the total.
+size_t HeightMap::GetGridLineCrossings(float x0, float y0, float x1, float y1, float fractions[], size_t maxCrossings) const
+{
+	constexpr float MinFraction = 0.001;			// ignore crossings closer than this to the ends of the move
+	size_t numCrossings = 0;
+	const auto addCrossings = [fractions, maxCrossings, &numCrossings](float start, float end, float gridMin, float spacing, float recipSpacing, uint32_t numLines)
+	{
+		const float delta = end - start;
+		if (delta != 0.0)
+		{
+			// Find the first and last grid lines strictly between start and end
+			const float lowCoord = min<float>(start, end), highCoord = max<float>(start, end);
+			const int32_t firstLine = max<int32_t>((int32_t)floorf((lowCoord - gridMin) * recipSpacing) + 1, 0);
+			const int32_t lastLine = min<int32_t>((int32_t)ceilf((highCoord - gridMin) * recipSpacing) - 1, (int32_t)numLines - 1);
+			for (int32_t line = firstLine; line <= lastLine; ++line)
+			{
+				const float f = (gridMin + (float)line * spacing - start)/delta;
+				if (f > MinFraction && f < 1.0 - MinFraction)
+				{
+					// Insert it in order
+					size_t j = min<size_t>(numCrossings, maxCrossings);
+					while (j != 0 && fractions[j - 1] > f)
+					{
+						if (j < maxCrossings)
+						{
+							fractions[j] = fractions[j - 1];
+						}
+						--j;
+					}
+					if (j < maxCrossings)
+					{
+						fractions[j] = f;
+					}
+					++numCrossings;
+				}
+			}
+		}
+	};
+
+	addCrossings(x0, x1, def.xMin, def.xSpacing, def.recipXspacing, def.numX);
+	addCrossings(y0, y1, def.yMin, def.ySpacing, def.recipYspacing, def.numY);
+	return numCrossings;
+}
+
+#endif
+
 // Save the grid to file returning true if an error occurred
 bool HeightMap::SaveToFile(FileStore *f, float zOffset) const
 {
@@ -319,7 +395,7 @@ bool HeightMap::SaveToFile(FileStore *f, float zOffset) const
 			}
 			if (IsHeightSet(index))
 			{
-				buf.catf("%7.3f", (double)(gridHeights[index] + zOffset));
+				buf.catf("%7.3f", (double)(GetHeight(index) + zOffset));
 			}
 			else
 			{
@@ -340,7 +416,7 @@ bool HeightMap::SaveToFile(FileStore *f, float zOffset) const
 // Load the grid from file, returning true if an error occurred with the error reason appended to the buffer
 bool HeightMap::LoadFromFile(FileStore *f, const StringRef& r)
 {
-	const size_t MaxLineLength = (MaxXGridPoints * 8) + 2;						// maximum length of a line in the height map file, need 8 characters per grid point
+	const size_t MaxLineLength = (MaxHeightMapXPoints * 8) + 2;						// maximum length of a line in the height map file, need 8 characters per grid point
 	const char* const readFailureText = "failed to read line from file";
 	char buffer[MaxLineLength + 1];
 	StringRef s(buffer, ARRAY_SIZE(buffer));
@@ -423,6 +499,107 @@ bool HeightMap::LoadFromFile(FileStore *f, const StringRef& r)
 	return true;											// an error occurred
 }
 
+// Save a binary copy of the grid, which can be loaded much faster than the CSV file. Return true if an error occurred.
+// The length and modification time of the CSV file are recorded so that we can tell whether the binary copy is still up to date.
+// If any height is too large to be held as an int16_t in microns, we don't make a binary copy.
+bool HeightMap::SaveToBinaryFile(FileStore *f, float zOffset, uint32_t csvLength, uint32_t csvTime) const
+{
+	BinaryHeader header;
+	header.magic = BinaryMagic;
+	header.version = BinaryVersion;
+	header.headerSize = sizeof(BinaryHeader);
+	header.csvLength = csvLength;
+	header.csvTime = csvTime;
+	const float gridParameters[7] = { def.xMin, def.xMax, def.yMin, def.yMax, def.radius, def.xSpacing, def.ySpacing };
+	for (size_t i = 0; i < ARRAY_SIZE(gridParameters); ++i)
+	{
+		header.gridParameters[i] = lrintf(gridParameters[i] * BinaryGridUnitsPerMm);
+	}
+	header.numX = (uint16_t)def.numX;
+	header.numY = (uint16_t)def.numY;
+	if (!f->Write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)))
+	{
+		return true;
+	}
+
+	int16_t heights[BinaryHeightsPerBlock];
+	const uint32_t numPoints = def.NumPoints();
+	for (uint32_t index = 0; index < numPoints; )
+	{
+		size_t count = 0;
+		while (count < BinaryHeightsPerBlock && index < numPoints)
+		{
+			int32_t height = BinaryHeightNotSet;
+			if (IsHeightSet(index))
+			{
+				height = lrint(((double)GetHeight(index) + (double)zOffset) * BinaryHeightUnitsPerMm);
+				if (height <= BinaryHeightNotSet || height > INT16_MAX)
+				{
+					return true;
+				}
+			}
+			heights[count++] = (int16_t)height;
+			++index;
+		}
+		if (!f->Write(reinterpret_cast<const uint8_t*>(heights), count * sizeof(int16_t)))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Load a binary copy of the grid, returning true if an error occurred or the copy doesn't match the CSV file with the given length and modification time.
+// We check the header before changing anything, so that the caller can load the CSV file instead.
+bool HeightMap::LoadFromBinaryFile(FileStore *f, uint32_t csvLength, uint32_t csvTime)
+{
+	BinaryHeader header;
+	if (   f->Read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != (int)sizeof(header)
+		|| header.magic != BinaryMagic || header.version != BinaryVersion || header.headerSize != sizeof(BinaryHeader)
+		|| header.csvLength != csvLength || header.csvTime != csvTime
+	   )
+	{
+		return true;
+	}
+
+	float xRange[2], yRange[2], spacings[2];
+	xRange[0] = (float)header.gridParameters[0]/BinaryGridUnitsPerMm;
+	xRange[1] = (float)header.gridParameters[1]/BinaryGridUnitsPerMm;
+	yRange[0] = (float)header.gridParameters[2]/BinaryGridUnitsPerMm;
+	yRange[1] = (float)header.gridParameters[3]/BinaryGridUnitsPerMm;
+	const float radius = (float)header.gridParameters[4]/BinaryGridUnitsPerMm;
+	spacings[0] = (float)header.gridParameters[5]/BinaryGridUnitsPerMm;
+	spacings[1] = (float)header.gridParameters[6]/BinaryGridUnitsPerMm;
+	GridDefinition newGrid;
+	if (!newGrid.Set(xRange, yRange, radius, spacings) || newGrid.numX != header.numX || newGrid.numY != header.numY)
+	{
+		return true;
+	}
+
+	SetGrid(newGrid);
+	int16_t heights[BinaryHeightsPerBlock];
+	const uint32_t numPoints = def.NumPoints();
+	for (uint32_t index = 0; index < numPoints; )
+	{
+		const size_t count = min<size_t>(BinaryHeightsPerBlock, numPoints - index);
+		if (f->Read(reinterpret_cast<uint8_t*>(heights), count * sizeof(int16_t)) != (int)(count * sizeof(int16_t)))
+		{
+			ClearGridHeights();
+			return true;
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (heights[i] != BinaryHeightNotSet)
+			{
+				SetGridHeight(index % def.numX, index / def.numX, (float)heights[i]/BinaryHeightUnitsPerMm);
+			}
+			++index;
+		}
+	}
+	ExtrapolateMissing();
+	return false;
+}
+
 // Return number of points probed, mean and RMS deviation, min and max error
 unsigned int HeightMap::GetStatistics(float& mean, float& deviation, float& minError, float& maxError) const
 {
@@ -435,7 +612,7 @@ unsigned int HeightMap::GetStatistics(float& mean, float& deviation, float& minE
 		if (IsHeightSet(i))
 		{
 			++numProbed;
-			const float fHeightError = gridHeights[i];
+			const float fHeightError = GetHeight(i);
 			if (fHeightError > maxError)
 			{
 				maxError = fHeightError;
@@ -462,9 +639,17 @@ unsigned int HeightMap::GetStatistics(float& mean, float& deviation, float& minE
 }
 
 // Try to turn mesh compensation on or off and report the state achieved
+// The grid heights are only changed while mesh compensation is off, so this is where we bring the cell coefficients up to date.
 bool HeightMap::UseHeightMap(bool b)
 {
-	useMap = b && def.IsValid();
+	const bool newUseMap = b && def.IsValid();
+#if HEIGHTMAP_USE_COEFFICIENTS
+	if (newUseMap && !coefficientsValid)
+	{
+		BuildCoefficients();
+	}
+#endif
+	useMap = newUseMap;
 	return useMap;
 }
 
@@ -489,31 +674,80 @@ float HeightMap::GetInterpolatedHeightError(float x, float y) const
 
 
 	const float xf = (x - def.xMin) * def.recipXspacing;
-	const float xFloor = floor(xf);
-	const int32_t xIndex = (int32_t)xFloor;
 	const float yf = (y - def.yMin) * def.recipYspacing;
-	const float yFloor = floor(yf);
-	const int32_t yIndex = (int32_t)yFloor;
 
-	return InterpolateXY(xIndex, yIndex, xf - xFloor, yf - yFloor);
+	// Successive calls are usually for points in the same cell, so try the cell we used last time before we work out which cell the point is in.
+	// This saves two calls to floorf on processors that have no instruction for it. Read lastCell just once, because another task may change it.
+	const uint32_t cell = lastCell;
+	uint32_t xIndex = cell & 0xFFFF;
+	uint32_t yIndex = cell >> 16;
+	float xFrac = xf - (float)xIndex;
+	float yFrac = yf - (float)yIndex;
+	if (xFrac < 0.0 || xFrac >= 1.0 || yFrac < 0.0 || yFrac >= 1.0)
+	{
+		const float xFloor = floorf(xf);
+		const float yFloor = floorf(yf);
+		xIndex = (uint32_t)xFloor;
+		yIndex = (uint32_t)yFloor;
+		xFrac = xf - xFloor;
+		yFrac = yf - yFloor;
+		lastCell = (yIndex << 16) | xIndex;
+	}
+
+	return InterpolateXY(xIndex, yIndex, xFrac, yFrac);
 }
 
 float HeightMap::InterpolateXY(uint32_t xIndex, uint32_t yIndex, float xFrac, float yFrac) const
 {
+#if HEIGHTMAP_USE_COEFFICIENTS
+	if (coefficientsValid)
+	{
+		const uint32_t index = GetMapIndex(xIndex, yIndex);
+		const CellCoefficients& coeffs = cellCoefficients[index];
+		return GetHeight(index) + (coeffs.xGradient + coeffs.twist * yFrac) * xFrac + coeffs.yGradient * yFrac;
+	}
+#endif
+
 	const uint32_t indexX0Y0 = GetMapIndex(xIndex, yIndex);			// (X0,Y0)
 	const uint32_t indexX1Y0 = indexX0Y0 + 1;						// (X1,Y0)
 	const uint32_t indexX0Y1 = indexX0Y0 + def.numX;				// (X0 Y1)
 	const uint32_t indexX1Y1 = indexX0Y1 + 1;						// (X1,Y1)
 
 	const float xyFrac = xFrac * yFrac;
-	return (gridHeights[indexX0Y0] * (1.0 - xFrac - yFrac + xyFrac))
-			+ (gridHeights[indexX1Y0] * (xFrac - xyFrac))
-			+ (gridHeights[indexX0Y1] * (yFrac - xyFrac))
-			+ (gridHeights[indexX1Y1] * xyFrac);
+	return (GetHeight(indexX0Y0) * (1.0 - xFrac - yFrac + xyFrac))
+			+ (GetHeight(indexX1Y0) * (xFrac - xyFrac))
+			+ (GetHeight(indexX0Y1) * (yFrac - xyFrac))
+			+ (GetHeight(indexX1Y1) * xyFrac);
 }
 
+#if HEIGHTMAP_USE_COEFFICIENTS
+
+// Calculate the interpolation coefficients of every grid cell from the grid heights
+void HeightMap::BuildCoefficients()
+{
+	for (uint32_t iY = 0; iY + 1 < def.numY; ++iY)
+	{
+		for (uint32_t iX = 0; iX + 1 < def.numX; ++iX)
+		{
+			const uint32_t indexX0Y0 = GetMapIndex(iX, iY);
+			const uint32_t indexX0Y1 = indexX0Y0 + def.numX;
+			CellCoefficients& coeffs = cellCoefficients[indexX0Y0];
+			coeffs.xGradient = GetHeight(indexX0Y0 + 1) - GetHeight(indexX0Y0);
+			coeffs.yGradient = GetHeight(indexX0Y1) - GetHeight(indexX0Y0);
+			coeffs.twist = GetHeight(indexX0Y1 + 1) - GetHeight(indexX0Y1) - coeffs.xGradient;
+		}
+	}
+	coefficientsValid = true;
+}
+
+#endif
+
 void HeightMap::ExtrapolateMissing()
 {
+#if HEIGHTMAP_USE_COEFFICIENTS
+	coefficientsValid = false;
+#endif
+
 	//1: calculating the bed plane by least squares fit
 	//2: filling in missing points
 
@@ -529,7 +763,7 @@ void HeightMap::ExtrapolateMissing()
 			{
 				const float fX = (def.xSpacing * iX) + def.xMin;
 				const float fY = (def.ySpacing * iY) + def.yMin;
-				const float fZ = gridHeights[index];
+				const float fZ = GetHeight(index);
 
 				n++;
 				sumX += fX; sumY += fY; sumZ += fZ;
@@ -553,7 +787,7 @@ void HeightMap::ExtrapolateMissing()
 			{
 				const float fX = (def.xSpacing * iX) + def.xMin;
 				const float fY = (def.ySpacing * iY) + def.yMin;
-				const float fZ = gridHeights[index];
+				const float fZ = GetHeight(index);
 
 				const float rX = fX - centX;
 				const float rY = fY - centY;
@@ -597,7 +831,7 @@ void HeightMap::ExtrapolateMissing()
 				const float fX = (def.xSpacing * iX) + def.xMin;
 				const float fY = (def.ySpacing * iY) + def.yMin;
 				const float fZ = (d - (a * fX + b * fY)) * invC;
-				gridHeights[index] = fZ;	// fill in Z but don't mark it as set so we can always differentiate between measured and extrapolated
+				StoreHeight(index, fZ);	// fill in Z but don't mark it as set so we can always differentiate between measured and extrapolated
 			}
 		}
 	}
@@ -11,6 +11,20 @@
 #include "RepRapFirmware.h"
 #include "ObjectModel/ObjectModel.h"
 
+#if SUPPORT_COMPACT_HEIGHT_MAP
+# define HEIGHTMAP_USE_COEFFICIENTS	(0)		// the coefficients would use six times as much RAM as the compact heights do
+constexpr size_t MaxHeightMapPoints = 2 * MaxGridProbePoints;			// heights held as int16_t use half the RAM of floats, so we can hold twice as many
+constexpr size_t MaxHeightMapXPoints = (3 * MaxXGridPoints)/2;			// allow a finer grid in X too, but keep the CSV line buffer a reasonable size
+#else
+# if SAM4E || SAME70
+#  define HEIGHTMAP_USE_COEFFICIENTS	(1)		// 1 to precompute the bilinear interpolation coefficients of each grid cell
+# else
+#  define HEIGHTMAP_USE_COEFFICIENTS	(0)		// not enough RAM to spare on the smaller processors
+# endif
+constexpr size_t MaxHeightMapPoints = MaxGridProbePoints;
+constexpr size_t MaxHeightMapXPoints = MaxXGridPoints;
+#endif
+
 // This class defines the bed probing grid
 class GridDefinition INHERIT_OBJECT_MODEL
 {
@@ -26,6 +40,7 @@ public:
 	float GetYCoordinate(unsigned int yIndex) const;
 	bool IsInRadius(float x, float y) const;
 	bool IsValid() const { return isValid; }
+	bool IsSameGrid(const GridDefinition& other) const;
 
 	bool Set(const float xRange[2], const float yRange[2], float pRadius, const float pSpacings[2]);
 	void PrintParameters(const StringRef& r) const;
@@ -75,7 +90,16 @@ public:
 
 	bool LoadFromFile(FileStore *f, const StringRef& r);			// Load the grid from file returning true if an error occurred
 
+	bool SaveToBinaryFile(FileStore *f, float zOffset, uint32_t csvLength, uint32_t csvTime) const	// Save a binary copy of the grid returning true if an error occurred
+	pre(IsValid());
+
+	bool LoadFromBinaryFile(FileStore *f, uint32_t csvLength, uint32_t csvTime);	// Load a binary copy of the grid returning true if an error occurred or it is out of date
+
 	unsigned int GetMinimumSegments(float deltaX, float deltaY) const;	// Return the minimum number of segments for a move by this X or Y amount
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	unsigned int GetMinimumStreamedSegments(float deltaX, float deltaY, size_t maxCrossings) const;	// Return the minimum number of segments if each may cross maxCrossings grid lines
+	size_t GetGridLineCrossings(float x0, float y0, float x1, float y1, float fractions[], size_t maxCrossings) const;	// Find where a move crosses the grid lines
+#endif
 
 	bool UseHeightMap(bool b);
 	bool UsingHeightMap() const { return useMap; }
@@ -87,15 +111,60 @@ public:
 private:
 	static const char * const HeightMapComment;						// The start of the comment we write at the start of the height map file
 
+	// The binary height map file starts with this header, followed by the heights in the same order as in the CSV file
+	struct BinaryHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t headerSize;
+		uint32_t csvLength;											// the length and modification time of the CSV file that this is a copy of
+		uint32_t csvTime;
+		int32_t gridParameters[7];									// xMin, xMax, yMin, yMax, radius, xSpacing, ySpacing in units of 0.01mm, the precision of the CSV file
+		uint16_t numX, numY;
+	};
+
+	static constexpr uint32_t BinaryMagic = 0x4D485252;				// "RRHM" in little-endian order
+	static constexpr uint16_t BinaryVersion = 1;
+	static constexpr float BinaryGridUnitsPerMm = 100.0;
+	static constexpr float BinaryHeightUnitsPerMm = 1000.0;			// heights are held as int16_t in microns, the precision of the CSV file
+	static constexpr int16_t BinaryHeightNotSet = INT16_MIN;
+	static constexpr size_t BinaryHeightsPerBlock = 64;				// how many heights we read or write at a time
+
 	GridDefinition def;
-	float gridHeights[MaxGridProbePoints];							// The Z coordinates of the points on the bed that were probed
-	uint32_t gridHeightSet[(MaxGridProbePoints + 31)/32];			// Bitmap of which heights are set
+#if SUPPORT_COMPACT_HEIGHT_MAP
+	static constexpr float HeightUnitsPerMm = 1000.0;				// heights are held in microns, the precision of the height map file
+	int16_t gridHeights[MaxHeightMapPoints];						// The Z coordinates of the points on the bed that were probed
+#else
+	float gridHeights[MaxHeightMapPoints];							// The Z coordinates of the points on the bed that were probed
+#endif
+	uint32_t gridHeightSet[(MaxHeightMapPoints + 31)/32];			// Bitmap of which heights are set
 	bool useMap;													// True to do bed compensation
+#if HEIGHTMAP_USE_COEFFICIENTS
+	bool coefficientsValid;											// True if cellCoefficients matches gridHeights
+
+	// Within a cell the height is gridHeights[index] + xGradient * xFrac + yGradient * yFrac + twist * xFrac * yFrac, where index is the map index of the cell's lowest corner
+	struct CellCoefficients
+	{
+		float xGradient, yGradient, twist;
+	};
+	CellCoefficients cellCoefficients[MaxHeightMapPoints];			// Indexed by the map index of the lowest corner of each cell
+#endif
+	mutable volatile uint32_t lastCell;								// The cell we looked up last, X index in the low 16 bits and Y index in the high 16 bits
 
 	uint32_t GetMapIndex(uint32_t xIndex, uint32_t yIndex) const { return (yIndex * def.NumXpoints()) + xIndex; }
 	bool IsHeightSet(uint32_t index) const { return (gridHeightSet[index/32] & (1 << (index & 31))) != 0; }
+#if SUPPORT_COMPACT_HEIGHT_MAP
+	float GetHeight(uint32_t index) const { return (float)gridHeights[index] * (1.0/HeightUnitsPerMm); }
+	void StoreHeight(uint32_t index, float height) { gridHeights[index] = (int16_t)constrain<long>(lrintf(height * HeightUnitsPerMm), -INT16_MAX, INT16_MAX); }
+#else
+	float GetHeight(uint32_t index) const { return gridHeights[index]; }
+	void StoreHeight(uint32_t index, float height) { gridHeights[index] = height; }
+#endif
 
 	float InterpolateXY(uint32_t xIndex, uint32_t yIndex, float xFrac, float yFrac) const;
+#if HEIGHTMAP_USE_COEFFICIENTS
+	void BuildCoefficients();
+#endif
 };
 
 #endif /* SRC_MOVEMENT_GRID_H_ */
@@ -0,0 +1,152 @@
+/*
+ * GridProbeOrder.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "GridProbeOrder.h"
+#include "RepRap.h"
+#include "Movement/Move.h"
+#include <utility>					// for std::swap
+
+GridProbeOrder::GridProbeOrder() : xOffset(0.0), yOffset(0.0), numPoints(0), numUnreachable(0), valid(false)
+{
+}
+
+void GridProbeOrder::Prepare(const GridDefinition& newGrid, float newXoffset, float newYoffset)
+{
+	if (valid && grid.IsSameGrid(newGrid) && xOffset == newXoffset && yOffset == newYoffset)
+	{
+		return;
+	}
+
+	grid = newGrid;
+	xOffset = newXoffset;
+	yOffset = newYoffset;
+	BuildSerpentinePath();
+
+	// See whether we can find a shorter order. On a fully reachable rectangular grid the serpentine order is already as short as possible.
+	if (numPoints > 3)
+	{
+		const float serpentineLength = PathLength();
+		BuildNearestNeighbourPath();
+		ImproveByTwoOpt();
+		if (PathLength() >= serpentineLength)
+		{
+			BuildSerpentinePath();
+		}
+	}
+	valid = true;
+}
+
+// Collect the points we can probe in the usual serpentine order, alternating the direction of the rows
+void GridProbeOrder::BuildSerpentinePath()
+{
+	const Move& move = reprap.GetMove();
+	numPoints = 0;
+	numUnreachable = 0;
+	for (size_t yIndex = 0; yIndex < grid.NumYpoints(); ++yIndex)
+	{
+		for (size_t i = 0; i < grid.NumXpoints(); ++i)
+		{
+			const size_t xIndex = (yIndex & 1) ? grid.NumXpoints() - 1 - i : i;
+			const float x = grid.GetXCoordinate(xIndex);
+			const float y = grid.GetYCoordinate(yIndex);
+			if (grid.IsInRadius(x, y))
+			{
+				if (move.IsAccessibleProbePoint(x, y))
+				{
+					order[numPoints++] = (uint16_t)(yIndex * grid.NumXpoints() + xIndex);
+				}
+				else
+				{
+					++numUnreachable;
+				}
+			}
+		}
+	}
+}
+
+bool GridProbeOrder::GetPoint(size_t n, size_t& xIndex, size_t& yIndex) const
+{
+	if (n >= numPoints)
+	{
+		return false;
+	}
+	xIndex = order[n] % grid.NumXpoints();
+	yIndex = order[n] / grid.NumXpoints();
+	return true;
+}
+
+float GridProbeOrder::Distance(size_t a, size_t b) const
+{
+	const size_t numX = grid.NumXpoints();
+	const float dx = grid.GetXCoordinate(order[a] % numX) - grid.GetXCoordinate(order[b] % numX);
+	const float dy = grid.GetYCoordinate(order[a] / numX) - grid.GetYCoordinate(order[b] / numX);
+	return sqrtf(fsquare(dx) + fsquare(dy));
+}
+
+float GridProbeOrder::PathLength() const
+{
+	float length = 0.0;
+	for (size_t i = 1; i < numPoints; ++i)
+	{
+		length += Distance(i - 1, i);
+	}
+	return length;
+}
+
+// Reorder the points so that each one is followed by the nearest one not yet visited, starting from the same first point as the serpentine order
+void GridProbeOrder::BuildNearestNeighbourPath()
+{
+	for (size_t i = 1; i < numPoints; ++i)
+	{
+		size_t nearest = i;
+		float nearestDistance = Distance(i - 1, i);
+		for (size_t j = i + 1; j < numPoints; ++j)
+		{
+			const float d = Distance(i - 1, j);
+			if (d < nearestDistance)
+			{
+				nearest = j;
+				nearestDistance = d;
+			}
+		}
+		std::swap(order[i], order[nearest]);
+	}
+}
+
+// Shorten the path by reversing sections of it where that removes a crossing. The path is open, so the last point may be reconnected too.
+void GridProbeOrder::ImproveByTwoOpt()
+{
+	constexpr float MinGain = 0.01;										// ignore improvements that are within rounding error
+	for (unsigned int pass = 0; pass < MaxTwoOptPasses; ++pass)
+	{
+		bool improved = false;
+		for (size_t i = 0; i + 2 < numPoints; ++i)
+		{
+			for (size_t j = i + 2; j < numPoints; ++j)
+			{
+				// Consider replacing edges (i, i+1) and (j, j+1) by (i, j) and (i+1, j+1), which means reversing points i+1 to j
+				const bool last = (j + 1 == numPoints);
+				const float oldLength = Distance(i, i + 1) + ((last) ? 0.0 : Distance(j, j + 1));
+				const float newLength = Distance(i, j) + ((last) ? 0.0 : Distance(i + 1, j + 1));
+				if (newLength + MinGain < oldLength)
+				{
+					for (size_t lo = i + 1, hi = j; lo < hi; ++lo, --hi)
+					{
+						std::swap(order[lo], order[hi]);
+					}
+					improved = true;
+				}
+			}
+		}
+		if (!improved)
+		{
+			break;
+		}
+	}
+}
+
+// End
@@ -0,0 +1,44 @@
+/*
+ * GridProbeOrder.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_BEDPROBING_GRIDPROBEORDER_H_
+#define SRC_MOVEMENT_BEDPROBING_GRIDPROBEORDER_H_
+
+#include "Grid.h"
+
+// This class holds the order in which G29 probes the points of the grid when it stops at each point.
+// We start from the usual serpentine order and try to shorten the travel between points using a nearest-neighbour tour improved by 2-opt,
+// keeping whichever order is shorter. Points outside the grid radius or unreachable by the Z probe are left out.
+// Working out the order is quadratic in the number of points, so we keep it until the grid or the Z probe offsets change.
+class GridProbeOrder
+{
+public:
+	GridProbeOrder();
+
+	void Prepare(const GridDefinition& grid, float xOffset, float yOffset);	// Work out the order for this grid and these Z probe offsets, unless we already have it
+	size_t NumPoints() const { return numPoints; }
+	unsigned int NumUnreachablePoints() const { return numUnreachable; }
+	bool GetPoint(size_t n, size_t& xIndex, size_t& yIndex) const;		// Get the grid indices of point n in the order, returning false if there are no more
+
+private:
+	static constexpr unsigned int MaxTwoOptPasses = 4;					// limit the time we spend on large grids
+
+	float Distance(size_t a, size_t b) const;							// Return the distance between two points in the order
+	float PathLength() const;
+	void BuildSerpentinePath();
+	void BuildNearestNeighbourPath();
+	void ImproveByTwoOpt();
+
+	GridDefinition grid;												// the grid that the order is for
+	float xOffset, yOffset;												// the Z probe offsets that the order is for
+	size_t numPoints;													// the number of points in the order
+	unsigned int numUnreachable;										// how many points inside the radius the Z probe can't reach
+	bool valid;
+	uint16_t order[MaxHeightMapPoints];									// map indices of the points in the order we probe them
+};
+
+#endif /* SRC_MOVEMENT_BEDPROBING_GRIDPROBEORDER_H_ */
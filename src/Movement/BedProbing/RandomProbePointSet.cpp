@@ -18,7 +18,7 @@
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(RandomProbePointSet, _ret)
 
-const ObjectModelTableEntry RandomProbePointSet::objectModelTable[] =
+constexpr ObjectModelTableEntry RandomProbePointSet::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "numPointsProbed", OBJECT_MODEL_FUNC(&(self->numBedCompensationPoints)), TYPE_OF(uint32_t), ObjectModelTableEntry::none }
@@ -28,6 +28,13 @@ DEFINE_GET_OBJECT_MODEL_TABLE(RandomProbePointSet)
 
 #endif
 
+void RandomProbePointSet::PlaneFitSums::Clear()
+{
+	numPoints = 0;
+	xOrigin = yOrigin = 0.0;
+	sumX = sumY = sumZ = sumXX = sumXY = sumYY = sumXZ = sumYZ = sumZZ = 0.0;
+}
+
 RandomProbePointSet::RandomProbePointSet() : numBedCompensationPoints(0)
 {
 	for (size_t point = 0; point < MaxProbePoints; point++)
@@ -35,19 +42,66 @@ RandomProbePointSet::RandomProbePointSet() : numBedCompensationPoints(0)
 		probePointSet[point] = unset;
 		zBedProbePoints[point] = 0.0;		// so that the M122 report looks tidy
 	}
+	fit.Clear();
+}
+
+// Add a point to the plane fit sums or remove it from them. The caller must only pass points that have been probed without error.
+void RandomProbePointSet::AccumulatePoint(size_t index, bool add)
+{
+	if (add && fit.numPoints == 0)
+	{
+		fit.Clear();
+		fit.xOrigin = xBedProbePoints[index];
+		fit.yOrigin = yBedProbePoints[index];
+	}
+
+	const floatc_t x = xBedProbePoints[index] - fit.xOrigin;
+	const floatc_t y = yBedProbePoints[index] - fit.yOrigin;
+	const floatc_t z = zBedProbePoints[index];
+	const floatc_t sign = (add) ? 1.0 : -1.0;
+	fit.sumX += sign * x;
+	fit.sumY += sign * y;
+	fit.sumZ += sign * z;
+	fit.sumXX += sign * x * x;
+	fit.sumXY += sign * x * y;
+	fit.sumYY += sign * y * y;
+	fit.sumXZ += sign * x * z;
+	fit.sumYZ += sign * y * z;
+	fit.sumZZ += sign * z * z;
+	if (add)
+	{
+		++fit.numPoints;
+	}
+	else
+	{
+		--fit.numPoints;
+	}
 }
 
 // Record the X and Y coordinates of a probe point
 void RandomProbePointSet::SetXYBedProbePoint(size_t index, float x, float y)
 {
+	const bool wasFitted = (probePointSet[index] & (xySet | zSet | probeError)) == (xySet | zSet);
+	if (wasFitted)
+	{
+		AccumulatePoint(index, false);
+	}
 	xBedProbePoints[index] = x;
 	yBedProbePoints[index] = y;
 	probePointSet[index] |= xySet;
+	if (wasFitted)
+	{
+		AccumulatePoint(index, true);
+	}
 }
 
 // Record the Z coordinate of a probe point
 void RandomProbePointSet::SetZBedProbePoint(size_t index, float z, bool wasXyCorrected, bool wasError)
 {
+	if ((probePointSet[index] & (xySet | zSet | probeError)) == (xySet | zSet))
+	{
+		AccumulatePoint(index, false);
+	}
 	zBedProbePoints[index] = z;
 	probePointSet[index] |= zSet;
 
@@ -68,6 +122,11 @@ void RandomProbePointSet::SetZBedProbePoint(size_t index, float z, bool wasXyCor
 	{
 		probePointSet[index] &= ~probeError;
 	}
+
+	if ((probePointSet[index] & (xySet | probeError)) == xySet)
+	{
+		AccumulatePoint(index, true);
+	}
 }
 
 size_t RandomProbePointSet::NumberOfProbePoints() const
@@ -89,6 +148,7 @@ void RandomProbePointSet::ClearProbeHeights()
 	{
 		probePointSet[i] &= ~zSet;
 	}
+	fit.Clear();
 }
 
 // Set the bed transform, returning true if error
@@ -199,6 +259,59 @@ float RandomProbePointSet::GetInterpolatedHeightError(float x, float y) const
 	}
 }
 
+// If the height error is a linear function of X and Y, get its coefficients and return true
+bool RandomProbePointSet::GetLinearHeightError(float& pX, float& pY, float& pC) const
+{
+	switch(numBedCompensationPoints)
+	{
+	case 0:
+		pX = pY = pC = 0.0;
+		return true;
+
+	case 3:
+		pX = aX;
+		pY = aY;
+		pC = aC;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Get the least squares plane z = pX*x + pY*y + pC through the points probed so far, and the RMS deviation of the points from it.
+// This only takes a few operations because we keep the sums up to date as the points are probed. Return false if there are fewer than 3 points or they are in a line.
+bool RandomProbePointSet::GetFittedPlane(float& pX, float& pY, float& pC, float& rmsDeviation) const
+{
+	if (fit.numPoints < 3)
+	{
+		return false;
+	}
+
+	// Work with the sums about the means, which makes the normal equations 2x2
+	const floatc_t n = (floatc_t)fit.numPoints;
+	const floatc_t meanX = fit.sumX/n, meanY = fit.sumY/n, meanZ = fit.sumZ/n;
+	const floatc_t cxx = fit.sumXX - n * meanX * meanX;
+	const floatc_t cxy = fit.sumXY - n * meanX * meanY;
+	const floatc_t cyy = fit.sumYY - n * meanY * meanY;
+	const floatc_t cxz = fit.sumXZ - n * meanX * meanZ;
+	const floatc_t cyz = fit.sumYZ - n * meanY * meanZ;
+	const floatc_t czz = fit.sumZZ - n * meanZ * meanZ;
+	const floatc_t det = cxx * cyy - cxy * cxy;
+	if (!(det > (floatc_t)1.0e-6 * cxx * cyy))
+	{
+		return false;
+	}
+
+	const floatc_t a = (cxz * cyy - cyz * cxy)/det;
+	const floatc_t b = (cyz * cxx - cxz * cxy)/det;
+	pX = (float)a;
+	pY = (float)b;
+	pC = (float)(meanZ - a * (meanX + fit.xOrigin) - b * (meanY + fit.yOrigin));
+	rmsDeviation = sqrtf(max<float>((float)((czz - a * cxz - b * cyz)/n), 0.0));
+	return true;
+}
+
 // Check whether the specified set of points has been successfully defined and probed
 bool RandomProbePointSet::GoodProbePoints(size_t numPoints) const
 {
@@ -275,6 +388,12 @@ void RandomProbePointSet::ReportProbeHeights(size_t numPoints, const StringRef&
 	// In the following, if there is only 1 point we may try to take the square root of a negative number due to rounding error, hence the 'max' call
 	const float stdDev = sqrtf(max<float>(sumOfSquares/numPoints - fsquare(mean), 0.0));
 	reply.catf(", mean %.3f, deviation from mean %.3f", (double)mean, (double)stdDev);
+
+	float pX, pY, pC, planeDeviation;
+	if (fit.numPoints == numPoints && GetFittedPlane(pX, pY, pC, planeDeviation))
+	{
+		reply.catf(", deviation from plane %.3f", (double)planeDeviation);
+	}
 }
 
 /*
@@ -40,6 +40,9 @@ public:
 	void SetIdentity() { numBedCompensationPoints = 0; }				// Set identity transform
 
 	float GetInterpolatedHeightError(float x, float y) const;			// Compute the interpolated height error at the specified point
+	bool GetLinearHeightError(float& pX, float& pY, float& pC) const;	// If the height error is pX*x + pY*y + pC, get the coefficients and return true
+	bool GetFittedPlane(float& pX, float& pY, float& pC, float& rmsDeviation) const;	// Get the least squares plane through the points probed so far, returning true if there is one
+	size_t GetNumPointsFitted() const { return fit.numPoints; }			// How many points the fitted plane uses
 
 	bool GoodProbePoints(size_t numPoints) const;						// Check whether the specified set of points has been successfully defined and probed
 	void ReportProbeHeights(size_t numPoints, const StringRef& reply) const;	// Print out the probe heights and any errors
@@ -55,6 +58,7 @@ private:
 	void BarycentricCoordinates(size_t p0, size_t p1,   				// Compute the barycentric coordinates of a point in a triangle
 			size_t p2, float x, float y, float& l1,     				// (see http://en.wikipedia.org/wiki/Barycentric_coordinate_system).
 			float& l2, float& l3) const;
+	void AccumulatePoint(size_t index, bool add);						// Add a probed point to the plane fit sums or remove it from them
 
 	// Enumeration to record what has been set
 	enum PointCoordinateSet
@@ -74,6 +78,18 @@ private:
 	float zBedProbePoints[MaxProbePoints];								// The Z coordinates of the points on the bed that were probed
 	uint8_t probePointSet[MaxProbePoints];								// Has the XY of this point been set? Has the Z been probed?
 
+	// The sums for the least squares plane through the probed points, which we update as each point is probed so that the fit is always ready.
+	// The X and Y coordinates are relative to the first point we added, to reduce rounding error when floatc_t is single precision.
+	struct PlaneFitSums
+	{
+		size_t numPoints;
+		float xOrigin, yOrigin;
+		floatc_t sumX, sumY, sumZ, sumXX, sumXY, sumYY, sumXZ, sumYZ, sumZZ;
+
+		void Clear();
+	};
+	PlaneFitSums fit;
+
 	// Variables used to do 3-point compensation
 	float aX, aY, aC; 													// Bed plane explicit equation z' = z + aX*x + aY*y + aC
 
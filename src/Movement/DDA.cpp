@@ -11,6 +11,8 @@
 #include "Move.h"
 #include "StepTimer.h"
 #include "Kinematics/LinearDeltaKinematics.h"		// for DELTA_AXES
+#include "MotionProfile.h"
+#include "LaserRaster.h"
 #include "Tools/Tool.h"
 
 #if SUPPORT_CAN_EXPANSION
@@ -117,6 +119,18 @@ void DDA::LogProbePosition()
 DDA::DDA(DDA* n) : next(n), prev(nullptr), state(empty)
 {
 	activeDMs = completedDMs = nullptr;
+#if DM_USE_STEP_TABLES
+	stepTableDMs = nullptr;
+#endif
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	numStreamedSubSegments = 0;
+#endif
+#if SUPPORT_INPUT_SHAPING
+	shapedProfile = nullptr;
+#endif
+#if SUPPORT_LASER
+	laserRaster = nullptr;
+#endif
 
 	// Set the endpoints to zero, because Move will ask for them.
 	// They will be wrong if we are on a delta. We take care of that when we process the M665 command in config.g.
@@ -128,6 +142,7 @@ DDA::DDA(DDA* n) : next(n), prev(nullptr), state(empty)
 	flags.all = 0;						// in particular we need to set endCoordinatesValid to false
 	virtualExtruderPosition = 0.0;
 	filePos = noFilePosition;
+	scanProbePoint = -1;
 
 #if SUPPORT_LASER || SUPPORT_IOBITS
 	laserPwmOrIoBits.Clear();
@@ -150,8 +165,41 @@ void DDA::ReleaseDMs()
 		dm = next;
 	}
 	activeDMs = completedDMs = nullptr;
+#if DM_USE_STEP_TABLES
+	stepTableDMs = nullptr;
+#endif
+}
+
+#if SUPPORT_INPUT_SHAPING
+
+void DDA::ReleaseShapedProfile()
+{
+	if (shapedProfile != nullptr)
+	{
+		MotionProfile::Release(shapedProfile);
+		shapedProfile = nullptr;
+	}
 }
 
+#endif
+
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+
+// Smoothed pressure advance looks back at the motion of the previous move when it prepares this one. If the previous move completed and was freed
+// before we were prepared, Free kept its shaped profile for that. Once we have been prepared or freed, it isn't needed any more.
+void DDA::ReleasePreviousHistory()
+{
+	if (prev->flags.keptForHistory)
+	{
+		prev->flags.keptForHistory = false;
+#if SUPPORT_INPUT_SHAPING
+		prev->ReleaseShapedProfile();
+#endif
+	}
+}
+
+#endif
+
 // Return the number of clocks this DDA still needs to execute.
 // This could be slightly negative, if the move is overdue for completion.
 int32_t DDA::GetTimeLeft() const
@@ -263,16 +311,44 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 	const Move& move = reprap.GetMove();
 	if (doMotorMapping)
 	{
+#if SUPPORT_SEGMENT_FREE_STREAMING
+		// If we are streaming this move instead of segmenting it, find the motor positions along it before we transform the end position
+		int32_t lastKnot[XYZ_AXES];
+		numStreamedSubSegments = (move.GetKinematics().UseSegmentFreeStreaming()) ? CalcStreamedSubSegments(nextMove.coords, nextMove.feedRate, lastKnot)
+									: (nextMove.moveType == 0 && move.UseMeshStreaming()) ? CalcMeshSubSegments(nextMove.coords, nextMove.tool, lastKnot)
+										: 0;
+#endif
 		if (!move.CartesianToMotorSteps(nextMove.coords, endPoint, nextMove.isCoordinated))		// transform the axis coordinates if on a delta or CoreXY printer
 		{
 			return false;												// throw away the move if it couldn't be transformed
 		}
+#if SUPPORT_SEGMENT_FREE_STREAMING
+		if (numStreamedSubSegments != 0)
+		{
+			for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+			{
+				if (IsBitSet(streamedAxes, axis))
+				{
+					const int32_t steps = endPoint[axis] - lastKnot[axis];
+					if (steps > INT16_MAX || steps < INT16_MIN)
+					{
+						numStreamedSubSegments = 0;						// too many steps, so just move the motors linearly
+						break;
+					}
+					streamedSubSegmentSteps[axis][numStreamedSubSegments - 1] = (int16_t)steps;
+				}
+			}
+		}
+#endif
 		flags.isDeltaMovement = move.IsDeltaMode()
 							&& (endPoint[X_AXIS] != positionNow[X_AXIS] || endPoint[Y_AXIS] != positionNow[Y_AXIS] || endPoint[Z_AXIS] != positionNow[Z_AXIS]);
 	}
 	else
 	{
 		flags.isDeltaMovement = false;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+		numStreamedSubSegments = 0;
+#endif
 	}
 
 	flags.xyMoving = false;
@@ -343,8 +419,19 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 					const float compensationTime = reprap.GetPlatform().GetPressureAdvance(drive - numTotalAxes);
 					if (compensationTime > 0.0)
 					{
-						// Compensation causes instant velocity changes equal to acceleration * k, so we may need to limit the acceleration
-						accelerations[drive] = min<float>(accelerations[drive], reprap.GetPlatform().GetInstantDv(drive)/compensationTime);
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+						const float smoothingTime = reprap.GetPlatform().GetPressureAdvanceSmoothing(drive - numTotalAxes);
+						if (smoothingTime > 0.0)
+						{
+							// Smoothing spreads the velocity change of acceleration * k over the smoothing time, which multiplies the extruder acceleration by up to 1 + k/smoothingTime
+							accelerations[drive] = min<float>(accelerations[drive], normalAccelerations[drive] * smoothingTime/(smoothingTime + compensationTime));
+						}
+						else
+#endif
+						{
+							// Compensation causes instant velocity changes equal to acceleration * k, so we may need to limit the acceleration
+							accelerations[drive] = min<float>(accelerations[drive], reprap.GetPlatform().GetInstantDv(drive)/compensationTime);
+						}
 					}
 				}
 			}
@@ -368,12 +455,14 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 	// 3. Store some values
 	tool = nextMove.tool;
 	flags.usesEndstops = (nextMove.endStopsToCheck != 0);
+	flags.endstopInterrupts = false;
 	endStopsToCheck = nextMove.endStopsToCheck;					//TODO move this to DDARing
 	filePos = nextMove.filePos;
 	virtualExtruderPosition = nextMove.virtualExtruderPosition;
 	proportionDone = nextMove.proportionDone;
+	scanProbePoint = nextMove.scanProbePoint;
 
-	flags.canPauseAfter = nextMove.canPauseAfter;
+	flags.canPauseAfter = flags.pauseAllowedAfter = nextMove.canPauseAfter;
 	flags.usingStandardFeedrate = nextMove.usingStandardFeedrate;
 	flags.isPrintingMove = flags.xyMoving && forwardExtruding;				// require forward extrusion so that wipe-while-retracting doesn't count
 	flags.isNonPrintingExtruderMove = extruding && !flags.isPrintingMove;	// flag used by filament monitors - we can ignore Z movement
@@ -381,6 +470,7 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 	flags.hadLookaheadUnderrun = false;
 	flags.isLeadscrewAdjustmentMove = false;
 	flags.goingSlow = false;
+	flags.keptForHistory = false;
 
 	// The end coordinates will be valid at the end of this move if it does not involve endstop checks and is not a raw motor move
 	flags.endCoordinatesValid = (endStopsToCheck == 0) && doMotorMapping;
@@ -397,6 +487,20 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 	}
 #endif
 
+#if SUPPORT_LASER
+	// If it's a raster move then keep the laser power values. If we can't get a raster then the move will use the power of the first pixel throughout.
+	if (   nextMove.numLaserRasterPixels > 1 && nextMove.isCoordinated && endStopsToCheck == 0
+		&& reprap.GetGCodes().GetMachineType() == MachineType::laser
+	   )
+	{
+		laserRaster = LaserRaster::Allocate();
+		if (laserRaster != nullptr)
+		{
+			laserRaster->SetPixels(nextMove.laserRasterPwm, nextMove.numLaserRasterPixels);
+		}
+	}
+#endif
+
 	// If it's a Z probing move, limit the Z acceleration to better handle nozzle-contact probes
 	if ((endStopsToCheck & ZProbeActive) != 0 && accelerations[Z_AXIS] > ZProbeMaxAcceleration)
 	{
@@ -431,16 +535,43 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 		}
 	}
 
-	// 5. Compute the maximum acceleration available
+	// 5. Compute the maximum acceleration and deceleration available. Each is the largest that keeps every drive within its own limit when projected onto the direction of motion.
+	// If any drive has a separate deceleration limit then we work out the deceleration separately. We keep any reduction that we made to the acceleration
+	// of a drive for pressure advance or Z probing.
 	float normalisedDirectionVector[MaxTotalDrivers];			// used to hold a unit-length vector in the direction of motion
 	memcpy(normalisedDirectionVector, directionVector, sizeof(normalisedDirectionVector));
 	Absolute(normalisedDirectionVector, MaxTotalDrivers);
 	acceleration = beforePrepare.maxAcceleration = VectorBoxIntersection(normalisedDirectionVector, accelerations, MaxTotalDrivers);
+	deceleration = acceleration;
+	{
+		const Platform& platform = reprap.GetPlatform();
+		float decelerations[MaxTotalDrivers];
+		bool separateDecelerations = false;
+		for (size_t drive = 0; drive < MaxTotalDrivers; ++drive)
+		{
+			if (normalisedDirectionVector[drive] != 0.0 && platform.HasSeparateDeceleration(drive))
+			{
+				separateDecelerations = true;
+				decelerations[drive] = (accelerations[drive] < normalAccelerations[drive])
+										? min<float>(platform.Deceleration(drive), accelerations[drive])
+											: platform.Deceleration(drive);
+			}
+			else
+			{
+				decelerations[drive] = accelerations[drive];
+			}
+		}
+		if (separateDecelerations)
+		{
+			deceleration = VectorBoxIntersection(normalisedDirectionVector, decelerations, MaxTotalDrivers);
+		}
+	}
 	if (flags.xyMoving)											// apply M204 acceleration limits to XY moves
 	{
-		acceleration = min<float>(acceleration, (flags.isPrintingMove) ? move.GetMaxPrintingAcceleration() : move.GetMaxTravelAcceleration());
+		const float maxXyAcceleration = (flags.isPrintingMove) ? move.GetMaxPrintingAcceleration() : move.GetMaxTravelAcceleration();
+		acceleration = min<float>(acceleration, maxXyAcceleration);
+		deceleration = min<float>(deceleration, maxXyAcceleration);
 	}
-	deceleration = acceleration;
 
 	// 6. Set the speed to the smaller of the requested and maximum speed.
 	// Also enforce a minimum speed of 0.5mm/sec. We need a minimum speed to avoid overflow in the movement calculations.
@@ -476,6 +607,37 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 		k.LimitSpeedAndAcceleration(*this, normalisedDirectionVector, numVisibleAxes, flags.continuousRotationShortcut);	// give the kinematics the chance to further restrict the speed and acceleration
 	}
 
+	// Limit the speed so that no hot end is asked to melt more filament than it can. Retraction doesn't need melting, so only forward extrusion is limited.
+	// The direction vector gives the filament length per mm of movement, so a flow of F mm^3/sec limits the speed to F/(A * e) where A is the filament cross section.
+	if (forwardExtruding)
+	{
+		const Platform& platform = reprap.GetPlatform();
+		const float filamentArea = Pi * fsquare(0.5 * platform.GetFilamentWidth());
+		for (size_t extruder = 0; extruder < MaxExtruders && numTotalAxes + extruder < MaxTotalDrivers; ++extruder)
+		{
+			const float extrusionPerMm = directionVector[numTotalAxes + extruder];
+			const float maxFlow = platform.GetMaxExtrusionFlow(extruder);
+			if (extrusionPerMm > 0.0 && maxFlow > 0.0)
+			{
+				LimitSpeedAndAcceleration(maxFlow/(filamentArea * extrusionPerMm), acceleration);
+			}
+		}
+	}
+
+#if HAS_STALL_DETECT
+	// If drivers that are configured to slow down on stall have stalled recently, reduce the speed and acceleration. Don't slow down homing moves.
+	if (endStopsToCheck == 0)
+	{
+		const float stallSpeedFactor = move.GetStallSpeedFactor();
+		if (stallSpeedFactor < 1.0)
+		{
+			requestedSpeed *= stallSpeedFactor;
+			acceleration *= stallSpeedFactor;
+			deceleration *= stallSpeedFactor;
+		}
+	}
+#endif
+
 	// 7. Calculate the provisional accelerate and decelerate distances and the top speed
 	endSpeed = 0.0;							// until the next move asks us to adjust it
 
@@ -499,7 +661,8 @@ bool DDA::InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMoto
 }
 
 // Set up a leadscrew motor move returning true if the move does anything
-bool DDA::InitLeadscrewMove(DDARing& ring, float feedrate, const float adjustments[MaxTotalDrivers])
+// If 'endstops' is nonzero then this is a G1 H4 move, and each motor in it stops when the endstop input with the same number as its driver is triggered.
+bool DDA::InitLeadscrewMove(DDARing& ring, float feedrate, const float adjustments[MaxTotalDrivers], EndstopsBitmap endstops)
 {
 	// 1. Compute the new endpoints and the movement vector
 	bool realMove = false;
@@ -525,15 +688,22 @@ bool DDA::InitLeadscrewMove(DDARing& ring, float feedrate, const float adjustmen
 	// 3. Store some values
 	flags.isLeadscrewAdjustmentMove = true;
 	flags.isDeltaMovement = false;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	numStreamedSubSegments = 0;
+#endif
 	flags.isPrintingMove = false;
 	flags.xyMoving = false;
-	flags.canPauseAfter = true;
+	flags.canPauseAfter = flags.pauseAllowedAfter = true;
 	flags.usingStandardFeedrate = false;
 	flags.usePressureAdvance = false;
 	flags.hadLookaheadUnderrun = false;
 	flags.goingSlow = false;
+	flags.keptForHistory = false;
 	flags.continuousRotationShortcut = false;
-	endStopsToCheck = 0;
+	flags.usesEndstops = (endstops != 0);
+	flags.endstopInterrupts = false;
+	endStopsToCheck = endstops;
+	scanProbePoint = -1;
 	virtualExtruderPosition = prev->virtualExtruderPosition;
 	tool = nullptr;
 	filePos = prev->filePos;
@@ -610,15 +780,20 @@ bool DDA::IsGoodToPrepare() const
 
 // Try to increase the ending speed of this move to allow the next move to start at targetNextSpeed.
 // Only called if this move and the next one are both printing moves.
+// We stop walking back through the queue as soon as we reach a move whose end speed would not change, and we don't recalculate moves whose
+// start and end speeds are unchanged, so the cost of adding a move doesn't grow with the length of the queue once the speeds have converged.
 /*static*/ void DDA::DoLookahead(DDARing& ring, DDA *laDDA)
 pre(state == provisional)
 {
 //	if (reprap.Debug(moduleDda)) debugPrintf("Adjusting, %f\n", laDDA->targetNextSpeed);
 	unsigned int laDepth = 0;
+	unsigned int numRecalculated = 0;
 	bool goingUp = true;
 
 	for(;;)					// this loop is used to nest lookahead without making recursive calls
 	{
+		const float oldStartSpeed = laDDA->startSpeed;
+		const float oldEndSpeed = laDDA->endSpeed;
 		if (goingUp)
 		{
 			// We have been asked to adjust the end speed of this move to match the next move starting at targetNextSpeed
@@ -647,8 +822,23 @@ pre(state == provisional)
 				{
 					laDDA->MatchSpeeds();
 					const float maxStartSpeed = sqrtf(fsquare(laDDA->beforePrepare.targetNextSpeed) + (2 * laDDA->deceleration * laDDA->totalDistance));
-					laDDA->prev->beforePrepare.targetNextSpeed = min<float>(maxStartSpeed, laDDA->requestedSpeed);
-					// leave 'recurse' true
+					const float prevTargetSpeed = min<float>(maxStartSpeed, laDDA->requestedSpeed);
+					if (prevTargetSpeed > laDDA->prev->endSpeed)
+					{
+						laDDA->prev->beforePrepare.targetNextSpeed = prevTargetSpeed;
+						// leave 'recurse' true
+					}
+					else
+					{
+						// The previous move already ends as fast as we could use, so its speeds and those of the moves before it won't change.
+						// Limit our end speed to what we can reach from our present start speed and start going back down.
+						const float maxReachableSpeed = sqrtf(fsquare(laDDA->startSpeed) + (2 * laDDA->deceleration * laDDA->totalDistance));
+						if (laDDA->beforePrepare.targetNextSpeed > maxReachableSpeed)
+						{
+							laDDA->beforePrepare.targetNextSpeed = maxReachableSpeed;
+						}
+						goingUp = false;
+					}
 				}
 				else
 				{
@@ -722,11 +912,16 @@ pre(state == provisional)
 				laDDA->endSpeed = laDDA->beforePrepare.targetNextSpeed;
 			}
 LA_DEBUG;
-			laDDA->RecalculateMove(ring);
+			if (laDDA->startSpeed != oldStartSpeed || laDDA->endSpeed != oldEndSpeed)
+			{
+				laDDA->RecalculateMove(ring);
+				++numRecalculated;
+			}
 
 			if (laDepth == 0)
 			{
 //				if (reprap.Debug(moduleDda)) debugPrintf("Complete, %f\n", laDDA->targetNextSpeed);
+				ring.RecordLookahead(numRecalculated);
 				return;
 			}
 
@@ -736,6 +931,138 @@ LA_DEBUG;
 	}
 }
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+
+// Calculate the motor steps for the non-linear axes in each sub-segment of a move that we are going to stream instead of segmenting it,
+// except for the last sub-segment. This must be called before the end position is transformed, so that the kinematics is left holding the end position.
+// Return the number of sub-segments, or zero if we are not going to stream this move. On return, lastKnot[] holds the motor positions at the start of the last sub-segment.
+size_t DDA::CalcStreamedSubSegments(const float endCoords[], float feedRate, int32_t lastKnot[XYZ_AXES])
+{
+	const Move& move = reprap.GetMove();
+	const Kinematics& k = move.GetKinematics();
+	const size_t numVisibleAxes = reprap.GetGCodes().GetVisibleAxes();
+	float startCoords[MaxAxes];
+	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+	{
+		startCoords[axis] = prev->GetEndCoordinate(axis, false);
+	}
+
+	// Use the same number of segments as GCodes would have used if it had segmented this move
+	const float xyLength = sqrtf(fsquare(endCoords[X_AXIS] - startCoords[X_AXIS]) + fsquare(endCoords[Y_AXIS] - startCoords[Y_AXIS]));
+	const float moveTime = xyLength/feedRate;
+	const size_t numSubSegments = (size_t)constrain<long>(min<long>(lrintf(xyLength/k.GetMinSegmentLength()), lrintf(moveTime * k.GetSegmentsPerSecond())), 1, MaxStreamedSubSegments);
+	if (numSubSegments < 2)
+	{
+		return 0;										// a single segment is handled better as a linear move
+	}
+
+	const int32_t * const positionNow = prev->DriveCoordinates();
+	for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+	{
+		lastKnot[axis] = positionNow[axis];
+	}
+
+	const size_t numKnots = numSubSegments - 1;
+	int32_t motorPos[MaxStreamedSubSegments - 1][MaxAxes];
+	for (size_t i = 0; i < numKnots; ++i)
+	{
+		streamedKnotFractions[i] = (float)(i + 1)/(float)numSubSegments;
+		for (size_t axis = 0; axis < MaxAxes; ++axis)
+		{
+			motorPos[i][axis] = positionNow[axis];
+		}
+	}
+
+	// Transform the intermediate positions together as coordinated moves, so that the kinematics doesn't change arm mode part way through.
+	// The kinematics may evaluate them incrementally along the line. The end of the move is transformed exactly later, so any approximation error doesn't accumulate.
+	if (!move.CartesianToMotorStepsAlongLine(startCoords, endCoords, numKnots, motorPos, true))
+	{
+		return 0;
+	}
+
+	for (size_t i = 0; i < numKnots; ++i)
+	{
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			const int32_t steps = motorPos[i][axis] - lastKnot[axis];
+			if (steps > INT16_MAX || steps < INT16_MIN)
+			{
+				return 0;
+			}
+			streamedSubSegmentSteps[axis][i] = (int16_t)steps;
+			lastKnot[axis] = motorPos[i][axis];
+		}
+	}
+	streamedAxes = LowestNBits<AxesBitmap>(XYZ_AXES) & ~k.GetLinearAxes();
+	return numSubSegments;
+}
+
+// Calculate the Z motor steps in each sub-segment of a move to which we apply mesh compensation continuously instead of segmenting it, except for the last sub-segment.
+// The knots are where the move crosses the grid lines of the height map, which is where GCodes would otherwise have split it, so the Z motor follows the same path.
+// endCoords[] holds the machine coordinates at the end of the move, which already include the bed compensation there.
+// Return the number of sub-segments, or zero if we are not going to stream this move. On return, lastKnot[] holds the motor positions at the start of the last sub-segment.
+size_t DDA::CalcMeshSubSegments(const float endCoords[], const Tool *tool, int32_t lastKnot[XYZ_AXES])
+{
+	const Move& move = reprap.GetMove();
+	const size_t numVisibleAxes = reprap.GetGCodes().GetVisibleAxes();
+	float startCoords[MaxAxes], finalCoords[MaxAxes];
+	for (size_t axis = 0; axis < MaxAxes; ++axis)
+	{
+		startCoords[axis] = (axis < numVisibleAxes) ? prev->GetEndCoordinate(axis, false) : 0.0;
+		finalCoords[axis] = (axis < numVisibleAxes) ? endCoords[axis] : 0.0;
+	}
+
+	const size_t numCrossings = move.AccessHeightMap().GetGridLineCrossings(startCoords[X_AXIS], startCoords[Y_AXIS], finalCoords[X_AXIS], finalCoords[Y_AXIS],
+																			streamedKnotFractions, MaxStreamedSubSegments - 1);
+	if (numCrossings == 0 || numCrossings >= MaxStreamedSubSegments)
+	{
+		return 0;										// no need to stream it, or too many grid lines to stream it in one move
+	}
+
+	// The Z coordinates at the ends of the move already include the bed compensation there, so we only need to add the difference between
+	// the compensation at each knot and the linear interpolation of the compensation at the ends
+	const float startCompensation = move.GetBedCompensation(startCoords, tool);
+	const float endCompensation = move.GetBedCompensation(finalCoords, tool);
+	const int32_t * const positionNow = prev->DriveCoordinates();
+	for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+	{
+		lastKnot[axis] = positionNow[axis];
+	}
+
+	float coords[MaxStreamedSubSegments - 1][MaxAxes];
+	int32_t motorPos[MaxStreamedSubSegments - 1][MaxAxes];
+	for (size_t i = 0; i < numCrossings; ++i)
+	{
+		const float fraction = streamedKnotFractions[i];
+		for (size_t axis = 0; axis < MaxAxes; ++axis)
+		{
+			coords[i][axis] = startCoords[axis] + (finalCoords[axis] - startCoords[axis]) * fraction;
+			motorPos[i][axis] = positionNow[axis];
+		}
+		coords[i][Z_AXIS] += move.GetBedCompensation(coords[i], tool) - (startCompensation + (endCompensation - startCompensation) * fraction);
+	}
+
+	if (!move.CartesianToMotorStepsBatch(numCrossings, coords, motorPos, true))
+	{
+		return 0;
+	}
+
+	for (size_t i = 0; i < numCrossings; ++i)
+	{
+		const int32_t steps = motorPos[i][Z_AXIS] - lastKnot[Z_AXIS];
+		if (steps > INT16_MAX || steps < INT16_MIN)
+		{
+			return 0;
+		}
+		streamedSubSegmentSteps[Z_AXIS][i] = (int16_t)steps;
+		lastKnot[Z_AXIS] = motorPos[i][Z_AXIS];
+	}
+	streamedAxes = MakeBitmap<AxesBitmap>(Z_AXIS);
+	return numCrossings + 1;
+}
+
+#endif
+
 // Try to push babystepping earlier in the move queue, returning the amount we pushed
 //TODO this won't work for CoreXZ, rotary delta, Kappa, or SCARA with Z crosstalk
 float DDA::AdvanceBabyStepping(DDARing& ring, size_t axis, float amount)
@@ -883,12 +1210,99 @@ void DDA::RecalculateMove(DDARing& ring)
 	clocksNeeded = (uint32_t)(totalTime * StepTimer::StepClockRate);
 }
 
+// Try to reduce the speeds of the moves from first to last inclusive, none of which has been prepared, so that the last one ends at a standstill.
+// The start speed of the first move can't be changed because the move before it may have been prepared already. So work back from the end
+// of the last move, finding the highest speed at which each move can start and still stop in time, until we reach a move that already ends slowly
+// enough. Return false without changing anything if even the first move starts too fast.
+/*static*/ bool DDA::PlanStopAfter(DDARing& ring, DDA *first, DDA *last)
+{
+	float maxEndSpeed = 0.0;
+	for (const DDA *dda = last; dda->endSpeed > maxEndSpeed; dda = dda->prev)
+	{
+		const float maxStartSpeed = sqrtf(fsquare(maxEndSpeed) + 2 * dda->deceleration * dda->totalDistance);
+		if (dda->startSpeed <= maxStartSpeed)
+		{
+			break;
+		}
+		if (dda == first)
+		{
+			return false;
+		}
+		maxEndSpeed = maxStartSpeed;
+	}
+
+	maxEndSpeed = 0.0;
+	for (DDA *dda = last; dda->endSpeed > maxEndSpeed; dda = dda->prev)
+	{
+		dda->endSpeed = dda->beforePrepare.targetNextSpeed = maxEndSpeed;
+		const float maxStartSpeed = sqrtf(fsquare(maxEndSpeed) + 2 * dda->deceleration * dda->totalDistance);
+		const bool reduceStartSpeed = (dda->startSpeed > maxStartSpeed);
+		if (reduceStartSpeed)
+		{
+			dda->startSpeed = maxStartSpeed;
+		}
+		dda->RecalculateMove(ring);
+		if (!reduceStartSpeed)
+		{
+			break;
+		}
+		maxEndSpeed = maxStartSpeed;
+	}
+	return true;
+}
+
 // Decide what speed we would really like this move to end at.
 // On entry, targetNextSpeed is the speed we would like the next move after this one to start at and this one to end at
 // On return, targetNextSpeed is the actual speed we can achieve without exceeding the jerk limits.
 void DDA::MatchSpeeds()
 {
-	for (size_t drive = 0; drive < MaxTotalDrivers; ++drive)
+	// If junction deviation is configured and both moves are XY moves, limit the XYZ corner speed using it instead of the XYZ jerk limits.
+	// We treat the corner as an arc of radius r that deviates from the junction point by the junction deviation d, and limit the speed
+	// to the centripetal speed sqrt(a * r) around it. If the angle between the moves at the junction is theta (180 degrees when they are in line)
+	// and s = sin(theta/2), then r = d * s/(1 - s).
+	// This lets gentle corners such as the segments of a curve be taken at almost full speed, and slows sharp corners more than jerk does.
+	const float junctionDeviation = reprap.GetMove().GetJunctionDeviation();
+	const bool useJunctionDeviation = junctionDeviation > 0.0 && flags.xyMoving && next->flags.xyMoving;
+	if (useJunctionDeviation)
+	{
+		// The XYZ parts of both direction vectors have unit length, so their dot product is the cosine of the angle turned through
+		float cosTurn = 0.0;
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			cosTurn += directionVector[axis] * next->directionVector[axis];
+		}
+		const float junctionAcceleration = min<float>(deceleration, next->acceleration);
+		const float longerDistance = max<float>(totalDistance, next->totalDistance);
+		const float shorterDistance = min<float>(totalDistance, next->totalDistance);
+		float maxJunctionSpeed = beforePrepare.targetNextSpeed;
+		if (cosTurn > cosf(MaxArcJunctionAngle) && longerDistance <= shorterDistance * MaxArcSegmentLengthRatio)
+		{
+			// A small turn between segments of similar length is most likely one joint of a curve that the slicer has split into segments.
+			// Treating it as a corner would let the speed rise and fall along the curve, so instead we estimate the radius of the curve from
+			// the turn angle and the segment lengths and limit the speed to the one that gives the allowed centripetal acceleration.
+			// Joints along a curve of even curvature then all get the same speed, so the curve is taken at a constant speed.
+			const float turnAngle = acosf(min<float>(cosTurn, 1.0));
+			if (turnAngle > 0.0)
+			{
+				const float radius = 0.5 * (totalDistance + next->totalDistance)/turnAngle;
+				maxJunctionSpeed = sqrtf(junctionAcceleration * radius);
+			}
+		}
+		else
+		{
+			const float sinHalfJunctionAngle = sqrtf(max<float>(0.5 * (1.0 + cosTurn), 0.0));
+			if (sinHalfJunctionAngle < 0.999)										// else the moves are almost in line, so there is no need to slow down
+			{
+				maxJunctionSpeed = sqrtf(junctionAcceleration * junctionDeviation * sinHalfJunctionAngle/(1.0 - sinHalfJunctionAngle));
+			}
+		}
+		if (beforePrepare.targetNextSpeed > maxJunctionSpeed)
+		{
+			beforePrepare.targetNextSpeed = maxJunctionSpeed;
+		}
+	}
+
+	for (size_t drive = (useJunctionDeviation) ? XYZ_AXES : 0; drive < MaxTotalDrivers; ++drive)
 	{
 		if (directionVector[drive] != 0.0 || next->directionVector[drive] != 0.0)
 		{
@@ -941,6 +1355,23 @@ void DDA::SetPositions(const float move[MaxTotalDrivers], size_t numDrives)
 }
 
 // Get a Cartesian end coordinate from this move
+// Return the average forward extrusion speed of the extruders of the current tool in mm/sec. The move must have been prepared.
+float DDA::GetToolExtrusionSpeed() const
+{
+	if (tool == nullptr || clocksNeeded == 0)
+	{
+		return 0.0;
+	}
+
+	const size_t numAxes = reprap.GetGCodes().GetTotalAxes();
+	float extrusion = 0.0;
+	for (size_t i = 0; i < tool->DriveCount(); ++i)
+	{
+		extrusion += max<float>(directionVector[numAxes + tool->Drive(i)], 0.0);
+	}
+	return (extrusion * totalDistance * StepTimer::StepClockRate)/clocksNeeded;
+}
+
 float DDA::GetEndCoordinate(size_t drive, bool disableMotorMapping)
 pre(disableDeltaMapping || drive < MaxAxes)
 {
@@ -1090,6 +1521,222 @@ inline void DDA::AdjustAcceleration()
 	}
 }
 
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+
+// Describe how far along the move the head is as a function of time, as a list of constant-jerk segments in mm and step clocks.
+// This may only be called once the move has been prepared, or from within Prepare after clocksNeeded has been finalised.
+// Return the number of segments, or zero if there would be more than maxSegs.
+size_t DDA::GetMotionSegments(MotionSegment segs[], size_t maxSegs) const
+{
+#if SUPPORT_INPUT_SHAPING
+	if (shapedProfile != nullptr)
+	{
+		const size_t num = shapedProfile->GetNumSegments();
+		if (num > maxSegs)
+		{
+			return 0;
+		}
+		for (size_t i = 0; i < num; ++i)
+		{
+			segs[i] = shapedProfile->GetSegment(i);
+		}
+		return num;
+	}
+#endif
+
+	// It's a trapezoidal move. We can't use the accelerate and decelerate distances because they are overwritten by Prepare.
+	const float clockRate = (float)StepTimer::StepClockRate;
+	const float totalClocks = (float)clocksNeeded;
+	const float accel = acceleration/fsquare(clockRate);
+	const float decel = deceleration/fsquare(clockRate);
+	const float vTop = topSpeed/clockRate;
+	const float accelClocks = min<float>((vTop - startSpeed/clockRate)/accel, totalClocks);
+	const float decelClocks = min<float>((vTop - endSpeed/clockRate)/decel, totalClocks - accelClocks);
+	const float phaseClocks[3] = { accelClocks, totalClocks - accelClocks - decelClocks, decelClocks };
+	const float phaseAccelerations[3] = { accel, 0.0, -decel };
+
+	size_t num = 0;
+	float clocks = 0.0, distance = 0.0, speed = startSpeed/clockRate;
+	for (size_t phase = 0; phase < 3; ++phase)
+	{
+		if (phaseClocks[phase] > 0.0)
+		{
+			if (num == maxSegs)
+			{
+				return 0;
+			}
+			MotionSegment& seg = segs[num++];
+			seg.startClocks = clocks;
+			seg.startDistance = distance;
+			seg.startSpeed = speed;
+			seg.acceleration = phaseAccelerations[phase];
+			seg.jerk = 0.0;
+			clocks += phaseClocks[phase];
+			distance = seg.DistanceAt(clocks);
+			speed = seg.SpeedAt(clocks);
+		}
+	}
+	return num;
+}
+
+#endif
+
+#if SUPPORT_INPUT_SHAPING
+
+// Return true if this move finishes while it is still accelerating. This may be called after the move has been prepared.
+bool DDA::EndsAccelerating() const
+{
+	return topSpeed > startSpeed
+		&& endSpeed >= topSpeed
+		&& (fsquare(topSpeed) - fsquare(startSpeed))/(2 * acceleration) > 0.98 * totalDistance;
+}
+
+// Work out the jerks to use for the acceleration and deceleration phases of this move, in mm per step clock cubed, or zero to leave that phase trapezoidal.
+// We can only make a speed change jerk-limited if the acceleration is zero at both ends of it, so we don't do it if the speed change continues into the previous or next move.
+// A jerk-limited speed change whose peak acceleration doesn't exceed the configured acceleration takes longer than the trapezoidal one, so we lengthen the
+// trapezoidal speed changes to that time by reducing their acceleration, taking the extra distance from the steady speed phase. If there isn't enough steady
+// speed phase to do that, we leave the move trapezoidal, so that neither the jerk limit nor the acceleration limit is exceeded.
+void DDA::GetRampJerks(float& accelJerk, float& decelJerk)
+{
+	accelJerk = decelJerk = 0.0;
+	const float jerkLimit = reprap.GetMove().GetJerkLimit();
+	if (jerkLimit > 0.0)
+	{
+		// Get the time that a speed change of dv takes with the jerk and acceleration limits. If the jerk limit would take the acceleration
+		// above the limit then the acceleration rises to the limit, stays there, then falls; otherwise it rises and falls at the jerk limit.
+		const auto rampTime = [jerkLimit](float dv, float accelLimit) -> float
+		{
+			return (dv * jerkLimit >= fsquare(accelLimit)) ? dv/accelLimit + accelLimit/jerkLimit : 2 * sqrtf(dv/jerkLimit);
+		};
+
+		float newAcceleration = acceleration, newAccelDistance = beforePrepare.accelDistance;
+		const bool limitAccelJerk = topSpeed > startSpeed && !IsAccelerationMove() && !prev->EndsAccelerating();
+		if (limitAccelJerk)
+		{
+			const float accelTime = rampTime(topSpeed - startSpeed, acceleration);
+			newAcceleration = (topSpeed - startSpeed)/accelTime;
+			newAccelDistance = (startSpeed + topSpeed) * 0.5 * accelTime;
+		}
+
+		float newDeceleration = deceleration, newDecelDistance = beforePrepare.decelDistance;
+		const bool limitDecelJerk = topSpeed > endSpeed && !IsDecelerationMove() && !(next->state == provisional && next->IsDecelerationMove());
+		if (limitDecelJerk)
+		{
+			const float decelTime = rampTime(topSpeed - endSpeed, deceleration);
+			newDeceleration = (topSpeed - endSpeed)/decelTime;
+			newDecelDistance = (topSpeed + endSpeed) * 0.5 * decelTime;
+		}
+
+		if ((limitAccelJerk || limitDecelJerk) && newAccelDistance + newDecelDistance <= totalDistance)
+		{
+			acceleration = newAcceleration;
+			deceleration = newDeceleration;
+			beforePrepare.accelDistance = newAccelDistance;
+			beforePrepare.decelDistance = newDecelDistance;
+			const float totalTime =   (topSpeed - startSpeed)/acceleration
+									+ (topSpeed - endSpeed)/deceleration
+									+ (totalDistance - beforePrepare.accelDistance - beforePrepare.decelDistance)/topSpeed;
+			clocksNeeded = (uint32_t)(totalTime * StepTimer::StepClockRate);
+
+			// With the lengthened speed changes, the jerk limit gives a peak acceleration no higher than the configured acceleration
+			const float clockRate = (float)StepTimer::StepClockRate;
+			const float jerk = jerkLimit/(fsquare(clockRate) * clockRate);
+			if (limitAccelJerk)
+			{
+				accelJerk = jerk;
+			}
+			if (limitDecelJerk)
+			{
+				decelJerk = jerk;
+			}
+		}
+	}
+}
+
+// Replace the trapezoidal speed profile of this move by one with jerk-limited speed changes, returning true if successful.
+// The speed changes take the same time and cover the same distance as the trapezoidal ones, so the duration of the move doesn't change.
+bool DDA::LimitJerk(float accelJerk, float decelJerk)
+{
+	MotionProfile * const profile = MotionProfile::Allocate();
+	if (profile == nullptr)
+	{
+		return false;
+	}
+
+	const float clockRate = (float)StepTimer::StepClockRate;
+	const float vStart = startSpeed/clockRate;
+	const float vTop = topSpeed/clockRate;
+	const float vEnd = endSpeed/clockRate;
+	const float accelClocks = (vTop - vStart)/(acceleration/fsquare(clockRate));
+	const float decelClocks = (vTop - vEnd)/(deceleration/fsquare(clockRate));
+	const float steadyClocks = max<float>((totalDistance - beforePrepare.accelDistance - beforePrepare.decelDistance)/vTop, 0.0);
+
+	MotionSegment segs[MotionProfile::MaxMoveSegments];
+	const size_t num = MotionProfile::MakeMoveSegments(segs, vStart, vTop, vEnd, accelClocks, steadyClocks, decelClocks, accelJerk, decelJerk);
+	for (size_t i = 0; i < num; ++i)
+	{
+		(void)profile->AddSegment(segs[i]);				// this can't fail because MaxMoveSegments is less than MaxSegments
+	}
+	profile->SetDuration(clocksNeeded);
+	shapedProfile = profile;
+	if (reprap.Debug(moduleMove))
+	{
+		profile->DebugPrint();
+	}
+	return true;
+}
+
+#endif
+
+#if SUPPORT_LASER
+
+// Return the time in step clocks after the start of the move at which the head has moved the specified distance along it.
+// This is only called from within Prepare after clocksNeeded has been finalised, because it needs the accelerate and decelerate distances.
+float DDA::TimeAtDistance(float distance) const
+{
+#if SUPPORT_INPUT_SHAPING
+	if (shapedProfile != nullptr)
+	{
+		return (float)shapedProfile->DistanceToTime(distance, 0.0);
+	}
+#endif
+
+	const float clockRate = (float)StepTimer::StepClockRate;
+	if (distance <= beforePrepare.accelDistance)
+	{
+		// Use the form that doesn't lose precision when the start speed is high
+		const float denominator = startSpeed + sqrtf(fsquare(startSpeed) + 2 * acceleration * distance);
+		return (denominator > 0.0) ? (2 * distance * clockRate)/denominator : 0.0;
+	}
+
+	const float decelStartDistance = totalDistance - beforePrepare.decelDistance;
+	if (distance <= decelStartDistance)
+	{
+		return ((topSpeed - startSpeed)/acceleration + (distance - beforePrepare.accelDistance)/topSpeed) * clockRate;
+	}
+
+	// In the deceleration phase, so work backwards from the end of the move
+	const float distanceToGo = max<float>(totalDistance - distance, 0.0);
+	const float denominator = endSpeed + sqrtf(fsquare(endSpeed) + 2 * deceleration * distanceToGo);
+	const float timeToGo = (denominator > 0.0) ? (2 * distanceToGo * clockRate)/denominator : 0.0;
+	return max<float>((float)clocksNeeded - timeToGo, 0.0);
+}
+
+// Work out when each pixel of a raster move starts. The pixels are equally spaced along the move.
+void DDA::PrepareLaserRaster()
+{
+	const size_t numPixels = laserRaster->GetNumPixels();
+	const float pixelLength = totalDistance/numPixels;
+	for (size_t i = 1; i < numPixels; ++i)
+	{
+		laserRaster->SetPixelStartClocks(i, (uint32_t)TimeAtDistance(pixelLength * i));
+	}
+	laserPwmOrIoBits.laserPwm = laserRaster->GetPixel(0);			// the power at the start of the move
+	laserRaster->Start();
+}
+
+#endif
+
 // Prepare this DDA for execution.
 // This must not be called with interrupts disabled, because it calls Platform::EnableDrive.
 void DDA::Prepare(uint8_t simMode, float extrusionPending[])
@@ -1103,14 +1750,47 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 		AdjustAcceleration();
 	}
 
+#if SUPPORT_INPUT_SHAPING
+	// Shape the move and/or limit the jerk if it has any acceleration or deceleration. Homing and probing moves may have their speed changed part way through, so we don't do either to them.
+	if (   !flags.usesEndstops
+		&& !flags.isLeadscrewAdjustmentMove
+		&& (topSpeed > startSpeed || topSpeed > endSpeed)
+	   )
+	{
+		float accelJerk, decelJerk;
+		GetRampJerks(accelJerk, decelJerk);
+		InputShaper& shaper = reprap.GetMove().GetInputShaper();
+		if (   !(flags.xyMoving && shaper.IsEnabled() && shaper.ShapeMove(*this, simMode == 0, accelJerk, decelJerk))
+			&& (accelJerk != 0.0 || decelJerk != 0.0)
+			&& simMode == 0
+		   )
+		{
+			(void)LimitJerk(accelJerk, decelJerk);
+		}
+	}
+#endif
+
 #if SUPPORT_LASER
 	if (topSpeed < requestedSpeed && reprap.GetGCodes().GetMachineType() == MachineType::laser)
 	{
 		// Scale back the laser power according to the actual speed
 		laserPwmOrIoBits.laserPwm = (laserPwmOrIoBits.laserPwm * topSpeed)/requestedSpeed;
+		if (laserRaster != nullptr)
+		{
+			laserRaster->ScalePixels(topSpeed/requestedSpeed);
+		}
+	}
+	if (laserRaster != nullptr)
+	{
+		PrepareLaserRaster();
 	}
 #endif
 
+	if (flags.usesEndstops && simMode == 0)
+	{
+		flags.endstopInterrupts = AttachEndstopInterrupts(reprap.GetPlatform());
+	}
+
 	PrepParams params;
 	params.accelDistance = beforePrepare.accelDistance;
 	params.decelDistance = beforePrepare.decelDistance;
@@ -1155,6 +1835,9 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 		afterPrepare.extraAccelerationClocks = roundS32((accelStopTime - (beforePrepare.accelDistance/topSpeed)) * StepTimer::StepClockRate);
 
 		activeDMs = completedDMs = nullptr;
+#if DM_USE_STEP_TABLES
+		stepTableDMs = nullptr;
+#endif
 
 #if SUPPORT_CAN_EXPANSION
 		CanInterface::StartMovement(*this);
@@ -1185,6 +1868,9 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 								DebugPrintAll("pr");
 							}
 							InsertDM(pdm);
+#if DM_USE_STEP_TABLES
+							AddStepTableDM(pdm);
+#endif
 						}
 						else
 						{
@@ -1247,7 +1933,8 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 					const size_t driver = config.driverNumbers[i];
 					if (driver >= NumDirectDrivers)
 					{
-						CanInterface::AddMovement(*this, params, driver - NumDirectDrivers, pdm->GetSteps());
+						CanInterface::AddDeltaMovement(*this, params, driver - NumDirectDrivers, delta, drive);
+						AddCanEndstopCheck(drive, driver - NumDirectDrivers);
 					}
 					else
 					{
@@ -1256,6 +1943,41 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 				}
 #endif
 			}
+#if SUPPORT_SEGMENT_FREE_STREAMING
+			else if (numStreamedSubSegments != 0 && drive < XYZ_AXES && IsBitSet(streamedAxes, drive))
+			{
+				// We are streaming the motor position for this axis, because it uses non-linear kinematics or mesh compensation.
+				// The motor may move and return, so allocate a DM even if there is no net movement.
+				DriveMovement* const pdm = DriveMovement::Allocate(drive, DMState::moving);
+				if (platform.GetDriversBitmap(drive) != 0)					// if any of the drives is local
+				{
+					reprap.GetPlatform().EnableDrive(drive);
+					if (pdm->PrepareStreamedAxis(*this, params, streamedSubSegmentSteps[drive], endPoint[drive] - prev->endPoint[drive]))
+					{
+						// Check for sensible values, print them if they look dubious
+						if (reprap.Debug(moduleDda) && pdm->totalSteps > 1000000)
+						{
+							DebugPrintAll("ps");
+						}
+						InsertDM(pdm);
+						SetBit(axisMotorsEnabled, drive);
+						additionalAxisMotorsToEnable |= reprap.GetMove().GetKinematics().GetConnectedAxes(drive);
+					}
+					else
+					{
+						pdm->state = DMState::idle;
+						pdm->nextDM = completedDMs;
+						completedDMs = pdm;
+					}
+				}
+				else
+				{
+					pdm->state = DMState::idle;								// no local drivers involved
+					pdm->nextDM = completedDMs;
+					completedDMs = pdm;
+				}
+			}
+#endif
 			else if (drive < numTotalAxes)
 			{
 				// It's a linear drive
@@ -1291,6 +2013,9 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 								DebugPrintAll("pr");
 							}
 							InsertDM(pdm);
+#if DM_USE_STEP_TABLES
+							AddStepTableDM(pdm);
+#endif
 						}
 						else
 						{
@@ -1308,6 +2033,7 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 						if (driver >= NumDirectDrivers)
 						{
 							CanInterface::AddMovement(*this, params, driver - NumDirectDrivers, delta);
+							AddCanEndstopCheck(drive, driver - NumDirectDrivers);
 						}
 						else
 						{
@@ -1325,24 +2051,25 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 				if (directionVector[drive] != 0.0)
 				{
 					DriveMovement* const pdm = DriveMovement::Allocate(drive, DMState::moving);
+
+					// If there is any extruder jerk in this move, in theory that means we need to instantly extrude or retract some amount of filament.
+					// Pass the speed change to PrepareExtruder
+					float speedChange;
+					if (flags.usePressureAdvance)
+					{
+						const float prevEndSpeed = (prev->flags.usePressureAdvance) ? prev->endSpeed * prev->directionVector[drive] : 0.0;
+						speedChange = (startSpeed * directionVector[drive]) - prevEndSpeed;
+					}
+					else
+					{
+						speedChange = 0.0;
+					}
+
 					if (platform.GetDriversBitmap(drive) != 0)					// if any of the drives is local
 					{
 #if !SUPPORT_CAN_EXPANSION
 						reprap.GetPlatform().EnableDrive(drive);
 #endif
-						// If there is any extruder jerk in this move, in theory that means we need to instantly extrude or retract some amount of filament.
-						// Pass the speed change to PrepareExtruder
-						float speedChange;
-						if (flags.usePressureAdvance)
-						{
-							const float prevEndSpeed = (prev->flags.usePressureAdvance) ? prev->endSpeed * prev->directionVector[drive] : 0.0;
-							speedChange = (startSpeed * directionVector[drive]) - prevEndSpeed;
-						}
-						else
-						{
-							speedChange = 0.0;
-						}
-
 						if (pdm->PrepareExtruder(*this, params, extrusionPending[drive - numTotalAxes], speedChange, flags.usePressureAdvance))
 						{
 							// Check for sensible values, print them if they look dubious
@@ -1369,6 +2096,10 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 					}
 					else
 					{
+#if SUPPORT_CAN_EXPANSION
+						// Prepare the DM anyway, to calculate the steps for the remote driver and carry forward the extrusion pending
+						(void)pdm->PrepareExtruder(*this, params, extrusionPending[drive - numTotalAxes], speedChange, flags.usePressureAdvance);
+#endif
 						pdm->state = DMState::idle;								// no local drivers involved
 						pdm->nextDM = completedDMs;
 						completedDMs = pdm;
@@ -1378,7 +2109,9 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 					const uint8_t driver = platform.GetExtruderDriver(drive - numTotalAxes);
 					if (driver >= NumDirectDrivers)
 					{
-						CanInterface::AddMovement(*this, params, driver - NumDirectDrivers, pdm->GetSteps());
+						CanInterface::AddExtruderMovement(*this, params, driver - NumDirectDrivers, pdm->GetNetStepsLeft(),
+															(flags.usePressureAdvance) ? platform.GetPressureAdvance(drive - numTotalAxes) : 0.0);
+						AddCanEndstopCheck(drive, driver - NumDirectDrivers);
 					}
 					else
 					{
@@ -1448,6 +2181,10 @@ void DDA::Prepare(uint8_t simMode, float extrusionPending[])
 #endif
 	}
 
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	ReleasePreviousHistory();
+#endif
+	__DMB();						// make sure that all the move details have been written first
 	state = frozen;					// must do this last so that the ISR doesn't start executing it before we have finished setting it up
 }
 
@@ -1553,8 +2290,97 @@ float DDA::NormaliseXYZ()
 	}
 }
 
+// Try to set up pin change interrupts for the endstops that this move checks, returning true if successful.
+// We can only do this if all of them are switches connected to endstop inputs. We still poll the Z probe, because it may be an analog one.
+bool DDA::AttachEndstopInterrupts(Platform& platform) const
+{
+	if ((endStopsToCheck & (ZProbeActive | LogProbeChanges)) != 0)
+	{
+		return false;
+	}
+
+	const size_t numAxes = reprap.GetGCodes().GetTotalAxes();
+	uint32_t inputs = 0;
+	for (size_t drive = 0; drive < MaxTotalDrivers; ++drive)
+	{
+		if (IsBitSet(endStopsToCheck, drive))
+		{
+			if (drive >= NumEndstops)
+			{
+				return false;
+			}
+
+			// G1 H4 moves and special endstops for extruder drives read the endstop input directly. Otherwise the axis endstop type must be a switch.
+			if ((endStopsToCheck & MotorEndstops) == 0 && ((endStopsToCheck & UseSpecialEndstop) == 0 || drive < numAxes))
+			{
+				if (drive >= numAxes)
+				{
+					return false;
+				}
+				EndStopPosition stopType;
+				EndStopInputType inputType;
+				platform.GetEndStopConfiguration(drive, stopType, inputType);
+				if (inputType != EndStopInputType::activeHigh && inputType != EndStopInputType::activeLow)
+				{
+					return false;
+				}
+			}
+			SetBit(inputs, drive);
+		}
+	}
+	return platform.AttachEndstopInterrupts(inputs);
+}
+
+#if SUPPORT_CAN_EXPANSION
+
+// If this move checks the endstop of a drive, tell the expansion board with a remote driver for that drive to check its endstop input for that driver.
+// It must stop all its drivers when the endstop is hit if we would abort the whole move.
+void DDA::AddCanEndstopCheck(size_t drive, size_t canDriver) const
+{
+	if (IsBitSet(endStopsToCheck, drive))
+	{
+		const bool stopAllDrives = (endStopsToCheck & UseSpecialEndstop) != 0
+									|| (drive < reprap.GetGCodes().GetTotalAxes() && reprap.GetMove().GetKinematics().QueryTerminateHomingMove(drive));
+		CanInterface::CheckEndstop(canDriver, stopAllDrives);
+	}
+}
+
+#endif
+
 void DDA::CheckEndstops(Platform& platform)
 {
+	if ((endStopsToCheck & MotorEndstops) != 0)
+	{
+		// This is a G1 H4 move, so stop each Z motor when the endstop input with the same number as its driver is triggered
+		const bool activeState = (endStopsToCheck & ActiveLowEndstop) == 0;
+		for (size_t driver = 0; driver < NumDirectDrivers; ++driver)
+		{
+			if (IsBitSet(endStopsToCheck, driver) && platform.EndStopInputState(driver) == activeState)
+			{
+				ClearBit(endStopsToCheck, driver);
+				const DriveMovement * const pdm = FindDM(driver + MaxTotalDrivers);
+				if (pdm != nullptr)
+				{
+					const int32_t stepsTaken = pdm->GetNetStepsTaken();
+					reprap.GetMove().SetLeadscrewHomed(driver, (pdm->direction) ? stepsTaken : -stepsTaken);
+				}
+				StopDrive(driver + MaxTotalDrivers);
+			}
+		}
+
+		if ((endStopsToCheck & LowestNBits<EndstopsBitmap>(NumDirectDrivers)) == 0)
+		{
+			// All the Z motors have reached their endstops, so the Z axis is now homed
+			EndStopPosition stopType;
+			EndStopInputType dummy;
+			platform.GetEndStopConfiguration(Z_AXIS, stopType, dummy);
+			reprap.GetMove().GetKinematics().OnHomingSwitchTriggered(Z_AXIS, stopType == EndStopPosition::highEndStop, platform.GetDriveStepsPerUnit(), *this);
+			reprap.GetGCodes().SetAxisIsHomed(Z_AXIS);
+			endStopsToCheck = 0;
+		}
+		return;
+	}
+
 	if ((endStopsToCheck & ZProbeActive) != 0)						// if the Z probe is enabled in this move
 	{
 		// Check whether the Z probe has been triggered. On a delta at least, this must be done separately from endstop checks,
@@ -1563,7 +2389,7 @@ void DDA::CheckEndstops(Platform& platform)
 		{
 		case EndStopHit::lowHit:
 			MoveAborted();											// set the state to completed and recalculate the endpoints
-			reprap.GetGCodes().MoveStoppedByZProbe();
+			reprap.GetGCodes().MoveStoppedByZProbe(topSpeed);
 			return;
 
 		case EndStopHit::nearStop:
@@ -1674,6 +2500,11 @@ pre(state == frozen)
 	}
 	state = executing;
 
+	if (flags.endstopInterrupts)
+	{
+		p.FlagEndstopChanged();						// make sure we check the endstops once at the start, in case one is already triggered
+	}
+
 #if DDA_LOG_PROBE_CHANGES
 	if ((endStopsToCheck & LogProbeChanges) != 0)
 	{
@@ -1755,91 +2586,295 @@ pre(state == frozen)
 
 uint32_t DDA::lastStepLowTime = 0;
 uint32_t DDA::lastDirChangeTime = 0;
+uint32_t DDA::stepMergeWindow = DDA::MinInterruptInterval;
+uint32_t DDA::mergedStepPasses = 0;
+uint32_t DDA::singleDriveStepPasses = 0;
+TimingHistogram DDA::stepLateness;
 
 // Generate the step pulses of internal drivers used by this DDA. Return true if the move is complete and the next move should be started.
+// All drives that are due to step within the step merging window are stepped together. If the first drive in the list is due again within that window
+// by the time we have finished, we go round again instead of returning to the caller and rescheduling the step interrupt.
 void DDA::StepDrivers(Platform& p)
 {
-	// 1. Check endstop switches and Z probe if asked. This is not speed critical because fast moves do not use endstops or the Z probe.
-	if (flags.usesEndstops)			// if any homing switches or the Z probe is enabled in this move
+	// Moves with only one local drive still stepping and nothing else to watch, such as retractions and long Z moves, take a shorter path
+	if (activeDMs != nullptr && activeDMs->nextDM == nullptr && !flags.usesEndstops
+#if SUPPORT_LASER
+		&& laserRaster == nullptr
+#endif
+	   )
 	{
-		CheckEndstops(p);			// call out to a separate function because this may help cache usage in the more common case where we don't call it
-		if (state == completed)		// we may have completed the move due to triggering an endstop switch or Z probe
+		const uint32_t driversStepping = p.GetDriversBitmap(activeDMs->drive);
+		if ((driversStepping & p.GetSlowDriversBitmap()) == 0)
 		{
+			StepSingleDrive(driversStepping);
 			return;
 		}
 	}
 
-	uint32_t driversStepping = 0;
-	DriveMovement* dm = activeDMs;
-	uint32_t now = StepTimer::GetInterruptClocks();
-	const uint32_t elapsedTime = (now - afterPrepare.moveStartTime) + MinInterruptInterval;
-	while (dm != nullptr && elapsedTime >= dm->nextStepTime)		// if the next step is due
+	unsigned int passesLeft = MaxStepPassesPerInterrupt;
+	uint32_t stepLowTime = 0;											// when we set the step pins low at the end of the previous pass
+	for (;;)
 	{
-		driversStepping |= p.GetDriversBitmap(dm->drive);
-		dm = dm->nextDM;
+		// 1. Check endstop switches and Z probe if asked. This is not speed critical because fast moves do not use endstops or the Z probe.
+		//    If the endstops raise interrupts then we only need to check them when one has changed.
+		if (flags.usesEndstops && (!flags.endstopInterrupts || p.CheckEndstopChanged()))	// if any homing switches or the Z probe is enabled in this move
+		{
+			CheckEndstops(p);			// call out to a separate function because this may help cache usage in the more common case where we don't call it
+			if (state == completed)		// we may have completed the move due to triggering an endstop switch or Z probe
+			{
+				return;
+			}
+		}
+
+		uint32_t driversStepping = 0;
+		DriveMovement* dm = activeDMs;
+		uint32_t now = StepTimer::GetInterruptClocks();
+#if SUPPORT_LASER
+		if (laserRaster != nullptr)
+		{
+			laserRaster->Update(p, now - afterPrepare.moveStartTime);
+		}
+#endif
+		if (dm != nullptr)
+		{
+			const int32_t lateness = (int32_t)(now - afterPrepare.moveStartTime - dm->nextStepTime);
+			stepLateness.Add((lateness > 0) ? (uint32_t)lateness : 0);
+		}
+		const uint32_t elapsedTime = (now - afterPrepare.moveStartTime) + stepMergeWindow;
+		while (dm != nullptr && elapsedTime >= dm->nextStepTime)		// if the next step is due
+		{
+			driversStepping |= p.GetDriversBitmap(dm->drive);
+			dm = dm->nextDM;
+		}
+
+		if ((driversStepping & p.GetSlowDriversBitmap()) == 0)	// if not using any external drivers
+		{
+			// 3. Step the drivers. If this is a merged pass, make sure the step pins have been low for long enough first.
+			if (passesLeft != MaxStepPassesPerInterrupt)
+			{
+				while (StepTimer::GetInterruptClocks() - stepLowTime < MinStepLowClocks) {}
+			}
+			Platform::StepDriversHigh(driversStepping);					// generate the steps
+		}
+		else
+		{
+			// 3. Step the drivers
+			uint32_t lastStepPulseTime = lastStepLowTime;
+			while (now - lastStepPulseTime < p.GetSlowDriverStepLowClocks() || now - lastDirChangeTime < p.GetSlowDriverDirSetupClocks())
+			{
+				now = StepTimer::GetInterruptClocks();
+			}
+			Platform::StepDriversHigh(driversStepping);					// generate the steps
+			lastStepPulseTime = StepTimer::GetInterruptClocks();
+
+			// 3a. Reset all step pins low. Do this now because some external drivers don't like the direction pins being changed before the end of the step pulse.
+			while (StepTimer::GetInterruptClocks() - lastStepPulseTime < p.GetSlowDriverStepHighClocks()) {}
+			Platform::StepDriversLow();									// set all step pins low
+			lastStepLowTime = lastStepPulseTime = StepTimer::GetInterruptClocks();
+		}
+
+		// 4. Remove those drives from the list, calculate the next step times, update the direction pins where necessary,
+		//    and re-insert them so as to keep the list in step-time order.
+		//    Note that the call to CalcNextStepTime may change the state of Direction pin.
+		DriveMovement *dmToInsert = activeDMs;							// head of the chain we need to re-insert
+		activeDMs = dm;													// remove the chain from the list
+		while (dmToInsert != dm)										// note that both of these may be nullptr
+		{
+			const bool hasMoreSteps = (dmToInsert->isDelta)
+					? dmToInsert->CalcNextStepTimeDelta(*this, true)
+					: dmToInsert->CalcNextStepTimeCartesian(*this, true);
+			DriveMovement * const nextToInsert = dmToInsert->nextDM;
+			if (hasMoreSteps)
+			{
+				InsertDM(dmToInsert);
+			}
+			else
+			{
+				dmToInsert->nextDM = completedDMs;
+				completedDMs = dmToInsert;
+			}
+			dmToInsert = nextToInsert;
+		}
+
+		// 5. Reset all step pins low. We already did this if we are using any external drivers, but doing it again does no harm.
+		Platform::StepDriversLow();										// set all step pins low
+		stepLowTime = StepTimer::GetInterruptClocks();
+
+		// 6. If the next step is already due within the merging window, generate it now rather than going back through the step timer.
+		//    Step 3 waits until the pins have been low for MinStepLowClocks, because only the loop checks run between setting them low and high again.
+		--passesLeft;
+		if (   passesLeft == 0
+			|| driversStepping == 0
+			|| activeDMs == nullptr
+			|| (StepTimer::GetInterruptClocks() - afterPrepare.moveStartTime) + stepMergeWindow < activeDMs->nextStepTime
+		   )
+		{
+			break;
+		}
+		++mergedStepPasses;
 	}
 
-	if ((driversStepping & p.GetSlowDriversBitmap()) == 0)	// if not using any external drivers
+	// If there are no more steps to do and the time for the move has nearly expired, flag the move as complete
+	if (activeDMs == nullptr && StepTimer::GetInterruptClocks() - afterPrepare.moveStartTime + WakeupTime >= clocksNeeded)
 	{
-		// 3. Step the drivers
-		Platform::StepDriversHigh(driversStepping);					// generate the steps
+		state = completed;
 	}
-	else
+}
+
+// Generate the step pulses when there is just one active drive and it only uses internal drivers. There is no step list to walk or re-sort and the
+// drivers bitmap is fetched once, so each pass takes much less time than in StepDrivers and we can afford to do more of them before returning.
+void DDA::StepSingleDrive(uint32_t driversStepping)
+{
+	DriveMovement * const dm = activeDMs;
+	const int32_t lateness = (int32_t)(StepTimer::GetInterruptClocks() - afterPrepare.moveStartTime - dm->nextStepTime);
+	stepLateness.Add((lateness > 0) ? (uint32_t)lateness : 0);
+
+	uint32_t stepLowTime = 0;											// when we set the step pins low at the end of the previous pass
+	for (unsigned int passesLeft = MaxSingleDriveStepPasses; passesLeft != 0; --passesLeft)
 	{
-		// 3. Step the drivers
-		uint32_t lastStepPulseTime = lastStepLowTime;
-		while (now - lastStepPulseTime < p.GetSlowDriverStepLowClocks() || now - lastDirChangeTime < p.GetSlowDriverDirSetupClocks())
+		if ((StepTimer::GetInterruptClocks() - afterPrepare.moveStartTime) + stepMergeWindow < dm->nextStepTime)
+		{
+			break;														// the next step isn't due yet
+		}
+
+		// Only the check above runs between setting the pin low and setting it high again, so wait until it has been low for long enough
+		if (passesLeft != MaxSingleDriveStepPasses)
+		{
+			while (StepTimer::GetInterruptClocks() - stepLowTime < MinStepLowClocks) {}
+		}
+		Platform::StepDriversHigh(driversStepping);						// generate the step
+		const bool hasMoreSteps = (dm->isDelta)
+									? dm->CalcNextStepTimeDelta(*this, true)
+									: dm->CalcNextStepTimeCartesian(*this, true);
+		Platform::StepDriversLow();										// the time taken to calculate the next step time ensures the step high time is long enough
+		stepLowTime = StepTimer::GetInterruptClocks();
+		++singleDriveStepPasses;
+		if (!hasMoreSteps)
 		{
-			now = StepTimer::GetInterruptClocks();
+			activeDMs = nullptr;
+			dm->nextDM = completedDMs;
+			completedDMs = dm;
+			break;
 		}
-		Platform::StepDriversHigh(driversStepping);					// generate the steps
-		lastStepPulseTime = StepTimer::GetInterruptClocks();
+	}
 
-		// 3a. Reset all step pins low. Do this now because some external drivers don't like the direction pins being changed before the end of the step pulse.
-		while (StepTimer::GetInterruptClocks() - lastStepPulseTime < p.GetSlowDriverStepHighClocks()) {}
-		Platform::StepDriversLow();									// set all step pins low
-		lastStepLowTime = lastStepPulseTime = StepTimer::GetInterruptClocks();
+	// If there are no more steps to do and the time for the move has nearly expired, flag the move as complete
+	if (activeDMs == nullptr && StepTimer::GetInterruptClocks() - afterPrepare.moveStartTime + WakeupTime >= clocksNeeded)
+	{
+		state = completed;
 	}
+}
 
-	// 4. Remove those drives from the list, calculate the next step times, update the direction pins where necessary,
-	//    and re-insert them so as to keep the list in step-time order.
-	//    Note that the call to CalcNextStepTime may change the state of Direction pin.
-	DriveMovement *dmToInsert = activeDMs;							// head of the chain we need to re-insert
-	activeDMs = dm;													// remove the chain from the list
-	while (dmToInsert != dm)										// note that both of these may be nullptr
+// Calculate all the step times of this prepared move in the same way as StepDrivers, but without generating any step pulses or changing the direction pins.
+// The step passes are run back to back and timed, so we can tell how fast the step interrupt could generate the steps of this move.
+// A pass that would have finished after the following step became due counts as a hiccup. On return the DMs have been released.
+void DDA::RunBenchmarkSteps(BenchmarkResults& results)
+{
+	while (activeDMs != nullptr)
 	{
-		const bool hasMoreSteps = (dmToInsert->isDelta)
-				? dmToInsert->CalcNextStepTimeDelta(*this, true)
-				: dmToInsert->CalcNextStepTimeCartesian(*this, true);
-		DriveMovement * const nextToInsert = dmToInsert->nextDM;
-		if (hasMoreSteps)
+		const uint32_t passStartTime = StepTimer::GetInterruptClocks();
+		const uint32_t stepTime = activeDMs->nextStepTime;
+		DriveMovement *dm = activeDMs;
+		while (dm != nullptr && stepTime + stepMergeWindow >= dm->nextStepTime)
 		{
-			InsertDM(dmToInsert);
+			++results.numSteps;
+			dm = dm->nextDM;
 		}
-		else
+
+		DriveMovement *dmToInsert = activeDMs;
+		activeDMs = dm;
+		while (dmToInsert != dm)
 		{
-			dmToInsert->nextDM = completedDMs;
-			completedDMs = dmToInsert;
+			const bool hasMoreSteps = (dmToInsert->isDelta)
+					? dmToInsert->CalcNextStepTimeDelta(*this, false)
+					: dmToInsert->CalcNextStepTimeCartesian(*this, false);
+			DriveMovement * const nextToInsert = dmToInsert->nextDM;
+			if (hasMoreSteps)
+			{
+				InsertDM(dmToInsert);
+			}
+			else
+			{
+				dmToInsert->nextDM = completedDMs;
+				completedDMs = dmToInsert;
+			}
+			dmToInsert = nextToInsert;
+		}
+
+		const uint32_t passClocks = StepTimer::GetInterruptClocks() - passStartTime;
+		++results.numPasses;
+		results.passClocks += passClocks;
+		if (passClocks > results.worstPassClocks)
+		{
+			results.worstPassClocks = passClocks;
+		}
+		if (activeDMs != nullptr && activeDMs->nextStepTime < stepTime + passClocks)
+		{
+			++results.numHiccups;
 		}
-		dmToInsert = nextToInsert;
+
+#if DM_USE_STEP_TABLES
+		RefillStepTables();							// the main loop would normally do this while the move executes, so don't include it in the timing
+#endif
 	}
 
-	// 5. Reset all step pins low. We already did this if we are using any external drivers, but doing it again does no harm.
-	Platform::StepDriversLow();										// set all step pins low
+	++results.numMoves;
+	results.moveClocks += clocksNeeded;
+	ReleaseDMs();
+#if SUPPORT_INPUT_SHAPING
+	ReleaseShapedProfile();
+#endif
+	state = empty;
+}
 
-	// If there are no more steps to do and the time for the move has nearly expired, flag the move as complete
-	if (activeDMs == nullptr && StepTimer::GetInterruptClocks() - afterPrepare.moveStartTime + WakeupTime >= clocksNeeded)
+// Return the number of extra step passes done since we were last called and clear it
+/*static*/ uint32_t DDA::GetAndClearMergedStepPasses()
+{
+	const uint32_t ret = mergedStepPasses;
+	mergedStepPasses = 0;
+	return ret;
+}
+
+// Return the number of step passes that took the single drive path since we were last called and clear it
+/*static*/ uint32_t DDA::GetAndClearSingleDriveStepPasses()
+{
+	const uint32_t ret = singleDriveStepPasses;
+	singleDriveStepPasses = 0;
+	return ret;
+}
+
+#if DM_USE_STEP_TABLES
+
+// Top up the step time tables of the DMs that use them. Called from the main loop, normally while this move is executing.
+void DDA::RefillStepTables()
+{
+	for (DriveMovement *dm = stepTableDMs; dm != nullptr; dm = dm->nextTableDM)
 	{
-		state = completed;
+		if (dm->state == DMState::moving)
+		{
+			dm->FillStepTable(*this, true);
+		}
 	}
 }
 
+#endif
+
 // Return the time that the next interrupt is needed. It may be earlier than the current time.
 std::optional<uint32_t> DDA::GetNextInterruptTime() const
 {
-	return (state == executing)
-			? std::optional<uint32_t>(((activeDMs != nullptr) ? activeDMs->nextStepTime : clocksNeeded - DDA::WakeupTime) + afterPrepare.moveStartTime)
-				: std::optional<uint32_t>();
+	if (state != executing)
+	{
+		return std::optional<uint32_t>();
+	}
+
+	uint32_t nextTime = (activeDMs != nullptr) ? activeDMs->nextStepTime : clocksNeeded - DDA::WakeupTime;
+#if SUPPORT_LASER
+	if (laserRaster != nullptr)
+	{
+		nextTime = min<uint32_t>(nextTime, laserRaster->GetNextChangeClocks());		// wake up when the laser power must change, even if no step is due
+	}
+#endif
+	return std::optional<uint32_t>(nextTime + afterPrepare.moveStartTime);
 }
 
 // Stop a drive and re-calculate the corresponding endpoint.
@@ -1967,6 +3002,32 @@ bool DDA::HasStepError() const
 bool DDA::Free()
 {
 	ReleaseDMs();
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	// If the next move is waiting to be prepared, keep our motion so that its smoothed pressure advance can look back at it.
+	// CanAddMove doesn't reuse a DDA whose next move is provisional, so our move details stay valid until then.
+	ReleasePreviousHistory();
+	flags.keptForHistory = (state == completed && next->state == provisional);
+#if SUPPORT_INPUT_SHAPING
+	if (!flags.keptForHistory)
+	{
+		ReleaseShapedProfile();
+	}
+#endif
+#elif SUPPORT_INPUT_SHAPING
+	ReleaseShapedProfile();
+#endif
+#if SUPPORT_LASER
+	if (laserRaster != nullptr)
+	{
+		LaserRaster::Release(laserRaster);
+		laserRaster = nullptr;
+	}
+#endif
+	if (flags.endstopInterrupts)
+	{
+		reprap.GetPlatform().DetachEndstopInterrupts();
+		flags.endstopInterrupts = false;
+	}
 	state = empty;
 	return flags.hadLookaheadUnderrun;
 }
@@ -1978,7 +3039,7 @@ int32_t DDA::GetStepsTaken(size_t drive) const
 	return (dmp != nullptr) ? dmp->GetNetStepsTaken() : 0;
 }
 
-void DDA::LimitSpeedAndAcceleration(float maxSpeed, float maxAcceleration)
+void DDA::LimitSpeedAndAcceleration(float maxSpeed, float maxAcceleration, float maxDeceleration)
 {
 	if (requestedSpeed > maxSpeed)
 	{
@@ -1988,9 +3049,9 @@ void DDA::LimitSpeedAndAcceleration(float maxSpeed, float maxAcceleration)
 	{
 		acceleration = maxAcceleration;
 	}
-	if (deceleration > maxAcceleration)
+	if (deceleration > maxDeceleration)
 	{
-		deceleration = maxAcceleration;
+		deceleration = maxDeceleration;
 	}
 }
 
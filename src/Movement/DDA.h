@@ -11,6 +11,7 @@
 #include "RepRapFirmware.h"
 #include "DriveMovement.h"
 #include "StepTimer.h"
+#include "TimingHistogram.h"
 #include "GCodes/GCodes.h"			// for class RawMove
 
 #include <optional>
@@ -22,11 +23,15 @@
 #endif
 
 class DDARing;
+class MotionProfile;
+struct MotionSegment;
+class LaserRaster;
 
 // This defines a single coordinated movement of one or several motors
 class DDA
 {
 	friend class DriveMovement;
+	friend class InputShaper;
 
 public:
 
@@ -39,14 +44,28 @@ public:
 		completed			// move has been completed or aborted
 	};
 
+	// Accumulated results of the step rate benchmark
+	struct BenchmarkResults
+	{
+		uint32_t numMoves;												// number of moves that we calculated the steps of
+		uint32_t numSteps;												// total number of steps
+		uint32_t numPasses;												// number of step passes, each of which would be one call to StepDrivers
+		uint32_t passClocks;											// total step clocks taken by the step passes
+		uint32_t worstPassClocks;										// the longest step pass
+		uint32_t moveClocks;											// the total nominal duration of the moves
+		uint32_t numHiccups;											// number of step passes that would have finished after the next step was due
+	};
+
 	DDA(DDA* n);
 
 	bool InitStandardMove(DDARing& ring, GCodes::RawMove &nextMove, bool doMotorMapping) __attribute__ ((hot));	// Set up a new move, returning true if it represents real movement
-	bool InitLeadscrewMove(DDARing& ring, float feedrate, const float amounts[MaxTotalDrivers]);		// Set up a leadscrew motor move
+	bool InitLeadscrewMove(DDARing& ring, float feedrate, const float amounts[MaxTotalDrivers], EndstopsBitmap endstops);	// Set up a leadscrew motor move
 
 	void Start(Platform& p, uint32_t tim) __attribute__ ((hot));			// Start executing the DDA, i.e. move the move.
-	void StepDrivers(Platform& p) __attribute__ ((hot));					// Take one step of the DDA, called by timed interrupt.
+	void StepDrivers(Platform& p) STEP_ISR_CODE;					// Take one step of the DDA, called by timed interrupt.
 	std::optional<uint32_t> GetNextInterruptTime() const;					// Return the time that the next interrupt is needed
+	void RunBenchmarkSteps(BenchmarkResults& results);						// Calculate all the step times of a prepared move without stepping the motors
+	static bool PlanStopAfter(DDARing& ring, DDA *first, DDA *last);		// Try to slow down unprepared moves so that the last one ends at a standstill
 
 	void SetNext(DDA *n) { next = n; }
 	void SetPrevious(DDA *p) { prev = p; }
@@ -55,8 +74,10 @@ public:
 	void Prepare(uint8_t simMode, float extrusionPending[]) __attribute__ ((hot));	// Calculate all the values and freeze this DDA
 	bool HasStepError() const;
 	bool CanPauseAfter() const { return flags.canPauseAfter; }
+	bool IsPauseAllowedAfter() const { return flags.pauseAllowedAfter; }		// Return true if we could pause after this move if it ended at a standstill
 	bool IsPrintingMove() const { return flags.isPrintingMove; }			// Return true if this involves both XY movement and extrusion
 	bool UsingStandardFeedrate() const { return flags.usingStandardFeedrate; }
+	int GetScanProbePoint() const { return scanProbePoint; }				// Return the grid point at which to record the Z probe reading at the end of this move, or -1
 
 	DDAState GetState() const { return state; }
 	DDA* GetNext() const { return next; }
@@ -72,12 +93,18 @@ public:
     FilePosition GetFilePosition() const { return filePos; }
     float GetRequestedSpeed() const { return requestedSpeed; }
     float GetTopSpeed() const { return topSpeed; }
+    float GetStartSpeed() const { return startSpeed; }
+    float GetEndSpeed() const { return endSpeed; }
+    float GetAcceleration() const { return acceleration; }
+    float GetDeceleration() const { return deceleration; }
     float GetVirtualExtruderPosition() const { return virtualExtruderPosition; }
 	float AdvanceBabyStepping(DDARing& ring, size_t axis, float amount);					// Try to push babystepping earlier in the move queue
 	bool IsHomingAxes() const { return (endStopsToCheck & HomeAxes) != 0; }
 	const Tool *GetTool() const { return tool; }
 	float GetTotalDistance() const { return totalDistance; }
-	void LimitSpeedAndAcceleration(float maxSpeed, float maxAcceleration);	// Limit the speed an acceleration of this move
+	float GetToolExtrusionSpeed() const;										// Get the average forward extrusion speed of the tool's extruders in mm/sec
+	void LimitSpeedAndAcceleration(float maxSpeed, float maxAcceleration) { LimitSpeedAndAcceleration(maxSpeed, maxAcceleration, maxAcceleration); }
+	void LimitSpeedAndAcceleration(float maxSpeed, float maxAcceleration, float maxDeceleration);	// Limit the speed, acceleration and deceleration of this move
 
 	// Filament monitor support
 	int32_t GetStepsTaken(size_t drive) const;
@@ -91,18 +118,26 @@ public:
 	uint32_t GetClocksNeeded() const { return clocksNeeded; }
 	bool IsGoodToPrepare() const;
 	bool IsNonPrintingExtruderMove() const { return flags.isNonPrintingExtruderMove; }
+	bool HadLookaheadUnderrun() const { return flags.hadLookaheadUnderrun; }
 
 #if SUPPORT_LASER || SUPPORT_IOBITS
 	LaserPwmOrIoBits GetLaserPwmOrIoBits() const { return laserPwmOrIoBits; }
 #endif
 
-#if SUPPORT_IOBITS
+#if SUPPORT_IOBITS || SUPPORT_MOVE_TRACE
 	uint32_t GetMoveStartTime() const { return afterPrepare.moveStartTime; }
+#endif
+
+#if SUPPORT_IOBITS
 	IoBits_t GetIoBits() const { return laserPwmOrIoBits.ioBits; }
 #endif
 
 	uint32_t GetMoveFinishTime() const { return afterPrepare.moveStartTime + clocksNeeded; }
 
+#if DM_USE_STEP_TABLES
+	void RefillStepTables();												// Top up the precomputed step times of the DMs that use them
+#endif
+
 #if HAS_SMART_DRIVERS
 	uint32_t GetStepInterval(size_t axis, uint32_t microstepShift) const;	// Get the current full step interval for this axis or extruder
 #endif
@@ -118,15 +153,16 @@ public:
 	// Note: the above measurements were taken some time ago, before some firmware optimisations.
 #if SAME70
 	// The system clock of the SAME70 is running at 150MHz. Use the same defaults as for the SAM4E for now.
+	// The step clock may be running faster than usual, so we scale the intervals that are expressed in step clocks to keep their duration the same.
 	static constexpr uint32_t MinCalcIntervalDelta = (40 * StepTimer::StepClockRate)/1000000; 		// the smallest sensible interval between calculations (40us) in step timer clocks
 	static constexpr uint32_t MinCalcIntervalCartesian = (40 * StepTimer::StepClockRate)/1000000;	// same as delta for now, but could be lower
-	static constexpr uint32_t MinInterruptInterval = 6;									// about 6us minimum interval between interrupts, in step clocks
-	static constexpr uint32_t HiccupTime = 10;											// how long we hiccup for
+	static constexpr uint32_t MinInterruptInterval = 6 * StepTimer::StepClockScale;		// about 6us minimum interval between interrupts, in step clocks
+	static constexpr uint32_t HiccupTime = 10 * StepTimer::StepClockScale;				// how long we hiccup for
 #elif SAM4E || SAM4S
 	static constexpr uint32_t MinCalcIntervalDelta = (40 * StepTimer::StepClockRate)/1000000; 		// the smallest sensible interval between calculations (40us) in step timer clocks
 	static constexpr uint32_t MinCalcIntervalCartesian = (40 * StepTimer::StepClockRate)/1000000;	// same as delta for now, but could be lower
-	static constexpr uint32_t MinInterruptInterval = 6;									// about 6us minimum interval between interrupts, in step clocks
-	static constexpr uint32_t HiccupTime = 10;											// how long we hiccup for
+	static constexpr uint32_t MinInterruptInterval = 6 * StepTimer::StepClockScale;		// about 6us minimum interval between interrupts, in step clocks
+	static constexpr uint32_t HiccupTime = 10 * StepTimer::StepClockScale;				// how long we hiccup for
 #elif __LPC17xx__
     static constexpr uint32_t MinCalcIntervalDelta = (40 * StepTimer::StepClockRate)/1000000;		// the smallest sensible interval between calculations (40us) in step timer clocks
     static constexpr uint32_t MinCalcIntervalCartesian = (40 * StepTimer::StepClockRate)/1000000;	// same as delta for now, but could be lower
@@ -140,6 +176,16 @@ public:
 #endif
 	static constexpr uint32_t MaxStepInterruptTime = 10 * MinInterruptInterval;			// the maximum time we spend looping in the ISR , in step clocks
 	static constexpr uint32_t WakeupTime = StepTimer::StepClockRate/10000;				// stop resting 100us before the move is due to end
+	static constexpr uint32_t MaxStepMergeWindow = (20 * StepTimer::StepClockRate)/1000000;	// the largest step merging window we allow (20us) in step clocks
+	static constexpr unsigned int MaxStepPassesPerInterrupt = 4;						// the maximum number of times we step the drivers in one call to StepDrivers
+	static constexpr uint32_t MinStepLowClocks = (2 * StepTimer::StepClockRate)/1000000 + 1;	// the step low time we guarantee between passes to internal drivers (at least 1us) in step clocks
+	static constexpr unsigned int MaxSingleDriveStepPasses = 8;						// the same when only one local drive is stepping, which costs much less per pass
+
+	static uint32_t GetStepMergeWindow() { return stepMergeWindow; }
+	static void SetStepMergeWindow(uint32_t clocks) { stepMergeWindow = min<uint32_t>(clocks, MaxStepMergeWindow); }
+	static uint32_t GetAndClearMergedStepPasses();
+	static uint32_t GetAndClearSingleDriveStepPasses();
+	static TimingHistogram& GetStepLatenessHistogram() { return stepLateness; }
 
 	static void PrintMoves();										// print saved moves for debugging
 
@@ -153,6 +199,11 @@ public:
 	static uint32_t lastDirChangeTime;								// when we last change the DIR signal to a slow driver
 
 private:
+	static uint32_t stepMergeWindow;								// steps due within this many step clocks are generated in the same pass
+	static uint32_t mergedStepPasses;								// how many extra step passes we did without returning to the step timer
+	static uint32_t singleDriveStepPasses;							// how many step passes took the single drive path
+	static TimingHistogram stepLateness;							// distribution of how late the first step of each step pass was, in step clocks
+
 	DriveMovement *FindDM(size_t drive) const;						// find the DM for a drive if there is one even if it is completed
 	DriveMovement *FindActiveDM(size_t drive) const;				// find the DM for a drive if there is one but only if it is active
 	void RecalculateMove(DDARing& ring) __attribute__ ((hot));
@@ -160,14 +211,44 @@ private:
 	void ReduceHomingSpeed();										// called to reduce homing speed when a near-endstop is triggered
 	void StopDrive(size_t drive);									// stop movement of a drive and recalculate the endpoint
 	void InsertDM(DriveMovement *dm) __attribute__ ((hot));
+	void StepSingleDrive(uint32_t driversStepping) STEP_ISR_CODE;
+#if DM_USE_STEP_TABLES
+	void AddStepTableDM(DriveMovement *dm);
+#endif
 	void DeactivateDM(size_t drive);
 	void ReleaseDMs();
+#if SUPPORT_INPUT_SHAPING
+	void ReleaseShapedProfile();
+#endif
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	void ReleasePreviousHistory();									// release the motion of the previous move if we kept it for this one
+#endif
 	bool IsDecelerationMove() const;								// return true if this move is or have been might have been intended to be a deceleration-only move
 	bool IsAccelerationMove() const;								// return true if this move is or have been might have been intended to be an acceleration-only move
 	void DebugPrintVector(const char *name, const float *vec, size_t len) const;
 	void CheckEndstops(Platform& platform);
+#if SUPPORT_CAN_EXPANSION
+	void AddCanEndstopCheck(size_t drive, size_t canDriver) const;	// tell the expansion board to check the endstop of a remote driver if required
+#endif
+	bool AttachEndstopInterrupts(Platform& platform) const;
 	float NormaliseXYZ();											// Make the direction vector unit-normal in XYZ
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	size_t CalcStreamedSubSegments(const float endCoords[], float feedRate, int32_t lastKnot[XYZ_AXES]);
+	size_t CalcMeshSubSegments(const float endCoords[], const Tool *tool, int32_t lastKnot[XYZ_AXES]);
+#endif
 	void AdjustAcceleration();										// Adjust the acceleration and deceleration to reduce ringing
+#if SUPPORT_INPUT_SHAPING
+	bool EndsAccelerating() const;									// return true if this move finishes while still accelerating
+	void GetRampJerks(float& accelJerk, float& decelJerk);			// lengthen the speed changes for the jerk limit and get their jerks, or zero for trapezoidal ones
+	bool LimitJerk(float accelJerk, float decelJerk);				// give the move jerk-limited speed changes
+#endif
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	size_t GetMotionSegments(MotionSegment segs[], size_t maxSegs) const;	// Describe the distance moved against time, once the move has been prepared
+#endif
+#if SUPPORT_LASER
+	float TimeAtDistance(float distance) const;						// Return when the head has moved a given distance along the move, once it has been prepared
+	void PrepareLaserRaster();										// Work out when the laser power must change during a raster move
+#endif
 
 	static void DoLookahead(DDARing& ring, DDA *laDDA) __attribute__ ((hot));	// Try to smooth out moves in the queue
     static float Normalise(float v[], size_t dim1, size_t dim2);  	// Normalise a vector of dim1 dimensions to unit length in the first dim1 dimensions
@@ -198,7 +279,10 @@ private:
 					 usingStandardFeedrate : 1,		// True if this move uses the standard feed rate
 					 isNonPrintingExtruderMove : 1,	// True if this move is a fast extruder-only move, probably a retract/re-prime
 					 continuousRotationShortcut : 1, // True if continuous rotation axes take shortcuts
-					 usesEndstops : 1;				// True if this move monitors endstops of Z probe
+					 usesEndstops : 1,				// True if this move monitors endstops of Z probe
+					 endstopInterrupts : 1,			// True if the endstops this move checks raise interrupts when they change, so we don't need to poll them
+					 pauseAllowedAfter : 1,			// True if GCodes allows us to pause after this move, even if it ends too fast to pause there as planned
+					 keptForHistory : 1;			// True if this move has completed and been freed, but we kept its motion for when the next move is prepared
 		};
 		uint16_t all;								// so that we can print all the flags at once for debugging
 	} flags;
@@ -206,6 +290,7 @@ private:
 #if SUPPORT_LASER || SUPPORT_IOBITS
 	LaserPwmOrIoBits laserPwmOrIoBits;		// laser PWM required or port state required during this move (here because it is currently 16 bits)
 #endif
+	int16_t scanProbePoint;					// if not negative, the grid point at which to record the Z probe reading when this move completes
 
 	EndstopsBitmap endStopsToCheck;			// Which endstops we are checking on this move
 	const Tool *tool;								// which tool (if any) is active
@@ -263,6 +348,24 @@ private:
 
     DriveMovement* activeDMs;					// list of associated DMs that need steps, in step time order
     DriveMovement* completedDMs;				// list of associated DMs that don't need any more steps
+#if DM_USE_STEP_TABLES
+    DriveMovement* stepTableDMs;				// list of associated DMs that use precomputed step times, linked through nextTableDM
+#endif
+
+#if SUPPORT_SEGMENT_FREE_STREAMING
+    size_t numStreamedSubSegments;				// if nonzero, the number of kinematic segments that we stream this move in instead of splitting it
+    AxesBitmap streamedAxes;					// the axes whose motors we stream
+    float streamedKnotFractions[MaxStreamedSubSegments - 1];	// the fraction of the move at the end of each sub-segment except the last
+    int16_t streamedSubSegmentSteps[XYZ_AXES][MaxStreamedSubSegments];	// the motor steps in each sub-segment for the streamed axes
+#endif
+
+#if SUPPORT_INPUT_SHAPING
+    MotionProfile *shapedProfile;				// if not null, the input-shaped or jerk-limited motion profile that the drives follow instead of the trapezoidal one
+#endif
+
+#if SUPPORT_LASER
+    LaserRaster *laserRaster;					// if not null, the laser power values at evenly spaced positions along this move
+#endif
 };
 
 // Find the DriveMovement record for a given drive even if it is completed, or return nullptr if there isn't one
@@ -298,6 +401,20 @@ inline DriveMovement *DDA::FindActiveDM(size_t drive) const
 	return nullptr;
 }
 
+#if DM_USE_STEP_TABLES
+
+// Record that a DM uses a step table so that we can refill it while the move executes
+inline void DDA::AddStepTableDM(DriveMovement *dm)
+{
+	if (dm->usesStepTable)
+	{
+		dm->nextTableDM = stepTableDMs;
+		stepTableDMs = dm;
+	}
+}
+
+#endif
+
 // Force an end point
 inline void DDA::SetDriveCoordinate(int32_t a, size_t drive)
 {
@@ -8,6 +8,16 @@
 #include "DDARing.h"
 #include "RepRap.h"
 #include "Move.h"
+#include "Tasks.h"
+#include "Heating/Heat.h"
+
+#if SUPPORT_MOVE_TRACE
+# include "MoveTrace.h"
+#endif
+
+#if SUPPORT_PLAN_TRACE
+# include "PlanTrace.h"
+#endif
 
 #if SUPPORT_CAN_EXPANSION
 # include "CAN/CanInterface.h"
@@ -16,7 +26,18 @@
 constexpr uint32_t UsualMinimumPreparedTime = StepTimer::StepClockRate/10;			// 100ms
 constexpr uint32_t AbsoluteMinimumPreparedTime = StepTimer::StepClockRate/20;		// 50ms
 
-DDARing::DDARing() : scheduledMoves(0), completedMoves(0)
+#ifdef RTOS
+constexpr unsigned int MoveTaskWakeThreshold = 2;				// the step ISR wakes the Move task when fewer than this many moves are prepared or executing
+#endif
+
+void DDARing::PrepareStats::Clear()
+{
+	numMovesPrepared = numPreparedLate = 0;
+	totalPrepareMillis = maxPrepareMillis = 0.0;
+	minSlackMillis = (float)UsualMinimumPreparedTime * StepTimer::StepClocksToMillis;	// the most slack a move normally gets
+}
+
+DDARing::DDARing() : scanReadingsIn(0), scanReadingsOut(0), scanReadingsLost(0), scheduledMoves(0), completedMoves(0)
 {
 }
 
@@ -41,11 +62,47 @@ void DDARing::Init1(unsigned int numDdas)
 	currentDda = nullptr;
 }
 
+// Increase the number of DDAs in the ring. The ring must be idle and all completed DDAs must have been recycled.
+// The new DDAs are inserted after addPointer, so that the DDA before addPointer still holds the position at the end of the last move.
+bool DDARing::Extend(unsigned int numDdas)
+{
+	if (numDdas > numDdasInRing)
+	{
+		const uint32_t ramNeeded = (numDdas - numDdasInRing) * sizeof(DDA);
+		if (!IsIdle() || checkPointer != addPointer || Tasks::GetNeverUsedRam() < ramNeeded + MinRamToLeave)
+		{
+			return false;
+		}
+
+		DDA * const oldNext = addPointer->GetNext();
+		DDA *dda = oldNext;
+		while (numDdasInRing < numDdas)
+		{
+			DDA * const newDda = new DDA(dda);
+			dda->SetPrevious(newDda);
+			dda = newDda;
+			++numDdasInRing;
+		}
+		addPointer->SetNext(dda);
+		dda->SetPrevious(addPointer);
+	}
+	return true;
+}
+
 // This must be called from Move::Init because it indirectly refers to the GCodes module, which must therefore be initialised first
 void DDARing::Init2()
 {
 	stepErrors = 0;
-	numLookaheadUnderruns = numPrepareUnderruns = numLookaheadErrors = 0;
+	numLookaheadUnderruns = numPrepareUnderruns = numLookaheadErrors = numEarlyPauses = 0;
+	numLookaheadPasses = numLookaheadRecalcs = 0;
+	maxLookaheadRecalcs = 0;
+	prepareStats.Clear();
+	recordingStatistics = true;
+	ClearScanReadings();
+#if SUPPORT_MOVE_TRACE
+	traceNextMoveLate = traceCurrentMoveLate = false;
+	traceCurrentMoveHiccups = 0;
+#endif
 
 	// Put the origin on the lookahead ring with default velocity in the previous position to the first one that will be used.
 	// Do this by calling SetLiveCoordinates and SetPositions, so that the motor coordinates will be correct too even on a delta.
@@ -67,6 +124,7 @@ void DDARing::Init2()
 	}
 	extrudersPrinting = false;
 	simulationTime = 0.0;
+	completedMoveClocks = 0;
 }
 
 void DDARing::Exit()
@@ -151,9 +209,9 @@ bool DDARing::AddStandardMove(GCodes::RawMove &nextMove, bool doMotorMapping)
 }
 
 // Add a leadscrew levelling motor move
-bool DDARing::AddSpecialMove(float feedRate, const float coords[])
+bool DDARing::AddSpecialMove(float feedRate, const float coords[], EndstopsBitmap endstops)
 {
-	if (addPointer->InitLeadscrewMove(*this, feedRate, coords))
+	if (addPointer->InitLeadscrewMove(*this, feedRate, coords, endstops))
 	{
 		addPointer = addPointer->GetNext();
 		scheduledMoves++;
@@ -164,12 +222,20 @@ bool DDARing::AddSpecialMove(float feedRate, const float coords[])
 
 void DDARing::Spin(uint8_t simulationMode, bool shouldStartMove)
 {
+#if SUPPORT_CAN_EXPANSION
+	CanInterface::SendDueBatches();									// send any batched moves for expansion boards that will soon be needed
+#endif
+
 	// If we are simulating, simulate completion of the current move.
 	// Do this here rather than at the end, so that when simulating, currentDda is non-null for most of the time and IsExtruding() returns the correct value
 	if (simulationMode != 0)
 	{
 		DDA * const cdda = currentDda;								// currentDda is declared volatile, so copy it in the next line
-		if (cdda != nullptr)
+		if (cdda != nullptr
+#if SUPPORT_PLAN_TRACE
+			&& PlanTrace::Record(*cdda)								// if the trace ring is full, complete the move later when the trace has been written
+#endif
+		   )
 		{
 			simulationTime += (float)cdda->GetClocksNeeded()/StepTimer::StepClockRate;
 			cdda->Complete();
@@ -194,24 +260,20 @@ void DDARing::Spin(uint8_t simulationMode, bool shouldStartMove)
 				}
 				else
 				{
-					Platform& p = reprap.GetPlatform();
-					SetBasePriority(NvicPriorityStep);				// shut out step interrupt
-					StartNextMove(p, StepTimer::GetInterruptClocksInterruptsDisabled());	// start the next move
-					std::optional<uint32_t> nextInterruptTime = GetNextInterruptTime();
-					if (nextInterruptTime.has_value())
-					{
-						if (StepTimer::ScheduleStepInterrupt(nextInterruptTime.value()))
-						{
-							Interrupt(p);
-						}
-					}
-					SetBasePriority(0);
+					// Hand the move over to the step ISR, which is the only code that starts real moves. Prepare() set the DDA state to frozen last,
+					// so the ISR will see a fully prepared move. We never need to shut out the step interrupt here.
+					StepTimer::TriggerStepInterrupt();
 				}
 			}
 		}
 	}
 	else
 	{
+#if DM_USE_STEP_TABLES
+		// Precompute some more step times for the executing move, so that the step ISR doesn't have to
+		cdda->RefillStepTables();
+#endif
+
 		// See whether we need to prepare any moves. First count how many prepared or executing moves we have and how long they will take.
 		int32_t preparedTime = 0;
 		unsigned int preparedCount = 0;
@@ -236,8 +298,9 @@ void DDARing::PrepareMoves(DDA *firstUnpreparedMove, int32_t moveTimeLeft, unsig
 {
 	// If the number of prepared moves will execute in less than the minimum time, prepare another move.
 	// Try to avoid preparing deceleration-only moves too early
+	const uint32_t timeLeftMeasuredAt = StepTimer::GetInterruptClocks();		// moveTimeLeft is measured from here
 	while (	  firstUnpreparedMove->GetState() == DDA::provisional
-		   && DriveMovement::NumFree() >= (int)MaxTotalDrivers		// check that we won't run out of DMs
+		   && (simulationMode != 0 || DriveMovement::Reserve(MaxTotalDrivers))	// check that we won't run out of DMs. Simulated moves don't use any.
 		   && moveTimeLeft < (int32_t)UsualMinimumPreparedTime		// prepare moves one eighth of a second ahead of when they will be needed
 		   && alreadyPrepared * 2 < numDdasInRing					// but don't prepare more than half the ring
 		   && (firstUnpreparedMove->IsGoodToPrepare() || moveTimeLeft < (int32_t)AbsoluteMinimumPreparedTime)
@@ -246,7 +309,39 @@ void DDARing::PrepareMoves(DDA *firstUnpreparedMove, int32_t moveTimeLeft, unsig
 #endif
 		  )
 	{
+		const uint32_t prepareStartTime = StepTimer::GetInterruptClocks();
 		firstUnpreparedMove->Prepare(simulationMode, extrusionPending);
+		if (simulationMode == 0)
+		{
+			// Record how long the move took to prepare and how much time it has before it starts. If no moves were prepared or executing then it isn't late, it just starts now.
+			const uint32_t now = StepTimer::GetInterruptClocks();
+			const uint32_t prepareClocks = now - prepareStartTime;
+			const float prepareMillis = (float)prepareClocks * StepTimer::StepClocksToMillis;
+			++prepareStats.numMovesPrepared;
+			prepareStats.totalPrepareMillis += prepareMillis;
+			if (prepareMillis > prepareStats.maxPrepareMillis)
+			{
+				prepareStats.maxPrepareMillis = prepareMillis;
+			}
+			if (alreadyPrepared != 0)
+			{
+				const float slackMillis = (float)(moveTimeLeft - (int32_t)(now - timeLeftMeasuredAt)) * StepTimer::StepClocksToMillis;
+				if (slackMillis < prepareStats.minSlackMillis)
+				{
+					prepareStats.minSlackMillis = slackMillis;
+				}
+				if (slackMillis <= 0.0)
+				{
+					++prepareStats.numPreparedLate;
+				}
+			}
+
+			// Tell the heaters how fast this move extrudes, so that they can add feedforward power before the temperature starts to fall.
+			// The move starts when the ones already prepared have finished.
+			const uint32_t moveStartMillis = (uint32_t)max<int32_t>(moveTimeLeft, 0)/(StepTimer::StepClockRate/SecondsToMillis);
+			reprap.GetHeat().SetExtrusionSpeed(firstUnpreparedMove->GetTool(), firstUnpreparedMove->GetToolExtrusionSpeed(),
+												moveStartMillis + firstUnpreparedMove->GetClocksNeeded()/(StepTimer::StepClockRate/SecondsToMillis));
+		}
 		moveTimeLeft += firstUnpreparedMove->GetTimeLeft();
 		++alreadyPrepared;
 		firstUnpreparedMove = firstUnpreparedMove->GetNext();
@@ -265,7 +360,7 @@ float DDARing::PushBabyStepping(size_t axis, float amount)
 	return addPointer->AdvanceBabyStepping(*this, axis, amount);
 }
 
-// Try to start another move. Must be called with interrupts disabled, to avoid a race condition.
+// Try to start another move. Only called from the step ISR.
 void DDARing::TryStartNextMove(Platform& p, uint32_t startTime)
 {
 	const DDA::DDAState st = getPointer->GetState();
@@ -285,14 +380,28 @@ void DDARing::TryStartNextMove(Platform& p, uint32_t startTime)
 		if (st == DDA::provisional)
 		{
 			++numPrepareUnderruns;					// there are more moves available, but they are not prepared yet. Signal an underrun.
+#if SUPPORT_MOVE_TRACE
+			traceNextMoveLate = true;
+#endif
 		}
 	}
 }
 
+// This is called from the step ISR. The boundary between the main task and the ISR is a single-producer, single-consumer queue:
+// the main task prepares moves and publishes each one by setting its state to frozen, and only the ISR advances getPointer and currentDda.
 void DDARing::Interrupt(Platform& p)
 {
 	DDA* const cdda = currentDda;					// capture volatile variable
-	if (cdda != nullptr)
+	if (cdda == nullptr)
+	{
+		// No move is executing. If the main task has handed us a prepared move, start it. The caller will schedule the interrupt for its first step.
+		if (getPointer->GetState() == DDA::frozen)
+		{
+			__DMB();								// don't read any of the move details before we have seen that it is frozen
+			StartNextMove(p, StepTimer::GetInterruptClocksInterruptsDisabled());
+		}
+	}
+	else
 	{
 		cdda->StepDrivers(p);						// check endstops if necessary and step the drivers
 		if (cdda->GetState() == DDA::completed)
@@ -302,6 +411,19 @@ void DDARing::Interrupt(Platform& p)
 			const uint32_t finishTime = cdda->GetMoveFinishTime();	// calculate when this move should finish
 			CurrentMoveCompleted();					// tell the DDA ring that the current move is complete
 			TryStartNextMove(p, finishTime);		// schedule the next move
+#ifdef RTOS
+			// If we are running short of prepared moves, wake the Move task so that it prepares more without waiting for its timeout
+			const DDA *dda = getPointer;
+			for (unsigned int i = 0; i < MoveTaskWakeThreshold; ++i)
+			{
+				if (dda->GetState() != DDA::frozen && dda->GetState() != DDA::executing)
+				{
+					Move::WakeMoveTaskFromISR();
+					break;
+				}
+				dda = dda->GetNext();
+			}
+#endif
 		}
 	}
 }
@@ -313,6 +435,9 @@ void DDARing::InsertHiccup(uint32_t delayClocks)
 	if (cdda != nullptr)
 	{
 		cdda->InsertHiccup(delayClocks);
+#if SUPPORT_MOVE_TRACE
+		++traceCurrentMoveHiccups;
+#endif
 		for (DDA *nextDda = cdda->GetNext(); nextDda->GetState() == DDA::frozen; nextDda = nextDda->GetNext())
 		{
 			nextDda->InsertHiccup(delayClocks);
@@ -330,12 +455,82 @@ void DDARing::CurrentMoveCompleted()
 	{
 		extrusionAccumulators[drive - numAxes] += currentDda->GetStepsTaken(drive);
 	}
+
+	// If we are probing the bed while moving, record the Z probe reading now that we have reached the grid point
+	const int scanPoint = currentDda->GetScanProbePoint();
+	if (scanPoint >= 0)
+	{
+		const size_t in = scanReadingsIn;
+		const size_t nextIn = (in + 1) % NumScanReadings;
+		if (nextIn == scanReadingsOut)
+		{
+			++scanReadingsLost;
+		}
+		else
+		{
+			scanReadings[in] = (uint32_t)scanPoint | ((uint32_t)reprap.GetPlatform().GetZProbeReading() << 16);
+			scanReadingsIn = nextIn;
+		}
+	}
+
+	completedMoveClocks += currentDda->GetClocksNeeded();
+
+#if SUPPORT_MOVE_TRACE
+	{
+		// The move start time includes the hiccups inserted during the move, so take them off to get the time it really started
+		MoveTraceRecord rec;
+		rec.startTime = currentDda->GetMoveStartTime() - traceCurrentMoveHiccups * DDA::HiccupTime;
+		rec.clocksNeeded = currentDda->GetClocksNeeded();
+		rec.startSpeed = (uint16_t)min<float>(currentDda->GetStartSpeed() * MoveTraceRecord::SpeedUnitsPerMmPerSec, 65535.0);
+		rec.topSpeed = (uint16_t)min<float>(currentDda->GetTopSpeed() * MoveTraceRecord::SpeedUnitsPerMmPerSec, 65535.0);
+		rec.endSpeed = (uint16_t)min<float>(currentDda->GetEndSpeed() * MoveTraceRecord::SpeedUnitsPerMmPerSec, 65535.0);
+		rec.numHiccups = (uint8_t)min<unsigned int>(traceCurrentMoveHiccups, 255);
+		rec.flags = ((traceCurrentMoveLate) ? MoveTraceRecord::FlagStartedLate : 0)
+				  | ((currentDda->HadLookaheadUnderrun()) ? MoveTraceRecord::FlagLookaheadUnderrun : 0)
+				  | ((currentDda->IsPrintingMove()) ? MoveTraceRecord::FlagPrintingMove : 0)
+				  | ((currentDda->IsNonPrintingExtruderMove()) ? MoveTraceRecord::FlagNonPrintingExtruderMove : 0);
+		MoveTrace::Record(rec);
+	}
+#endif
+
+	__DMB();										// make sure the live coordinates have been written before the main task can see that the move has completed
 	currentDda = nullptr;
 
 	getPointer = getPointer->GetNext();
 	completedMoves++;
 }
 
+// Get the total planned duration of all the moves completed since startup. The print monitor uses this to estimate the time left from the simulated print time.
+float DDARing::GetCompletedMoveTime() const
+{
+	const irqflags_t flags = cpu_irq_save();										// the ISR updates completedMoveClocks and it is too long to read atomically
+	const uint64_t clocks = completedMoveClocks;
+	cpu_irq_restore(flags);
+	return (float)clocks/(float)StepTimer::StepClockRate;
+}
+
+// Discard any Z probe readings recorded at the end of moves. Only called when the ring is idle.
+void DDARing::ClearScanReadings()
+{
+	scanReadingsOut = scanReadingsIn;
+	scanReadingsLost = 0;
+}
+
+// Fetch the next Z probe reading recorded at the end of a move, returning false if there are none
+bool DDARing::GetScanReading(unsigned int& point, int& reading)
+{
+	const size_t out = scanReadingsOut;
+	if (out == scanReadingsIn)
+	{
+		return false;
+	}
+	const uint32_t r = scanReadings[out];
+	scanReadingsOut = (out + 1) % NumScanReadings;
+	point = r & 0xFFFF;
+	reading = (int)(r >> 16);
+	return true;
+}
+
 int32_t DDARing::GetAccumulatedExtrusion(size_t extruder, size_t drive, bool& isPrinting)
 {
 	const uint32_t basepri = ChangeBasePriority(NvicPriorityStep);
@@ -472,7 +667,7 @@ float DDARing::GetRequestedSpeed() const
 bool DDARing::PauseMoves(RestorePoint& rp)
 {
 	// Find a move we can pause after.
-	// Ideally, we would adjust a move if necessary and possible so that we can pause after it, but for now we don't do that.
+	// Moves that have already been prepared can't be changed, but we adjust unprepared moves if necessary so that we can pause after them.
 	// There are a few possibilities:
 	// 1. There is no currently executing move and no moves in the queue, and GCodes does not have a move for us.
 	//    Pause immediately. Resume from the current file position.
@@ -499,6 +694,7 @@ bool DDARing::PauseMoves(RestorePoint& rp)
 
 	const DDA * const savedDdaRingAddPointer = addPointer;
 	bool pauseOkHere;
+	bool foundPausePoint = false;
 
 	cpu_irq_disable();
 	DDA *dda = currentDda;
@@ -513,12 +709,11 @@ bool DDARing::PauseMoves(RestorePoint& rp)
 		dda = dda->GetNext();
 	}
 
-	while (dda != savedDdaRingAddPointer)
+	while (dda != savedDdaRingAddPointer && dda->GetState() != DDA::provisional)
 	{
 		if (pauseOkHere)
 		{
-			// We can pause before executing this move
-			addPointer = dda;
+			foundPausePoint = true;						// we can pause before executing this move
 			break;
 		}
 		pauseOkHere = dda->CanPauseAfter();
@@ -527,6 +722,32 @@ bool DDARing::PauseMoves(RestorePoint& rp)
 
 	cpu_irq_enable();
 
+	// The step ISR doesn't touch provisional moves and we own the move mutex, so we can look at the rest of the ring with interrupts enabled
+	DDA * const firstProvisionalDda = dda;
+	while (!foundPausePoint && dda != savedDdaRingAddPointer)
+	{
+		if (pauseOkHere)
+		{
+			foundPausePoint = true;
+		}
+		else if (dda->IsPauseAllowedAfter() && DDA::PlanStopAfter(*this, firstProvisionalDda, dda))
+		{
+			dda = dda->GetNext();						// this move now ends at a standstill, so we can pause before the next one
+			++numEarlyPauses;
+			foundPausePoint = true;
+		}
+		else
+		{
+			pauseOkHere = dda->CanPauseAfter();
+			dda = dda->GetNext();
+		}
+	}
+
+	if (foundPausePoint)
+	{
+		addPointer = dda;
+	}
+
 	// We may be going to skip some moves. Get the end coordinate of the previous move.
 	DDA * const prevDda = addPointer->GetPrevious();
 	const size_t numVisibleAxes = reprap.GetGCodes().GetVisibleAxes();
@@ -569,6 +790,53 @@ bool DDARing::PauseMoves(RestorePoint& rp)
 	return true;
 }
 
+#if SUPPORT_RESUME_JOURNAL
+
+// Get the point that we would resume from if the power failed now, which is the start of the move that is executing, or of the next move if none is executing.
+// Fill in the restore point in the same way as PauseMoves does when it skips moves, returning false if there is no such move or it wasn't read from a file.
+// The caller must make sure that the Move task doesn't recycle any DDAs while we are looking at them.
+bool DDARing::GetResumePoint(RestorePoint& rp)
+{
+	DDA *dda = currentDda;						// capture volatile variable
+	if (dda == nullptr)
+	{
+		dda = getPointer;
+		if (dda == addPointer)
+		{
+			return false;								// the ring is empty
+		}
+	}
+
+	if (dda->GetFilePosition() == noFilePosition)
+	{
+		return false;
+	}
+
+	DDA * const prevDda = dda->GetPrevious();
+	const size_t numVisibleAxes = reprap.GetGCodes().GetVisibleAxes();
+	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+	{
+		rp.moveCoords[axis] = prevDda->GetEndCoordinate(axis, false);
+	}
+	reprap.GetMove().InverseAxisAndBedTransform(rp.moveCoords, prevDda->GetTool());
+
+#if SUPPORT_LASER || SUPPORT_IOBITS
+	rp.laserPwmOrIoBits = dda->GetLaserPwmOrIoBits();
+#endif
+	rp.proportionDone = dda->GetProportionDone(false);
+	rp.initialUserX = dda->GetInitialUserX();
+	rp.initialUserY = dda->GetInitialUserY();
+	if (dda->UsingStandardFeedrate())
+	{
+		rp.feedRate = dda->GetRequestedSpeed();
+	}
+	rp.virtualExtruderPosition = dda->GetVirtualExtruderPosition();
+	rp.filePos = dda->GetFilePosition();
+	return true;
+}
+
+#endif
+
 #if HAS_VOLTAGE_MONITOR || HAS_STALL_DETECT
 
 // Pause the print immediately, returning true if we were able to
@@ -658,9 +926,17 @@ bool DDARing::LowPowerOrStallPause(RestorePoint& rp)
 
 void DDARing::Diagnostics(MessageType mtype, const char *prefix)
 {
-	reprap.GetPlatform().MessageF(mtype, "=== %sDDARing ===\nScheduled moves: %" PRIu32 ", completed moves: %" PRIu32 ", StepErrors: %u, LaErrors: %u, Underruns: %u, %u\n",
-		prefix, scheduledMoves, completedMoves, stepErrors, numLookaheadErrors, numLookaheadUnderruns, numPrepareUnderruns);
-	stepErrors = numLookaheadUnderruns = numPrepareUnderruns = numLookaheadErrors = 0;
+	reprap.GetPlatform().MessageF(mtype, "=== %sDDARing ===\nScheduled moves: %" PRIu32 ", completed moves: %" PRIu32 ", StepErrors: %u, LaErrors: %u, Underruns: %u, %u, early pauses: %u\n",
+		prefix, scheduledMoves, completedMoves, stepErrors, numLookaheadErrors, numLookaheadUnderruns, numPrepareUnderruns, numEarlyPauses);
+	stepErrors = numLookaheadUnderruns = numPrepareUnderruns = numLookaheadErrors = numEarlyPauses = 0;
+	reprap.GetPlatform().MessageF(mtype, "Lookahead passes: %" PRIu32 ", moves recalculated per pass: %.2f, max %u\n",
+		numLookaheadPasses, (numLookaheadPasses == 0) ? 0.0 : (double)numLookaheadRecalcs/(double)numLookaheadPasses, maxLookaheadRecalcs);
+	numLookaheadPasses = numLookaheadRecalcs = 0;
+	maxLookaheadRecalcs = 0;
+	reprap.GetPlatform().MessageF(mtype, "Moves prepared: %" PRIu32 ", prepare time avg %.2fms max %.2fms, min slack %.1fms, prepared late %" PRIu32 "\n",
+		prepareStats.numMovesPrepared, (prepareStats.numMovesPrepared == 0) ? 0.0 : (double)(prepareStats.totalPrepareMillis/prepareStats.numMovesPrepared),
+		(double)prepareStats.maxPrepareMillis, (double)prepareStats.minSlackMillis, prepareStats.numPreparedLate);
+	prepareStats.Clear();
 }
 
 // End
@@ -15,37 +15,56 @@
 class DDARing
 {
 public:
+	// Statistics about how long moves take to prepare and how close to their start times they are prepared. The diagnostics report clears them.
+	struct PrepareStats
+	{
+		uint32_t numMovesPrepared;												// How many moves we prepared
+		uint32_t numPreparedLate;												// How many of them were prepared after the moves before them had finished
+		float totalPrepareMillis;												// The total time spent in DDA::Prepare
+		float maxPrepareMillis;													// The longest time that DDA::Prepare took
+		float minSlackMillis;													// The shortest time between finishing preparing a move and its start time
+
+		void Clear();
+	};
+
 	DDARing();
 
 	void Init1(unsigned int numDdas);
 	void Init2();
 	void Exit();
+	bool Extend(unsigned int numDdas);											// Increase the number of DDAs in the ring, returning true if successful
+	unsigned int GetNumDdas() const { return numDdasInRing; }
 
 	void RecycleDDAs();
 	bool CanAddMove() const;
 	bool AddStandardMove(GCodes::RawMove &nextMove, bool doMotorMapping) __attribute__ ((hot));	// Set up a new move, returning true if it represents real movement
-	bool AddSpecialMove(float feedRate, const float coords[]);
+	bool AddSpecialMove(float feedRate, const float coords[], EndstopsBitmap endstops = 0);
 
 	void Spin(uint8_t simulationMode, bool shouldStartMove);					// Try to process moves in the ring, returning true if the ring is idle
 	bool IsIdle() const;														// Return true if this DDA ring is idle
 
 	float PushBabyStepping(size_t axis, float amount);							// Try to push some babystepping through the lookahead queue, returning the amount pushed
 
-	void Interrupt(Platform& p);												// Check endstops, generate step pulses
+	void Interrupt(Platform& p) STEP_ISR_CODE;									// Check endstops, generate step pulses
 	void InsertHiccup(uint32_t delayClocks);									// Insert a brief pause to avoid processor overload
 	std::optional<uint32_t> GetNextInterruptTime() const;						// Return the time that the next step is due
-	void CurrentMoveCompleted() __attribute__ ((hot));							// Signal that the current move has just been completed
-	void TryStartNextMove(Platform& p, uint32_t startTime) __attribute__ ((hot));	// Try to start another move, returning true if Step() needs to be called immediately
+	void CurrentMoveCompleted() STEP_ISR_CODE;									// Signal that the current move has just been completed
+	void TryStartNextMove(Platform& p, uint32_t startTime) STEP_ISR_CODE;	// Try to start another move, returning true if Step() needs to be called immediately
 	uint32_t ExtruderPrintingSince() const { return extrudersPrintingSince; }	// When we started doing normal moves after the most recent extruder-only move
 	int32_t GetAccumulatedExtrusion(size_t extruder, size_t drive, bool& isPrinting);
 
 	uint32_t GetScheduledMoves() const { return scheduledMoves; }				// How many moves have been scheduled?
 	uint32_t GetCompletedMoves() const { return completedMoves; }				// How many moves have been completed?
 	void ResetMoveCounters() { scheduledMoves = completedMoves = 0; }
+	float GetCompletedMoveTime() const;											// Get the total planned duration of all the moves completed since startup, in seconds
 
 	float GetSimulationTime() const { return simulationTime; }
 	void ResetSimulationTime() { simulationTime = 0.0; }
 
+	void ClearScanReadings();													// Discard any Z probe readings we recorded while probing during moves
+	bool GetScanReading(unsigned int& point, int& reading);						// Fetch the next Z probe reading recorded at the end of a move, returning false if there are none
+	unsigned int GetNumLostScanReadings() const { return scanReadingsLost; }	// How many readings we discarded because the buffer was full
+
 #if HAS_SMART_DRIVERS
 	uint32_t GetStepInterval(size_t axis, uint32_t microstepShift) const;
 #endif
@@ -56,6 +75,7 @@ public:
 	float GetRequestedSpeed() const;
 
 	int32_t GetEndPoint(size_t drive) const { return liveEndPoints[drive]; } 	// Get the current position of a motor
+	const int32_t *GetLastQueuedEndPoints() const { return addPointer->GetPrevious()->DriveCoordinates(); }	// Get the motor positions at the end of the last queued move
 	void GetCurrentMachinePosition(float m[MaxAxes], bool disableMotorMapping) const; // Get the current position in untransformed coords
 	void SetPositions(const float move[MaxTotalDrivers]);						// Force the machine coordinates to be these
 	void AdjustMotorPositions(const float adjustment[], size_t numMotors);		// Perform motor endpoint adjustment
@@ -64,11 +84,17 @@ public:
 	void ResetExtruderPositions();												// Resets the extrusion amounts of the live coordinates
 
 	bool PauseMoves(RestorePoint& rp);											// Pause the print as soon as we can, returning true if we were able to skip any
+#if SUPPORT_RESUME_JOURNAL
+	bool GetResumePoint(RestorePoint& rp);										// Get the point that we would resume from if the power failed now, without changing the ring
+#endif
 #if HAS_VOLTAGE_MONITOR || HAS_STALL_DETECT
 	bool LowPowerOrStallPause(RestorePoint& rp);								// Pause the print immediately, returning true if we were able to
 #endif
 
-	void RecordLookaheadError() { ++numLookaheadErrors; }						// Record a lookahead error
+	void RecordLookaheadError() { if (recordingStatistics) { ++numLookaheadErrors; } }	// Record a lookahead error
+	void RecordLookahead(unsigned int numRecalculated);						// Record how many moves a lookahead pass recalculated
+	void SetRecordingStatistics(bool b) { recordingStatistics = b; }			// Enable or disable recording the lookahead statistics, e.g. while moves outside the ring are planned
+	const PrepareStats& GetPrepareStats() const { return prepareStats; }
 
 	void Diagnostics(MessageType mtype, const char *prefix);
 
@@ -87,13 +113,33 @@ private:
 
 	unsigned int numDdasInRing;
 
+	// Z probe readings recorded at the end of moves by the step ISR, for probing the bed while moving. Each one has the grid point index in the low 16 bits and the reading in the high 16 bits.
+	static constexpr size_t NumScanReadings = 16;
+	volatile uint32_t scanReadings[NumScanReadings];
+	volatile size_t scanReadingsIn;												// Only written by the ISR
+	volatile size_t scanReadingsOut;											// Only written by the main task
+	volatile unsigned int scanReadingsLost;
+
 	uint32_t scheduledMoves;													// Move counters for the code queue
 	volatile uint32_t completedMoves;											// This one is modified by an ISR, hence volatile
+	uint64_t completedMoveClocks;												// The total of clocksNeeded of all completed moves, modified by the ISR
 
 	unsigned int numLookaheadUnderruns;											// How many times we have run out of moves to adjust during lookahead
 	unsigned int numPrepareUnderruns;											// How many times we wanted a new move but there were only un-prepared moves in the queue
 	unsigned int numLookaheadErrors;											// How many times our lookahead algorithm failed
 	unsigned int stepErrors;													// count of step errors, for diagnostics
+	unsigned int numEarlyPauses;												// How many pauses made a queued move decelerate to a stop
+	uint32_t numLookaheadPasses;												// How many times we did lookahead since the last diagnostics report
+	uint32_t numLookaheadRecalcs;												// How many moves those lookahead passes recalculated
+	unsigned int maxLookaheadRecalcs;											// The most moves that one lookahead pass recalculated
+	PrepareStats prepareStats;
+	bool recordingStatistics;													// False while the step rate benchmark plans its moves against this ring
+
+#if SUPPORT_MOVE_TRACE
+	bool traceNextMoveLate;														// The ISR found the next move unprepared, so it will start late. Only used by the ISR.
+	bool traceCurrentMoveLate;													// The current move started late. Only used by the ISR.
+	unsigned int traceCurrentMoveHiccups;										// How many hiccups the ISR inserted during the current move. Only used by the ISR.
+#endif
 
 	float simulationTime;														// Print time since we started simulating
 	float extrusionPending[MaxExtruders];										// Extrusion not done due to rounding to nearest step
@@ -102,8 +148,21 @@ private:
 	volatile bool extrudersPrinting;											// Set whenever an extruder starts a printing move, cleared by a non-printing extruder move
 };
 
-// Start the next move. Return true if the
-// Must be called with base priority greater than or equal to the step interrupt, to avoid a race with the step ISR.
+inline void DDARing::RecordLookahead(unsigned int numRecalculated)
+{
+	if (!recordingStatistics)
+	{
+		return;
+	}
+	++numLookaheadPasses;
+	numLookaheadRecalcs += numRecalculated;
+	if (numRecalculated > maxLookaheadRecalcs)
+	{
+		maxLookaheadRecalcs = numRecalculated;
+	}
+}
+
+// Start the next move. Only called from the step ISR.
 inline void DDARing::StartNextMove(Platform& p, uint32_t startTime)
 pre(ddaRingGetPointer->GetState() == DDA::frozen)
 {
@@ -117,6 +176,11 @@ pre(ddaRingGetPointer->GetState() == DDA::frozen)
 		extrudersPrinting = true;
 		extrudersPrintingSince = millis();
 	}
+#if SUPPORT_MOVE_TRACE
+	traceCurrentMoveLate = traceNextMoveLate;
+	traceNextMoveLate = false;
+	traceCurrentMoveHiccups = 0;
+#endif
 	currentDda = cdda;
 	cdda->Start(p, startTime);
 }
@@ -12,24 +12,112 @@
 #include "RepRap.h"
 #include "Math/Isqrt.h"
 #include "Kinematics/LinearDeltaKinematics.h"
+#include "Tasks.h"
+
+#if SUPPORT_INPUT_SHAPING
+# include "MotionProfile.h"
+#endif
 
 // Static members
 
 DriveMovement *DriveMovement::freeList = nullptr;
 int DriveMovement::numFree = 0;
 int DriveMovement::minFree = 0;
+unsigned int DriveMovement::numAllocated = 0;
+unsigned int DriveMovement::maxAllocated = 0;
+unsigned int DriveMovement::highWater = 0;
+uint32_t DriveMovement::numAllocationFailures = 0;
+bool DriveMovement::inShortfall = false;
+
+#if DM_USE_STEP_TABLES
+uint32_t DriveMovement::stepTableUnderruns = 0;
+#endif
+
+#if USE_INCREMENTAL_SQRT
+
+// Return the integer square root of val, given a guess that is likely to be close to it.
+// Successive step times need square roots that differ only a little, so a linear correction using a 32-bit division followed by a few
+// adjustments gives exactly the same result as isqrt64, but much faster on processors that have a 32-bit hardware divide and no FPU.
+static inline uint32_t IncrementalSqrt(uint64_t val, uint32_t guess)
+{
+	if (guess != 0 && guess < 0x80000000)
+	{
+		const uint64_t guessSquared = isquare64(guess);
+		const bool tooLow = (val >= guessSquared);
+		const uint64_t diff = (tooLow) ? val - guessSquared : guessSquared - val;
+		if (diff <= 0xFFFFFFFF)
+		{
+			const uint32_t correction = (uint32_t)diff/(2 * guess);
+			uint32_t root = (tooLow) ? guess + correction : guess - correction;
+			for (unsigned int i = 0; i < 4; ++i)
+			{
+				if (isquare64(root) > val)
+				{
+					--root;
+				}
+				else if (isquare64(root + 1) <= val)
+				{
+					++root;
+				}
+				else
+				{
+					return root;
+				}
+			}
+		}
+	}
+	return isqrt64(val);								// no usable guess, or it was too far out
+}
+
+# define STEP_SQRT(_val, _guess)	IncrementalSqrt(_val, _guess)
+#else
+# define STEP_SQRT(_val, _guess)	isqrt64(_val)
+#endif
 
-void DriveMovement::InitialAllocate(unsigned int num)
+void DriveMovement::InitialAllocate(unsigned int num, unsigned int maxNum)
 {
 	while (num != 0)
 	{
 		freeList = new DriveMovement(freeList);
 		++numFree;
+		++numAllocated;
 		--num;
 	}
+	maxAllocated = max<unsigned int>(maxNum, numAllocated);
 	ResetMinFree();
 }
 
+// Make sure that at least 'num' DMs are free, allocating more up to the limit if necessary, and return true if they are.
+// This is called from the Move task before preparing a move, so that Allocate never needs to allocate memory and never fails.
+bool DriveMovement::Reserve(unsigned int num)
+{
+	while (numFree < (int)num)
+	{
+		if (numAllocated >= maxAllocated || Tasks::GetNeverUsedRam() < sizeof(DriveMovement) + MinRamToLeave)
+		{
+			// PrepareMoves calls us again on each pass until DMs are freed, so only count the first failure of each shortfall
+			if (!inShortfall)
+			{
+				++numAllocationFailures;
+				inShortfall = true;
+			}
+			return false;
+		}
+		freeList = new DriveMovement(freeList);
+		++numFree;
+		++numAllocated;
+	}
+	inShortfall = false;
+	return true;
+}
+
+/*static*/ uint32_t DriveMovement::GetAndClearAllocationFailures()
+{
+	const uint32_t ret = numAllocationFailures;
+	numAllocationFailures = 0;
+	return ret;
+}
+
 DriveMovement *DriveMovement::Allocate(size_t drive, DMState st)
 {
 	DriveMovement * const dm = freeList;
@@ -41,6 +129,10 @@ DriveMovement *DriveMovement::Allocate(size_t drive, DMState st)
 		{
 			minFree = numFree;
 		}
+		if (numAllocated - numFree > highWater)
+		{
+			highWater = numAllocated - numFree;
+		}
 		dm->nextDM = nullptr;
 		dm->drive = (uint8_t)drive;
 		dm->state = st;
@@ -50,14 +142,64 @@ DriveMovement *DriveMovement::Allocate(size_t drive, DMState st)
 
 // Constructors
 DriveMovement::DriveMovement(DriveMovement *next) : nextDM(next)
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	, isSmoothed(false)
+#endif
 {
 }
 
 // Non static members
 
+// Calculate the time since the start of the move at which the specified step is due, for a Cartesian or extruder move that has not yet reversed direction
+// previousStepTime is the time of an earlier step in the move, or zero if there isn't one. It is only used to speed up the square root.
+inline uint32_t DriveMovement::CalcNonReversedStepTime(const DDA &dda, uint32_t stepNumber, uint32_t previousStepTime) const
+pre(stepNumber < reverseStartStep)
+{
+#if SUPPORT_INPUT_SHAPING
+	if (isShaped)
+	{
+		return dda.shapedProfile->DistanceToTime((float)stepNumber * mp.shaped.mmPerStep, mp.shaped.advanceClocks);
+	}
+#endif
+
+	if (stepNumber < mp.cart.accelStopStep)
+	{
+		// acceleration phase
+		const uint32_t adjustedStartSpeedTimesCdivA = dda.afterPrepare.startSpeedTimesCdivA + mp.cart.compensationClocks;
+		return STEP_SQRT(isquare64(adjustedStartSpeedTimesCdivA) + (mp.cart.twoCsquaredTimesMmPerStepDivA * stepNumber), previousStepTime + adjustedStartSpeedTimesCdivA) - adjustedStartSpeedTimesCdivA;
+	}
+
+	if (stepNumber < mp.cart.decelStartStep)
+	{
+		// steady speed phase
+		return (uint32_t)(  (int32_t)(((uint64_t)mp.cart.mmPerStepTimesCKdivtopSpeed * stepNumber)/K1)
+						  + dda.afterPrepare.extraAccelerationClocks
+						  - (int32_t)mp.cart.accelCompensationClocks
+						 );
+	}
+
+	// deceleration phase
+	const uint64_t temp = mp.cart.twoCsquaredTimesMmPerStepDivD * stepNumber;
+	const uint32_t adjustedTopSpeedTimesCdivDPlusDecelStartClocks = dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - mp.cart.compensationClocks;
+	// Allow for possible rounding error when the end speed is zero or very small
+	return (temp < twoDistanceToStopTimesCsquaredDivD)
+			? adjustedTopSpeedTimesCdivDPlusDecelStartClocks
+				- STEP_SQRT(twoDistanceToStopTimesCsquaredDivD - temp,
+							(previousStepTime < adjustedTopSpeedTimesCdivDPlusDecelStartClocks) ? adjustedTopSpeedTimesCdivDPlusDecelStartClocks - previousStepTime : 0)
+			: adjustedTopSpeedTimesCdivDPlusDecelStartClocks;
+}
+
 // Prepare this DM for a Cartesian axis move, returning true if there are steps to do
 bool DriveMovement::PrepareCartesianAxis(const DDA& dda, const PrepParams& params)
 {
+#if SUPPORT_INPUT_SHAPING
+	if (dda.shapedProfile != nullptr)
+	{
+		return PrepareShapedDrive(dda, dda.totalDistance/(float)totalSteps, 0.0);
+	}
+	isShaped = false;
+#endif
+
 	const float stepsPerMm = (float)totalSteps/dda.totalDistance;
 	mp.cart.twoCsquaredTimesMmPerStepDivA = roundU64((double)(StepTimer::StepClockRateSquared * 2)/((double)stepsPerMm * (double)dda.acceleration));
 	mp.cart.twoCsquaredTimesMmPerStepDivD = roundU64((double)(StepTimer::StepClockRateSquared * 2)/((double)stepsPerMm * (double)dda.deceleration));
@@ -92,9 +234,57 @@ bool DriveMovement::PrepareCartesianAxis(const DDA& dda, const PrepParams& param
 	stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
 	stepsTillRecalc = 0;							// so that we don't skip the calculation
 	isDelta = false;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	isStreamed = false;
+#endif
+
+#if DM_USE_STEP_TABLES
+	// Homing and probing moves may have their speed changed part way through, so don't precompute their step times
+	usesStepTable = !dda.flags.usesEndstops;
+	if (usesStepTable)
+	{
+		tableGetIndex = tableAddIndex = 0;
+		FillStepTable(dda, false);
+	}
+#endif
+
 	return CalcNextStepTimeCartesian(dda, false);
 }
 
+#if SUPPORT_INPUT_SHAPING
+
+// Prepare this DM for a Cartesian axis or extruder that follows the input-shaped motion profile of the DDA, returning true if there are steps to do.
+// On entry, totalSteps and direction have been set up. The step times never need to reverse direction, so there is no reverse phase.
+bool DriveMovement::PrepareShapedDrive(const DDA& dda, float mmPerStep, float advanceClocks)
+{
+	mp.shaped.mmPerStep = mmPerStep;
+	mp.shaped.advanceClocks = advanceClocks;
+	reverseStartStep = totalSteps + 1;
+	twoDistanceToStopTimesCsquaredDivD = 0;
+
+	// Prepare for the first step
+	nextStep = 0;
+	nextStepTime = 0;
+	stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
+	stepsTillRecalc = 0;							// so that we don't skip the calculation
+	isDelta = false;
+	isShaped = true;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	isStreamed = false;
+#endif
+
+#if DM_USE_STEP_TABLES
+	// We never shape homing or probing moves, so the speed won't change part way through and we can precompute the step times
+	usesStepTable = true;
+	tableGetIndex = tableAddIndex = 0;
+	FillStepTable(dda, false);
+#endif
+
+	return CalcNextStepTimeCartesian(dda, false);
+}
+
+#endif
+
 // Prepare this DM for a Delta axis move, returning true if there are steps to do
 bool DriveMovement::PrepareDeltaAxis(const DDA& dda, const PrepParams& params)
 {
@@ -109,6 +299,12 @@ bool DriveMovement::PrepareDeltaAxis(const DDA& dda, const PrepParams& params)
 	mp.delta.dSquaredMinusAsquaredMinusBsquaredTimesKsquaredSsquared = roundS64(dSquaredMinusAsquaredMinusBsquared * fsquare(stepsPerMm * DriveMovement::K2));
 	mp.delta.twoCsquaredTimesMmPerStepDivA = roundU64((double)(2 * StepTimer::StepClockRateSquared)/((double)stepsPerMm * (double)dda.acceleration));
 	mp.delta.twoCsquaredTimesMmPerStepDivD = roundU64((double)(2 * StepTimer::StepClockRateSquared)/((double)stepsPerMm * (double)dda.deceleration));
+#if USE_INCREMENTAL_SQRT
+	mp.delta.lastT2 = 0;								// no guess available for the first square root
+#endif
+#if SUPPORT_INPUT_SHAPING
+	mp.delta.mmPerDsK = 1.0/(stepsPerMm * DriveMovement::K2);
+#endif
 
 	// Calculate the distance at which we need to reverse direction.
 	if (params.a2plusb2 <= 0.0)
@@ -183,9 +379,85 @@ bool DriveMovement::PrepareDeltaAxis(const DDA& dda, const PrepParams& params)
 	stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
 	stepsTillRecalc = 0;							// so that we don't skip the calculation
 	isDelta = true;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	isStreamed = false;
+#endif
+#if DM_USE_STEP_TABLES
+	usesStepTable = false;
+#endif
 	return CalcNextStepTimeDelta(dda, false);
 }
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+
+// Return the distance along a streamed move at which the specified sub-segment ends
+/*static*/ inline float DriveMovement::StreamedSubSegmentEndDistance(const DDA &dda, size_t subSegment)
+{
+	return (subSegment + 1 < dda.numStreamedSubSegments) ? dda.streamedKnotFractions[subSegment] * dda.totalDistance : dda.totalDistance;
+}
+
+// Prepare this DM for an axis move that we stream without segmentation because of the kinematics or mesh compensation, returning true if there are steps to do.
+// subSegmentSteps[] holds the number of motor steps in each sub-segment calculated by the kinematics when the move was added to the queue.
+// netSteps is the net movement of the motor, which may differ slightly from the total of those if babystepping has been applied since.
+bool DriveMovement::PrepareStreamedAxis(const DDA& dda, const PrepParams& params, const int16_t subSegmentSteps[], int32_t netSteps)
+pre(dda.numStreamedSubSegments != 0)
+{
+	const size_t numSubSegments = dda.numStreamedSubSegments;
+	for (size_t i = 0; i < numSubSegments; ++i)
+	{
+		mp.streamed.subSegmentSteps[i] = subSegmentSteps[i];
+		netSteps -= subSegmentSteps[i];
+	}
+	mp.streamed.subSegmentSteps[numSubSegments - 1] = (int16_t)constrain<int32_t>(mp.streamed.subSegmentSteps[numSubSegments - 1] + netSteps, INT16_MIN, INT16_MAX);
+
+	totalSteps = 0;
+	for (size_t i = 0; i < numSubSegments; ++i)
+	{
+		totalSteps += labs(mp.streamed.subSegmentSteps[i]);
+	}
+	if (totalSteps == 0)
+	{
+		return false;
+	}
+
+	mp.streamed.accelStopDistance = params.accelDistance;
+	mp.streamed.decelStartDistance = params.decelStartDistance;
+	mp.streamed.numSubSegments = (uint8_t)numSubSegments;
+
+	// Set up the first sub-segment that has any steps in it
+	size_t firstSubSegment = 0;
+	while (mp.streamed.subSegmentSteps[firstSubSegment] == 0)
+	{
+		++firstSubSegment;
+	}
+	const int32_t firstSteps = mp.streamed.subSegmentSteps[firstSubSegment];
+	mp.streamed.subSegment = (uint8_t)firstSubSegment;
+	mp.streamed.subSegmentStartDistance = (firstSubSegment == 0) ? 0.0 : StreamedSubSegmentEndDistance(dda, firstSubSegment - 1);
+	mp.streamed.subSegmentStartStep = 0;
+	mp.streamed.subSegmentEndStep = labs(firstSteps);
+	mp.streamed.mmPerStep = (StreamedSubSegmentEndDistance(dda, firstSubSegment) - mp.streamed.subSegmentStartDistance)/(float)labs(firstSteps);
+	mp.streamed.netStepsBeforeSubSegment = 0;
+	direction = (firstSteps > 0);
+
+	// We handle direction changes at sub-segment boundaries ourselves, so there is no reverse phase
+	reverseStartStep = totalSteps + 1;
+	twoDistanceToStopTimesCsquaredDivD = 0;
+
+	// Prepare for the first step
+	nextStep = 0;
+	nextStepTime = 0;
+	stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
+	stepsTillRecalc = 0;							// so that we don't skip the calculation
+	isDelta = true;									// so that DDA::StepDrivers calls CalcNextStepTimeDelta
+	isStreamed = true;
+#if DM_USE_STEP_TABLES
+	usesStepTable = false;
+#endif
+	return CalcNextStepTimeDelta(dda, false);
+}
+
+#endif
+
 // Prepare this DM for an extruder move, returning true if there are steps to do
 bool DriveMovement::PrepareExtruder(const DDA& dda, const PrepParams& params, float& extrusionPending, float speedChange, bool doCompensation)
 {
@@ -216,6 +488,45 @@ bool DriveMovement::PrepareExtruder(const DDA& dda, const PrepParams& params, fl
 	const float rawStepsPerMm = reprap.GetPlatform().DriveStepsPerUnit(drive);
 	const float effectiveStepsPerMm = fabsf(dv) * rawStepsPerMm;
 
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	if (doCompensation && direction)
+	{
+		// If the pressure advance is smoothed then the extruder follows its own profile, which also follows the input-shaped profile if there is one.
+		// If we can't build the profile then we fall back to unsmoothed pressure advance.
+		const float advanceTime = reprap.GetPlatform().GetPressureAdvance(extruder);
+		const float smoothingTime = reprap.GetPlatform().GetPressureAdvanceSmoothing(extruder);
+		if (advanceTime > 0.0 && smoothingTime > 0.0)
+		{
+			MotionProfile * const profile = BuildSmoothedAdvanceProfile(dda, extrusionRequired,
+																		advanceTime * (float)StepTimer::StepClockRate, smoothingTime * (float)StepTimer::StepClockRate);
+			if (profile != nullptr)
+			{
+				return PrepareSmoothedExtruder(dda, profile, extrusionPending, rawStepsPerMm);
+			}
+		}
+	}
+#endif
+
+#if SUPPORT_INPUT_SHAPING
+	if (dda.shapedProfile != nullptr)
+	{
+		// The extruder follows the shaped profile, with the pressure advance based on the shaped speed. InputShaper::ShapeMove only shapes the move
+		// if the advanced extrusion never goes backwards, so the check below only fails if smoothed pressure advance couldn't get a profile.
+		// In that case we use the trapezoidal profile below, which handles the reverse phase.
+		const float advanceTime = (doCompensation && direction) ? reprap.GetPlatform().GetPressureAdvance(extruder) : 0.0;
+		const float advanceClocks = advanceTime * (float)StepTimer::StepClockRate;
+		if (advanceClocks == 0.0 || dda.shapedProfile->IsAdvanceMonotonic(advanceClocks))
+		{
+			extrusionRequired += (dda.endSpeed - dda.startSpeed) * advanceTime * dv;
+			const int32_t netSteps = (int32_t)(extrusionRequired * rawStepsPerMm);
+			extrusionPending = extrusionRequired - (float)netSteps/rawStepsPerMm;
+			totalSteps = labs(netSteps);
+			return PrepareShapedDrive(dda, 1.0/effectiveStepsPerMm, advanceClocks);
+		}
+	}
+	isShaped = false;
+#endif
+
 	float compensationTime;
 	float accelCompensationDistance;
 
@@ -312,9 +623,375 @@ bool DriveMovement::PrepareExtruder(const DDA& dda, const PrepParams& params, fl
 	stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
 	stepsTillRecalc = 0;							// so that we don't skip the calculation
 	isDelta = false;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	isStreamed = false;
+#endif
+#if DM_USE_STEP_TABLES
+	usesStepTable = false;							// extruder moves may reverse, so they always use the ISR calculation
+#endif
+	return CalcNextStepTimeCartesian(dda, false);
+}
+
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+
+// Apply a time offset, an extrusion offset and an extrusion factor to a motion segment
+static inline void TransformSegment(MotionSegment& seg, float clocksOffset, float extrusionOffset, float extrusionPerMm)
+{
+	seg.startClocks += clocksOffset;
+	seg.startDistance = extrusionOffset + seg.startDistance * extrusionPerMm;
+	seg.startSpeed *= extrusionPerMm;
+	seg.acceleration *= extrusionPerMm;
+	seg.jerk *= extrusionPerMm;
+}
+
+// Return the index of the last segment that starts at or before the specified time, searching forwards from 'from'
+static inline size_t FindSegment(const MotionSegment segs[], size_t from, size_t numSegs, float clocks)
+{
+	while (from + 1 < numSegs && segs[from + 1].startClocks <= clocks)
+	{
+		++from;
+	}
+	return from;
+}
+
+// Insert a time into a sorted list of breakpoints, unless it is outside the move or within half a clock of an existing one
+static void InsertBreakpoint(float breakpoints[], size_t& numBreakpoints, float t)
+{
+	size_t j = numBreakpoints;
+	while (j != 0 && breakpoints[j - 1] > t)
+	{
+		--j;
+	}
+	if (j != 0 && j != numBreakpoints && t - breakpoints[j - 1] >= 0.5 && breakpoints[j] - t >= 0.5)
+	{
+		memmove(breakpoints + j + 1, breakpoints + j, (numBreakpoints - j) * sizeof(breakpoints[0]));
+		breakpoints[j] = t;
+		++numBreakpoints;
+	}
+}
+
+// Build the profile of extruder position against time for a move that uses smoothed pressure advance, or return nullptr if we can't.
+// Unsmoothed pressure advance moves the extruder to e(t) + k * de/dt where e(t) is the commanded extrusion, so the extruder speed jumps whenever the acceleration changes.
+// Instead we move it to e(t) + (k/w) * (e(t) - e(t - w)), which applies the advance to the extrusion speed averaged over the previous w seconds.
+// The moves before this one are still in the ring, so the average carries across move boundaries and the extruder never has to jump.
+// If the previous move has already completed and been recycled, DDA::Free kept its motion, including any shaped profile, until this move is prepared.
+// Extrusion in moves that don't use pressure advance counts as none. The profile is in mm of extrusion, but it may go backwards.
+MotionProfile *DriveMovement::BuildSmoothedAdvanceProfile(const DDA& dda, float extrusionRequired, float advanceClocks, float smoothingClocks) const
+{
+	// Collect the commanded extrusion during this move and during the smoothing time before it, with times relative to the start of this move.
+	// We fill the array from the end backwards, keeping one entry spare at the start in case we need to extrapolate.
+	constexpr size_t MaxHistorySegments = 40;
+	constexpr unsigned int MaxHistoryMoves = 8;
+	MotionSegment history[MaxHistorySegments];
+
+	const size_t numThisMove = dda.GetMotionSegments(history, MaxHistorySegments - 1);
+	if (numThisMove == 0)
+	{
+		return nullptr;
+	}
+	const float moveClocks = (float)dda.clocksNeeded;
+	const float moveDistance = history[numThisMove - 1].DistanceAt(moveClocks);
+	if (moveDistance <= 0.0)
+	{
+		return nullptr;
+	}
+	size_t first = MaxHistorySegments - numThisMove;
+	memmove(history + first, history, numThisMove * sizeof(history[0]));
+	for (size_t i = first; i < MaxHistorySegments; ++i)
+	{
+		TransformSegment(history[i], 0.0, 0.0, extrusionRequired/moveDistance);		// scale the extrusion so that it adds up to exactly what is required
+	}
+
+	float historyStartClocks = 0.0, historyStartExtrusion = 0.0;
+	const DDA *prevDda = &dda;
+	for (unsigned int numMoves = 0; historyStartClocks > -smoothingClocks && numMoves < MaxHistoryMoves; ++numMoves)
+	{
+		prevDda = prevDda->prev;
+		if (   prevDda == nullptr || prevDda == &dda
+			|| (   prevDda->state != DDA::frozen && prevDda->state != DDA::executing && prevDda->state != DDA::completed
+				&& !(prevDda->state == DDA::empty && prevDda->flags.keptForHistory)
+			   )
+		   )
+		{
+			break;
+		}
+		const size_t num = prevDda->GetMotionSegments(history, first - 1);
+		if (num == 0)
+		{
+			break;
+		}
+		const float prevClocks = (float)prevDda->clocksNeeded;
+		const float extrusionPerMm = (prevDda->flags.usePressureAdvance) ? prevDda->directionVector[drive] : 0.0;
+		const float prevStartExtrusion = historyStartExtrusion - history[num - 1].DistanceAt(prevClocks) * extrusionPerMm;
+		first -= num;
+		memmove(history + first, history, num * sizeof(history[0]));
+		for (size_t i = first; i < first + num; ++i)
+		{
+			TransformSegment(history[i], historyStartClocks - prevClocks, prevStartExtrusion, extrusionPerMm);
+		}
+		historyStartClocks -= prevClocks;
+		historyStartExtrusion = prevStartExtrusion;
+	}
+
+	if (history[first].startClocks > -smoothingClocks)
+	{
+		// We don't know what happened before, so assume that the extrusion had been going at the speed at which the history starts
+		const MotionSegment& earliest = history[first];
+		MotionSegment& extrapolated = history[first - 1];
+		extrapolated.startClocks = -smoothingClocks;
+		extrapolated.startDistance = earliest.startDistance - earliest.startSpeed * (earliest.startClocks + smoothingClocks);
+		extrapolated.startSpeed = earliest.startSpeed;
+		extrapolated.acceleration = 0.0;
+		extrapolated.jerk = 0.0;
+		--first;
+	}
+
+	// The jerk of the advanced extrusion can only change when the current time or the time one smoothing period ago crosses a history segment boundary
+	float breakpoints[2 * MaxHistorySegments + 2];
+	breakpoints[0] = 0.0;
+	breakpoints[1] = moveClocks;
+	size_t numBreakpoints = 2;
+	for (size_t i = first; i < MaxHistorySegments; ++i)
+	{
+		InsertBreakpoint(breakpoints, numBreakpoints, history[i].startClocks);
+		InsertBreakpoint(breakpoints, numBreakpoints, history[i].startClocks + smoothingClocks);
+	}
+
+	MotionProfile * const profile = MotionProfile::Allocate();
+	if (profile == nullptr)
+	{
+		return nullptr;
+	}
+
+	// Build the profile relative to the advance at the start of the move, which is also the advance at the end of the previous move
+	const float ratio = advanceClocks/smoothingClocks;
+	size_t current = first;
+	size_t delayed = FindSegment(history, first, MaxHistorySegments, -smoothingClocks);
+	const float initialAdvance = -ratio * history[delayed].DistanceAt(-smoothingClocks);
+	for (size_t m = 0; m + 1 < numBreakpoints; ++m)
+	{
+		const float t0 = breakpoints[m];
+		const float t1 = breakpoints[m + 1];
+		const float midTime = 0.5 * (t0 + t1);
+		current = FindSegment(history, current, MaxHistorySegments, midTime);
+		delayed = FindSegment(history, delayed, MaxHistorySegments, midTime - smoothingClocks);
+		const MotionSegment& cs = history[current];
+		const MotionSegment& ds = history[delayed];
+		MotionSegment seg;
+		seg.startClocks = t0;
+		seg.startDistance = cs.DistanceAt(t0) * (1.0 + ratio) - ds.DistanceAt(t0 - smoothingClocks) * ratio - initialAdvance;
+		seg.startSpeed = cs.SpeedAt(t0) * (1.0 + ratio) - ds.SpeedAt(t0 - smoothingClocks) * ratio;
+		seg.acceleration = cs.AccelerationAt(t0) * (1.0 + ratio) - ds.AccelerationAt(t0 - smoothingClocks) * ratio;
+		seg.jerk = cs.jerk * (1.0 + ratio) - ds.jerk * ratio;
+		bool ok = profile->AddSegment(seg);
+
+		// If the extruder reverses during this interval then start a new segment there, so that the extruder only goes one way during each segment.
+		// The speed is quadratic in time, so it may reverse twice.
+		const float length = t1 - t0;
+		const float v = seg.startSpeed, a = seg.acceleration, j = seg.jerk;
+		float reverseTimes[2];
+		size_t numReversals = 0;
+		if (j == 0.0)
+		{
+			if (a != 0.0)
+			{
+				reverseTimes[numReversals++] = -v/a;
+			}
+		}
+		else
+		{
+			const float discriminant = fsquare(a) - 2 * j * v;
+			if (discriminant > 0.0)
+			{
+				const float root = sqrtf(discriminant);
+				const float r1 = (-a - root)/j, r2 = (-a + root)/j;
+				reverseTimes[numReversals++] = min<float>(r1, r2);
+				reverseTimes[numReversals++] = max<float>(r1, r2);
+			}
+		}
+		for (size_t i = 0; ok && i < numReversals; ++i)
+		{
+			if (reverseTimes[i] > 0.0 && reverseTimes[i] < length)
+			{
+				const float reverseClocks = t0 + reverseTimes[i];
+				ok = profile->AddSegment(reverseClocks, seg.DistanceAt(reverseClocks), 0.0, seg.AccelerationAt(reverseClocks), j);
+			}
+		}
+
+		if (!ok)
+		{
+			MotionProfile::Release(profile);
+			return nullptr;
+		}
+	}
+
+	profile->SetDuration(dda.clocksNeeded);
+	if (reprap.Debug(moduleMove))
+	{
+		profile->DebugPrint();
+	}
+	return profile;
+}
+
+// Prepare this DM to follow a smoothed pressure advance profile, returning true if there are steps to do. The DM takes ownership of the profile.
+bool DriveMovement::PrepareSmoothedExtruder(const DDA& dda, MotionProfile *profile, float& extrusionPending, float stepsPerMm)
+{
+	// The drive position is always floor(extrusion * stepsPerMm), so we step forwards when the extrusion reaches a whole number of steps and backwards when it drops below one.
+	// Count the steps in the same way that CalcNextStepTimeSmoothedFull takes them.
+	int32_t position = 0;
+	uint32_t steps = 0;
+	const size_t numSegments = profile->GetNumSegments();
+	for (size_t seg = 0; seg < numSegments; ++seg)
+	{
+		const int32_t endPosition = (int32_t)floorf(profile->GetSegmentEndDistance(seg) * stepsPerMm);
+		if ((profile->IsSegmentRising(seg)) ? endPosition > position : endPosition < position)
+		{
+			steps += (uint32_t)labs(endPosition - position);
+			position = endPosition;
+		}
+	}
+	extrusionPending = profile->GetSegmentEndDistance(numSegments - 1) - (float)position/stepsPerMm;
+
+	mp.smoothed.profile = profile;
+	mp.smoothed.stepsPerMm = stepsPerMm;
+	mp.smoothed.position = 0;
+	mp.smoothed.netSteps = position;
+	mp.smoothed.segment = 0;
+	totalSteps = steps;
+	reverseStartStep = totalSteps + 1;
+	twoDistanceToStopTimesCsquaredDivD = 0;
+
+	// Prepare for the first step
+	nextStep = 0;
+	nextStepTime = 0;
+	stepInterval = 999999;
+	stepsTillRecalc = 0;
+	isDelta = false;
+	isSmoothed = true;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	isStreamed = false;
+#endif
+#if SUPPORT_INPUT_SHAPING
+	isShaped = false;
+#endif
+#if DM_USE_STEP_TABLES
+	usesStepTable = false;							// we need to change direction part way through, so we calculate the steps in the ISR
+#endif
 	return CalcNextStepTimeCartesian(dda, false);
 }
 
+// Calculate the time of the next step for an extruder with smoothed pressure advance, which may change direction at any segment boundary of the profile.
+// We always single step, because extruders don't usually step fast enough to need anything else.
+bool DriveMovement::CalcNextStepTimeSmoothedFull(const DDA &dda, bool live)
+pre(nextStep <= totalSteps; stepsTillRecalc == 0)
+{
+	const MotionProfile& profile = *mp.smoothed.profile;
+	const float stepsPerMm = mp.smoothed.stepsPerMm;
+	for (;;)
+	{
+		const size_t seg = mp.smoothed.segment;
+		const bool rising = profile.IsSegmentRising(seg);
+		const int32_t endPosition = (int32_t)floorf(profile.GetSegmentEndDistance(seg) * stepsPerMm);
+		if ((rising) ? endPosition > mp.smoothed.position : endPosition < mp.smoothed.position)
+		{
+			// The next step is in this segment
+			if (rising != (bool)direction)
+			{
+				direction = rising;
+				if (live)
+				{
+					reprap.GetPlatform().SetDirection(drive, direction);
+				}
+			}
+			const int32_t threshold = (rising) ? mp.smoothed.position + 1 : mp.smoothed.position;
+			mp.smoothed.position += (rising) ? 1 : -1;
+			const uint32_t nextCalcStepTime = roundU32(profile.SolveInSegment(seg, (float)threshold/stepsPerMm, rising));
+			if (nextCalcStepTime > nextStepTime)
+			{
+				stepInterval = nextCalcStepTime - nextStepTime;
+				nextStepTime = nextCalcStepTime;
+			}
+			else
+			{
+				stepInterval = 0;					// rounding error has made this step appear to be due before the last one
+			}
+			return true;
+		}
+
+		if (seg + 1 >= profile.GetNumSegments())
+		{
+			// We counted the steps in the same way when we prepared the move, so this should never happen
+			state = DMState::stepError;
+			stepInterval = 20000000 + nextStepTime;	// so we can tell what happened in the debug print
+			return false;
+		}
+		mp.smoothed.segment = seg + 1;
+	}
+}
+
+#endif
+
+#if DM_USE_STEP_TABLES
+
+// Precompute the times of the next few steps of a Cartesian axis move and store them in the step table.
+// If 'live' is true then the move may be executing, so the step ISR may take entries from the table or overtake us while we are calculating.
+// We never shut out the step ISR. If it overtakes us, it discards the entries for the steps it has passed.
+void DriveMovement::FillStepTable(const DDA& dda, bool live)
+{
+	// The step ISR won't look in the table for any step up to this one, so there is no point in calculating them.
+	// Read nextStep before stepsTillRecalc so that if the ISR changes them while we read them, we underestimate rather than overestimate.
+	uint32_t lastStepNotNeeded = 0;
+	if (live)
+	{
+		lastStepNotNeeded = nextStep;
+		lastStepNotNeeded += stepsTillRecalc;
+	}
+
+	uint32_t addIndex = tableAddIndex;						// only we change this
+	uint32_t lastStepTime = 0;
+	for (;;)
+	{
+		const uint32_t stepNumber = addIndex + 1;
+		if (stepNumber > totalSteps || addIndex - tableGetIndex >= StepTableSize)
+		{
+			break;
+		}
+
+		uint32_t stepTime;
+		if (stepNumber <= lastStepNotNeeded)
+		{
+			stepTime = NoStepTime;							// the ISR has already calculated this step
+		}
+		else
+		{
+			stepTime = CalcNonReversedStepTime(dda, stepNumber, lastStepTime);
+			lastStepTime = stepTime;
+			if (stepTime > dda.clocksNeeded)
+			{
+				if (stepNumber + 1 < totalSteps)
+				{
+					break;									// leave it to the ISR to calculate this step and record the step error
+				}
+				stepTime = dda.clocksNeeded;				// the last step is often late due to rounding error, so bring it forward
+			}
+		}
+
+		stepTable[addIndex & (StepTableSize - 1)] = stepTime;
+		++addIndex;
+		__DMB();											// make sure that the entry has been written before the ISR can see it
+		tableAddIndex = addIndex;
+	}
+}
+
+/*static*/ uint32_t DriveMovement::GetAndClearStepTableUnderruns()
+{
+	const uint32_t ret = stepTableUnderruns;
+	stepTableUnderruns = 0;
+	return ret;
+}
+
+#endif
+
 void DriveMovement::DebugPrint() const
 {
 	const size_t totalAxes = reprap.GetGCodes().GetTotalAxes();
@@ -326,6 +1003,30 @@ void DriveMovement::DebugPrint() const
 					c, (state == DMState::stepError) ? " ERR:" : ":", (direction) ? 'F' : 'B', totalSteps, nextStep, reverseStartStep, stepInterval,
 					twoDistanceToStopTimesCsquaredDivD);
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+		if (isStreamed)
+		{
+			debugPrintf("subseg=%u/%u start=%" PRIu32 " end=%" PRIu32 " net=%" PRIi32 " asd=%.2f dsd=%.2f mmps=%.5f\n",
+						mp.streamed.subSegment, mp.streamed.numSubSegments, mp.streamed.subSegmentStartStep, mp.streamed.subSegmentEndStep,
+						mp.streamed.netStepsBeforeSubSegment, (double)mp.streamed.accelStopDistance, (double)mp.streamed.decelStartDistance, (double)mp.streamed.mmPerStep);
+		}
+		else
+#endif
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+		if (isSmoothed)
+		{
+			debugPrintf("smoothed pos=%" PRIi32 " net=%" PRIi32 " seg=%" PRIu32 "\n", mp.smoothed.position, mp.smoothed.netSteps, mp.smoothed.segment);
+			mp.smoothed.profile->DebugPrint();
+		}
+		else
+#endif
+#if SUPPORT_INPUT_SHAPING
+		if (isShaped && !isDelta)
+		{
+			debugPrintf("shaped mmps=%.5f pa=%.1f\n", (double)mp.shaped.mmPerStep, (double)mp.shaped.advanceClocks);
+		}
+		else
+#endif
 		if (isDelta)
 		{
 			debugPrintf("hmz0sK=%" PRIi32 " minusAaPlusBbTimesKs=%" PRIi32 " dSquaredMinusAsquaredMinusBsquared=%" PRId64 "\n"
@@ -355,6 +1056,13 @@ void DriveMovement::DebugPrint() const
 bool DriveMovement::CalcNextStepTimeCartesianFull(const DDA &dda, bool live)
 pre(nextStep < totalSteps; stepsTillRecalc == 0)
 {
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	if (isSmoothed)
+	{
+		return CalcNextStepTimeSmoothedFull(dda, live);
+	}
+#endif
+
 	// Work out how many steps to calculate at a time.
 	// The last step before reverseStartStep must be single stepped to make sure that we don't reverse the direction too soon.
 	uint32_t shiftFactor = 0;		// assume single stepping
@@ -382,29 +1090,10 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 
 	const uint32_t nextCalcStep = nextStep + stepsTillRecalc;
 	uint32_t nextCalcStepTime;
-	if (nextCalcStep < mp.cart.accelStopStep)
+	if (nextCalcStep < reverseStartStep)
 	{
-		// acceleration phase
-		const uint32_t adjustedStartSpeedTimesCdivA = dda.afterPrepare.startSpeedTimesCdivA + mp.cart.compensationClocks;
-		nextCalcStepTime = isqrt64(isquare64(adjustedStartSpeedTimesCdivA) + (mp.cart.twoCsquaredTimesMmPerStepDivA * nextCalcStep)) - adjustedStartSpeedTimesCdivA;
-	}
-	else if (nextCalcStep < mp.cart.decelStartStep)
-	{
-		// steady speed phase
-		nextCalcStepTime = (uint32_t)(  (int32_t)(((uint64_t)mp.cart.mmPerStepTimesCKdivtopSpeed * nextCalcStep)/K1)
-								  + dda.afterPrepare.extraAccelerationClocks
-								  - (int32_t)mp.cart.accelCompensationClocks
-								 );
-	}
-	else if (nextCalcStep < reverseStartStep)
-	{
-		// deceleration phase, not reversed yet
-		const uint64_t temp = mp.cart.twoCsquaredTimesMmPerStepDivD * nextCalcStep;
-		const uint32_t adjustedTopSpeedTimesCdivDPlusDecelStartClocks = dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - mp.cart.compensationClocks;
-		// Allow for possible rounding error when the end speed is zero or very small
-		nextCalcStepTime = (temp < twoDistanceToStopTimesCsquaredDivD)
-						? adjustedTopSpeedTimesCdivDPlusDecelStartClocks - isqrt64(twoDistanceToStopTimesCsquaredDivD - temp)
-						: adjustedTopSpeedTimesCdivDPlusDecelStartClocks;
+		// acceleration, steady speed or deceleration phase, not reversed yet
+		nextCalcStepTime = CalcNonReversedStepTime(dda, nextCalcStep, nextStepTime);
 	}
 	else
 	{
@@ -419,7 +1108,8 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 		}
 		const uint32_t adjustedTopSpeedTimesCdivDPlusDecelStartClocks = dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - mp.cart.compensationClocks;
 		nextCalcStepTime = adjustedTopSpeedTimesCdivDPlusDecelStartClocks
-							+ isqrt64((int64_t)(mp.cart.twoCsquaredTimesMmPerStepDivD * nextCalcStep) - mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD);
+							+ STEP_SQRT((int64_t)(mp.cart.twoCsquaredTimesMmPerStepDivD * nextCalcStep) - mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD,
+										(nextStepTime > adjustedTopSpeedTimesCdivDPlusDecelStartClocks) ? nextStepTime - adjustedTopSpeedTimesCdivDPlusDecelStartClocks : 0);
 	}
 
 	// When crossing between movement phases with high microstepping, due to rounding errors the next step may appear to be due before the last one
@@ -450,6 +1140,14 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 			return false;
 		}
 	}
+
+#if DM_USE_STEP_TABLES
+	if (usesStepTable && live)
+	{
+		++stepTableUnderruns;							// the step table ran dry, so we had to calculate this step here
+	}
+#endif
+
 	return true;
 }
 
@@ -511,7 +1209,12 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 	const int32_t t1 = mp.delta.minusAaPlusBbTimesKs + hmz0scK;
 	// Due to rounding error we can end up trying to take the square root of a negative number if we do not take precautions here
 	const int64_t t2a = mp.delta.dSquaredMinusAsquaredMinusBsquaredTimesKsquaredSsquared - (int64_t)isquare64(mp.delta.hmz0sK) + (int64_t)isquare64(t1);
+#if USE_INCREMENTAL_SQRT
+	const int32_t t2 = (t2a > 0) ? IncrementalSqrt(t2a, mp.delta.lastT2) : 0;
+	mp.delta.lastT2 = t2;
+#else
 	const int32_t t2 = (t2a > 0) ? isqrt64(t2a) : 0;
+#endif
 	const int32_t dsK = (direction) ? t1 - t2 : t1 + t2;
 
 	// Now feed dsK into a modified version of the step algorithm for Cartesian motion without elasticity compensation
@@ -523,10 +1226,19 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 	}
 
 	uint32_t nextCalcStepTime;
+#if SUPPORT_INPUT_SHAPING
+	if (dda.shapedProfile != nullptr)
+	{
+		nextCalcStepTime = dda.shapedProfile->DistanceToTime((float)dsK * mp.delta.mmPerDsK, 0.0);
+	}
+	else
+#endif
 	if ((uint32_t)dsK < mp.delta.accelStopDsK)
 	{
 		// Acceleration phase
-		nextCalcStepTime = isqrt64(isquare64(dda.afterPrepare.startSpeedTimesCdivA) + (mp.delta.twoCsquaredTimesMmPerStepDivA * (uint32_t)dsK)/K2) - dda.afterPrepare.startSpeedTimesCdivA;
+		nextCalcStepTime = STEP_SQRT(isquare64(dda.afterPrepare.startSpeedTimesCdivA) + (mp.delta.twoCsquaredTimesMmPerStepDivA * (uint32_t)dsK)/K2,
+									 nextStepTime + dda.afterPrepare.startSpeedTimesCdivA)
+							- dda.afterPrepare.startSpeedTimesCdivA;
 	}
 	else if ((uint32_t)dsK < mp.delta.decelStartDsK)
 	{
@@ -540,7 +1252,9 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 		const uint64_t temp = (mp.delta.twoCsquaredTimesMmPerStepDivD * (uint32_t)dsK)/K2;
 		// Because of possible rounding error when the end speed is zero or very small, we need to check that the square root will work OK
 		nextCalcStepTime = (temp < twoDistanceToStopTimesCsquaredDivD)
-						? dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - isqrt64(twoDistanceToStopTimesCsquaredDivD - temp)
+						? dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks
+							- STEP_SQRT(twoDistanceToStopTimesCsquaredDivD - temp,
+										(nextStepTime < dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks) ? dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - nextStepTime : 0)
 						: dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks;
 	}
 
@@ -575,6 +1289,155 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 	return true;
 }
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+
+// Return the time in step clocks since the start of the move at which the head reaches the specified distance along it
+inline uint32_t DriveMovement::StreamedDistanceToTime(const DDA &dda, float distance) const
+{
+#if SUPPORT_INPUT_SHAPING
+	if (dda.shapedProfile != nullptr)
+	{
+		return dda.shapedProfile->DistanceToTime(distance, 0.0);
+	}
+#endif
+
+	if (distance < mp.streamed.accelStopDistance)
+	{
+		// Acceleration phase: t = (sqrt(u^2 + 2as) - u)/a
+		const float startSpeedTimesCdivA = (float)dda.afterPrepare.startSpeedTimesCdivA;
+		return roundU32(sqrtf(fsquare(startSpeedTimesCdivA) + ((float)StepTimer::StepClockRateSquared * 2 * distance)/dda.acceleration) - startSpeedTimesCdivA);
+	}
+
+	if (distance < mp.streamed.decelStartDistance)
+	{
+		// Steady speed phase
+		return (uint32_t)(roundS32((distance * (float)StepTimer::StepClockRate)/dda.topSpeed) + dda.afterPrepare.extraAccelerationClocks);
+	}
+
+	// Deceleration phase: t = decelStartTime + (v - sqrt(v^2 - 2d(s - decelStartDistance)))/d
+	// Because of possible rounding error when the end speed is zero or very small, we need to check that the square root will work OK
+	const float temp = fsquare(dda.topSpeed) - 2 * dda.deceleration * (distance - mp.streamed.decelStartDistance);
+	return (temp > 0.0)
+			? dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - roundU32((sqrtf(temp) * (float)StepTimer::StepClockRate)/dda.deceleration)
+				: dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks;
+}
+
+// Move on to the next sub-segment that has any steps in it, changing direction if necessary
+void DriveMovement::StartNextStreamedSubSegment(const DDA &dda, bool live)
+pre(nextStep <= totalSteps)
+{
+	do
+	{
+		mp.streamed.netStepsBeforeSubSegment += mp.streamed.subSegmentSteps[mp.streamed.subSegment];
+		++mp.streamed.subSegment;
+	} while (mp.streamed.subSegmentSteps[mp.streamed.subSegment] == 0);		// this terminates because there are steps left to do
+
+	const int32_t steps = mp.streamed.subSegmentSteps[mp.streamed.subSegment];
+	mp.streamed.subSegmentStartDistance = StreamedSubSegmentEndDistance(dda, mp.streamed.subSegment - 1);
+	mp.streamed.subSegmentStartStep = mp.streamed.subSegmentEndStep;
+	mp.streamed.subSegmentEndStep += labs(steps);
+	mp.streamed.mmPerStep = (StreamedSubSegmentEndDistance(dda, mp.streamed.subSegment) - mp.streamed.subSegmentStartDistance)/(float)labs(steps);
+
+	const bool newDirection = (steps > 0);
+	if (newDirection != direction)
+	{
+		direction = newDirection;
+		if (live)
+		{
+			reprap.GetPlatform().SetDirection(drive, direction);
+		}
+	}
+}
+
+// Calculate the time since the start of the move when the next step is due for an axis whose motor positions we stream.
+// Return true if there are more steps to do.
+bool DriveMovement::CalcNextStepTimeStreamedFull(const DDA &dda, bool live)
+pre(nextStep <= totalSteps; stepsTillRecalc == 0)
+{
+	if (nextStep > mp.streamed.subSegmentEndStep)
+	{
+		StartNextStreamedSubSegment(dda, live);
+	}
+
+	// Work out how many steps to calculate at a time. We never do multiple steps across the end of a sub-segment, because the direction may change there.
+	uint32_t shiftFactor = 0;		// assume single stepping
+	if (stepInterval < DDA::MinCalcIntervalDelta)
+	{
+		const uint32_t stepsToLimit = mp.streamed.subSegmentEndStep - nextStep;
+		if (stepInterval < DDA::MinCalcIntervalDelta/4 && stepsToLimit > 8)
+		{
+			shiftFactor = 3;		// octal stepping
+		}
+		else if (stepInterval < DDA::MinCalcIntervalDelta/2 && stepsToLimit > 4)
+		{
+			shiftFactor = 2;		// quad stepping
+		}
+		else if (stepsToLimit > 2)
+		{
+			shiftFactor = 1;		// double stepping
+		}
+	}
+
+	stepsTillRecalc = (1u << shiftFactor) - 1;					// store number of additional steps to generate
+
+	const uint32_t stepsIntoSubSegment = nextStep + stepsTillRecalc - mp.streamed.subSegmentStartStep;
+	const uint32_t nextCalcStepTime = StreamedDistanceToTime(dda, mp.streamed.subSegmentStartDistance + (float)stepsIntoSubSegment * mp.streamed.mmPerStep);
+
+	// When crossing between movement phases with high microstepping, due to rounding errors the next step may appear to be due before the last one.
+	stepInterval = (nextCalcStepTime > nextStepTime)
+					? (nextCalcStepTime - nextStepTime) >> shiftFactor	// calculate the time per step, ready for next time
+					: 0;
+#if EVEN_STEPS
+	nextStepTime = nextCalcStepTime - (stepsTillRecalc * stepInterval);
+#else
+	nextStepTime = nextCalcStepTime;
+#endif
+
+	if (nextCalcStepTime > dda.clocksNeeded)
+	{
+		// The calculation makes this step late.
+		// When the end speed is very low, calculating the time of the last step is very sensitive to rounding error.
+		// So if this is the last step and it is late, bring it forward to the expected finish time.
+		// Very rarely, the penultimate step may be calculated late, so allow for that too.
+		if (nextStep + 1 >= totalSteps)
+		{
+			nextStepTime = dda.clocksNeeded;
+		}
+		else
+		{
+			// We don't expect any steps except the last two to be late
+			state = DMState::stepError;
+			stepInterval = 10000000 + nextStepTime;		// so we can tell what happened in the debug print
+			return false;
+		}
+	}
+	return true;
+}
+
+// Return the net number of steps taken so far in the forwards direction by a streamed axis
+int32_t DriveMovement::GetStreamedNetStepsTaken() const
+{
+	if (nextStep == 0)
+	{
+		return 0;
+	}
+	const int32_t stepsThisSubSegment = (int32_t)(min<uint32_t>(nextStep - 1, totalSteps) - mp.streamed.subSegmentStartStep);
+	return mp.streamed.netStepsBeforeSubSegment + ((direction) ? stepsThisSubSegment : -stepsThisSubSegment);
+}
+
+// Return the net number of steps left to do in the forwards direction by a streamed axis
+int32_t DriveMovement::GetStreamedNetStepsLeft() const
+{
+	int32_t netSteps = 0;
+	for (size_t i = 0; i < mp.streamed.numSubSegments; ++i)
+	{
+		netSteps += mp.streamed.subSegmentSteps[i];
+	}
+	return netSteps - GetStreamedNetStepsTaken();
+}
+
+#endif
+
 // Reduce the speed of this movement. Called to reduce the homing speed when we detect we are near the endstop for a drive.
 void DriveMovement::ReduceSpeed(uint32_t inverseSpeedFactor)
 {
@@ -9,12 +9,27 @@
 #define DRIVEMOVEMENT_H_
 
 #include "RepRapFirmware.h"
+#include "StepTimer.h"
+
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+# include "MotionProfile.h"
+#endif
 
 class LinearDeltaKinematics;
 
 #define EVEN_STEPS			(1)			// 1 to generate steps at even intervals when doing double/quad/octal stepping
 #define ROUND_TO_NEAREST	(0)			// 1 for round to nearest (as used in 1.20beta10), 0 for round down (as used prior to 1.20beta10)
 
+#if SAME70 || SAM4E
+# define DM_USE_STEP_TABLES	(1)			// 1 to precompute step times for Cartesian axes outside the step ISR
+#else
+# define DM_USE_STEP_TABLES	(0)			// not enough RAM to spare on the smaller processors
+#endif
+
+#if SUPPORT_SEGMENT_FREE_STREAMING
+constexpr size_t MaxStreamedSubSegments = 8;	// the maximum number of kinematic segments that one DDA may stream to a motor
+#endif
+
 // Rounding functions, to improve code clarity. Also allows a quick switch between round-to-nearest and round down in the movement code.
 inline uint32_t roundU32(float f)
 {
@@ -139,6 +154,12 @@ public:
 	bool PrepareCartesianAxis(const DDA& dda, const PrepParams& params) __attribute__ ((hot));
 	bool PrepareDeltaAxis(const DDA& dda, const PrepParams& params) __attribute__ ((hot));
 	bool PrepareExtruder(const DDA& dda, const PrepParams& params, float& extrusionPending, float speedChange, bool doCompensation) __attribute__ ((hot));
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	bool PrepareStreamedAxis(const DDA& dda, const PrepParams& params, const int16_t subSegmentSteps[], int32_t netSteps) __attribute__ ((hot));
+#endif
+#if SUPPORT_INPUT_SHAPING
+	bool PrepareShapedDrive(const DDA& dda, float mmPerStep, float advanceClocks) __attribute__ ((hot));
+#endif
 	void ReduceSpeed(uint32_t inverseSpeedFactor);
 	void DebugPrint() const;
 	int32_t GetNetStepsLeft() const;
@@ -148,24 +169,55 @@ public:
 	uint32_t GetStepInterval(uint32_t microstepShift) const;	// Get the current full step interval for this axis or extruder
 #endif
 
-#if SUPPORT_CAN_EXPANSION
-	int32_t GetSteps() const { return (direction) ? totalSteps : -totalSteps; }
-#endif
-
-	static void InitialAllocate(unsigned int num);
+	static void InitialAllocate(unsigned int num, unsigned int maxNum);
+	static bool Reserve(unsigned int num);						// make sure that at least num DMs are free, allocating more if we are allowed to
 	static int NumFree() { return numFree; }
 	static int MinFree() { return minFree; }
 	static void ResetMinFree() { minFree = numFree; }
+	static unsigned int NumAllocated() { return numAllocated; }
+	static unsigned int GetMaxAllocated() { return maxAllocated; }
+	static void SetMaxAllocated(unsigned int num) { maxAllocated = max<unsigned int>(num, numAllocated); }	// we never free DMs, so the limit can't go below the number allocated
+	static unsigned int HighWater() { return highWater; }
+	static uint32_t GetAndClearAllocationFailures();
 	static DriveMovement *Allocate(size_t drive, DMState st);
 	static void Release(DriveMovement *item);
 
+#if DM_USE_STEP_TABLES
+	void FillStepTable(const DDA& dda, bool live);
+	static uint32_t GetAndClearStepTableUnderruns();
+#endif
+
 private:
-	bool CalcNextStepTimeCartesianFull(const DDA &dda, bool live) __attribute__ ((hot));
-	bool CalcNextStepTimeDeltaFull(const DDA &dda, bool live) __attribute__ ((hot));
+	bool CalcNextStepTimeCartesianFull(const DDA &dda, bool live) STEP_ISR_CODE;
+	uint32_t CalcNonReversedStepTime(const DDA &dda, uint32_t stepNumber, uint32_t previousStepTime) const __attribute__ ((hot));
+	bool CalcNextStepTimeDeltaFull(const DDA &dda, bool live) STEP_ISR_CODE;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	bool CalcNextStepTimeStreamedFull(const DDA &dda, bool live) STEP_ISR_CODE;
+	uint32_t StreamedDistanceToTime(const DDA &dda, float distance) const __attribute__ ((hot));
+	void StartNextStreamedSubSegment(const DDA &dda, bool live);
+	static float StreamedSubSegmentEndDistance(const DDA &dda, size_t subSegment);
+	int32_t GetStreamedNetStepsTaken() const;
+	int32_t GetStreamedNetStepsLeft() const;
+#endif
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	MotionProfile *BuildSmoothedAdvanceProfile(const DDA& dda, float extrusionRequired, float advanceClocks, float smoothingClocks) const;
+	bool PrepareSmoothedExtruder(const DDA& dda, MotionProfile *profile, float& extrusionPending, float stepsPerMm) __attribute__ ((hot));
+	bool CalcNextStepTimeSmoothedFull(const DDA &dda, bool live) STEP_ISR_CODE;
+	int32_t GetSmoothedNetStepsTaken() const;
+#endif
 
 	static DriveMovement *freeList;
 	static int numFree;
 	static int minFree;
+	static unsigned int numAllocated;					// how many DMs we have allocated
+	static unsigned int maxAllocated;					// the most DMs we may allocate
+	static unsigned int highWater;						// the most DMs that have been in use at once
+	static uint32_t numAllocationFailures;				// how many times we wanted more DMs but couldn't have them
+	static bool inShortfall;							// true if the last call to Reserve couldn't provide enough DMs
+
+#if DM_USE_STEP_TABLES
+	static uint32_t stepTableUnderruns;
+#endif
 
 	// Parameters common to Cartesian, delta and extruder moves
 
@@ -176,9 +228,20 @@ private:
 	uint8_t microstepShift : 4,							// log2 of the microstepping factor (for when we use dynamic microstepping adjustment)
 			direction : 1,								// true=forwards, false=backwards
 			fullCurrent : 1,							// true if the drivers are set to the full current, false if they are set to the standstill current
-			isDelta : 1;								// true if this DM uses segment-free delta kinematics
+			isDelta : 1,								// true if this DM uses segment-free delta kinematics
+			usesStepTable : 1;							// true if the step times are precomputed into stepTable
 	uint8_t stepsTillRecalc;							// how soon we need to recalculate
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	bool isStreamed;									// true if this DM interpolates motor positions calculated by the kinematics along the move
+#endif
+#if SUPPORT_INPUT_SHAPING
+	bool isShaped;										// true if this Cartesian or extruder DM follows the input-shaped motion profile of the DDA
+#endif
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	bool isSmoothed;									// true if this extruder DM follows its own profile because it uses smoothed pressure advance
+#endif
+
 	uint32_t totalSteps;								// total number of steps for this move
 
 	// These values change as the step is executed, except for reverseStartStep
@@ -190,6 +253,17 @@ private:
 	// The following only needs to be stored per-drive if we are supporting pressure advance
 	uint64_t twoDistanceToStopTimesCsquaredDivD;
 
+#if DM_USE_STEP_TABLES
+	// Precomputed step times. The table is a lock-free single-producer, single-consumer queue that is filled from the main loop and emptied by the step ISR.
+	// Only the main loop writes tableAddIndex and only the ISR writes tableGetIndex. The indices are never reduced modulo the table size,
+	// so the entry with index N always holds the time of step N+1, or NoStepTime if the ISR had already passed that step when we came to calculate it.
+	static constexpr size_t StepTableSize = 8;			// must be a power of 2
+	DriveMovement *nextTableDM;							// link to the next DM in the same DDA that uses a step table
+	volatile uint32_t tableGetIndex;					// index of the next entry to remove
+	volatile uint32_t tableAddIndex;					// index of the next entry to add
+	uint32_t stepTable[StepTableSize];
+#endif
+
 	// Parameters unique to a style of move (Cartesian, delta or extruder). Currently, extruders and Cartesian moves use the same parameters.
 	union MoveParams
 	{
@@ -221,11 +295,53 @@ private:
 			uint32_t accelStopDsK;
 			uint32_t decelStartDsK;
 			uint32_t mmPerStepTimesCKdivtopSpeed;
+#if USE_INCREMENTAL_SQRT
+			uint32_t lastT2;							// the previous value of t2, used to speed up the next square root
+#endif
+#if SUPPORT_INPUT_SHAPING
+			float mmPerDsK;								// converts dsK to distance along the move, for input-shaped moves
+#endif
 		} delta;
+
+#if SUPPORT_SEGMENT_FREE_STREAMING
+		struct StreamedParameters						// Parameters for segment-free movement of axes using non-linear kinematics
+		{
+			// The motor position is interpolated linearly between the positions calculated by the kinematics or the mesh compensation at the ends of each sub-segment
+			float accelStopDistance;					// the distance along the move at which acceleration stops
+			float decelStartDistance;					// the distance along the move at which deceleration starts
+			float subSegmentStartDistance;				// the distance along the move at which the current sub-segment starts
+			float mmPerStep;							// the distance travelled along the move per step in the current sub-segment
+			uint32_t subSegmentStartStep;				// how many steps were done before the current sub-segment
+			uint32_t subSegmentEndStep;					// the number of the last step in the current sub-segment
+			int32_t netStepsBeforeSubSegment;			// the net number of steps done before the current sub-segment, forwards positive
+			uint8_t subSegment;							// the number of the current sub-segment
+			uint8_t numSubSegments;						// the number of sub-segments in this move
+			int16_t subSegmentSteps[MaxStreamedSubSegments];	// the signed number of steps in each sub-segment
+		} streamed;
+#endif
+
+#if SUPPORT_INPUT_SHAPING
+		struct ShapedParameters							// Parameters for Cartesian and extruder movement that follows an input-shaped motion profile
+		{
+			float mmPerStep;							// the distance travelled along the move per step
+			float advanceClocks;						// the pressure advance time in step clocks, or zero
+		} shaped;
+#endif
+
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+		struct SmoothedParameters						// Parameters for extruder movement with smoothed pressure advance
+		{
+			MotionProfile *profile;						// the extrusion against time including the advance, which we own and release with this DM
+			float stepsPerMm;							// the raw steps per mm of the extruder
+			int32_t position;							// the net steps done including the one that is due next, which is always floor(extrusion * stepsPerMm)
+			int32_t netSteps;							// the net steps in the whole move
+			uint32_t segment;							// the profile segment that the next step is in
+		} smoothed;
+#endif
 	} mp;
 
 	static constexpr uint32_t NoStepTime = 0xFFFFFFFF;	// value to indicate that no further steps are needed when calculating the next step time
-	static constexpr uint32_t K1 = 1024;				// a power of 2 used to multiply the value mmPerStepTimesCdivtopSpeed to reduce rounding errors
+	static constexpr uint32_t K1 = 1024/StepTimer::StepClockScale;	// a power of 2 used to multiply the value mmPerStepTimesCdivtopSpeed to reduce rounding errors, smaller if the step clock is fast
 	static constexpr uint32_t K2 = 512;					// a power of 2 used in delta calculations to reduce rounding errors (but too large makes things worse)
 	static constexpr int32_t Kc = 1024 * 1024;			// a power of 2 for scaling the Z movement fraction
 };
@@ -247,6 +363,34 @@ inline bool DriveMovement::CalcNextStepTimeCartesian(const DDA &dda, bool live)
 #endif
 			return true;
 		}
+#if DM_USE_STEP_TABLES
+		if (usesStepTable)
+		{
+			// Discard any entries for steps that we calculated here because the table ran dry, then see whether the time of this step has already been calculated
+			uint32_t getIndex = tableGetIndex;
+			const uint32_t addIndex = tableAddIndex;			// capture volatile variable
+			while (getIndex != addIndex && getIndex + 1 < nextStep)
+			{
+				++getIndex;
+			}
+			if (getIndex != addIndex)
+			{
+				__DMB();										// don't read the entry before we have read tableAddIndex
+				const uint32_t stepTime = stepTable[getIndex & (StepTableSize - 1)];
+				tableGetIndex = getIndex + 1;
+				if (stepTime != NoStepTime)
+				{
+					stepInterval = (stepTime > nextStepTime) ? stepTime - nextStepTime : 0;
+					nextStepTime = stepTime;
+					return true;
+				}
+			}
+			else
+			{
+				tableGetIndex = getIndex;
+			}
+		}
+#endif
 		return CalcNextStepTimeCartesianFull(dda, live);
 	}
 
@@ -272,6 +416,12 @@ inline bool DriveMovement::CalcNextStepTimeDelta(const DDA &dda, bool live)
 		}
 		else
 		{
+#if SUPPORT_SEGMENT_FREE_STREAMING
+			if (isStreamed)
+			{
+				return CalcNextStepTimeStreamedFull(dda, live);
+			}
+#endif
 			return CalcNextStepTimeDeltaFull(dda, live);
 		}
 	}
@@ -284,6 +434,20 @@ inline bool DriveMovement::CalcNextStepTimeDelta(const DDA &dda, bool live)
 // We have already taken nextSteps - 1 steps, unless nextStep is zero.
 inline int32_t DriveMovement::GetNetStepsLeft() const
 {
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	if (isStreamed)
+	{
+		return GetStreamedNetStepsLeft();
+	}
+#endif
+
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	if (isSmoothed)
+	{
+		return mp.smoothed.netSteps - GetSmoothedNetStepsTaken();
+	}
+#endif
+
 	int32_t netStepsLeft;
 	if (reverseStartStep > totalSteps)		// if no reverse phase
 	{
@@ -305,6 +469,20 @@ inline int32_t DriveMovement::GetNetStepsLeft() const
 // We have already taken nextSteps - 1 steps, unless nextStep is zero.
 inline int32_t DriveMovement::GetNetStepsTaken() const
 {
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	if (isStreamed)
+	{
+		return GetStreamedNetStepsTaken();
+	}
+#endif
+
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	if (isSmoothed)
+	{
+		return GetSmoothedNetStepsTaken();
+	}
+#endif
+
 	int32_t netStepsTaken;
 	if (nextStep < reverseStartStep || reverseStartStep > totalSteps)				// if no reverse phase, or not started it yet
 	{
@@ -320,11 +498,30 @@ inline int32_t DriveMovement::GetNetStepsTaken() const
 // This is inlined because it is only called from one place
 inline void DriveMovement::Release(DriveMovement *item)
 {
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	if (item->isSmoothed)
+	{
+		MotionProfile::Release(item->mp.smoothed.profile);
+		item->isSmoothed = false;
+	}
+#endif
 	item->nextDM = freeList;
 	freeList = item;
 	++numFree;
 }
 
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+
+// Return the net steps taken by an extruder with smoothed pressure advance. The position already includes the step that is due next, if there is one.
+inline int32_t DriveMovement::GetSmoothedNetStepsTaken() const
+{
+	return (nextStep == 0 || nextStep > totalSteps) ? mp.smoothed.position
+			: (direction) ? mp.smoothed.position - 1
+				: mp.smoothed.position + 1;
+}
+
+#endif
+
 #if HAS_SMART_DRIVERS
 
 // Get the current full step interval for this axis or extruder
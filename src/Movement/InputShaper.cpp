@@ -0,0 +1,304 @@
+/*
+ * InputShaper.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "InputShaper.h"
+
+#if SUPPORT_INPUT_SHAPING
+
+#include "DDA.h"
+#include "MotionProfile.h"
+#include "StepTimer.h"
+#include "Platform.h"
+#include "RepRap.h"
+#include "GCodes/GCodes.h"
+
+static_assert(MotionProfile::MaxSegments + 1 >= 4 * InputShaper::MaxImpulses, "Not enough profile segments for the maximum number of shaper impulses");
+
+InputShaper::InputShaper()
+	: type(InputShaperType::none), numFrequencies(0), dampingRatio(0.1), numImpulses(0), meanDelay(0.0),
+	  movesShaped(0), movesTooShort(0), movesNoProfile(0), movesAdvanceReverses(0)
+{
+}
+
+// Set up the shaper. Multiple frequencies are handled by convolving together the shapers for the individual frequencies.
+bool InputShaper::Configure(InputShaperType t, const float freqs[], size_t numFreqs, float damping)
+{
+	if (numFreqs == 0 || numFreqs > MaxFrequencies || damping < 0.0 || damping >= 1.0)
+	{
+		return false;
+	}
+
+	numImpulses = 1;
+	amplitudes[0] = 1.0;
+	delays[0] = 0.0;
+	const float dampedFactor = sqrtf(1.0 - fsquare(damping));
+	const float k = expf(-damping * Pi/dampedFactor);
+	for (size_t i = 0; i < numFreqs; ++i)
+	{
+		const float halfPeriod = 0.5/(freqs[i] * dampedFactor);
+		const float times[3] = { 0.0, halfPeriod, 2 * halfPeriod };
+		bool ok;
+		switch (t.ToInt())
+		{
+		case InputShaperType::zv:
+			{
+				const float amps[2] = { 1.0/(1.0 + k), k/(1.0 + k) };
+				ok = AddImpulses(amps, times, 2);
+			}
+			break;
+
+		case InputShaperType::zvd:
+			{
+				const float scale = 1.0/fsquare(1.0 + k);
+				const float amps[3] = { scale, 2 * k * scale, fsquare(k) * scale };
+				ok = AddImpulses(amps, times, 3);
+			}
+			break;
+
+		case InputShaperType::ei:
+			{
+				constexpr float VibrationTolerance = 0.05;	// the fraction of the vibration we allow at the shaper frequency, which widens the band that we suppress
+				const float a1 = 0.25 * (1.0 + VibrationTolerance);
+				const float a2 = 0.5 * (1.0 - VibrationTolerance) * k;
+				const float a3 = a1 * fsquare(k);
+				const float scale = 1.0/(a1 + a2 + a3);
+				const float amps[3] = { a1 * scale, a2 * scale, a3 * scale };
+				ok = AddImpulses(amps, times, 3);
+			}
+			break;
+
+		default:
+			ok = false;
+			break;
+		}
+
+		if (!ok)
+		{
+			numImpulses = 0;
+			return false;
+		}
+	}
+
+	// Sort the impulses into time order, convert the delays to step clocks and calculate the mean delay
+	for (size_t i = 1; i < numImpulses; ++i)
+	{
+		const float amp = amplitudes[i], del = delays[i];
+		size_t j = i;
+		while (j != 0 && delays[j - 1] > del)
+		{
+			amplitudes[j] = amplitudes[j - 1];
+			delays[j] = delays[j - 1];
+			--j;
+		}
+		amplitudes[j] = amp;
+		delays[j] = del;
+	}
+
+	meanDelay = 0.0;
+	for (size_t i = 0; i < numImpulses; ++i)
+	{
+		delays[i] *= (float)StepTimer::StepClockRate;
+		meanDelay += amplitudes[i] * delays[i];
+	}
+
+	type = t;
+	numFrequencies = numFreqs;
+	for (size_t i = 0; i < numFreqs; ++i)
+	{
+		frequencies[i] = freqs[i];
+	}
+	dampingRatio = damping;
+	return true;
+}
+
+// Convolve the existing impulses with another set, returning false if there would be too many
+bool InputShaper::AddImpulses(const float amps[], const float times[], size_t num)
+{
+	if (numImpulses * num > MaxImpulses)
+	{
+		return false;
+	}
+
+	// Work backwards so that we don't overwrite the existing impulses before we have used them
+	for (size_t i = numImpulses; i != 0; )
+	{
+		--i;
+		const float amp = amplitudes[i], del = delays[i];
+		for (size_t j = 0; j < num; ++j)
+		{
+			amplitudes[i * num + j] = amp * amps[j];
+			delays[i * num + j] = del + times[j];
+		}
+	}
+	numImpulses *= num;
+	return true;
+}
+
+// Shape the motion profile of a move. On entry the move has been planned as a trapezoidal move, with jerk-limited speed changes if accelJerk or decelJerk is nonzero.
+// If wantProfile is true then we allocate a profile, fill it in and attach it to the DDA; otherwise we just work out how long the shaped move takes (for simulation).
+// Return true if we shaped the move, in which case the duration of the DDA has been updated.
+bool InputShaper::ShapeMove(DDA& dda, bool wantProfile, float accelJerk, float decelJerk)
+{
+	// Work in mm and step clocks, so that the profile doesn't need to convert units
+	const float clockRate = (float)StepTimer::StepClockRate;
+	const float startSpeed = dda.startSpeed/clockRate;
+	const float topSpeed = dda.topSpeed/clockRate;
+	const float endSpeed = dda.endSpeed/clockRate;
+	const float acceleration = dda.acceleration/fsquare(clockRate);
+	const float deceleration = dda.deceleration/fsquare(clockRate);
+	const float accelClocks = (topSpeed - startSpeed)/acceleration;
+	const float decelClocks = (topSpeed - endSpeed)/deceleration;
+	const float steadyClocks = (dda.totalDistance - dda.beforePrepare.accelDistance - dda.beforePrepare.decelDistance)/topSpeed;
+
+	// Convolving the speed with the shaper delays the motion by the mean delay and extends the move by the shaper duration.
+	// Shorten the steady speed phase of the unshaped move so that the shaped move still covers the original distance.
+	// Jerk-limited speed changes are symmetrical, so they don't change the distance covered.
+	const float shaperClocks = delays[numImpulses - 1];
+	const float shapedSteadyClocks = steadyClocks - ((endSpeed * shaperClocks) + ((startSpeed - endSpeed) * meanDelay))/topSpeed;
+	if (shapedSteadyClocks < 0.0)
+	{
+		++movesTooShort;
+		return false;
+	}
+
+	const float unshapedClocks = accelClocks + shapedSteadyClocks + decelClocks;
+	const float totalClocks = unshapedClocks + shaperClocks;
+
+	if (wantProfile)
+	{
+		MotionProfile * const profile = MotionProfile::Allocate();
+		if (profile == nullptr)
+		{
+			++movesNoProfile;
+			return false;
+		}
+
+		// Describe the unshaped move
+		MotionSegment unshaped[MotionProfile::MaxMoveSegments];
+		const size_t numUnshaped = MotionProfile::MakeMoveSegments(unshaped, startSpeed, topSpeed, endSpeed, accelClocks, shapedSteadyClocks, decelClocks, accelJerk, decelJerk);
+
+		// The shaped jerk can only change when one of the impulses reaches a boundary between segments of the unshaped move, so make a sorted list of those times
+		float breakpoints[(MotionProfile::MaxMoveSegments + 1) * MaxImpulses];
+		size_t numBreakpoints = 0;
+		for (size_t k = 0; k <= numUnshaped; ++k)
+		{
+			const float boundaryTime = (k < numUnshaped) ? unshaped[k].startClocks : unshapedClocks;
+			for (size_t i = 0; i < numImpulses; ++i)
+			{
+				const float t = boundaryTime + delays[i];
+				size_t j = numBreakpoints;
+				while (j != 0 && breakpoints[j - 1] > t)
+				{
+					--j;
+				}
+				if ((j == 0 || t - breakpoints[j - 1] >= 0.5) && (j == numBreakpoints || breakpoints[j] - t >= 0.5))		// ignore times less than half a clock apart
+				{
+					memmove(breakpoints + j + 1, breakpoints + j, (numBreakpoints - j) * sizeof(breakpoints[0]));
+					breakpoints[j] = t;
+					++numBreakpoints;
+				}
+			}
+		}
+
+		// Build the profile, merging adjacent intervals that have the same constant acceleration
+		float distance = 0.0, speed = startSpeed, lastAcceleration = 0.0, lastJerk = 0.0;
+		for (size_t m = 0; m + 1 < numBreakpoints; ++m)
+		{
+			const float intervalStart = breakpoints[m];
+			const float intervalLength = breakpoints[m + 1] - intervalStart;
+			const float midTime = intervalStart + intervalLength * 0.5;
+			float accel = 0.0, jerk = 0.0;
+			for (size_t i = 0; i < numImpulses; ++i)
+			{
+				const float t = midTime - delays[i];
+				if (t >= 0.0 && t < unshapedClocks)
+				{
+					size_t k = numUnshaped - 1;
+					while (k != 0 && unshaped[k].startClocks > t)
+					{
+						--k;
+					}
+					accel += amplitudes[i] * unshaped[k].AccelerationAt(intervalStart - delays[i]);
+					jerk += amplitudes[i] * unshaped[k].jerk;
+				}
+			}
+
+			if (m == 0 || jerk != 0.0 || lastJerk != 0.0 || accel != lastAcceleration)
+			{
+				if (!profile->AddSegment(intervalStart, distance, speed, accel, jerk))
+				{
+					// This can only happen if the move has jerk-limited speed changes, because of the static_assert at the start of this file
+					MotionProfile::Release(profile);
+					++movesNoProfile;
+					return false;
+				}
+				lastAcceleration = accel;
+				lastJerk = jerk;
+			}
+			distance += (speed + (accel * 0.5 + jerk * intervalLength * (1.0/6.0)) * intervalLength) * intervalLength;
+			speed += (accel + jerk * intervalLength * 0.5) * intervalLength;
+		}
+
+		// The extruders must follow the same profile as the axes, otherwise extrusion and motion drift apart. If any can't, leave the whole move unshaped.
+		if (dda.flags.usePressureAdvance && !CanExtrudersFollow(dda, *profile))
+		{
+			MotionProfile::Release(profile);
+			++movesAdvanceReverses;
+			return false;
+		}
+
+		profile->SetDuration(roundU32(totalClocks));
+		dda.shapedProfile = profile;
+		if (reprap.Debug(moduleMove))
+		{
+			profile->DebugPrint();
+		}
+	}
+
+	dda.clocksNeeded = roundU32(totalClocks);
+	++movesShaped;
+	return true;
+}
+
+// Return true if every extruder that moves forwards with pressure advance in this move can follow the profile, i.e. its advanced extrusion never goes backwards.
+// Extruders with smoothed pressure advance build their own profile from the shaped one, so we don't need to check those.
+bool InputShaper::CanExtrudersFollow(const DDA& dda, const MotionProfile& profile) const
+{
+	const Platform& platform = reprap.GetPlatform();
+	const size_t numTotalAxes = reprap.GetGCodes().GetTotalAxes();
+	for (size_t drive = numTotalAxes; drive < NumDirectDrivers; ++drive)
+	{
+		if (dda.directionVector[drive] > 0.0)
+		{
+			const size_t extruder = drive - numTotalAxes;
+			const float advanceTime = platform.GetPressureAdvance(extruder);
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+			if (platform.GetPressureAdvanceSmoothing(extruder) > 0.0)
+			{
+				continue;
+			}
+#endif
+			if (advanceTime > 0.0 && !profile.IsAdvanceMonotonic(advanceTime * (float)StepTimer::StepClockRate))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Report the statistics and clear them
+void InputShaper::Diagnostics(MessageType mtype)
+{
+	reprap.GetPlatform().MessageF(mtype, "Input shaping: %" PRIu32 " moves shaped, %" PRIu32 " too short, %" PRIu32 " no profile, %" PRIu32 " pressure advance reverses, profiles allocated %u\n",
+									movesShaped, movesTooShort, movesNoProfile, movesAdvanceReverses, MotionProfile::NumAllocated());
+	movesShaped = movesTooShort = movesNoProfile = movesAdvanceReverses = 0;
+}
+
+#endif
+
+// End
@@ -0,0 +1,72 @@
+/*
+ * InputShaper.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_INPUTSHAPER_H_
+#define SRC_MOVEMENT_INPUTSHAPER_H_
+
+#include "RepRapFirmware.h"
+#include "NamedEnum.h"
+#include "MessageType.h"
+
+// The ways in which we can reduce ringing. 'daa' is dynamic acceleration adjustment, which is done by DDA::AdjustAcceleration and doesn't use the input shaper.
+NamedEnum(InputShaperType, none, daa, zv, zvd, ei);
+
+#if SUPPORT_INPUT_SHAPING
+
+class DDA;
+class MotionProfile;
+
+// Class to shape the motion profiles of moves so that they don't excite ringing at the configured frequencies.
+// The shaper is a train of impulses whose amplitudes add up to 1. DDA::Prepare asks us to convolve the acceleration profile of a move with it,
+// which cancels vibration at the shaper frequencies while keeping the full acceleration. The move takes slightly longer, by up to the duration of the shaper.
+// Each move is shaped on its own, so the shaped move starts and ends at the same speeds as the unshaped one.
+class InputShaper
+{
+public:
+	static constexpr size_t MaxFrequencies = 2;
+	static constexpr size_t MaxImpulses = 9;					// enough for two frequencies with 3 impulses each
+
+	InputShaper();
+
+	bool Configure(InputShaperType t, const float freqs[], size_t numFreqs, float damping);	// set up the shaper, returning false if the parameters are bad
+	void Disable() { numImpulses = 0; }
+	bool IsEnabled() const { return numImpulses != 0; }
+	InputShaperType GetType() const { return type; }
+	float GetDampingRatio() const { return dampingRatio; }
+	size_t GetNumFrequencies() const { return numFrequencies; }
+	float GetFrequency(size_t n) const { return frequencies[n]; }
+	float GetDuration() const { return delays[numImpulses - 1]; }	// the duration of the shaper in step clocks
+
+	bool ShapeMove(DDA& dda, bool wantProfile, float accelJerk, float decelJerk) __attribute__ ((hot));	// shape a move, returning true if we did
+
+	void Diagnostics(MessageType mtype);						// report and clear the statistics
+
+private:
+	bool AddImpulses(const float amplitudes[], const float times[], size_t num);
+	bool CanExtrudersFollow(const DDA& dda, const MotionProfile& profile) const;	// check that the pressure advance of every extruder can follow the profile
+
+	InputShaperType type;
+	size_t numFrequencies;
+	float frequencies[MaxFrequencies];
+	float dampingRatio;
+
+	// The impulses of the shaper, with delays in step clocks
+	size_t numImpulses;
+	float amplitudes[MaxImpulses];
+	float delays[MaxImpulses];
+	float meanDelay;											// the sum of the delays weighted by the amplitudes
+
+	// Statistics
+	uint32_t movesShaped;
+	uint32_t movesTooShort;										// moves we couldn't shape because they had too little steady speed phase
+	uint32_t movesNoProfile;									// moves we couldn't shape because we ran out of profiles or the profile needed too many segments
+	uint32_t movesAdvanceReverses;								// moves we didn't shape because the pressure advance of an extruder would have gone backwards
+};
+
+#endif
+
+#endif /* SRC_MOVEMENT_INPUTSHAPER_H_ */
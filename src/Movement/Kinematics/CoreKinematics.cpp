@@ -44,10 +44,17 @@ void CoreKinematics::Recalc()
 					forwardMatrix(i, j) = tempMatrix(i, j + MaxAxes);
 				}
 			}
+
+			// See whether we can use one of the faster conversions. They need the forward matrix, so we only use them if the inverse matrix could be inverted.
+			shape = (IsCoupledOnly(MaxAxes, MaxAxes)) ? MatrixShape::diagonal
+					: (IsCoupledOnly(X_AXIS, Y_AXIS)) ? MatrixShape::coupledXY
+						: (IsCoupledOnly(X_AXIS, Z_AXIS)) ? MatrixShape::coupledXZ
+							: MatrixShape::general;
 		}
 		else
 		{
 			forwardMatrix.Fill(0.0);
+			shape = MatrixShape::general;
 			reprap.GetPlatform().Message(ErrorMessage, "Invalid kinematics matrix\n");
 		}
 	}
@@ -123,6 +130,28 @@ inline bool CoreKinematics::HasSharedMotor(size_t axis) const
 	return connectedAxes[axis] != MakeBitmap<AxesBitmap>(axis);
 }
 
+// Return true if the inverse matrix is diagonal with non-zero diagonal elements, apart from the coefficients that link axes axisA and axisB to motors axisA and axisB.
+// Pass MaxAxes for both axes to test for a purely diagonal matrix. The forward matrix then has the same shape.
+bool CoreKinematics::IsCoupledOnly(size_t axisA, size_t axisB) const
+{
+	for (size_t axis = 0; axis < MaxAxes; ++axis)
+	{
+		const bool axisCoupled = (axis == axisA || axis == axisB);
+		for (size_t motor = 0; motor < MaxAxes; ++motor)
+		{
+			if (axisCoupled && (motor == axisA || motor == axisB))
+			{
+				continue;
+			}
+			if ((inverseMatrix(axis, motor) != 0.0) != (axis == motor))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 CoreKinematics::CoreKinematics(KinematicsType k) : ZLeadscrewKinematics(k), modified(false)
 {
 	// Start by assuming 1:1 mapping of axes to motors by setting diagonal elements to 1 and other element to zero
@@ -283,12 +312,67 @@ bool CoreKinematics::Configure(unsigned int mCode, GCodeBuffer& gb, const String
 	return seen;
 }
 
+// Convert Cartesian coordinates to motor coordinates when the matrix is diagonal apart from the coefficients linking AxisA and AxisB, where AxisA < AxisB.
+// Instantiated with both axes equal to MaxAxes for a diagonal matrix. The results are the same as the general conversion gives.
+template<size_t AxisA, size_t AxisB> inline void CoreKinematics::CoupledCartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+																							int32_t motorPos[]) const
+{
+	const size_t limit = min<size_t>(numVisibleAxes, numTotalAxes);
+	for (size_t motor = 0; motor < limit; ++motor)
+	{
+		if (motor != AxisA && motor != AxisB)
+		{
+			motorPos[motor] = lrintf(inverseMatrix(motor, motor) * machinePos[motor] * stepsPerMm[motor]);
+		}
+	}
+	if (AxisB < limit)
+	{
+		motorPos[AxisA] = lrintf((inverseMatrix(AxisA, AxisA) * machinePos[AxisA] + inverseMatrix(AxisB, AxisA) * machinePos[AxisB]) * stepsPerMm[AxisA]);
+		motorPos[AxisB] = lrintf((inverseMatrix(AxisA, AxisB) * machinePos[AxisA] + inverseMatrix(AxisB, AxisB) * machinePos[AxisB]) * stepsPerMm[AxisB]);
+	}
+}
+
+// Convert motor coordinates to machine coordinates when the matrix is diagonal apart from the coefficients linking AxisA and AxisB, where AxisA < AxisB
+template<size_t AxisA, size_t AxisB> inline void CoreKinematics::CoupledMotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, float machinePos[]) const
+{
+	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+	{
+		if (axis != AxisA && axis != AxisB)
+		{
+			machinePos[axis] = forwardMatrix(axis, axis) * (float)motorPos[axis] / stepsPerMm[axis];
+		}
+	}
+	if (AxisB < numVisibleAxes)
+	{
+		machinePos[AxisA] = forwardMatrix(AxisA, AxisA) * (float)motorPos[AxisA] / stepsPerMm[AxisA] + forwardMatrix(AxisB, AxisA) * (float)motorPos[AxisB] / stepsPerMm[AxisB];
+		machinePos[AxisB] = forwardMatrix(AxisA, AxisB) * (float)motorPos[AxisA] / stepsPerMm[AxisA] + forwardMatrix(AxisB, AxisB) * (float)motorPos[AxisB] / stepsPerMm[AxisB];
+	}
+}
+
 // Convert Cartesian coordinates to motor coordinates returning true if successful.
 // This is called frequently, so try to keep it efficient.
 // If a motor has no visible axes that affect it, leave the old motor coordinate unchanged.
 bool CoreKinematics::CartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
 	int32_t motorPos[], bool isCoordinated) const
 {
+	switch (shape)
+	{
+	case MatrixShape::diagonal:
+		CoupledCartesianToMotorSteps<MaxAxes, MaxAxes>(machinePos, stepsPerMm, numVisibleAxes, numTotalAxes, motorPos);
+		return true;
+
+	case MatrixShape::coupledXY:
+		CoupledCartesianToMotorSteps<X_AXIS, Y_AXIS>(machinePos, stepsPerMm, numVisibleAxes, numTotalAxes, motorPos);
+		return true;
+
+	case MatrixShape::coupledXZ:
+		CoupledCartesianToMotorSteps<X_AXIS, Z_AXIS>(machinePos, stepsPerMm, numVisibleAxes, numTotalAxes, motorPos);
+		return true;
+
+	default:
+		break;
+	}
+
 	for (size_t motor = 0; motor < numTotalAxes; ++motor)
 	{
 		const size_t axisLimit = min<size_t>(numVisibleAxes, lastAxis[motor] + 1);
@@ -311,6 +395,24 @@ bool CoreKinematics::CartesianToMotorSteps(const float machinePos[], const float
 // Convert motor coordinates to machine coordinates. Used after homing and after individual motor moves.
 void CoreKinematics::MotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, float machinePos[]) const
 {
+	switch (shape)
+	{
+	case MatrixShape::diagonal:
+		CoupledMotorStepsToCartesian<MaxAxes, MaxAxes>(motorPos, stepsPerMm, numVisibleAxes, machinePos);
+		return;
+
+	case MatrixShape::coupledXY:
+		CoupledMotorStepsToCartesian<X_AXIS, Y_AXIS>(motorPos, stepsPerMm, numVisibleAxes, machinePos);
+		return;
+
+	case MatrixShape::coupledXZ:
+		CoupledMotorStepsToCartesian<X_AXIS, Z_AXIS>(motorPos, stepsPerMm, numVisibleAxes, machinePos);
+		return;
+
+	default:
+		break;
+	}
+
 	// If there are more motors than visible axes (e.g. CoreXYU which has a V motor), we assume that we can ignore the trailing ones when calculating the machine position
 	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
 	{
@@ -392,7 +494,7 @@ void CoreKinematics::LimitSpeedAndAcceleration(DDA& dda, const float* normalised
 		const float mm = fabsf(motorMovements[motor]);
 		if (mm != 0.0)
 		{
-			dda.LimitSpeedAndAcceleration(reprap.GetPlatform().MaxFeedrate(motor)/mm, reprap.GetPlatform().Acceleration(motor)/mm);
+			dda.LimitSpeedAndAcceleration(reprap.GetPlatform().MaxFeedrate(motor)/mm, reprap.GetPlatform().Acceleration(motor)/mm, reprap.GetPlatform().Deceleration(motor)/mm);
 		}
 	}
 }
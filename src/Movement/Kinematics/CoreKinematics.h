@@ -14,6 +14,9 @@
 class CoreKinematics : public ZLeadscrewKinematics
 {
 public:
+	void* operator new(size_t sz) { return Allocate<CoreKinematics>(); }
+	void operator delete(void* p) { Release<CoreKinematics>(p); }
+
 	CoreKinematics(KinematicsType k);
 
 	// Overridden base class functions. See Kinematics.h for descriptions.
@@ -29,8 +32,21 @@ public:
 	AxesBitmap GetLinearAxes() const override;
 
 private:
+	// Matrices with these shapes are common enough to be worth converting without the general matrix multiplication
+	enum class MatrixShape : uint8_t
+	{
+		general,
+		diagonal,											// each axis has its own motor, as in Cartesian printers
+		coupledXY,											// as diagonal except that X and Y share two motors, as in CoreXY printers
+		coupledXZ											// as diagonal except that X and Z share two motors, as in CoreXZ printers
+	};
+
 	void Recalc();											// recalculate internal variables following a configuration change
 	bool HasSharedMotor(size_t axis) const;					// return true if the axis doesn't have a single dedicated motor
+	bool IsCoupledOnly(size_t axisA, size_t axisB) const;	// return true if every motor has its own axis apart from any that axisA and axisB share
+
+	template<size_t AxisA, size_t AxisB> void CoupledCartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, int32_t motorPos[]) const;
+	template<size_t AxisA, size_t AxisB> void CoupledMotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, float machinePos[]) const;
 
 	// Primary parameters
 	FixedMatrix<float, MaxAxes, MaxAxes> inverseMatrix;		// maps coordinates to motor positions
@@ -39,6 +55,7 @@ private:
 	FixedMatrix<float, MaxAxes, MaxAxes> forwardMatrix;		// maps motor positions to coordinates
 	AxesBitmap connectedAxes[MaxAxes];						// which other axes are connected to each axis by shared motors etc.
 	bool modified;											// true if matrix has been altered
+	MatrixShape shape;										// which of the conversion functions we can use for this matrix
 	uint8_t firstMotor[MaxAxes], lastMotor[MaxAxes];		// first and last motor used by each axis
 	uint8_t firstAxis[MaxAxes], lastAxis[MaxAxes];			// first and last axis that each motor controls
 };
@@ -160,6 +160,75 @@ bool HangprinterKinematics::CartesianToMotorSteps(const float machinePos[], cons
 	return false;
 }
 
+// Convert a batch of Cartesian coordinates to motor coordinates, returning true if all of them were converted.
+// The anchor positions and steps/mm are fetched once for the whole batch instead of once per point.
+bool HangprinterKinematics::CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+														int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	const float ax = anchorA[X_AXIS], ay = anchorA[Y_AXIS], az = anchorA[Z_AXIS];
+	const float bx = anchorB[X_AXIS], by = anchorB[Y_AXIS], bz = anchorB[Z_AXIS];
+	const float cx = anchorC[X_AXIS], cy = anchorC[Y_AXIS], cz = anchorC[Z_AXIS];
+	const float dz = anchorDz;
+	const float aStepsPerMm = stepsPerMm[A_AXIS], bStepsPerMm = stepsPerMm[B_AXIS], cStepsPerMm = stepsPerMm[C_AXIS], dStepsPerMm = stepsPerMm[D_AXIS];
+	for (size_t i = 0; i < numPoints; ++i)
+	{
+		const float x = machinePos[i][X_AXIS], y = machinePos[i][Y_AXIS], z = machinePos[i][Z_AXIS];
+		const float aSquared = fsquare(az - z) + fsquare(ay - y) + fsquare(ax - x);
+		const float bSquared = fsquare(bz - z) + fsquare(by - y) + fsquare(bx - x);
+		const float cSquared = fsquare(cz - z) + fsquare(cy - y) + fsquare(cx - x);
+		const float dSquared = fsquare(x) + fsquare(y) + fsquare(dz - z);
+		if (!(aSquared > 0.0 && bSquared > 0.0 && cSquared > 0.0 && dSquared > 0.0))
+		{
+			return false;
+		}
+		motorPos[i][A_AXIS] = lrintf(sqrtf(aSquared) * aStepsPerMm);
+		motorPos[i][B_AXIS] = lrintf(sqrtf(bSquared) * bStepsPerMm);
+		motorPos[i][C_AXIS] = lrintf(sqrtf(cSquared) * cStepsPerMm);
+		motorPos[i][D_AXIS] = lrintf(sqrtf(dSquared) * dStepsPerMm);
+	}
+	return true;
+}
+
+// Convert equally spaced points along a straight line to motor coordinates, returning true if all of them were converted.
+// The squared length of each line is a quadratic function of the distance along the move, so we evaluate it by forward differences, which needs just two additions per line and point.
+// Over the few points of one move the rounding error this adds is far smaller than one step.
+bool HangprinterKinematics::CartesianToMotorStepsAlongLine(const float startPos[], const float endPos[], size_t numPoints, const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+															int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	const float anchors[HANGPRINTER_AXES][3] =
+	{
+		{ anchorA[X_AXIS], anchorA[Y_AXIS], anchorA[Z_AXIS] },
+		{ anchorB[X_AXIS], anchorB[Y_AXIS], anchorB[Z_AXIS] },
+		{ anchorC[X_AXIS], anchorC[Y_AXIS], anchorC[Z_AXIS] },
+		{ 0.0, 0.0, anchorDz }
+	};
+	const float scale = 1.0/(float)(numPoints + 1);
+	const float dx = (endPos[X_AXIS] - startPos[X_AXIS]) * scale, dy = (endPos[Y_AXIS] - startPos[Y_AXIS]) * scale, dz = (endPos[Z_AXIS] - startPos[Z_AXIS]) * scale;
+	const float secondDiff = 2.0 * (fsquare(dx) + fsquare(dy) + fsquare(dz));
+
+	for (size_t line = 0; line < HANGPRINTER_AXES; ++line)
+	{
+		// Vector from the anchor to the first point, which is one step along the line from the start
+		const float vx = startPos[X_AXIS] + dx - anchors[line][X_AXIS];
+		const float vy = startPos[Y_AXIS] + dy - anchors[line][Y_AXIS];
+		const float vz = startPos[Z_AXIS] + dz - anchors[line][Z_AXIS];
+		float lengthSquared = fsquare(vx) + fsquare(vy) + fsquare(vz);
+		float firstDiff = 2.0 * (vx * dx + vy * dy + vz * dz) + 0.5 * secondDiff;
+		const float lineStepsPerMm = stepsPerMm[line];
+		for (size_t i = 0; i < numPoints; ++i)
+		{
+			if (!(lengthSquared > 0.0))
+			{
+				return false;
+			}
+			motorPos[i][line] = lrintf(sqrtf(lengthSquared) * lineStepsPerMm);
+			lengthSquared += firstDiff;
+			firstDiff += secondDiff;
+		}
+	}
+	return true;
+}
+
 // Convert motor coordinates to machine coordinates. Used after homing and after individual motor moves.
 void HangprinterKinematics::MotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, float machinePos[]) const
 {
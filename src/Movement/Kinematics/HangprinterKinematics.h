@@ -13,6 +13,9 @@
 class HangprinterKinematics : public Kinematics
 {
 public:
+	void* operator new(size_t sz) { return Allocate<HangprinterKinematics>(); }
+	void operator delete(void* p) { Release<HangprinterKinematics>(p); }
+
 	// Constructors
 	HangprinterKinematics();
 
@@ -20,6 +23,10 @@ public:
 	const char *GetName(bool forStatusReport) const override;
 	bool Configure(unsigned int mCode, GCodeBuffer& gb, const StringRef& reply, bool& error) override;
 	bool CartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, int32_t motorPos[], bool isCoordinated) const override;
+	bool CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+										int32_t motorPos[][MaxAxes], bool isCoordinated) const override;
+	bool CartesianToMotorStepsAlongLine(const float startPos[], const float endPos[], size_t numPoints, const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+										int32_t motorPos[][MaxAxes], bool isCoordinated) const override;
 	void MotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, float machinePos[]) const override;
 	bool SupportsAutoCalibration() const override { return true; }
 	bool DoAutoCalibration(size_t numFactors, const RandomProbePointSet& probePoints, const StringRef& reply) override;
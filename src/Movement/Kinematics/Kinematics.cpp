@@ -23,10 +23,39 @@ const char * const Kinematics::HomeAllFileName = "homeall.g";
 
 // Constructor. Pass segsPerSecond <= 0.0 to get non-segmented kinematics.
 Kinematics::Kinematics(KinematicsType t, float segsPerSecond, float minSegLength, bool doUseRawG0)
-	: segmentsPerSecond(segsPerSecond), minSegmentLength(minSegLength), useSegmentation(segsPerSecond > 0.0), useRawG0(doUseRawG0), type(t)
+	: segmentsPerSecond(segsPerSecond), minSegmentLength(minSegLength), useSegmentation(segsPerSecond > 0.0), useRawG0(doUseRawG0),
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	  useSegmentFreeStreaming(false),
+#endif
+	  type(t)
 {
 }
 
+// Process the Q parameter of M669. Q1 asks for moves to be streamed to the motors without splitting them into DDA segments.
+// Builds that don't support segment-free streaming accept the Q parameter but ignore it.
+void Kinematics::TryConfigureSegmentFreeStreaming(GCodeBuffer& gb, bool& seen)
+{
+	if (gb.Seen('Q'))
+	{
+		seen = true;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+		useSegmentFreeStreaming = useSegmentation && gb.GetIValue() > 0;
+#else
+		(void)gb.GetIValue();
+#endif
+	}
+}
+
+// Return the text to include in the M669 report to say whether we are streaming segmented moves
+const char *Kinematics::GetSegmentFreeStreamingText() const
+{
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	return (useSegmentFreeStreaming) ? ", segment-free streaming" : "";
+#else
+	return "";
+#endif
+}
+
 // Set or report the parameters from a M665, M666 or M669 command
 // This is the fallback function for when the derived class doesn't use the specified M-code
 bool Kinematics::Configure(unsigned int mCode, GCodeBuffer& gb, const StringRef& reply, bool& error)
@@ -46,6 +75,42 @@ bool Kinematics::Configure(unsigned int mCode, GCodeBuffer& gb, const StringRef&
 	return false;
 }
 
+// Convert a batch of Cartesian positions to motor positions, returning true if all of them were converted
+// This default implementation just converts them one at a time
+bool Kinematics::CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+												int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	for (size_t i = 0; i < numPoints; ++i)
+	{
+		if (!CartesianToMotorSteps(machinePos[i], stepsPerMm, numVisibleAxes, numTotalAxes, motorPos[i], isCoordinated))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Convert equally spaced positions along a straight line to motor positions, returning true if all of them were converted
+// This default implementation converts each of them exactly
+bool Kinematics::CartesianToMotorStepsAlongLine(const float startPos[], const float endPos[], size_t numPoints, const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+												int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	for (size_t i = 0; i < numPoints; ++i)
+	{
+		const float fraction = (float)(i + 1)/(float)(numPoints + 1);
+		float pos[MaxAxes];
+		for (size_t axis = 0; axis < MaxAxes; ++axis)
+		{
+			pos[axis] = (axis < numVisibleAxes) ? startPos[axis] + (endPos[axis] - startPos[axis]) * fraction : 0.0;
+		}
+		if (!CartesianToMotorSteps(pos, stepsPerMm, numVisibleAxes, numTotalAxes, motorPos[i], isCoordinated))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 // Return true if the specified XY position is reachable by the print head reference point.
 // This default implementation assumes a rectangular reachable area, so it just uses the bed dimensions give in the M208 command.
 bool Kinematics::IsReachable(float x, float y, bool isCoordinated) const
@@ -10,6 +10,7 @@
 
 #include "RepRapFirmware.h"
 #include "Math/Matrix.h"
+#include "General/FreelistManager.h"
 
 inline floatc_t fcsquare(floatc_t a)
 {
@@ -89,6 +90,20 @@ public:
 	// Return true if successful, false if we were unable to convert
 	virtual bool CartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, int32_t motorPos[], bool isCoordinated) const = 0;
 
+	// Convert a batch of Cartesian positions to motor positions, for example the knots of a move whose sub-segments we stream to the motors
+	// 'machinePos' holds 'numPoints' sets of axis positions and 'motorPos' receives the corresponding sets of motor positions
+	// The default implementation converts the points one at a time. Kinematics with costly per-point setup override it to do that setup once.
+	// Return true if all the points were converted successfully
+	virtual bool CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+												int32_t motorPos[][MaxAxes], bool isCoordinated) const;
+
+	// Convert 'numPoints' equally spaced positions along the straight line from 'startPos' to 'endPos' to motor positions, excluding both ends of the line.
+	// Point i is at fraction (i + 1)/(numPoints + 1) of the way along. The end of the line is always converted exactly by a call to CartesianToMotorSteps,
+	// so kinematics that override this may evaluate the transform incrementally along the line, provided that the error stays well below one step.
+	// Return true if all the points were converted successfully
+	virtual bool CartesianToMotorStepsAlongLine(const float startPos[], const float endPos[], size_t numPoints, const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+												int32_t motorPos[][MaxAxes], bool isCoordinated) const;
+
 	// Convert motor positions (measured in steps from reference position) to Cartesian coordinates
 	// 'motorPos' is the input vector of motor positions
 	// 'stepsPerMm' is as configured in M92. On a Scara or polar machine this would actually be steps per degree.
@@ -105,6 +120,10 @@ public:
 	virtual bool DoAutoCalibration(size_t numFactors, const RandomProbePointSet& probePoints, const StringRef& reply)
 	pre(SupportsAutoCalibration()) { return false; }
 
+	// Return true if the last auto calibration wants another pass within the same G32, setting pointsToProbe to a bitmap of the probe points to probe again.
+	// The kinematics sets the heights of the other points itself. 'passesDone' is how many passes we have done in this G32.
+	virtual bool WantsAnotherCalibrationPass(unsigned int passesDone, uint32_t& pointsToProbe) { return false; }
+
 	// Set the default parameters that are changed by auto calibration back to their defaults.
 	// Do nothing if auto calibration is not supported.
 	virtual void SetCalibrationDefaults() { }
@@ -201,6 +220,9 @@ public:
 	bool UseRawG0() const { return useRawG0; }
 	float GetSegmentsPerSecond() const pre(UseSegmentation()) { return segmentsPerSecond; }
 	float GetMinSegmentLength() const pre(UseSegmentation()) { return minSegmentLength; }
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	bool UseSegmentFreeStreaming() const { return useSegmentFreeStreaming; }
+#endif
 
 protected:
 	// Constructor. Pass segsPerSecond <= 0.0 to get non-segmented motion.
@@ -210,6 +232,10 @@ protected:
 	// Return true if any coordinates were changed
 	bool LimitPositionFromAxis(float coords[], size_t firstAxis, size_t numVisibleAxes, AxesBitmap axesHomed) const;
 
+	// Process the Q parameter of M669, which selects whether segmented moves are streamed to the motors instead
+	void TryConfigureSegmentFreeStreaming(GCodeBuffer& gb, bool& seen);
+	const char *GetSegmentFreeStreamingText() const;
+
 	// Debugging functions
 	static void PrintMatrix(const char* s, const MathMatrix<float>& m, size_t numRows = 0, size_t maxCols = 0);
 	static void PrintMatrix(const char* s, const MathMatrix<double>& m, size_t numRows = 0, size_t maxCols = 0);
@@ -224,6 +250,9 @@ protected:
 private:
 	bool useSegmentation;					// true if we have to approximate linear movement using segmentation
 	bool useRawG0;							// true if we normally use segmentation but we do not need to segment travel moves
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	bool useSegmentFreeStreaming;			// true if the motor positions along segmented moves are calculated by the DriveMovement instead of by splitting the move
+#endif
 	KinematicsType type;
 };
 
@@ -426,14 +426,17 @@ bool LinearDeltaKinematics::DoAutoCalibration(size_t numFactors, const RandomPro
 	for (;;)
 	{
 		// Build a Nx9 matrix of derivatives with respect to xa, xb, yc, za, zb, zc, diagonal.
+		// The perturbed parameter sets are the same for every probe point, so set each one up just once.
 		FixedMatrix<floatc_t, MaxCalibrationPoints, NumDeltaFactors> derivativeMatrix;
-		for (size_t i = 0; i < numPoints; ++i)
+		for (size_t j = 0; j < numFactors; ++j)
 		{
-			for (size_t j = 0; j < numFactors; ++j)
+			const size_t adjustedJ = (numFactors == 8 && j >= 6) ? j + 1 : j;		// skip diagonal rod length if doing 8-factor calibration
+			LinearDeltaKinematics hiParams(*this), loParams(*this);
+			PerturbParameters(adjustedJ, hiParams, loParams);
+			for (size_t i = 0; i < numPoints; ++i)
 			{
-				const size_t adjustedJ = (numFactors == 8 && j >= 6) ? j + 1 : j;		// skip diagonal rod length if doing 8-factor calibration
 				const floatc_t d =
-					ComputeDerivative(adjustedJ, probeMotorPositions(i, DELTA_A_AXIS), probeMotorPositions(i, DELTA_B_AXIS), probeMotorPositions(i, DELTA_C_AXIS));
+					ComputeDerivative(adjustedJ, hiParams, loParams, probeMotorPositions(i, DELTA_A_AXIS), probeMotorPositions(i, DELTA_B_AXIS), probeMotorPositions(i, DELTA_C_AXIS));
 				if (isnan(d))			// a couple of users have reported getting Nans in the derivative, probably due to points being unreachable
 				{
 					reply.printf("Auto calibration failed because probe point P%u was unreachable using the current delta parameters. Try a smaller probing radius.", i);
@@ -448,18 +451,18 @@ bool LinearDeltaKinematics::DoAutoCalibration(size_t numFactors, const RandomPro
 			PrintMatrix("Derivative matrix", derivativeMatrix, numPoints, numFactors);
 		}
 
-		// Now build the normal equations for least squares fitting
+		// Now build the normal equations for least squares fitting. The matrix is symmetrical, so we only need to calculate half of it.
 		FixedMatrix<floatc_t, NumDeltaFactors, NumDeltaFactors + 1> normalMatrix;
 		for (size_t i = 0; i < numFactors; ++i)
 		{
-			for (size_t j = 0; j < numFactors; ++j)
+			for (size_t j = i; j < numFactors; ++j)
 			{
 				floatc_t temp = derivativeMatrix(0, i) * derivativeMatrix(0, j);
 				for (size_t k = 1; k < numPoints; ++k)
 				{
 					temp += derivativeMatrix(k, i) * derivativeMatrix(k, j);
 				}
-				normalMatrix(i, j) = temp;
+				normalMatrix(i, j) = normalMatrix(j, i) = temp;
 			}
 			floatc_t temp = derivativeMatrix(0, i) * -((floatc_t)probePoints.GetZHeight(0) + corrections[0]);
 			for (size_t k = 1; k < numPoints; ++k)
@@ -583,18 +586,18 @@ MotionType LinearDeltaKinematics::GetMotionType(size_t axis) const
 	return (axis < numTowers) ? MotionType::segmentFreeDelta : MotionType::linear;
 }
 
-// Compute the derivative of height with respect to a parameter at the specified motor endpoints.
-// 'deriv' indicates the parameter as follows:
+// Set up the parameter sets used to compute the derivative of height with respect to a parameter, by perturbing it up and down.
+// On entry, hiParams and loParams are copies of the current parameters. 'deriv' indicates the parameter as follows:
 // 0, 1, 2 = X, Y, Z tower endstop adjustments
 // 3 = delta radius
 // 4 = X tower correction
 // 5 = Y tower correction
 // 6 = diagonal rod length
-// 7, 8 = X tilt, Y tilt. We scale these by the printable radius to get sensible values in the range -1..1
-floatc_t LinearDeltaKinematics::ComputeDerivative(unsigned int deriv, float ha, float hb, float hc) const
+// 7, 8 = X tilt, Y tilt
+// The endstop adjustments and tilts are perturbed when we compute the derivative, so they don't need different parameter sets.
+/*static*/ void LinearDeltaKinematics::PerturbParameters(unsigned int deriv, LinearDeltaKinematics& hiParams, LinearDeltaKinematics& loParams)
 {
-	const float perturb = 0.2;			// perturbation amount in mm or degrees
-	LinearDeltaKinematics hiParams(*this), loParams(*this);
+	const float perturb = DerivativePerturbation;
 	switch(deriv)
 	{
 	case 0:
@@ -639,7 +642,13 @@ floatc_t LinearDeltaKinematics::ComputeDerivative(unsigned int deriv, float ha,
 		// X and Y tilt
 		break;
 	}
+}
 
+// Compute the derivative of height with respect to a parameter at the specified motor endpoints, using the parameter sets set up by PerturbParameters.
+// X and Y tilt are scaled by the printable radius to get sensible values in the range -1..1
+floatc_t LinearDeltaKinematics::ComputeDerivative(unsigned int deriv, const LinearDeltaKinematics& hiParams, const LinearDeltaKinematics& loParams, float ha, float hb, float hc) const
+{
+	const float perturb = DerivativePerturbation;
 	float newPos[XYZ_AXES];
 	hiParams.ForwardTransform((deriv == 0) ? ha + perturb : ha, (deriv == 1) ? hb + perturb : hb, (deriv == 2) ? hc + perturb : hc, newPos);
 	if (deriv == 7)
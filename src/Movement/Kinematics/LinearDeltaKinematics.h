@@ -15,6 +15,9 @@
 class LinearDeltaKinematics : public Kinematics
 {
 public:
+	void* operator new(size_t sz) { return Allocate<LinearDeltaKinematics>(); }
+	void operator delete(void* p) { Release<LinearDeltaKinematics>(p); }
+
 	// Constructors
 	LinearDeltaKinematics();
 
@@ -56,11 +59,14 @@ private:
     float Transform(const float headPos[], size_t axis) const;						// Calculate the motor position for a single tower from a Cartesian coordinate
     void ForwardTransform(float Ha, float Hb, float Hc, float headPos[XYZ_AXES]) const;	// Calculate the Cartesian position from the motor positions
 
-	floatc_t ComputeDerivative(unsigned int deriv, float ha, float hb, float hc) const;	// Compute the derivative of height with respect to a parameter at a set of motor endpoints
+	static void PerturbParameters(unsigned int deriv, LinearDeltaKinematics& hiParams, LinearDeltaKinematics& loParams);	// Perturb a parameter in both directions
+	floatc_t ComputeDerivative(unsigned int deriv, const LinearDeltaKinematics& hiParams, const LinearDeltaKinematics& loParams, float ha, float hb, float hc) const;
+																					// Compute the derivative of height with respect to a parameter at a set of motor endpoints
 	void Adjust(size_t numFactors, const floatc_t v[]);								// Perform 3-, 4-, 6- or 7-factor adjustment
 	void PrintParameters(const StringRef& reply) const;								// Print all the parameters for debugging
 
 	static constexpr size_t MaxTowers = 6;				// maximum number of delta towers
+	static constexpr float DerivativePerturbation = 0.2;	// perturbation amount in mm or degrees used to calculate derivatives
 	static constexpr size_t UsualNumTowers = 3;			// the usual number of towers, which are the ones we use for forward kinematics and the ones we calibrate
 
 	// Axis names used internally
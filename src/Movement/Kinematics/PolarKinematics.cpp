@@ -107,6 +107,65 @@ bool PolarKinematics::CartesianToMotorSteps(const float machinePos[], const floa
 	return true;
 }
 
+// Convert equally spaced points along a straight line to motor coordinates, returning true if all of them were converted.
+// The squared radius is a quadratic function of the distance along the move, so we evaluate it by forward differences.
+// The angle turned between consecutive points has a tangent of (cross product)/(dot product) of their position vectors, and the cross product is the same for every pair.
+// So we compute the angle of the first point exactly and add the small angles using a short series for atan, which is much faster than calling atan2f at every point.
+// If the angle between points is too large for the series to be accurate, we fall back to atan2f for that point.
+bool PolarKinematics::CartesianToMotorStepsAlongLine(const float startPos[], const float endPos[], size_t numPoints, const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+														int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	constexpr float MaxSeriesTangent = 0.2;				// the series error for tangents up to this is below 1e-7 radians per point
+	const float scale = 1.0/(float)(numPoints + 1);
+	const float dx = (endPos[X_AXIS] - startPos[X_AXIS]) * scale, dy = (endPos[Y_AXIS] - startPos[Y_AXIS]) * scale;
+	const float secondDiff = 2.0 * (fsquare(dx) + fsquare(dy));
+	const float crossProduct = startPos[X_AXIS] * dy - startPos[Y_AXIS] * dx;
+
+	float x = startPos[X_AXIS] + dx, y = startPos[Y_AXIS] + dy;
+	float radiusSquared = fsquare(x) + fsquare(y);
+	float firstDiff = 2.0 * (x * dx + y * dy) + 0.5 * secondDiff;
+	float angle = atan2f(y, x);
+	for (size_t i = 0; i < numPoints; ++i)
+	{
+		if (i != 0)
+		{
+			// The dot product of the previous position vector (x - dx, y - dy) with this one (x, y)
+			const float dotProduct = radiusSquared - (x * dx + y * dy);
+			const float t = (dotProduct > 0.0) ? crossProduct/dotProduct : MaxSeriesTangent;
+			if (fabsf(t) < MaxSeriesTangent)
+			{
+				const float t2 = fsquare(t);
+				angle += t * (1.0 - t2 * (1.0/3.0 - t2 * (1.0/5.0 - t2 * (1.0/7.0))));
+				if (angle > Pi)
+				{
+					angle -= TwoPi;
+				}
+				else if (angle <= -Pi)
+				{
+					angle += TwoPi;
+				}
+			}
+			else
+			{
+				angle = atan2f(y, x);
+			}
+		}
+
+		motorPos[i][0] = lrintf(sqrtf(max<float>(radiusSquared, 0.0)) * stepsPerMm[0]);
+		motorPos[i][1] = (motorPos[i][0] == 0) ? 0 : lrintf(angle * RadiansToDegrees * stepsPerMm[1]);
+		for (size_t axis = Z_AXIS; axis < numVisibleAxes; ++axis)
+		{
+			motorPos[i][axis] = lrintf((startPos[axis] + (endPos[axis] - startPos[axis]) * (float)(i + 1) * scale) * stepsPerMm[axis]);
+		}
+
+		x += dx;
+		y += dy;
+		radiusSquared += firstDiff;
+		firstDiff += secondDiff;
+	}
+	return true;
+}
+
 // Convert motor positions (measured in steps from reference position) to Cartesian coordinates
 // 'motorPos' is the input vector of motor positions
 // 'stepsPerMm' is as configured in M92. On a Scara or polar machine this would actually be steps per degree.
@@ -121,22 +121,26 @@ bool RotaryDeltaKinematics::Configure(unsigned int mCode, GCodeBuffer& gb, const
 			gb.TryGetFValue('Y', angleCorrections[DELTA_B_AXIS], seen);
 			gb.TryGetFValue('Z', angleCorrections[DELTA_C_AXIS], seen);
 
+			bool seenNonGeometry = false;
+			TryConfigureSegmentFreeStreaming(gb, seenNonGeometry);
+
 			if (seen)
 			{
 				Recalc();
 			}
-			else
+			else if (!seenNonGeometry)
 			{
 				reply.printf("Kinematics is rotary delta, arms (%.3f,%.2f,%.3f)mm, rods (%.3f,%.3f,%.3f)mm, bearingHeights (%.3f,%.2f,%.3f)mm"
 							 ", arm movement %.1f to %.1f" DEGREE_SYMBOL
 							 ", delta radius %.3f, bed radius %.1f"
-							 ", angle corrections (%.3f,%.3f,%.3f)" DEGREE_SYMBOL ,
+							 ", angle corrections (%.3f,%.3f,%.3f)" DEGREE_SYMBOL "%s",
 							 (double)armLengths[DELTA_A_AXIS], (double)armLengths[DELTA_B_AXIS], (double)armLengths[DELTA_C_AXIS],
 							 (double)rodLengths[DELTA_A_AXIS], (double)rodLengths[DELTA_B_AXIS], (double)rodLengths[DELTA_C_AXIS],
 							 (double)bearingHeights[DELTA_A_AXIS], (double)bearingHeights[DELTA_B_AXIS], (double)bearingHeights[DELTA_C_AXIS],
 							 (double)minArmAngle, (double)maxArmAngle,
 							 (double)radius, (double)printRadius,
-							 (double)angleCorrections[DELTA_A_AXIS], (double)angleCorrections[DELTA_B_AXIS], (double)angleCorrections[DELTA_C_AXIS]);
+							 (double)angleCorrections[DELTA_A_AXIS], (double)angleCorrections[DELTA_B_AXIS], (double)angleCorrections[DELTA_C_AXIS],
+							 GetSegmentFreeStreamingText());
 			}
 			return seen;
 		}
@@ -200,6 +204,50 @@ bool RotaryDeltaKinematics::CartesianToMotorSteps(const float machinePos[], cons
 	return ok;
 }
 
+// Convert a batch of Cartesian positions to motor positions, returning true if all of them were converted.
+// We work through the points one tower at a time, so that the constants for that tower are fetched once and the arm angle sine and cosine are reused for every point.
+bool RotaryDeltaKinematics::CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes,
+														int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	for (size_t axis = 0; axis < min<size_t>(numVisibleAxes, DELTA_AXES); ++axis)
+	{
+		const float cosine = armAngleCosines[axis];
+		const float sine = armAngleSines[axis];
+		const float u2 = twiceU[axis];
+		const float bearingHeight = bearingHeights[axis];
+		const float rodArmDifference = rodSquaredMinusArmSquared[axis];
+		const float axisStepsPerDegree = stepsPerMm[axis];
+		for (size_t i = 0; i < numPoints; ++i)
+		{
+			// This is the same calculation as in Transform
+			const float x = machinePos[i][X_AXIS] * cosine + machinePos[i][Y_AXIS] * sine;
+			const float y = machinePos[i][Y_AXIS] * cosine - machinePos[i][X_AXIS] * sine;
+			const float rMinusX = radius - x;
+			const float hMinusZ = bearingHeight - machinePos[i][Z_AXIS];
+			const float a = u2 * rMinusX;
+			const float b = u2 * hMinusZ;
+			const float c = rodArmDifference - (fsquare(hMinusZ) + fsquare(rMinusX) + fsquare(y));
+			const float pos = asinf((b * c - a * sqrtf(fsquare(a) + fsquare(b) - fsquare(c)))/(fsquare(a) + fsquare(b))) * RadiansToDegrees;
+			if (isnan(pos) || isinf(pos))
+			{
+				return false;
+			}
+			motorPos[i][axis] = lrintf(pos * axisStepsPerDegree);
+		}
+	}
+
+	// Transform any additional axes linearly
+	for (size_t axis = DELTA_AXES; axis < numVisibleAxes; ++axis)
+	{
+		const float axisStepsPerMm = stepsPerMm[axis];
+		for (size_t i = 0; i < numPoints; ++i)
+		{
+			motorPos[i][axis] = lrintf(machinePos[i][axis] * axisStepsPerMm);
+		}
+	}
+	return true;
+}
+
 // Convert motor positions (measured in steps from reference position) to Cartesian coordinates
 // 'motorPos' is the input vector of motor positions
 // 'stepsPerMm' is as configured in M92. On a Scara or polar machine this would actually be steps per degree.
@@ -22,6 +22,9 @@
 class ScaraKinematics : public ZLeadscrewKinematics
 {
 public:
+	void* operator new(size_t sz) { return Allocate<ScaraKinematics>(); }
+	void operator delete(void* p) { Release<ScaraKinematics>(p); }
+
 	// Constructors
 	ScaraKinematics();
 
@@ -15,13 +15,17 @@
 
 const float M3ScrewPitch = 0.5;
 
+const uint32_t DefaultMaxCalibrationPasses = 5;
+
 ZLeadscrewKinematics::ZLeadscrewKinematics(KinematicsType k)
-	: Kinematics(k, -1.0, 0.0, true), numLeadscrews(0), correctionFactor(1.0), maxCorrection(1.0), screwPitch(M3ScrewPitch)
+	: Kinematics(k, -1.0, 0.0, true), numLeadscrews(0), correctionFactor(1.0), maxCorrection(1.0), screwPitch(M3ScrewPitch),
+	  targetDeviation(0.0), maxCalibrationPasses(DefaultMaxCalibrationPasses), pointsOutOfTolerance(0), numPredictedPoints(0), wantAnotherPass(false)
 {
 }
 
 ZLeadscrewKinematics::ZLeadscrewKinematics(KinematicsType k, float segsPerSecond, float minSegLength, bool doUseRawG0)
-	: Kinematics(k, segsPerSecond, minSegLength, doUseRawG0), numLeadscrews(0), correctionFactor(1.0), maxCorrection(1.0), screwPitch(M3ScrewPitch)
+	: Kinematics(k, segsPerSecond, minSegLength, doUseRawG0), numLeadscrews(0), correctionFactor(1.0), maxCorrection(1.0), screwPitch(M3ScrewPitch),
+	  targetDeviation(0.0), maxCalibrationPasses(DefaultMaxCalibrationPasses), pointsOutOfTolerance(0), numPredictedPoints(0), wantAnotherPass(false)
 {
 }
 
@@ -50,6 +54,9 @@ bool ZLeadscrewKinematics::Configure(unsigned int mCode, GCodeBuffer& gb, const
 		gb.TryGetFValue('S', maxCorrection, seenPFS);
 		gb.TryGetFValue('P', screwPitch, seenPFS);
 		gb.TryGetFValue('F', correctionFactor, seenPFS);
+		gb.TryGetFValue('T', targetDeviation, seenPFS);
+		gb.TryGetUIValue('N', maxCalibrationPasses, seenPFS);
+		maxCalibrationPasses = constrain<uint32_t>(maxCalibrationPasses, 1, 20);
 
 		if (seenX && seenY && xSize == ySize)
 		{
@@ -80,6 +87,10 @@ bool ZLeadscrewKinematics::Configure(unsigned int mCode, GCodeBuffer& gb, const
 				reply.catf(" (%.1f,%.1f)", (double)leadscrewX[i], (double)leadscrewY[i]);
 			}
 			reply.catf(", factor %.02f, maximum correction %.02fmm, manual adjusting screw pitch %.02fmm", (double)correctionFactor, (double)maxCorrection, (double)screwPitch);
+			if (targetDeviation > 0.0)
+			{
+				reply.catf(", target deviation %.3fmm in up to %" PRIu32 " passes", (double)targetDeviation, maxCalibrationPasses);
+			}
 		}
 		return false;
 	}
@@ -95,6 +106,7 @@ bool ZLeadscrewKinematics::SupportsAutoCalibration() const
 // Perform auto calibration, returning true if failed. Override this implementation in kinematics that support it. Caller already owns the GCode movement lock.
 bool ZLeadscrewKinematics::DoAutoCalibration(size_t numFactors, const RandomProbePointSet& probePoints, const StringRef& reply)
 {
+	wantAnotherPass = false;
 	if (!SupportsAutoCalibration())			// should be checked by caller, but check it here too
 	{
 		return false;
@@ -306,8 +318,31 @@ bool ZLeadscrewKinematics::DoAutoCalibration(size_t numFactors, const RandomProb
 				reprap.GetMove().AdjustLeadscrews(solution);
 				reply.printf("Leadscrew adjustments made:");
 				AppendCorrections(solution, reply);
+				const float deviationBefore = sqrtf((float)initialSumOfSquares/numPoints);
 				reply.catf(", points used %d, deviation before %.3f after %.3f",
-							numPoints, (double)sqrtf((float)initialSumOfSquares/numPoints), (double)sqrtf((float)sumOfSquares/numPoints));
+							numPoints, (double)deviationBefore, (double)sqrtf((float)sumOfSquares/numPoints));
+
+				// If we have a target deviation and haven't reached it, work out the heights we expect after the adjustment so that G32 can probe again just the points that are still out of tolerance.
+				// We use the scaled corrections that we actually applied, so this allows for a correction factor other than 1.
+				if (targetDeviation > 0.0 && deviationBefore > targetDeviation)
+				{
+					pointsOutOfTolerance = 0;
+					for (size_t i = 0; i < numPoints; ++i)
+					{
+						floatc_t predictedHeight = probePoints.GetZHeight(i);
+						for (size_t j = 0; j < numFactors; ++j)
+						{
+							predictedHeight += solution[j] * derivativeMatrix(i, j);
+						}
+						predictedHeights[i] = (float)predictedHeight;
+						if (fabsf(predictedHeights[i]) > targetDeviation)
+						{
+							SetBit(pointsOutOfTolerance, i);
+						}
+					}
+					numPredictedPoints = numPoints;
+					wantAnotherPass = (pointsOutOfTolerance != 0);
+				}
 			}
 		}
 		else
@@ -326,6 +361,28 @@ bool ZLeadscrewKinematics::DoAutoCalibration(size_t numFactors, const RandomProb
 	return failed;
 }
 
+// Return true if we want G32 to make another adjustment, setting pointsToProbe to the points that were still predicted to be out of tolerance.
+// We give the other points the heights that we predicted for them, so that the next adjustment is calculated from a complete set of points.
+bool ZLeadscrewKinematics::WantsAnotherCalibrationPass(unsigned int passesDone, uint32_t& pointsToProbe)
+{
+	if (!wantAnotherPass || passesDone >= maxCalibrationPasses)
+	{
+		wantAnotherPass = false;
+		return false;
+	}
+
+	wantAnotherPass = false;
+	for (size_t i = 0; i < numPredictedPoints; ++i)
+	{
+		if (!IsBitSet(pointsOutOfTolerance, i))
+		{
+			reprap.GetMove().SetZBedProbePoint(i, predictedHeights[i], true, false);
+		}
+	}
+	pointsToProbe = pointsOutOfTolerance;
+	return true;
+}
+
 // Append the list of leadscrew corrections to 'reply'
 void ZLeadscrewKinematics::AppendCorrections(const floatc_t corrections[], const StringRef& reply) const
 {
@@ -21,6 +21,7 @@ public:
 	bool Configure(unsigned int mCode, GCodeBuffer& gb, const StringRef& reply, bool& error) override;
 	bool SupportsAutoCalibration() const override;
 	bool DoAutoCalibration(size_t numFactors, const RandomProbePointSet& probePoints, const StringRef& reply) override;
+	bool WantsAnotherCalibrationPass(unsigned int passesDone, uint32_t& pointsToProbe) override;
 	bool WriteResumeSettings(FileStore *f) const override;
 
 private:
@@ -33,6 +34,14 @@ private:
 	float correctionFactor;
 	float maxCorrection;
 	float screwPitch;
+	float targetDeviation;									// if nonzero, G32 repeats the adjustment until the deviation is no more than this (M671 T)
+	uint32_t maxCalibrationPasses;							// the most adjustments that G32 makes when targetDeviation is set (M671 N)
+
+	// The results of the last auto calibration, used if we do another pass
+	float predictedHeights[MaxCalibrationPoints];			// the heights we expect at the probe points after the adjustment
+	uint32_t pointsOutOfTolerance;							// bitmap of the points whose predicted heights are outside the target deviation
+	size_t numPredictedPoints;
+	bool wantAnotherPass;
 };
 
 #endif /* SRC_MOVEMENT_KINEMATICS_ZLEADSCREWKINEMATICS_H_ */
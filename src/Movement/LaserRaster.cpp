@@ -0,0 +1,113 @@
+/*
+ * LaserRaster.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "LaserRaster.h"
+
+#if SUPPORT_LASER
+
+#include "Move.h"
+#include "Platform.h"
+#include "Tasks.h"
+
+// Static members
+
+LaserRaster *LaserRaster::freeList = nullptr;
+unsigned int LaserRaster::numFree = 0;
+unsigned int LaserRaster::numAllocated = 0;
+unsigned int LaserRaster::maxAllocated = 0;
+uint32_t LaserRaster::allocationFailures = 0;
+
+/*static*/ void LaserRaster::InitialAllocate(unsigned int num, unsigned int maxNum)
+{
+	while (num != 0)
+	{
+		freeList = new LaserRaster(freeList);
+		++numFree;
+		++numAllocated;
+		--num;
+	}
+	maxAllocated = max<unsigned int>(maxNum, numAllocated);
+}
+
+// Return true if we can allocate a raster. If none are in use then we return true anyway, so that we never stop accepting new moves for lack of a raster.
+/*static*/ bool LaserRaster::IsAvailable()
+{
+	return freeList != nullptr
+		|| numFree == numAllocated
+		|| (numAllocated < maxAllocated && Tasks::GetNeverUsedRam() >= sizeof(LaserRaster) + MinRamToLeave);
+}
+
+// Allocate a raster. This is only called from the Move task, so it may allocate more memory.
+/*static*/ LaserRaster *LaserRaster::Allocate()
+{
+	if (freeList == nullptr)
+	{
+		if (numAllocated >= maxAllocated || Tasks::GetNeverUsedRam() < sizeof(LaserRaster) + MinRamToLeave)
+		{
+			++allocationFailures;
+			return nullptr;
+		}
+		freeList = new LaserRaster(freeList);
+		++numFree;
+		++numAllocated;
+	}
+
+	LaserRaster * const ret = freeList;
+	freeList = ret->next;
+	--numFree;
+	ret->next = nullptr;
+	ret->numPixels = 0;
+	return ret;
+}
+
+/*static*/ void LaserRaster::Release(LaserRaster *item)
+{
+	item->next = freeList;
+	freeList = item;
+	++numFree;
+}
+
+/*static*/ uint32_t LaserRaster::GetAndClearAllocationFailures()
+{
+	const uint32_t ret = allocationFailures;
+	allocationFailures = 0;
+	return ret;
+}
+
+void LaserRaster::SetPixels(const Pwm_t pwm[], size_t num)
+{
+	numPixels = min<size_t>(num, MaxPixels);
+	memcpy(pixels, pwm, numPixels * sizeof(pixels[0]));
+	nextPixel = numPixels;
+}
+
+void LaserRaster::ScalePixels(float factor)
+{
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		pixels[i] = (Pwm_t)(pixels[i] * factor);
+	}
+}
+
+// Set the laser power if the head has reached the start of one or more new pixels
+void LaserRaster::Update(Platform& p, uint32_t elapsedClocks)
+{
+	size_t n = nextPixel;
+	if (n < numPixels && elapsedClocks >= pixelStartClocks[n])
+	{
+		do
+		{
+			++n;
+		} while (n < numPixels && elapsedClocks >= pixelStartClocks[n]);
+		nextPixel = n;
+		p.SetLaserPwm(pixels[n - 1]);
+	}
+}
+
+#endif
+
+// End
@@ -0,0 +1,60 @@
+/*
+ * LaserRaster.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_LASERRASTER_H_
+#define SRC_MOVEMENT_LASERRASTER_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_LASER
+
+// Class to hold the laser PWM values of a raster move, which is a straight move along which the laser power changes at evenly spaced positions.
+// The step ISR changes the laser power when the head reaches the start of each pixel, so a whole line of an engraving can be done by a single DDA.
+// Rasters are only needed from when a move is added to the ring until it completes, so they are kept in a pool that grows on demand. Only the Move task allocates and releases them.
+class LaserRaster
+{
+public:
+	static constexpr size_t MaxPixels = MaxLaserRasterPixels;
+
+	static void InitialAllocate(unsigned int num, unsigned int maxNum);
+	static LaserRaster *Allocate();								// allocate a raster if we can, returning nullptr if we are out of memory or at the limit
+	static void Release(LaserRaster *item);
+	static bool IsAvailable();									// return true if we can allocate a raster, or none are in use
+	static unsigned int NumAllocated() { return numAllocated; }
+	static unsigned int NumInUse() { return numAllocated - numFree; }
+	static uint32_t GetAndClearAllocationFailures();
+
+	void SetPixels(const Pwm_t pwm[], size_t num);
+	void ScalePixels(float factor);								// scale the laser power, e.g. because the move is slower than requested
+	size_t GetNumPixels() const { return numPixels; }
+	Pwm_t GetPixel(size_t n) const { return pixels[n]; }
+	void SetPixelStartClocks(size_t n, uint32_t clocks) { pixelStartClocks[n] = clocks; }	// n must be at least 1
+	void Start() { nextPixel = 1; }								// called when the move is prepared, because the first pixel is set up by DDA::Start
+
+	// Functions called by the step ISR
+	uint32_t GetNextChangeClocks() const { return (nextPixel < numPixels) ? pixelStartClocks[nextPixel] : UINT32_MAX; }
+	void Update(Platform& p, uint32_t elapsedClocks) __attribute__ ((hot));
+
+private:
+	LaserRaster(LaserRaster *n) : next(n), numPixels(0), nextPixel(0) { }
+
+	static LaserRaster *freeList;
+	static unsigned int numFree;
+	static unsigned int numAllocated;							// how many rasters we have allocated
+	static unsigned int maxAllocated;							// the most rasters we may allocate
+	static uint32_t allocationFailures;
+
+	LaserRaster *next;
+	size_t numPixels;
+	size_t nextPixel;											// the next pixel whose power we need to set
+	Pwm_t pixels[MaxPixels];
+	uint32_t pixelStartClocks[MaxPixels];						// the time after the start of the move at which we reach each pixel except the first
+};
+
+#endif
+
+#endif /* SRC_MOVEMENT_LASERRASTER_H_ */
@@ -0,0 +1,244 @@
+/*
+ * MotionProfile.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "MotionProfile.h"
+
+#if HAS_MOTION_PROFILES
+
+#include "Move.h"
+#include "StepTimer.h"
+#include "Tasks.h"
+
+// Static members
+
+MotionProfile *MotionProfile::freeList = nullptr;
+unsigned int MotionProfile::numFree = 0;
+unsigned int MotionProfile::numAllocated = 0;
+unsigned int MotionProfile::maxAllocated = 0;
+
+/*static*/ void MotionProfile::InitialAllocate(unsigned int num, unsigned int maxNum)
+{
+	while (num != 0)
+	{
+		freeList = new MotionProfile(freeList);
+		++numFree;
+		++numAllocated;
+		--num;
+	}
+	maxAllocated = max<unsigned int>(maxNum, numAllocated);
+}
+
+// Allocate a profile. This is only called from the Move task when preparing a move, so it may allocate more memory.
+/*static*/ MotionProfile *MotionProfile::Allocate()
+{
+	if (freeList == nullptr)
+	{
+		if (numAllocated >= maxAllocated || Tasks::GetNeverUsedRam() < sizeof(MotionProfile) + MinRamToLeave)
+		{
+			return nullptr;
+		}
+		freeList = new MotionProfile(freeList);
+		++numFree;
+		++numAllocated;
+	}
+
+	MotionProfile * const ret = freeList;
+	freeList = ret->next;
+	--numFree;
+	ret->next = nullptr;
+	ret->Clear();
+	return ret;
+}
+
+/*static*/ void MotionProfile::Release(MotionProfile *item)
+{
+	item->next = freeList;
+	freeList = item;
+	++numFree;
+}
+
+// Fill in the segments of a move that changes speed from startSpeed to topSpeed in accelClocks, stays at topSpeed for steadyClocks, then changes speed to endSpeed in decelClocks.
+// If a jerk is nonzero then the corresponding speed change is a jerk-limited S-curve whose acceleration rises from zero and falls back to zero.
+// The S-curve is symmetrical, so it takes the same time and covers the same distance as the trapezoidal speed change. The jerk must be at least 4 * speed change/time^2.
+// Speeds are in mm per step clock and jerks in mm per step clock cubed. Return the number of segments.
+/*static*/ size_t MotionProfile::MakeMoveSegments(MotionSegment segs[], float startSpeed, float topSpeed, float endSpeed,
+													float accelClocks, float steadyClocks, float decelClocks, float accelJerk, float decelJerk)
+{
+	size_t num = 0;
+	float clocks = 0.0, distance = 0.0, speed = startSpeed;
+	const auto addSegment = [segs, &num, &clocks, &distance, &speed](float duration, float accel, float jerk)
+	{
+		if (duration > 0.0)
+		{
+			MotionSegment& seg = segs[num++];
+			seg.startClocks = clocks;
+			seg.startDistance = distance;
+			seg.startSpeed = speed;
+			seg.acceleration = accel;
+			seg.jerk = jerk;
+			clocks += duration;
+			distance = seg.DistanceAt(clocks);
+			speed = seg.SpeedAt(clocks);
+		}
+	};
+	const auto addSpeedChange = [&addSegment](float duration, float speedChange, float jerk)
+	{
+		if (jerk > 0.0 && duration > 0.0)
+		{
+			// The acceleration rises at the jerk limit for jerkClocks, stays constant, then falls at the jerk limit for jerkClocks.
+			// So speedChange = jerk * jerkClocks * (duration - jerkClocks).
+			const float sign = (speedChange >= 0.0) ? 1.0 : -1.0;
+			const float jerkClocks = 0.5 * (duration - sqrtf(max<float>(fsquare(duration) - 4.0 * fabsf(speedChange)/jerk, 0.0)));
+			const float peakAcceleration = sign * jerk * jerkClocks;
+			addSegment(jerkClocks, 0.0, sign * jerk);
+			addSegment(duration - 2 * jerkClocks, peakAcceleration, 0.0);
+			addSegment(jerkClocks, peakAcceleration, -sign * jerk);
+		}
+		else
+		{
+			addSegment(duration, (duration > 0.0) ? speedChange/duration : 0.0, 0.0);
+		}
+	};
+
+	addSpeedChange(accelClocks, topSpeed - startSpeed, accelJerk);
+	addSegment(steadyClocks, 0.0, 0.0);
+	addSpeedChange(decelClocks, endSpeed - topSpeed, decelJerk);
+	return num;
+}
+
+// Append a segment to the profile
+bool MotionProfile::AddSegment(float startClocks, float startDistance, float startSpeed, float acceleration, float jerk)
+{
+	if (numSegments == MaxSegments)
+	{
+		return false;
+	}
+	MotionSegment& seg = segments[numSegments++];
+	seg.startClocks = startClocks;
+	seg.startDistance = startDistance;
+	seg.startSpeed = startSpeed;
+	seg.acceleration = acceleration;
+	seg.jerk = jerk;
+	return true;
+}
+
+// Return the time after the start of a segment at which b*t + (a/2)t^2 + (j/6)t^3 reaches 'distance', which must be positive. The function must be increasing.
+// If it doesn't reach the distance before maxClocks, which can happen due to rounding error at the end of the move, return maxClocks.
+/*static*/ float MotionProfile::SolveSegment(float b, float a, float j, float distance, float maxClocks)
+{
+	// Start with the solution ignoring the jerk, using the form that doesn't lose precision when a is small or negative
+	const float discriminant = fsquare(b) + 2 * a * distance;
+	const float denominator = (discriminant > 0.0) ? b + sqrtf(discriminant) : b;
+	float t = (denominator > 0.0) ? min<float>((2 * distance)/denominator, maxClocks) : maxClocks;
+	if (j != 0.0)
+	{
+		// Refine it by Newton-Raphson iteration. The segments are short enough that a few iterations are plenty.
+		for (unsigned int i = 0; i < 4; ++i)
+		{
+			const float speed = b + (a + j * t * 0.5) * t;
+			if (speed <= 0.0)
+			{
+				break;
+			}
+			const float error = (b + (a * 0.5 + j * t * (1.0/6.0)) * t) * t - distance;
+			t = constrain<float>(t - error/speed, 0.0, maxClocks);
+		}
+	}
+	return t;
+}
+
+// Return the time at which the advanced distance first reaches the requested value
+uint32_t MotionProfile::DistanceToTime(float distance, float advanceClocks) const
+pre(numSegments != 0)
+{
+	// Find the last segment that starts at or before the requested distance
+	const float initialSpeed = segments[0].startSpeed;
+	size_t low = 0, high = numSegments;
+	while (high - low > 1)
+	{
+		const size_t mid = (low + high)/2;
+		if (segments[mid].startDistance + advanceClocks * (segments[mid].startSpeed - initialSpeed) <= distance)
+		{
+			low = mid;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	const MotionSegment& seg = segments[low];
+	const float distanceIntoSegment = distance - (seg.startDistance + advanceClocks * (seg.startSpeed - initialSpeed));
+	const float t = (distanceIntoSegment <= 0.0)
+					? seg.startClocks
+						: seg.startClocks + SolveSegment(seg.startSpeed + advanceClocks * seg.acceleration, seg.acceleration + advanceClocks * seg.jerk, seg.jerk,
+														distanceIntoSegment, GetSegmentEndClocks(low) - seg.startClocks);
+	return (uint32_t)(t + 0.5);
+}
+
+// Return the time in step clocks at which the distance reaches the requested value during segment n.
+// The distance must not change direction during the segment, and 'rising' says which way it is going.
+float MotionProfile::SolveInSegment(size_t n, float distance, bool rising) const
+pre(n < numSegments)
+{
+	const MotionSegment& seg = segments[n];
+
+	// If the distance is falling then negate everything, so that we can use the same solution as for rising distances
+	const float sign = (rising) ? 1.0 : -1.0;
+	const float distanceIntoSegment = (distance - seg.startDistance) * sign;
+	return (distanceIntoSegment <= 0.0)
+			? seg.startClocks
+				: seg.startClocks + SolveSegment(seg.startSpeed * sign, seg.acceleration * sign, seg.jerk * sign, distanceIntoSegment, GetSegmentEndClocks(n) - seg.startClocks);
+}
+
+// Return true if the advanced distance never decreases during the profile
+bool MotionProfile::IsAdvanceMonotonic(float advanceClocks) const
+{
+	for (size_t i = 0; i < numSegments; ++i)
+	{
+		// The advanced speed is v + k * a, which is quadratic in time, so check it at both ends and at its turning point if that is within the segment
+		const MotionSegment& seg = segments[i];
+		const float endClocks = GetSegmentEndClocks(i);
+		if (   seg.startSpeed + advanceClocks * seg.acceleration < 0.0
+			|| seg.SpeedAt(endClocks) + advanceClocks * seg.AccelerationAt(endClocks) < 0.0
+		   )
+		{
+			return false;
+		}
+		if (seg.jerk != 0.0)
+		{
+			const float turningClocks = seg.startClocks - (seg.acceleration + advanceClocks * seg.jerk)/seg.jerk;
+			if (   turningClocks > seg.startClocks && turningClocks < endClocks
+				&& seg.SpeedAt(turningClocks) + advanceClocks * seg.AccelerationAt(turningClocks) < 0.0
+			   )
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void MotionProfile::DebugPrint() const
+{
+	debugPrintf("Profile %u seg, %" PRIu32 " clocks:", numSegments, durationClocks);
+	for (size_t i = 0; i < numSegments; ++i)
+	{
+		const MotionSegment& seg = segments[i];
+		debugPrintf(" t=%.1f s=%.3f v=%.3f a=%.1f", (double)seg.startClocks, (double)seg.startDistance,
+					(double)(seg.startSpeed * StepTimer::StepClockRate), (double)(seg.acceleration * StepTimer::StepClockRateSquared));
+		if (seg.jerk != 0.0)
+		{
+			debugPrintf(" j=%.0f", (double)(seg.jerk * StepTimer::StepClockRateSquared * StepTimer::StepClockRate));
+		}
+	}
+	debugPrintf("\n");
+}
+
+#endif
+
+// End
@@ -0,0 +1,92 @@
+/*
+ * MotionProfile.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_MOTIONPROFILE_H_
+#define SRC_MOVEMENT_MOTIONPROFILE_H_
+
+#include "RepRapFirmware.h"
+
+#if HAS_MOTION_PROFILES
+
+// A part of a motion profile during which the jerk (the rate of change of acceleration) is constant. Usually the jerk is zero.
+struct MotionSegment
+{
+	float startClocks;										// when this segment starts, in step clocks since the start of the move
+	float startDistance;									// how far along the move we are at the start of this segment, in mm
+	float startSpeed;										// the speed at the start of this segment, in mm per step clock
+	float acceleration;										// the acceleration at the start of this segment, in mm per step clock squared
+	float jerk;												// the jerk during this segment, in mm per step clock cubed
+
+	float DistanceAt(float clocks) const
+	{
+		const float t = clocks - startClocks;
+		return startDistance + (startSpeed + (acceleration * 0.5 + jerk * t * (1.0/6.0)) * t) * t;
+	}
+	float SpeedAt(float clocks) const { const float t = clocks - startClocks; return startSpeed + (acceleration + jerk * t * 0.5) * t; }
+	float AccelerationAt(float clocks) const { return acceleration + jerk * (clocks - startClocks); }
+};
+
+// Class to describe how far along a move the head has travelled as a function of time, when that can't be described by a simple trapezoidal speed profile.
+// The profile is a sequence of segments, each with constant jerk. Times are in step clocks since the start of the move, distances are in mm.
+// Profiles are also used to describe the movement of an extruder with smoothed pressure advance, which may go backwards as well as forwards.
+// Profiles are only needed from when a move is prepared until it completes, so they are kept in a pool that grows on demand.
+class MotionProfile
+{
+public:
+	static constexpr size_t MaxSegments = 48;
+	static constexpr size_t MaxMoveSegments = 7;			// the most segments that MakeMoveSegments generates
+
+	static void InitialAllocate(unsigned int num, unsigned int maxNum);
+	static MotionProfile *Allocate();							// allocate a profile if we can, returning nullptr if we are out of memory or at the limit
+	static void Release(MotionProfile *item);
+	static unsigned int NumAllocated() { return numAllocated; }
+	static unsigned int NumFree() { return numFree; }
+
+	// Describe an accelerate-steady-decelerate move, with jerk-limited speed changes if the jerks are nonzero
+	static size_t MakeMoveSegments(MotionSegment segs[], float startSpeed, float topSpeed, float endSpeed,
+									float accelClocks, float steadyClocks, float decelClocks, float accelJerk, float decelJerk);
+
+	void Clear() { numSegments = 0; }
+	bool AddSegment(float startClocks, float startDistance, float startSpeed, float acceleration, float jerk = 0.0);	// returns false if there is no room
+	bool AddSegment(const MotionSegment& seg) { return AddSegment(seg.startClocks, seg.startDistance, seg.startSpeed, seg.acceleration, seg.jerk); }
+	size_t GetNumSegments() const { return numSegments; }
+	uint32_t GetDuration() const { return durationClocks; }
+	void SetDuration(uint32_t clocks) { durationClocks = clocks; }
+
+	// Return the time at which the advanced distance s + k * (v - v0) first reaches 'distance', where k is the pressure advance time in step clocks (zero for axes).
+	// The advanced distance must not decrease anywhere in the profile; call IsAdvanceMonotonic to check that before using a nonzero k.
+	uint32_t DistanceToTime(float distance, float advanceClocks) const __attribute__ ((hot));
+	bool IsAdvanceMonotonic(float advanceClocks) const;
+
+	// Functions used to step through a profile segment by segment, when the distance may decrease as well as increase
+	const MotionSegment& GetSegment(size_t n) const { return segments[n]; }
+	float GetSegmentEndClocks(size_t n) const { return (n + 1 < numSegments) ? segments[n + 1].startClocks : (float)durationClocks; }
+	float GetSegmentEndDistance(size_t n) const { return segments[n].DistanceAt(GetSegmentEndClocks(n)); }
+	bool IsSegmentRising(size_t n) const { return segments[n].SpeedAt(0.5 * (segments[n].startClocks + GetSegmentEndClocks(n))) >= 0.0; }
+	float SolveInSegment(size_t n, float distance, bool rising) const __attribute__ ((hot));
+
+	void DebugPrint() const;
+
+private:
+	MotionProfile(MotionProfile *n) : next(n), numSegments(0), durationClocks(0) { }
+
+	static float SolveSegment(float b, float a, float j, float distance, float maxClocks) __attribute__ ((hot));
+
+	static MotionProfile *freeList;
+	static unsigned int numFree;
+	static unsigned int numAllocated;							// how many profiles we have allocated
+	static unsigned int maxAllocated;							// the most profiles we may allocate
+
+	MotionProfile *next;
+	size_t numSegments;
+	uint32_t durationClocks;									// the total duration of the move
+	MotionSegment segments[MaxSegments];
+};
+
+#endif
+
+#endif /* SRC_MOVEMENT_MOTIONPROFILE_H_ */
@@ -39,10 +39,53 @@
 #include "GCodes/GCodeBuffer.h"
 #include "Tools/Tool.h"
 
+#if HAS_MOTION_PROFILES
+# include "MotionProfile.h"
+#endif
+
+#if SUPPORT_LASER
+# include "LaserRaster.h"
+#endif
+
 #if SUPPORT_CAN_EXPANSION
 # include "CAN/CanInterface.h"
 #endif
 
+#if SUPPORT_TMC51xx && SUPPORT_OBJECT_MODEL
+# include "StepperDrivers/TMC51xx.h"
+#endif
+
+#ifdef RTOS
+
+// The Move task reads moves from GCodes, adds them to the ring and prepares them, so that move preparation doesn't wait for whatever else the main task is doing.
+// It sleeps between spins, but the step ISR wakes it when the prepared moves are running low.
+constexpr unsigned int MoveTaskStackWords = 500;					// must be large enough for DDA::Prepare and input shaping
+constexpr uint32_t MoveTaskIdleWaitMillis = 10;						// how long the Move task sleeps when the ring is idle
+constexpr uint32_t MoveTaskActiveWaitMillis = 1;					// how long the Move task sleeps when there are moves in the ring
+constexpr unsigned int MaxSimulationSpinsWithoutWaiting = 50;		// when simulating, how many times the Move task may spin before it lets lower priority tasks run
+static Task<MoveTaskStackWords> moveTask;
+
+extern "C" [[noreturn]] void MoveStart(void * pvParameters)
+{
+	reprap.GetMove().MoveLoop();
+}
+
+#endif
+
+#if HAS_STALL_DETECT
+
+// Each time a driver that is configured to slow down on stall (M915 R4) stalls, we reduce the speed and acceleration of new moves by this factor, down to a minimum.
+// When there have been no stalls for a while we gradually restore the speed.
+constexpr float StallSpeedReductionFactor = 0.8;
+constexpr float MinimumStallSpeedFactor = 0.3;
+constexpr float StallSpeedRecoveryStep = 0.05;
+constexpr uint32_t StallSpeedRecoveryInterval = 5000;				// milliseconds
+
+#endif
+
+// The Move task holds this mutex while it spins. Functions that other tasks call to change the ring while moves may be executing must take it too.
+static Mutex moveMutex;
+
 #if SUPPORT_OBJECT_MODEL
 
 // Object model table and functions
@@ -52,14 +95,38 @@
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(Move, _ret)
 
-const ObjectModelTableEntry Move::objectModelTable[] =
+#if SUPPORT_TMC51xx
+
+// The peak coil currents in mA after coolStep scaling, and the stallGuard results, of the smart drivers
+static const ObjectModelArrayDescriptor driverCurrentsArrayDescriptor =
+{
+	[] (ObjectModel *self) -> size_t { return reprap.GetPlatform().GetNumSmartDrivers(); },
+	[] (ObjectModel *self, size_t n) -> void* { return (void *)&(SmartDrivers::GetLoadTelemetry(n).actualCurrent); }
+};
+
+static const ObjectModelArrayDescriptor driverLoadsArrayDescriptor =
+{
+	[] (ObjectModel *self) -> size_t { return reprap.GetPlatform().GetNumSmartDrivers(); },
+	[] (ObjectModel *self, size_t n) -> void* { return (void *)&(SmartDrivers::GetLoadTelemetry(n).sgResult); }
+};
+
+#endif
+
+constexpr ObjectModelTableEntry Move::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "drcEnabled", OBJECT_MODEL_FUNC(&(self->drcEnabled)), TYPE_OF(bool), ObjectModelTableEntry::none },
 	{ "drcMinimumAcceleration", OBJECT_MODEL_FUNC(&(self->drcMinimumAcceleration)), TYPE_OF(float), ObjectModelTableEntry::none },
 	{ "drcPeriod", OBJECT_MODEL_FUNC(&(self->drcPeriod)), TYPE_OF(float), ObjectModelTableEntry::none },
+#if SUPPORT_TMC51xx
+	{ "driverCurrents", OBJECT_MODEL_FUNC_NOSELF(&driverCurrentsArrayDescriptor), TYPE_OF(uint32_t) | IsArray, ObjectModelTableEntry::live },
+	{ "driverLoads", OBJECT_MODEL_FUNC_NOSELF(&driverLoadsArrayDescriptor), TYPE_OF(uint32_t) | IsArray, ObjectModelTableEntry::live },
+#endif
 	{ "maxPrintingAcceleration", OBJECT_MODEL_FUNC(&(self->maxPrintingAcceleration)), TYPE_OF(float), ObjectModelTableEntry::none },
 	{ "maxTravelAcceleration", OBJECT_MODEL_FUNC(&(self->maxTravelAcceleration)), TYPE_OF(float), ObjectModelTableEntry::none },
+	{ "prepareMaxTime", OBJECT_MODEL_FUNC(&(self->mainDDARing.GetPrepareStats().maxPrepareMillis)), TYPE_OF(Float2), ObjectModelTableEntry::none },
+	{ "prepareMinSlack", OBJECT_MODEL_FUNC(&(self->mainDDARing.GetPrepareStats().minSlackMillis)), TYPE_OF(float), ObjectModelTableEntry::none },
+	{ "preparedLate", OBJECT_MODEL_FUNC(&(self->mainDDARing.GetPrepareStats().numPreparedLate)), TYPE_OF(uint32_t), ObjectModelTableEntry::none },
 };
 
 DEFINE_GET_OBJECT_MODEL_TABLE(Move)
@@ -72,17 +139,33 @@ Move::Move()
 	  maxPrintingAcceleration(10000.0), maxTravelAcceleration(10000.0),
 	  drcPeriod(0.025),												// 40Hz
 	  drcMinimumAcceleration(10.0),
-	  jerkPolicy(0)
+#if SUPPORT_INPUT_SHAPING
+	  jerkLimit(0.0),
+#endif
+	  jerkPolicy(0), junctionDeviation(0.0), benchmarkDdas{ nullptr, nullptr }
 {
 	// Kinematics must be set up here because GCodes::Init asks the kinematics for the assumed initial position
 	kinematics = Kinematics::Create(KinematicsType::cartesian);		// default to Cartesian
 	mainDDARing.Init1(DdaRingLength);
-	DriveMovement::InitialAllocate(NumDms);
+#if SUPPORT_ASYNC_MOVES
+	auxDDARing.Init1(AuxDdaRingLength);
+#endif
+	DriveMovement::InitialAllocate(InitialNumDms, DefaultMaxNumDms);
+#if HAS_MOTION_PROFILES
+	MotionProfile::InitialAllocate(InitialNumMotionProfiles, MaxNumMotionProfiles);
+#endif
+#if SUPPORT_LASER
+	LaserRaster::InitialAllocate(0, MaxNumLaserRasters);
+#endif
 }
 
 void Move::Init()
 {
 	mainDDARing.Init2();
+#if SUPPORT_ASYNC_MOVES
+	auxDDARing.Init2();
+	auxMoveAvailable = false;
+#endif
 
 	// Clear the transforms
 	SetIdentityTransform();
@@ -90,7 +173,11 @@ void Move::Init()
 
 	usingMesh = false;
 	useTaper = false;
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	streamMesh = false;
+#endif
 	zShift = 0.0;
+	UpdateLinearTransform();
 
 	idleTimeout = DefaultIdleTimeout;
 	moveState = MoveState::idle;
@@ -100,18 +187,74 @@ void Move::Init()
 	simulationMode = 0;
 	longestGcodeWaitInterval = 0;
 	numHiccups = 0;
+	planningCycles = 0;
+	numPlannedMoves = 0;
 	bedLevellingMoveAvailable = false;
+	leadscrewsHomed = 0;
+
+#if HAS_STALL_DETECT
+	stallSpeedFactor = 1.0;
+	whenStallSpeedFactorChanged = millis();
+	numStallSlowdowns = 0;
+#endif
 
 	active = true;
+
+	moveMutex.Create("Move");
+#ifdef RTOS
+	moveTask.Create(MoveStart, "MOVE", nullptr, TaskPriority::MovePriority);
+#endif
 }
 
+// Shut down. The Move task keeps running, but while we are not active it just discards any moves that GCodes tries to give it.
 void Move::Exit()
 {
+	MutexLocker lock(moveMutex);
 	StepTimer::DisableStepInterrupt();
 	mainDDARing.Exit();
+#if SUPPORT_ASYNC_MOVES
+	auxDDARing.Exit();
+#endif
 	active = false;												// don't accept any more moves
 }
 
+#ifdef RTOS
+
+void Move::MoveLoop()
+{
+	unsigned int simulationSpins = 0;
+	for (;;)
+	{
+		{
+			MutexLocker lock(moveMutex);
+			Spin();
+		}
+
+		// When simulating there are no step pulses to wait for, so keep going while GCodes has moves or segments of moves for us
+		if (simulationMode != 0 && reprap.GetGCodes().IsMoveAvailable() && simulationSpins < MaxSimulationSpinsWithoutWaiting)
+		{
+			++simulationSpins;
+		}
+		else
+		{
+			simulationSpins = 0;
+			(void)TaskBase::Take((mainDDARing.IsIdle()) ? MoveTaskIdleWaitMillis : MoveTaskActiveWaitMillis);
+		}
+	}
+}
+
+/*static*/ void Move::WakeMoveTaskFromISR()
+{
+	moveTask.GiveFromISR();
+}
+
+/*static*/ void Move::WakeMoveTask()
+{
+	moveTask.Give();
+}
+
+#endif
+
 void Move::Spin()
 {
 	if (!active)
@@ -126,13 +269,28 @@ void Move::Spin()
 		++idleCount;
 	}
 
+#if HAS_STALL_DETECT
+	// If we slowed down because of stalls and there have been no more stalls for a while, start restoring the speed
+	if (stallSpeedFactor < 1.0 && millis() - whenStallSpeedFactorChanged >= StallSpeedRecoveryInterval)
+	{
+		stallSpeedFactor = min<float>(stallSpeedFactor + StallSpeedRecoveryStep, 1.0);
+		whenStallSpeedFactorChanged = millis();
+	}
+#endif
+
 	// Recycle the DDAs for completed moves, checking for DDA errors to print if Move debug is enabled
 	mainDDARing.RecycleDDAs();
 
+	// Time how long we spend fetching, adding and preparing moves, so that M37 can report the planning load of a simulated file
+	const uint32_t planningStartCycles = StepTimer::GetCycleCount();
+
 	// See if we can add another move to the ring
 	bool canAddMove = (
 #if SUPPORT_ROLAND
 						  !reprap.GetRoland()->Active() &&
+#endif
+#if SUPPORT_LASER
+						  LaserRaster::IsAvailable() &&		// we don't know whether the next move is a raster move until we have read it
 #endif
 						  mainDDARing.CanAddMove()
 					  );
@@ -174,8 +332,9 @@ void Move::Spin()
 						AxisAndBedTransform(nextMove.coords, nextMove.tool, true);
 					}
 
-					if (mainDDARing.AddStandardMove(nextMove, !IsRawMotorMove(nextMove.moveType)))
+					if ((nextMove.moveType == 4) ? AddLeadscrewHomingMove(nextMove) : mainDDARing.AddStandardMove(nextMove, !IsRawMotorMove(nextMove.moveType)))
 					{
+						++numPlannedMoves;
 						idleCount = 0;
 						if (moveState == MoveState::idle || moveState == MoveState::timing)
 						{
@@ -195,9 +354,35 @@ void Move::Spin()
 	}
 
 	mainDDARing.Spin(simulationMode, idleCount > 10);	// let the DDA ring process moves. Better to have a few moves in the queue so that we can do lookahead, hence the test on idleCount.
+	planningCycles += StepTimer::GetCycleCount() - planningStartCycles;
+
+#if SUPPORT_ASYNC_MOVES
+	// Do the same for the auxiliary ring. Auxiliary moves are requested one at a time by M596, so we start them as soon as we have them.
+	auxDDARing.RecycleDDAs();
+	if (auxMoveAvailable && auxDDARing.CanAddMove())
+	{
+		if (simulationMode < 2)
+		{
+			// Auxiliary moves are raw motor moves that never move the axes, so set the axis coordinates to where the axis motors already are in this ring
+			const int32_t * const endPoints = auxDDARing.GetLastQueuedEndPoints();
+			const size_t numVisibleAxes = reprap.GetGCodes().GetVisibleAxes();
+			for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+			{
+				auxMove.coords[axis] = (float)endPoints[axis]/reprap.GetPlatform().DriveStepsPerUnit(axis);
+			}
+			auxDDARing.AddStandardMove(auxMove, false);
+		}
+		auxMoveAvailable = false;
+	}
+	auxDDARing.Spin(simulationMode, true);
+#endif
 
 	// Reduce motor current to standby if the rings have been idle for long enough
-	if (mainDDARing.IsIdle())
+	if (mainDDARing.IsIdle()
+#if SUPPORT_ASYNC_MOVES
+		&& auxDDARing.IsIdle()
+#endif
+	   )
 	{
 		if (moveState == MoveState::executing && !reprap.GetGCodes().IsPaused())
 		{
@@ -225,6 +410,7 @@ unsigned int Move::GetNumProbePoints() const
 // Try to push some babystepping through the lookahead queue, returning the amount pushed
 float Move::PushBabyStepping(size_t axis, float amount)
 {
+	MutexLocker lock(moveMutex);
 	return mainDDARing.PushBabyStepping(axis, amount);
 }
 
@@ -260,31 +446,97 @@ bool Move::IsAccessibleProbePoint(float x, float y) const
 	return kinematics->IsReachable(x - params.xOffset, y - params.yOffset, false);
 }
 
+// Return the mutex that the Move task holds while it spins. GCodes holds it while it pauses a print or abandons the move it has waiting,
+// so that the Move task can't take the waiting move part way through. The mutex is recursive, so Move functions may be called while holding it.
+/*static*/ Mutex& Move::GetMoveMutex()
+{
+	return moveMutex;
+}
+
 // Pause the print as soon as we can, returning true if we are able to skip any moves and updating 'rp' to the first move we skipped.
 bool Move::PausePrint(RestorePoint& rp)
 {
-	return mainDDARing.PauseMoves(rp);
+	MutexLocker lock(moveMutex);
+	const bool ret = mainDDARing.PauseMoves(rp);
+#if SUPPORT_ASYNC_MOVES
+	if (!auxDDARing.IsIdle())
+	{
+		StepTimer::TriggerStepInterrupt();		// pausing the main ring disabled the step interrupt, but auxiliary moves must keep going
+	}
+#endif
+	return ret;
+}
+
+#if SUPPORT_RESUME_JOURNAL
+
+// Get the point that we would resume from if the power failed now, returning true if there is one
+bool Move::GetResumePoint(RestorePoint& rp)
+{
+	MutexLocker lock(moveMutex);
+	return mainDDARing.GetResumePoint(rp);
 }
 
+#endif
+
 #if HAS_VOLTAGE_MONITOR || HAS_STALL_DETECT
 
 // Pause the print immediately, returning true if we were able to skip or abort any moves and setting up to the move we aborted
 bool Move::LowPowerOrStallPause(RestorePoint& rp)
 {
+	MutexLocker lock(moveMutex);
 	return mainDDARing.LowPowerOrStallPause(rp);
 }
 
 #endif
 
+#if HAS_STALL_DETECT
+
+// Reduce the speed and acceleration of new moves because a driver stalled. This is called by Platform.
+// Moves that are already in the ring are not changed, because lowering the speed of a move whose start speed has already been fixed would need the lookahead to be redone.
+void Move::ReduceSpeedOnStall()
+{
+	stallSpeedFactor = max<float>(stallSpeedFactor * StallSpeedReductionFactor, MinimumStallSpeedFactor);
+	whenStallSpeedFactorChanged = millis();
+	++numStallSlowdowns;
+}
+
+#endif
+
 void Move::Diagnostics(MessageType mtype)
 {
 	Platform& p = reprap.GetPlatform();
 	p.MessageF(mtype, "=== Move ===\nHiccups: %" PRIu32 ", FreeDm: %d, MinFreeDm: %d, MaxWait: %" PRIu32 "ms\n",
 						numHiccups, DriveMovement::NumFree(), DriveMovement::MinFree(), longestGcodeWaitInterval);
+	p.MessageF(mtype, "DMs allocated: %u, limit %u, high water %u, allocation failures %" PRIu32 "\n",
+						DriveMovement::NumAllocated(), DriveMovement::GetMaxAllocated(), DriveMovement::HighWater(), DriveMovement::GetAndClearAllocationFailures());
 	numHiccups = 0;
 	longestGcodeWaitInterval = 0;
 	DriveMovement::ResetMinFree();
 
+	p.MessageF(mtype, "Merged step passes: %" PRIu32 ", single drive step passes: %" PRIu32 "\n", DDA::GetAndClearMergedStepPasses(), DDA::GetAndClearSingleDriveStepPasses());
+#if HAS_STALL_DETECT
+	p.MessageF(mtype, "Stall speed factor %.2f, slowdowns %" PRIu32 "\n", (double)stallSpeedFactor, numStallSlowdowns);
+	numStallSlowdowns = 0;
+#endif
+
+#if DM_USE_STEP_TABLES
+	p.MessageF(mtype, "Step table underruns: %" PRIu32 "\n", DriveMovement::GetAndClearStepTableUnderruns());
+#endif
+#if SUPPORT_INPUT_SHAPING
+	inputShaper.Diagnostics(mtype);
+#endif
+#if SUPPORT_LASER
+	if (LaserRaster::NumAllocated() != 0)
+	{
+		p.MessageF(mtype, "Laser rasters allocated %u, in use %u, allocation failures %" PRIu32 "\n",
+							LaserRaster::NumAllocated(), LaserRaster::NumInUse(), LaserRaster::GetAndClearAllocationFailures());
+	}
+#endif
+
+	// The timing histograms are not cleared here, so that they can accumulate over a whole print. M122 P107 clears them.
+	isrDurations.Report(mtype, "Step ISR duration", 1000000.0/(float)SystemCoreClock);
+	DDA::GetStepLatenessHistogram().Report(mtype, "Step lateness", 1000000.0/(float)StepTimer::StepClockRate);
+
 #if defined(__ALLIGATOR__)
 	// Motor Fault Diagnostic
 	reprap.GetPlatform().MessageF(mtype, "Motor Fault status: %s\n", digitalRead(MotorFaultDetectPin) ? "none" : "FAULT detected!" );
@@ -333,6 +585,9 @@ void Move::Diagnostics(MessageType mtype)
 #endif
 
 	mainDDARing.Diagnostics(mtype, "");
+#if SUPPORT_ASYNC_MOVES
+	auxDDARing.Diagnostics(mtype, "Aux");
+#endif
 }
 
 // Set the current position to be this
@@ -341,6 +596,7 @@ void Move::SetNewPosition(const float positionNow[MaxTotalDrivers], bool doBedCo
 	float newPos[MaxTotalDrivers];
 	memcpy(newPos, positionNow, sizeof(newPos));			// copy to local storage because Transform modifies it
 	AxisAndBedTransform(newPos, reprap.GetCurrentTool(), doBedCompensation);
+	MutexLocker lock(moveMutex);
 	SetLiveCoordinates(newPos);
 	SetPositions(newPos);
 }
@@ -411,19 +667,104 @@ bool Move::CartesianToMotorSteps(const float machinePos[MaxAxes], int32_t motorP
 	return b;
 }
 
+// Convert a batch of Cartesian coordinates to motor steps, axes only, returning true if all of them were converted.
+// Used when streaming the sub-segments of a move, which needs the motor positions at several points along it.
+bool Move::CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	const bool b = kinematics->CartesianToMotorStepsBatch(numPoints, machinePos, reprap.GetPlatform().GetDriveStepsPerUnit(),
+															reprap.GetGCodes().GetVisibleAxes(), reprap.GetGCodes().GetTotalAxes(), motorPos, isCoordinated);
+	if (!b && reprap.Debug(moduleMove) && !inInterrupt())
+	{
+		debugPrintf("Unable to transform %u points\n", numPoints);
+	}
+	return b;
+}
+
+// Convert equally spaced points along a straight line to motor steps, axes only, excluding both ends of the line. Returns true if all of them were converted.
+// Used when streaming the sub-segments of a move, which needs the motor positions at equal intervals along it.
+bool Move::CartesianToMotorStepsAlongLine(const float startPos[MaxAxes], const float endPos[MaxAxes], size_t numPoints, int32_t motorPos[][MaxAxes], bool isCoordinated) const
+{
+	const bool b = kinematics->CartesianToMotorStepsAlongLine(startPos, endPos, numPoints, reprap.GetPlatform().GetDriveStepsPerUnit(),
+																reprap.GetGCodes().GetVisibleAxes(), reprap.GetGCodes().GetTotalAxes(), motorPos, isCoordinated);
+	if (!b && reprap.Debug(moduleMove) && !inInterrupt())
+	{
+		debugPrintf("Unable to transform %u points\n", numPoints);
+	}
+	return b;
+}
+
 void Move::AxisAndBedTransform(float xyzPoint[MaxAxes], const Tool *tool, bool useBedCompensation) const
 {
-	AxisTransform(xyzPoint, tool);
-	if (useBedCompensation)
+	if (useBedCompensation && linearTransformIncludesBed && Tool::GetXAxes(tool) == DefaultXAxisMapping && Tool::GetYAxes(tool) == DefaultYAxisMapping)
 	{
-		BedTransform(xyzPoint, tool);
+		// Do the axis and bed compensation in one go
+		const float zOffset = linearZOffset + linearPlaneX * Tool::GetOffset(tool, X_AXIS) + linearPlaneY * Tool::GetOffset(tool, Y_AXIS);
+		const float x = xyzPoint[X_AXIS], y = xyzPoint[Y_AXIS], z = xyzPoint[Z_AXIS];
+		xyzPoint[X_AXIS] = linearTransform[0][0] * x + linearTransform[0][1] * y + linearTransform[0][2] * z;
+		xyzPoint[Y_AXIS] = linearTransform[1][0] * x + linearTransform[1][1] * y + linearTransform[1][2] * z;
+		xyzPoint[Z_AXIS] = linearTransform[2][0] * x + linearTransform[2][1] * y + linearTransform[2][2] * z + zOffset;
+	}
+	else
+	{
+		AxisTransform(xyzPoint, tool);
+		if (useBedCompensation)
+		{
+			BedTransform(xyzPoint, tool);
+		}
 	}
 }
 
 void Move::InverseAxisAndBedTransform(float xyzPoint[MaxAxes], const Tool *tool) const
 {
-	InverseBedTransform(xyzPoint, tool);
-	InverseAxisTransform(xyzPoint, tool);
+	if (linearTransformIncludesBed && Tool::GetXAxes(tool) == DefaultXAxisMapping && Tool::GetYAxes(tool) == DefaultYAxisMapping)
+	{
+		const float zOffset = linearZOffset + linearPlaneX * Tool::GetOffset(tool, X_AXIS) + linearPlaneY * Tool::GetOffset(tool, Y_AXIS);
+		const float x = xyzPoint[X_AXIS], y = xyzPoint[Y_AXIS], z = xyzPoint[Z_AXIS] - zOffset;
+		xyzPoint[X_AXIS] = inverseLinearTransform[0][0] * x + inverseLinearTransform[0][1] * y + inverseLinearTransform[0][2] * z;
+		xyzPoint[Y_AXIS] = inverseLinearTransform[1][0] * x + inverseLinearTransform[1][1] * y + inverseLinearTransform[1][2] * z;
+		xyzPoint[Z_AXIS] = inverseLinearTransform[2][0] * x + inverseLinearTransform[2][1] * y + inverseLinearTransform[2][2] * z;
+	}
+	else
+	{
+		InverseBedTransform(xyzPoint, tool);
+		InverseAxisTransform(xyzPoint, tool);
+	}
+}
+
+// Recalculate the combined axis and bed transform. This must be called whenever the axis compensation or the bed compensation changes.
+// The axis compensation is x' = x + tanXY*y + tanXZ*z, y' = y + tanYZ*z. A linear bed compensation then adds pX*x' + pY*y' plus a constant to z.
+void Move::UpdateLinearTransform()
+{
+	float pX, pY, pC;
+	linearTransformIncludesBed = !usingMesh && !useTaper && probePoints.GetLinearHeightError(pX, pY, pC);
+	if (!linearTransformIncludesBed)
+	{
+		pX = pY = pC = 0.0;
+	}
+	linearPlaneX = pX;
+	linearPlaneY = pY;
+	linearZOffset = pC + zShift;
+
+	linearTransform[0][0] = 1.0;
+	linearTransform[0][1] = tanXY;
+	linearTransform[0][2] = tanXZ;
+	linearTransform[1][0] = 0.0;
+	linearTransform[1][1] = 1.0;
+	linearTransform[1][2] = tanYZ;
+	linearTransform[2][0] = pX;
+	linearTransform[2][1] = pX * tanXY + pY;
+	linearTransform[2][2] = 1.0 + pX * tanXZ + pY * tanYZ;
+
+	// The inverse undoes the bed compensation and then the axis compensation: z = z' - pX*x' - pY*y', y = y' - tanYZ*z, x = x' - tanXY*y - tanXZ*z
+	inverseLinearTransform[2][0] = -pX;
+	inverseLinearTransform[2][1] = -pY;
+	inverseLinearTransform[2][2] = 1.0;
+	for (size_t col = 0; col < XYZ_AXES; ++col)
+	{
+		const float zCoeff = inverseLinearTransform[2][col];
+		inverseLinearTransform[1][col] = ((col == Y_AXIS) ? 1.0 : 0.0) - tanYZ * zCoeff;
+		inverseLinearTransform[0][col] = ((col == X_AXIS) ? 1.0 : 0.0) - tanXY * inverseLinearTransform[1][col] - tanXZ * zCoeff;
+	}
 }
 
 // Do the Axis transform BEFORE the bed transform
@@ -576,6 +917,7 @@ void Move::SetZeroHeightError(const float coords[MaxAxes])
 	memcpy(tempCoords, coords, sizeof(tempCoords));
 	AxisTransform(tempCoords, nullptr);
 	zShift = -GetInterpolatedHeightError(tempCoords[X_AXIS], tempCoords[Y_AXIS]);
+	UpdateLinearTransform();
 }
 
 void Move::SetIdentityTransform()
@@ -585,6 +927,7 @@ void Move::SetIdentityTransform()
 	heightMap.UseHeightMap(false);
 	usingMesh = false;
 	zShift = 0.0;
+	UpdateLinearTransform();
 }
 
 // Load the height map from file, returning true if an error occurred with the error reason appended to the buffer
@@ -599,6 +942,7 @@ bool Move::LoadHeightMapFromFile(FileStore *f, const StringRef& r)
 	{
 		zShift = 0.0;
 	}
+	UpdateLinearTransform();
 	return ret;
 }
 
@@ -608,6 +952,24 @@ bool Move::SaveHeightMapToFile(FileStore *f) const
 	return heightMap.SaveToFile(f, zShift);
 }
 
+// Load the binary copy of a height map file, returning true if an error occurred or it doesn't match the CSV file
+bool Move::LoadHeightMapFromBinaryFile(FileStore *f, uint32_t csvLength, uint32_t csvTime)
+{
+	const bool ret = heightMap.LoadFromBinaryFile(f, csvLength, csvTime);
+	if (!ret)
+	{
+		zShift = 0.0;
+		UpdateLinearTransform();
+	}
+	return ret;
+}
+
+// Save a binary copy of the height map returning true if an error occurred
+bool Move::SaveHeightMapToBinaryFile(FileStore *f, uint32_t csvLength, uint32_t csvTime) const
+{
+	return heightMap.SaveToBinaryFile(f, zShift, csvLength, csvTime);
+}
+
 void Move::SetTaperHeight(float h)
 {
 	useTaper = (h > 1.0);
@@ -616,15 +978,41 @@ void Move::SetTaperHeight(float h)
 		taperHeight = h;
 		recipTaperHeight = 1.0/h;
 	}
+	UpdateLinearTransform();
 }
 
 // Enable mesh bed compensation
 bool Move::UseMesh(bool b)
 {
 	usingMesh = heightMap.UseHeightMap(b);
+	UpdateLinearTransform();
 	return usingMesh;
 }
 
+#if SUPPORT_SEGMENT_FREE_STREAMING
+
+// Return true if we apply mesh compensation by streaming the Z motor position along each move instead of segmenting moves at the grid lines.
+// We can only do this if the Z motor moves the Z axis alone, and the kinematics is linear so that moves aren't segmented anyway.
+bool Move::UseMeshStreaming() const
+{
+	return usingMesh
+		&& streamMesh
+		&& !kinematics->UseSegmentation()
+		&& !IsDeltaMode()
+		&& kinematics->GetConnectedAxes(Z_AXIS) == MakeBitmap<AxesBitmap>(Z_AXIS);
+}
+
+// Return the Z correction that the bed transform applies at a point that has already been axis-transformed
+float Move::GetBedCompensation(const float xyzPoint[MaxAxes], const Tool *tool) const
+{
+	float tempCoords[MaxAxes];
+	memcpy(tempCoords, xyzPoint, sizeof(tempCoords));
+	BedTransform(tempCoords, tool);
+	return tempCoords[Z_AXIS] - xyzPoint[Z_AXIS];
+}
+
+#endif
+
 float Move::AxisCompensation(unsigned int axis) const
 {
 	return (axis < ARRAY_SIZE(tangents)) ? tangents[axis] : 0.0;
@@ -635,6 +1023,7 @@ void Move::SetAxisCompensation(unsigned int axis, float tangent)
 	if (axis < ARRAY_SIZE(tangents))
 	{
 		tangents[axis] = tangent;
+		UpdateLinearTransform();
 	}
 }
 
@@ -686,6 +1075,7 @@ bool Move::FinishedBedProbing(int sParam, const StringRef& reply)
 	// Clear out the Z heights so that we don't re-use old points.
 	// This allows us to use different numbers of probe point on different occasions.
 	probePoints.ClearProbeHeights();
+	UpdateLinearTransform();
 	return error;
 }
 
@@ -693,6 +1083,7 @@ bool Move::FinishedBedProbing(int sParam, const StringRef& reply)
 // This may occasionally get called prematurely.
 void Move::Interrupt()
 {
+	const uint32_t isrStartCycles = StepTimer::GetCycleCount();
 	const uint32_t isrStartTime = StepTimer::GetInterruptClocksInterruptsDisabled();
 	Platform& p = reprap.GetPlatform();
 	bool repeat;
@@ -700,6 +1091,14 @@ void Move::Interrupt()
 	{
 		mainDDARing.Interrupt(p);
 		std::optional<uint32_t> nextStepTime = mainDDARing.GetNextInterruptTime();
+#if SUPPORT_ASYNC_MOVES
+		auxDDARing.Interrupt(p);
+		const std::optional<uint32_t> nextAuxStepTime = auxDDARing.GetNextInterruptTime();
+		if (nextAuxStepTime.has_value() && (!nextStepTime.has_value() || (int32_t)(nextAuxStepTime.value() - nextStepTime.value()) < 0))
+		{
+			nextStepTime = nextAuxStepTime;
+		}
+#endif
 		if (!nextStepTime.has_value())
 		{
 			break;
@@ -711,6 +1110,9 @@ void Move::Interrupt()
 		{
 			// Force a break by updating the move start time
 			mainDDARing.InsertHiccup(DDA::HiccupTime);
+#if SUPPORT_ASYNC_MOVES
+			auxDDARing.InsertHiccup(DDA::HiccupTime);
+#endif
 			nextStepTime = nextStepTime.value() + DDA::HiccupTime;
 #if SUPPORT_CAN_EXPANSION
 			CanInterface::InsertHiccup(DDA::HiccupTime);
@@ -722,6 +1124,15 @@ void Move::Interrupt()
 		// If we have already spent too much time in the ISR, delay the interrupt
 		repeat = StepTimer::ScheduleStepInterrupt(nextStepTime.value());
 	} while (repeat);
+
+	isrDurations.Add(StepTimer::GetCycleCount() - isrStartCycles);
+}
+
+// Clear the step interrupt timing histograms
+void Move::ClearStepTimingHistograms()
+{
+	isrDurations.Clear();
+	DDA::GetStepLatenessHistogram().Clear();
 }
 
 /*static*/ float Move::MotorStepsToMovement(size_t drive, int32_t endpoint)
@@ -796,10 +1207,13 @@ float Move::GetProbeCoordinates(int count, float& x, float& y, bool wantNozzlePo
 // Enter or leave simulation mode
 void Move::Simulate(uint8_t simMode)
 {
+	MutexLocker lock(moveMutex);
 	simulationMode = simMode;
 	if (simMode != 0)
 	{
 		mainDDARing.ResetSimulationTime();
+		planningCycles = 0;
+		numPlannedMoves = 0;
 	}
 }
 
@@ -822,6 +1236,77 @@ void Move::AdjustLeadscrews(const floatc_t corrections[])
 	bedLevellingMoveAvailable = true;
 }
 
+#if SUPPORT_ASYNC_MOVES
+
+// Queue an extruder move that runs independently of the moves in the main ring. The amounts are relative and in mm, the feed rate is in mm/sec.
+// Return false if we haven't yet taken the previous auxiliary move, in which case the caller should try again later.
+bool Move::AddAuxiliaryMove(const float amounts[], size_t numAmounts, float feedRate)
+{
+	if (auxMoveAvailable)
+	{
+		return false;
+	}
+
+	const size_t numTotalAxes = reprap.GetGCodes().GetTotalAxes();
+	auxMove.SetDefaults(numTotalAxes);
+	for (size_t i = 0; i < numAmounts && numTotalAxes + i < MaxTotalDrivers; ++i)
+	{
+		auxMove.coords[numTotalAxes + i] = amounts[i];
+	}
+	auxMove.feedRate = feedRate;
+	auxMove.virtualExtruderPosition = 0.0;
+	auxMove.proportionDone = 1.0;
+	auxMove.canPauseAfter = true;
+	auxMove.isFirmwareRetraction = false;
+	auxMove.moveType = 1;										// a raw motor move, so we don't apply any kinematics or bed compensation
+	auxMoveAvailable = true;
+	return true;
+}
+
+// Return true if no auxiliary moves are pending or executing
+bool Move::AuxiliaryMovesFinished() const
+{
+	return !auxMoveAvailable && auxDDARing.IsIdle();
+}
+
+#endif
+
+// Set up a G1 H4 move, in which each Z motor moves the requested distance or until the endstop input with the same number as its driver is triggered.
+// GCodes has already checked that every Z driver has an endstop input. Return true if there is any movement.
+bool Move::AddLeadscrewHomingMove(const GCodes::RawMove& nextMove)
+{
+	float amounts[MaxTotalDrivers];
+	for (float& amount : amounts)
+	{
+		amount = 0.0;
+	}
+
+	const float distance = nextMove.coords[Z_AXIS] - nextMove.initialCoords[Z_AXIS];
+	EndstopsBitmap endstops = nextMove.endStopsToCheck;
+	const AxisDriversConfig& config = reprap.GetPlatform().GetAxisDriversConfig(Z_AXIS);
+	for (size_t i = 0; i < config.numDrivers; ++i)
+	{
+		const size_t driver = config.driverNumbers[i];
+		if (driver < NumDirectDrivers)
+		{
+			amounts[driver] = distance;
+			SetBit(endstops, driver);
+		}
+	}
+
+	leadscrewsHomed = 0;
+
+	// The feed rate of a leadscrew move applies to the vector sum of the motor movements, so scale it up to move each motor at the requested speed
+	return mainDDARing.AddSpecialMove(nextMove.feedRate * sqrtf((float)config.numDrivers), amounts, endstops);
+}
+
+// This is called from the step ISR when the endstop of a Z motor triggers during a G1 H4 move. 'steps' is how far the motor moved, signed.
+void Move::SetLeadscrewHomed(size_t driver, int32_t steps)
+{
+	leadscrewHomingSteps[driver] = steps;
+	leadscrewsHomed |= MakeBitmap<uint32_t>(driver);
+}
+
 // Return the idle timeout in seconds
 float Move::IdleTimeout() const
 {
@@ -862,49 +1347,324 @@ GCodeResult Move::ConfigureAccelerations(GCodeBuffer&gb, const StringRef& reply)
 		seen = true;
 		maxTravelAcceleration = gb.GetFValue();
 	}
+	if (gb.Seen('J'))
+	{
+		// J sets the rate of change of acceleration in mm/sec^3, with zero meaning that acceleration changes instantly
+		seen = true;
+#if SUPPORT_INPUT_SHAPING
+		jerkLimit = max<float>(gb.GetFValue(), 0.0);
+#else
+		reply.copy("Jerk-limited acceleration is not supported by this firmware");
+		return GCodeResult::error;
+#endif
+	}
 	if (!seen)
 	{
 		reply.printf("Maximum printing acceleration %.1f, maximum travel acceleration %.1f", (double)maxPrintingAcceleration, (double)maxTravelAcceleration);
+#if SUPPORT_INPUT_SHAPING
+		if (jerkLimit > 0.0)
+		{
+			reply.catf(", acceleration jerk limit %.0f", (double)jerkLimit);
+		}
+#endif
 	}
 	return GCodeResult::ok;
 }
 
 // Process M593
+// P selects the type of ringing reduction: "none", "daa" (dynamic acceleration adjustment) or an input shaper "zv", "zvd" or "ei".
+// F gives the ringing frequency; input shapers accept two frequencies separated by a colon. S is the damping ratio used by input shapers.
+// L is the minimum acceleration that DAA may reduce acceleration to.
 GCodeResult Move::ConfigureDynamicAcceleration(GCodeBuffer& gb, const StringRef& reply)
 {
-	bool seen = false;
+	constexpr size_t MaxFrequencies = 2;
+
+	InputShaperType newType(InputShaperType::none);
+	float freqs[MaxFrequencies] = { 1.0/drcPeriod, 1.0/drcPeriod };
+	size_t numFreqs = 1;
+	float damping = 0.1;
+	if (drcEnabled)
+	{
+		newType = InputShaperType::daa;
+	}
+#if SUPPORT_INPUT_SHAPING
+	if (inputShaper.GetNumFrequencies() != 0)
+	{
+		if (inputShaper.IsEnabled())
+		{
+			newType = inputShaper.GetType();
+		}
+		numFreqs = inputShaper.GetNumFrequencies();
+		for (size_t i = 0; i < numFreqs; ++i)
+		{
+			freqs[i] = inputShaper.GetFrequency(i);
+		}
+	}
+	damping = inputShaper.GetDampingRatio();
+#endif
+
+	bool seen = false, seenType = false;
+	if (gb.Seen('P'))
+	{
+		seen = seenType = true;
+		String<StringLength20> typeName;
+		if (!gb.GetPossiblyQuotedString(typeName.GetRef()))
+		{
+			reply.copy("Missing ringing reduction type");
+			return GCodeResult::error;
+		}
+		bool found = false;
+		for (unsigned int i = 0; i < InputShaperType::NumValues && !found; ++i)
+		{
+			newType.Assign(i);
+			found = StringEqualsIgnoreCase(typeName.c_str(), newType.ToString());
+		}
+		if (!found)
+		{
+			reply.printf("Unknown ringing reduction type '%s'", typeName.c_str());
+			return GCodeResult::error;
+		}
+#if !SUPPORT_INPUT_SHAPING
+		if (newType != InputShaperType::none && newType != InputShaperType::daa)
+		{
+			reply.copy("Input shaping is not supported by this firmware");
+			return GCodeResult::error;
+		}
+#endif
+	}
+
 	if (gb.Seen('F'))
 	{
 		seen = true;
-		const float f = gb.GetFValue();
-		if (f >= 4.0 && f <= 10000.0)
+		numFreqs = MaxFrequencies;
+		gb.GetFloatArray(freqs, numFreqs, false);
+		bool freqsOk = (numFreqs != 0);
+		for (size_t i = 0; i < numFreqs; ++i)
 		{
-			drcPeriod = 1.0/f;
-			drcEnabled = true;
+			if (freqs[i] < 4.0 || freqs[i] > 10000.0)
+			{
+				freqsOk = false;
+			}
 		}
-		else
+		if (!freqsOk)
 		{
-			drcEnabled = false;
+			newType = InputShaperType::none;						// as in earlier firmware, an out-of-range frequency disables ringing reduction
+		}
+		else if (!seenType && newType == InputShaperType::none)
+		{
+			newType = InputShaperType::daa;							// a frequency on its own enables dynamic acceleration adjustment, as in earlier firmware
 		}
 	}
+
+	if (gb.Seen('S'))
+	{
+		seen = true;
+		damping = gb.GetFValue();
+	}
+
 	if (gb.Seen('L'))
 	{
 		seen = true;
 		drcMinimumAcceleration = max<float>(gb.GetFValue(), 1.0);		// very low accelerations cause problems with the maths
 	}
 
-	if (!seen)
+	if (seen)
 	{
-		if (reprap.GetMove().IsDRCenabled())
+		if (newType == InputShaperType::daa && numFreqs != 1)
 		{
-			reply.printf("Dynamic ringing cancellation at %.1fHz, min. acceleration %.1f", (double)(1.0/drcPeriod), (double)drcMinimumAcceleration);
+			reply.copy("Dynamic acceleration adjustment supports only one frequency");
+			return GCodeResult::error;
 		}
-		else
+		drcEnabled = (newType == InputShaperType::daa);
+		if (drcEnabled)
+		{
+			drcPeriod = 1.0/freqs[0];
+		}
+#if SUPPORT_INPUT_SHAPING
+		if (newType == InputShaperType::none || newType == InputShaperType::daa)
+		{
+			inputShaper.Disable();
+		}
+		else if (!inputShaper.Configure(newType, freqs, numFreqs, damping))
+		{
+			reply.copy("Bad input shaper parameters");
+			return GCodeResult::error;
+		}
+#endif
+	}
+	else if (drcEnabled)
+	{
+		reply.printf("Dynamic ringing cancellation at %.1fHz, min. acceleration %.1f", (double)(1.0/drcPeriod), (double)drcMinimumAcceleration);
+	}
+#if SUPPORT_INPUT_SHAPING
+	else if (inputShaper.IsEnabled())
+	{
+		reply.printf("Input shaping '%s' at %.1f", inputShaper.GetType().ToString(), (double)inputShaper.GetFrequency(0));
+		for (size_t i = 1; i < inputShaper.GetNumFrequencies(); ++i)
 		{
-			reply.copy("Dynamic ringing cancellation is disabled");
+			reply.catf(":%.1f", (double)inputShaper.GetFrequency(i));
 		}
+		reply.catf("Hz, damping ratio %.2f, duration %.1fms",
+					(double)inputShaper.GetDampingRatio(), (double)(inputShaper.GetDuration() * StepTimer::StepClocksToMillis));
+	}
+#endif
+	else
+	{
+		reply.copy("Dynamic ringing cancellation is disabled");
 	}
 	return GCodeResult::ok;
 }
 
+// Configure the movement queue and step generation
+GCodeResult Move::ConfigureMovementQueue(GCodeBuffer& gb, const StringRef& reply)
+{
+	bool seen = false;
+	if (gb.Seen('P'))
+	{
+		// Changing the queue length requires that the movement queue is idle, which the caller ensures if the P parameter is present
+		seen = true;
+		const uint32_t newLength = gb.GetUIValue();
+		if (newLength < mainDDARing.GetNumDdas() || newLength > MaxDdaRingLength)
+		{
+			reply.printf("Movement queue length must be between %u and %u", mainDDARing.GetNumDdas(), MaxDdaRingLength);
+			return GCodeResult::error;
+		}
+		MutexLocker lock(moveMutex);
+		if (!mainDDARing.Extend(newLength))
+		{
+			reply.copy("Failed to extend the movement queue, not enough free RAM or moves still pending");
+			return GCodeResult::error;
+		}
+	}
+	if (gb.Seen('D'))
+	{
+		seen = true;
+		DriveMovement::SetMaxAllocated(gb.GetUIValue());
+	}
+	if (gb.Seen('W'))
+	{
+		seen = true;
+		const float stepMergeMicroseconds = max<float>(gb.GetFValue(), 0.0);
+		DDA::SetStepMergeWindow(lrintf(stepMergeMicroseconds * (float)StepTimer::StepClockRate * 0.000001));
+	}
+
+	if (!seen)
+	{
+		reply.printf("Movement queue length %u, DM limit %u (%u allocated), step merging window %.1fus",
+						mainDDARing.GetNumDdas(), DriveMovement::GetMaxAllocated(), DriveMovement::NumAllocated(),
+						(double)((float)DDA::GetStepMergeWindow() * 1000000.0/(float)StepTimer::StepClockRate));
+	}
+	return GCodeResult::ok;
+}
+
+// Canned moves for the step rate benchmark. The X, Y, Z and first extruder coordinates are relative to the end of the previous move, and the set as a whole returns to the start point.
+struct BenchmarkMove
+{
+	float x, y, z, e;
+	float feedRate;										// in mm/sec
+};
+
+static constexpr BenchmarkMove BenchmarkMoves[] =
+{
+	{  50.0,   0.0,  0.0,  0.0,  300.0 },				// long fast X travel move
+	{   0.0,  50.0,  0.0,  0.0,  300.0 },				// long fast Y travel move
+	{ -35.0, -35.0,  0.0,  0.0,  300.0 },				// long fast diagonal travel move
+	{  10.0,   5.0,  0.0,  0.5,  100.0 },				// medium length printing move
+	{   2.0,  -1.0,  0.0,  0.1,   60.0 },				// short printing move
+	{   0.5,   0.5,  0.0,  0.03,  40.0 },				// very short printing move, as found in curves
+	{   0.0,   0.0,  5.0,  0.0,   10.0 },				// Z move
+	{ -27.5, -19.5, -5.0, -0.63, 200.0 }				// XYZ move with retraction, back to the start point
+};
+
+// Run the step rate benchmark. The caller must have locked movement and waited for it to stop.
+// We pass a set of canned moves through the normal move setup, preparation and step time calculation code, and report how long the step calculations took.
+// No step pulses are generated, but the motors are enabled as they would be for a real move. The measured times include the time spent in other interrupts.
+GCodeResult Move::RunStepRateBenchmark(GCodeBuffer& gb, const StringRef& reply)
+{
+#if SUPPORT_CAN_EXPANSION
+	reply.copy("The step rate benchmark is not supported when using CAN expansion");
+	return GCodeResult::error;
+#else
+	const unsigned int numRepeats = (gb.Seen('S')) ? constrain<unsigned int>(gb.GetUIValue(), 1, 100) : 10;
+
+	// Use a pair of DDAs outside the ring, so that the Move task and the step interrupt never see the benchmark moves
+	if (benchmarkDdas[0] == nullptr)
+	{
+		benchmarkDdas[0] = new DDA(nullptr);
+		benchmarkDdas[1] = new DDA(benchmarkDdas[0]);
+		benchmarkDdas[0]->SetNext(benchmarkDdas[1]);
+		benchmarkDdas[0]->SetPrevious(benchmarkDdas[1]);
+		benchmarkDdas[1]->SetPrevious(benchmarkDdas[0]);
+	}
+
+	// Start from the current position
+	const GCodes& gc = reprap.GetGCodes();
+	const size_t numAxes = gc.GetTotalAxes();
+	GCodes::RawMove move;
+	move.SetDefaults(numAxes);
+	GetCurrentMachinePosition(move.coords, false);
+	benchmarkDdas[1]->SetPositions(move.coords, numAxes);
+	move.virtualExtruderPosition = 0.0;
+	move.proportionDone = 0.0;
+	move.isFirmwareRetraction = false;
+	move.canPauseAfter = true;
+	move.isCoordinated = true;
+	move.usePressureAdvance = true;
+#if SUPPORT_LASER || SUPPORT_IOBITS
+	move.laserPwmOrIoBits.Clear();
+#endif
+
+	float extrusionPending[MaxExtruders];
+	for (float& ep : extrusionPending)
+	{
+		ep = 0.0;
+	}
+
+	// The benchmark moves are planned against the main ring, so stop them being counted in its lookahead statistics.
+	// Hold the Move mutex too, so that the Move task doesn't reserve DMs or plan moves while we are using them.
+	MutexLocker lock(moveMutex);
+	mainDDARing.SetRecordingStatistics(false);
+	DDA::BenchmarkResults results = {};
+	unsigned int ddaIndex = 0;
+	for (unsigned int i = 0; i < numRepeats; ++i)
+	{
+		for (const BenchmarkMove& bm : BenchmarkMoves)
+		{
+			move.coords[X_AXIS] += bm.x;
+			move.coords[Y_AXIS] += bm.y;
+			move.coords[Z_AXIS] += bm.z;
+			if (gc.GetNumExtruders() != 0)
+			{
+				move.coords[numAxes] = bm.e;
+				move.hasExtrusion = (bm.e != 0.0);
+			}
+			move.feedRate = bm.feedRate;
+
+			DDA * const dda = benchmarkDdas[ddaIndex];
+			if (dda->InitStandardMove(mainDDARing, move, true) && DriveMovement::Reserve(MaxTotalDrivers))
+			{
+				dda->Prepare(0, extrusionPending);
+				dda->RunBenchmarkSteps(results);
+				ddaIndex ^= 1;
+			}
+		}
+	}
+	mainDDARing.SetRecordingStatistics(true);
+
+	if (results.numSteps == 0 || results.passClocks == 0)
+	{
+		reply.copy("Step rate benchmark: no steps were generated, check that the motors are configured and that the current position is reachable");
+		return GCodeResult::error;
+	}
+
+	reply.printf("Step rate benchmark: %" PRIu32 " moves, %" PRIu32 " steps in %.2f sec, max step rate %" PRIu32 " steps/sec, time per step %.2fus, worst step pass %.1fus, hiccups %" PRIu32,
+					results.numMoves, results.numSteps, (double)((float)results.moveClocks/StepTimer::StepClockRate),
+					(uint32_t)(((uint64_t)results.numSteps * StepTimer::StepClockRate)/results.passClocks),
+					(double)((float)results.passClocks * 1000000.0/((float)StepTimer::StepClockRate * (float)results.numSteps)),
+					(double)((float)results.worstPassClocks * 1000000.0/(float)StepTimer::StepClockRate),
+					results.numHiccups);
+	return GCodeResult::ok;
+#endif
+}
+
 // End
@@ -12,33 +12,60 @@
 #include "MessageType.h"
 #include "DDARing.h"
 #include "DDA.h"								// needed because of our inline functions
+#include "InputShaper.h"
 #include "BedProbing/RandomProbePointSet.h"
 #include "BedProbing/Grid.h"
 #include "Kinematics/Kinematics.h"
 #include "GCodes/RestorePoint.h"
+#include "RTOSIface/RTOSIface.h"
 
 // Define the number of DDAs and DMs.
 // A DDA represents a move in the queue.
-// Each DDA needs one DM per drive that it moves, but only when it has been prepared and frozen
+// Each DDA needs one DM per drive that it moves, but only when it has been prepared and frozen.
+// We allocate InitialNumDms DMs at startup and more on demand, up to a limit that defaults to DefaultMaxNumDms and can be changed using M595.
 
 #if SAME70
 
 constexpr unsigned int DdaRingLength = 40;
-constexpr unsigned int NumDms = DdaRingLength/2 * 12;								// allow enough for plenty of CAN expansion
+constexpr unsigned int MaxDdaRingLength = 400;										// the most DDAs that M595 may extend the ring to
+constexpr unsigned int InitialNumDms = DdaRingLength/2 * 4;						// enough for XYZ + 1 extruder
+constexpr unsigned int DefaultMaxNumDms = DdaRingLength/2 * 12;						// allow enough for plenty of CAN expansion
 
 #elif SAM4E || SAM4S
 
 constexpr unsigned int DdaRingLength = 40;
-const unsigned int NumDms = DdaRingLength/2 * 8;									// suitable for e.g. a delta + 5 input hot end
+constexpr unsigned int MaxDdaRingLength = 120;										// the most DDAs that M595 may extend the ring to
+constexpr unsigned int InitialNumDms = DdaRingLength/2 * 4;						// enough for XYZ + 1 extruder
+constexpr unsigned int DefaultMaxNumDms = DdaRingLength/2 * 8;						// suitable for e.g. a delta + 5 input hot end
 
 #else
 
 // We are more memory-constrained on the SAM3X
 const unsigned int DdaRingLength = 20;
-const unsigned int NumDms = 20 * 5;													// suitable for e.g. a delta + 2-input hot end
+const unsigned int MaxDdaRingLength = 40;											// the most DDAs that M595 may extend the ring to
+const unsigned int InitialNumDms = DdaRingLength/2 * 4;								// enough for XYZ + 1 extruder
+const unsigned int DefaultMaxNumDms = DdaRingLength * 5;								// suitable for e.g. a delta + 2-input hot end
 
 #endif
 
+#if SUPPORT_ASYNC_MOVES
+// Auxiliary extruder moves are queued in a ring of their own, which only needs to be long enough to do some lookahead between them
+constexpr unsigned int AuxDdaRingLength = 8;
+#endif
+
+#if HAS_MOTION_PROFILES
+// Each input-shaped move, and each extruder drive in a move with smoothed pressure advance, needs a motion profile from when the move is prepared until it completes.
+// We allocate more on demand up to half the ring length, or the full ring length if we support pressure advance smoothing.
+constexpr unsigned int InitialNumMotionProfiles = 4;
+constexpr unsigned int MaxNumMotionProfiles = (SUPPORT_PRESSURE_ADVANCE_SMOOTHING) ? DdaRingLength : DdaRingLength/2;
+#endif
+
+#if SUPPORT_LASER
+// Each laser raster move needs a raster from when it is added to the ring until it completes. We allocate them on demand.
+constexpr unsigned int MaxNumLaserRasters = DdaRingLength/2;
+#endif
+
+constexpr uint32_t MinRamToLeave = 16 * 1024;										// when extending the DDA ring or the DM pool, leave this much RAM for network buffers, file buffers and stacks
 constexpr uint32_t MovementStartDelayClocks = StepTimer::StepClockRate/100;			// 10ms delay between preparing the first move and starting it
 
 // This is the master movement class.  It controls all movement in the machine.
@@ -49,13 +76,18 @@ public:
 	void Init();													// Start me up
 	void Spin();													// Called in a tight loop to keep the class going
 	void Exit();													// Shut down
+#ifdef RTOS
+	[[noreturn]] void MoveLoop();									// The body of the Move task, which calls Spin
+	static void WakeMoveTaskFromISR();								// Called by the step ISR when the prepared moves are running low
+	static void WakeMoveTask();										// Called by GCodes when it has a new move for us while simulating
+#endif
 
 	void GetCurrentMachinePosition(float m[MaxAxes], bool disableMotorMapping) const; // Get the current position in untransformed coords
 	void GetCurrentUserPosition(float m[MaxAxes], uint8_t moveType, const Tool *tool) const;
 																	// Return the position (after all queued moves have been executed) in transformed coords
 	int32_t GetEndPoint(size_t drive) const;					 	// Get the current position of a motor
 	void LiveCoordinates(float m[MaxTotalDrivers], const Tool *tool);	// Gives the last point at the end of the last complete DDA transformed to user coords
-	void Interrupt() __attribute__ ((hot));							// The hardware's (i.e. platform's)  interrupt should call this.
+	void Interrupt() STEP_ISR_CODE;							// The hardware's (i.e. platform's)  interrupt should call this.
 	bool AllMovesAreFinished();										// Is the look-ahead ring empty?  Stops more moves being added as well.
 	void DoLookAhead() __attribute__ ((hot));						// Run the look-ahead procedure
 	void SetNewPosition(const float positionNow[MaxTotalDrivers], bool doBedCompensation); // Set the current position to be this
@@ -77,11 +109,20 @@ public:
 	void SetTaperHeight(float h);
 	bool UseMesh(bool b);											// Try to enable mesh bed compensation and report the final state
 	bool IsUsingMesh() const { return usingMesh; }					// Return true if we are using mesh compensation
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	void SetStreamMesh(bool b) { streamMesh = b; }
+	bool GetStreamMesh() const { return streamMesh; }
+	bool UseMeshStreaming() const;									// Return true if we apply mesh compensation along moves instead of segmenting them
+	float GetBedCompensation(const float xyzPoint[MaxAxes], const Tool *tool) const;	// Return the Z correction that the bed transform applies at a point
+#endif
 	unsigned int GetNumProbePoints() const;							// Return the number of currently used probe points
 	float PushBabyStepping(size_t axis, float amount);				// Try to push some babystepping through the lookahead queue
 
 	GCodeResult ConfigureAccelerations(GCodeBuffer&gb, const StringRef& reply);			// process M204
 	GCodeResult ConfigureDynamicAcceleration(GCodeBuffer& gb, const StringRef& reply);	// process M593
+	GCodeResult ConfigureMovementQueue(GCodeBuffer& gb, const StringRef& reply);		// process M595
+	GCodeResult RunStepRateBenchmark(GCodeBuffer& gb, const StringRef& reply);			// process M122 P106
+	void ClearStepTimingHistograms();												// process M122 P107
 
 	float GetMaxPrintingAcceleration() const { return maxPrintingAcceleration; }
 	float GetMaxTravelAcceleration() const { return maxTravelAcceleration; }
@@ -89,14 +130,24 @@ public:
 	float GetDRCperiod() const { return drcPeriod; }
 	float GetDRCminimumAcceleration() const { return drcMinimumAcceleration; }
 	float IsDRCenabled() const { return drcEnabled; }
+#if SUPPORT_INPUT_SHAPING
+	InputShaper& GetInputShaper() { return inputShaper; }
+	float GetJerkLimit() const { return jerkLimit; }				// the maximum rate of change of acceleration in mm/sec^3, or zero for trapezoidal moves
+#endif
 
 	void Diagnostics(MessageType mtype);							// Report useful stuff
+	uint32_t GetNumHiccups() const { return numHiccups; }			// How many hiccups there have been since we last reported diagnostics
+	const DDARing::PrepareStats& GetPrepareStats() const { return mainDDARing.GetPrepareStats(); }
 
 	// Kinematics and related functions
 	Kinematics& GetKinematics() const { return *kinematics; }
 	bool SetKinematics(KinematicsType k);											// Set kinematics, return true if successful
 	bool CartesianToMotorSteps(const float machinePos[MaxAxes], int32_t motorPos[MaxAxes], bool isCoordinated) const;
 																					// Convert Cartesian coordinates to delta motor coordinates, return true if successful
+	bool CartesianToMotorStepsBatch(size_t numPoints, const float machinePos[][MaxAxes], int32_t motorPos[][MaxAxes], bool isCoordinated) const;
+																					// Convert several sets of Cartesian coordinates to motor coordinates, return true if successful
+	bool CartesianToMotorStepsAlongLine(const float startPos[MaxAxes], const float endPos[MaxAxes], size_t numPoints, int32_t motorPos[][MaxAxes], bool isCoordinated) const;
+																					// Convert equally spaced points along a straight line to motor coordinates, return true if successful
 	void MotorStepsToCartesian(const int32_t motorPos[], size_t numVisibleAxes, size_t numTotalAxes, float machinePos[]) const;
 																					// Convert motor coordinates to machine coordinates
 	void EndPointToMachine(const float coords[], int32_t ep[], size_t numDrives) const;
@@ -109,28 +160,47 @@ public:
 	// End temporary functions
 
 	bool IsRawMotorMove(uint8_t moveType) const;									// Return true if this is a raw motor move
+	bool AddLeadscrewHomingMove(const GCodes::RawMove& nextMove);					// Add a G1 H4 move to home the Z motors individually
 
 	float IdleTimeout() const;														// Returns the idle timeout in seconds
 	void SetIdleTimeout(float timeout);												// Set the idle timeout in seconds
 
 	void Simulate(uint8_t simMode);													// Enter or leave simulation mode
 	float GetSimulationTime() const { return mainDDARing.GetSimulationTime(); }		// Get the accumulated simulation time
+	float GetPlanningTime() const { return (float)planningCycles/(float)SystemCoreClock; }	// Get the CPU time spent planning moves since simulation was last started, in seconds
+	uint32_t GetNumPlannedMoves() const { return numPlannedMoves; }					// Get the number of moves planned since simulation was last started
 
 	bool PausePrint(RestorePoint& rp);												// Pause the print as soon as we can, returning true if we were able to
+	static Mutex& GetMoveMutex();													// Get the mutex that the Move task holds while it reads and prepares moves
+#if SUPPORT_RESUME_JOURNAL
+	bool GetResumePoint(RestorePoint& rp);											// Get the point that we would resume from if the power failed now
+#endif
 #if HAS_VOLTAGE_MONITOR || HAS_STALL_DETECT
 	bool LowPowerOrStallPause(RestorePoint& rp);									// Pause the print immediately, returning true if we were able to
 #endif
+#if HAS_STALL_DETECT
+	void ReduceSpeedOnStall();														// Reduce the speed and acceleration of new moves because a driver stalled
+	float GetStallSpeedFactor() const { return stallSpeedFactor; }					// Get the factor by which we are reducing speed and acceleration because of stalls
+#endif
 
 	bool NoLiveMovement() const { return mainDDARing.IsIdle(); }					// Is a move running, or are there any queued?
 
 	uint32_t GetScheduledMoves() const { return mainDDARing.GetScheduledMoves(); }	// How many moves have been scheduled?
 	uint32_t GetCompletedMoves() const { return mainDDARing.GetCompletedMoves(); }	// How many moves have been completed?
 	void ResetMoveCounters() { mainDDARing.ResetMoveCounters(); }
+	float GetCompletedMoveTime() const { return mainDDARing.GetCompletedMoveTime(); }	// Get the total planned duration of the moves completed since startup
+
+	void ClearScanReadings() { mainDDARing.ClearScanReadings(); }					// Discard any Z probe readings recorded at the ends of moves
+	bool GetScanReading(unsigned int& point, int& reading) { return mainDDARing.GetScanReading(point, reading); }	// Fetch the next Z probe reading recorded at the end of a move
+	unsigned int GetNumLostScanReadings() const { return mainDDARing.GetNumLostScanReadings(); }
 
 	HeightMap& AccessHeightMap() { return heightMap; }								// Access the bed probing grid
+	const HeightMap& AccessHeightMap() const { return heightMap; }
 	const GridDefinition& GetGrid() const { return heightMap.GetGrid(); }			// Get the grid definition
 	bool LoadHeightMapFromFile(FileStore *f, const StringRef& r);					// Load the height map from a file returning true if an error occurred
 	bool SaveHeightMapToFile(FileStore *f) const;									// Save the height map to a file returning true if an error occurred
+	bool LoadHeightMapFromBinaryFile(FileStore *f, uint32_t csvLength, uint32_t csvTime);	// Load the binary copy of a height map file returning true if an error occurred
+	bool SaveHeightMapToBinaryFile(FileStore *f, uint32_t csvLength, uint32_t csvTime) const;	// Save a binary copy of the height map returning true if an error occurred
 
 	const RandomProbePointSet& GetProbePoints() const { return probePoints; }		// Return the probe point set constructed from G30 commands
 
@@ -140,6 +210,13 @@ public:
 	float GetRequestedSpeed() const { return mainDDARing.GetRequestedSpeed(); }
 
 	void AdjustLeadscrews(const floatc_t corrections[]);							// Called by some Kinematics classes to adjust the leadscrews
+#if SUPPORT_ASYNC_MOVES
+	bool AddAuxiliaryMove(const float amounts[], size_t numAmounts, float feedRate);	// Queue an extruder move that runs independently of the main moves
+	bool AuxiliaryMovesFinished() const;								// Return true if no auxiliary moves are pending or executing
+#endif
+	void SetLeadscrewHomed(size_t driver, int32_t steps);							// Called by the step ISR when a Z motor reaches its endstop in a G1 H4 move
+	bool IsLeadscrewHomed(size_t driver) const { return IsBitSet(leadscrewsHomed, driver); }
+	int32_t GetLeadscrewHomingSteps(size_t driver) const { return leadscrewHomingSteps[driver]; }
 
 	int32_t GetAccumulatedExtrusion(size_t extruder, bool& isPrinting);				// Return and reset the accumulated commanded extrusion amount
 
@@ -149,6 +226,8 @@ public:
 
 	unsigned int GetJerkPolicy() const { return jerkPolicy; }
 	void SetJerkPolicy(unsigned int jp) { jerkPolicy = jp; }
+	float GetJunctionDeviation() const { return junctionDeviation; }
+	void SetJunctionDeviation(float jd) { junctionDeviation = max<float>(jd, 0.0); }
 
 #if HAS_SMART_DRIVERS
 	uint32_t GetStepInterval(size_t axis, uint32_t microstepShift) const;			// Get the current step interval for this axis or extruder
@@ -173,10 +252,16 @@ private:
 	void InverseBedTransform(float move[MaxAxes], const Tool *tool) const;	// Go from a bed-transformed point back to user coordinates
 	void AxisTransform(float move[MaxAxes], const Tool *tool) const;		// Take a position and apply the axis-angle compensations
 	void InverseAxisTransform(float move[MaxAxes], const Tool *tool) const;	// Go from an axis transformed point back to user coordinates
+	void UpdateLinearTransform();										// Recalculate the combined axis and bed transform after the compensation has changed
 	void SetPositions(const float move[MaxTotalDrivers]) { return mainDDARing.SetPositions(move); }	// Force the machine coordinates to be these;
 	float GetInterpolatedHeightError(float xCoord, float yCoord) const;		// Get the height error at an XY position
 
 	DDARing mainDDARing;								// The DDA ring used for regular moves
+#if SUPPORT_ASYNC_MOVES
+	DDARing auxDDARing;									// The DDA ring used for auxiliary extruder moves, which run independently of the main ring
+	GCodes::RawMove auxMove;							// An auxiliary move that GCodes has given us but we haven't yet added to the auxiliary ring
+	volatile bool auxMoveAvailable;						// True if auxMove holds a move that we haven't taken yet
+#endif
 
 	bool active;										// Are we live and running?
 	uint8_t simulationMode;								// Are we simulating, or really printing?
@@ -187,17 +272,38 @@ private:
 	float maxTravelAcceleration;
 	float drcPeriod;									// the period of ringing that we don't want to excite
 	float drcMinimumAcceleration;						// the minimum value that we reduce acceleration to
+#if SUPPORT_INPUT_SHAPING
+	InputShaper inputShaper;							// the ZV, ZVD or EI shaper if enabled
+	float jerkLimit;									// the maximum rate of change of acceleration set by M204 J, or zero
+#endif
+
+#if HAS_STALL_DETECT
+	float stallSpeedFactor;								// the factor by which we reduce the speed and acceleration of new moves because drivers stalled
+	uint32_t whenStallSpeedFactorChanged;				// when we last reduced or restored stallSpeedFactor
+	uint32_t numStallSlowdowns;							// how many times we have reduced stallSpeedFactor
+#endif
 
 	unsigned int jerkPolicy;							// When we allow jerk
+	float junctionDeviation;							// If nonzero, XYZ corner speeds are limited using this junction deviation in mm instead of the XYZ jerk limits
 	unsigned int idleCount;								// The number of times Spin was called and had no new moves to process
 	uint32_t longestGcodeWaitInterval;					// the longest we had to wait for a new GCode
 	uint32_t numHiccups;								// How many times we delayed an interrupt to avoid using too much CPU time in interrupts
+	uint64_t planningCycles;							// CPU cycles spent fetching, adding and preparing moves since simulation was last started
+	uint32_t numPlannedMoves;							// How many moves we added to the main ring since simulation was last started
+	TimingHistogram isrDurations;						// Distribution of step ISR durations in CPU cycles
 
 	float tangents[3]; 									// Axis compensation - 90 degrees + angle gives angle between axes
 	float& tanXY = tangents[0];
 	float& tanYZ = tangents[1];
 	float& tanXZ = tangents[2];
 
+	// The axis compensation and a linear bed compensation combined into one XYZ affine transform, for tools that use only the X and Y axes.
+	// The Z offset that it adds is linearZOffset plus linearPlaneX and linearPlaneY times the tool's X and Y offsets.
+	float linearTransform[XYZ_AXES][XYZ_AXES];
+	float inverseLinearTransform[XYZ_AXES][XYZ_AXES];
+	float linearPlaneX, linearPlaneY, linearZOffset;
+	bool linearTransformIncludesBed;					// True if the bed compensation is linear and not tapered, so it is included in the combined transform
+
 	HeightMap heightMap;    							// The grid definition in use and height map for G29 bed probing
 	RandomProbePointSet probePoints;					// G30 bed probe points
 	float taperHeight;									// Height over which we taper
@@ -205,6 +311,9 @@ private:
 	float zShift;										// Height to add to the bed transform
 	bool usingMesh;										// true if we are using the height map, false if we are using the random probe point set
 	bool useTaper;										// True to taper off the compensation
+#if SUPPORT_SEGMENT_FREE_STREAMING
+	bool streamMesh;									// True to apply mesh compensation to the Z motor along each move instead of segmenting moves at the grid lines
+#endif
 
 	uint32_t idleTimeout;								// How long we wait with no activity before we reduce motor currents to idle, in milliseconds
 	uint32_t lastStateChangeTime;						// The approximate time at which the state last changed, except we don't record timing->idle
@@ -213,6 +322,11 @@ private:
 
 	float specialMoveCoords[MaxTotalDrivers];			// Amounts by which to move individual motors (leadscrew adjustment move)
 	bool bedLevellingMoveAvailable;						// True if a leadscrew adjustment move is pending
+
+	volatile int32_t leadscrewHomingSteps[NumDirectDrivers];	// How far each Z motor moved in the last G1 H4 move before its endstop triggered, in steps
+	volatile uint32_t leadscrewsHomed;					// Bitmap of the drivers whose endstops triggered in the last G1 H4 move
+
+	DDA *benchmarkDdas[2];								// DDAs used by the step rate benchmark, allocated when first needed
 };
 
 //******************************************************************************************************
@@ -0,0 +1,111 @@
+/*
+ * MoveTrace.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "MoveTrace.h"
+
+#if SUPPORT_MOVE_TRACE
+
+#include "Platform.h"
+#include "RepRap.h"
+#include "StepTimer.h"
+
+namespace MoveTrace
+{
+	// The file starts with this header, so that the tool reading it knows the record layout and how to convert step clocks to time
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t recordSize;
+		uint32_t numRecords;
+		uint32_t stepClockRate;
+	};
+
+	constexpr uint32_t FileMagic = 0x54564D52;					// "RMVT" in little-endian order
+	constexpr uint16_t FileVersion = 1;
+
+	static MoveTraceRecord records[NumRecords];
+	static volatile size_t nextRecord = 0;						// only written by the ISR, except when we clear the ring
+	static volatile uint32_t numRecorded = 0;					// how many records we have added since the ring was cleared, saturating at NumRecords
+}
+
+void MoveTrace::Record(const MoveTraceRecord& rec)
+{
+	const size_t n = nextRecord;
+	records[n] = rec;
+	nextRecord = (n + 1) % NumRecords;
+	if (numRecorded < NumRecords)
+	{
+		numRecorded = numRecorded + 1;
+	}
+}
+
+void MoveTrace::Clear()
+{
+	const irqflags_t flags = cpu_irq_save();
+	nextRecord = 0;
+	numRecorded = 0;
+	cpu_irq_restore(flags);
+}
+
+// Write the records to the trace file, oldest first, and then clear the ring so that the next dump shows only later moves.
+// The ISR goes on adding records while we write the file, so we copy each one with interrupts disabled and stop when we reach the ones added since we started.
+GCodeResult MoveTrace::WriteFile(const StringRef& reply)
+{
+	Platform& platform = reprap.GetPlatform();
+	FileStore * const f = platform.OpenSysFile(FileName, OpenMode::write);
+	if (f == nullptr)
+	{
+		reply.printf("Failed to create file %s", FileName);
+		return GCodeResult::error;
+	}
+
+	irqflags_t flags = cpu_irq_save();
+	const uint32_t count = numRecorded;
+	size_t index = (nextRecord + NumRecords - count) % NumRecords;
+	nextRecord = 0;
+	numRecorded = 0;
+	cpu_irq_restore(flags);
+
+	const FileHeader header = { FileMagic, FileVersion, (uint16_t)sizeof(MoveTraceRecord), count, StepTimer::StepClockRate };
+	bool ok = f->Write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+	uint32_t numWritten = 0;
+	while (ok && numWritten < count)
+	{
+		flags = cpu_irq_save();
+		const bool overwritten = index < numRecorded;				// the ISR refills the ring from slot 0, so it has already reused this slot
+		const MoveTraceRecord rec = records[index];
+		cpu_irq_restore(flags);
+		if (overwritten)
+		{
+			break;
+		}
+		ok = f->Write(reinterpret_cast<const uint8_t*>(&rec), sizeof(rec));
+		index = (index + 1) % NumRecords;
+		++numWritten;
+	}
+
+	// If the ISR overwrote some of the old records before we could write them, correct the count in the header
+	if (ok && numWritten != count)
+	{
+		const FileHeader newHeader = { FileMagic, FileVersion, (uint16_t)sizeof(MoveTraceRecord), numWritten, StepTimer::StepClockRate };
+		ok = f->Seek(0) && f->Write(reinterpret_cast<const uint8_t*>(&newHeader), sizeof(newHeader));
+	}
+	ok = f->Close() && ok;
+
+	if (!ok)
+	{
+		reply.printf("Failed to write file %s", FileName);
+		return GCodeResult::error;
+	}
+	reply.printf("Wrote %" PRIu32 " move records to %s", numWritten, FileName);
+	return GCodeResult::ok;
+}
+
+#endif
+
+// End
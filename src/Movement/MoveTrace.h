@@ -0,0 +1,52 @@
+/*
+ * MoveTrace.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_MOVETRACE_H_
+#define SRC_MOVEMENT_MOVETRACE_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_MOVE_TRACE
+
+#include "GCodes/GCodeResult.h"
+
+// A compact record of one completed move, for finding out after a print which moves were starved of prepared moves or slowed by lookahead
+struct MoveTraceRecord
+{
+	// Values of the flags field
+	static constexpr uint8_t FlagStartedLate = 1u << 0;			// the ISR wanted this move before it had been prepared, so the motion stopped
+	static constexpr uint8_t FlagLookaheadUnderrun = 1u << 1;	// the lookahead queue was not long enough to optimise this move
+	static constexpr uint8_t FlagPrintingMove = 1u << 2;		// the move included XY movement and extrusion
+	static constexpr uint8_t FlagNonPrintingExtruderMove = 1u << 3;	// the move was a fast extruder-only move, probably a retract or re-prime
+
+	static constexpr float SpeedUnitsPerMmPerSec = 10.0;		// speeds are held in units of 0.1mm/sec
+
+	uint32_t startTime;											// step clock at which the move started, including any hiccups before it started
+	uint32_t clocksNeeded;										// the planned duration of the move in step clocks, excluding hiccups
+	uint16_t startSpeed;										// the speeds after lookahead, in units of 0.1mm/sec
+	uint16_t topSpeed;
+	uint16_t endSpeed;
+	uint8_t numHiccups;											// how many times the step ISR delayed this move to avoid using too much CPU time, saturating at 255
+	uint8_t flags;
+};
+
+static_assert(sizeof(MoveTraceRecord) == 16, "Unexpected size of move trace record");
+
+// A ring of the most recently completed moves, written by the step ISR. M122 P111 writes it to a system file, which can then be fetched over HTTP.
+namespace MoveTrace
+{
+	constexpr size_t NumRecords = 256;
+	constexpr const char* FileName = "movetrace.bin";
+
+	void Record(const MoveTraceRecord& rec) __attribute__ ((hot));	// Add a record, overwriting the oldest one if the ring is full. Only called from the step ISR.
+	void Clear();
+	GCodeResult WriteFile(const StringRef& reply);				// Write the records to the trace file, oldest first
+}
+
+#endif
+
+#endif /* SRC_MOVEMENT_MOVETRACE_H_ */
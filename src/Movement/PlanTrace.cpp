@@ -0,0 +1,140 @@
+/*
+ * PlanTrace.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "PlanTrace.h"
+
+#if SUPPORT_PLAN_TRACE
+
+#include "DDA.h"
+#include "Platform.h"
+#include "RepRap.h"
+#include "StepTimer.h"
+
+namespace PlanTrace
+{
+	// The file starts with this header, so that the tool comparing traces knows the record layout and how to convert step clocks to time
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t recordSize;
+		uint32_t numRecords;
+		uint32_t stepClockRate;
+		uint32_t numDrives;
+	};
+
+	constexpr uint32_t FileMagic = 0x54504652;					// "RFPT" in little-endian order
+	constexpr uint16_t FileVersion = 1;
+
+	static PlanTraceRecord records[NumRecords];
+	static volatile size_t addIndex = 0;						// only written by the Move task
+	static volatile size_t writeIndex = 0;						// only written by the GCodes task
+	static FileStore *volatile traceFile = nullptr;
+	static uint32_t numMoves = 0;
+	static uint32_t numWritten = 0;
+	static bool writeFailed = false;
+
+	static void WriteHeader(uint32_t count)
+	{
+		const FileHeader header = { FileMagic, FileVersion, (uint16_t)sizeof(PlanTraceRecord), count, StepTimer::StepClockRate, MaxTotalDrivers };
+		if (!traceFile->Write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)))
+		{
+			writeFailed = true;
+		}
+	}
+}
+
+GCodeResult PlanTrace::Start(const char *filename, const StringRef& reply)
+{
+	Stop();
+	FileStore * const f = reprap.GetPlatform().OpenSysFile(filename, OpenMode::write);
+	if (f == nullptr)
+	{
+		reply.printf("Failed to create file %s", filename);
+		return GCodeResult::error;
+	}
+	addIndex = writeIndex = 0;
+	numMoves = numWritten = 0;
+	writeFailed = false;
+	traceFile = f;
+	WriteHeader(0);												// the count is filled in when the trace is stopped
+	return GCodeResult::ok;
+}
+
+void PlanTrace::Stop()
+{
+	if (traceFile != nullptr)
+	{
+		Spin();
+		FileStore * const f = traceFile;
+		if (!writeFailed && f->Seek(0))
+		{
+			WriteHeader(numWritten);
+		}
+		traceFile = nullptr;
+		if (!f->Close() || writeFailed)
+		{
+			reprap.GetPlatform().Message(ErrorMessage, "Failed to write the plan trace file\n");
+		}
+	}
+}
+
+bool PlanTrace::Record(const DDA& dda)
+{
+	if (traceFile == nullptr)
+	{
+		return true;
+	}
+
+	const size_t n = addIndex;
+	const size_t next = (n + 1) % NumRecords;
+	if (next == writeIndex)
+	{
+		return false;
+	}
+
+	PlanTraceRecord& rec = records[n];
+	rec.moveNumber = numMoves++;
+	rec.clocksNeeded = dda.GetClocksNeeded();
+	rec.startSpeed = dda.GetStartSpeed();
+	rec.topSpeed = dda.GetTopSpeed();
+	rec.endSpeed = dda.GetEndSpeed();
+	rec.acceleration = dda.GetAcceleration();
+	rec.deceleration = dda.GetDeceleration();
+	memcpy(rec.endPoint, dda.DriveCoordinates(), sizeof(rec.endPoint));
+	addIndex = next;
+	return true;
+}
+
+void PlanTrace::Spin()
+{
+	FileStore * const f = traceFile;
+	if (f != nullptr)
+	{
+		size_t n = writeIndex;
+		while (n != addIndex)
+		{
+			if (!writeFailed)
+			{
+				if (f->Write(reinterpret_cast<const uint8_t*>(&records[n]), sizeof(PlanTraceRecord)))
+				{
+					++numWritten;
+				}
+				else
+				{
+					writeFailed = true;								// keep emptying the ring so that the simulation doesn't stall
+				}
+			}
+			n = (n + 1) % NumRecords;
+			writeIndex = n;
+		}
+	}
+}
+
+#endif
+
+// End
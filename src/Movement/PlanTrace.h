@@ -0,0 +1,47 @@
+/*
+ * PlanTrace.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_PLANTRACE_H_
+#define SRC_MOVEMENT_PLANTRACE_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_PLAN_TRACE
+
+#include "GCodes/GCodeResult.h"
+
+class DDA;
+
+// The planner output for one move, as recorded while simulating a file
+struct PlanTraceRecord
+{
+	uint32_t moveNumber;										// counts the moves completed since the trace was started
+	uint32_t clocksNeeded;										// the planned duration of the move in step clocks
+	float startSpeed;											// the speeds after lookahead, in mm/sec
+	float topSpeed;
+	float endSpeed;
+	float acceleration;											// the acceleration and deceleration used, in mm/sec^2
+	float deceleration;
+	int32_t endPoint[MaxTotalDrivers];							// the machine coordinates of the end of the move, in steps
+};
+
+// A trace of the planned moves of a simulated print, written to a system file so that the planner output of two firmware builds can be compared move by move.
+// Simulation doesn't depend on the timing of the step interrupt or on the hardware, so the same file and configuration always produce the same trace.
+// The Move task adds the records to a small ring and the GCodes task writes them to the file. If the ring is full, the simulated move is held back until there is room.
+namespace PlanTrace
+{
+	constexpr size_t NumRecords = 32;
+
+	GCodeResult Start(const char *filename, const StringRef& reply);	// Create the trace file. Called by the GCodes task when it starts simulating a file.
+	void Stop();												// Write any remaining records and close the file
+	bool Record(const DDA& dda);								// Add a record if we are tracing. Returns false if the ring is full. Only called from the Move task.
+	void Spin();												// Write the pending records to the file. Only called from the GCodes task.
+}
+
+#endif
+
+#endif /* SRC_MOVEMENT_PLANTRACE_H_ */
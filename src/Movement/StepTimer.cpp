@@ -33,6 +33,7 @@ namespace StepTimer
 		// 1.524us resolution on the Duet 085 (84MHz clock)
 		// 1.067us resolution on the Duet WiFi (120MHz clock)
 		// 0.853us resolution on the SAM E70 (150MHz peripheral clock)
+		// If the fast step clock is enabled then on the SAM4E and SAM E70 we use a divisor of 32 instead, which gives 4 times the resolution.
 
 #if __LPC17xx__
 		//LPC has 32bit timers
@@ -51,7 +52,8 @@ namespace StepTimer
 #else
 		pmc_set_writeprotect(false);
 		pmc_enable_periph_clk(STEP_TC_ID);
-		tc_init(STEP_TC, STEP_TC_CHAN, TC_CMR_WAVE | TC_CMR_WAVSEL_UP | TC_CMR_TCCLKS_TIMER_CLOCK4 | TC_CMR_EEVT_XC0);	// must set TC_CMR_EEVT nonzero to get RB compare interrupts
+		constexpr uint32_t clockSelect = (StepClockDivisor == 32) ? TC_CMR_TCCLKS_TIMER_CLOCK3 : TC_CMR_TCCLKS_TIMER_CLOCK4;
+		tc_init(STEP_TC, STEP_TC_CHAN, TC_CMR_WAVE | TC_CMR_WAVSEL_UP | clockSelect | TC_CMR_EEVT_XC0);	// must set TC_CMR_EEVT nonzero to get RB compare interrupts
 		STEP_TC->TC_CHANNEL[STEP_TC_CHAN].TC_IDR = ~(uint32_t)0;	// interrupts disabled for now
 #if SAM4S || SAME70													// if 16-bit TCs
 		STEP_TC->TC_CHANNEL[STEP_TC_CHAN].TC_IER = TC_IER_COVFS;	// enable the overflow interrupt so that we can use it to extend the count to 32-bits
@@ -61,6 +63,14 @@ namespace StepTimer
 		NVIC_SetPriority(STEP_TC_IRQN, NvicPriorityStep);			// set priority for this IRQ
 		NVIC_EnableIRQ(STEP_TC_IRQN);
 #endif
+
+		// Enable the CPU cycle counter, which we use to time the step ISR
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+#if SAME70
+		DWT->LAR = 0xC5ACCE55;										// unlock the DWT registers
+#endif
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 	}
 
 #if SAM4S || SAME70
@@ -101,24 +111,9 @@ namespace StepTimer
 
 #endif
 
-	// Schedule an interrupt at the specified clock count, or return true if that time is imminent or has passed already.
-	// On entry, interrupts must be disabled or the base priority must be <= step interrupt priority.
-	/*static*/ bool ScheduleStepInterrupt(uint32_t tim)
+	// Set up the step interrupt to occur at the specified clock count. Must be called with interrupts disabled.
+	static inline void SetStepInterruptTime(uint32_t tim)
 	{
-		if (stepInterruptIsScheduled && (int32_t)(tim - nextStepInterruptScheduledAt) > 0)
-		{
-			return false;											// an interrupt is already scheduled
-		}
-
-		// We need to disable all interrupts, because once we read the current step clock we have only 6us to set up the interrupt, or we will miss it
-		const irqflags_t flags = cpu_irq_save();
-		const int32_t diff = (int32_t)(tim - GetInterruptClocksInterruptsDisabled());	// see how long we have to go
-		if (diff < (int32_t)DDA::MinInterruptInterval)				// if less than about 6us or already passed
-		{
-			cpu_irq_restore(flags);
-			return true;											// tell the caller to execute the ISR instead
-		}
-
 		nextStepInterruptScheduledAt = tim;
 		stepInterruptIsScheduled = true;
 
@@ -139,10 +134,44 @@ namespace StepTimer
 			nextInterruptTime = tim;
 			nextInterruptScheduledAt = GetInterruptClocksInterruptsDisabled();
 #endif
+	}
+
+	// Schedule an interrupt at the specified clock count, or return true if that time is imminent or has passed already.
+	// On entry, interrupts must be disabled or the base priority must be <= step interrupt priority.
+	/*static*/ bool ScheduleStepInterrupt(uint32_t tim)
+	{
+		if (stepInterruptIsScheduled && (int32_t)(tim - nextStepInterruptScheduledAt) > 0)
+		{
+			return false;											// an interrupt is already scheduled
+		}
+
+		// We need to disable all interrupts, because once we read the current step clock we have only 6us to set up the interrupt, or we will miss it
+		const irqflags_t flags = cpu_irq_save();
+		const int32_t diff = (int32_t)(tim - GetInterruptClocksInterruptsDisabled());	// see how long we have to go
+		if (diff < (int32_t)DDA::MinInterruptInterval)				// if less than about 6us or already passed
+		{
+			cpu_irq_restore(flags);
+			return true;											// tell the caller to execute the ISR instead
+		}
+
+		SetStepInterruptTime(tim);
 		cpu_irq_restore(flags);
 		return false;
 	}
 
+	// Make sure that a step interrupt occurs soon, so that the step ISR can start a move that the Move task has just prepared.
+	// This is called from the Move task with step interrupts enabled. Unlike ScheduleStepInterrupt, it never asks the caller to execute the ISR.
+	void TriggerStepInterrupt()
+	{
+		const irqflags_t flags = cpu_irq_save();
+		const uint32_t tim = GetInterruptClocksInterruptsDisabled() + 2 * DDA::MinInterruptInterval;
+		if (!stepInterruptIsScheduled || (int32_t)(tim - nextStepInterruptScheduledAt) < 0)
+		{
+			SetStepInterruptTime(tim);
+		}
+		cpu_irq_restore(flags);
+	}
+
 	// Make sure we get no step interrupts
 	void DisableStepInterrupt()
 	{
@@ -204,7 +233,7 @@ namespace StepTimer
 }
 
 // Step pulse timer interrupt
-extern "C" void STEP_TC_HANDLER() __attribute__ ((hot));
+extern "C" void STEP_TC_HANDLER() STEP_ISR_CODE;
 
 void STEP_TC_HANDLER()
 {
@@ -12,10 +12,19 @@
 
 namespace StepTimer
 {
-	constexpr uint32_t StepClockRate = VARIANT_MCK/128;					// just under 1MHz
+#if SUPPORT_FAST_STEP_CLOCK && (SAME70 || SAM4E)
+# if SUPPORT_CAN_EXPANSION
+#  error "The fast step clock can't be used with CAN expansion, because the expansion boards use the standard step clock rate"
+# endif
+	constexpr uint32_t StepClockDivisor = 32;							// TIMER_CLOCK3, about 4.7MHz on the SAM E70 and 3.75MHz on the SAM4E
+#else
+	constexpr uint32_t StepClockDivisor = 128;							// TIMER_CLOCK4
+#endif
+	constexpr uint32_t StepClockScale = 128/StepClockDivisor;			// the number of step clocks in the period of the standard step clock
+	constexpr uint32_t StepClockRate = VARIANT_MCK/StepClockDivisor;	// just under 1MHz unless we are using the fast step clock
 	constexpr uint64_t StepClockRateSquared = (uint64_t)StepClockRate * StepClockRate;
 	constexpr float StepClocksToMillis = 1000.0/(float)StepClockRate;
-	constexpr uint32_t MinInterruptInterval = 6;						// 12 clocks is about 6us
+	constexpr uint32_t MinInterruptInterval = 6 * StepClockScale;		// about 6us
 
 	void Init();
 
@@ -54,7 +63,14 @@ namespace StepTimer
 #endif
 	}
 
-	bool ScheduleStepInterrupt(uint32_t tim) __attribute__ ((hot));		// Schedule an interrupt at the specified clock count, or return true if it has passed already
+	// Get the CPU cycle count. This has much finer resolution than the step clock, so we use it to time the step ISR.
+	static inline uint32_t GetCycleCount()
+	{
+		return DWT->CYCCNT;
+	}
+
+	bool ScheduleStepInterrupt(uint32_t tim) STEP_ISR_CODE;		// Schedule an interrupt at the specified clock count, or return true if it has passed already
+	void TriggerStepInterrupt();										// Make sure that a step interrupt occurs soon
 	void DisableStepInterrupt();										// Make sure we get no step interrupts
 	bool ScheduleSoftTimerInterrupt(uint32_t tim);						// Schedule an interrupt at the specified clock count, or return true if it has passed already
 	void DisableSoftTimerInterrupt();									// Make sure we get no software timer interrupts
@@ -313,6 +313,10 @@ private:
 	static constexpr unsigned int ReadMsCnt = 2;
 	static constexpr unsigned int ReadPwmScale = 3;
 
+	// The order in which we read the registers. DRV_STATUS holds the stall, temperature and open load flags, so we read it every other time.
+	static constexpr unsigned int ReadScheduleLength = 6;
+	static const uint8_t ReadSchedule[ReadScheduleLength];
+
 	volatile uint32_t writeRegisters[NumWriteRegisters];	// the values we want the TMC22xx writable registers to have
 	volatile uint32_t readRegisters[NumReadRegisters];		// the last values read from the TMC22xx readable registers
 	volatile uint32_t accumulatedReadRegisters[NumReadRegisters];
@@ -347,7 +351,7 @@ private:
 	Pin enablePin;											// the enable pin of this driver, if it has its own
 	uint8_t driverNumber;									// the number of this driver as addressed by the UART multiplexer
 	uint8_t standstillCurrentFraction;						// divide this by 256 to get the motor current standstill fraction
-	uint8_t registerToRead;									// the next register we need to read
+	uint8_t readScheduleIndex;								// the index into ReadSchedule of the next register we need to read
 	uint8_t lastIfCount;									// the value of the IFCNT register last time we read it
 	volatile uint8_t writeRegCRCs[NumWriteRegisters];		// CRCs of the messages needed to update the registers
 	static const uint8_t ReadRegCRCs[NumReadRegisters];		// CRCs of the messages needed to read the registers
@@ -397,6 +401,16 @@ const uint8_t TmcDriverState::ReadRegNumbers[NumReadRegisters] =
 	REGNUM_PWM_SCALE
 };
 
+const uint8_t TmcDriverState::ReadSchedule[ReadScheduleLength] =
+{
+	ReadDrvStat,
+	ReadGStat,
+	ReadDrvStat,
+	ReadMsCnt,
+	ReadDrvStat,
+	ReadPwmScale
+};
+
 const uint8_t TmcDriverState::ReadRegCRCs[NumReadRegisters] =
 {
 	CRCAddByte(InitialSendCRC, ReadRegNumbers[0]),
@@ -537,7 +551,7 @@ pre(!driversPowered)
 		accumulatedReadRegisters[i] = readRegisters[i] = 0;
 	}
 	registerBeingUpdated = 0;
-	registerToRead = 0;
+	readScheduleIndex = 0;
 	lastIfCount = 0;
 	readErrors = writeErrors = numReads = numTimeouts = 0;
 }
@@ -801,6 +815,7 @@ inline void TmcDriverState::TransferDone()
 	}
 	else if (driversState != DriversState::noPower)		// we don't check the CRC, so only accept the result if power is still good
 	{
+		const size_t registerToRead = ReadSchedule[readScheduleIndex];
 		if (sendData[2] == ReadRegNumbers[registerToRead] && ReadRegNumbers[registerToRead] == receiveData[6] && receiveData[4] == 0x05 && receiveData[5] == 0xFF)
 		{
 			// We asked to read the scheduled read register, and the sync byte, slave address and register number in the received message match
@@ -821,10 +836,10 @@ inline void TmcDriverState::TransferDone()
 			readRegisters[registerToRead] = regVal;
 			accumulatedReadRegisters[registerToRead] |= regVal;
 
-			++registerToRead;
-			if (registerToRead == NumReadRegisters)
+			++readScheduleIndex;
+			if (readScheduleIndex == ReadScheduleLength)
 			{
-				registerToRead = 0;
+				readScheduleIndex = 0;
 			}
 			++numReads;
 		}
@@ -893,6 +908,7 @@ inline void TmcDriverState::StartTransfer()
 		// Read a register
 		const irqflags_t flags = cpu_irq_save();		// avoid race condition
 		uart->UART_CR = UART_CR_RSTRX | UART_CR_RSTTX;	// reset transmitter and receiver
+		const size_t registerToRead = ReadSchedule[readScheduleIndex];
 		SetupDMAReceive(ReadRegNumbers[registerToRead], ReadRegCRCs[registerToRead]);	// set up the PDC
 		uart->UART_IER = UART_IER_ENDRX;				// enable end-of-receive interrupt
 		uart->UART_CR = UART_CR_RXEN | UART_CR_TXEN;	// enable transmitter and receiver
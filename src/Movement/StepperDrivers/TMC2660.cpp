@@ -217,6 +217,7 @@ public:
 
 	void TransferDone() __attribute__ ((hot));						// called by the ISR when the SPI transfer has completed
 	void StartTransfer() __attribute__ ((hot));						// called to start a transfer
+	void DecodeStatus(Move& move) __attribute__ ((hot));			// called by the ISR to decode the status that TransferDone captured
 
 	uint32_t ReadLiveStatus() const;
 	uint32_t ReadAccumulatedStatus(uint32_t bitsToKeep);
@@ -256,6 +257,9 @@ private:
 	uint32_t maxSgLoadRegister;								// the maximum value of the StallGuard bits we read
 	uint32_t mstepPosition;									// the current microstep position, or 0xFFFFFFFF if unknown
 
+	uint32_t rawStatusIn;									// the data that we received in the most recent transfer, not yet decoded
+	uint32_t rawDataOut;									// the data that we sent in the most recent transfer
+	bool statusPending;										// true if rawStatusIn holds a status that we haven't decoded yet
 	volatile uint32_t lastReadStatus;						// the status word that we read most recently, updated by the ISR
 	volatile uint32_t accumulatedStatus;
 	bool enabled;
@@ -410,6 +414,7 @@ pre(!driversPowered)
 	registers[DriveConfig] = defaultDrvConfReg;
 	registersToUpdate = UpdateAllRegisters;
 	accumulatedStatus = lastReadStatus = 0;
+	statusPending = false;
 	rdselState = 0xFF;
 	mstepPosition = 0xFFFFFFFF;
 	ResetLoadRegisters();
@@ -715,15 +720,27 @@ unsigned int TmcDriverState::GetMicrostepping(bool& interpolation) const
 	return 1u << microstepShiftFactor;
 }
 
-// This is called by the ISR when the SPI transfer has completed
+// This is called by the ISR when the SPI transfer has completed. It does as little as possible, so that the next transfer can be started quickly.
 inline void TmcDriverState::TransferDone()
 {
 	fastDigitalWriteHigh(pin);									// set the CS pin high for the driver we just polled
-	if (driversPowered)											// if the power is still good, update the status
+	if (driversPowered)											// if the power is still good, capture the status
 	{
 		Cache::InvalidateAfterDMAReceive(&spiDataIn, sizeof(spiDataIn));
-		uint32_t status = be32_to_cpu(spiDataIn) >> 12;			// get the status
-		const uint32_t interval = reprap.GetMove().GetStepInterval(axisNumber, microstepShiftFactor);		// get the full step interval
+		rawStatusIn = spiDataIn;
+		rawDataOut = spiDataOut;
+		statusPending = true;
+	}
+}
+
+// Decode the status that TransferDone captured. The ISR calls this for all drivers once per polling cycle, while the transfer to the first driver is in progress.
+inline void TmcDriverState::DecodeStatus(Move& move)
+{
+	if (statusPending)
+	{
+		statusPending = false;
+		uint32_t status = be32_to_cpu(rawStatusIn) >> 12;		// get the status
+		const uint32_t interval = move.GetStepInterval(axisNumber, microstepShiftFactor);		// get the full step interval
 		if (interval == 0 || interval > maxStallStepInterval)	// if the motor speed is too low to get reliable stall indication
 		{
 			status &= ~TMC_RR_SG;								// remove the stall status bit
@@ -755,7 +772,7 @@ inline void TmcDriverState::TransferDone()
 		lastReadStatus = status;
 		accumulatedStatus |= status;
 
-		const uint32_t dataWritten = be32_to_cpu(spiDataOut) >> 8;
+		const uint32_t dataWritten = be32_to_cpu(rawDataOut) >> 8;
 		if ((dataWritten & TMC_REGNUM_MASK) == TMC_REG_DRVCONF)
 		{
 			rdselState = (dataWritten & TMC_DRVCONF_RDSEL_MASK) >> TMC_DRVCONF_RDSEL_SHIFT;
@@ -821,6 +838,16 @@ inline void TmcDriverState::StartTransfer()
 
 extern "C" void TMC2660_SPI_Handler(void) __attribute__ ((hot));
 
+// Decode the captured status of all the drivers
+static void DecodeAllStatus()
+{
+	Move& move = reprap.GetMove();
+	for (size_t i = 0; i < numTmc2660Drivers; ++i)
+	{
+		driverStates[i].DecodeStatus(move);
+	}
+}
+
 void TMC2660_SPI_Handler(void)
 {
 	TmcDriverState *driver = currentDriver;				// capture volatile variable
@@ -833,9 +860,15 @@ void TMC2660_SPI_Handler(void)
 			++driver;									// advance to the next driver
 			if (driver == driverStates + numTmc2660Drivers)
 			{
+				// We have polled all the drivers. Start the next cycle, then decode the status of all the drivers while the first transfer is in progress.
 				driver = driverStates;
+				driver->StartTransfer();
+				DecodeAllStatus();
+			}
+			else
+			{
+				driver->StartTransfer();
 			}
-			driver->StartTransfer();
 			return;
 		}
 	}
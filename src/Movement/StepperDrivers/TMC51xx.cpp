@@ -225,6 +225,7 @@ constexpr uint8_t REGNUM_COOLCONF = 0x6D;
 constexpr uint32_t COOLCONF_SGFILT = 1 << 24;				// set to update stallGuard status every 4 full steps instead of every full step
 constexpr uint32_t COOLCONF_SGT_SHIFT = 16;
 constexpr uint32_t COOLCONF_SGT_MASK = 128 << COOLCONF_SGT_SHIFT;	// stallguard threshold (signed)
+constexpr uint32_t COOLCONF_COOLSTEP_MASK = 0xFFFF;			// SEMIN, SEUP, SEMAX, SEDN and SEIMIN. CoolStep is disabled when SEMIN is zero.
 
 constexpr uint32_t DefaultCoolConfReg = 0;
 
@@ -283,6 +284,7 @@ public:
 	void SetStandstillCurrentPercent(float percent);
 
 	static void TransferTimedOut() { ++numTimeouts; }
+	const DriverLoadTelemetry& GetLoadTelemetry() const { return loadTelemetry; }
 
 	uint32_t ReadLiveStatus() const;
 	uint32_t ReadAccumulatedStatus(uint32_t bitsToKeep);
@@ -346,6 +348,7 @@ private:
 	uint32_t axisNumber;									// the axis number of this driver as used to index the DriveMovements in the DDA
 	uint32_t microstepShiftFactor;							// how much we need to shift 1 left by to get the current microstepping
 	uint32_t motorCurrent;									// the configured motor current in mA
+	DriverLoadTelemetry loadTelemetry;						// the load and coolStep current that we last read back
 
 	uint16_t numReads, numWrites;							// how many successful reads and writes we had
 	static uint16_t numTimeouts;							// how many times a transfer timed out
@@ -418,6 +421,8 @@ pre(!driversPowered)
 
 	regIndexBeingUpdated = regIndexRequested = previousRegIndexRequested = 0xFF;
 	numReads = numWrites = 0;
+	loadTelemetry.sgResult = loadTelemetry.actualCurrent = 0;
+	ResetLoadRegisters();
 }
 
 // Set a register value and flag it for updating
@@ -513,6 +518,10 @@ bool TmcDriverState::SetRegister(SmartDriverRegister reg, uint32_t regVal)
 		UpdateRegister (WriteTcoolthrs, regVal & ((1u << 20) - 1));
 		return true;
 
+	case SmartDriverRegister::coolConf:
+		UpdateRegister(WriteCoolConf, (writeRegisters[WriteCoolConf] & ~COOLCONF_COOLSTEP_MASK) | (regVal & COOLCONF_COOLSTEP_MASK));
+		return true;
+
 	case SmartDriverRegister::hdec:
 	default:
 		return false;
@@ -547,6 +556,9 @@ uint32_t TmcDriverState::GetRegister(SmartDriverRegister reg) const
 	case SmartDriverRegister::coolStep:
 		return writeRegisters[WriteTcoolthrs];
 
+	case SmartDriverRegister::coolConf:
+		return writeRegisters[WriteCoolConf] & COOLCONF_COOLSTEP_MASK;
+
 	case SmartDriverRegister::hdec:
 	default:
 		return 0;
@@ -719,7 +731,7 @@ void TmcDriverState::AppendDriverStatus(const StringRef& reply, bool clearGlobal
 		reply.cat(" ok");
 	}
 
-	reply.catf(", reads %u, writes %u timeouts %u", numReads, numWrites, numTimeouts);
+	reply.catf(", current %" PRIu32 "mA, reads %u, writes %u timeouts %u", loadTelemetry.actualCurrent, numReads, numWrites, numTimeouts);
 	numReads = numWrites = 0;
 	if (clearGlobalStats)
 	{
@@ -830,6 +842,23 @@ void TmcDriverState::TransferSucceeded(const uint8_t *rcvDataBlock)
 		if (previousRegIndexRequested == ReadDrvStat)
 		{
 			// We treat the DRV_STATUS register separately
+			// Record the load and the current that coolStep has chosen. The stallGuard result is only meaningful when the motor is moving.
+			if ((regVal & TMC_RR_STST) == 0)
+			{
+				const uint32_t sgResult = regVal & TMC_RR_SGRESULT;
+				loadTelemetry.sgResult = sgResult;
+				if (sgResult < minSgLoadRegister)
+				{
+					minSgLoadRegister = sgResult;
+				}
+				if (sgResult > maxSgLoadRegister)
+				{
+					maxSgLoadRegister = sgResult;
+				}
+			}
+			const uint32_t iRun = (writeRegisters[WriteIholdIrun] & IHOLDIRUN_IRUN_MASK) >> IHOLDIRUN_IRUN_SHIFT;
+			loadTelemetry.actualCurrent = (motorCurrent * (((regVal & TMC_RR_CSACTUAL) >> TMC_RR_CSACTUAL_SHIFT) + 1))/(iRun + 1);
+
 			if ((regVal & (TMC_RR_OLA | TMC_RR_OLB)) != 0)
 			{
 				uint32_t interval;
@@ -1464,6 +1493,12 @@ namespace SmartDrivers
 		return (driver < numTmc51xxDrivers) ? driverStates[driver].GetRegister(reg) : 0;
 	}
 
+	const DriverLoadTelemetry& GetLoadTelemetry(size_t driver)
+	{
+		static const DriverLoadTelemetry noTelemetry = { 0, 0 };
+		return (driver < numTmc51xxDrivers) ? driverStates[driver].GetLoadTelemetry() : noTelemetry;
+	}
+
 };	// end namespace
 
 #endif
@@ -23,6 +23,15 @@ const uint32_t TMC_RR_OLA = 1 << 29;				// open load A
 const uint32_t TMC_RR_OLB = 1 << 30;				// open load B
 const uint32_t TMC_RR_STST = 1 << 31;				// standstill detected
 const uint32_t TMC_RR_SGRESULT = 0x3FF;				// 10-bit stallGuard2 result
+const uint32_t TMC_RR_CSACTUAL_SHIFT = 16;
+const uint32_t TMC_RR_CSACTUAL = 0x1F << TMC_RR_CSACTUAL_SHIFT;	// the current scale that coolStep has chosen
+
+// The motor load and current that we last read back from a driver, for the object model
+struct DriverLoadTelemetry
+{
+	uint32_t sgResult;								// the stallGuard2 result, lower values mean higher load. Not updated at standstill.
+	uint32_t actualCurrent;							// the peak coil current in mA after coolStep scaling
+};
 
 namespace SmartDrivers
 {
@@ -49,6 +58,7 @@ namespace SmartDrivers
 	void SetStandstillCurrentPercent(size_t driver, float percent);
 	bool SetRegister(size_t driver, SmartDriverRegister reg, uint32_t regVal);
 	uint32_t GetRegister(size_t driver, SmartDriverRegister reg);
+	const DriverLoadTelemetry& GetLoadTelemetry(size_t driver);
 };
 
 #endif
@@ -0,0 +1,38 @@
+/*
+ * TimingHistogram.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "TimingHistogram.h"
+#include "Platform.h"
+#include "RepRap.h"
+
+void TimingHistogram::Clear()
+{
+	for (volatile uint32_t& c : counts)
+	{
+		c = 0;
+	}
+	maxValue = 0;
+}
+
+// Print the histogram as a list of <lower bound in microseconds>:<count> pairs, omitting empty buckets
+void TimingHistogram::Report(MessageType mtype, const char *name, float microsecondsPerUnit) const
+{
+	Platform& p = reprap.GetPlatform();
+	p.MessageF(mtype, "%s (us):", name);
+	for (size_t i = 0; i < NumBuckets; ++i)
+	{
+		const uint32_t count = counts[i];
+		if (count != 0)
+		{
+			const uint32_t lowerBound = (i == 0) ? 0 : 1u << i;
+			p.MessageF(mtype, " %.2f%s:%" PRIu32, (double)(lowerBound * microsecondsPerUnit), (i + 1 == NumBuckets) ? "+" : "", count);
+		}
+	}
+	p.MessageF(mtype, ", max %.2f\n", (double)(maxValue * microsecondsPerUnit));
+}
+
+// End
@@ -0,0 +1,43 @@
+/*
+ * TimingHistogram.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_MOVEMENT_TIMINGHISTOGRAM_H_
+#define SRC_MOVEMENT_TIMINGHISTOGRAM_H_
+
+#include "RepRapFirmware.h"
+#include "MessageType.h"
+
+// Class to record a log-scaled histogram of timing measurements such as step interrupt durations, so that we can see jitter that averages hide.
+// Bucket 0 counts values 0 and 1, bucket n counts values from 2^n to 2^(n+1)-1, and the last bucket also counts all larger values.
+// Values are added from within the step ISR, so Add() must be fast. Reading and clearing are not synchronised with it, so a count may occasionally be out by one.
+class TimingHistogram
+{
+public:
+	static constexpr size_t NumBuckets = 16;
+
+	TimingHistogram() { Clear(); }
+
+	void Clear();
+	void Add(uint32_t val) __attribute__ ((hot));
+	void Report(MessageType mtype, const char *name, float microsecondsPerUnit) const;		// print the non-empty buckets and the maximum value
+
+private:
+	volatile uint32_t counts[NumBuckets];
+	volatile uint32_t maxValue;
+};
+
+inline void TimingHistogram::Add(uint32_t val)
+{
+	const size_t bucket = (val <= 1) ? 0 : min<size_t>(31 - __builtin_clz(val), NumBuckets - 1);
+	++counts[bucket];
+	if (val > maxValue)
+	{
+		maxValue = val;
+	}
+}
+
+#endif /* SRC_MOVEMENT_TIMINGHISTOGRAM_H_ */
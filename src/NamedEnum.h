@@ -20,7 +20,7 @@
 #define STRINGLIST_2(_v1,_v2) #_v1,#_v2
 #define STRINGLIST_3(_v1,_v2,_v3) #_v1,#_v2,#_v3
 #define STRINGLIST_4(_v1,_v2,_v3,_v4) #_v1,#_v2,#_v3,#_v4
-#define STRINGLIST_5(_v1,_v2,_v3,_v4,_v5) #_v1,#_v2,#_v3,#_v4,_v5
+#define STRINGLIST_5(_v1,_v2,_v3,_v4,_v5) #_v1,#_v2,#_v3,#_v4,#_v5
 
 // Macro to declare an enumeration with printable value names
 // Usage example:
@@ -11,9 +11,9 @@
 #include "WiFiSocket.h"
 
 const unsigned int MaxBuffersPerSocket = 4;
+const size_t MinDirectSendLength = 1024;			// if we aren't already collecting data to send, we send blocks at least this long straight to the WiFi module instead of copying them
 
-
-WiFiSocket::WiFiSocket(NetworkInterface *iface) : Socket(iface), receivedData(nullptr), state(SocketState::inactive), needsPolling(false)
+WiFiSocket::WiFiSocket(NetworkInterface *iface) : Socket(iface), receivedData(nullptr), sendBuffer(nullptr), state(SocketState::inactive), needsPolling(false)
 {
 }
 
@@ -27,6 +27,16 @@ void WiFiSocket::Init(SocketNumber n)
 // Close a connection when the last packet has been sent
 void WiFiSocket::Close()
 {
+	if (state == SocketState::connected)
+	{
+		FlushSendBuffer(MessageHeaderSamToEsp::FlagPush);
+	}
+	if (sendBuffer != nullptr)
+	{
+		sendBuffer->Release();				// the WiFi module didn't accept it, so we can't send it
+		sendBuffer = nullptr;
+	}
+
 	if (state == SocketState::connected || state == SocketState::clientDisconnecting)
 	{
 		const int32_t reply = GetInterface()->SendCommand(NetworkCommand::connClose, socketNum, 0, nullptr, 0, nullptr, 0);
@@ -54,6 +64,11 @@ void WiFiSocket::Terminate()
 		state = (reply != 0) ? SocketState::broken : SocketState::inactive;
 	}
 	DiscardReceivedData();
+	if (sendBuffer != nullptr)
+	{
+		sendBuffer->Release();
+		sendBuffer = nullptr;
+	}
 	txBufferSpace = 0;
 }
 
@@ -201,6 +216,10 @@ void WiFiSocket::Poll(bool full)
 		if (state == SocketState::connected)
 		{
 			txBufferSpace = resp.Value().writeBufferSpace;
+			if (sendBuffer != nullptr)
+			{
+				FlushSendBuffer(MessageHeaderSamToEsp::FlagPush);	// in case the responder didn't tell us that it had finished sending
+			}
 			ReceiveData(resp.Value().bytesAvailable);
 		}
 		break;
@@ -264,7 +283,7 @@ void WiFiSocket::ReceiveData(uint16_t bytesAvailable)
 		}
 		else if (NetworkBuffer::Count(receivedData) < MaxBuffersPerSocket)
 		{
-			NetworkBuffer * const buf = NetworkBuffer::Allocate();
+			NetworkBuffer * const buf = NetworkBuffer::Allocate(protocol);
 			if (buf != nullptr)
 			{
 				const size_t maxToRead = min<size_t>(NetworkBuffer::bufferSize, MaxDataLength);
@@ -297,25 +316,42 @@ void WiFiSocket::DiscardReceivedData()
 	}
 }
 
-// Send the data, returning the length buffered
+// Send the data, returning the length buffered.
+// Each SPI transfer to the WiFi module has a large fixed overhead, so rather than sending each small block as soon as we get it, we collect the blocks
+// in a network buffer and send them together when the buffer is full or the responder tells us that it has finished. The push goes in the same transfer.
 size_t WiFiSocket::Send(const uint8_t *data, size_t length)
 {
-	if (state == SocketState::connected && txBufferSpace != 0)
+	if (state != SocketState::connected || txBufferSpace == 0)
 	{
-		const size_t lengthToSend = min<size_t>(length, min<size_t>(txBufferSpace, MaxDataLength));
-		const int32_t reply = GetInterface()->SendCommand(NetworkCommand::connWrite, socketNum, 0, data, lengthToSend, nullptr, 0);
-		if (reply >= 0 && (size_t)reply <= lengthToSend)
+		return 0;
+	}
+
+	if (sendBuffer == nullptr)
+	{
+		if (length < MinDirectSendLength)
 		{
-			txBufferSpace -= (size_t)reply;
-			return (size_t)reply;
+			sendBuffer = NetworkBuffer::Allocate(protocol);
 		}
-		if (reprap.Debug(moduleNetwork))
+		if (sendBuffer == nullptr)
 		{
-			debugPrintf("Send failed, terminating\n");
+			return WriteData(data, length, 0);					// it's a big block or we couldn't get a buffer, so send it straight away
 		}
-		state = SocketState::broken;							// something is not right, terminate the socket soon
 	}
-	return 0;
+
+	// Don't collect more than the WiFi module has room for, so that we know it will accept all of it when we send it
+	const size_t maxToHold = min<size_t>(min<size_t>(txBufferSpace, MaxDataLength), sendBuffer->Remaining() + sendBuffer->SpaceLeft());
+	if (sendBuffer->Remaining() >= maxToHold)
+	{
+		FlushSendBuffer(0);
+		return (sendBuffer == nullptr) ? Send(data, length) : 0;
+	}
+
+	const size_t accepted = sendBuffer->AppendData(data, min<size_t>(length, maxToHold - sendBuffer->Remaining()));
+	if (sendBuffer->Remaining() >= maxToHold)
+	{
+		FlushSendBuffer(0);
+	}
+	return accepted;
 }
 
 // Tell the interface to send the outstanding data
@@ -323,16 +359,48 @@ void WiFiSocket::Send()
 {
 	if (state == SocketState::connected)
 	{
-		const int32_t reply = GetInterface()->SendCommand(NetworkCommand::connWrite, socketNum, MessageHeaderSamToEsp::FlagPush, nullptr, 0, nullptr, 0);
-		if (reply < 0)
+		FlushSendBuffer(MessageHeaderSamToEsp::FlagPush);
+	}
+}
+
+// Send the data we have collected to the WiFi module, with the specified flags
+void WiFiSocket::FlushSendBuffer(uint8_t flags)
+{
+	if (sendBuffer != nullptr)
+	{
+		sendBuffer->Taken(WriteData(sendBuffer->UnreadData(), sendBuffer->Remaining(), flags));
+		if (sendBuffer->IsEmpty())
 		{
-			if (reprap.Debug(moduleNetwork))
-			{
-				debugPrintf("Send failed, terminating\n");
-			}
-			state = SocketState::broken;						// something is not right, terminate the socket soon
+			sendBuffer = sendBuffer->Release();
 		}
 	}
+	else if (flags != 0)
+	{
+		(void)WriteData(nullptr, 0, flags);
+	}
+}
+
+// Write data to the WiFi module in a single SPI transfer, returning the amount it accepted
+size_t WiFiSocket::WriteData(const uint8_t *data, size_t length, uint8_t flags)
+{
+	const size_t lengthToSend = min<size_t>(length, min<size_t>(txBufferSpace, MaxDataLength));
+	if (lengthToSend == 0 && flags == 0)
+	{
+		return 0;
+	}
+
+	const int32_t reply = GetInterface()->SendCommand(NetworkCommand::connWrite, socketNum, flags, (lengthToSend == 0) ? nullptr : data, lengthToSend, nullptr, 0);
+	if (reply >= 0 && (size_t)reply <= lengthToSend)
+	{
+		txBufferSpace -= (size_t)reply;
+		return (size_t)reply;
+	}
+	if (reprap.Debug(moduleNetwork))
+	{
+		debugPrintf("Send failed, terminating\n");
+	}
+	state = SocketState::broken;								// something is not right, terminate the socket soon
+	return 0;
 }
 
 // Return true if we need to poll this socket
@@ -50,8 +50,11 @@ private:
 	WiFiInterface *GetInterface() const;
 	void ReceiveData(uint16_t bytesAvailable);
 	void DiscardReceivedData();
+	size_t WriteData(const uint8_t *data, size_t length, uint8_t flags);
+	void FlushSendBuffer(uint8_t flags);
 
 	NetworkBuffer *receivedData;						// List of buffers holding received data
+	NetworkBuffer *sendBuffer;							// Data that we are collecting so that we can send it to the WiFi module in one transfer
 	uint32_t whenConnected;
 	uint16_t txBufferSpace;								// How much free transmit buffer space the WiFi mofule reported
 	SocketNumber socketNum;								// The WiFi socket number we are using
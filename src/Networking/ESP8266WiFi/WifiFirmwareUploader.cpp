@@ -63,12 +63,16 @@ const char * const resultMessages[] =
 // The ESP8266 supports 921600, 460800, 230400, 115200, 74880 and some lower baud rates.
 // 921600b is not reliable because even though it sometimes succeeds in connecting, we get a bad response during uploading after a few blocks.
 // Probably our UART ISR cannot receive bytes fast enough, perhaps because of the latency of the system tick ISR.
-// 460800b doesn't always manage to connect, but if it does then uploading appears to be reliable.
+// 460800b doesn't always manage to connect, but if it does then uploading appears to be reliable. So we try it first, but only for one reset cycle.
 // 230400b always manages to connect.
-static const uint32_t uploadBaudRates[] = { 230400, 115200, 74880, 9600 };
+static const uint32_t uploadBaudRates[] = { 460800, 230400, 115200, 74880, 9600 };
+
+// The size of the buffer for one block including the packet header
+const size_t EspBlockHeaderSize = 16;
+const size_t EspBlockBufferSize = EspBlockHeaderSize + EspFlashBlockSize;
 
 WifiFirmwareUploader::WifiFirmwareUploader(UARTClass& port, WiFiInterface& iface)
-	: uploadPort(port), interface(iface), uploadFile(nullptr), state(UploadState::idle)
+	: uploadPort(port), interface(iface), uploadFile(nullptr), blockBuffer(nullptr), state(UploadState::idle)
 {
 }
 
@@ -508,16 +512,13 @@ uint16_t WifiFirmwareUploader::checksum(const uint8_t *data, uint16_t dataLen, u
 	return(cksum);
 }
 
-WifiFirmwareUploader::EspUploadResult WifiFirmwareUploader::flashWriteBlock(uint16_t flashParmVal, uint16_t flashParmMask)
+// Read the block numbered uploadBlockNumber from the file into the block buffer and prepare its header
+WifiFirmwareUploader::EspUploadResult WifiFirmwareUploader::readBlock(uint16_t flashParmVal, uint16_t flashParmMask)
 {
 	const uint32_t blkSize = EspFlashBlockSize;
-
-	// Allocate a data buffer for the combined header and block data
 	const uint16_t hdrOfst = 0;
-	const uint16_t dataOfst = 16;
-	const uint16_t blkBufSize = dataOfst + blkSize;
-	uint32_t blkBuf32[blkBufSize/4];
-	uint8_t * const blkBuf = reinterpret_cast<uint8_t*>(blkBuf32);
+	const uint16_t dataOfst = EspBlockHeaderSize;
+	uint8_t * const blkBuf = reinterpret_cast<uint8_t*>(blockBuffer);
 
 	// Prepare the header for the block
 	putData(blkSize, 4, blkBuf, hdrOfst + 0);
@@ -548,12 +549,20 @@ WifiFirmwareUploader::EspUploadResult WifiFirmwareUploader::flashWriteBlock(uint
 		putData(flashParm | flashParmVal, 2, blkBuf + dataOfst + 2, 0);
 	}
 
+	return EspUploadResult::success;
+}
+
+// Send the block that readBlock read
+WifiFirmwareUploader::EspUploadResult WifiFirmwareUploader::flashWriteBlock()
+{
+	const uint8_t * const blkBuf = reinterpret_cast<const uint8_t*>(blockBuffer);
+
 	// Calculate the block checksum
-	uint16_t cksum = checksum(blkBuf + dataOfst, blkSize, ESP_CHECKSUM_MAGIC);
+	uint16_t cksum = checksum(blkBuf + EspBlockHeaderSize, EspFlashBlockSize, ESP_CHECKSUM_MAGIC);
 	EspUploadResult stat;
 	for (int i = 0; i < 3; i++)
 	{
-		if ((stat = doCommand(ESP_FLASH_DATA, blkBuf, blkBufSize, cksum, nullptr, blockWriteTimeout)) == EspUploadResult::success)
+		if ((stat = doCommand(ESP_FLASH_DATA, blkBuf, EspBlockBufferSize, cksum, nullptr, blockWriteTimeout)) == EspUploadResult::success)
 		{
 			break;
 		}
@@ -587,7 +596,7 @@ void WifiFirmwareUploader::Spin()
 	switch (state)
 	{
 	case UploadState::resetting:
-		if (connectAttemptNumber == ARRAY_SIZE(uploadBaudRates) * retriesPerBaudRate)
+		if (baudRateNumber == ARRAY_SIZE(uploadBaudRates))
 		{
 			// Time to give up
 			interface.ResetWiFi();
@@ -597,8 +606,8 @@ void WifiFirmwareUploader::Spin()
 		else
 		{
 			// Reset the serial port at the new baud rate. Also reset the ESP8266.
-			const uint32_t baud = uploadBaudRates[connectAttemptNumber/retriesPerBaudRate];
-			if (connectAttemptNumber % retriesPerBaudRate == 0)
+			const uint32_t baud = uploadBaudRates[baudRateNumber];
+			if (connectAttemptNumber == 0)
 			{
 				// First attempt at this baud rate
 				MessageF("Trying to connect at %u baud: ", baud);
@@ -620,7 +629,7 @@ void WifiFirmwareUploader::Spin()
 			if (res == EspUploadResult::success)
 			{
 				// Successful connection
-//				MessageF(" success on attempt %d\n", (connectAttemptNumber % retriesPerBaudRate) + 1);
+//				MessageF(" success on attempt %d\n", connectAttemptNumber + 1);
 				MessageF(" success\n");
 				state = UploadState::erasing1;
 			}
@@ -630,9 +639,11 @@ void WifiFirmwareUploader::Spin()
 				++connectAttemptNumber;
 				if (connectAttemptNumber % retriesPerReset == 0)
 				{
-					if (connectAttemptNumber % retriesPerBaudRate == 0)
+					if (connectAttemptNumber == ((baudRateNumber == 0) ? retriesAtFastBaudRate : retriesPerBaudRate))
 					{
 						MessageF(" failed\n");
+						++baudRateNumber;
+						connectAttemptNumber = 0;
 					}
 					state = UploadState::resetting;		// try a reset and a lower baud rate
 				}
@@ -666,7 +677,8 @@ void WifiFirmwareUploader::Spin()
 				uploadBlockNumber = 0;
 				uploadNextPercentToReport = percentToReportIncrement;
 				lastAttemptTime = millis();
-				state = UploadState::uploading;
+				uploadResult = readBlock(0, 0);
+				state = (uploadResult == EspUploadResult::success) ? UploadState::uploading : UploadState::done;
 			}
 			else
 			{
@@ -683,7 +695,7 @@ void WifiFirmwareUploader::Spin()
 			const uint32_t blkCnt = (fileSize + EspFlashBlockSize - 1) / EspFlashBlockSize;
 			if (uploadBlockNumber < blkCnt)
 			{
-				uploadResult = flashWriteBlock(0, 0);
+				uploadResult = flashWriteBlock();
 				lastAttemptTime = millis();
 				if (uploadResult != EspUploadResult::success)
 				{
@@ -697,6 +709,16 @@ void WifiFirmwareUploader::Spin()
 					MessageF("%u%% complete\n", percentComplete);
 					uploadNextPercentToReport += percentToReportIncrement;
 				}
+
+				// Read the next block now, so that we do it while the ESP is writing this one instead of after the block write interval
+				if (uploadResult == EspUploadResult::success && uploadBlockNumber < blkCnt)
+				{
+					uploadResult = readBlock(0, 0);
+					if (uploadResult != EspUploadResult::success)
+					{
+						state = UploadState::done;
+					}
+				}
 			}
 			else
 			{
@@ -707,6 +729,8 @@ void WifiFirmwareUploader::Spin()
 
 	case UploadState::done:
 		uploadFile->Close();
+		delete[] blockBuffer;
+		blockBuffer = nullptr;
 		uploadPort.end();					// disable the port, it has a high interrupt priority
 		if (uploadResult == EspUploadResult::success)
 		{
@@ -753,12 +777,15 @@ void WifiFirmwareUploader::SendUpdateFile(const char *file, const char *dir, uin
 		return;
 	}
 
+	blockBuffer = new uint32_t[EspBlockBufferSize/sizeof(uint32_t)];
+
 	// Stop the network
 	restartModeOnCompletion = interface.EnableState();
 	interface.Stop();
 
 	// Set up the state so that subsequent calls to Spin() will attempt the upload
 	uploadAddress = address;
+	baudRateNumber = 0;
 	connectAttemptNumber = 0;
 	state = UploadState::resetting;
 }
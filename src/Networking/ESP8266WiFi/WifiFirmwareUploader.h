@@ -27,6 +27,7 @@ private:
 	static const uint32_t defaultTimeout = 500;				// default timeout in milliseconds
 	static const uint32_t syncTimeout = 1000;
 	static const unsigned int retriesPerBaudRate = 9;
+	static const unsigned int retriesAtFastBaudRate = 3;		// 460800 baud doesn't always connect, so don't spend long trying it
 	static const unsigned int retriesPerReset = 3;
 	static const uint32_t connectAttemptInterval = 50;
 	static const uint32_t resetDelay = 500;
@@ -81,7 +82,8 @@ private:
 	EspUploadResult flashBegin(uint32_t addr, uint32_t size);
 	EspUploadResult flashFinish(bool reboot);
 	static uint16_t checksum(const uint8_t *data, uint16_t dataLen, uint16_t cksum);
-	EspUploadResult flashWriteBlock(uint16_t flashParmVal, uint16_t flashParmMask);
+	EspUploadResult readBlock(uint16_t flashParmVal, uint16_t flashParmMask);
+	EspUploadResult flashWriteBlock();
 	EspUploadResult DoErase(uint32_t address, uint32_t size);
 
 	UARTClass& uploadPort;
@@ -91,7 +93,9 @@ private:
 	uint32_t uploadAddress;
 	uint32_t uploadBlockNumber;
 	unsigned int uploadNextPercentToReport;
-	unsigned int connectAttemptNumber;
+	uint32_t *blockBuffer;									// the header and data of the next block to send, read from the file while the ESP is writing the previous one
+	size_t baudRateNumber;
+	unsigned int connectAttemptNumber;						// the number of attempts at the current baud rate
 	uint32_t lastAttemptTime;
 	uint32_t lastResetTime;
 	UploadState state;
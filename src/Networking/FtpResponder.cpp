@@ -14,9 +14,13 @@
 #include "NetworkInterface.h"
 #include "Platform.h"
 
+FtpResponder *FtpResponder::ftpResponders = nullptr;
+
 FtpResponder::FtpResponder(NetworkResponder *n)
-	: UploadingNetworkResponder(n), dataSocket(nullptr), passivePort(0), passivePortOpenTime(0), dataBuf(nullptr), haveFileToMove(false)
+	: UploadingNetworkResponder(n), dataSocket(nullptr), passivePort(0), passivePortOpenTime(0), dataBuf(nullptr),
+	  nextFtpResponder(ftpResponders), haveFileToMove(false)
 {
+	ftpResponders = this;
 }
 
 // Ask the responder to accept this connection, returns true if it did
@@ -268,70 +272,96 @@ void FtpResponder::SendPassiveData()
 	}
 
 	// If we get here then there are no output buffers left to send
-	// If we have a file to send, send it
-	if (fileBeingSent != nullptr && fileBuffer == nullptr)
+	// If we have a file to send, send it. The socket may transmit straight from the buffers, so once we have sent some of a buffer we can't refill or release it
+	// until the socket has finished with it. To keep the connection busy while we wait for acknowledgements, we keep up to MaxFileBuffersInFlight buffers in a chain.
+	for (;;)
 	{
-		fileBuffer = NetworkBuffer::Allocate();
-		if (fileBuffer == nullptr)
+		// Release the buffers at the start of the chain that the socket has finished with. All but the last buffer have been sent in full,
+		// and the socket holds the most recently sent data, so a buffer is finished with when the socket holds no more than was sent from the buffers after it.
+		while (fileBuffer != nullptr && fileBuffer->IsEmpty())
 		{
-			return;					// no buffer available, try again later
+			size_t sentAfter = 0;
+			for (const NetworkBuffer *b = fileBuffer->Next(); b != nullptr; b = b->Next())
+			{
+				sentAfter += b->Length() - b->Remaining();
+			}
+			if (dataSocket->BytesHeld() > sentAfter)
+			{
+				break;
+			}
+			fileBuffer = fileBuffer->Release();
 		}
-	}
 
-	// If we have a file buffer here, we must be in the process of sending a file
-	while (fileBuffer != nullptr)
-	{
-		if (fileBuffer->IsEmpty() && fileBeingSent != nullptr)
+		// If we have sent everything in the chain then read some more of the file into a new buffer
+		NetworkBuffer *lastBuffer = NetworkBuffer::FindLast(fileBuffer);
+		if ((lastBuffer == nullptr || lastBuffer->IsEmpty()) && fileBeingSent != nullptr && NetworkBuffer::Count(fileBuffer) < MaxFileBuffersInFlight)
 		{
-			const int bytesRead = fileBuffer->ReadFromFile(fileBeingSent);
+			NetworkBuffer * const buf = NetworkBuffer::Allocate(FtpDataProtocol);
+			if (buf == nullptr)
+			{
+				return;					// no buffer available, try again later
+			}
+			const int bytesRead = buf->ReadFromFile(fileBeingSent);
 			if (bytesRead != (int)NetworkBuffer::bufferSize)
 			{
 				// We had a read error or we reached the end of the file
 				fileBeingSent->Close();
 				fileBeingSent = nullptr;
 			}
+			if (buf->IsEmpty())
+			{
+				buf->Release();
+			}
+			else
+			{
+				NetworkBuffer::AppendToList(&fileBuffer, buf);
+				lastBuffer = buf;
+			}
 		}
 
-		if (fileBuffer->IsEmpty())
+		if (lastBuffer == nullptr || lastBuffer->IsEmpty())
 		{
-			// Must have sent the whole file
-			fileBuffer->Release();
-			fileBuffer = nullptr;
+			if (fileBuffer != nullptr || fileBeingSent != nullptr)
+			{
+				return;					// waiting for acknowledgements before we can send any more
+			}
+			break;						// must have sent the whole file
 		}
-		else
+
+		const size_t remaining = lastBuffer->Remaining();
+		const size_t sent = dataSocket->SendNoCopy(lastBuffer->UnreadData(), remaining);
+		if (sent == 0)
 		{
-			const size_t remaining = fileBuffer->Remaining();
-			const size_t sent = dataSocket->Send(fileBuffer->UnreadData(), remaining);
-			if (sent == 0)
+			// Check whether the connection has been closed
+			if (!dataSocket->CanSend())
 			{
-				// Check whether the connection has been closed
-				if (!dataSocket->CanSend())
+				if (reprap.Debug(moduleWebserver))
 				{
-					if (reprap.Debug(moduleWebserver))
-					{
-						debugPrintf("Can't send anymore\n");
-					}
-
-					sendError = true;
-					dataSocket = nullptr;
-					if (fileBeingSent != nullptr)
-					{
-						fileBeingSent->Close();
-						fileBeingSent = nullptr;
-					}
-					fileBuffer->Release();
-					fileBuffer = nullptr;
+					debugPrintf("Can't send anymore\n");
+				}
 
-					responderState = ResponderState::pasvTransferComplete;
+				sendError = true;
+				if (dataSocket->HoldsSentData())
+				{
+					dataSocket->Terminate();		// make the socket discard the data it holds, because we are about to release the buffers
 				}
-				return;
-			}
+				dataSocket = nullptr;
+				if (fileBeingSent != nullptr)
+				{
+					fileBeingSent->Close();
+					fileBeingSent = nullptr;
+				}
+				ReleaseFileBuffers();
 
-			fileBuffer->Taken(sent);
-			if (sent < remaining)
-			{
-				return;
+				responderState = ResponderState::pasvTransferComplete;
 			}
+			return;
+		}
+
+		lastBuffer->Taken(sent);
+		if (sent < remaining)
+		{
+			return;
 		}
 	}
 
@@ -346,10 +376,10 @@ void FtpResponder::SendPassiveData()
 // Write some more upload data
 void FtpResponder::DoUpload()
 {
-	// Write incoming data to the file
+	// Write all the incoming data that the socket has received to the file, up to a limit so that we don't hold up the other responders for too long
 	const uint8_t *buffer;
 	size_t len;
-	if (dataSocket->ReadBuffer(buffer, len))
+	for (unsigned int chunks = 0; chunks < MaxUploadChunksPerSpin && dataSocket->ReadBuffer(buffer, len); ++chunks)
 	{
 		if (reprap.Debug(moduleWebserver))
 		{
@@ -540,6 +570,12 @@ void FtpResponder::ProcessLine()
 			}
 			Commit(ResponderState::reading);
 		}
+		// each interface has a single FTP data port, so only one session at a time can use passive mode on it
+		else if (StringEqualsIgnoreCase(clientMessage, "PASV") && DataPortInUse(skt->GetInterface()))
+		{
+			outBuf->copy("425 Data connection in use by another session.\r\n");
+			Commit(ResponderState::reading);
+		}
 		// enter passive mode mode
 		else if (StringEqualsIgnoreCase(clientMessage, "PASV"))
 		{
@@ -737,7 +773,7 @@ void FtpResponder::ProcessLine()
 			fileBeingSent = GetPlatform().OpenFile(currentDirectory.c_str(), filename, OpenMode::read);
 			if (fileBeingSent != nullptr)
 			{
-				outBuf->printf("150 Opening data connection for %s (%lu bytes).\r\n", filename, fileBeingSent->Length());
+				outBuf->printf("150 Opening data connection for %s (%" PRIuFilePos " bytes).\r\n", filename, fileBeingSent->Length());
 				Commit(ResponderState::sendingPasvData);
 			}
 			else
@@ -892,15 +928,24 @@ void FtpResponder::CloseDataPort()
 
 	if (dataSocket != nullptr)
 	{
-		dataSocket->Close();								// close it gracefully
+		if (fileBuffer != nullptr && dataSocket->HoldsSentData())
+		{
+			dataSocket->Terminate();						// the socket may still be sending from our file buffers, which we are about to release
+		}
+		else
+		{
+			dataSocket->Close();							// close it gracefully
+		}
 		dataSocket = nullptr;
 	}
 	else if (skt != nullptr)
 	{
 		skt->GetInterface()->TerminateDataPort();			// in case it has been partially set up
 	}
+	passivePort = 0;
 
 	OutputBuffer::ReleaseAll(dataBuf);
+	ReleaseFileBuffers();
 
 	if (fileBeingSent != nullptr)
 	{
@@ -909,6 +954,28 @@ void FtpResponder::CloseDataPort()
 	}
 }
 
+// Release the chain of buffers that we have been sending the file from
+void FtpResponder::ReleaseFileBuffers()
+{
+	while (fileBuffer != nullptr)
+	{
+		fileBuffer = fileBuffer->Release();
+	}
+}
+
+// Return true if another FTP session has the data port of this interface open
+bool FtpResponder::DataPortInUse(const NetworkInterface *iface) const
+{
+	for (const FtpResponder *r = ftpResponders; r != nullptr; r = r->nextFtpResponder)
+	{
+		if (r != this && r->passivePort != 0 && r->skt != nullptr && r->skt->GetInterface() == iface)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 /*static*/ void FtpResponder::InitStatic()
 {
 	// Nothing needed here
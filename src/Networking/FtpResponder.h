@@ -27,6 +27,8 @@ public:
 protected:
 	static const size_t ftpMessageLength = 128;			// maximum line length for incoming FTP commands
 	static const uint32_t ftpPasvPortTimeout = 10000;	// maximum time to wait for an FTP data connection in milliseconds
+	static const unsigned int MaxFileBuffersInFlight = 3;	// how many buffers of a file we may have sent and not had acknowledged
+	static const unsigned int MaxUploadChunksPerSpin = 4;	// how many received chunks of upload data we write to the file in one call to Spin
 
 	Socket *dataSocket;
 	Port passivePort;
@@ -48,6 +50,11 @@ protected:
 	void ChangeDirectory(const char *newDirectory);
 
 	void CloseDataPort();
+	void ReleaseFileBuffers();
+	bool DataPortInUse(const NetworkInterface *iface) const;
+
+	static FtpResponder *ftpResponders;					// all the FTP responders, so that we can tell whether another one is using the data port
+	FtpResponder *nextFtpResponder;
 
 	bool haveCompleteLine;
 	bool haveFileToMove;
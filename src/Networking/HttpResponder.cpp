@@ -7,8 +7,12 @@
 
 #include "HttpResponder.h"
 #include "Socket.h"
+#include "Network.h"
 #include "GCodes/GCodes.h"
+#include "Heating/Heat.h"
+#include "Movement/Move.h"
 #include "General/IP4String.h"
+#include "Storage/CRC32.h"
 
 #define KO_START "rr_"
 const size_t KoFirst = 3;
@@ -20,6 +24,9 @@ static_assert(ARRAY_SIZE(serviceUnavailableResponse) <= OUTPUT_BUFFER_SIZE, "OUT
 
 const uint32_t HttpReceiveTimeout = 2000;
 
+// Each status stream ties up a responder for as long as the client stays connected, so we always leave one responder for other requests
+static unsigned int MaxStatusStreams() { return reprap.GetNetwork().GetNumHttpResponders() - 1; }
+
 // Text for a human-readable 404 page
 const char* const ErrorPagePart1 =
 	"<html>\n"
@@ -32,7 +39,7 @@ const char* const ErrorPagePart2 =
 	"</p>\n"
 	"</body>\n";
 
-HttpResponder::HttpResponder(NetworkResponder *n) : UploadingNetworkResponder(n)
+HttpResponder::HttpResponder(NetworkResponder *n) : UploadingNetworkResponder(n), isKeptAlive(false), streamBuffer(nullptr), isStreamingStatus(false)
 {
 }
 
@@ -44,14 +51,8 @@ bool HttpResponder::Accept(Socket *s, NetworkProtocol protocol)
 		responderState = ResponderState::reading;
 		skt = s;
 		timer = millis();
-
-		// Reset the parse state variables
-		clientPointer = 0;
-		parseState = HttpParseState::doingCommandWord;
-		numCommandWords = 0;
-		numQualKeys = 0;
-		numHeaderKeys = 0;
-		commandWords[0] = clientMessage;
+		isKeptAlive = false;
+		ResetParseState();
 
 		if (reprap.Debug(moduleWebserver))
 		{
@@ -62,6 +63,61 @@ bool HttpResponder::Accept(Socket *s, NetworkProtocol protocol)
 	return false;
 }
 
+// Close the connection if we kept it open after the last request and the client hasn't started another one.
+// This is called when a new connection arrives and no responder is free, so that idle persistent connections don't lock out other clients.
+bool HttpResponder::CloseIfIdle(NetworkProtocol protocol)
+{
+	const uint8_t *data;
+	size_t length;
+	if (   protocol == HttpProtocol
+		&& responderState == ResponderState::reading && isKeptAlive && clientPointer == 0
+		&& !skt->ReadBuffer(data, length)
+	   )
+	{
+		skt->Close();
+		skt = nullptr;
+		responderState = ResponderState::free;
+		isKeptAlive = false;
+		if (reprap.Debug(moduleWebserver))
+		{
+			debugPrintf("Closed idle HTTP connection\n");
+		}
+		return true;
+	}
+	return false;
+}
+
+// Reset the parser ready for a new request
+void HttpResponder::ResetParseState()
+{
+	clientPointer = 0;
+	parseState = HttpParseState::doingCommandWord;
+	numCommandWords = 0;
+	numQualKeys = 0;
+	numHeaderKeys = 0;
+	commandWords[0] = clientMessage;
+}
+
+// Return true if the client is willing to keep the connection open after this request.
+// HTTP/1.1 connections persist unless the client says otherwise. Because we don't discard anything after the end of the request,
+// a client may also pipeline several requests on a persistent connection; we process them in turn.
+bool HttpResponder::ClientWantsKeepAlive() const
+{
+	const char * const connection = GetHeaderValue("Connection");
+	if (connection != nullptr)
+	{
+		if (StringEqualsIgnoreCase(connection, "close"))
+		{
+			return false;
+		}
+		if (StringEqualsIgnoreCase(connection, "keep-alive"))
+		{
+			return true;
+		}
+	}
+	return numCommandWords >= 3 && StringEqualsIgnoreCase(commandWords[2], "HTTP/1.1");
+}
+
 // Do some work, returning true if we did anything significant
 bool HttpResponder::Spin()
 {
@@ -108,6 +164,9 @@ bool HttpResponder::Spin()
 		(void)SendFileInfo(millis() - startedProcessingRequestAt >= MaxFileInfoGetTime);
 		return true;
 
+	case ResponderState::streamingStatus:
+		return SpinStatusStream();
+
 	case ResponderState::uploading:
 		DoUpload();
 		return true;
@@ -445,9 +504,10 @@ bool HttpResponder::CharFromClient(char c)
 // 'value' is null-terminated, but we also pass its length in case it contains embedded nulls, which matters when uploading files.
 // Return true if we generated a json response to send, false if we didn't and changed the state instead.
 // This may also return true with response == nullptr if we tried to generate a response but ran out of buffers.
-bool HttpResponder::GetJsonResponse(const char* request, OutputBuffer *&response, bool& keepOpen)
+bool HttpResponder::GetJsonResponse(const char* request, OutputBuffer *&response, bool& keepOpen, bool& isBinary)
 {
 	keepOpen = false;	// assume we don't want to persist the connection
+	isBinary = false;
 	if (StringEqualsIgnoreCase(request, "connect") && GetKeyValue("password") != nullptr)
 	{
 		if (!CheckAuthenticated())
@@ -496,8 +556,17 @@ bool HttpResponder::GetJsonResponse(const char* request, OutputBuffer *&response
 	}
 	else if (StringEqualsIgnoreCase(request, "status"))
 	{
+		keepOpen = true;
 		const char *typeString = GetKeyValue("type");
-		if (typeString != nullptr)
+		const char * const formatString = GetKeyValue("format");
+		if (formatString != nullptr && StringEqualsIgnoreCase(formatString, "binary"))
+		{
+			// Compact binary status response for clients that poll many machines, e.g. rr_status?format=binary
+			OutputBuffer::Release(response);
+			response = reprap.GetBinaryStatusResponse(ResponseSource::HTTP);		// this may return nullptr
+			isBinary = true;
+		}
+		else if (typeString != nullptr)
 		{
 			// New-style JSON status responses
 			int type = SafeStrtol(typeString);
@@ -518,6 +587,7 @@ bool HttpResponder::GetJsonResponse(const char* request, OutputBuffer *&response
 	}
 	else if (StringEqualsIgnoreCase(request, "gcode") && GetKeyValue("gcode") != nullptr)
 	{
+		keepOpen = true;
 		NetworkGCodeInput * const httpInput = reprap.GetGCodes().GetHTTPInput();
 		httpInput->Put(HttpMessage, GetKeyValue("gcode"));
 		response->printf("{\"buff\":%u}", httpInput->BufferSpaceLeft());
@@ -620,6 +690,55 @@ const char* HttpResponder::GetKeyValue(const char *key) const
 	return nullptr;
 }
 
+const char* HttpResponder::GetHeaderValue(const char *key) const
+{
+	for (size_t i = 0; i < numHeaderKeys; ++i)
+	{
+		if (StringEqualsIgnoreCase(headers[i].key, key))
+		{
+			return headers[i].value;
+		}
+	}
+	return nullptr;
+}
+
+// Return true if the name of a web file includes a hash of its contents, e.g. "app.4a2b97c1.js".
+// A new version of the web interface uses new names for such files, so the browser may cache them for as long as it likes.
+static bool IsVersionedWebFile(const char *filename)
+{
+	bool inSection = false;
+	unsigned int hexDigits = 0;
+	for (const char *p = filename; *p != 0; ++p)
+	{
+		const char c = *p;
+		if (c == '.')
+		{
+			if (inSection && hexDigits >= 8)
+			{
+				return true;
+			}
+			inSection = true;
+			hexDigits = 0;
+		}
+		else if (c == '/')
+		{
+			inSection = false;
+		}
+		else if (inSection)
+		{
+			if (isxdigit(c))
+			{
+				++hexDigits;
+			}
+			else
+			{
+				inSection = false;
+			}
+		}
+	}
+	return false;
+}
+
 // Called to process a FileInfo request, which may take several calls
 // Return true if complete
 bool HttpResponder::SendFileInfo(bool quitEarly)
@@ -664,9 +783,21 @@ bool HttpResponder::Authenticate()
 
 	if (numSessions < MaxHttpSessions)
 	{
-		sessions[numSessions].ip = GetRemoteIP();
-		sessions[numSessions].lastQueryTime = millis();
-		sessions[numSessions].isPostUploading = false;
+		// CheckAuthenticated didn't find the client, so the probe sequence for its address ends at a free slot
+		const IPAddress remoteIP = GetRemoteIP();
+		size_t slot = SessionSlot(remoteIP);
+		while (!sessions[slot].ip.IsNull())
+		{
+			slot = (slot + 1) % SessionTableSize;
+		}
+		const uint32_t now = millis();
+		sessions[slot].ip = remoteIP;
+		sessions[slot].lastQueryTime = now;
+		sessions[slot].isPostUploading = false;
+		if (numSessions == 0)
+		{
+			oldestQueryTime = now;
+		}
 		numSessions++;
 		return true;
 	}
@@ -676,47 +807,76 @@ bool HttpResponder::Authenticate()
 // Check and update the authentication
 bool HttpResponder::CheckAuthenticated()
 {
-	const IPAddress remoteIP = GetRemoteIP();
-	for (size_t i = 0; i < numSessions; i++)
+	HttpSession * const session = FindSession(GetRemoteIP());
+	if (session != nullptr)
 	{
-		if (sessions[i].ip == remoteIP)
+		session->lastQueryTime = millis();
+		return true;
+	}
+	return false;
+}
+
+bool HttpResponder::RemoveAuthentication()
+{
+	HttpSession * const session = FindSession(skt->GetRemoteIP());
+	if (session != nullptr)
+	{
+		if (session->isPostUploading)
 		{
-			sessions[i].lastQueryTime = millis();
-			return true;
+			// Don't allow sessions with active POST uploads to be removed
+			return false;
 		}
+		RemoveSession(session - sessions);
+		return true;
 	}
 	return false;
 }
 
-bool HttpResponder::RemoveAuthentication()
+/*static*/ HttpResponder::HttpSession *HttpResponder::FindSession(IPAddress ip)
 {
-	const IPAddress remoteIP = skt->GetRemoteIP();
-	for (size_t i = numSessions; i != 0; )
+	if (numSessions != 0)
 	{
-		--i;
-		if (sessions[i].ip == remoteIP)
+		// The table is never full, so there is always a free slot to end the search
+		for (size_t slot = SessionSlot(ip); !sessions[slot].ip.IsNull(); slot = (slot + 1) % SessionTableSize)
 		{
-			if (sessions[i].isPostUploading)
+			if (sessions[slot].ip == ip)
 			{
-				// Don't allow sessions with active POST uploads to be removed
-				return false;
+				return &sessions[slot];
 			}
+		}
+	}
+	return nullptr;
+}
 
-			for (size_t k = i + 1; k < numSessions; ++k)
-			{
-				sessions[k - 1] = sessions[k];
-			}
-			numSessions--;
-			return true;
+// Free a slot in the session table. Sessions later in the same probe sequence are moved back, so that we never need to mark deleted slots.
+/*static*/ void HttpResponder::RemoveSession(size_t slot)
+{
+	size_t next = slot;
+	for (;;)
+	{
+		next = (next + 1) % SessionTableSize;
+		if (sessions[next].ip.IsNull())
+		{
+			break;
+		}
+
+		// The session in the next slot can fill the free one unless its home slot lies cyclically between the free slot and its current slot
+		const size_t home = SessionSlot(sessions[next].ip);
+		if (((next - home) % SessionTableSize) >= ((next - slot) % SessionTableSize))
+		{
+			sessions[slot] = sessions[next];
+			slot = next;
 		}
 	}
-	return false;
+	sessions[slot].ip.SetNull();
+	numSessions--;
 }
 
 void HttpResponder::SendFile(const char* nameOfFileToSend, bool isWebFile)
 {
 	FileStore *fileToSend = nullptr;
 	bool zip = false;
+	String<MaxFilenameLength> nameBuf;
 
 	if (isWebFile)
 	{
@@ -739,7 +899,6 @@ void HttpResponder::SendFile(const char* nameOfFileToSend, bool isWebFile)
 				// Try to open a gzipped version of the file first
 				if (!StringEndsWithIgnoreCase(nameOfFileToSend, ".gz") && strlen(nameOfFileToSend) + 3 <= MaxFilenameLength)
 				{
-					String<MaxFilenameLength> nameBuf;
 					nameBuf.copy(nameOfFileToSend);
 					nameBuf.cat(".gz");
 					fileToSend = GetPlatform().OpenFile(GetPlatform().GetWebDir(), nameBuf.c_str(), OpenMode::read);
@@ -795,19 +954,60 @@ void HttpResponder::SendFile(const char* nameOfFileToSend, bool isWebFile)
 		}
 	}
 
-	fileBeingSent = fileToSend;
-	outBuf->copy("HTTP/1.1 200 OK\r\n");
-
-	// Don't cache files served by rr_download
-	if (!isWebFile)
+	// Web files are small, so keep the connection open for the next one if the browser wants to. Close it after rr_download so that large downloads don't hold on to a responder.
+	const bool keepOpen = isWebFile && ClientWantsKeepAlive();
+	if (isWebFile)
+	{
+		// Web files only change when the user installs a new version of the web interface, so let the browser cache them.
+		// The entity tag is made from the size and date of the file, so the browser can check whether its copy is still valid without us reading the file.
+		const time_t lastModified = GetPlatform().GetLastModifiedTime(GetPlatform().GetWebDir(), (zip) ? nameBuf.c_str() : nameOfFileToSend);
+		String<24> etag;
+		etag.printf("\"%" PRIx32 "-%" PRIx32 "\"", (uint32_t)fileToSend->Length(), (uint32_t)lastModified);
+		String<32> lastModifiedString;
+		const struct tm * const timeInfo = gmtime(&lastModified);
+		if (timeInfo->tm_year > /*19*/80)
+		{
+			static const char * const dayNames[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+			lastModifiedString.printf("%s, %02d %s %04d %02d:%02d:%02d GMT",
+										dayNames[timeInfo->tm_wday], timeInfo->tm_mday, MassStorage::GetMonthName(timeInfo->tm_mon + 1), timeInfo->tm_year + 1900,
+										timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
+		}
+
+		// Browsers send back the Last-Modified string we gave them, so we only need to compare strings to handle If-Modified-Since
+		const char * const ifNoneMatch = GetHeaderValue("If-None-Match");
+		const char * const ifModifiedSince = GetHeaderValue("If-Modified-Since");
+		const bool notModified = (ifNoneMatch != nullptr)
+									? strstr(ifNoneMatch, etag.c_str()) != nullptr
+										: ifModifiedSince != nullptr && !lastModifiedString.IsEmpty() && StringEqualsIgnoreCase(ifModifiedSince, lastModifiedString.c_str());
+		outBuf->copy((notModified) ? "HTTP/1.1 304 Not Modified\r\n" : "HTTP/1.1 200 OK\r\n");
+		outBuf->cat((IsVersionedWebFile(nameOfFileToSend)) ? "Cache-Control: max-age=31536000, immutable\r\n" : "Cache-Control: no-cache\r\n");
+		outBuf->catf("ETag: %s\r\n", etag.c_str());
+		if (!lastModifiedString.IsEmpty())
+		{
+			outBuf->catf("Last-Modified: %s\r\n", lastModifiedString.c_str());
+		}
+
+		if (notModified)
+		{
+			fileToSend->Close();
+			outBuf->catf("Connection: %s\r\n\r\n", keepOpen ? "keep-alive" : "close");
+			Commit(keepOpen ? ResponderState::reading : ResponderState::free);
+			return;
+		}
+	}
+	else
 	{
-		outBuf->cat(	"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+		// Don't cache files served by rr_download
+		outBuf->copy(	"HTTP/1.1 200 OK\r\n"
+						"Cache-Control: no-cache, no-store, must-revalidate\r\n"
 						"Pragma: no-cache\r\n"
 						"Expires: 0\r\n"
 						"Access-Control-Allow-Origin: *\r\n"
 					);
 	}
 
+	fileBeingSent = fileToSend;
+
 	const char* contentType;
 	if (StringEndsWithIgnoreCase(nameOfFileToSend, ".png"))
 	{
@@ -849,13 +1049,14 @@ void HttpResponder::SendFile(const char* nameOfFileToSend, bool isWebFile)
 		outBuf->cat("Content-Encoding: gzip\r\n");
 	}
 
-	outBuf->catf("Content-Length: %lu\r\n", fileToSend->Length());
-	outBuf->cat("Connection: close\r\n\r\n");
-	Commit();
+	outBuf->catf("Content-Length: %" PRIuFilePos "\r\n", fileToSend->Length());
+	outBuf->catf("Connection: %s\r\n\r\n", keepOpen ? "keep-alive" : "close");
+	Commit(keepOpen ? ResponderState::reading : ResponderState::free);
 }
 
 void HttpResponder::SendGCodeReply()
 {
+	const bool keepOpen = ClientWantsKeepAlive();
 	{
 		// Do we need to keep the G-Code reply for other clients?
 		bool clearReply = false;
@@ -891,7 +1092,7 @@ void HttpResponder::SendGCodeReply()
 						"Content-Type: text/plain\r\n"
 					);
 		outBuf->catf("Content-Length: %u\r\n", gcodeReply.DataLength());
-		outBuf->cat("Connection: close\r\n\r\n");
+		outBuf->catf("Connection: %s\r\n\r\n", keepOpen ? "keep-alive" : "close");
 		outStack.Append(gcodeReply);
 
 		// Possibly clean up the G-code reply once again
@@ -901,7 +1102,285 @@ void HttpResponder::SendGCodeReply()
 		}
 	}
 
-	Commit();
+	Commit(keepOpen ? ResponderState::reading : ResponderState::free);
+}
+
+// Append the TYPE line of a metric in the Prometheus text format
+static void AppendMetricType(OutputBuffer *buf, const char *name, const char *type)
+{
+	buf->cat("# TYPE ");
+	buf->cat(name);
+	buf->cat(' ');
+	buf->cat(type);
+	buf->cat('\n');
+}
+
+// Append the name and labels of a sample. The labels are already in the form {name="value"} or null.
+static void AppendSampleName(OutputBuffer *buf, const char *name, const char *labels)
+{
+	buf->cat(name);
+	if (labels != nullptr)
+	{
+		buf->cat(labels);
+	}
+	buf->cat(' ');
+}
+
+static void AppendSample(OutputBuffer *buf, const char *name, const char *labels, uint32_t value)
+{
+	AppendSampleName(buf, name, labels);
+	buf->catUnsigned(value);
+	buf->cat('\n');
+}
+
+static void AppendSample(OutputBuffer *buf, const char *name, const char *labels, float value)
+{
+	AppendSampleName(buf, name, labels);
+	buf->catFloat(value, 3);
+	buf->cat('\n');
+}
+
+template<class T> static void AppendMetric(OutputBuffer *buf, const char *name, const char *type, T value)
+{
+	AppendMetricType(buf, name, type);
+	AppendSample(buf, name, nullptr, value);
+}
+
+static float ClocksToMillis(uint32_t clocks)
+{
+	return (float)clocks * StepTimer::StepClocksToMillis;
+}
+
+// Send the performance counters as plain text in the format that Prometheus scrapes, for rr_metrics.
+// The peak and minimum values are the same ones that M122 reports and clears, so they cover the time since M122 was last run. We don't clear them here.
+// We build the response with the integer and fixed-point output functions rather than printf, so that frequent scraping costs little time in the network task.
+void HttpResponder::SendMetrics()
+{
+	OutputBuffer *metrics;
+	if (!OutputBuffer::Allocate(metrics))
+	{
+		outBuf->copy(serviceUnavailableResponse);
+		Commit(ResponderState::free, false);
+		return;
+	}
+
+	AppendMetric(metrics, "rrf_main_loop_slowest_ms", "gauge", ClocksToMillis(reprap.GetSlowestLoopClocks()));
+	AppendMetric(metrics, "rrf_main_loop_fastest_ms", "gauge", ClocksToMillis(reprap.GetFastestLoopClocks()));
+
+	const Move& move = reprap.GetMove();
+	const DDARing::PrepareStats& prepareStats = move.GetPrepareStats();
+	AppendMetric(metrics, "rrf_move_hiccups", "gauge", move.GetNumHiccups());
+	AppendMetric(metrics, "rrf_move_prepared_late", "gauge", prepareStats.numPreparedLate);
+	AppendMetric(metrics, "rrf_move_prepare_max_ms", "gauge", prepareStats.maxPrepareMillis);
+	AppendMetric(metrics, "rrf_move_prepare_min_slack_ms", "gauge", prepareStats.minSlackMillis);
+
+	AppendMetricType(metrics, "rrf_output_buffers_used", "gauge");
+	AppendSample(metrics, "rrf_output_buffers_used", "{size=\"large\"}", (uint32_t)OutputBuffer::GetUsedBuffers(true));
+	AppendSample(metrics, "rrf_output_buffers_used", "{size=\"small\"}", (uint32_t)OutputBuffer::GetUsedBuffers(false));
+	AppendMetricType(metrics, "rrf_output_buffers_max_used", "gauge");
+	AppendSample(metrics, "rrf_output_buffers_max_used", "{size=\"large\"}", (uint32_t)OutputBuffer::GetMaxUsedBuffers(true));
+	AppendSample(metrics, "rrf_output_buffers_max_used", "{size=\"small\"}", (uint32_t)OutputBuffer::GetMaxUsedBuffers(false));
+	AppendMetric(metrics, "rrf_output_buffer_failures", "gauge", OutputBuffer::GetAllocationFailures());
+
+	AppendMetric(metrics, "rrf_sd_max_retries", "gauge", (uint32_t)FileStore::GetMaxRetryCount());
+	AppendMetric(metrics, "rrf_sd_longest_write_ms", "gauge", FileStore::GetLongestWriteTime());
+
+	const Network& network = reprap.GetNetwork();
+	AppendMetric(metrics, "rrf_network_loop_slowest_ms", "gauge", ClocksToMillis(network.GetSlowestLoopClocks()));
+	AppendMetric(metrics, "rrf_network_throttled", "gauge", network.GetTimesThrottled());
+	AppendMetric(metrics, "rrf_network_buffer_failures", "gauge", NetworkBuffer::GetAllocationFailures());
+
+	const Heat& heat = reprap.GetHeat();
+	AppendMetric(metrics, "rrf_heater_spin_longest_ms", "gauge", ClocksToMillis(heat.GetLongestSpinClocks()));
+	AppendMetric(metrics, "rrf_heater_spins_total", "counter", heat.GetNumSpins());
+
+	if (metrics->HadOverflow())
+	{
+		OutputBuffer::ReleaseAll(metrics);
+		outBuf->copy(serviceUnavailableResponse);
+		Commit(ResponderState::free, false);
+		return;
+	}
+
+	const bool keepOpen = ClientWantsKeepAlive();
+	outBuf->copy(	"HTTP/1.1 200 OK\r\n"
+					"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+					"Pragma: no-cache\r\n"
+					"Expires: 0\r\n"
+					"Access-Control-Allow-Origin: *\r\n"
+					"Content-Type: text/plain; version=0.0.4\r\n"
+				);
+	outBuf->catf("Content-Length: %u\r\n", (unsigned int)metrics->Length());
+	outBuf->catf("Connection: %s\r\n\r\n", keepOpen ? "keep-alive" : "close");
+	outBuf->Append(metrics);
+	Commit(keepOpen ? ResponderState::reading : ResponderState::free);
+}
+
+// Start sending status responses as server-sent events, so that the client doesn't need to keep polling rr_status.
+// The client can ask for the status type and the interval between events, e.g. rr_statusstream?type=2&interval=250.
+// We only send a new event when the status has changed, or after StatusStreamKeepAliveInterval so that we notice when the client has gone away.
+void HttpResponder::StartStatusStream()
+{
+	if (numStatusStreams >= MaxStatusStreams())
+	{
+		RejectMessage("Too many status streams", 503);
+		return;
+	}
+
+	const char * const typeString = GetKeyValue("type");
+	const int type = (typeString != nullptr) ? SafeStrtol(typeString) : 2;
+	streamType = (type >= 1 && type <= (int)NumStatusTypes) ? (unsigned int)type : 2;
+	const char * const intervalString = GetKeyValue("interval");
+	streamInterval = (intervalString != nullptr)
+						? constrain<uint32_t>(SafeStrtoul(intervalString), MinStatusStreamInterval, MaxStatusStreamInterval)
+							: DefaultStatusStreamInterval;
+
+	streamBuffer = nullptr;
+	streamLastSentTime = millis() - StatusStreamKeepAliveInterval;			// make sure that we send the first event straight away
+	timer = millis() - streamInterval;
+	isStreamingStatus = true;
+	++numStatusStreams;
+
+	outBuf->copy(	"HTTP/1.1 200 OK\r\n"
+					"Cache-Control: no-cache\r\n"
+					"Access-Control-Allow-Origin: *\r\n"
+					"Content-Type: text/event-stream\r\n"
+					"Connection: keep-alive\r\n\r\n"
+				);
+	Commit(ResponderState::streamingStatus);
+}
+
+// Send the next status event if it is time to, returning true if we did anything significant
+bool HttpResponder::SpinStatusStream()
+{
+	if (streamBuffer == nullptr)
+	{
+		if (!skt->CanSend())
+		{
+			ConnectionLost();										// the client has closed the connection
+			return true;
+		}
+
+		const uint32_t now = millis();
+		if (now - timer < streamInterval)
+		{
+			return false;
+		}
+		timer = now;
+
+		if (!CheckAuthenticated())									// this also stops the session timing out while we are streaming
+		{
+			ConnectionLost();
+			return true;
+		}
+
+		uint32_t crc;
+		OutputBuffer * const status = GetSharedStatus(streamType, crc);
+		if (status == nullptr || (crc == streamLastSentCrc && now - streamLastSentTime < StatusStreamKeepAliveInterval))
+		{
+			return false;											// no buffers available, or nothing new to send
+		}
+
+		status->IncreaseReferences(1);
+		streamBuffer = status;
+		streamPointer = status;
+		streamOffset = 0;
+		streamLastSentCrc = crc;
+		streamLastSentTime = now;
+	}
+
+	// Send the event directly from the shared buffers. We can't use outBuf, because other responders may be sending the same buffers and each buffer only has one read pointer.
+	while (streamPointer != nullptr)
+	{
+		const size_t remaining = streamPointer->DataLength() - streamOffset;
+		if (remaining != 0)
+		{
+			const size_t sent = skt->Send(reinterpret_cast<const uint8_t *>(streamPointer->Data() + streamOffset), remaining);
+			if (sent == 0)
+			{
+				if (!skt->CanSend())
+				{
+					ConnectionLost();
+				}
+				return true;
+			}
+			streamOffset += sent;
+			if (sent < remaining)
+			{
+				return true;
+			}
+		}
+		streamPointer = streamPointer->Next();
+		streamOffset = 0;
+	}
+
+	skt->Send();													// tell the socket there is no more data for now
+	OutputBuffer::ReleaseAll(streamBuffer);
+	return true;
+}
+
+void HttpResponder::StopStatusStream()
+{
+	if (isStreamingStatus)
+	{
+		isStreamingStatus = false;
+		OutputBuffer::ReleaseAll(streamBuffer);
+		--numStatusStreams;
+		if (numStatusStreams == 0)
+		{
+			// Nobody else wants the shared status events, so free up the buffers
+			for (SharedStatus& ss : sharedStatus)
+			{
+				OutputBuffer::ReleaseAll(ss.buffer);
+			}
+		}
+	}
+}
+
+// Return the shared status event of the specified type, building it if it is too old. The caller must increase the references if it keeps the event.
+// We build a new event at most once every MinStatusStreamInterval, so the cost of building the status doesn't depend on how many clients are streaming it.
+/*static*/ OutputBuffer *HttpResponder::GetSharedStatus(unsigned int type, uint32_t& crc)
+{
+	SharedStatus& ss = sharedStatus[type - 1];
+	const uint32_t now = millis();
+	if (ss.buffer == nullptr || now - ss.whenBuilt >= MinStatusStreamInterval)
+	{
+		OutputBuffer *event;
+		if (OutputBuffer::Allocate(event))
+		{
+			OutputBuffer *status = reprap.GetStatusResponse(type, ResponseSource::HTTP);			// this may return nullptr
+			if (status == nullptr || status->HadOverflow())
+			{
+				OutputBuffer::ReleaseAll(status);
+				OutputBuffer::Release(event);
+			}
+			else
+			{
+				CRC32 statusCrc;
+				for (const OutputBuffer *buf = status; buf != nullptr; buf = buf->Next())
+				{
+					statusCrc.Update(buf->Data(), buf->DataLength());
+				}
+				event->copy("data: ");
+				event->Append(status);
+				event->cat("\n\n");
+				if (event->HadOverflow())
+				{
+					OutputBuffer::ReleaseAll(event);
+				}
+				else
+				{
+					OutputBuffer::ReleaseAll(ss.buffer);
+					ss.buffer = event;
+					ss.whenBuilt = now;
+					ss.crc = statusCrc.Get();
+				}
+			}
+		}
+	}
+
+	crc = ss.crc;
+	return ss.buffer;
 }
 
 // Send a JSON response to the current command. outBuf is non-null on entry.
@@ -931,14 +1410,26 @@ void HttpResponder::SendJsonResponse(const char* command)
 				return;
 			}
 		}
+
+		if (StringEqualsIgnoreCase(command, "statusstream"))	// rr_statusstream
+		{
+			StartStatusStream();
+			return;
+		}
+
+		if (StringEqualsIgnoreCase(command, "metrics"))		// rr_metrics
+		{
+			SendMetrics();
+			return;
+		}
 	}
 
 	// Try to process a request for JSON responses
 	OutputBuffer *jsonResponse;
-	bool mayKeepOpen;
+	bool mayKeepOpen, isBinary;
 	if (OutputBuffer::Allocate(jsonResponse))
 	{
-		const bool gotResponse = GetJsonResponse(command, jsonResponse, mayKeepOpen);
+		const bool gotResponse = GetJsonResponse(command, jsonResponse, mayKeepOpen, isBinary);
 		if (!gotResponse)
 		{
 			// GetJsonResponse() changed the state instead of returning a response
@@ -982,21 +1473,8 @@ void HttpResponder::SendJsonResponse(const char* command)
 		return;
 	}
 
-	// Send the JSON response
-	bool keepOpen = false;
-	if (mayKeepOpen)
-	{
-		// Check that the browser wants to persist the connection too
-		for (size_t i = 0; i < numHeaderKeys; ++i)
-		{
-			if (StringEqualsIgnoreCase(headers[i].key, "Connection"))
-			{
-				// Comment out the following line to disable persistent connections
-				keepOpen = StringEqualsIgnoreCase(headers[i].value, "keep-alive");
-				break;
-			}
-		}
-	}
+	// Send the JSON response, keeping the connection open if the browser wants to persist it too
+	const bool keepOpen = mayKeepOpen && ClientWantsKeepAlive();
 
 	// Note that when using RTOS the following response should preferably be small enough to fit in a single buffer.
 	// This is because the current task may get suspended e.g. when reading from SD card to build a file list,
@@ -1008,8 +1486,8 @@ void HttpResponder::SendJsonResponse(const char* command)
 					"Pragma: no-cache\r\n"
 					"Expires: 0\r\n"
 					"Access-Control-Allow-Origin: *\r\n"
-					"Content-Type: application/json\r\n"
 				);
+	outBuf->catf("Content-Type: %s\r\n", (isBinary) ? "application/octet-stream" : "application/json");
 	const unsigned int replyLength = (jsonResponse != nullptr) ? jsonResponse->Length() : 0;
 	outBuf->catf("Content-Length: %u\r\n", replyLength);
 	outBuf->catf("Connection: %s\r\n\r\n", keepOpen ? "keep-alive" : "close");
@@ -1087,8 +1565,8 @@ void HttpResponder::ProcessRequest()
 		return;
 	}
 
-	// Reserve an output buffer before we process the request, or we won't be able to reply
-	if (outBuf != nullptr || OutputBuffer::Allocate(outBuf))
+	// Reserve an output buffer before we process the request, or we won't be able to reply. Ask for a large one so that it can hold the response headers.
+	if (outBuf != nullptr || OutputBuffer::Allocate(outBuf, true))
 	{
 		if (StringEqualsIgnoreCase(commandWords[0], "GET"))
 		{
@@ -1202,16 +1680,11 @@ void HttpResponder::ProcessRequest()
 					uploadedBytes = 0;
 
 					// Keep track of the connection that is now uploading
-					const IPAddress remoteIP = GetRemoteIP();
-					const uint16_t remotePort = skt->GetRemotePort();
-					for (size_t i = 0; i < numSessions; i++)
+					HttpSession * const session = FindSession(GetRemoteIP());
+					if (session != nullptr)
 					{
-						if (sessions[i].ip == remoteIP)
-						{
-							sessions[i].postPort = remotePort;
-							sessions[i].isPostUploading = true;
-							break;
-						}
+						session->postPort = skt->GetRemotePort();
+						session->isPostUploading = true;
 					}
 					return;
 				}
@@ -1288,15 +1761,11 @@ void HttpResponder::DoUpload()
 	if (uploadedBytes >= postFileLength)
 	{
 		// Reset POST upload state for this client
-		const IPAddress remoteIP = GetRemoteIP();
-		for (size_t i = 0; i < numSessions; i++)
+		HttpSession * const session = FindSession(GetRemoteIP());
+		if (session != nullptr && session->isPostUploading)
 		{
-			if (sessions[i].ip == remoteIP && sessions[i].isPostUploading)
-			{
-				sessions[i].isPostUploading = false;
-				sessions[i].lastQueryTime = millis();
-				break;
-			}
+			session->isPostUploading = false;
+			session->lastQueryTime = millis();
 		}
 
 		FinishUpload(postFileLength, fileLastModified, postFileGotCrc, postFileExpectedCrc);
@@ -1313,19 +1782,23 @@ void HttpResponder::Terminate(NetworkProtocol protocol, NetworkInterface *interf
 	}
 }
 
+// This overrides the version in class UploadingNetworkResponder
+void HttpResponder::ConnectionLost()
+{
+	StopStatusStream();
+	UploadingNetworkResponder::ConnectionLost();
+}
+
 // This overrides the version in class NetworkResponder
 void HttpResponder::CancelUpload()
 {
 	if (skt != nullptr)
 	{
-		for (size_t i = 0; i < numSessions; i++)
+		HttpSession * const session = FindSession(skt->GetRemoteIP());
+		if (session != nullptr && session->isPostUploading)
 		{
-			if (sessions[i].ip == skt->GetRemoteIP() && sessions[i].isPostUploading)
-			{
-				sessions[i].isPostUploading = false;
-				sessions[i].lastQueryTime = millis();
-				break;
-			}
+			session->isPostUploading = false;
+			session->lastQueryTime = millis();
 		}
 	}
 	UploadingNetworkResponder::CancelUpload();
@@ -1337,7 +1810,10 @@ void HttpResponder::SendData()
 	NetworkResponder::SendData();
 	if (responderState == ResponderState::reading)
 	{
+		// We kept the connection open, so get ready for the next request, which the client may already have sent
 		timer = millis();				// restart the timer
+		isKeptAlive = true;
+		ResetParseState();
 	}
 }
 
@@ -1357,6 +1833,10 @@ void HttpResponder::Diagnostics(MessageType mt) const
 	MutexLocker lock(gcodeReplyMutex);
 
 	clientsServed = 0;
+	for (HttpSession& session : sessions)
+	{
+		session.ip.SetNull();
+	}
 	numSessions = 0;
 	gcodeReply.ReleaseAll();
 }
@@ -1417,18 +1897,27 @@ void HttpResponder::Diagnostics(MessageType mt) const
 {
 	unsigned int clientsTimedOut = 0;
 	const uint32_t now = millis();
-	for (size_t i = numSessions; i != 0; )
+
+	// Query times only ever move forwards, so until the oldest one we recorded is too old, no session can have timed out
+	if (numSessions != 0 && now - oldestQueryTime > HttpSessionTimeout)
 	{
-		--i;
-		if ((now - sessions[i].lastQueryTime) > HttpSessionTimeout)
+		uint32_t oldestAge = 0;
+		for (size_t slot = 0; slot < SessionTableSize; )
 		{
-			for (size_t k = i + 1; k < numSessions; k++)
+			if (!sessions[slot].ip.IsNull())
 			{
-				sessions[k - 1] = sessions[k];
+				const uint32_t age = now - sessions[slot].lastQueryTime;
+				if (age > HttpSessionTimeout)
+				{
+					RemoveSession(slot);
+					clientsTimedOut++;
+					continue;								// RemoveSession may have moved another session into this slot
+				}
+				oldestAge = max<uint32_t>(oldestAge, age);
 			}
-			numSessions--;
-			clientsTimedOut++;
+			++slot;
 		}
+		oldestQueryTime = now - oldestAge;
 	}
 
 	// If we cannot send the G-Code reply to anyone, we may free up some run-time space by dumping it
@@ -1472,15 +1961,19 @@ void HttpResponder::Diagnostics(MessageType mt) const
 
 /*static*/ void HttpResponder::CommonDiagnostics(MessageType mtype)
 {
-	GetPlatform().MessageF(mtype, "HTTP sessions: %u of %u\n", numSessions, MaxHttpSessions);
+	GetPlatform().MessageF(mtype, "HTTP sessions: %u of %u, status streams: %u of %u\n", numSessions, MaxHttpSessions, numStatusStreams, MaxStatusStreams());
 }
 
 // Static data
 
-HttpResponder::HttpSession HttpResponder::sessions[MaxHttpSessions];
+HttpResponder::HttpSession HttpResponder::sessions[SessionTableSize];
 unsigned int HttpResponder::numSessions = 0;
+uint32_t HttpResponder::oldestQueryTime = 0;
 unsigned int HttpResponder::clientsServed = 0;
 
+HttpResponder::SharedStatus HttpResponder::sharedStatus[NumStatusTypes] = { };
+unsigned int HttpResponder::numStatusStreams = 0;
+
 volatile uint32_t HttpResponder::seq = 0;
 volatile OutputStack HttpResponder::gcodeReply;
 Mutex HttpResponder::gcodeReplyMutex;
@@ -17,6 +17,7 @@ public:
 	bool Spin() override;								// do some work, returning true if we did anything significant
 	bool Accept(Socket *s, NetworkProtocol protocol) override;	// ask the responder to accept this connection, returns true if it did
 	void Terminate(NetworkProtocol protocol, NetworkInterface *interface) override;	// terminate the responder if it is serving the specified protocol on the specified interface
+	bool CloseIfIdle(NetworkProtocol protocol) override;	// close a kept-alive connection that has no request in progress, returning true if we did
 	void Diagnostics(MessageType mtype) const override;
 
 	static void InitStatic();
@@ -28,11 +29,14 @@ public:
 	static void CommonDiagnostics(MessageType mtype);
 
 protected:
+	void ConnectionLost() override;
 	void CancelUpload() override;
 	void SendData() override;
 
 private:
-	static const size_t MaxHttpSessions = 8;			// maximum number of simultaneous HTTP sessions
+	static const size_t MaxHttpSessions = 16;			// maximum number of simultaneous HTTP sessions
+	static const unsigned int SessionTableBits = 5;		// log2 of the number of slots in the session table
+	static const size_t SessionTableSize = 1u << SessionTableBits;	// must be at least twice MaxHttpSessions to keep the probe sequences short
 	static const uint16_t WebMessageLength = 1460;		// maximum length of the web message we accept after decoding
 	static const size_t MaxCommandWords = 4;			// max number of space-separated words in the command
 	static const size_t MaxQualKeys = 5;				// max number of key/value pairs in the qualifier
@@ -41,6 +45,13 @@ private:
 	static const uint32_t MaxFileInfoGetTime = 2000;	// maximum length of time we spend getting file info, to avoid the client timing out (actual time will be a little longer than this)
 	static const uint32_t MaxBufferWaitTime = 1000;		// maximum length of time we spend waiting for a buffer before we discard gcodeReply buffers
 
+	// Status streaming
+	static const unsigned int NumStatusTypes = 3;		// the number of status response types that clients can stream
+	static const uint32_t MinStatusStreamInterval = 100;		// the shortest interval between status events that a client may ask for, in milliseconds
+	static const uint32_t MaxStatusStreamInterval = 10000;		// the longest interval between status events that a client may ask for, in milliseconds
+	static const uint32_t DefaultStatusStreamInterval = 500;	// the interval between status events if the client doesn't ask for one
+	static const uint32_t StatusStreamKeepAliveInterval = 5000;	// how often we send the status even if it hasn't changed, so that we find out if the client has gone
+
 	enum class HttpParseState
 	{
 		doingCommandWord,			// receiving a word in the first line of the HTTP request
@@ -76,19 +87,32 @@ private:
 	bool CheckAuthenticated();
 	bool RemoveAuthentication();
 
+	static size_t SessionSlot(IPAddress ip) { return (ip.GetV4LittleEndian() * 2654435769u) >> (32 - SessionTableBits); }
+	static HttpSession *FindSession(IPAddress ip);	// return the session for this client, or nullptr if it hasn't authenticated
+	static void RemoveSession(size_t slot);
+
+	void ResetParseState();
 	bool CharFromClient(char c);
+	bool ClientWantsKeepAlive() const;
 	void SendFile(const char* nameOfFileToSend, bool isWebFile);
 	void SendGCodeReply();
+	void SendMetrics();
 	void SendJsonResponse(const char* command);
-	bool GetJsonResponse(const char* request, OutputBuffer *&response, bool& keepOpen);
+	bool GetJsonResponse(const char* request, OutputBuffer *&response, bool& keepOpen, bool& isBinary);
 	void ProcessMessage();
 	void ProcessRequest();
 	void RejectMessage(const char* s, unsigned int code = 500);
 	bool SendFileInfo(bool quitEarly);
+	void StartStatusStream();
+	bool SpinStatusStream();
+	void StopStatusStream();
+
+	static OutputBuffer *GetSharedStatus(unsigned int type, uint32_t& crc);
 
 	void DoUpload();
 
 	const char* GetKeyValue(const char *key) const;	// return the value of the specified key, or nullptr if not present
+	const char* GetHeaderValue(const char *key) const;	// return the value of the specified header, or nullptr if not present
 
 	HttpParseState parseState;
 
@@ -104,21 +128,44 @@ private:
 	size_t numCommandWords;
 	size_t numQualKeys;								// number of qualifier keys we have found, <= maxQualKeys
 	size_t numHeaderKeys;							// number of keys we have found, <= maxHeaders
+	bool isKeptAlive;								// true if we are waiting for another request on a connection that we kept open
 
 	// rr_fileinfo requests
 	uint32_t startedProcessingRequestAt;			// when we started processing the current HTTP request
 	// rr_fileinfo also uses fileBeingProcessed in the networkResponder class
 
+	// rr_statusstream requests
+	OutputBuffer *streamBuffer;						// the shared status event we are sending, on which we hold a reference, or nullptr
+	const OutputBuffer *streamPointer;				// the buffer in streamBuffer that we are sending
+	size_t streamOffset;							// how much of streamPointer we have sent
+	uint32_t streamInterval;						// the interval between events that the client asked for
+	uint32_t streamLastSentTime;					// when we last started sending an event
+	uint32_t streamLastSentCrc;						// the CRC of the status we last sent, so that we only send it again if it has changed
+	unsigned int streamType;						// the type of status response the client asked for
+	bool isStreamingStatus;
+
 	uint32_t postFileLength;
 	uint32_t postFileExpectedCrc;
 	time_t fileLastModified;
 	bool postFileGotCrc;
 
 	// Keeping track of HTTP sessions
-	static HttpSession sessions[MaxHttpSessions];
+	// The sessions are held in a hash table indexed by client IP address, using linear probing. Unused slots have a null IP address.
+	static HttpSession sessions[SessionTableSize];
 	static unsigned int numSessions;
+	static uint32_t oldestQueryTime;					// no session has a last query time earlier than this, so none can time out until HttpSessionTimeout after it
 	static unsigned int clientsServed;
 
+	// Status events, built once and shared between all the clients that are streaming that type of status
+	struct SharedStatus
+	{
+		OutputBuffer *buffer;						// the event in server-sent events format, or nullptr
+		uint32_t whenBuilt;
+		uint32_t crc;								// the CRC of the status response in the event
+	};
+	static SharedStatus sharedStatus[NumStatusTypes];
+	static unsigned int numStatusStreams;
+
 	// Responses from GCodes class
 	static volatile uint32_t seq;					// Sequence number for G-Code replies
 	static volatile OutputStack gcodeReply;
@@ -100,8 +100,22 @@
 /**
  * MEM_SIZE: the size of the heap memory. If the application will send
  * a lot of data that needs to be copied, this should be set high.
+ * The heap size and the TCP window and send buffer sizes are chosen when the network is started,
+ * depending on how much RAM is free. See the memory profiles in LwipEthernetInterface.cpp.
  */
-#define MEM_SIZE                		12288		// 8192 works too but then lwip reports mem errors. sadly "max" isn't working
+#ifndef __ASSEMBLER__
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern unsigned int lwipMemSize, lwipTcpWindow, lwipTcpSendBuffer;
+extern void *lwipHeap;
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+#define MEM_SIZE                		lwipMemSize
+#define LWIP_RAM_HEAP_POINTER			lwipHeap
 
 /**
  * MEMP_NUM_UDP_PCB: the number of UDP protocol control blocks. One
@@ -126,7 +140,7 @@
  * MEMP_NUM_TCP_SEG: the number of simultaneously queued TCP segments.
  * (requires the LWIP_TCP option)
  */
-#define MEMP_NUM_TCP_SEG                8
+#define MEMP_NUM_TCP_SEG                TCP_SND_QUEUELEN
 
 /**
  * MEMP_NUM_REASSDATA: the number of IP packets simultaneously queued for
@@ -148,7 +162,7 @@
  * If the application sends a lot of data out of ROM (or other static memory),
  * this should be set high.
  */
-#define MEMP_NUM_PBUF                   4
+#define MEMP_NUM_PBUF                   10		// file data is sent without copying, which needs up to 2 of these per HTTP socket
 
 /**
  * MEMP_NUM_NETBUF: the number of struct netbufs.
@@ -235,19 +249,30 @@ extern uint32_t trueRandom(void);
  * TCP_WND: The size of a TCP window.  This must be at least
  * (2 * TCP_MSS) for things to work well
  */
-#define TCP_WND                 (2 * TCP_MSS)
+#define TCP_WND                 lwipTcpWindow
 
 /**
  * TCP_SND_BUF: TCP sender buffer space (bytes).
  * To achieve good performance, this should be at least 2 * TCP_MSS.
  */
-#define TCP_SND_BUF             (2 * TCP_MSS)
+#define TCP_SND_BUF             lwipTcpSendBuffer
+
+/**
+ * The largest TCP_SND_BUF that any memory profile uses. The segment queue is sized for this.
+ */
+#define TCP_SND_BUF_MAX         (4 * TCP_MSS)
 
 /**
  * TCP_SND_QUEUELEN: TCP sender buffer space (pbufs). This must be at least
  * as much as (2 * TCP_SND_BUF/TCP_MSS) for things to work.
  */
-#define TCP_SND_QUEUELEN        ((4 * (TCP_SND_BUF) + (TCP_MSS - 1))/(TCP_MSS))
+#define TCP_SND_QUEUELEN        ((4 * (TCP_SND_BUF_MAX) + (TCP_MSS - 1))/(TCP_MSS))
+
+/**
+ * The sanity checks in init.c are done by the preprocessor, so they can't check the sizes that we choose at run time.
+ * LwipEthernetInterface checks the memory profiles instead.
+ */
+#define LWIP_DISABLE_TCP_SANITY_CHECKS	1
 
 /*
    ------------------------------------------------
@@ -321,6 +346,7 @@ extern uint32_t trueRandom(void);
 #define MEM_STATS                         1
 #define MEMP_STATS                        1
 #define SYS_STATS                         1
+#define MIB2_STATS                        1		// for the count of retransmitted segments
 #endif
 /* Left outside to avoid warning. */
 #define ETHARP_STATS                      LWIP_STATS
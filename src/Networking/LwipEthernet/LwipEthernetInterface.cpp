@@ -19,6 +19,8 @@
 #include "Networking/TelnetResponder.h"
 #include "General/IP4String.h"
 #include "Version.h"
+#include "Tasks.h"
+#include "Movement/Move.h"
 #include "GMAC/ethernet_sam.h"
 
 extern "C"
@@ -41,6 +43,53 @@ const char * const MdnsServiceStrings[NumProtocols] = { "_http", "_ftp", "_telne
 const char * const MdnsTxtRecords[2] = { "product=" FIRMWARE_NAME, "version=" VERSION };
 const unsigned int MdnsTtl = 10 * 60;			// same value as on the Duet 0.6/0.8.5
 
+// LwIP memory profiles. When we start the network we use the first one whose heap we can allocate while leaving enough RAM free.
+// The throughput profile has a larger receive window so that uploads don't keep stalling with the window full,
+// and a larger send buffer and heap so that more data that LwIP copies can be in flight.
+struct LwipMemoryProfile
+{
+	const char *name;
+	unsigned int memSize;						// the size of the LwIP heap
+	unsigned int tcpWindow;						// the TCP receive window
+	unsigned int tcpSendBuffer;					// the amount of unacknowledged data we can have per connection
+};
+
+constexpr LwipMemoryProfile MemoryProfiles[] =
+{
+	{ "throughput", 24576, 4 * TCP_MSS, 4 * TCP_MSS },
+	{ "economy", 12288, 2 * TCP_MSS, 2 * TCP_MSS },		// 8192 heap works too but then lwip reports mem errors
+};
+
+constexpr size_t LwipHeapOverhead = 32;			// extra bytes that mem_init needs for alignment and the header at each end of the heap
+
+// These replace the LwIP sanity checks, which can't check sizes that are chosen at run time
+constexpr bool CheckMemoryProfiles()
+{
+	for (const LwipMemoryProfile& p : MemoryProfiles)
+	{
+		if (   p.memSize > 64000 || p.tcpWindow < TCP_MSS || p.tcpSendBuffer < 2 * TCP_MSS || p.tcpSendBuffer > TCP_SND_BUF_MAX
+			|| p.tcpWindow > PBUF_POOL_SIZE * (PBUF_POOL_BUFSIZE - (PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + PBUF_IP_HLEN + PBUF_TRANSPORT_HLEN))
+		   )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static_assert(CheckMemoryProfiles(), "Bad LwIP memory profile");
+
+static const LwipMemoryProfile *memoryProfile = &MemoryProfiles[ARRAY_SIZE(MemoryProfiles) - 1];
+
+extern "C"
+{
+	// These are the sizes that lwipopts.h tells LwIP to use
+	unsigned int lwipMemSize = MemoryProfiles[ARRAY_SIZE(MemoryProfiles) - 1].memSize;
+	unsigned int lwipTcpWindow = MemoryProfiles[ARRAY_SIZE(MemoryProfiles) - 1].tcpWindow;
+	unsigned int lwipTcpSendBuffer = MemoryProfiles[ARRAY_SIZE(MemoryProfiles) - 1].tcpSendBuffer;
+	void *lwipHeap = nullptr;
+}
+
 
 /*-----------------------------------------------------------------------------------*/
 
@@ -147,7 +196,7 @@ LwipEthernetInterface::LwipEthernetInterface(Platform& p) : platform(p), closeDa
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(LwipEthernetInterface, _ret)
 
-const ObjectModelTableEntry LwipEthernetInterface::objectModelTable[] =
+constexpr ObjectModelTableEntry LwipEthernetInterface::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "gateway", OBJECT_MODEL_FUNC(&(self->gateway)), TYPE_OF(IPAddress), ObjectModelTableEntry::none },
@@ -370,6 +419,9 @@ void LwipEthernetInterface::Start()
 	{
 		const char *hostname = reprap.GetNetwork().GetHostname();
 
+		// Allocate the LwIP heap before LwIP initialises it
+		ChooseMemoryProfile();
+
 		// Allow the MAC address to be set only before LwIP is started...
 		ethernet_configure_interface(platform.GetDefaultMacAddress(), hostname);
 		init_ethernet(DefaultIpAddress, DefaultNetMask, DefaultGateway);
@@ -389,6 +441,24 @@ void LwipEthernetInterface::Start()
 	state = NetworkState::establishingLink;
 }
 
+// Choose the memory profile to use and allocate the LwIP heap. The last profile is always used if none of the others fit.
+void LwipEthernetInterface::ChooseMemoryProfile()
+{
+	for (const LwipMemoryProfile& p : MemoryProfiles)
+	{
+		if (Tasks::GetNeverUsedRam() >= p.memSize + LwipHeapOverhead + MinRamToLeave)
+		{
+			memoryProfile = &p;
+			break;
+		}
+	}
+
+	lwipMemSize = memoryProfile->memSize;
+	lwipTcpWindow = memoryProfile->tcpWindow;
+	lwipTcpSendBuffer = memoryProfile->tcpSendBuffer;
+	lwipHeap = new uint32_t[(memoryProfile->memSize + LwipHeapOverhead)/sizeof(uint32_t)];
+}
+
 // Stop the network
 void LwipEthernetInterface::Stop()
 {
@@ -534,6 +604,15 @@ void LwipEthernetInterface::Diagnostics(MessageType mtype)
 	}
 	platform.Message(mtype, "\n");
 
+	platform.MessageF(mtype, "Memory profile %s: heap %u, TCP window %u, send buffer %u\n",
+						memoryProfile->name, memoryProfile->memSize, memoryProfile->tcpWindow, memoryProfile->tcpSendBuffer);
+#if LWIP_STATS
+	platform.MessageF(mtype, "Heap max used %u, errors %u, pbuf pool max used %u of %u, exhausted %u, TCP segments retransmitted %" PRIu32 "\n",
+						lwip_stats.mem.max, lwip_stats.mem.err, lwip_stats.memp[MEMP_PBUF_POOL]->max, PBUF_POOL_SIZE, lwip_stats.memp[MEMP_PBUF_POOL]->err,
+						lwip_stats.mib2.tcpretranssegs);
+#endif
+	LwipSocket::Diagnostics(mtype);
+
 #if LWIP_STATS
 	// This prints LwIP diagnostics data to the USB port - blocking!
 	stats_display();
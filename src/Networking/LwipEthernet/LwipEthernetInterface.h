@@ -75,6 +75,7 @@ private:
 
 	void Start();
 	void Stop();
+	void ChooseMemoryProfile();
 	void InitSockets();
 	void TerminateSockets();
 
@@ -10,6 +10,7 @@
 
 #include "LwipSocket.h"
 #include "Networking/NetworkBuffer.h"
+#include "Platform.h"
 #include "RepRap.h"
 
 
@@ -72,6 +73,12 @@ extern void UnlockLWIP();
 
 // LwipSocket class
 
+// Static members
+uint32_t LwipSocket::bytesReceived = 0;
+uint32_t LwipSocket::bytesAcknowledged = 0;
+uint32_t LwipSocket::receiveWindowFull = 0;
+uint32_t LwipSocket::lastDiagnosticsTime = 0;
+
 LwipSocket::LwipSocket(NetworkInterface *iface) : Socket(iface), connectionPcb(nullptr),
 		receivedData(nullptr), state(SocketState::disabled)
 {
@@ -103,6 +110,12 @@ void LwipSocket::DataReceived(pbuf *data)
 {
 	if (state != SocketState::closing)
 	{
+		bytesReceived += data->tot_len;
+		if (connectionPcb != nullptr && connectionPcb->rcv_wnd == 0)
+		{
+			++receiveWindowFull;								// the client must wait until we have processed some of the data
+		}
+
 		// Store it for the NetworkResponder
 		if (receivedData == nullptr)
 		{
@@ -122,6 +135,7 @@ void LwipSocket::DataReceived(pbuf *data)
 
 void LwipSocket::DataSent(size_t numBytes)
 {
+	bytesAcknowledged += numBytes;
 	if (numBytes <= unAcked)
 	{
 		unAcked -= numBytes;
@@ -398,8 +412,20 @@ void LwipSocket::DiscardReceivedData()
 	readIndex = 0;
 }
 
-// Send the data, returning the length buffered
+// Send the data, returning the length buffered. LwIP copies the data, so the caller may reuse its buffer straight away.
 size_t LwipSocket::Send(const uint8_t *data, size_t length)
+{
+	return DoSend(data, length, TCP_WRITE_FLAG_COPY);
+}
+
+// Send the data without copying it, returning the length buffered. LwIP keeps pointers to the data until it has been acknowledged,
+// because it may need to retransmit it, so the caller must not change the data until HoldsSentData returns false.
+size_t LwipSocket::SendNoCopy(const uint8_t *data, size_t length)
+{
+	return DoSend(data, length, 0);
+}
+
+size_t LwipSocket::DoSend(const uint8_t *data, size_t length, uint8_t apiFlags)
 {
 	// This is always called outside the EthernetInterface::Spin method. Wait for pending ISRs to finish
 	while (!LockLWIP()) { }
@@ -425,7 +451,7 @@ size_t LwipSocket::Send(const uint8_t *data, size_t length)
 		err_t err;
 		do
 		{
-			err = tcp_write(connectionPcb, data, bytesToSend, 0);
+			err = tcp_write(connectionPcb, data, bytesToSend, apiFlags);
 			if (ERR_IS_FATAL(err))
 			{
 				Terminate();
@@ -466,4 +492,16 @@ size_t LwipSocket::Send(const uint8_t *data, size_t length)
 	return 0;
 }
 
+// Report the throughput statistics since the last time and clear them
+/*static*/ void LwipSocket::Diagnostics(MessageType mtype)
+{
+	const uint32_t now = millis();
+	const float seconds = max<float>((float)(now - lastDiagnosticsTime) * MillisToSeconds, 0.001);
+	reprap.GetPlatform().MessageF(mtype, "TCP received %" PRIu32 " bytes (%.1fKB/s), sent %" PRIu32 " bytes (%.1fKB/s), receive window full %" PRIu32 " times\n",
+									bytesReceived, (double)((float)bytesReceived/(seconds * 1024.0)), bytesAcknowledged, (double)((float)bytesAcknowledged/(seconds * 1024.0)),
+									receiveWindowFull);
+	bytesReceived = bytesAcknowledged = receiveWindowFull = 0;
+	lastDiagnosticsTime = now;
+}
+
 // End
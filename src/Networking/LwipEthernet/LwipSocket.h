@@ -11,6 +11,7 @@
 #include "LwipEthernetInterface.h"
 #include "Networking/NetworkDefs.h"
 #include "Networking/Socket.h"
+#include "MessageType.h"
 
 
 typedef int8_t err_t;
@@ -45,6 +46,10 @@ public:
 	bool CanSend() const override;
 	size_t Send(const uint8_t *data, size_t length) override;
 	void Send() override { }
+	size_t SendNoCopy(const uint8_t *data, size_t length) override;
+	size_t BytesHeld() const override { return unAcked; }
+
+	static void Diagnostics(MessageType mtype);			// report and clear the throughput statistics
 
 private:
 	enum class SocketState : uint8_t
@@ -60,6 +65,7 @@ private:
 
 	void ReInit();
 	void DiscardReceivedData();
+	size_t DoSend(const uint8_t *data, size_t length, uint8_t apiFlags);
 
 	uint32_t whenConnected;
 	uint32_t whenWritten;
@@ -72,6 +78,12 @@ private:
 
 	SocketState state;
 	size_t unAcked;
+
+	// Statistics for all sockets
+	static uint32_t bytesReceived;
+	static uint32_t bytesAcknowledged;
+	static uint32_t receiveWindowFull;					// how many times we received data that closed the receive window
+	static uint32_t lastDiagnosticsTime;
 };
 
 #endif /* SRC_SAME70_LWIPSOCKET_H_ */
@@ -36,20 +36,24 @@
 #include "General/IP4String.h"
 #include "Version.h"
 #include "Movement/StepTimer.h"
+#include "Movement/Move.h"
+#include "Tasks.h"
 
 #ifdef RTOS
 
 #if __LPC17xx__
 constexpr size_t NetworkStackWords = 470;
 #else
-constexpr size_t NetworkStackWords = 550;
+constexpr size_t NetworkStackWords = 650;				// 100 more than we used to need, because with exFAT enabled the file name functions in FatFS put an extra directory buffer on the stack
 #endif
 
 static Task<NetworkStackWords> networkTask;
 
 #endif
 
-Network::Network(Platform& p) : platform(p), responders(nullptr), nextResponderToPoll(nullptr)
+Network::Network(Platform& p) : platform(p), responders(nullptr), nextResponderToPoll(nullptr), numHttpResponders(0),
+	cpuBudgetPercent(100), budgetClocksPerWindow(0), responderActionsPerSpin(1), budgetWindowStart(0), clocksInWindow(0),
+	clocksSinceDiagnostics(0), lastDiagnosticsTime(0), timesThrottled(0)
 {
 #if defined(DUET3_V03)
 	interfaces[0] = new LwipEthernetInterface(p);
@@ -81,7 +85,7 @@ static const ObjectModelArrayDescriptor interfaceArrayDescriptor =
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(Network, _ret)
 
-const ObjectModelTableEntry Network::objectModelTable[] =
+constexpr ObjectModelTableEntry Network::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "interfaces", OBJECT_MODEL_FUNC_NOSELF(&interfaceArrayDescriptor), TYPE_OF(ObjectModel) | IsArray, ObjectModelTableEntry::none }
@@ -124,9 +128,10 @@ void Network::Init()
 	}
 #endif
 
-	for (size_t i = 0; i < NumHttpResponders; ++i)
+	while (numHttpResponders < NumHttpResponders)
 	{
 		responders = new HttpResponder(responders);
+		++numHttpResponders;
 	}
 
 	SafeStrncpy(hostname, DEFAULT_HOSTNAME, ARRAY_SIZE(hostname));
@@ -310,9 +315,51 @@ extern "C" void NetworkLoop(void *)
 {
 	for (;;)
 	{
-		reprap.GetNetwork().Spin(true);
-		RTOSIface::Yield();
+		Network& network = reprap.GetNetwork();
+		network.Spin(true);
+		const uint32_t throttleTime = network.GetThrottleTime();
+		if (throttleTime != 0)
+		{
+			delay(throttleTime);			// we have used up our CPU budget, so let the other tasks have the processor
+		}
+		else
+		{
+			RTOSIface::Yield();
+		}
+	}
+}
+
+// If the network task has used more than its CPU budget in the current window, return how many milliseconds it should sleep for, else return 0
+uint32_t Network::GetThrottleTime()
+{
+	const uint32_t now = millis();
+	const uint32_t timeInWindow = now - budgetWindowStart;
+	if (timeInWindow >= BudgetWindowMillis)
+	{
+		budgetWindowStart = now;
+		clocksInWindow = 0;
+		return 0;
+	}
+	if (cpuBudgetPercent >= 100 || clocksInWindow < budgetClocksPerWindow)
+	{
+		return 0;
+	}
+	++timesThrottled;
+	return BudgetWindowMillis - timeInWindow;
+}
+
+// Set the CPU budget of the network task and the number of responders that may do significant work in each call to Spin
+GCodeResult Network::SetCpuBudget(uint32_t percent, uint32_t actionsPerSpin, const StringRef& reply)
+{
+	if (percent < 10 || percent > 100 || actionsPerSpin == 0 || actionsPerSpin > 8)
+	{
+		reply.copy("CPU budget must be 10 to 100 percent and responder actions per loop 1 to 8");
+		return GCodeResult::error;
 	}
+	cpuBudgetPercent = percent;
+	budgetClocksPerWindow = (BudgetWindowMillis * (StepTimer::StepClockRate/1000) * percent)/100;
+	responderActionsPerSpin = actionsPerSpin;
+	return GCodeResult::ok;
 }
 
 // This is called at the end of config.g processing.
@@ -382,27 +429,32 @@ void Network::Spin(bool full)
 		iface->Spin(full);
 	}
 
-	// Poll the responders
+	// Poll the responders, stopping when we have been round all of them or responderActionsPerSpin of them have done something significant
 	if (full)
 	{
 		NetworkResponder *nr = nextResponderToPoll;
-		bool doneSomething = false;
+		uint32_t actionsLeft = responderActionsPerSpin;
 		do
 		{
 			if (nr == nullptr)
 			{
 				nr = responders;		// 'responders' can't be null at this point
 			}
-			doneSomething = nr->Spin();
+			if (nr->Spin())
+			{
+				--actionsLeft;
+			}
 			nr = nr->GetNext();
-		} while (!doneSomething && nr != nextResponderToPoll);
+		} while (actionsLeft != 0 && nr != nextResponderToPoll);
 		nextResponderToPoll = nr;
 	}
 
 	HttpResponder::CheckSessions();		// time out any sessions that have gone away
 
-	// Keep track of the loop time
+	// Keep track of the loop time and the time we have used
 	const uint32_t dt = StepTimer::GetInterruptClocks() - lastTime;
+	clocksInWindow += dt;
+	clocksSinceDiagnostics += dt;
 	if (dt < fastLoop)
 	{
 		fastLoop = dt;
@@ -430,6 +482,14 @@ void Network::Diagnostics(MessageType mtype)
 	fastLoop = UINT32_MAX;
 	slowLoop = 0;
 
+	const uint32_t now = millis();
+	const float cpuPercent = (now == lastDiagnosticsTime) ? 0.0 : (clocksSinceDiagnostics * StepTimer::StepClocksToMillis * 100.0)/(float)(now - lastDiagnosticsTime);
+	platform.MessageF(mtype, "CPU budget %" PRIu32 "%%, used %.1f%%, throttled %" PRIu32 " times, responder actions per loop %" PRIu32 "\n",
+						cpuBudgetPercent, (double)cpuPercent, timesThrottled, responderActionsPerSpin);
+	clocksSinceDiagnostics = 0;
+	timesThrottled = 0;
+	lastDiagnosticsTime = now;
+
 	platform.Message(mtype, "Responder states:");
 	for (NetworkResponder *r = responders; r != nullptr; r = r->GetNext())
 	{
@@ -438,6 +498,7 @@ void Network::Diagnostics(MessageType mtype)
 	platform.Message(mtype, "\n");
 
 	HttpResponder::CommonDiagnostics(mtype);
+	NetworkBuffer::Diagnostics(mtype);
 
 	for (NetworkInterface *iface : interfaces)
 	{
@@ -542,9 +603,44 @@ bool Network::FindResponder(Socket *skt, NetworkProtocol protocol)
 			return true;
 		}
 	}
+
+	// No responder is free, so close a persistent connection that is waiting for a request that hasn't arrived, if there is one
+	for (NetworkResponder *r = responders; r != nullptr; r = r->GetNext())
+	{
+		if (r->CloseIfIdle(protocol) && r->Accept(skt, protocol))
+		{
+			return true;
+		}
+	}
 	return false;
 }
 
+// Increase the number of HTTP responders, so that more HTTP requests can be processed concurrently.
+// The responders are allocated from the heap and shared by all the interfaces. We can't free them because the network task may be using them, so the number can only go up.
+GCodeResult Network::SetNumHttpResponders(size_t num, const StringRef& reply)
+{
+	if (num < numHttpResponders || num > MaxHttpResponders)
+	{
+		reply.printf("Number of HTTP responders must be between %u and %u", numHttpResponders, MaxHttpResponders);
+		return GCodeResult::error;
+	}
+
+	while (numHttpResponders < num)
+	{
+		if (Tasks::GetNeverUsedRam() < sizeof(HttpResponder) + MinRamToLeave)
+		{
+			reply.printf("Not enough memory for more than %u HTTP responders", numHttpResponders);
+			return GCodeResult::error;
+		}
+
+		// The network task may be walking the list of responders, so we only link in the new responder when it is fully constructed
+		HttpResponder * const r = new HttpResponder(responders);
+		responders = r;
+		++numHttpResponders;
+	}
+	return GCodeResult::ok;
+}
+
 void Network::HandleHttpGCodeReply(const char *msg)
 {
 	MutexLocker lock(httpMutex);
@@ -26,11 +26,13 @@ const size_t NumNetworkInterfaces = 1;
 #if defined(__LPC17xx__)
 // Only 2 http responders as we are tight on memory.
 const size_t NumHttpResponders = 2;		// the number of concurrent HTTP requests we can process
+const size_t MaxHttpResponders = 2;		// the number of HTTP responders that M586 may ask for
 const size_t NumFtpResponders = 0;		// the number of concurrent FTP sessions we support
 const size_t NumTelnetResponders = 0;	// the number of concurrent Telnet sessions we support
 #else
 const size_t NumHttpResponders = 4;		// the number of concurrent HTTP requests we can process
-const size_t NumFtpResponders = 1;		// the number of concurrent FTP sessions we support
+const size_t MaxHttpResponders = 8;		// the number of HTTP responders that M586 may ask for
+const size_t NumFtpResponders = 2;		// the number of concurrent FTP sessions we support
 const size_t NumTelnetResponders = 2;	// the number of concurrent Telnet sessions we support
 #endif
 
@@ -60,6 +62,14 @@ public:
 	GCodeResult EnableProtocol(unsigned int interface, NetworkProtocol protocol, int port, int secure, const StringRef& reply);
 	GCodeResult DisableProtocol(unsigned int interface, NetworkProtocol protocol, const StringRef& reply);
 	GCodeResult ReportProtocols(unsigned int interface, const StringRef& reply) const;
+	GCodeResult SetNumHttpResponders(size_t num, const StringRef& reply);
+	size_t GetNumHttpResponders() const { return numHttpResponders; }
+	GCodeResult SetCpuBudget(uint32_t percent, uint32_t actionsPerSpin, const StringRef& reply);
+	uint32_t GetCpuBudget() const { return cpuBudgetPercent; }
+	uint32_t GetSlowestLoopClocks() const { return slowLoop; }	// these two cover the time since we last reported diagnostics
+	uint32_t GetTimesThrottled() const { return timesThrottled; }
+	uint32_t GetResponderActionsPerSpin() const { return responderActionsPerSpin; }
+	uint32_t GetThrottleTime();
 
 	// WiFi interfaces
 	GCodeResult HandleWiFiCode(int mcode, GCodeBuffer& gb, const StringRef& reply, OutputBuffer*& longReply);
@@ -101,6 +111,7 @@ private:
 	NetworkInterface *interfaces[NumNetworkInterfaces];
 	NetworkResponder *responders;
 	NetworkResponder *nextResponderToPoll;
+	size_t numHttpResponders;
 
 	Mutex httpMutex;
 #if SUPPORT_TELNET
@@ -109,6 +120,17 @@ private:
 
 	uint32_t fastLoop, slowLoop;
 
+	// CPU budget for the network task. If it uses more than its budget in a window then it sleeps until the end of the window.
+	static constexpr uint32_t BudgetWindowMillis = 10;
+	uint32_t cpuBudgetPercent;						// 100 means no limit
+	uint32_t budgetClocksPerWindow;					// the step clocks we may spend in the responders and interfaces per window
+	uint32_t responderActionsPerSpin;				// how many responders may do significant work in one call to Spin
+	uint32_t budgetWindowStart;
+	uint32_t clocksInWindow;
+	uint32_t clocksSinceDiagnostics;				// statistics since the last call to Diagnostics
+	uint32_t lastDiagnosticsTime;
+	uint32_t timesThrottled;
+
 	char hostname[16];								// Limit DHCP hostname to 15 characters + terminating 0
 };
 
@@ -7,16 +7,25 @@
 
 #include "NetworkBuffer.h"
 #include "Storage/FileStore.h"
+#include "Platform.h"
+#include "RepRap.h"
+#include "Tasks.h"
+#include "Movement/Move.h"
 
 NetworkBuffer *NetworkBuffer::freelist = nullptr;
+unsigned int NetworkBuffer::numAllocated = 0;
+unsigned int NetworkBuffer::numInUse[NumProtocols + 1] = { 0 };
+unsigned int NetworkBuffer::maxInUse = 0;
+uint32_t NetworkBuffer::allocationFailures = 0;
 
-NetworkBuffer::NetworkBuffer(NetworkBuffer *n) : next(n), dataLength(0), readPointer(0)
+NetworkBuffer::NetworkBuffer(NetworkBuffer *n) : next(n), dataLength(0), readPointer(0), user(AnyProtocol)
 {
 }
 
 // Release this buffer and return the next one in the chain
 NetworkBuffer *NetworkBuffer::Release()
 {
+	--numInUse[UserIndex(user)];
 	NetworkBuffer *ret = next;
 	next = freelist;
 	freelist = this;
@@ -103,14 +112,35 @@ void NetworkBuffer::Empty()
 	return list;
 }
 
-/*static*/ NetworkBuffer *NetworkBuffer::Allocate()
+// Allocate a buffer. This is only called from the Network task. If there are no free buffers then we create another one, provided that we haven't reached the limit and there is enough RAM left.
+/*static*/ NetworkBuffer *NetworkBuffer::Allocate(NetworkProtocol user)
 {
-	NetworkBuffer *ret = freelist;
-	if (ret != nullptr)
+	if (freelist == nullptr)
 	{
-		freelist = ret->next;
-		ret->next = nullptr;
-		ret->dataLength = ret->readPointer = 0;
+		if (numAllocated >= MaxNetworkBufferCount || Tasks::GetNeverUsedRam() < sizeof(NetworkBuffer) + MinRamToLeave)
+		{
+			++allocationFailures;
+			return nullptr;
+		}
+		freelist = new NetworkBuffer(freelist);
+		++numAllocated;
+	}
+
+	NetworkBuffer * const ret = freelist;
+	freelist = ret->next;
+	ret->next = nullptr;
+	ret->dataLength = ret->readPointer = 0;
+	ret->user = user;
+
+	++numInUse[UserIndex(user)];
+	unsigned int totalInUse = 0;
+	for (unsigned int n : numInUse)
+	{
+		totalInUse += n;
+	}
+	if (totalInUse > maxInUse)
+	{
+		maxInUse = totalInUse;
 	}
 	return ret;
 }
@@ -120,10 +150,20 @@ void NetworkBuffer::Empty()
 	while (number != 0)
 	{
 		freelist = new NetworkBuffer(freelist);
+		++numAllocated;
 		--number;
 	}
 }
 
+// Report the usage of the buffers and clear the statistics
+/*static*/ void NetworkBuffer::Diagnostics(MessageType mtype)
+{
+	reprap.GetPlatform().MessageF(mtype, "Network buffers: %u allocated, %u max in use, in use by HTTP %u FTP %u Telnet %u, %" PRIu32 " allocation failures\n",
+									numAllocated, maxInUse, numInUse[HttpProtocol], numInUse[FtpProtocol], numInUse[TelnetProtocol], allocationFailures);
+	maxInUse = 0;
+	allocationFailures = 0;
+}
+
 // Count how many buffers there are in a chain
 /*static*/ unsigned int NetworkBuffer::Count(NetworkBuffer*& ptr)
 {
@@ -10,6 +10,7 @@
 
 #include "RepRapFirmware.h"
 #include "NetworkDefs.h"
+#include "MessageType.h"
 
 class WiFiSocket;
 class W5500Socket;
@@ -32,9 +33,15 @@ public:
 	// Return the amount of data available, not including continuation buffers
 	size_t Remaining() const { return dataLength - readPointer; }
 
+	// Return the amount of data that was put in this buffer, including any that has been taken
+	size_t Length() const { return dataLength; }
+
 	// Return the amount of data available, including continuation buffers
 	size_t TotalRemaining() const;
 
+	// Return the next buffer in the chain
+	const NetworkBuffer *Next() const { return next; }
+
 	// Return true if there no data left to read
 	bool IsEmpty() const { return readPointer == dataLength; }
 
@@ -62,12 +69,16 @@ public:
 	// Find the last buffer in a list
 	static NetworkBuffer *FindLast(NetworkBuffer *list);
 
-	// Allocate a buffer
-	static NetworkBuffer *Allocate();
+	// Allocate a buffer for use by the specified protocol
+	static NetworkBuffer *Allocate(NetworkProtocol user);
 
 	// Alocate buffers and put them in the freelist
 	static void AllocateBuffers(unsigned int number);
 
+	// Report the usage of the buffers and clear the statistics
+	static void Diagnostics(MessageType mtype);
+	static uint32_t GetAllocationFailures() { return allocationFailures; }
+
 	// Count how many buffers there are in a chain
 	static unsigned int Count(NetworkBuffer*& ptr);
 
@@ -83,12 +94,22 @@ private:
 	uint8_t *Data() { return reinterpret_cast<uint8_t*>(data32); }
 	const uint8_t *Data() const { return reinterpret_cast<const uint8_t*>(data32); }
 
+	// Return the index into numInUse for a protocol. FTP data connections are counted with FTP.
+	static size_t UserIndex(NetworkProtocol p) { return (p == FtpDataProtocol) ? FtpProtocol : (p < NumProtocols) ? p : NumProtocols; }
+
 	NetworkBuffer *next;
 	size_t dataLength;
 	size_t readPointer;
+	NetworkProtocol user;									// the protocol that allocated this buffer
 	// When doing unaligned transfers on the WiFi interface, up to 3 extra bytes may be returned, hence the +1 in the following
 	uint32_t data32[bufferSize/sizeof(uint32_t) + 1];		// 32-bit aligned buffer so we can do direct DMA
 	static NetworkBuffer *freelist;
+
+	// Statistics
+	static unsigned int numAllocated;						// how many buffers we have created
+	static unsigned int numInUse[NumProtocols + 1];			// how many buffers each protocol is using, with the last entry for any other user
+	static unsigned int maxInUse;							// the most buffers in use at once since we last reported
+	static uint32_t allocationFailures;						// how many times we failed to allocate a buffer since we last reported
 };
 
 #endif /* SRC_NETWORKING_NETWORKBUFFER_H_ */
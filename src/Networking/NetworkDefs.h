@@ -42,8 +42,10 @@ constexpr Port MdnsPort = 5353;
 
 #if defined(__LPC17xx__)
 const size_t NetworkBufferCount = 2;				// number of MSS sized buffers
+const size_t MaxNetworkBufferCount = 2;				// the number of buffers we may have if we allocate more when we run out
 #else
 constexpr size_t NetworkBufferCount = 6;			// number of 2K network buffers
+constexpr size_t MaxNetworkBufferCount = 16;		// the number of buffers we may have if we allocate more when we run out and there is enough free RAM
 #endif
 
 constexpr size_t SsidBufferLength = 32;				// maximum characters in an SSID
@@ -79,24 +79,32 @@ void NetworkResponder::SendData()
 	// If we have a file to send, send it
 	if (fileBeingSent != nullptr && fileBuffer == nullptr)
 	{
-		fileBuffer = NetworkBuffer::Allocate();
+		fileBuffer = NetworkBuffer::Allocate(skt->GetProtocol());
 		if (fileBuffer == nullptr)
 		{
 			return;					// no buffer available, try again later
 		}
 	}
 
-	// If we have a file buffer here, we must be in the process of sending a file
+	// If we have a file buffer here, we must be in the process of sending a file.
+	// We read the file straight into the buffer and the socket may transmit straight from it, so once we have sent some of it we can't refill or release it until the socket has finished with it.
 	while (fileBuffer != nullptr)
 	{
-		if (fileBuffer->IsEmpty() && fileBeingSent != nullptr)
+		if (fileBuffer->IsEmpty())
 		{
-			const int bytesRead = fileBuffer->ReadFromFile(fileBeingSent);
-			if (bytesRead != (int)NetworkBuffer::bufferSize)
+			if (fileBuffer->Length() != 0 && skt->HoldsSentData())
+			{
+				return;					// still waiting for the data to be acknowledged
+			}
+			if (fileBeingSent != nullptr)
 			{
-				// We had a read error or we reached the end of the file
-				fileBeingSent->Close();
-				fileBeingSent = nullptr;
+				const int bytesRead = fileBuffer->ReadFromFile(fileBeingSent);
+				if (bytesRead != (int)NetworkBuffer::bufferSize)
+				{
+					// We had a read error or we reached the end of the file
+					fileBeingSent->Close();
+					fileBeingSent = nullptr;
+				}
 			}
 		}
 
@@ -109,7 +117,7 @@ void NetworkResponder::SendData()
 		else
 		{
 			const size_t remaining = fileBuffer->Remaining();
-			const size_t sent = skt->Send(fileBuffer->UnreadData(), remaining);
+			const size_t sent = skt->SendNoCopy(fileBuffer->UnreadData(), remaining);
 			if (sent == 0)
 			{
 				// Check whether the connection has been closed
@@ -159,10 +167,9 @@ void NetworkResponder::ConnectionLost()
 		fileBeingSent = nullptr;
 	}
 
-	if (fileBuffer != nullptr)
+	while (fileBuffer != nullptr)
 	{
-		fileBuffer->Release();
-		fileBuffer = nullptr;
+		fileBuffer = fileBuffer->Release();
 	}
 
 	if (skt != nullptr)
@@ -28,6 +28,7 @@ public:
 	virtual bool Spin() = 0;							// do some work, returning true if we did anything significant
 	virtual bool Accept(Socket *s, NetworkProtocol protocol) = 0;	// ask the responder to accept this connection, returns true if it did
 	virtual void Terminate(NetworkProtocol protocol, NetworkInterface *interface) = 0;	// terminate the responder if it is serving the specified protocol on the specified interface
+	virtual bool CloseIfIdle(NetworkProtocol protocol) { return false; }	// close a kept-alive connection that has no request in progress, returning true if we did
 	virtual void Diagnostics(MessageType mtype) const = 0;
 
 protected:
@@ -42,6 +43,7 @@ protected:
 		// HTTP responder additional states
 		processingRequest,
 		gettingFileInfo,								// getting file info
+		streamingStatus,								// sending status responses as server-sent events
 
 		// FTP responder additional states
 		waitingForPasvPort,
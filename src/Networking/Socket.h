@@ -42,6 +42,11 @@ public:
 	virtual size_t Send(const uint8_t *data, size_t length) = 0;
 	virtual void Send() = 0;
 
+	// Send data that the caller promises not to change until HoldsSentData returns false, so that the socket may transmit directly from it
+	virtual size_t SendNoCopy(const uint8_t *data, size_t length) { return Send(data, length); }
+	virtual size_t BytesHeld() const { return 0; }				// how many of the most recent bytes passed to SendNoCopy the socket still needs
+	bool HoldsSentData() const { return BytesHeld() != 0; }
+
 protected:
 	enum class SocketState : uint8_t
 	{
@@ -73,7 +73,7 @@ void UploadingNetworkResponder::FinishUpload(uint32_t fileLength, time_t fileLas
 	if (fileLength != 0 && fileBeingUploaded.Length() != fileLength)
 	{
 		uploadError = true;
-		GetPlatform().MessageF(ErrorMessage, "Uploaded file size is different (%lu vs. expected %lu bytes)\n", fileBeingUploaded.Length(), fileLength);
+		GetPlatform().MessageF(ErrorMessage, "Uploaded file size is different (%" PRIuFilePos " vs. expected %" PRIu32 " bytes)\n", fileBeingUploaded.Length(), fileLength);
 	}
 	else if (gotCrc && expectedCrc != fileBeingUploaded.GetCrc32())
 	{
@@ -12,6 +12,7 @@
 #include "RepRap.h"
 #include "RepRapFirmware.h"
 #include "Platform.h"
+#include "Version.h"
 
 #include "MdnsResponder.h"
 #include "W5500Interface.h"
@@ -22,14 +23,111 @@ constexpr size_t DnsHeaderLength = 6 * sizeof(uint16_t);
 constexpr size_t MinMdnsHeaderLength = DnsHeaderLength + 8;	// + extra space for at least one query
 
 constexpr uint16_t MdnsTtl = 120;		// in seconds
+constexpr unsigned int MaxNameJumps = 8;	// the most compression pointers we follow in one name, so that a malformed packet can't make us loop
 
-MdnsResponder::MdnsResponder(W5500Socket *sock) : socket(sock), lastAnnouncement(0)
+constexpr uint16_t DnsTypeA = 1, DnsTypePtr = 12, DnsTypeTxt = 16, DnsTypeSrv = 33, DnsTypeAny = 255;
+constexpr uint16_t DnsClassIn = 1, DnsClassAny = 255;
+
+constexpr const char * MdnsServiceLabels[NumProtocols] = { "_http", "_ftp", "_telnet" };
+constexpr const char * MdnsServiceTypes[NumProtocols] = { "_http._tcp.local", "_ftp._tcp.local", "_telnet._tcp.local" };
+constexpr const char * MdnsTxtRecords[] = { "product=" FIRMWARE_NAME, "version=" VERSION };
+
+MdnsResponder::MdnsResponder(W5500Socket *sock)
+	: socket(sock), lastAnnouncement(0), cachedLength(0), aRecordLength(0), numAnswers(0), cacheOverflowed(false)
 {
 }
 
+// Build the response packet. It holds the A record for <hostname>.local followed by PTR, SRV and TXT records for each enabled protocol.
+// Names are compressed by pointing back to the copies earlier in the packet, which keeps the packet small enough for one buffer.
 void MdnsResponder::UpdateServiceRecords()
 {
-	// TODO
+	const W5500Interface * const iface = static_cast<const W5500Interface*>(socket->GetInterface());
+	const char * const hostname = reprap.GetNetwork().GetHostname();
+
+	cachedLength = 0;
+	cacheOverflowed = false;
+
+	// Write DNS header. The transaction ID and the answer count are patched when we send it.
+	PutU16(0);											// Transaction
+	PutU16(0x8400);										// Standard response
+	PutU16(0);											// No questions
+	PutU16(0);											// Answers
+	PutU16(0);											// No authority RRs
+	PutU16(0);											// No additional RRs
+
+	// Write A record
+	const size_t hostnameOffset = cachedLength;
+	PutString(hostname);
+	const size_t localOffset = cachedLength;
+	PutString("local");
+	PutByte(0);
+	PutRecordHeader(DnsTypeA, true, 4);
+	if (cachedLength + 4 <= MaxCachedPacketLength)
+	{
+		iface->GetIPAddress().UnpackV4(cachedPacket + cachedLength);
+	}
+	cachedLength += 4;
+	aRecordLength = cachedLength;
+	numAnswers = 1;
+
+	// Write the service records
+	size_t tcpOffset = 0;
+	size_t txtLength = 0;
+	for (const char *txt : MdnsTxtRecords)
+	{
+		txtLength += strlen(txt) + 1;
+	}
+
+	for (size_t protocol = 0; protocol < NumProtocols; ++protocol)
+	{
+		if (!iface->IsProtocolEnabled(protocol))
+		{
+			continue;
+		}
+
+		// PTR record from the service type to our instance of it
+		const size_t serviceTypeOffset = cachedLength;
+		PutString(MdnsServiceLabels[protocol]);
+		if (tcpOffset == 0)
+		{
+			tcpOffset = cachedLength;
+			PutString("_tcp");
+			PutPointer(localOffset);
+		}
+		else
+		{
+			PutPointer(tcpOffset);
+		}
+		PutRecordHeader(DnsTypePtr, false, strlen(hostname) + 3);
+		const size_t instanceOffset = cachedLength;
+		PutString(hostname);
+		PutPointer(serviceTypeOffset);
+
+		// SRV record giving the port and the host
+		PutPointer(instanceOffset);
+		PutRecordHeader(DnsTypeSrv, true, 8);
+		PutU16(0);										// Priority
+		PutU16(0);										// Weight
+		PutU16(iface->GetPortNumber(protocol));
+		PutPointer(hostnameOffset);
+
+		// TXT record
+		PutPointer(instanceOffset);
+		PutRecordHeader(DnsTypeTxt, true, txtLength);
+		for (const char *txt : MdnsTxtRecords)
+		{
+			PutString(txt);
+		}
+
+		numAnswers += 3;
+	}
+
+	if (cacheOverflowed)
+	{
+		// Fall back to just the A record, which always fits
+		cachedLength = aRecordLength;
+		numAnswers = 1;
+	}
 }
 
 void MdnsResponder::Spin()
@@ -54,228 +152,211 @@ void MdnsResponder::Spin()
 	}
 }
 
-void MdnsResponder::ProcessPacket(const uint8_t *packet, size_t length) const
+// Work out which of our names the queries in a packet ask for, then send the cached answers.
+// We send all the service records if any of them is asked for, because that is no more work than sending the ones that were asked for.
+void MdnsResponder::ProcessPacket(const uint8_t *packet, size_t length)
 {
-	size_t bytesProcessed = 0;
+	if (aRecordLength == 0)
+	{
+		return;											// we haven't got an IP address yet
+	}
 
-	// Try to read the DNS header
-	const uint16_t transaction = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed));
-	bytesProcessed += sizeof(uint16_t);
-	const uint16_t headerFlags = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed));
-	bytesProcessed += sizeof(uint16_t);
-	const uint16_t numQueries = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed));
-	bytesProcessed += DnsHeaderLength - 2 * sizeof(uint16_t);
+	// Read the DNS header
+	const uint16_t transaction = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet));
+	const uint16_t headerFlags = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + sizeof(uint16_t)));
+	const uint16_t numQueries = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + 2 * sizeof(uint16_t)));
+	if ((headerFlags & 0x8000) != 0)
+	{
+		return;											// it's a response, not a query
+	}
 
-	if (headerFlags == 0)		// Query
+	const W5500Interface * const iface = static_cast<const W5500Interface*>(socket->GetInterface());
+	bool wantA = false, wantServices = false;
+	size_t bytesProcessed = DnsHeaderLength;
+	for (uint16_t query = 0; query < numQueries; query++)
 	{
-		for (uint16_t query = 0; query < numQueries; query++)
+		char name[MaxQueryNameLength];
+		bytesProcessed = ReadName(packet, length, bytesProcessed, name, ARRAY_SIZE(name));
+		if (bytesProcessed == 0 || bytesProcessed + 2 * sizeof(uint16_t) > length)
 		{
-			bool nameMatches = false;
-			if (packet[bytesProcessed] == 0xC0)
-			{
-				// Deal with name compression
-				bytesProcessed++;
-				uint8_t offset = packet[bytesProcessed++];
-				if (offset < length)
-				{
-					// Check if the compressed name matches
-					nameMatches = CheckHostname(packet + offset, length - offset, nullptr);
-				}
-				else
-				{
-					//debugPrintf("mDNS compressed name overflow\n");
-					break;
-				}
-			}
-			else
-			{
-				// Deal with regular names
-				if (bytesProcessed < length)
-				{
-					// Check if the regular name matches
-					nameMatches = CheckHostname(packet + bytesProcessed, length - bytesProcessed, &bytesProcessed);
-				}
-				else
-				{
-					//debugPrintf("mDNS regular name overflow\n");
-					break;
-				}
-			}
+			//debugPrintf("mDNS query overflow\n");
+			break;
+		}
 
-			// Check query type and class
-			if (bytesProcessed + 2 * sizeof(uint16_t) <= length)
+		// Check query type and class
+		const uint16_t type = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed));
+		bytesProcessed += sizeof(uint16_t);
+		const uint16_t qclass = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed)) & 0x7FFF;	// ignore the unicast response bit
+		bytesProcessed += sizeof(uint16_t);
+		if (qclass != DnsClassIn && qclass != DnsClassAny)
+		{
+			continue;
+		}
+
+		const char * const afterHostname = MatchHostname(name);
+		for (size_t protocol = 0; protocol < NumProtocols; ++protocol)
+		{
+			if (iface->IsProtocolEnabled(protocol))
 			{
-				const uint16_t type = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed));
-				bytesProcessed += sizeof(uint16_t);
-				const uint16_t flags = __builtin_bswap16(*reinterpret_cast<const uint16_t*>(packet + bytesProcessed));
-				bytesProcessed += sizeof(uint16_t);
-				if (flags == 1 && type == 1 && nameMatches)		// Class IN, A record
+				if (   ((type == DnsTypePtr || type == DnsTypeAny) && StringEqualsIgnoreCase(name, MdnsServiceTypes[protocol]))
+					|| ((type == DnsTypeSrv || type == DnsTypeTxt || type == DnsTypeAny) && afterHostname != nullptr && StringEqualsIgnoreCase(afterHostname, MdnsServiceTypes[protocol]))
+				   )
 				{
-					SendARecord(transaction);
+					wantServices = true;
 				}
 			}
-			else
-			{
-				//debugPrintf("mDNS query flags overflow\n");
-				break;
-			}
+		}
+		if ((type == DnsTypeA || type == DnsTypeAny) && afterHostname != nullptr && StringEqualsIgnoreCase(afterHostname, "local"))
+		{
+			wantA = true;
 		}
 	}
-	else
+
+	if (wantServices || wantA)
 	{
-		//debugPrintf("Unknown mDNS query\n");
+		SendCachedPacket(transaction, wantServices);
 	}
 }
 
-bool MdnsResponder::CheckHostname(const uint8_t *ptr, size_t maxLength, size_t *bytesProcessed) const
+// If a name starts with our hostname followed by a dot then return the rest of it, else return nullptr
+const char *MdnsResponder::MatchHostname(const char *name) const
 {
-	const uint8_t *originalPtr = ptr;
 	const char *hostname = reprap.GetNetwork().GetHostname();
-	bool nameMatches = true;
-
-	// Check the hostname
-	const uint8_t nameLength = *ptr++;
-	if (nameLength < maxLength)
+	while (*hostname != 0)
 	{
-		if (nameLength == strlen(hostname))
-		{
-			for (unsigned int i = 0; i < nameLength; i++)
-			{
-				if (tolower(hostname[i]) != tolower(*ptr++))
-				{
-					nameMatches = false;
-				}
-			}
-		}
-		else
+		if (tolower(*hostname++) != tolower(*name++))
 		{
-			nameMatches = false;
-			ptr += nameLength;
+			return nullptr;
 		}
 	}
-	else
+	return (*name == '.') ? name + 1 : nullptr;
+}
+
+// Read a possibly compressed name from a packet into 'name' as a dot-separated string and return the offset of the first byte after it, or 0 if the name is malformed.
+// If the name doesn't fit in the buffer then we return it as an empty string, which doesn't match any of our names.
+/*static*/ size_t MdnsResponder::ReadName(const uint8_t *packet, size_t length, size_t offset, char *name, size_t maxNameLength)
+{
+	size_t nameLength = 0, endOffset = 0;
+	bool truncated = false;
+	unsigned int jumps = 0;
+	for (;;)
 	{
-		//debugPrintf("mDNS name overflow\n");
-		if (bytesProcessed != nullptr)
+		if (offset >= length)
 		{
-			bytesProcessed += maxLength;
+			return 0;
 		}
-		return false;
-	}
-
-	// Check the domain name
-	const uint8_t domainLength = *ptr++;
-	if (ptr + domainLength < originalPtr + maxLength)
-	{
-		if (nameMatches && domainLength == 5)
+		const uint8_t labelLength = packet[offset];
+		if (labelLength == 0)
 		{
-			const char *domainName = reinterpret_cast<const char *>(ptr);
-			nameMatches = strncmp(domainName, "local", 5) == 0;
+			if (endOffset == 0)
+			{
+				endOffset = offset + 1;
+			}
+			break;
 		}
-		else
+		if ((labelLength & 0xC0) == 0xC0)
 		{
-			nameMatches = false;
+			// Deal with name compression
+			if (offset + 1 >= length || ++jumps > MaxNameJumps)
+			{
+				return 0;
+			}
+			if (endOffset == 0)
+			{
+				endOffset = offset + 2;
+			}
+			offset = ((labelLength & 0x3F) << 8) | packet[offset + 1];
+			continue;
 		}
-		ptr += domainLength;
-	}
-	else
-	{
-		//debugPrintf("mDNS query domain overflow\n");
-		if (bytesProcessed != nullptr)
+		if ((labelLength & 0xC0) != 0 || offset + 1 + labelLength > length)
 		{
-			bytesProcessed += maxLength;
+			return 0;
 		}
-		return false;
-	}
 
-	// Check for terminating zero
-	if (ptr < originalPtr + maxLength)
-	{
-		if (*ptr++ != 0)
+		if (nameLength + labelLength + 2 > maxNameLength)
+		{
+			truncated = true;
+		}
+		else if (!truncated)
 		{
-			//debugPrintf("mDNS FQDN not terminated\n");
-			if (bytesProcessed != nullptr)
+			if (nameLength != 0)
 			{
-				bytesProcessed += maxLength;
+				name[nameLength++] = '.';
 			}
-			return false;
+			memcpy(name + nameLength, packet + offset + 1, labelLength);
+			nameLength += labelLength;
 		}
+		offset += labelLength + 1;
 	}
-	else
+
+	name[(truncated) ? 0 : nameLength] = 0;
+	return endOffset;
+}
+
+// Send the cached response, or just the part of it up to the end of the A record
+void MdnsResponder::SendCachedPacket(uint16_t transaction, bool withServices)
+{
+	if (!socket->CanSend())
 	{
-		//debugPrintf("mDNS FQDN overflow\n");
-		if (bytesProcessed != nullptr)
-		{
-			bytesProcessed += maxLength;
-		}
-		return false;
+		return;
 	}
 
-	// End
-	if (bytesProcessed != nullptr)
+	*reinterpret_cast<uint16_t*>(cachedPacket) = __builtin_bswap16(transaction);
+	*reinterpret_cast<uint16_t*>(cachedPacket + 3 * sizeof(uint16_t)) = __builtin_bswap16((withServices) ? numAnswers : 1);
+
+	// Send it to the mDNS address
+	socket->Send(cachedPacket, (withServices) ? cachedLength : aRecordLength);
+	socket->Send();
+}
+
+void MdnsResponder::PutByte(uint8_t b)
+{
+	if (cachedLength < MaxCachedPacketLength)
 	{
-		*bytesProcessed += ptr - originalPtr;
+		cachedPacket[cachedLength] = b;
 	}
-	return nameMatches;
+	else
+	{
+		cacheOverflowed = true;
+	}
+	++cachedLength;
 }
 
-void MdnsResponder::SendARecord(uint16_t transaction) const
+void MdnsResponder::PutU16(uint16_t val)
 {
-	uint8_t buffer[256];
-	size_t bytesWritten = 0;
-
-	memset(buffer, 0, ARRAY_SIZE(buffer));
-
-	// Write DNS header
-	*reinterpret_cast<uint16_t*>(buffer) = transaction;
-	bytesWritten += sizeof(uint16_t);
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = __builtin_bswap16(0x8400);	// Standard response
-	bytesWritten += sizeof(uint16_t);
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = 0;							// No questions
-	bytesWritten += sizeof(uint16_t);
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = __builtin_bswap16(1);			// One answer
-	bytesWritten += sizeof(uint16_t);
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = 0;							// No authority RRs
-	bytesWritten += sizeof(uint16_t);
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = 0;							// No additional RRs
-	bytesWritten += sizeof(uint16_t);
-
-	// Write A record and start with the hostname
-	const char *hostname = reprap.GetNetwork().GetHostname();
-	size_t hostnameLength = strlen(hostname);
-	buffer[bytesWritten++] = hostnameLength;
-	strncpy(reinterpret_cast<char *>(buffer + bytesWritten), hostname, ARRAY_SIZE(buffer) - bytesWritten);
-	bytesWritten += hostnameLength;
-
-	// Write domain
-	buffer[bytesWritten++] = 5;
-	strncpy(reinterpret_cast<char *>(buffer + bytesWritten), "local", ARRAY_SIZE(buffer) - bytesWritten);
-	bytesWritten += 5;
-
-	// Write terminating zero
-	buffer[bytesWritten++] = 0;
-
-	// Write flags
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = __builtin_bswap16(0x01);		// A record
-	bytesWritten += sizeof(uint16_t);
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = __builtin_bswap16(0x8001);	// Class IN, Cache Flush
-	bytesWritten += sizeof(uint16_t);
+	PutByte(val >> 8);
+	PutByte(val & 0xFF);
+}
 
-	// Write TTL
-	*reinterpret_cast<uint32_t*>(buffer + bytesWritten) = __builtin_bswap32(MdnsTtl);
-	bytesWritten += sizeof(uint32_t);
+void MdnsResponder::PutU32(uint32_t val)
+{
+	PutU16(val >> 16);
+	PutU16(val & 0xFFFF);
+}
 
-	// Write data length
-	*reinterpret_cast<uint16_t*>(buffer + bytesWritten) = __builtin_bswap16(4);			// 4 Bytes (IPv4)
-	bytesWritten += sizeof(uint16_t);
+// Write a label or a TXT string, preceded by its length
+void MdnsResponder::PutString(const char *str)
+{
+	const size_t len = strlen(str);
+	PutByte(len);
+	while (*str != 0)
+	{
+		PutByte(*str++);
+	}
+}
 
-	// Write IPv4 address
-	socket->GetInterface()->GetIPAddress().UnpackV4(buffer + bytesWritten);
-	bytesWritten += 4;
+// Write a compression pointer to a name earlier in the packet
+void MdnsResponder::PutPointer(size_t offset)
+{
+	PutU16(0xC000 | offset);
+}
 
-	// Send it to the mDNS address
-	socket->Send(buffer, bytesWritten);
-	socket->Send();
+void MdnsResponder::PutRecordHeader(uint16_t type, bool cacheFlush, uint16_t dataLength)
+{
+	PutU16(type);
+	PutU16((cacheFlush) ? 0x8001 : 0x0001);				// Class IN, optionally with Cache Flush
+	PutU32(MdnsTtl);
+	PutU16(dataLength);
 }
 
 void MdnsResponder::Announce()
@@ -285,6 +366,12 @@ void MdnsResponder::Announce()
 		return;
 	}
 
-	SendARecord(0);
+	if (aRecordLength == 0)
+	{
+		UpdateServiceRecords();
+	}
+	SendCachedPacket(0, true);
 	lastAnnouncement = millis();
 }
+
+// End
@@ -19,21 +19,41 @@
 
 class W5500Socket;
 
+// Class to answer mDNS queries for our hostname and the DNS-SD services we provide.
+// The answers only change when the hostname, IP address or enabled protocols change, so we build the response packet when they do and send it from the cache.
 class MdnsResponder {
 public:
 	MdnsResponder(W5500Socket *sock);
 
-	void UpdateServiceRecords();
+	void UpdateServiceRecords();					// rebuild the cached response, called when the hostname, IP address or protocols change
 	void Spin();
 	void Announce();
 
 private:
+	static constexpr size_t MaxCachedPacketLength = 512;
+	static constexpr size_t MaxQueryNameLength = 64;
+
 	W5500Socket *socket;
 	uint32_t lastAnnouncement;
 
-	void ProcessPacket(const uint8_t *data, size_t length) const;
-	bool CheckHostname(const uint8_t *ptr, size_t maxLength, size_t *bytesProcessed) const;
-	void SendARecord(uint16_t transaction) const;
+	// The cached response. It starts with the A record, so we can send just that by sending the start of the packet with the answer count patched.
+	uint8_t cachedPacket[MaxCachedPacketLength];
+	size_t cachedLength;							// the length of the whole response including the service records
+	size_t aRecordLength;							// the length of the response up to the end of the A record, or 0 if the cache hasn't been built
+	uint16_t numAnswers;							// the number of answers in the whole response
+	bool cacheOverflowed;
+
+	void ProcessPacket(const uint8_t *data, size_t length);
+	void SendCachedPacket(uint16_t transaction, bool withServices);
+	const char *MatchHostname(const char *name) const;
+	static size_t ReadName(const uint8_t *packet, size_t length, size_t offset, char *name, size_t maxNameLength);
+
+	void PutByte(uint8_t b);
+	void PutU16(uint16_t val);
+	void PutU32(uint32_t val);
+	void PutString(const char *str);
+	void PutPointer(size_t offset);
+	void PutRecordHeader(uint16_t type, bool cacheFlush, uint16_t dataLength);
 };
 
 #endif /* SRC_NETWORKING_W5500ETHERNET_MDNSRESPONDER_H_ */
@@ -18,8 +18,10 @@
 #include "MdnsResponder.h"
 #include "General/IP4String.h"
 
+constexpr uint32_t FullPollInterval = 100;			// how often in milliseconds we poll all the sockets in case we missed a W5500 interrupt
+
 W5500Interface::W5500Interface(Platform& p)
-	: platform(p), lastTickMillis(0), ftpDataSocket(0), state(NetworkState::disabled), activated(false)
+	: platform(p), lastTickMillis(0), lastFullPollMillis(0), ftpDataSocket(0), state(NetworkState::disabled), activated(false)
 {
 	// Create the sockets
 	for (W5500Socket*& skt : sockets)
@@ -46,7 +48,7 @@ W5500Interface::W5500Interface(Platform& p)
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(W5500Interface, _ret)
 
-const ObjectModelTableEntry W5500Interface::objectModelTable[] =
+constexpr ObjectModelTableEntry W5500Interface::objectModelTable[] =
 {
 	// These entries must be in alphabetical order
 	{ "gateway", OBJECT_MODEL_FUNC(&(self->gateway)), TYPE_OF(IPAddress), ObjectModelTableEntry::none },
@@ -65,6 +67,7 @@ void W5500Interface::Init()
 
 	// Ensure that the W5500 chip is in the reset state
 	pinMode(W5500ResetPin, OUTPUT_LOW);
+	pinMode(W5500InterruptPin, INPUT_PULLUP);
 	lastTickMillis = millis();
 
 	SetIPAddress(DefaultIpAddress, DefaultNetMask, DefaultGateway);
@@ -99,6 +102,7 @@ GCodeResult W5500Interface::EnableProtocol(NetworkProtocol protocol, int port, i
 				ResetSockets();
 				if (state == NetworkState::active)
 				{
+					mdnsResponder->UpdateServiceRecords();
 					mdnsResponder->Announce();
 				}
 			}
@@ -111,7 +115,7 @@ GCodeResult W5500Interface::EnableProtocol(NetworkProtocol protocol, int port, i
 	return GCodeResult::error;
 }
 
-bool W5500Interface::IsProtocolEnabled(NetworkProtocol protocol)
+bool W5500Interface::IsProtocolEnabled(NetworkProtocol protocol) const
 {
 	return (protocol < NumProtocols) ? protocolEnabled[protocol] : false;
 }
@@ -127,6 +131,11 @@ GCodeResult W5500Interface::DisableProtocol(NetworkProtocol protocol, const Stri
 			ResetSockets();
 		}
 		protocolEnabled[protocol] = false;
+		if (state == NetworkState::active)
+		{
+			mdnsResponder->UpdateServiceRecords();
+			mdnsResponder->Announce();
+		}
 		ReportOneProtocol(protocol, reply);
 		return GCodeResult::ok;
 	}
@@ -226,6 +235,9 @@ void W5500Interface::Start()
 	setGAR(gateway);
 	setSUBR(netmask);
 
+	// Enable interrupts from the TCP sockets and the mDNS socket, so that we only need to poll the sockets that have something to do
+	setSIMR(((1u << NumW5500TcpSockets) - 1) | (1u << MdnsSocketNumber));
+
 	setPHYCFGR(PHYCFGR_OPMD | PHYCFGR_OPMDC_ALLA | ~PHYCFGR_RST);	// remove the reset
 
 	state = NetworkState::establishingLink;
@@ -318,6 +330,7 @@ void W5500Interface::Spin(bool full)
 		{
 			InitSockets();
 			platform.MessageF(NetworkInfoMessage, "Network running, IP address = %s\n", IP4String(ipAddress).c_str());
+			mdnsResponder->UpdateServiceRecords();
 			mdnsResponder->Announce();
 			state = NetworkState::active;
 		}
@@ -344,25 +357,36 @@ void W5500Interface::Spin(bool full)
 					{
 //						debugPrintf("IP address changed\n");
 						getSIPR(ipAddress);
+						mdnsResponder->UpdateServiceRecords();
 						mdnsResponder->Announce();
 					}
 				}
 
-				// Poll the next TCP socket
-				sockets[nextSocketToPoll]->Poll(full);
+				// Poll the next TCP socket that has something to do. Sockets that are listening with no client only need to be polled when the W5500 flags an event for them.
+				const uint8_t events = GetSocketEvents();
+				for (size_t i = 0; i < NumW5500TcpSockets; ++i)
+				{
+					const size_t skt = nextSocketToPoll;
+					++nextSocketToPoll;
+					if (nextSocketToPoll == NumW5500TcpSockets)
+					{
+						nextSocketToPoll = 0;
+					}
+					if (sockets[skt]->NeedsPolling() || (events & (1u << skt)) != 0)
+					{
+						sockets[skt]->Poll(full);
+						break;
+					}
+				}
 
 				// Keep mDNS alive
-				mdnsSocket->Poll(full);
-				if (full)
+				if ((events & (1u << MdnsSocketNumber)) != 0)
 				{
-					mdnsResponder->Spin();
+					mdnsSocket->Poll(full);
 				}
-
-				// Move on to the next TCP socket for next time
-				++nextSocketToPoll;
-				if (nextSocketToPoll == NumW5500TcpSockets)
+				if (full)
 				{
-					nextSocketToPoll = 0;
+					mdnsResponder->Spin();
 				}
 			}
 			else if (full)
@@ -423,6 +447,7 @@ int W5500Interface::EnableState() const
 
 void W5500Interface::UpdateHostname(const char *name) /*override*/
 {
+	mdnsResponder->UpdateServiceRecords();
 	mdnsResponder->Announce();
 }
 
@@ -453,6 +478,19 @@ void W5500Interface::InitSockets()
 }
 
 // Note, the following is called to initialise the sockets as well as to reset them. Therefore it must work with sockets that have never been initialised.
+// Return a bitmap of the sockets that the W5500 has flagged as having events. Reading the interrupt pin is much cheaper than reading the socket registers over SPI.
+// Every so often we report all sockets as having events, so that the round robin still visits idle sockets in case we missed an event.
+uint8_t W5500Interface::GetSocketEvents()
+{
+	const uint32_t now = millis();
+	if (now - lastFullPollMillis >= FullPollInterval)
+	{
+		lastFullPollMillis = now;
+		return 0xFF;
+	}
+	return (digitalRead(W5500InterruptPin)) ? 0 : getSIR();
+}
+
 void W5500Interface::ResetSockets()
 {
 	// See how many sockets are available
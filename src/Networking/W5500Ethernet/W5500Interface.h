@@ -42,7 +42,8 @@ public:
 
 	GCodeResult EnableInterface(int mode, const StringRef& ssid, const StringRef& reply) override;			// enable or disable the network
 	GCodeResult EnableProtocol(NetworkProtocol protocol, int port, int secure, const StringRef& reply) override;
-	bool IsProtocolEnabled(NetworkProtocol protocol);
+	bool IsProtocolEnabled(NetworkProtocol protocol) const;
+	Port GetPortNumber(NetworkProtocol protocol) const { return portNumbers[protocol]; }
 	GCodeResult DisableProtocol(NetworkProtocol protocol, const StringRef& reply) override;
 	GCodeResult ReportProtocols(const StringRef& reply) const override;
 
@@ -79,12 +80,14 @@ private:
 	void InitSockets();
 	void ResetSockets();
 	void TerminateSockets();
+	uint8_t GetSocketEvents();
 
 	void ReportOneProtocol(NetworkProtocol protocol, const StringRef& reply) const
 	pre(protocol < NumProtocols);
 
 	Platform& platform;
 	uint32_t lastTickMillis;
+	uint32_t lastFullPollMillis;					// when we last polled all the sockets regardless of the W5500 interrupt output
 
 	W5500Socket *sockets[NumW5500TcpSockets];
 	size_t ftpDataSocket;							// number of the port for FTP DATA connections
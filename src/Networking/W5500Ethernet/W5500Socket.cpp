@@ -57,6 +57,7 @@ void W5500Socket::ReInit()
 	persistConnection = true;
 	isTerminated = false;
 	isSending = false;
+	isIdle = false;
 
 	// Re-initialise the socket on the W5500
 	if (protocol != MdnsProtocol)
@@ -77,6 +78,10 @@ void W5500Socket::ReInit()
 
 		socket(socketNum, Sn_MR_UDP, MdnsPort, SF_MULTI_ENABLE);
 	}
+
+	// Have the W5500 assert its interrupt output when a client connects or disconnects or data arrives.
+	// We don't enable the SENDOK and TIMEOUT interrupts because Send polls for those.
+	setSn_IMR(socketNum, Sn_IR_CON | Sn_IR_DISCON | Sn_IR_RECV);
 }
 
 // Close a connection when the last packet has been sent
@@ -178,6 +183,14 @@ void W5500Socket::Poll(bool full)
 	{
 		MutexLocker lock(interface->interfaceMutex);
 
+		// Clear the receive and disconnect interrupts so that the W5500 releases its interrupt output. We are about to deal with the events anyway.
+		const uint8_t interrupts = getSn_IR(socketNum);
+		if (interrupts & (Sn_IR_RECV | Sn_IR_DISCON))
+		{
+			setSn_IR(socketNum, interrupts & (Sn_IR_RECV | Sn_IR_DISCON));
+		}
+
+		isIdle = false;
 		switch(getSn_SR(socketNum))
 		{
 		case SOCK_INIT:					// Socket has been initialised but is not listening yet
@@ -193,10 +206,11 @@ void W5500Socket::Poll(bool full)
 			break;
 
 		case SOCK_LISTEN:				// Socket is listening but no client has connected to it yet
+			isIdle = true;				// nothing more to do until the W5500 flags a connection
 			break;
 
 		case SOCK_ESTABLISHED:			// A client is connected to this socket
-			if (getSn_IR(socketNum) & Sn_IR_CON)
+			if (interrupts & Sn_IR_CON)
 			{
 				// New connection, so retrieve the sending IP address and port, and clear the interrupt
 				getSn_DIPR(socketNum, remoteIPAddress);
@@ -269,7 +283,7 @@ void W5500Socket::ReceiveData()
 		}
 		else if (NetworkBuffer::Count(receivedData) < MaxBuffersPerSocket)
 		{
-			NetworkBuffer * const buf = NetworkBuffer::Allocate();
+			NetworkBuffer * const buf = NetworkBuffer::Allocate(protocol);
 			if (buf != nullptr)
 			{
 				wiz_recv_data(socketNum, buf->Data(), len);
@@ -31,6 +31,8 @@ public:
 	size_t Send(const uint8_t *data, size_t length) override;
 	void Send() override;
 
+	bool NeedsPolling() const { return !isIdle; }		// true if the socket may have work to do even if the W5500 hasn't flagged an event for it
+
 private:
 	void ReInit();
 	void ReceiveData();
@@ -43,6 +45,7 @@ private:
 	SocketNumber socketNum;								// The W5500 socket number we are using
 	bool sendOutstanding;								// True if we have written data to the socket but not flushed it
 	bool isSending;										// True if we have written data to the W5500 to send and have not yet seen success or timeout
+	bool isIdle;										// True if the socket was listening with no client when we last polled it
 	uint16_t wizTxBufferPtr;							// Current offset into the Wizchip send buffer, if sendOutstanding is true
 	uint16_t wizTxBufferLeft;							// Transmit buffer space left, if sendOutstanding is true
 };
@@ -10,37 +10,83 @@
 #if SUPPORT_OBJECT_MODEL
 
 #include "OutputMemory.h"
+#include "Storage/CRC32.h"
 #include <cstring>
 #include <General/SafeStrtod.h>
 
+uint32_t ObjectModel::changeSequence = 0;
+
 // Constructor
-ObjectModel::ObjectModel()
+ObjectModel::ObjectModel() : changeRecords(nullptr)
 {
 }
 
 // Report this object
-bool ObjectModel::ReportAsJson(OutputBuffer* buf, const char* filter, ReportFlags flags)
+bool ObjectModel::ReportAsJson(OutputBuffer* buf, const char* filter, ReportFlags flags, uint32_t since)
 {
 	buf->cat('{');
 	size_t numEntries;
-	const ObjectModelTableEntry *omte = GetObjectModelTable(numEntries);
+	const ObjectModelTableEntry * const table = GetObjectModelTable(numEntries);
+	if (since != ReportAll && changeRecords == nullptr)
+	{
+		changeRecords = new ChangeRecord[numEntries]();		// sequence numbers start at zero, so every entry is treated as changed the first time
+	}
+
 	bool added = false;
-	while (numEntries != 0)
+	for (size_t i = 0; i < numEntries; ++i)
 	{
+		const ObjectModelTableEntry * const omte = &table[i];
 		if (omte->Matches(filter, flags))
 		{
-			if (added)
+			OutputBuffer *entryBuf;
+			if (since == ReportAll || !OutputBuffer::Allocate(entryBuf))
 			{
-				buf->cat(',');
+				// We are reporting everything, or we can't get a buffer to try the entry in, so report it regardless
+				if (added)
+				{
+					buf->cat(',');
+				}
+				omte->ReportAsJson(buf, this, GetNextElement(filter), flags, since);
+				added = true;
+				continue;
+			}
+
+			// Report the entry into a separate buffer so that we can discard it if it hasn't changed
+			bool changed = omte->ReportAsJson(entryBuf, this, GetNextElement(filter), flags, since);
+			if (omte->type != TYPE_OF(ObjectModel))
+			{
+				// Nested objects keep their own change records, so we only need to check leaf values and arrays here
+				CRC32 crc;
+				for (const OutputBuffer *b = entryBuf; b != nullptr; b = b->Next())
+				{
+					crc.Update(b->Data(), b->DataLength());
+				}
+				ChangeRecord& cr = changeRecords[i];
+				if (cr.sequence == 0 || cr.hash != crc.Get())
+				{
+					cr.hash = crc.Get();
+					cr.sequence = ++changeSequence;
+				}
+				changed = (cr.sequence > since);
+			}
+
+			if (changed)
+			{
+				if (added)
+				{
+					buf->cat(',');
+				}
+				buf->Append(entryBuf);
+				added = true;
+			}
+			else
+			{
+				OutputBuffer::ReleaseAll(entryBuf);
 			}
-			omte->ReportAsJson(buf, this, GetNextElement(filter), flags);
-			added = true;
 		}
-		--numEntries;
-		++omte;
 	}
 	buf->cat('}');
-	return true;
+	return added;
 }
 
 // Find the requested entry
@@ -87,14 +133,13 @@ bool ObjectModelTableEntry::Matches(const char* filterString, ObjectModelFilterF
 	return IdCompare(filterString) == 0 && (flags & filterFlags) == filterFlags;
 }
 
-// Private function to report a value of primitive type
-void ObjectModelTableEntry::ReportItemAsJson(OutputBuffer *buf, const char *filter, ObjectModel::ReportFlags flags, void *nParam, TypeCode type)
+// Private function to report a value of primitive type. Return false if it was a nested object and we were asked for changes only and there were none.
+bool ObjectModelTableEntry::ReportItemAsJson(OutputBuffer *buf, const char *filter, ObjectModel::ReportFlags flags, void *nParam, TypeCode type, uint32_t since)
 {
 	switch (type)
 	{
 	case TYPE_OF(ObjectModel):
-		((ObjectModel*)nParam)->ReportAsJson(buf, filter, flags);
-		break;
+		return ((ObjectModel*)nParam)->ReportAsJson(buf, filter, flags, since) || since == ObjectModel::ReportAll;
 
 	case TYPE_OF(float):
 		buf->catf("%.1f", (double)*(const float *)nParam);
@@ -179,10 +224,11 @@ void ObjectModelTableEntry::ReportItemAsJson(OutputBuffer *buf, const char *filt
 		}
 		break;
 	}
+	return true;
 }
 
 // Add the value of this element to the buffer, returning true if it matched and we did
-bool ObjectModelTableEntry::ReportAsJson(OutputBuffer* buf, ObjectModel *self, const char* filter, ObjectModel::ReportFlags flags) const
+bool ObjectModelTableEntry::ReportAsJson(OutputBuffer* buf, ObjectModel *self, const char* filter, ObjectModel::ReportFlags flags, uint32_t since) const
 {
 	buf->cat(name);
 	buf->cat(':');
@@ -198,15 +244,13 @@ bool ObjectModelTableEntry::ReportAsJson(OutputBuffer* buf, ObjectModel *self, c
 			{
 				buf->cat(',');
 			}
-			ReportItemAsJson(buf, filter, flags, arr->GetElement(self, i), type & ~IsArray);
+			ReportItemAsJson(buf, filter, flags, arr->GetElement(self, i), type & ~IsArray, ObjectModel::ReportAll);		// arrays are tracked as a whole
 		}
 		buf->cat(']');
+		return true;
 	}
-	else
-	{
-		ReportItemAsJson(buf, filter, flags, param(self), type);
-	}
-	return true;
+
+	return ReportItemAsJson(buf, filter, flags, param(self), type, since);
 }
 
 // Compare an ID with the name of this object
@@ -267,11 +311,14 @@ TypeCode ObjectModel::GetObjectValue(ExpressionValue& val, const char *idString)
 		param = arr->GetElement(this, val);		// fetch the pointer to the array element
 	}
 
+	return (tc == TYPE_OF(ObjectModel)) ? ((ObjectModel*)param)->GetObjectValue(val, idString) : GetPrimitiveValue(val, param, tc);
+}
+
+// Fetch a value of primitive type given the pointer that a table entry yielded for it
+/*static*/ TypeCode ObjectModel::GetPrimitiveValue(ExpressionValue& val, const void *param, TypeCode tc)
+{
 	switch (tc)
 	{
-	case TYPE_OF(ObjectModel):
-		return ((ObjectModel*)param)->GetObjectValue(val, idString);
-
 	case TYPE_OF(float):
 	case TYPE_OF(Float2):
 	case TYPE_OF(Float3):
@@ -306,6 +353,181 @@ TypeCode ObjectModel::GetObjectValue(ExpressionValue& val, const char *idString)
 	return tc;
 }
 
+// Match a filter against the object model.
+// We count the matching entries first so that we can allocate exactly the right number of nodes.
+void ObjectModelSubscription::Compile(ObjectModel *root, const char *name, const char *p_filter, ObjectModel::ReportFlags flags)
+{
+	Clear();
+	SafeStrncpy(subscriptionName, name, ARRAY_SIZE(subscriptionName));
+	const size_t filterLength = strlen(p_filter);
+	filter = new char[filterLength + 1];
+	memcpy(filter, p_filter, filterLength + 1);
+
+	numNodes = AddNodes(root, filter, flags, 0);
+	if (numNodes != 0)
+	{
+		nodes = new Node[numNodes];
+		(void)AddNodes(root, filter, flags, 0);
+	}
+}
+
+void ObjectModelSubscription::Clear()
+{
+	delete[] nodes;
+	nodes = nullptr;
+	numNodes = 0;
+	delete[] filter;
+	filter = nullptr;
+}
+
+// Add the nodes for the entries of an object that match the filter, starting at the specified index, and return the index after the last one.
+// If we haven't allocated the nodes yet, just count them.
+size_t ObjectModelSubscription::AddNodes(ObjectModel *obj, const char *p_filter, ObjectModel::ReportFlags flags, size_t index)
+{
+	size_t numEntries;
+	const ObjectModelTableEntry * const table = obj->GetObjectModelTable(numEntries);
+	const char * const nextFilter = ObjectModel::GetNextElement(p_filter);
+	for (size_t i = 0; i < numEntries; ++i)
+	{
+		const ObjectModelTableEntry * const omte = &table[i];
+		if (omte->Matches(p_filter, flags))
+		{
+			const size_t nodeIndex = index++;
+			if (omte->type == TYPE_OF(ObjectModel))
+			{
+				index = AddNodes((ObjectModel*)omte->param(obj), nextFilter, flags, index);
+			}
+			if (nodes != nullptr)
+			{
+				nodes[nodeIndex].entry = omte;
+				nodes[nodeIndex].filter = nextFilter;
+				nodes[nodeIndex].numDescendants = index - nodeIndex - 1;
+			}
+		}
+	}
+	return index;
+}
+
+// Report the values the filter selected, in the same form as ObjectModel::ReportAsJson with no change tracking
+void ObjectModelSubscription::ReportAsJson(OutputBuffer *buf, ObjectModel *root, ObjectModel::ReportFlags flags) const
+{
+	(void)ReportNodes(buf, root, 0, numNodes, flags);
+}
+
+// Report the nodes from index up to end that belong to obj, returning end
+size_t ObjectModelSubscription::ReportNodes(OutputBuffer *buf, ObjectModel *obj, size_t index, size_t end, ObjectModel::ReportFlags flags) const
+{
+	buf->cat('{');
+	bool added = false;
+	while (index < end)
+	{
+		const Node& node = nodes[index];
+		if (added)
+		{
+			buf->cat(',');
+		}
+		added = true;
+		if (node.entry->type == TYPE_OF(ObjectModel))
+		{
+			buf->cat(node.entry->name);
+			buf->cat(':');
+			index = ReportNodes(buf, (ObjectModel*)node.entry->param(obj), index + 1, index + 1 + node.numDescendants, flags);
+		}
+		else
+		{
+			(void)node.entry->ReportAsJson(buf, obj, node.filter, flags, ObjectModel::ReportAll);
+			++index;
+		}
+	}
+	buf->cat('}');
+	return index;
+}
+
+// Resolve the name of a value of primitive type to the table entries that lead to it, returning true if successful.
+// This follows the same rules as GetObjectValue.
+bool CompiledObjectPath::Compile(ObjectModel *root, const char *idString)
+{
+	numSteps = 0;
+	ObjectModel *obj = root;
+	while (numSteps < MaxSteps)
+	{
+		const ObjectModelTableEntry * const e = obj->FindObjectModelTableEntry(idString);
+		if (e == nullptr)
+		{
+			break;
+		}
+
+		idString = ObjectModel::GetNextElement(idString);
+		void *param = e->param(obj);
+		TypeCode tc = e->type;
+		uint32_t index = NotArray;
+		if ((tc & IsArray) != 0)
+		{
+			if (*idString != '[')
+			{
+				break;
+			}
+			const char *endptr;
+			const unsigned long val = SafeStrtoul(idString + 1, &endptr);
+			const ObjectModelArrayDescriptor * const arr = (const ObjectModelArrayDescriptor*)param;
+			if (endptr == idString + 1 || *endptr != ']' || val >= arr->GetNumElements(obj))
+			{
+				break;
+			}
+			idString = endptr + 1;
+			if (*idString == '.')
+			{
+				++idString;
+			}
+			tc &= ~IsArray;
+			index = val;
+			param = arr->GetElement(obj, index);
+		}
+
+		steps[numSteps].entry = e;
+		steps[numSteps].index = index;
+		++numSteps;
+		if (tc != TYPE_OF(ObjectModel))
+		{
+			ExpressionValue dummy;
+			return ObjectModel::GetPrimitiveValue(dummy, param, tc) != NoType;
+		}
+		obj = (ObjectModel*)param;
+	}
+
+	numSteps = 0;
+	return false;
+}
+
+// Get the value that we resolved the path to, returning NoType if it no longer exists
+TypeCode CompiledObjectPath::GetValue(ObjectModel *root, ExpressionValue& val) const
+{
+	ObjectModel *obj = root;
+	for (size_t i = 0; i < numSteps; ++i)
+	{
+		const Step& step = steps[i];
+		void *param = step.entry->param(obj);
+		TypeCode tc = step.entry->type;
+		if (step.index != NotArray)
+		{
+			const ObjectModelArrayDescriptor * const arr = (const ObjectModelArrayDescriptor*)param;
+			if (step.index >= arr->GetNumElements(obj))
+			{
+				return NoType;						// the array has shrunk
+			}
+			tc &= ~IsArray;
+			param = arr->GetElement(obj, step.index);
+		}
+
+		if (i + 1 == numSteps)
+		{
+			return ObjectModel::GetPrimitiveValue(val, param, tc);
+		}
+		obj = (ObjectModel*)param;
+	}
+	return NoType;
+}
+
 // Template specialisations
 bool ObjectModel::GetObjectValue(float& val, const char *idString)
 {
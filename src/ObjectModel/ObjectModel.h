@@ -47,10 +47,18 @@ public:
 		flagShortForm = 1
 	};
 
+	// Pass this as the 'since' parameter of ReportAsJson to report all matching entries without tracking changes
+	static constexpr uint32_t ReportAll = 0xFFFFFFFF;
+
 	ObjectModel();
 
-	// Construct a JSON representation of those parts of the object model requested by the user
-	bool ReportAsJson(OutputBuffer *buf, const char *filter, ReportFlags rflags);
+	// Construct a JSON representation of those parts of the object model requested by the user.
+	// If 'since' is not ReportAll then we only report entries whose values have changed since the report that returned that change sequence number.
+	// Return true if we reported any entries.
+	bool ReportAsJson(OutputBuffer *buf, const char *filter, ReportFlags rflags, uint32_t since = ReportAll);
+
+	// Return the sequence number of the most recent change we found. A client passes this as 'since' in its next report to get just the changes.
+	static uint32_t GetChangeSequence() { return changeSequence; }
 
 	// Return the type of an object
 	TypeCode GetObjectType(const char *idString);
@@ -70,16 +78,30 @@ public:
 	// Skip the current element in the ID or filter string
 	static const char* GetNextElement(const char *id);
 
+	// Fetch a value of primitive type given the pointer that a table entry yielded for it
+	static TypeCode GetPrimitiveValue(ExpressionValue& val, const void *param, TypeCode tc);
+
 protected:
+	friend class ObjectModelSubscription;
 	virtual const ObjectModelTableEntry *GetObjectModelTable(size_t& numEntries) const = 0;
 
 private:
+	// Record of when the value of a table entry last changed. We only find out about changes when we report the entry, so we keep a hash of the value we last reported.
+	struct ChangeRecord
+	{
+		uint32_t hash;
+		uint32_t sequence;
+	};
+
 	// Get pointers to various types from the object model, returning null if failed
 	template<class T> T* GetObjectPointer(const char* idString);
 
 	const char **GetStringObjectPointer(const char *idString);
 	uint32_t *GetShortEnumObjectPointer(const char *idString);
 	uint32_t *GetBitmapObjectPointer(const char *idString);
+
+	ChangeRecord *changeRecords;						// one per table entry, allocated the first time that a client asks for changes to this object
+	static uint32_t changeSequence;						// incremented each time we find that a value has changed
 };
 
 // Function template used to get constexpr type IDs
@@ -137,8 +159,9 @@ public:
 	// Return true if this object table entry matches a filter or query
 	bool Matches(const char *filter, ObjectModelFilterFlags flags) const;
 
-	// See whether we should add the value of this element to the buffer, returning true if it matched the filter and we did add it
-	bool ReportAsJson(OutputBuffer* buf, ObjectModel *self, const char* filter, ObjectModel::ReportFlags flags) const;
+	// See whether we should add the value of this element to the buffer, returning true if it matched the filter and we did add it.
+	// If 'since' is not ObjectModel::ReportAll then nested objects only report entries that have changed, and we return false if there were none.
+	bool ReportAsJson(OutputBuffer* buf, ObjectModel *self, const char* filter, ObjectModel::ReportFlags flags, uint32_t since) const;
 
 	// Return the name of this field
 	const char* GetName() const { return name; }
@@ -146,8 +169,96 @@ public:
 	// Compare the name of this field with the filter string that we are trying to match
 	int IdCompare(const char *id) const;
 
+	// Return true if the entries of a table are in strictly increasing order of name, which FindObjectModelTableEntry relies on to do a binary search
+	static constexpr bool IsSorted(const ObjectModelTableEntry table[], size_t numEntries)
+	{
+		for (size_t i = 1; i < numEntries; ++i)
+		{
+			const char *p = table[i - 1].name, *q = table[i].name;
+			while (*p != 0 && *p == *q)
+			{
+				++p;
+				++q;
+			}
+			if (*p >= *q)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
 	// Private function to report a value of primitive type
-	static void ReportItemAsJson(OutputBuffer *buf, const char *filter, ObjectModel::ReportFlags flags, void *nParam, TypeCode type);
+	static bool ReportItemAsJson(OutputBuffer *buf, const char *filter, ObjectModel::ReportFlags flags, void *nParam, TypeCode type, uint32_t since);
+};
+
+// The path to a value in the object model, resolved to the table entries that lead to it.
+// Fetching the value through this is much faster than GetObjectValue, because we don't need to parse the name or search the tables again.
+// We still call the table entry functions each time, so that if an object or the size of an array changes we fetch the right value or fail.
+class CompiledObjectPath
+{
+public:
+	CompiledObjectPath() : numSteps(0) { }
+
+	// Resolve the name of a value of primitive type, returning true if successful
+	bool Compile(ObjectModel *root, const char *idString);
+
+	// Get the value, returning NoType if it no longer exists
+	TypeCode GetValue(ObjectModel *root, ExpressionValue& val) const;
+
+	bool IsValid() const { return numSteps != 0; }
+	void Clear() { numSteps = 0; }
+
+private:
+	static constexpr size_t MaxSteps = 6;
+	static constexpr uint32_t NotArray = 0xFFFFFFFF;
+
+	struct Step
+	{
+		const ObjectModelTableEntry *entry;
+		uint32_t index;					// the array index if the entry is an array, else NotArray
+	};
+
+	Step steps[MaxSteps];
+	size_t numSteps;
+};
+
+// A named object model report whose filter has been matched against the tables once, for clients that poll the same filter repeatedly.
+// Each report then visits only the table entries that the filter selected, instead of matching the filter against every entry at every level.
+class ObjectModelSubscription
+{
+public:
+	static constexpr size_t MaxNameLength = 15;
+
+	ObjectModelSubscription() : filter(nullptr), nodes(nullptr), numNodes(0) { }
+	~ObjectModelSubscription() { Clear(); }
+
+	// Match a filter against the object model
+	void Compile(ObjectModel *root, const char *name, const char *p_filter, ObjectModel::ReportFlags flags);
+
+	// Report the values the filter selected, in the same form as ObjectModel::ReportAsJson
+	void ReportAsJson(OutputBuffer *buf, ObjectModel *root, ObjectModel::ReportFlags flags) const;
+
+	bool IsNamed(const char *name) const { return filter != nullptr && strcmp(subscriptionName, name) == 0; }
+	bool IsInUse() const { return filter != nullptr; }
+	void Clear();
+
+private:
+	// The selected entries in preorder, so the entries of a nested object follow the entry for the object itself
+	struct Node
+	{
+		const ObjectModelTableEntry *entry;
+		const char *filter;				// the rest of the filter, which arrays of objects need to report their elements
+		uint16_t numDescendants;		// how many of the following nodes belong to this one
+	};
+
+	size_t AddNodes(ObjectModel *obj, const char *p_filter, ObjectModel::ReportFlags flags, size_t index);
+	size_t ReportNodes(OutputBuffer *buf, ObjectModel *obj, size_t index, size_t end, ObjectModel::ReportFlags flags) const;
+
+	char subscriptionName[MaxNameLength + 1];
+	char *filter;						// our own copy of the filter
+	Node *nodes;
+	size_t numNodes;
 };
 
 // Use this macro to inherit form ObjectModel
@@ -158,9 +269,11 @@ public:
 	const ObjectModelTableEntry *GetObjectModelTable(size_t& numEntries) const override; \
 	static const ObjectModelTableEntry objectModelTable[];
 
+// Use this macro after the table definition, which must be declared constexpr so that we can check at compile time that it is sorted
 #define DEFINE_GET_OBJECT_MODEL_TABLE(_class) \
 	const ObjectModelTableEntry *_class::GetObjectModelTable(size_t& numEntries) const \
 	{ \
+		static_assert(ObjectModelTableEntry::IsSorted(objectModelTable, ARRAY_SIZE(objectModelTable)), "Object model table entries of " #_class " must be in alphabetical order"); \
 		numEntries = ARRAY_SIZE(objectModelTable); \
 		return objectModelTable; \
 	}
@@ -10,13 +10,20 @@
 #include "RepRap.h"
 #include <cstdarg>
 
-/*static*/ OutputBuffer * volatile OutputBuffer::freeOutputBuffers = nullptr;		// Messages may also be sent by ISRs,
-/*static*/ volatile size_t OutputBuffer::usedOutputBuffers = 0;						// so make these volatile.
-/*static*/ volatile size_t OutputBuffer::maxUsedOutputBuffers = 0;
+/*static*/ OutputBuffer * volatile OutputBuffer::freeOutputBuffers[NumSizeClasses] = { nullptr, nullptr };		// Messages may also be sent by ISRs,
+/*static*/ volatile size_t OutputBuffer::usedOutputBuffers[NumSizeClasses] = { 0, 0 };							// so make these volatile.
+/*static*/ volatile size_t OutputBuffer::maxUsedOutputBuffers[NumSizeClasses] = { 0, 0 };
+/*static*/ volatile uint32_t OutputBuffer::sizeClassMisses[NumSizeClasses] = { 0, 0 };
+/*static*/ volatile uint32_t OutputBuffer::allocationFailures = 0;
 
 //*************************************************************************************************
 // OutputBuffer class implementation
 
+OutputBuffer::OutputBuffer(OutputBuffer *n, bool isLarge)
+	: next(n), data(new char[(isLarge) ? OUTPUT_BUFFER_SIZE : SMALL_OUTPUT_BUFFER_SIZE]), sizeClass((isLarge) ? LargeBuffer : SmallBuffer)
+{
+}
+
 void OutputBuffer::Append(OutputBuffer *other)
 {
 	if (other != nullptr)
@@ -161,11 +168,11 @@ size_t OutputBuffer::copy(const char *src, size_t len)
 size_t OutputBuffer::cat(const char c)
 {
 	// See if we can append a char
-	if (last->dataLength == OUTPUT_BUFFER_SIZE)
+	if (last->dataLength == last->Capacity())
 	{
-		// No - allocate a new item and copy the data
+		// No - allocate a new item and copy the data. If we have filled one buffer then there may be more to come, so ask for a large one.
 		OutputBuffer *nextBuffer;
-		if (!Allocate(nextBuffer))
+		if (!Allocate(nextBuffer, true))
 		{
 			// We cannot store any more data
 			hadOverflow = true;
@@ -189,6 +196,74 @@ size_t OutputBuffer::cat(const char c)
 	return 1;
 }
 
+// Append an unsigned decimal integer
+size_t OutputBuffer::catUnsigned(uint32_t val)
+{
+	char digits[10];
+	size_t pos = sizeof(digits);
+	do
+	{
+		digits[--pos] = '0' + (val % 10);
+		val /= 10;
+	} while (val != 0);
+	return cat(digits + pos, sizeof(digits) - pos);
+}
+
+// Append a signed decimal integer
+size_t OutputBuffer::catInt(int32_t val)
+{
+	if (val >= 0)
+	{
+		return catUnsigned((uint32_t)val);
+	}
+	const size_t ret = cat('-');
+	return ret + catUnsigned(-(uint32_t)val);
+}
+
+// Append a float with a fixed number of decimal places, like catf("%.2f") but much faster.
+// We fall back to printf for NaNs, infinities, values too large to convert to uint32_t and more than 3 decimal places.
+size_t OutputBuffer::catFloat(float val, unsigned int decimals)
+{
+	static constexpr uint32_t PowersOfTen[] = { 1, 10, 100, 1000 };
+	const float absVal = fabsf(val);
+	if (decimals >= ARRAY_SIZE(PowersOfTen) || !(absVal < 1.0e9))
+	{
+		return catf("%.*f", (int)decimals, (double)val);
+	}
+
+	// Convert the integer and fractional parts separately, so that we don't lose precision in the fractional part of large values
+	const uint32_t scale = PowersOfTen[decimals];
+	uint32_t intPart = (uint32_t)absVal;
+	uint32_t fracPart = (uint32_t)lrintf((absVal - (float)intPart) * (float)scale);
+	if (fracPart >= scale)
+	{
+		++intPart;
+		fracPart -= scale;
+	}
+
+	char digits[16];
+	size_t pos = sizeof(digits);
+	for (unsigned int i = 0; i < decimals; ++i)
+	{
+		digits[--pos] = '0' + (fracPart % 10);
+		fracPart /= 10;
+	}
+	if (decimals != 0)
+	{
+		digits[--pos] = '.';
+	}
+	do
+	{
+		digits[--pos] = '0' + (intPart % 10);
+		intPart /= 10;
+	} while (intPart != 0);
+	if (val < 0.0)
+	{
+		digits[--pos] = '-';
+	}
+	return cat(digits + pos, sizeof(digits) - pos);
+}
+
 size_t OutputBuffer::cat(const char *src)
 {
 	return cat(src, strlen(src));
@@ -199,11 +274,11 @@ size_t OutputBuffer::cat(const char *src, size_t len)
 	size_t copied = 0;
 	while (copied < len)
 	{
-		if (last->dataLength == OUTPUT_BUFFER_SIZE)
+		if (last->dataLength == last->Capacity())
 		{
 			// The last buffer is full
 			OutputBuffer *nextBuffer;
-			if (!Allocate(nextBuffer))
+			if (!Allocate(nextBuffer, true))
 			{
 				// We cannot store any more data, stop here
 				hadOverflow = true;
@@ -217,7 +292,7 @@ size_t OutputBuffer::cat(const char *src, size_t len)
 				item->last = last;
 			}
 		}
-		const size_t copyLength = min<size_t>(len - copied, OUTPUT_BUFFER_SIZE - last->dataLength);
+		const size_t copyLength = min<size_t>(len - copied, last->Capacity() - last->dataLength);
 		memcpy(last->data + last->dataLength, src + copied, copyLength);
 		last->dataLength += copyLength;
 		copied += copyLength;
@@ -292,10 +367,10 @@ size_t OutputBuffer::EncodeString(const char *src, bool allowControlChars, bool
 	return bytesWritten;
 }
 
-size_t OutputBuffer::EncodeReply(OutputBuffer *src)
+// Encode the characters of a chain of buffers in JSON format and release the chain
+size_t OutputBuffer::EncodeChain(OutputBuffer *src)
 {
-	size_t bytesWritten = cat('"');
-
+	size_t bytesWritten = 0;
 	while (src != nullptr)
 	{
 		for (size_t index = 0; index < src->DataLength(); ++index)
@@ -304,7 +379,26 @@ size_t OutputBuffer::EncodeReply(OutputBuffer *src)
 		}
 		src = Release(src);
 	}
+	return bytesWritten;
+}
 
+size_t OutputBuffer::EncodeReply(OutputBuffer *src)
+{
+	size_t bytesWritten = cat('"');
+	bytesWritten += EncodeChain(src);
+	bytesWritten += cat('"');
+	return bytesWritten;
+}
+
+// Encode all the replies on a stack as a single JSON string and release them. The replies may be shared with other destinations.
+size_t OutputBuffer::EncodeReply(volatile OutputStack& src)
+{
+	size_t bytesWritten = cat('"');
+	OutputBuffer *reply;
+	while ((reply = src.Pop()) != nullptr)
+	{
+		bytesWritten += EncodeChain(reply);
+	}
 	bytesWritten += cat('"');
 	return bytesWritten;
 }
@@ -338,27 +432,39 @@ bool OutputBuffer::WriteToFile(FileData& f) const
 // Initialise the output buffers manager
 /*static*/ void OutputBuffer::Init()
 {
-	freeOutputBuffers = nullptr;
+	freeOutputBuffers[LargeBuffer] = freeOutputBuffers[SmallBuffer] = nullptr;
 	for (size_t i = 0; i < OUTPUT_BUFFER_COUNT; i++)
 	{
-		freeOutputBuffers = new OutputBuffer(freeOutputBuffers);
+		freeOutputBuffers[LargeBuffer] = new OutputBuffer(freeOutputBuffers[LargeBuffer], true);
+	}
+	for (size_t i = 0; i < SMALL_OUTPUT_BUFFER_COUNT; i++)
+	{
+		freeOutputBuffers[SmallBuffer] = new OutputBuffer(freeOutputBuffers[SmallBuffer], false);
 	}
 }
 
 // Allocates an output buffer instance which can be used for (large) string outputs. This must be thread safe. Not safe to call from interrupts!
-/*static*/ bool OutputBuffer::Allocate(OutputBuffer *&buf)
+/*static*/ bool OutputBuffer::Allocate(OutputBuffer *&buf, bool preferLarge)
 {
 	{
 		TaskCriticalSectionLocker lock;
 
-		buf = freeOutputBuffers;
+		size_t sc = (preferLarge || SMALL_OUTPUT_BUFFER_COUNT == 0) ? LargeBuffer : SmallBuffer;
+		buf = freeOutputBuffers[sc];
+		if (buf == nullptr)
+		{
+			++sizeClassMisses[sc];
+			sc = (preferLarge) ? SmallBuffer : LargeBuffer;
+			buf = freeOutputBuffers[sc];
+		}
+
 		if (buf != nullptr)
 		{
-			freeOutputBuffers = buf->next;
-			usedOutputBuffers++;
-			if (usedOutputBuffers > maxUsedOutputBuffers)
+			freeOutputBuffers[sc] = buf->next;
+			usedOutputBuffers[sc]++;
+			if (usedOutputBuffers[sc] > maxUsedOutputBuffers[sc])
 			{
-				maxUsedOutputBuffers = usedOutputBuffers;
+				maxUsedOutputBuffers[sc] = usedOutputBuffers[sc];
 			}
 
 			// Initialise the buffer before we release the lock in case another task uses it immediately
@@ -372,6 +478,7 @@ bool OutputBuffer::WriteToFile(FileData& f) const
 
 			return true;
 		}
+		++allocationFailures;
 	}
 
 	reprap.GetPlatform().LogError(ErrorCode::OutputStarvation);
@@ -381,16 +488,18 @@ bool OutputBuffer::WriteToFile(FileData& f) const
 // Get the number of bytes left for continuous writing
 /*static*/ size_t OutputBuffer::GetBytesLeft(const OutputBuffer *writingBuffer)
 {
-	const size_t freeOutputBuffers = OUTPUT_BUFFER_COUNT - usedOutputBuffers;
-	const size_t bytesLeft = OUTPUT_BUFFER_SIZE - writingBuffer->last->DataLength();
+	// Continuation buffers are large ones if possible. We count the reserved buffers against the large ones.
+	const size_t freeLargeBuffers = OUTPUT_BUFFER_COUNT - usedOutputBuffers[LargeBuffer];
+	const size_t freeSmallBuffers = SMALL_OUTPUT_BUFFER_COUNT - usedOutputBuffers[SmallBuffer];
+	const size_t bytesLeft = (writingBuffer == nullptr) ? 0 : writingBuffer->last->Capacity() - writingBuffer->last->DataLength();
 
-	if (freeOutputBuffers < RESERVED_OUTPUT_BUFFERS)
+	if (freeLargeBuffers < RESERVED_OUTPUT_BUFFERS)
 	{
 		// Keep some space left to encapsulate the responses (e.g. via an HTTP header)
 		return bytesLeft;
 	}
 
-	return bytesLeft + (freeOutputBuffers - RESERVED_OUTPUT_BUFFERS) * OUTPUT_BUFFER_SIZE;
+	return bytesLeft + (freeLargeBuffers - RESERVED_OUTPUT_BUFFERS) * OUTPUT_BUFFER_SIZE + freeSmallBuffers * SMALL_OUTPUT_BUFFER_SIZE;
 }
 
 // Truncate an output buffer to free up more memory. Returns the number of released bytes.
@@ -419,8 +528,8 @@ bool OutputBuffer::WriteToFile(FileData& f) const
 
 		// Unlink and free the last entry
 		previousItem->next = nullptr;
+		releasedBytes += lastItem->Capacity();
 		Release(lastItem);
-		releasedBytes += OUTPUT_BUFFER_SIZE;
 	} while (previousItem != buffer && releasedBytes < bytesNeeded);
 
 	// Update all the references to the last item
@@ -445,10 +554,10 @@ bool OutputBuffer::WriteToFile(FileData& f) const
 	}
 	else
 	{
-		// Otherwise prepend it to the list of free output buffers again
-		buf->next = freeOutputBuffers;
-		freeOutputBuffers = buf;
-		usedOutputBuffers--;
+		// Otherwise prepend it to the list of free output buffers of its size again
+		buf->next = freeOutputBuffers[buf->sizeClass];
+		freeOutputBuffers[buf->sizeClass] = buf;
+		usedOutputBuffers[buf->sizeClass]--;
 	}
 	return nextBuffer;
 }
@@ -463,8 +572,10 @@ bool OutputBuffer::WriteToFile(FileData& f) const
 
 /*static*/ void OutputBuffer::Diagnostics(MessageType mtype)
 {
-	reprap.GetPlatform().MessageF(mtype, "Used output buffers: %d of %d (%d max)\n",
-			usedOutputBuffers, OUTPUT_BUFFER_COUNT, maxUsedOutputBuffers);
+	reprap.GetPlatform().MessageF(mtype, "Used output buffers: %u of %u (%u max, %" PRIu32 " misses) large, %u of %u (%u max, %" PRIu32 " misses) small, %" PRIu32 " failures\n",
+			usedOutputBuffers[LargeBuffer], OUTPUT_BUFFER_COUNT, maxUsedOutputBuffers[LargeBuffer], sizeClassMisses[LargeBuffer],
+			usedOutputBuffers[SmallBuffer], SMALL_OUTPUT_BUFFER_COUNT, maxUsedOutputBuffers[SmallBuffer], sizeClassMisses[SmallBuffer], allocationFailures);
+	sizeClassMisses[LargeBuffer] = sizeClassMisses[SmallBuffer] = allocationFailures = 0;
 }
 
 //*************************************************************************************************
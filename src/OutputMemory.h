@@ -22,7 +22,7 @@ class OutputBuffer
 	public:
 		friend class OutputStack;
 
-		OutputBuffer(OutputBuffer *n) : next(n) { }
+		OutputBuffer(OutputBuffer *n, bool isLarge);
 
 		void Append(OutputBuffer *other);
 		OutputBuffer *Next() const { return next; }
@@ -33,6 +33,7 @@ class OutputBuffer
 		const char *Data() const { return data; }
 		const char *UnreadData() const { return data + bytesRead; }
 		size_t DataLength() const { return dataLength; }	// How many bytes have been written to this instance?
+		size_t Capacity() const { return (sizeClass == LargeBuffer) ? OUTPUT_BUFFER_SIZE : SMALL_OUTPUT_BUFFER_SIZE; }
 		size_t Length() const;								// How many bytes have been written to the whole chain?
 
 		char& operator[](size_t index);
@@ -54,6 +55,11 @@ class OutputBuffer
 		size_t cat(const char *src, size_t len);
 		size_t cat(StringRef &str);
 
+		// Fast versions of catf for the numbers in status responses, which don't use printf
+		size_t catUnsigned(uint32_t val);
+		size_t catInt(int32_t val);
+		size_t catFloat(float val, unsigned int decimals);
+
 		size_t EncodeString(const char *src, bool allowControlChars, bool prependAsterisk = false);
 
 		template<size_t Len> size_t EncodeString(const String<Len>& str, bool allowControlChars, bool prependAsterisk = false)
@@ -62,6 +68,7 @@ class OutputBuffer
 		}
 
 		size_t EncodeReply(OutputBuffer *src);
+		size_t EncodeReply(volatile OutputStack& src);
 
 		uint32_t GetAge() const;
 
@@ -72,7 +79,8 @@ class OutputBuffer
 		static void Init();
 
 		// Allocate an unused OutputBuffer instance. Returns true on success or false if no instance could be allocated.
-		static bool Allocate(OutputBuffer *&buf);
+		// We allocate a small buffer unless preferLarge is true, but if there are none of the preferred size left then we allocate the other size.
+		static bool Allocate(OutputBuffer *&buf, bool preferLarge = false);
 
 		// Get the number of bytes left for allocation. If writingBuffer is not NULL, this returns the number of free bytes for
 		// continuous writes, i.e. for writes that need to allocate an extra OutputBuffer instance to finish the message.
@@ -89,26 +97,37 @@ class OutputBuffer
 
 		static void Diagnostics(MessageType mtype);
 
-		static unsigned int GetFreeBuffers() { return OUTPUT_BUFFER_COUNT - usedOutputBuffers; }
+		static unsigned int GetFreeBuffers() { return (OUTPUT_BUFFER_COUNT - usedOutputBuffers[LargeBuffer]) + (SMALL_OUTPUT_BUFFER_COUNT - usedOutputBuffers[SmallBuffer]); }
+		static unsigned int GetUsedBuffers(bool large) { return usedOutputBuffers[(large) ? LargeBuffer : SmallBuffer]; }
+		static unsigned int GetMaxUsedBuffers(bool large) { return maxUsedOutputBuffers[(large) ? LargeBuffer : SmallBuffer]; }
+		static uint32_t GetAllocationFailures() { return allocationFailures; }	// how many times we ran out of buffers since we last reported diagnostics
 
 	private:
+		// The size classes
+		enum : uint8_t { SmallBuffer = 0, LargeBuffer = 1, NumSizeClasses = 2 };
+
 		size_t EncodeChar(char c);
+		size_t EncodeChain(OutputBuffer *src);
 
 		OutputBuffer *next;
 		OutputBuffer *last;
 
 		uint32_t whenQueued;
 
-		char data[OUTPUT_BUFFER_SIZE];
+		char * const data;										// OUTPUT_BUFFER_SIZE or SMALL_OUTPUT_BUFFER_SIZE bytes, depending on the size class
 		size_t dataLength, bytesRead;
 
+		const uint8_t sizeClass;
 		bool isReferenced;
 		bool hadOverflow;
 		volatile size_t references;
 
-		static OutputBuffer * volatile freeOutputBuffers;		// Messages may be sent by multiple tasks
-		static volatile size_t usedOutputBuffers;				// so make these volatile.
-		static volatile size_t maxUsedOutputBuffers;
+		// One free list and set of statistics for each size class
+		static OutputBuffer * volatile freeOutputBuffers[NumSizeClasses];		// Messages may be sent by multiple tasks
+		static volatile size_t usedOutputBuffers[NumSizeClasses];				// so make these volatile.
+		static volatile size_t maxUsedOutputBuffers[NumSizeClasses];
+		static volatile uint32_t sizeClassMisses[NumSizeClasses];				// how many times we wanted this size but there were none left
+		static volatile uint32_t allocationFailures;							// how many times there were no buffers of either size left
 };
 
 inline uint32_t OutputBuffer::GetAge() const
@@ -92,8 +92,65 @@
 # define SUPPORT_OBJECT_MODEL	0
 #endif
 
+#ifndef SUPPORT_SEGMENT_FREE_STREAMING
+# define SUPPORT_SEGMENT_FREE_STREAMING	0
+#endif
+
+#ifndef SUPPORT_INPUT_SHAPING
+# define SUPPORT_INPUT_SHAPING	0
+#endif
+
+#ifndef SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+# define SUPPORT_PRESSURE_ADVANCE_SMOOTHING	0
+#endif
+
+#ifndef SUPPORT_MACRO_CACHE
+# define SUPPORT_MACRO_CACHE	0
+#endif
+
+#ifndef SUPPORT_DIRECTORY_CACHE
+# define SUPPORT_DIRECTORY_CACHE	0
+#endif
+
+#ifndef SUPPORT_RESUME_JOURNAL
+# define SUPPORT_RESUME_JOURNAL	0
+#endif
+
+#ifndef SUPPORT_MOVE_TRACE
+# define SUPPORT_MOVE_TRACE		0
+#endif
+
+#ifndef SUPPORT_COMPACT_HEIGHT_MAP
+# define SUPPORT_COMPACT_HEIGHT_MAP	0
+#endif
+
+#ifndef SUPPORT_SECTOR_CACHE
+# define SUPPORT_SECTOR_CACHE	0					// set nonzero to keep recently used FAT and directory sectors in RAM
+#endif
+
+#ifndef SUPPORT_RAM_STEP_ISR
+# define SUPPORT_RAM_STEP_ISR	0					// set nonzero to run the step ISR and the DDA step code from RAM instead of flash memory
+#endif
+
+#ifndef SUPPORT_PLAN_TRACE
+# define SUPPORT_PLAN_TRACE		0
+#endif
+
+#ifndef SUPPORT_ASYNC_MOVES
+# define SUPPORT_ASYNC_MOVES	0
+#endif
+
+#ifndef SUPPORT_FAST_STEP_CLOCK
+# define SUPPORT_FAST_STEP_CLOCK	0
+#endif
+
+#ifndef USE_INCREMENTAL_SQRT
+# define USE_INCREMENTAL_SQRT	0
+#endif
+
 #define HAS_SMART_DRIVERS		(SUPPORT_TMC2660 || SUPPORT_TMC22xx || SUPPORT_TMC51xx)
 #define HAS_STALL_DETECT		(SUPPORT_TMC2660 || SUPPORT_TMC51xx)
+#define HAS_MOTION_PROFILES		(SUPPORT_INPUT_SHAPING || SUPPORT_PRESSURE_ADVANCE_SMOOTHING)
 
 // HAS_LWIP_NETWORKING refers to Lwip 2 support in the Networking folder, not legacy SAM3XA networking using Lwip 1
 #ifndef HAS_LWIP_NETWORKING
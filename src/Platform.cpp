@@ -34,6 +34,7 @@
 #include "Version.h"
 #include "SoftTimer.h"
 #include "Logger.h"
+#include "DataLogger.h"
 #include "Tasks.h"
 #include "Hardware/DmacManager.h"
 #include "Hardware/Cache.h"
@@ -71,6 +72,10 @@
 # include "Networking/TelnetResponder.h"
 #endif
 
+#if SUPPORT_MOVE_TRACE
+# include "Movement/MoveTrace.h"
+#endif
+
 #include <climits>
 #include <utility>					// for std::swap
 
@@ -168,11 +173,11 @@ extern "C" void UrgentInit()
 uint8_t Platform::softwareResetDebugInfo = 0;			// extra info for debugging
 
 Platform::Platform()
-	: logger(nullptr), board(DEFAULT_BOARD_TYPE), active(false), errorCodeBits(0),
+	: logger(nullptr), dataLogger(nullptr), board(DEFAULT_BOARD_TYPE), active(false), errorCodeBits(0),
 #if HAS_SMART_DRIVERS
 	  nextDriveToPoll(0),
 #endif
-	  lastFanCheckTime(0), auxGCodeReply(nullptr), sysDir(nullptr), tickState(0), debugCode(0),
+	  nextFanCheckTime(0), sysDir(nullptr), tickState(0), debugCode(0),
 	  lastWarningMillis(0), deliberateError(false)
 {
 	massStorage = new MassStorage(this);
@@ -221,6 +226,7 @@ void Platform::Init()
 	baudRates[0] = MAIN_BAUD_RATE;
 	commsParams[0] = 0;
 	usbMutex.Create("USB");
+	messageLimiter.Init();
 	SERIAL_MAIN_DEVICE.Start(UsbVBusPin);
 
 #ifdef SERIAL_AUX_DEVICE
@@ -331,6 +337,8 @@ void Platform::Init()
 #endif
 
 	ARRAY_INIT(endStopPins, END_STOP_PINS);
+	endstopInterruptInputs = 0;
+	endstopChanged = false;
 
 	// Drives
 	minimumMovementSpeed = DefaultMinFeedrate;
@@ -344,6 +352,15 @@ void Platform::Init()
 	driveStepsPerUnit[Z_AXIS] = DefaultZDriveStepsPerUnit;
 	instantDvs[Z_AXIS] = DefaultZInstantDv;
 
+	for (float& flow : maxExtrusionFlows)
+	{
+		flow = 0.0;
+	}
+	for (float& decel : decelerations)
+	{
+		decel = 0.0;
+	}
+
 	for (size_t drive = E0_AXIS; drive < MaxTotalDrivers; ++drive)
 	{
 		maxFeedrates[drive] = DefaultEMaxFeedrate;
@@ -445,6 +462,9 @@ void Platform::Init()
 	{
 		extruderDrivers[extr] = (uint8_t)(extr + MinAxes);		// set up default extruder drive mapping
 		SetPressureAdvance(extr, 0.0);							// no pressure advance
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+		SetPressureAdvanceSmoothing(extr, 0.0);					// no smoothing of pressure advance
+#endif
 #if SUPPORT_NONLINEAR_EXTRUSION
 		nonlinearExtrusionA[extr] = nonlinearExtrusionB[extr] = 0.0;
 		nonlinearExtrusionLimit[extr] = DefaultNonlinearExtrusionLimit;
@@ -453,8 +473,14 @@ void Platform::Init()
 
 #if defined(DUET_NG)
 	// Test for presence of a DueX2 or DueX5 expansion board and work out how many TMC2660 drivers we have
-	// The SX1509B has an independent power on reset, so give it some time
-	delay(200);
+	// The SX1509B has an independent power on reset, so give it some time. It started when we did, so we only need to wait until 200ms after reset.
+	{
+		const uint32_t now = millis();
+		if (now < 200)
+		{
+			delay(200 - now);
+		}
+	}
 	expansionBoard = DuetExpansion::DueXnInit();
 
 # if HAS_SMART_DRIVERS
@@ -506,8 +532,8 @@ void Platform::Init()
 
 #if HAS_STALL_DETECT
 	stalledDrivers = 0;
-	logOnStallDrivers = pauseOnStallDrivers = rehomeOnStallDrivers = 0;
-	stalledDriversToLog = stalledDriversToPause = stalledDriversToRehome = 0;
+	logOnStallDrivers = pauseOnStallDrivers = rehomeOnStallDrivers = slowDownOnStallDrivers = 0;
+	stalledDriversToLog = stalledDriversToPause = stalledDriversToRehome = stalledDriversToSlowDown = 0;
 #endif
 
 #if HAS_VOLTAGE_MONITOR
@@ -658,6 +684,9 @@ void Platform::InitZProbe()
 {
 	zProbeOnFilter.Init(0);
 	zProbeOffFilter.Init(0);
+	zProbeRecordingCrossing = zProbeCrossingSeen = false;
+	zProbePrevValue = 0;
+	zProbePrevClocks = 0;
 
 #ifdef DUET_06_085
 	zProbeModulationPin = (board == BoardType::Duet_07 || board == BoardType::Duet_085) ? Z_PROBE_MOD_PIN07 : Z_PROBE_MOD_PIN06;
@@ -818,6 +847,62 @@ void Platform::SetProbing(bool isProbing)
 	{
 		digitalWrite(zProbeModulationPin, isProbing);
 	}
+
+	// Keep the crossing time after the probing move, because GCodes fetches it after ending the move
+	if (isProbing)
+	{
+		zProbeCrossingSeen = false;
+	}
+	zProbeRecordingCrossing = isProbing && IsFilteredZProbeType();
+}
+
+// Return true if the Z probe reading comes from the averaging filters, which the tick ISR updates
+bool Platform::IsFilteredZProbeType() const
+{
+	switch (zProbeType)
+	{
+	case ZProbeType::analog:
+	case ZProbeType::dumbModulated:
+	case ZProbeType::alternateAnalog:
+	case ZProbeType::endstopSwitch:
+	case ZProbeType::digital:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Record the time at which the filtered Z probe reading reached the trigger value during a probing move. Called from the tick ISR after the filters have been updated.
+// The reading only changes once per tick, so the step ISR sees the trigger up to a tick late. We interpolate between the last two readings to find when it really happened.
+void Platform::RecordZProbeReading()
+{
+	const int value = GetZProbeReading();
+	const uint32_t now = StepTimer::GetInterruptClocks();
+	if (zProbeRecordingCrossing && !zProbeCrossingSeen)
+	{
+		const int threshold = GetCurrentZProbeParameters().adcValue;
+		if (value >= threshold)
+		{
+			zProbeCrossingClocks = (zProbePrevValue < threshold)
+									? zProbePrevClocks + (uint32_t)(((uint64_t)(now - zProbePrevClocks) * (uint32_t)(threshold - zProbePrevValue))/(uint32_t)(value - zProbePrevValue))
+									: now;
+			zProbeCrossingSeen = true;
+		}
+	}
+	zProbePrevValue = value;
+	zProbePrevClocks = now;
+}
+
+// Return how long in seconds the Z probe trigger was detected at the specified step clock time after the filtered reading reached the trigger value
+float Platform::GetZProbeTriggerLatency(uint32_t detectedAt) const
+{
+	if (!zProbeCrossingSeen)
+	{
+		return 0.0;
+	}
+	const int32_t latency = (int32_t)(detectedAt - zProbeCrossingClocks);
+	return (latency > 0 && latency < (int32_t)(StepTimer::StepClockRate/100)) ? (float)latency/StepTimer::StepClockRate : 0.0;		// ignore it if it doesn't make sense
 }
 
 const ZProbe& Platform::GetZProbeParameters(ZProbeType probeType) const
@@ -1184,10 +1269,7 @@ void Platform::Exit()
 	massStorage->CloseAllFiles();
 
 	// Release the aux output stack (should release the others too!)
-	while (auxGCodeReply != nullptr)
-	{
-		auxGCodeReply = OutputBuffer::Release(auxGCodeReply);
-	}
+	auxGCodeReply.ReleaseAll();
 
 	// Stop processing data. Don't try to send a message because it will probably never get there.
 	active = false;
@@ -1372,6 +1454,22 @@ void Platform::Spin()
 	// Try to flush messages to serial ports
 	(void)FlushMessages();
 
+	// Report the error and warning messages that we suppressed because they were repeated
+	{
+		String<MessageLimiter::MaxRepeatReportLength> repeatReport;
+		MessageType type;
+		while (messageLimiter.GetRepeatReport(repeatReport.GetRef(), type))
+		{
+			RawMessage(type, repeatReport.c_str());
+		}
+	}
+
+	// Ramp the spindle speeds and apply their RPM feedback
+	for (Spindle& spindle : spindles)
+	{
+		spindle.Spin();
+	}
+
 	// Check the MCU max and min temperatures
 #if HAS_CPU_TEMP_SENSOR
 	if (adcFilters[CpuTempFilterIndex].IsValid())
@@ -1489,6 +1587,11 @@ void Platform::Spin()
 						{
 							stalledDriversToPause |= mask;
 						}
+						else if ((slowDownOnStallDrivers & mask) != 0)
+						{
+							reprap.GetMove().ReduceSpeedOnStall();
+							stalledDriversToSlowDown |= mask;
+						}
 						else if ((logOnStallDrivers & mask) != 0)
 						{
 							stalledDriversToLog |= mask;
@@ -1557,9 +1660,9 @@ void Platform::Spin()
 	}
 
 	// Thermostatically-controlled fans (do this after getting TMC driver status)
-	if (now - lastFanCheckTime >= FanCheckInterval)
+	if ((int32_t)(now - nextFanCheckTime) >= 0)
 	{
-		lastFanCheckTime = now;
+		nextFanCheckTime = now + FanCheckInterval;
 		bool thermostaticFanRunning = false;
 		for (size_t fan = 0; fan < NUM_FANS; ++fan)
 		{
@@ -1626,6 +1729,14 @@ void Platform::Spin()
 				MessageF(WarningMessage, "Driver(s)%s stalled at Z height %.2f", scratchString.c_str(), (double)liveCoordinates[Z_AXIS]);
 				reported = true;
 			}
+			if (stalledDriversToSlowDown != 0 && reprap.GetGCodes().IsReallyPrinting())
+			{
+				String<ScratchStringLength> scratchString;
+				ListDrivers(scratchString.GetRef(), stalledDriversToSlowDown);
+				stalledDriversToSlowDown = 0;
+				MessageF(WarningMessage, "Driver(s)%s stalled, speed reduced to %.0f%%", scratchString.c_str(), (double)(reprap.GetMove().GetStallSpeedFactor() * 100.0));
+				reported = true;
+			}
 #endif
 
 #if HAS_VOLTAGE_MONITOR
@@ -1722,6 +1833,10 @@ void Platform::Spin()
 	{
 		logger->Flush(false);
 	}
+	if (dataLogger != nullptr)
+	{
+		dataLogger->Spin();
+	}
 }
 
 #if HAS_SMART_DRIVERS
@@ -2154,7 +2269,10 @@ void Platform::Diagnostics(MessageType mtype)
 {
 #if USE_CACHE
 	// Get the cache statistics before we start messing around with the cache
+# if SAM4E
 	const uint32_t cacheCount = Cache::GetHitCount();
+# endif
+	const uint32_t invalidateCount = Cache::GetInvalidateCount();
 #endif
 
 	Message(mtype, "=== Platform ===\n");
@@ -2285,7 +2403,8 @@ void Platform::Diagnostics(MessageType mtype)
 	MessageF(mtype, "Error status: %" PRIx32 "\n", errorCodeBits);
 
 	// Show the number of free entries in the file table
-	MessageF(mtype, "Free file entries: %u\n", massStorage->GetNumFreeFiles());
+	MessageF(mtype, "Free file entries: %u of %u (%u reserved for jobs), most used %u\n",
+				massStorage->GetNumFreeFiles(), (unsigned int)MAX_FILES, (unsigned int)FilesReservedForJobs, massStorage->GetAndClearMaxFilesInUse());
 
 	// Show the HSMCI CD pin and speed
 #if HAS_HIGH_SPEED_SD
@@ -2296,6 +2415,12 @@ void Platform::Diagnostics(MessageType mtype)
 
 	// Show the longest SD card write time
 	MessageF(mtype, "SD card longest block write time: %.1fms, max retries %u\n", (double)FileStore::GetAndClearLongestWriteTime(), FileStore::GetAndClearMaxRetryCount());
+#if SUPPORT_MACRO_CACHE
+	massStorage->MacroCacheDiagnostics(mtype);
+#endif
+#if SUPPORT_SECTOR_CACHE
+	massStorage->SectorCacheDiagnostics(mtype);
+#endif
 
 #if HAS_CPU_TEMP_SENSOR
 	// Show the MCU temperatures
@@ -2339,7 +2464,14 @@ void Platform::Diagnostics(MessageType mtype)
 	}
 
 #if USE_CACHE
+# if SAM4E
 	MessageF(mtype, "Cache data hit count %" PRIu32 "\n", cacheCount);
+# endif
+	MessageF(mtype, "Cache invalidations %" PRIu32 ", step ISR code in %s\n", invalidateCount, (SUPPORT_RAM_STEP_ISR) ? "RAM" : "flash");
+#endif
+
+#if SAME70
+	DmacManager::Diagnostics(mtype);
 #endif
 
 // Debug
@@ -2642,8 +2774,64 @@ GCodeResult Platform::DiagnosticTest(GCodeBuffer& gb, const StringRef& reply, in
 		}
 		break;
 
+	case (int)DiagnosticTestType::TimeCRC32:		// Show the speed of the CRC calculation on uploaded data. The displayed values are subject to interrupts.
+		{
+			constexpr size_t CrcBlockSize = 512;
+			constexpr unsigned int CrcNumBlocks = 64;
+			char buf[CrcBlockSize];
+			for (size_t i = 0; i < CrcBlockSize; ++i)
+			{
+				buf[i] = (char)(i * 7 + 3);
+			}
+
+			// Time the calculation that uploads use
+			CRC32 crc1;
+			const uint32_t now1 = StepTimer::GetInterruptClocks();
+			for (unsigned int i = 0; i < CrcNumBlocks; ++i)
+			{
+				crc1.Update(buf, CrcBlockSize);
+			}
+			const uint32_t tim1 = StepTimer::GetInterruptClocks() - now1;
+
+			// Time the byte at a time calculation, which also checks the result
+			CRC32 crc2;
+			const uint32_t now2 = StepTimer::GetInterruptClocks();
+			for (unsigned int i = 0; i < CrcNumBlocks; ++i)
+			{
+				for (size_t j = 0; j < CrcBlockSize; ++j)
+				{
+					crc2.Update(buf[j]);
+				}
+			}
+			const uint32_t tim2 = StepTimer::GetInterruptClocks() - now2;
+
+			const float megabytesTimesClockRate = (float)(CrcBlockSize * CrcNumBlocks) * (float)StepTimer::StepClockRate * 1.0e-6;
+			reply.printf("CRC32: block %.2fMb/sec, byte at a time %.2fMb/sec, %s",
+				(double)(megabytesTimesClockRate/(float)max<uint32_t>(tim1, 1)), (double)(megabytesTimesClockRate/(float)max<uint32_t>(tim2, 1)),
+					(crc1.Get() == crc2.Get()) ? "ok" : "ERROR");
+			return (crc1.Get() == crc2.Get()) ? GCodeResult::ok : GCodeResult::error;
+		}
+
 	case (int)DiagnosticTestType::TimeSDWrite:
-		return reprap.GetGCodes().StartSDTiming(gb, reply);
+		return reprap.GetGCodes().StartSDTiming(gb, reply, false);
+
+	case (int)DiagnosticTestType::SDCardBenchmark:
+		return reprap.GetGCodes().StartSDTiming(gb, reply, true);
+
+	case (int)DiagnosticTestType::StepRateBenchmark:
+		return reprap.GetMove().RunStepRateBenchmark(gb, reply);
+
+	case (int)DiagnosticTestType::GCodeParseBenchmark:
+		return GCodeBuffer::RunParseBenchmark(gb, reply);
+
+#if SUPPORT_MOVE_TRACE
+	case (int)DiagnosticTestType::WriteMoveTrace:
+		return MoveTrace::WriteFile(reply);
+#endif
+
+	case (int)DiagnosticTestType::ClearStepTimingHistograms:
+		reprap.GetMove().ClearStepTimingHistograms();
+		break;
 
 	case (int)DiagnosticTestType::PrintObjectSizes:
 		reply.printf(
@@ -2839,6 +3027,54 @@ bool Platform::EndStopInputState(size_t drive) const
 	return drive < NumEndstops && endStopPins[drive] != NoPin && IoPort::ReadPin(endStopPins[drive]);
 }
 
+// Attach pin change interrupts to the specified endstop inputs, so that the step interrupt only needs to check them after one has changed.
+// This is called by the Move task when preparing a move that checks endstops. Only one move at a time may use endstop interrupts.
+// Return false if the interrupts are already in use or an input doesn't support them, in which case the caller must poll the endstops.
+bool Platform::AttachEndstopInterrupts(uint32_t inputs)
+{
+	if (endstopInterruptInputs != 0 || inputs == 0)
+	{
+		return false;
+	}
+
+	for (size_t input = 0; input < NumEndstops; ++input)
+	{
+		if (IsBitSet(inputs, input))
+		{
+			const Pin pin = endStopPins[input];
+			if (   pin == NoPin
+				|| FilamentMonitor::IsUsingPin(pin)						// don't take over the interrupt of a filament monitor
+				|| !attachInterrupt(pin, EndstopInterrupt, INTERRUPT_MODE_CHANGE, this)
+			   )
+			{
+				DetachEndstopInterrupts();
+				return false;
+			}
+			SetBit(endstopInterruptInputs, input);
+		}
+	}
+	return true;
+}
+
+void Platform::DetachEndstopInterrupts()
+{
+	for (size_t input = 0; endstopInterruptInputs != 0; ++input)
+	{
+		if (IsBitSet(endstopInterruptInputs, input))
+		{
+			detachInterrupt(endStopPins[input]);
+			ClearBit(endstopInterruptInputs, input);
+		}
+	}
+}
+
+// Endstop pin change ISR. Get the step interrupt to check the endstops straight away instead of waiting for the next step.
+/*static*/ void Platform::EndstopInterrupt(CallbackParameter param)
+{
+	static_cast<Platform*>(param.vp)->FlagEndstopChanged();
+	StepTimer::TriggerStepInterrupt();
+}
+
 // Get the statuses of all the endstop inputs, regardless of what they are used for. Used for triggers.
 uint32_t Platform::GetAllEndstopStates() const
 {
@@ -3509,6 +3745,16 @@ uint32_t Platform::GetFanRPM(size_t tachoIndex) const
 	return (tachoIndex < NumTachos) ? tachos[tachoIndex].GetRPM() : 0;
 }
 
+// Make sure that we check the fans again within 'delay' milliseconds. This is used to turn off the blip at the right time when a fan is started.
+void Platform::ScheduleFanCheck(uint32_t delay)
+{
+	const uint32_t when = millis() + delay;
+	if ((int32_t)(when - nextFanCheckTime) < 0)
+	{
+		nextFanCheckTime = when;
+	}
+}
+
 bool Platform::FansHardwareInverted(size_t fanNumber) const
 {
 #if defined(DUET_06_085)
@@ -3601,12 +3847,18 @@ void Platform::AppendAuxReply(const char *msg, bool rawMessage)
 		}
 		else
 		{
-			// Regular text-based responses for AUX are currently stored and processed by M105/M408
-			if (auxGCodeReply != nullptr || OutputBuffer::Allocate(auxGCodeReply))
+			// Regular text-based responses for AUX are currently stored and processed by M105/M408.
+			// Append the message to the last stored reply unless it is shared with other destinations.
+			OutputBuffer *buf = auxGCodeReply.GetLastItem();
+			if (buf == nullptr || buf->IsReferenced())
 			{
-				auxSeq++;
-				auxGCodeReply->cat(msg);
+				if (!OutputBuffer::Allocate(buf) || !auxGCodeReply.Push(buf))
+				{
+					return;
+				}
 			}
+			auxSeq++;
+			buf->cat(msg);
 		}
 	}
 #endif
@@ -3631,16 +3883,10 @@ void Platform::AppendAuxReply(OutputBuffer *reply, bool rawMessage)
 		}
 		else
 		{
-			// Other responses are stored for M105/M408
+			// Other responses are stored for M105/M408. We keep them by reference rather than appending them to the previous reply,
+			// because the same buffers may also be queued for USB, HTTP or Telnet and appending would change them.
 			auxSeq++;
-			if (auxGCodeReply == nullptr)
-			{
-				auxGCodeReply = reply;
-			}
-			else
-			{
-				auxGCodeReply->Append(reply);
-			}
+			auxGCodeReply.Push(reply);
 		}
 	}
 #else
@@ -3648,6 +3894,17 @@ void Platform::AppendAuxReply(OutputBuffer *reply, bool rawMessage)
 #endif
 }
 
+// Append the stored G-Code replies for AUX devices to a JSON response as a single string, and release them
+void Platform::EncodeAuxGCodeReply(OutputBuffer *response)
+{
+#ifdef SERIAL_AUX_DEVICE
+	MutexLocker lock(auxMutex);
+	response->EncodeReply(auxGCodeReply);
+#else
+	response->cat("\"\"");
+#endif
+}
+
 // Send the specified message to the specified destinations. The Error and Warning flags have already been handled.
 void Platform::RawMessage(MessageType type, const char *message)
 {
@@ -3829,6 +4086,21 @@ void Platform::Message(const MessageType type, OutputBuffer *buffer)
 	}
 }
 
+// Send an error or warning message, after handling the flags. If the same source has sent one recently then we count the message instead of sending it,
+// so that a repeating error can't flood the output channels. We report the count the next time the source may send a message.
+void Platform::LimitedMessage(MessageType type, const char *source, const char *message)
+{
+	String<MessageLimiter::MaxRepeatReportLength> repeatReport;
+	if (messageLimiter.Allow(type, source, message, repeatReport.GetRef()))
+	{
+		if (!repeatReport.IsEmpty())
+		{
+			RawMessage(type, repeatReport.c_str());
+		}
+		RawMessage(type, message);
+	}
+}
+
 void Platform::MessageF(MessageType type, const char *fmt, va_list vargs)
 {
 	String<FormatStringLength> formatString;
@@ -3845,9 +4117,11 @@ void Platform::MessageF(MessageType type, const char *fmt, va_list vargs)
 	else
 	{
 		formatString.vprintf(fmt, vargs);
+		RawMessage(type, formatString.c_str());
+		return;
 	}
 
-	RawMessage((MessageType)(type & ~(ErrorMessageFlag | WarningMessageFlag)), formatString.c_str());
+	LimitedMessage((MessageType)(type & ~(ErrorMessageFlag | WarningMessageFlag)), fmt, formatString.c_str());
 }
 
 void Platform::MessageF(MessageType type, const char *fmt, ...)
@@ -3869,7 +4143,7 @@ void Platform::Message(MessageType type, const char *message)
 		String<FormatStringLength> formatString;
 		formatString.copy(((type & ErrorMessageFlag) != 0) ? "Error: " : "Warning: ");
 		formatString.cat(message);
-		RawMessage((MessageType)(type & ~(ErrorMessageFlag | WarningMessageFlag)), formatString.c_str());
+		LimitedMessage((MessageType)(type & ~(ErrorMessageFlag | WarningMessageFlag)), message, formatString.c_str());
 	}
 }
 
@@ -3904,10 +4178,47 @@ void Platform::SendAlert(MessageType mt, const char *message, const char *title,
 	}
 }
 
-// Configure logging according to the M929 command received, returning true if error
+// Configure logging according to the M929 command received, returning true if error.
+// M929 S1 [P"filename"] starts event logging and M929 S0 stops it.
+// M929 D1 [P"filename"] [R<rate>] starts binary data logging at the given rate in Hz and M929 D0 stops it.
 GCodeResult Platform::ConfigureLogging(GCodeBuffer& gb, const StringRef& reply)
 {
-	if (gb.Seen('S'))
+	if (gb.Seen('D'))
+	{
+		const bool start = gb.GetIValue() > 0;
+		if (dataLogger != nullptr)
+		{
+			dataLogger->Stop();
+		}
+		if (start)
+		{
+			if (dataLogger == nullptr)
+			{
+				dataLogger = new DataLogger();
+			}
+
+			String<MaxFilenameLength> filename;
+			if (gb.Seen('P'))
+			{
+				if (!gb.GetQuotedString(filename.GetRef()))
+				{
+					reply.copy("Missing filename in M929 command");
+					return GCodeResult::error;
+				}
+			}
+			else
+			{
+				filename.copy(DEFAULT_DATA_LOG_FILE);
+			}
+			const unsigned int rate = (gb.Seen('R')) ? gb.GetUIValue() : 10;
+			if (!dataLogger->Start(realTime, filename.GetRef(), rate))
+			{
+				reply.printf("Failed to create data log file %s", filename.c_str());
+				return GCodeResult::error;
+			}
+		}
+	}
+	else if (gb.Seen('S'))
 	{
 		StopLogging();
 		if (gb.GetIValue() > 0)
@@ -3942,6 +4253,14 @@ GCodeResult Platform::ConfigureLogging(GCodeBuffer& gb, const StringRef& reply)
 	else
 	{
 		reply.printf("Event logging is %s", (logger != nullptr && logger->IsActive()) ? "enabled" : "disabled");
+		if (dataLogger != nullptr && dataLogger->IsActive())
+		{
+			reply.catf(", data logging at %uHz, %" PRIu32 " records dropped", dataLogger->GetRate(), dataLogger->GetDroppedRecords());
+		}
+		else
+		{
+			reply.cat(", data logging is disabled");
+		}
 	}
 	return GCodeResult::ok;
 }
@@ -3953,6 +4272,10 @@ void Platform::StopLogging()
 	{
 		logger->Stop(realTime);
 	}
+	if (dataLogger != nullptr)
+	{
+		dataLogger->Stop();
+	}
 }
 
 bool Platform::AtxPower() const
@@ -3989,6 +4312,18 @@ void Platform::SetPressureAdvance(size_t extruder, float factor)
 	}
 }
 
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+
+void Platform::SetPressureAdvanceSmoothing(size_t extruder, float seconds)
+{
+	if (extruder < MaxExtruders)
+	{
+		pressureAdvanceSmoothing[extruder] = seconds;
+	}
+}
+
+#endif
+
 #if SUPPORT_NONLINEAR_EXTRUSION
 
 bool Platform::GetExtrusionCoefficients(size_t extruder, float& a, float& b, float& limit) const
@@ -4239,11 +4574,11 @@ const char* Platform::InternalGetSysDir() const
 }
 
 // Open a file
-FileStore* Platform::OpenFile(const char* folder, const char* fileName, OpenMode mode, uint32_t preAllocSize) const
+FileStore* Platform::OpenFile(const char* folder, const char* fileName, OpenMode mode, uint32_t preAllocSize, FileUser user) const
 {
 	String<MaxFilenameLength> location;
 	return (MassStorage::CombineName(location.GetRef(), folder, fileName))
-			? massStorage->OpenFile(location.c_str(), mode, preAllocSize)
+			? massStorage->OpenFile(location.c_str(), mode, preAllocSize, user)
 				: nullptr;
 }
 
@@ -4259,6 +4594,12 @@ bool Platform::FileExists(const char* folder, const char *filename) const
 	return MassStorage::CombineName(location.GetRef(), folder, filename) && massStorage->FileExists(location.c_str());
 }
 
+time_t Platform::GetLastModifiedTime(const char* folder, const char *filename) const
+{
+	String<MaxFilenameLength> location;
+	return (MassStorage::CombineName(location.GetRef(), folder, filename)) ? massStorage->GetLastModifiedTime(location.c_str()) : 0;
+}
+
 bool Platform::DirectoryExists(const char *folder, const char *dir) const
 {
 	String<MaxFilenameLength> location;
@@ -4292,14 +4633,28 @@ bool Platform::SysFileExists(const char *filename) const
 	return MakeSysFileName(location.GetRef(), filename) && massStorage->FileExists(location.c_str());
 }
 
-FileStore* Platform::OpenSysFile(const char *filename, OpenMode mode) const
+FileStore* Platform::OpenSysFile(const char *filename, OpenMode mode, FileUser user) const
 {
 	String<MaxFilenameLength> location;
 	return (MakeSysFileName(location.GetRef(), filename))
-			? massStorage->OpenFile(location.c_str(), mode, 0)
+			? massStorage->OpenFile(location.c_str(), mode, 0, user)
 				: nullptr;
 }
 
+FileStore* Platform::OpenSysMacroFile(const char *filename) const
+{
+	String<MaxFilenameLength> location;
+	if (!MakeSysFileName(location.GetRef(), filename))
+	{
+		return nullptr;
+	}
+#if SUPPORT_MACRO_CACHE
+	return massStorage->OpenMacroFile(location.c_str());
+#else
+	return massStorage->OpenFile(location.c_str(), OpenMode::read, 0, FileUser::job);
+#endif
+}
+
 bool Platform::DeleteSysFile(const char *filename) const
 {
 	String<MaxFilenameLength> location;
@@ -4725,25 +5080,36 @@ GCodeResult Platform::ConfigureStallDetection(GCodeBuffer& gb, const StringRef&
 			logOnStallDrivers &= ~drivers;
 			pauseOnStallDrivers &= ~drivers;
 			rehomeOnStallDrivers &= ~drivers;
+			slowDownOnStallDrivers &= ~drivers;
 			break;
 
 		case 1:
 			rehomeOnStallDrivers &= ~drivers;
 			pauseOnStallDrivers &= ~drivers;
+			slowDownOnStallDrivers &= ~drivers;
 			logOnStallDrivers |= drivers;
 			break;
 
 		case 2:
 			logOnStallDrivers &= ~drivers;
 			rehomeOnStallDrivers &= ~drivers;
+			slowDownOnStallDrivers &= ~drivers;
 			pauseOnStallDrivers |= drivers;
 			break;
 
 		case 3:
 			logOnStallDrivers &= ~drivers;
 			pauseOnStallDrivers &= ~drivers;
+			slowDownOnStallDrivers &= ~drivers;
 			rehomeOnStallDrivers |= drivers;
 			break;
+
+		case 4:
+			logOnStallDrivers &= ~drivers;
+			pauseOnStallDrivers &= ~drivers;
+			rehomeOnStallDrivers &= ~drivers;
+			slowDownOnStallDrivers |= drivers;
+			break;
 		}
 	}
 
@@ -4779,8 +5145,9 @@ GCodeResult Platform::ConfigureStallDetection(GCodeBuffer& gb, const StringRef&
 			buf->catf(", action: %s",
 						(IsBitSet(rehomeOnStallDrivers, drive)) ? "rehome"
 							: (IsBitSet(pauseOnStallDrivers, drive)) ? "pause"
-								: (IsBitSet(logOnStallDrivers, drive)) ? "log"
-									: "none"
+								: (IsBitSet(slowDownOnStallDrivers, drive)) ? "slow down"
+									: (IsBitSet(logOnStallDrivers, drive)) ? "log"
+										: "none"
 					  );
 			printed = true;
 		}
@@ -4860,12 +5227,15 @@ void Platform::Tick()
 	case 1:
 	case 3:
 		{
-			// We read a filtered ADC channel on alternate ticks
-			// Because we are in the tick ISR and no other ISR reads the averaging filter, we can cast away 'volatile' here.
-			ThermistorAveragingFilter& currentFilter = const_cast<ThermistorAveragingFilter&>(adcFilters[currentFilterNumber]);		// cast away 'volatile'
-			currentFilter.ProcessReading(AnalogInReadChannel(filteredAdcChannels[currentFilterNumber]));
+			// We read the filtered ADC channels on alternate ticks. The ADC converts all the enabled channels each tick, so we feed every filter
+			// from the same scan instead of just one of them. Each channel then gets a fresh reading every 2ms however many thermistors there are.
+			// Because we are in the tick ISR and no other ISR reads the averaging filters, we can cast away 'volatile' here.
+			for (size_t filter = 0; filter < NumAdcFilters; ++filter)
+			{
+				const_cast<ThermistorAveragingFilter&>(adcFilters[filter]).ProcessReading(AnalogInReadChannel(filteredAdcChannels[filter]));
+			}
 
-			// Guard against overly long delays between successive calls of PID::Spin().
+			// Guard against overly long delays between successive calls of PID::Spin(). We check one heater each time.
 			// Do not call Time() here, it isn't safe. We use millis() instead.
 			if ((configuredHeaters & (1u << currentFilterNumber)) != 0 && (millis() - reprap.GetHeat().GetLastSampleTime(currentFilterNumber)) > maxPidSpinDelay)
 			{
@@ -4913,6 +5283,11 @@ void Platform::Tick()
 		break;
 	}
 
+	if (IsFilteredZProbeType())
+	{
+		RecordZProbeReading();
+	}
+
 	AnalogInStartConversion();
 }
 
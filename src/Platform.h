@@ -39,6 +39,7 @@ Licence: GPL
 #include "Storage/FileData.h"
 #include "Storage/MassStorage.h"	// must be after Pins.h because it needs NumSdCards defined
 #include "MessageType.h"
+#include "MessageLimiter.h"
 #include "Spindle.h"
 #include "ZProbe.h"
 #include "ZProbeProgrammer.h"
@@ -94,7 +95,7 @@ constexpr unsigned int Z_PROBE_AVERAGE_READINGS = 8;			// We average this number
 // HEATERS - The bed is assumed to be the at index 0
 
 // Define the number of temperature readings we average for each thermistor. This should be a power of 2 and at least 4 ^ AD_OVERSAMPLE_BITS.
-// Keep THERMISTOR_AVERAGE_READINGS * NUM_HEATERS * 2ms no greater than HEAT_SAMPLE_TIME or the PIDs won't work well.
+// Every filter gets a new reading every 2ms, so keep ThermistorAverageReadings * 2ms no greater than the heater sample interval or the PIDs won't work well.
 constexpr unsigned int ThermistorAverageReadings = 32;
 
 constexpr uint32_t maxPidSpinDelay = 5000;			// Maximum elapsed time in milliseconds between successive temp samples by Pid::Spin() permitted for a temp sensor
@@ -209,6 +210,14 @@ enum class DiagnosticTestType : int
 	TimeSinCos = 103,				// do a timing test on the trig functions
 	TimeSDWrite = 104,				// do a write timing test on the SD card
 	PrintObjectSizes = 105,			// print the sizes of various objects
+	StepRateBenchmark = 106,		// run a step generation benchmark using canned moves
+	ClearStepTimingHistograms = 107,	// clear the step ISR duration and step lateness histograms
+	GCodeParseBenchmark = 108,		// time parsing canned lines of GCode
+	SDCardBenchmark = 109,			// measure sequential and random read and write speeds of the SD card
+	TimeCRC32 = 110,				// measure the speed of the CRC32 calculation used for file uploads
+#if SUPPORT_MOVE_TRACE
+	WriteMoveTrace = 111,			// write the trace of recently completed moves to a system file and clear it
+#endif
 
 	SetWriteBuffer = 500,			// enable/disable the write buffer
 
@@ -348,7 +357,7 @@ public:
 	bool SetDateTime(time_t time);							// Sets the current RTC date and time or returns false on error
 
   	// Communications and data storage
-	OutputBuffer *GetAuxGCodeReply();						// Returns cached G-Code reply for AUX devices and clears its reference
+	void EncodeAuxGCodeReply(OutputBuffer *response);		// Append the stored G-Code replies for AUX devices to a JSON response and release them
 	void AppendAuxReply(OutputBuffer *buf, bool rawMessage);
 	void AppendAuxReply(const char *msg, bool rawMessage);
     uint32_t GetAuxSeq() { return auxSeq; }
@@ -373,9 +382,10 @@ public:
 
 	// File functions
 	MassStorage* GetMassStorage() const;
-	FileStore* OpenFile(const char* folder, const char* fileName, OpenMode mode, uint32_t preAllocSize = 0) const;
+	FileStore* OpenFile(const char* folder, const char* fileName, OpenMode mode, uint32_t preAllocSize = 0, FileUser user = FileUser::general) const;
 	bool Delete(const char* folder, const char *filename) const;
 	bool FileExists(const char* folder, const char *filename) const;
+	time_t GetLastModifiedTime(const char* folder, const char *filename) const;
 	bool DirectoryExists(const char *folder, const char *dir) const;
 
 	const char* GetWebDir() const; 					// Where the html etc files are
@@ -387,7 +397,8 @@ public:
 	// Functions to work with the system files folder
 	GCodeResult SetSysDir(const char* dir, const StringRef& reply);				// Set the system files path
 	bool SysFileExists(const char *filename) const;
-	FileStore* OpenSysFile(const char *filename, OpenMode mode) const;
+	FileStore* OpenSysFile(const char *filename, OpenMode mode, FileUser user = FileUser::general) const;
+	FileStore* OpenSysMacroFile(const char *filename) const;						// Open a macro file for reading, from the macro cache if possible
 	bool DeleteSysFile(const char *filename) const;
 	bool MakeSysFileName(const StringRef& result, const char *filename) const;
 	void GetSysDir(const StringRef & path) const;
@@ -433,15 +444,24 @@ public:
 	float Acceleration(size_t axisOrExtruder) const;
 	const float* Accelerations() const;
 	void SetAcceleration(size_t axisOrExtruder, float value);
+	float Deceleration(size_t axisOrExtruder) const;						// the deceleration limit, which is the acceleration limit unless one has been set
+	bool HasSeparateDeceleration(size_t axisOrExtruder) const { return decelerations[axisOrExtruder] > 0.0; }
+	void SetDeceleration(size_t axisOrExtruder, float value);				// a value of zero makes the deceleration limit the same as the acceleration limit
 	float MaxFeedrate(size_t axisOrExtruder) const;
 	const float* MaxFeedrates() const { return maxFeedrates; }
 	void SetMaxFeedrate(size_t axisOrExtruder, float value);
+	float GetMaxExtrusionFlow(size_t extruder) const { return maxExtrusionFlows[extruder]; }	// the maximum volumetric flow in mm^3/sec, or zero if unlimited
+	void SetMaxExtrusionFlow(size_t extruder, float value) { maxExtrusionFlows[extruder] = max<float>(value, 0.0); }
 	float MinMovementSpeed() const { return minimumMovementSpeed; }
 	void SetMinMovementSpeed(float value) { minimumMovementSpeed = max<float>(value, 0.01); }
 	float GetInstantDv(size_t axis) const;
 	void SetInstantDv(size_t axis, float value);
 	EndStopHit Stopped(size_t axisOrExtruder) const;
 	bool EndStopInputState(size_t axis) const;
+	bool AttachEndstopInterrupts(uint32_t inputs);				// make the specified endstop inputs interrupt when they change, returning true if successful
+	void DetachEndstopInterrupts();
+	void FlagEndstopChanged() { endstopChanged = true; }
+	bool CheckEndstopChanged() __attribute__ ((hot));			// return true if an endstop input may have changed since we last checked
 	float AxisMaximum(size_t axis) const;
 	void SetAxisMaximum(size_t axis, float value, bool byProbing);
 	float AxisMinimum(size_t axis) const;
@@ -449,6 +469,10 @@ public:
 	float AxisTotalLength(size_t axis) const;
 	float GetPressureAdvance(size_t extruder) const;
 	void SetPressureAdvance(size_t extruder, float factor);
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	float GetPressureAdvanceSmoothing(size_t extruder) const;
+	void SetPressureAdvanceSmoothing(size_t extruder, float seconds);
+#endif
 
 	void SetEndStopConfiguration(size_t axis, EndStopPosition endstopPos, EndStopInputType inputType)
 		pre(axis < MaxAxes);
@@ -501,6 +525,7 @@ public:
 	bool HomingZWithProbe() const;
 	bool WritePlatformParameters(FileStore *f, bool includingG31) const;
 	void SetProbing(bool isProbing);
+	float GetZProbeTriggerLatency(uint32_t detectedAt) const;
 	GCodeResult ProgramZProbe(GCodeBuffer& gb, const StringRef& reply);
 	void SetZProbeModState(bool b) const;
 
@@ -531,6 +556,7 @@ public:
 
 	bool WriteFanSettings(FileStore *f) const;		// Save some resume information
 	uint32_t GetFanRPM(size_t tachoIndex) const;
+	void ScheduleFanCheck(uint32_t delay);			// Make sure that we check the fans again within 'delay' milliseconds
 
 	// Flash operations
 	void UpdateFirmware();
@@ -628,6 +654,7 @@ private:
 	const char* InternalGetSysDir() const;  		// where the system files are - not thread-safe!
 
 	void RawMessage(MessageType type, const char *message);	// called by Message after handling error/warning flags
+	void LimitedMessage(MessageType type, const char *source, const char *message);	// send an error or warning message unless its source has sent too many lately
 
 	void ResetChannel(size_t chan);					// re-initialise a serial channel
 	float AdcReadingToCpuTemperature(uint32_t reading) const;
@@ -698,6 +725,7 @@ private:
 
 	// Logging
 	Logger *logger;
+	DataLogger *dataLogger;
 
 	// Z probes
 	ZProbe switchZProbeParameters;			// Z probe values for the switch Z-probe
@@ -739,12 +767,19 @@ private:
 	bool directions[MaxTotalDrivers];
 	int8_t enableValues[MaxTotalDrivers];
 	Pin endStopPins[NumEndstops];
+	uint32_t endstopInterruptInputs;					// the endstop inputs that we have attached interrupts to
+	volatile bool endstopChanged;						// set by the endstop interrupt, cleared when the step interrupt checks the endstops
 	float maxFeedrates[MaxTotalDrivers];
+	float maxExtrusionFlows[MaxExtruders];				// the most filament that each hot end can melt in mm^3/sec, or zero if there is no limit
 	float minimumMovementSpeed;
 	float accelerations[MaxTotalDrivers];
+	float decelerations[MaxTotalDrivers];				// zero means use the acceleration
 	float driveStepsPerUnit[MaxTotalDrivers];
 	float instantDvs[MaxTotalDrivers];
 	float pressureAdvance[MaxExtruders];
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+	float pressureAdvanceSmoothing[MaxExtruders];		// the time over which pressure advance is smoothed, or zero for unsmoothed pressure advance
+#endif
 #if SUPPORT_NONLINEAR_EXTRUSION
 	float nonlinearExtrusionA[MaxExtruders], nonlinearExtrusionB[MaxExtruders], nonlinearExtrusionLimit[MaxExtruders];
 #endif
@@ -773,8 +808,8 @@ private:
 #endif
 
 #if HAS_STALL_DETECT
-	DriversBitmap logOnStallDrivers, pauseOnStallDrivers, rehomeOnStallDrivers;
-	DriversBitmap stalledDrivers, stalledDriversToLog, stalledDriversToPause, stalledDriversToRehome;
+	DriversBitmap logOnStallDrivers, pauseOnStallDrivers, rehomeOnStallDrivers, slowDownOnStallDrivers;
+	DriversBitmap stalledDrivers, stalledDriversToLog, stalledDriversToPause, stalledDriversToRehome, stalledDriversToSlowDown;
 #endif
 
 #if defined(DUET_06_085)
@@ -798,6 +833,13 @@ private:
 	volatile ZProbeAveragingFilter zProbeOnFilter;					// Z probe readings we took with the IR turned on
 	volatile ZProbeAveragingFilter zProbeOffFilter;					// Z probe readings we took with the IR turned off
 
+	// Interpolation of the time at which the filtered Z probe reading reached the trigger value during a probing move
+	volatile uint32_t zProbeCrossingClocks;							// step clock time at which the reading reached the trigger value
+	volatile bool zProbeCrossingSeen;
+	volatile bool zProbeRecordingCrossing;							// true during a probing move with a filtered Z probe
+	int zProbePrevValue;											// accessed only in the tick ISR
+	uint32_t zProbePrevClocks;										// accessed only in the tick ISR
+
 	// Thermistors and temperature monitoring
 	volatile ThermistorAveragingFilter adcFilters[NumAdcFilters];	// ADC reading averaging filters
 
@@ -808,6 +850,8 @@ private:
 
 	void InitZProbe();
 	uint16_t GetRawZProbeReading() const;
+	bool IsFilteredZProbeType() const;
+	void RecordZProbeReading();
 
 	// Axes and endstops
 	float axisMaxima[MaxAxes];
@@ -816,6 +860,7 @@ private:
 	EndStopPosition endStopPos[MaxAxes];
 	EndStopInputType endStopInputType[MaxAxes];
 
+	static void EndstopInterrupt(CallbackParameter param);
 	static bool WriteAxisLimits(FileStore *f, AxesBitmap axesProbed, const float limits[MaxAxes], int sParam);
 
 	// Heaters
@@ -823,7 +868,7 @@ private:
 
 	// Fans
 	Fan fans[NUM_FANS];
-	uint32_t lastFanCheckTime;
+	uint32_t nextFanCheckTime;						// when we next need to update the thermostatic and blipping fans
 	void InitFans();
 	bool FansHardwareInverted(size_t fanNumber) const;
 
@@ -839,7 +884,7 @@ private:
 	Mutex auxMutex;
 #endif
 
-	OutputBuffer *auxGCodeReply;				// G-Code reply for AUX devices (special one because it is actually encapsulated before sending)
+	volatile OutputStack auxGCodeReply;			// G-Code replies for AUX devices (special because they are encapsulated before sending). They may be shared with other destinations.
 	uint32_t auxSeq;							// Sequence number for AUX devices
 	bool auxDetected;							// Have we processed at least one G-Code from an AUX device?
 
@@ -851,6 +896,8 @@ private:
 	volatile OutputStack usbOutput;
 	Mutex usbMutex;
 
+	MessageLimiter messageLimiter;				// Limits how often repeated error and warning messages are sent
+
 	// Files
 	MassStorage* massStorage;
 	const char *sysDir;
@@ -990,6 +1037,16 @@ inline void Platform::SetAcceleration(size_t drive, float value)
 	accelerations[drive] = max<float>(value, 1.0);		// don't allow zero or negative
 }
 
+inline float Platform::Deceleration(size_t drive) const
+{
+	return (decelerations[drive] > 0.0) ? decelerations[drive] : accelerations[drive];
+}
+
+inline void Platform::SetDeceleration(size_t drive, float value)
+{
+	decelerations[drive] = (value <= 0.0) ? 0.0 : max<float>(value, 1.0);
+}
+
 inline float Platform::MaxFeedrate(size_t drive) const
 {
 	return maxFeedrates[drive];
@@ -1116,6 +1173,15 @@ inline float Platform::GetPressureAdvance(size_t extruder) const
 	return (extruder < MaxExtruders) ? pressureAdvance[extruder] : 0.0;
 }
 
+#if SUPPORT_PRESSURE_ADVANCE_SMOOTHING
+
+inline float Platform::GetPressureAdvanceSmoothing(size_t extruder) const
+{
+	return (extruder < MaxExtruders) ? pressureAdvanceSmoothing[extruder] : 0.0;
+}
+
+#endif
+
 // This is called by the tick ISR to get the raw Z probe reading to feed to the filter
 inline uint16_t Platform::GetRawZProbeReading() const
 {
@@ -1168,11 +1234,15 @@ inline MassStorage* Platform::GetMassStorage() const
 	return massStorage;
 }
 
-inline OutputBuffer *Platform::GetAuxGCodeReply()
+// This is called by the step ISR. We clear the flag before the caller reads the endstops, so a change that happens while it reads them sets the flag again.
+inline bool Platform::CheckEndstopChanged()
 {
-	OutputBuffer *temp = auxGCodeReply;
-	auxGCodeReply = nullptr;
-	return temp;
+	if (endstopChanged)
+	{
+		endstopChanged = false;
+		return true;
+	}
+	return false;
 }
 
 // *** These next three functions must use the same bit assignments in the drivers bitmap ***
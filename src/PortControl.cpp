@@ -17,52 +17,81 @@ PortControl::PortControl()
 {
 }
 
+/*static*/ bool PortControl::TimerInterrupt(void *param, uint32_t& when)
+{
+	PortControl * const pc = static_cast<PortControl*>(param);
+	return reprap.GetGCodes().GetMachineType() != MachineType::laser && pc->UpdatePortsFromMoves(when);
+}
+
 void PortControl::Init()
 {
 	numConfiguredPorts = 0;
 	advanceMillis = 0;
 	advanceClocks = 0;
 	currentPortState = 0;
+	timerUsable = false;
 }
 
 void PortControl::Exit()
 {
+	timer.CancelCallback();
 	UpdatePorts(0);
 	numConfiguredPorts = 0;
 }
 
-void PortControl::Spin(bool full)
+// Set the ports to the state of the move that will be executing advanceClocks from now.
+// If the move that sets that state is already executing or frozen, set nextChangeTime to the step clock time at which we need to look again and return true.
+// Must be called with the step interrupt disabled, or from the step timer interrupt.
+bool PortControl::UpdatePortsFromMoves(uint32_t& nextChangeTime)
 {
-	if (numConfiguredPorts != 0 && reprap.GetGCodes().GetMachineType() != MachineType::laser)
+	const DDA * cdda = reprap.GetMove().GetCurrentDDA();
+	if (cdda == nullptr)
+	{
+		// Movement has stopped, so turn all ports off
+		UpdatePorts(0);
+		return false;
+	}
+
+	const uint32_t now = StepTimer::GetInterruptClocks() + advanceClocks;
+	uint32_t moveEndTime = cdda->GetMoveStartTime();
+	DDA::DDAState st = cdda->GetState();
+	do
 	{
-		cpu_irq_disable();
-		const DDA * cdda = reprap.GetMove().GetCurrentDDA();
-		if (cdda == nullptr)
+		moveEndTime += cdda->GetClocksNeeded();
+		if ((int32_t)(moveEndTime - now) >= 0)
 		{
-			// Movement has stopped, so turn all ports off
-			cpu_irq_enable();
-			UpdatePorts(0);
+			break;
 		}
-		else
-		{
-			const uint32_t now = StepTimer::GetInterruptClocks() + advanceClocks;
-			uint32_t moveEndTime = cdda->GetMoveStartTime();
-			DDA::DDAState st = cdda->GetState();
-			do
-			{
-				moveEndTime += cdda->GetClocksNeeded();
-				if ((int32_t)(moveEndTime - now) >= 0)
-				{
-					break;
-				}
-				cdda = cdda->GetNext();
-				st = cdda->GetState();
-			} while (st == DDA::executing || st == DDA::frozen);
-			cpu_irq_enable();
+		cdda = cdda->GetNext();
+		st = cdda->GetState();
+	} while (st == DDA::executing || st == DDA::frozen);
 
-			const IoBits_t bits = (st == DDA::executing || st == DDA::frozen || st == DDA::provisional) ? cdda->GetIoBits() : 0;
-			UpdatePorts(bits);
+	const IoBits_t bits = (st == DDA::executing || st == DDA::frozen || st == DDA::provisional) ? cdda->GetIoBits() : 0;
+	UpdatePorts(bits);
+
+	// The next move starts when this one ends. We add 1 so that when the timer fires, the loop above has moved on to it.
+	nextChangeTime = moveEndTime + 1 - advanceClocks;
+	return st == DDA::executing || st == DDA::frozen;
+}
+
+void PortControl::Spin(bool full)
+{
+	if (numConfiguredPorts != 0 && reprap.GetGCodes().GetMachineType() != MachineType::laser)
+	{
+		// When we can use the timer, it changes the ports at the move boundaries and we only need to keep it scheduled.
+		// Otherwise we change them here, so their timing depends on how often we are called.
+		const uint32_t baseprio = ChangeBasePriority(NvicPriorityStep);
+		timer.CancelCallback();
+		uint32_t nextChangeTime;
+		if (UpdatePortsFromMoves(nextChangeTime) && timerUsable)
+		{
+			(void)timer.ScheduleCallback(nextChangeTime, TimerInterrupt, static_cast<void*>(this));		// if it is already due, we will catch up on the next call
 		}
+		RestoreBasePriority(baseprio);
+	}
+	else
+	{
+		timer.CancelCallback();
 	}
 }
 
@@ -72,8 +101,10 @@ bool PortControl::Configure(GCodeBuffer& gb, const StringRef& reply)
 	if (gb.Seen('P'))
 	{
 		seen = true;
+		timer.CancelCallback();
 		UpdatePorts(0);
 		numConfiguredPorts = 0;
+		timerUsable = true;
 		uint32_t portNumbers[MaxPorts];
 		size_t numPorts = MaxPorts;
 		gb.GetUnsignedArray(portNumbers, numPorts, false);
@@ -92,6 +123,10 @@ bool PortControl::Configure(GCodeBuffer& gb, const StringRef& reply)
 				return true;
 			}
 			pm.WriteDigital(false);				// ensure the port is off
+			if (!pm.HasFastAccess())
+			{
+				timerUsable = false;			// e.g. a port on a DueX, which must not be written from an interrupt
+			}
 			if (i >= numConfiguredPorts)
 			{
 				numConfiguredPorts = i + 1;
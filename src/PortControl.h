@@ -10,6 +10,7 @@
 
 #include "RepRapFirmware.h"
 #include "Hardware/IoPorts.h"			// for PinConfiguration
+#include "SoftTimer.h"
 
 class GCodeBuffer;
 
@@ -26,6 +27,9 @@ public:
 
 private:
 	void UpdatePorts(IoBits_t newPortState);
+	bool UpdatePortsFromMoves(uint32_t& nextChangeTime);
+
+	static bool TimerInterrupt(void *param, uint32_t& when);
 
 	static const size_t MaxPorts = 16;		// the port bitmap is currently a 16-bit word
 
@@ -34,6 +38,8 @@ private:
 	unsigned int advanceMillis;
 	uint32_t advanceClocks;
 	IoBits_t currentPortState;
+	bool timerUsable;						// true if all configured ports can be driven from the step timer interrupt
+	SoftTimer timer;						// used to change the port states at move boundaries, when timerUsable is true
 };
 
 #endif
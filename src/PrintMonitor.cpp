@@ -28,7 +28,7 @@ Licence: GPL
 PrintMonitor::PrintMonitor(Platform& p, GCodes& gc) : platform(p), gCodes(gc), isPrinting(false), heatingUp(false),
 	printStartTime(0), pauseStartTime(0), totalPauseTime(0), currentLayer(0), warmUpDuration(0.0),
 	firstLayerDuration(0.0), firstLayerFilament(0.0), firstLayerProgress(0.0), lastLayerChangeTime(0.0),
-	lastLayerFilament(0.0), lastLayerZ(0.0), numLayerSamples(0), layerEstimatedTimeLeft(0.0), printingFileParsed(false)
+	lastLayerFilament(0.0), lastLayerZ(0.0), numLayerSamples(0), layerEstimatedTimeLeft(0.0), printStartMoveTime(0.0), printingFileParsed(false)
 {
 	filenameBeingPrinted[0] = 0;
 	printingFileInfo.Init();
@@ -179,6 +179,7 @@ void PrintMonitor::StartedPrint()
 	heatingUp = false;
 	printStartTime = millis64();
 	warmUpDuration = 0.0;
+	printStartMoveTime = reprap.GetMove().GetCompletedMoveTime();
 }
 
 // Called when the first layer has been finished
@@ -397,6 +398,30 @@ float PrintMonitor::EstimateTimeLeft(PrintEstimationMethod method) const
 				return (timeLeft > 0.0) ? timeLeft : 0.1;
 			}
 			break;
+
+		case simulationBased:
+		{
+			// Use the print time recorded by M37 simulation if we have it, else the one in the slicer comments.
+			// Subtract the planned duration of the moves we have completed, so that the estimate doesn't depend on how evenly the print time is spread through the file or the layers.
+			const uint32_t totalTime = (printingFileInfo.simulatedTime != 0) ? printingFileInfo.simulatedTime : printingFileInfo.printTime;
+			if (totalTime == 0 || heatingUp)
+			{
+				return 0.0;
+			}
+
+			const float moveTimeDone = reprap.GetMove().GetCompletedMoveTime() - printStartMoveTime;
+			const float moveTimeLeft = (float)totalTime - moveTimeDone;
+			if (moveTimeLeft <= 0.0)
+			{
+				return 0.1;
+			}
+
+			// Once we have done enough moves, correct for dwells, waits and speed factor changes by comparing the real print time with the planned move time
+			const float speedCorrection = (moveTimeDone >= ESTIMATION_MIN_MOVE_TIME)
+											? constrain<float>(realPrintDuration/moveTimeDone, 1.0/ESTIMATION_MAX_SPEED_CORRECTION, ESTIMATION_MAX_SPEED_CORRECTION)
+												: 1.0;
+			return moveTimeLeft * speedCorrection;
+		}
 	}
 
 	return 0.0;
@@ -29,6 +29,8 @@ const size_t MAX_LAYER_SAMPLES = 5;					// Number of layer samples for end-time
 const float ESTIMATION_MIN_FILAMENT_USAGE = 0.01;	// Minimum per cent of filament to be printed before the filament-based estimation returns values
 const float ESTIMATION_MIN_FILE_USAGE = 0.001;		// Minimum per cent of the file to be processed before any file-based estimations are made
 const float FIRST_LAYER_SPEED_FACTOR = 0.25;		// First layer speed factor compared to other layers (only for layer-based estimation)
+const float ESTIMATION_MIN_MOVE_TIME = 60.0;		// Seconds of moves to be completed before the simulation-based estimation corrects for the real print speed
+const float ESTIMATION_MAX_SPEED_CORRECTION = 2.0;	// Limit on the correction that the simulation-based estimation applies for the real print speed
 
 const uint32_t PRINTMONITOR_UPDATE_INTERVAL = 200;	// Update interval in milliseconds
 
@@ -36,7 +38,8 @@ enum PrintEstimationMethod
 {
 	filamentBased,
 	fileBased,
-	layerBased
+	layerBased,
+	simulationBased
 };
 
 class PrintMonitor
@@ -90,6 +93,7 @@ class PrintMonitor
 		float filamentUsagePerLayer[MAX_LAYER_SAMPLES];
 		float fileProgressPerLayer[MAX_LAYER_SAMPLES];
 		float layerEstimatedTimeLeft;
+		float printStartMoveTime;						// the planned duration of the moves completed before this print started
 
 		bool printingFileParsed;
 		GCodeFileInfo printingFileInfo;
@@ -4,6 +4,7 @@
 #include "Movement/StepTimer.h"
 #include "FilamentMonitors/FilamentMonitor.h"
 #include "GCodes/GCodes.h"
+#include "GCodes/ConfigCache.h"
 #include "Heating/Heat.h"
 #include "Network.h"
 #include "Platform.h"
@@ -152,7 +153,7 @@ extern "C" void hsmciIdle(uint32_t stBits, uint32_t dmaBits)
 // Macro to build a standard lambda function that includes the necessary type conversions
 #define OBJECT_MODEL_FUNC(_ret) OBJECT_MODEL_FUNC_BODY(RepRap, _ret)
 
-const ObjectModelTableEntry RepRap::objectModelTable[] =
+constexpr ObjectModelTableEntry RepRap::objectModelTable[] =
 {
 	// These entries are temporary pending design of the object model
 	//TODO design the object model
@@ -169,6 +170,8 @@ DEFINE_GET_OBJECT_MODEL_TABLE(RepRap)
 
 // RepRap member functions.
 
+/*static*/ const char * const RepRap::bootPhaseName[numBootPhases] = { "platform", "modules", "SD mount", "config", "network" };
+
 // Do nothing more in the constructor; put what you want in RepRap:Init()
 
 RepRap::RepRap() : toolList(nullptr), currentTool(nullptr), lastWarningMillis(0), activeExtruders(0),
@@ -178,7 +181,9 @@ RepRap::RepRap() : toolList(nullptr), currentTool(nullptr), lastWarningMillis(0)
 #endif
 	spinningModule(noModule), debug(0), stopped(false),
 	active(false), resetting(false), processingConfig(true), beepFrequency(0), beepDuration(0),
-	diagnosticsDestination(MessageType::NoDestinationMessage), justSentDiagnostics(false)
+	configResponseText(nullptr), configResponseLength(0), configResponseCapacity(0), configResponseCachedVersion(0), configResponseVersion(1),
+	diagnosticsDestination(MessageType::NoDestinationMessage), diagnosticsMessageType(MessageType::NoDestinationMessage),
+	nextDiagnosticsSection(NumDiagnosticsSections), whenLastDiagnosticsSection(0), justSentDiagnostics(false)
 {
 	OutputBuffer::Init();
 	platform = new Platform();
@@ -211,8 +216,14 @@ void RepRap::Init()
 {
 	toolListMutex.Create("ToolList");
 	messageBoxMutex.Create("MessageBox");
+	configResponseMutex.Create("ConfigResponse");
+	for (Tool*& t : toolTable)
+	{
+		t = nullptr;
+	}
 
 	platform->Init();
+	bootPhaseEndMillis[bootPlatform] = millis();
 	network->Init();
 	SetName(DEFAULT_MACHINE_NAME);		// Network must be initialised before calling this because this calls SetHostName
 	gCodes->Init();						// must be called before Move::Init
@@ -235,6 +246,7 @@ void RepRap::Init()
 #if SUPPORT_12864_LCD
 	display->Init();
 #endif
+	bootPhaseEndMillis[bootModules] = millis();
 
 	// Set up the timeout of the regular watchdog, and set up the backup watchdog if there is one.
 #if __LPC17xx__
@@ -274,6 +286,7 @@ void RepRap::Init()
 			rslt = platform->GetMassStorage()->Mount(0, reply.GetRef(), false);
 		}
 		while (rslt == GCodeResult::notFinished);
+		bootPhaseEndMillis[bootMountSd] = millis();
 
 		if (rslt == GCodeResult::ok)
 		{
@@ -283,6 +296,7 @@ void RepRap::Init()
 			if (platform->SysFileExists(configFile))
 			{
 				platform->MessageF(UsbMessage, "%s...", configFile);
+				configFile = ConfigCache::GetFileToRun(configFile);
 			}
 			else
 			{
@@ -310,11 +324,15 @@ void RepRap::Init()
 			platform->MessageF(UsbMessage, "%s\n", reply.c_str());
 		}
 	}
+#else
+	bootPhaseEndMillis[bootMountSd] = millis();
 #endif
 	processingConfig = false;
+	bootPhaseEndMillis[bootConfig] = millis();
 
 	// Enable network (unless it's disabled)
 	network->Activate();			// need to do this here, as the configuration GCodes may set IP address etc.
+	bootPhaseEndMillis[bootNetwork] = millis();
 
 #if HAS_HIGH_SPEED_SD
 	hsmci_set_idle_func(hsmciIdle);
@@ -327,6 +345,11 @@ void RepRap::Init()
 
 	fastLoop = UINT32_MAX;
 	slowLoop = 0;
+	ResetModuleSpinTimes();
+	for (uint32_t& t : lastModuleSpinMillis)
+	{
+		t = 0;
+	}
 }
 
 void RepRap::Exit()
@@ -360,73 +383,84 @@ void RepRap::Spin()
 
 	const uint32_t lastTime = StepTimer::GetInterruptClocks();
 
-	ticksInSpinState = 0;
-	spinningModule = modulePlatform;
+	SetSpinningModule(modulePlatform);
 	platform->Spin();
 
 #ifndef RTOS
-	ticksInSpinState = 0;
-	spinningModule = moduleNetwork;
+	SetSpinningModule(moduleNetwork);
 	network->Spin(true);
 #endif
 
-	ticksInSpinState = 0;
-	spinningModule = moduleWebserver;
+	SetSpinningModule(moduleWebserver);
 
-	ticksInSpinState = 0;
-	spinningModule = moduleGcodes;
+	SetSpinningModule(moduleGcodes);
 	gCodes->Spin();
 
-	ticksInSpinState = 0;
-	spinningModule = moduleMove;
+#ifndef RTOS
+	SetSpinningModule(moduleMove);
 	move->Spin();
+#endif
 
 #ifndef RTOS
-	ticksInSpinState = 0;
-	spinningModule = moduleHeat;
+	SetSpinningModule(moduleHeat);
 	heat->Spin();
 #endif
 
 #if SUPPORT_ROLAND
-	ticksInSpinState = 0;
-	spinningModule = moduleRoland;
+	SetSpinningModule(moduleRoland);
 	roland->Spin();
 #endif
 
 #if SUPPORT_SCANNER && !SCANNER_AS_SEPARATE_TASK
-	ticksInSpinState = 0;
-	spinningModule = moduleScanner;
+	SetSpinningModule(moduleScanner);
 	scanner->Spin();
 #endif
 
 #if SUPPORT_IOBITS
-	ticksInSpinState = 0;
-	spinningModule = modulePortControl;
+	SetSpinningModule(modulePortControl);
 	portControl->Spin(true);
 #endif
 
-	ticksInSpinState = 0;
-	spinningModule = modulePrintMonitor;
-	printMonitor->Spin();
+	// The remaining modules don't need attention on every pass, so only spin them when they are due, to keep the loop time short for GCodes and Move
+	if (ModuleSpinIsDue(modulePrintMonitor, PrintMonitorSpinInterval))
+	{
+		SetSpinningModule(modulePrintMonitor);
+		printMonitor->Spin();
+	}
 
-	ticksInSpinState = 0;
-	spinningModule = moduleFilamentSensors;
-	FilamentMonitor::Spin();
+	if (ModuleSpinIsDue(moduleFilamentSensors, FilamentSensorsSpinInterval))
+	{
+		SetSpinningModule(moduleFilamentSensors);
+		FilamentMonitor::Spin();
+	}
 
 #if SUPPORT_12864_LCD
-	ticksInSpinState = 0;
-	spinningModule = moduleDisplay;
-	display->Spin();
+	if (ModuleSpinIsDue(moduleDisplay, DisplaySpinInterval))
+	{
+		SetSpinningModule(moduleDisplay);
+		display->Spin();
+	}
 #endif
 
-	ticksInSpinState = 0;
-	spinningModule = noModule;
+	SetSpinningModule(noModule);
 
-	// Check if we need to send diagnostics
+	// Check if we need to send diagnostics. We send one section of the report per pass so that we don't hold up the main loop for long,
+	// and we wait for output buffers to be freed between sections so that the report doesn't use them all up.
 	if (diagnosticsDestination != MessageType::NoDestinationMessage)
 	{
-		Diagnostics(diagnosticsDestination);
+		diagnosticsMessageType = diagnosticsDestination;
 		diagnosticsDestination = MessageType::NoDestinationMessage;
+		nextDiagnosticsSection = 0;
+		whenLastDiagnosticsSection = millis() - MaxDiagnosticsWaitMillis;
+	}
+	if (   nextDiagnosticsSection < NumDiagnosticsSections
+		&& (OutputBuffer::GetFreeBuffers() >= MinFreeBuffersForDiagnostics || millis() - whenLastDiagnosticsSection >= MaxDiagnosticsWaitMillis)
+	   )
+	{
+		SendDiagnosticsSection(diagnosticsMessageType, nextDiagnosticsSection);
+		++nextDiagnosticsSection;
+		whenLastDiagnosticsSection = millis();
+		justSentDiagnostics = true;
 	}
 
 	// Check if we need to display a cold extrusion warning
@@ -475,44 +509,135 @@ void RepRap::Spin()
 
 void RepRap::Timing(MessageType mtype)
 {
+	// Report how long each phase of starting up took, so that we can see where the boot time goes
+	platform->Message(mtype, "Boot times (ms):");
+	uint32_t phaseStartMillis = 0;
+	for (size_t i = 0; i < numBootPhases; ++i)
+	{
+		platform->MessageF(mtype, " %s %" PRIu32, bootPhaseName[i], bootPhaseEndMillis[i] - phaseStartMillis);
+		phaseStartMillis = bootPhaseEndMillis[i];
+	}
+	platform->Message(mtype, "\n");
+
 	platform->MessageF(mtype, "Slowest loop: %.2fms; fastest: %.2fms\n", (double)(slowLoop * StepTimer::StepClocksToMillis), (double)(fastLoop * StepTimer::StepClocksToMillis));
 	fastLoop = UINT32_MAX;
 	slowLoop = 0;
+
+	// Report the time spent in each module's Spin function since we last reported it
+	platform->Message(mtype, "Spin times total/max (ms):");
+	for (size_t i = 0; i < numModules; ++i)
+	{
+		if (moduleSpinTotalTimes[i] != 0)
+		{
+			platform->MessageF(mtype, " %s %.1f/%.2f", moduleName[i], (double)(moduleSpinTotalTimes[i] * StepTimer::StepClocksToMillis), (double)(moduleSpinMaxTimes[i] * StepTimer::StepClocksToMillis));
+		}
+	}
+	platform->Message(mtype, "\n");
+	ResetModuleSpinTimes();
 }
 
-void RepRap::Diagnostics(MessageType mtype)
+// Record the time spent by the module that was spinning, then make the specified module the spinning one
+void RepRap::SetSpinningModule(Module m)
 {
-	platform->Message(mtype, "=== Diagnostics ===\n");
+	const uint32_t now = StepTimer::GetInterruptClocks();
+	if (spinningModule < numModules)
+	{
+		const uint32_t dt = now - moduleSpinStartTime;
+		moduleSpinTotalTimes[spinningModule] += dt;
+		if (dt > moduleSpinMaxTimes[spinningModule])
+		{
+			moduleSpinMaxTimes[spinningModule] = dt;
+		}
+	}
+	moduleSpinStartTime = now;
+	ticksInSpinState = 0;
+	spinningModule = m;
+}
 
-	// Print the firmware version and board type
+// Return true if the specified module last spun at least the specified number of milliseconds ago, and if so record that it is spinning now
+bool RepRap::ModuleSpinIsDue(Module m, uint32_t interval)
+{
+	const uint32_t now = millis();
+	if (now - lastModuleSpinMillis[m] < interval)
+	{
+		return false;
+	}
+	lastModuleSpinMillis[m] = now;
+	return true;
+}
+
+void RepRap::ResetModuleSpinTimes()
+{
+	for (size_t i = 0; i < numModules; ++i)
+	{
+		moduleSpinTotalTimes[i] = 0;
+		moduleSpinMaxTimes[i] = 0;
+	}
+}
+
+// Send one section of the diagnostics report
+void RepRap::SendDiagnosticsSection(MessageType mtype, unsigned int section)
+{
+	switch (section)
+	{
+	case 0:
+		platform->Message(mtype, "=== Diagnostics ===\n");
+
+		// Print the firmware version and board type
 
 #ifdef DUET_NG
-	platform->MessageF(mtype, "%s version %s running on %s", FIRMWARE_NAME, VERSION, platform->GetElectronicsString());
-	const char* const expansionName = DuetExpansion::GetExpansionBoardName();
-	platform->MessageF(mtype, (expansionName == nullptr) ? "\n" : " + %s\n", expansionName);
+		platform->MessageF(mtype, "%s version %s running on %s", FIRMWARE_NAME, VERSION, platform->GetElectronicsString());
+		{
+			const char* const expansionName = DuetExpansion::GetExpansionBoardName();
+			platform->MessageF(mtype, (expansionName == nullptr) ? "\n" : " + %s\n", expansionName);
+		}
 #else
-	platform->MessageF(mtype, "%s version %s running on %s\n", FIRMWARE_NAME, VERSION, platform->GetElectronicsString());
+		platform->MessageF(mtype, "%s version %s running on %s\n", FIRMWARE_NAME, VERSION, platform->GetElectronicsString());
 #endif
 
 #if SAM4E || SAM4S || SAME70
-	platform->PrintUniqueId(mtype);
+		platform->PrintUniqueId(mtype);
 #endif
 
-	// Show the used and free buffer counts. Do this early in case we are running out of them and the diagnostics get truncated.
-	OutputBuffer::Diagnostics(mtype);
+		// Show the used and free buffer counts. Do this early in case we are running out of them and the diagnostics get truncated.
+		OutputBuffer::Diagnostics(mtype);
+		Tasks::Diagnostics(mtype);
+		break;
 
 	// Now print diagnostics for other modules
-	Tasks::Diagnostics(mtype);
-	platform->Diagnostics(mtype);				// this includes a call to our Timing() function
-	move->Diagnostics(mtype);
-	heat->Diagnostics(mtype);
-	gCodes->Diagnostics(mtype);
-	network->Diagnostics(mtype);
-	FilamentMonitor::Diagnostics(mtype);
+	case 1:
+		platform->Diagnostics(mtype);			// this includes a call to our Timing() function
+		break;
+
+	case 2:
+		move->Diagnostics(mtype);
+		break;
+
+	case 3:
+		heat->Diagnostics(mtype);
+		break;
+
+	case 4:
+		gCodes->Diagnostics(mtype);
+		break;
+
+	case 5:
+		network->Diagnostics(mtype);
+		break;
+
+	case 6:
+		FilamentMonitor::Diagnostics(mtype);
+#if SUPPORT_CAN_EXPANSION
+		CanInterface::Diagnostics(mtype);
+#endif
 #ifdef DUET_NG
-	DuetExpansion::Diagnostics(mtype);
+		DuetExpansion::Diagnostics(mtype);
 #endif
-	justSentDiagnostics = true;
+		break;
+
+	default:
+		break;
+	}
 }
 
 // Turn off the heaters, disable the motors, and deactivate the Heat and Move classes. Leave everything else working.
@@ -618,6 +743,10 @@ void RepRap::AddTool(Tool* tool)
 	}
 	tool->next = *t;
 	*t = tool;
+	if (tool->Number() < (int)MaxIndexedTools)
+	{
+		toolTable[tool->Number()] = tool;
+	}
 	tool->UpdateExtruderAndHeaterCount(activeExtruders, activeToolHeaters);
 	platform->UpdateConfiguredHeaters();
 }
@@ -652,6 +781,10 @@ void RepRap::DeleteTool(Tool* tool)
 			break;
 		}
 	}
+	if (tool->Number() < (int)MaxIndexedTools)
+	{
+		toolTable[tool->Number()] = nullptr;
+	}
 
 	// Delete it
 	Tool::Delete(tool);
@@ -718,6 +851,12 @@ void RepRap::StandbyTool(int toolNumber, bool simulating)
 
 Tool* RepRap::GetTool(int toolNumber) const
 {
+	// Most machines number their tools from zero, so look up low-numbered tools directly
+	if (toolNumber >= 0 && toolNumber < (int)MaxIndexedTools)
+	{
+		return toolTable[toolNumber];
+	}
+
 	MutexLocker lock(toolListMutex);
 	Tool* tool = toolList;
 	while(tool != nullptr)
@@ -850,7 +989,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 	ch = '[';
 	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
 	{
-		response->catf("%c%d", ch, (gCodes->IsAxisHomed(axis)) ? 1 : 0);
+		response->cat(ch);
+		response->catInt((gCodes->IsAxisHomed(axis)) ? 1 : 0);
 		ch = ',';
 	}
 
@@ -868,7 +1008,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 	ch = '[';
 	for (size_t axis = 0; axis < numVisibleAxes; axis++)
 	{
-		response->catf("%c%.3f", ch, HideNan(gCodes->GetUserCoordinate(axis)));
+		response->cat(ch);
+		response->catFloat(HideNan(gCodes->GetUserCoordinate(axis)), 3);
 		ch = ',';
 	}
 
@@ -891,7 +1032,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t drive = 0; drive < numVisibleAxes; drive++)
 		{
-			response->catf("%c%.3f", ch, HideNan(liveCoordinates[drive]));
+			response->cat(ch);
+			response->catFloat(HideNan(liveCoordinates[drive]), 3);
 			ch = ',';
 		}
 
@@ -900,7 +1042,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t extruder = 0; extruder < GetExtrudersInUse(); extruder++)
 		{
-			response->catf("%c%.1f", ch, HideNan(liveCoordinates[gCodes->GetTotalAxes() + extruder]));
+			response->cat(ch);
+			response->catFloat(HideNan(liveCoordinates[gCodes->GetTotalAxes() + extruder]), 1);
 			ch = ',';
 		}
 		if (ch == '[')							// we may have no extruders
@@ -979,7 +1122,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t i = 0; i < NUM_FANS; i++)
 		{
-			response->catf("%c%d", ch, (int)lrintf(platform->GetFanValue(i) * 100.0));
+			response->cat(ch);
+			response->catInt((int)lrintf(platform->GetFanValue(i) * 100.0));
 			ch = ',';
 		}
 		response->cat((ch == '[') ? "[]" : "]");
@@ -1005,7 +1149,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t extruder = 0; extruder < GetExtrudersInUse(); extruder++)
 		{
-			response->catf("%c%.1f", ch, (double)(gCodes->GetExtrusionFactor(extruder)));
+			response->cat(ch);
+			response->catFloat(gCodes->GetExtrusionFactor(extruder), 1);
 			ch = ',';
 		}
 		response->cat((ch == '[') ? "[]" : "]");
@@ -1048,7 +1193,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 				char ch = '[';
 				for (size_t i = 0; i < NumTachos; ++i)
 				{
-					response->catf("%c%" PRIu32, ch, platform->GetFanRPM(i));
+					response->cat(ch);
+					response->catUnsigned(platform->GetFanRPM(i));
 					ch = ',';
 				}
 				response->cat(']');
@@ -1099,7 +1245,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t heater = 0; heater < NumHeaters; heater++)
 		{
-			response->catf("%c%.1f", ch, (double)heat->GetTemperature(heater));
+			response->cat(ch);
+			response->catFloat(heat->GetTemperature(heater), 1);
 			ch = ',';
 		}
 		response->cat((ch == '[') ? "[]" : "]");
@@ -1109,7 +1256,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t heater = 0; heater < NumHeaters; heater++)
 		{
-			response->catf("%c%d", ch, heat->GetStatus(heater));
+			response->cat(ch);
+			response->catInt(heat->GetStatus(heater));
 			ch = ',';
 		}
 		response->cat((ch == '[') ? "[]" : "]");
@@ -1137,7 +1285,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 				ch = '[';
 				for (size_t heater = 0; heater < tool->heaterCount; heater++)
 				{
-					response->catf("%c%.1f", ch, (double)tool->activeTemperatures[heater]);
+					response->cat(ch);
+					response->catFloat(tool->activeTemperatures[heater], 1);
 					ch = ',';
 				}
 				response->cat((ch == '[') ? "[]" : "]");
@@ -1154,7 +1303,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 				ch = '[';
 				for (size_t heater = 0; heater < tool->heaterCount; heater++)
 				{
-					response->catf("%c%.1f", ch, (double)tool->standbyTemperatures[heater]);
+					response->cat(ch);
+					response->catFloat(tool->standbyTemperatures[heater], 1);
 					ch = ',';
 				}
 				response->cat((ch == '[') ? "[]" : "]");
@@ -1460,7 +1610,8 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		ch = '[';
 		for (size_t extruder = 0; extruder < GetExtrudersInUse(); extruder++)		// loop through extruders
 		{
-			response->catf("%c%.1f", ch, (double)(gCodes->GetRawExtruderTotalByDrive(extruder)));
+			response->cat(ch);
+			response->catFloat(gCodes->GetRawExtruderTotalByDrive(extruder), 1);
 			ch = ',';
 		}
 		if (ch == '[')
@@ -1472,7 +1623,7 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 		response->catf("],\"fractionPrinted\":%.1f", (double)((printMonitor->IsPrinting()) ? (gCodes->FractionOfFilePrinted() * 100.0) : 0.0));
 
 		// Byte position of the file being printed
-		response->catf(",\"filePosition\":%lu", gCodes->GetFilePosition());
+		response->catf(",\"filePosition\":%" PRIuFilePos, gCodes->GetFilePosition());
 
 		// First Layer Duration
 		response->catf(",\"firstLayerDuration\":%.1f", (double)(printMonitor->GetFirstLayerDuration()));
@@ -1496,28 +1647,217 @@ OutputBuffer *RepRap::GetStatusResponse(uint8_t type, ResponseSource source)
 			response->catf(",\"filament\":%.1f", (double)(printMonitor->EstimateTimeLeft(filamentBased)));
 
 			// Based on layers
-			response->catf(",\"layer\":%.1f}", (double)(printMonitor->EstimateTimeLeft(layerBased)));
+			response->catf(",\"layer\":%.1f", (double)(printMonitor->EstimateTimeLeft(layerBased)));
+
+			// Based on the simulated or slicer print time less the planned time of the moves done
+			response->catf(",\"simulation\":%.1f}", (double)(printMonitor->EstimateTimeLeft(simulationBased)));
 		}
 	}
 
 	if (source == ResponseSource::AUX)
 	{
-		OutputBuffer *reply = platform->GetAuxGCodeReply();
-		if (response != nullptr)
+		// Send the response to the last command. Do this last
+		response->catf(",\"seq\":%" PRIu32 ",\"resp\":", platform->GetAuxSeq());	// send the response sequence number
+
+		// Send the JSON response
+		platform->EncodeAuxGCodeReply(response);										// also releases the replies
+	}
+	response->cat('}');
+
+	return response;
+}
+
+// Append a value to a binary response in the byte order of the processor, which is little-endian on all the processors we support
+template<class T> static void AppendBinary(OutputBuffer *buf, T val)
+{
+	buf->cat(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+// Get the compact binary status response. This has the same values as the type 1 and type 3 JSON responses except the messages, but needs no formatting.
+// Clients that see the sequence number change should fetch the G-code reply, and clients that want the static values or the messages should ask for a JSON response.
+// All floats are IEEE single precision and all values are little-endian with no padding. The layout is:
+//  uint8 version (currently 1), char status, uint8 numAxes, uint8 numExtruders, uint8 numHeaters, uint8 numFans, uint8 numTools, int8 currentTool,
+//  uint16 axesHomed bitmap, uint32 seq, uint32 seconds since reset, float requested speed, float top speed, float speed factor, float Z babystep,
+//  float user coordinates[numAxes], float machine coordinates[numAxes], float extruder positions[numExtruders], float extrusion factors[numExtruders],
+//  float heater temperatures[numHeaters], uint8 heater states[numHeaters], int8 bed heater, int8 chamber heater, uint8 fan percentages[numFans], int32 probe value,
+//  for each tool: int8 number, uint8 numToolHeaters, float active temperatures[numToolHeaters], float standby temperatures[numToolHeaters],
+//  uint8 printing, float fraction printed, float print duration, float time left by file, filament and layer, uint32 file position, uint16 current layer.
+OutputBuffer *RepRap::GetBinaryStatusResponse(ResponseSource source)
+{
+	OutputBuffer *response;
+	if (!OutputBuffer::Allocate(response))
+	{
+		return nullptr;
+	}
+
+	const size_t numVisibleAxes = gCodes->GetVisibleAxes();
+	const size_t numExtruders = GetExtrudersInUse();
+	unsigned int numTools = 0;
+	{
+		MutexLocker lock(toolListMutex);
+		for (const Tool *tool = toolList; tool != nullptr; tool = tool->Next())
+		{
+			++numTools;
+		}
+	}
+	uint16_t axesHomed = 0;
+	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+	{
+		if (gCodes->IsAxisHomed(axis))
 		{
-			// Send the response to the last command. Do this last
-			response->catf(",\"seq\":%" PRIu32 ",\"resp\":", platform->GetAuxSeq());	// send the response sequence number
+			axesHomed |= 1u << axis;
+		}
+	}
+
+	AppendBinary<uint8_t>(response, 1);
+	AppendBinary<char>(response, GetStatusCharacter());
+	AppendBinary<uint8_t>(response, numVisibleAxes);
+	AppendBinary<uint8_t>(response, numExtruders);
+	AppendBinary<uint8_t>(response, NumHeaters);
+	AppendBinary<uint8_t>(response, NUM_FANS);
+	AppendBinary<uint8_t>(response, numTools);
+	AppendBinary<int8_t>(response, GetCurrentToolNumber());
+	AppendBinary<uint16_t>(response, axesHomed);
+	AppendBinary<uint32_t>(response, (source == ResponseSource::HTTP) ? network->GetHttpReplySeq() : 0);
+	AppendBinary<uint32_t>(response, (uint32_t)(millis64()/1000u));
+	AppendBinary<float>(response, move->GetRequestedSpeed());
+	AppendBinary<float>(response, move->GetTopSpeed());
+	AppendBinary<float>(response, gCodes->GetSpeedFactor());
+	AppendBinary<float>(response, gCodes->GetTotalBabyStepOffset(Z_AXIS));
 
-			// Send the JSON response
-			response->EncodeReply(reply);												// also releases the OutputBuffer chain
+	// Coordinates
+	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+	{
+		AppendBinary<float>(response, gCodes->GetUserCoordinate(axis));
+	}
+	{
+		float liveCoordinates[MaxTotalDrivers];
+#if SUPPORT_ROLAND
+		if (roland->Active())
+		{
+			roland->GetCurrentRolandPosition(liveCoordinates);
+		}
+		else
+#endif
+		{
+			move->LiveCoordinates(liveCoordinates, currentTool);
+		}
+		for (size_t axis = 0; axis < numVisibleAxes; ++axis)
+		{
+			AppendBinary<float>(response, liveCoordinates[axis]);
+		}
+		for (size_t extruder = 0; extruder < numExtruders; ++extruder)
+		{
+			AppendBinary<float>(response, liveCoordinates[gCodes->GetTotalAxes() + extruder]);
 		}
 	}
-	response->cat('}');
+	for (size_t extruder = 0; extruder < numExtruders; ++extruder)
+	{
+		AppendBinary<float>(response, gCodes->GetExtrusionFactor(extruder));
+	}
+
+	// Heaters and fans
+	for (size_t heater = 0; heater < NumHeaters; ++heater)
+	{
+		AppendBinary<float>(response, heat->GetTemperature(heater));
+	}
+	for (size_t heater = 0; heater < NumHeaters; ++heater)
+	{
+		AppendBinary<uint8_t>(response, heat->GetStatus(heater));
+	}
+	AppendBinary<int8_t>(response, (NumBedHeaters > 0) ? heat->GetBedHeater(0) : -1);
+	AppendBinary<int8_t>(response, (NumChamberHeaters > 0) ? heat->GetChamberHeater(0) : -1);
+	for (size_t fan = 0; fan < NUM_FANS; ++fan)
+	{
+		AppendBinary<uint8_t>(response, (uint8_t)lrintf(platform->GetFanValue(fan) * 100.0));
+	}
+	AppendBinary<int32_t>(response, platform->GetZProbeReading());
+
+	// Tool temperatures. The tool list may have changed since we counted the tools, so stop at the number we reported.
+	{
+		MutexLocker lock(toolListMutex);
+		unsigned int toolsLeft = numTools;
+		for (const Tool *tool = toolList; tool != nullptr && toolsLeft != 0; tool = tool->Next())
+		{
+			AppendBinary<int8_t>(response, tool->Number());
+			AppendBinary<uint8_t>(response, tool->heaterCount);
+			for (size_t heater = 0; heater < tool->heaterCount; ++heater)
+			{
+				AppendBinary<float>(response, tool->activeTemperatures[heater]);
+			}
+			for (size_t heater = 0; heater < tool->heaterCount; ++heater)
+			{
+				AppendBinary<float>(response, tool->standbyTemperatures[heater]);
+			}
+			--toolsLeft;
+		}
+		while (toolsLeft != 0)
+		{
+			AppendBinary<int8_t>(response, -1);				// a tool was deleted, so report a dummy one with no heaters
+			AppendBinary<uint8_t>(response, 0);
+			--toolsLeft;
+		}
+	}
+
+	// Print progress
+	const bool printing = printMonitor->IsPrinting();
+	AppendBinary<uint8_t>(response, (printing) ? 1 : 0);
+	AppendBinary<float>(response, (printing) ? gCodes->FractionOfFilePrinted() : 0.0);
+	AppendBinary<float>(response, printMonitor->GetPrintDuration());
+	AppendBinary<float>(response, printMonitor->EstimateTimeLeft(fileBased));
+	AppendBinary<float>(response, printMonitor->EstimateTimeLeft(filamentBased));
+	AppendBinary<float>(response, printMonitor->EstimateTimeLeft(layerBased));
+	AppendBinary<uint32_t>(response, (uint32_t)gCodes->GetFilePosition());
+	AppendBinary<uint16_t>(response, printMonitor->GetCurrentLayer());
 
 	return response;
 }
 
+// Get the config response. It only changes when the configuration does, so we return a copy of the last one unless ConfigResponseChanged has been called since.
 OutputBuffer *RepRap::GetConfigResponse()
+{
+	MutexLocker lock(configResponseMutex);
+	const uint32_t version = configResponseVersion;
+	if (configResponseText != nullptr && configResponseCachedVersion == version)
+	{
+		OutputBuffer *response;
+		if (!OutputBuffer::Allocate(response))
+		{
+			return nullptr;
+		}
+		response->copy(configResponseText, configResponseLength);
+		if (response->HadOverflow())
+		{
+			OutputBuffer::ReleaseAll(response);
+			return nullptr;
+		}
+		return response;
+	}
+
+	OutputBuffer * const response = MakeConfigResponse();
+	if (response != nullptr && !response->HadOverflow())
+	{
+		// Keep a copy of the text. Grow the buffer when we need to but never shrink it, to avoid fragmenting the heap.
+		const size_t length = response->Length();
+		if (length > configResponseCapacity)
+		{
+			delete[] configResponseText;
+			configResponseCapacity = length + 64;
+			configResponseText = new char[configResponseCapacity];
+		}
+		configResponseLength = 0;
+		for (const OutputBuffer *buf = response; buf != nullptr; buf = buf->Next())
+		{
+			memcpy(configResponseText + configResponseLength, buf->Data(), buf->DataLength());
+			configResponseLength += buf->DataLength();
+		}
+		configResponseCachedVersion = version;
+	}
+	return response;
+}
+
+// Build the config response
+OutputBuffer *RepRap::MakeConfigResponse()
 {
 	// We need some resources to return a valid config response...
 	OutputBuffer *response;
@@ -1533,7 +1873,8 @@ OutputBuffer *RepRap::GetConfigResponse()
 	char ch = '[';
 	for (size_t axis = 0; axis < numAxes; axis++)
 	{
-		response->catf("%c%.2f", ch, (double)(platform->AxisMinimum(axis)));
+		response->cat(ch);
+		response->catFloat(platform->AxisMinimum(axis), 2);
 		ch = ',';
 	}
 
@@ -1542,7 +1883,8 @@ OutputBuffer *RepRap::GetConfigResponse()
 	ch = '[';
 	for (size_t axis = 0; axis < numAxes; axis++)
 	{
-		response->catf("%c%.2f", ch, (double)(platform->AxisMaximum(axis)));
+		response->cat(ch);
+		response->catFloat(platform->AxisMaximum(axis), 2);
 		ch = ',';
 	}
 
@@ -1551,7 +1893,8 @@ OutputBuffer *RepRap::GetConfigResponse()
 	ch = '[';
 	for (size_t drive = 0; drive < MaxTotalDrivers; drive++)
 	{
-		response->catf("%c%.2f", ch, (double)(platform->Acceleration(drive)));
+		response->cat(ch);
+		response->catFloat(platform->Acceleration(drive), 2);
 		ch = ',';
 	}
 
@@ -1560,7 +1903,8 @@ OutputBuffer *RepRap::GetConfigResponse()
 	ch = '[';
 	for (size_t drive = 0; drive < MaxTotalDrivers; drive++)
 	{
-		response->catf("%c%.2f", ch, (double)(platform->GetMotorCurrent(drive, 906)));
+		response->cat(ch);
+		response->catFloat(platform->GetMotorCurrent(drive, 906), 2);
 		ch = ',';
 	}
 
@@ -1614,7 +1958,8 @@ OutputBuffer *RepRap::GetConfigResponse()
 	ch = '[';
 	for (size_t drive = 0; drive < MaxTotalDrivers; drive++)
 	{
-		response->catf("%c%.2f", ch, (double)(platform->GetInstantDv(drive)));
+		response->cat(ch);
+		response->catFloat(platform->GetInstantDv(drive), 2);
 		ch = ',';
 	}
 
@@ -1623,7 +1968,8 @@ OutputBuffer *RepRap::GetConfigResponse()
 	ch = '[';
 	for (size_t drive = 0; drive < MaxTotalDrivers; drive++)
 	{
-		response->catf("%c%.2f", ch, (double)(platform->MaxFeedrate(drive)));
+		response->cat(ch);
+		response->catFloat(platform->MaxFeedrate(drive), 2);
 		ch = ',';
 	}
 
@@ -1667,7 +2013,8 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 	response->catf("[%.1f", (double)((bedHeater == -1) ? 0.0 : heat->GetTemperature(bedHeater)));
 	for (size_t heater = DefaultE0Heater; heater < GetToolHeatersInUse(); heater++)
 	{
-		response->catf("%c%.1f", ch, (double)(heat->GetTemperature(heater)));
+		response->cat(ch);
+		response->catFloat(heat->GetTemperature(heater), 1);
 		ch = ',';
 	}
 	response->cat((ch == '[') ? "[]" : "]");
@@ -1705,7 +2052,8 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 	for (size_t axis = 0; axis < numVisibleAxes; axis++)
 	{
 		// Coordinates may be NaNs, for example when delta or SCARA homing fails. Replace any NaNs or infinities by 9999.9 to prevent JSON parsing errors.
-		response->catf("%c%.3f", ch, HideNan(gCodes->GetUserCoordinate(axis)));
+		response->cat(ch);
+		response->catFloat(HideNan(gCodes->GetUserCoordinate(axis)), 3);
 		ch = ',';
 	}
 
@@ -1716,7 +2064,8 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 	ch = '[';
 	for (size_t drive = 0; drive < numVisibleAxes; drive++)
 	{
-		response->catf("%c%.3f", ch, HideNan(liveCoordinates[drive]));
+		response->cat(ch);
+		response->catFloat(HideNan(liveCoordinates[drive]), 3);
 		ch = ',';
 	}
 
@@ -1725,7 +2074,8 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 	ch = '[';
 	for (size_t i = 0; i < GetExtrudersInUse(); ++i)
 	{
-		response->catf("%c%.2f", ch, (double)(gCodes->GetExtrusionFactor(i)));
+		response->cat(ch);
+		response->catFloat(gCodes->GetExtrusionFactor(i), 2);
 		ch = ',';
 	}
 	response->cat((ch == '[') ? "[]" : "]");
@@ -1771,7 +2121,8 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 			char ch = '[';
 			for (size_t i = 0; i < NumTachos; ++i)
 			{
-				response->catf("%c%" PRIu32, ch, platform->GetFanRPM(i));
+				response->cat(ch);
+				response->catUnsigned(platform->GetFanRPM(i));
 				ch = ',';
 			}
 			response->cat(']');
@@ -1787,7 +2138,8 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 	ch = '[';
 	for (size_t axis = 0; axis < numVisibleAxes; ++axis)
 	{
-		response->catf("%c%d", ch, (gCodes->IsAxisHomed(axis)) ? 1 : 0);
+		response->cat(ch);
+		response->catInt((gCodes->IsAxisHomed(axis)) ? 1 : 0);
 		ch = ',';
 	}
 	response->cat(']');
@@ -1858,7 +2210,7 @@ OutputBuffer *RepRap::GetLegacyStatusResponse(uint8_t type, int seq)
 		response->catf(",\"seq\":%d,\"resp\":", auxSeq);					// send the response sequence number
 
 		// Send the JSON response
-		response->EncodeReply(platform->GetAuxGCodeReply());				// also releases the OutputBuffer chain
+		platform->EncodeAuxGCodeReply(response);							// also releases the replies
 	}
 
 	response->cat('}');
@@ -1894,38 +2246,27 @@ OutputBuffer *RepRap::GetFilesResponse(const char *dir, unsigned int startAt, bo
 	{
 		err = 0;
 		FileInfo fileInfo;
-		unsigned int filesFound = 0;
-		bool gotFile = platform->GetMassStorage()->FindFirst(dir, fileInfo);
-
 		size_t bytesLeft = OutputBuffer::GetBytesLeft(response);	// don't write more bytes than we can
 
-		while (gotFile)
+		for (unsigned int fileNum = startAt; platform->GetMassStorage()->GetDirectoryEntry(dir, fileNum, fileInfo); ++fileNum)
 		{
-			if (fileInfo.fileName[0] != '.')						// ignore Mac resource files and Linux hidden files
+			// Make sure we can end this response properly
+			if (bytesLeft < fileInfo.fileName.strlen() * 2 + 20)
 			{
-				if (filesFound >= startAt)
-				{
-					// Make sure we can end this response properly
-					if (bytesLeft < fileInfo.fileName.strlen() * 2 + 20)
-					{
-						// No more space available - stop here
-						platform->GetMassStorage()->AbandonFindNext();
-						nextFile = filesFound;
-						break;
-					}
-
-					// Write separator and filename
-					if (filesFound != startAt)
-					{
-						bytesLeft -= response->cat(',');
-					}
+				// No more space available - stop here
+				nextFile = fileNum;
+				break;
+			}
 
-					bytesLeft -= response->EncodeString(fileInfo.fileName, false, flagsDirs && fileInfo.isDirectory);
-				}
-				++filesFound;
+			// Write separator and filename
+			if (fileNum != startAt)
+			{
+				bytesLeft -= response->cat(',');
 			}
-			gotFile = platform->GetMassStorage()->FindNext(fileInfo);
+
+			bytesLeft -= response->EncodeString(fileInfo.fileName, false, flagsDirs && fileInfo.isDirectory);
 		}
+		platform->GetMassStorage()->EndDirectoryListing();
 	}
 
 	if (err != 0)
@@ -1967,53 +2308,43 @@ OutputBuffer *RepRap::GetFilelistResponse(const char *dir, unsigned int startAt)
 	{
 		err = 0;
 		FileInfo fileInfo;
-		unsigned int filesFound = 0;
-		bool gotFile = platform->GetMassStorage()->FindFirst(dir, fileInfo);
 		size_t bytesLeft = OutputBuffer::GetBytesLeft(response);	// don't write more bytes than we can
 
-		while (gotFile)
+		for (unsigned int fileNum = startAt; platform->GetMassStorage()->GetDirectoryEntry(dir, fileNum, fileInfo); ++fileNum)
 		{
-			if (fileInfo.fileName[0] != '.')			// ignore Mac resource files and Linux hidden files
+			// Make sure we can end this response properly
+			if (bytesLeft < fileInfo.fileName.strlen() * 2 + 50)
 			{
-				if (filesFound >= startAt)
-				{
-					// Make sure we can end this response properly
-					if (bytesLeft < fileInfo.fileName.strlen() * 2 + 50)
-					{
-						// No more space available - stop here
-						platform->GetMassStorage()->AbandonFindNext();
-						nextFile = filesFound;
-						break;
-					}
+				// No more space available - stop here
+				nextFile = fileNum;
+				break;
+			}
 
-					// Write delimiter
-					if (filesFound != startAt)
-					{
-						bytesLeft -= response->cat(',');
-					}
+			// Write delimiter
+			if (fileNum != startAt)
+			{
+				bytesLeft -= response->cat(',');
+			}
 
-					// Write another file entry
-					bytesLeft -= response->catf("{\"type\":\"%c\",\"name\":", fileInfo.isDirectory ? 'd' : 'f');
-					bytesLeft -= response->EncodeString(fileInfo.fileName, false);
-					bytesLeft -= response->catf(",\"size\":%" PRIu32, fileInfo.size);
+			// Write another file entry
+			bytesLeft -= response->catf("{\"type\":\"%c\",\"name\":", fileInfo.isDirectory ? 'd' : 'f');
+			bytesLeft -= response->EncodeString(fileInfo.fileName, false);
+			bytesLeft -= response->catf(",\"size\":%" PRIuFilePos, fileInfo.size);
 
-					const struct tm * const timeInfo = gmtime(&fileInfo.lastModified);
-					if (timeInfo->tm_year <= /*19*/80)
-					{
-						// Don't send the last modified date if it is invalid
-						bytesLeft -= response->cat('}');
-					}
-					else
-					{
-						bytesLeft -= response->catf(",\"date\":\"%04u-%02u-%02uT%02u:%02u:%02u\"}",
-								timeInfo->tm_year + 1900, timeInfo->tm_mon + 1, timeInfo->tm_mday,
-								timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
-					}
-				}
-				++filesFound;
+			const struct tm * const timeInfo = gmtime(&fileInfo.lastModified);
+			if (timeInfo->tm_year <= /*19*/80)
+			{
+				// Don't send the last modified date if it is invalid
+				bytesLeft -= response->cat('}');
+			}
+			else
+			{
+				bytesLeft -= response->catf(",\"date\":\"%04u-%02u-%02uT%02u:%02u:%02u\"}",
+						timeInfo->tm_year + 1900, timeInfo->tm_mon + 1, timeInfo->tm_mday,
+						timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
 			}
-			gotFile = platform->GetMassStorage()->FindNext(fileInfo);
 		}
+		platform->GetMassStorage()->EndDirectoryListing();
 	}
 
 	// If there is no error, don't append "err":0 because if we do then DWC thinks there has been an error - looks like it doesn't check the value
@@ -2060,7 +2391,7 @@ bool RepRap::GetFileInfoResponse(const char *filename, OutputBuffer *&response,
 
 	if (info.isValid)
 	{
-		response->printf("{\"err\":0,\"size\":%lu,",info.fileSize);
+		response->printf("{\"err\":0,\"size\":%" PRIuFilePos ",", info.fileSize);
 		const struct tm * const timeInfo = gmtime(&info.lastModifiedTime);
 		if (timeInfo->tm_year > /*19*/80)
 		{
@@ -2090,7 +2421,8 @@ bool RepRap::GetFileInfoResponse(const char *filename, OutputBuffer *&response,
 		{
 			for (size_t i = 0; i < info.numFilaments; ++i)
 			{
-				response->catf("%c%.1f", ch, HideNan(info.filamentNeeded[i]));
+				response->cat(ch);
+				response->catFloat(HideNan(info.filamentNeeded[i]), 1);
 				ch = ',';
 			}
 		}
@@ -55,8 +55,9 @@ public:
 	void Init();
 	void Spin();
 	void Exit();
-	void Diagnostics(MessageType mtype);
-	void DeferredDiagnostics(MessageType mtype) { diagnosticsDestination = mtype; }
+	void Diagnostics(MessageType mtype) { diagnosticsDestination = mtype; }	// Start sending the diagnostics report. The main task sends it a section at a time.
+	uint32_t GetSlowestLoopClocks() const { return slowLoop; }	// these two cover the time since we last reported diagnostics
+	uint32_t GetFastestLoopClocks() const { return (fastLoop == UINT32_MAX) ? 0 : fastLoop; }
 	void Timing(MessageType mtype);
 
 	bool Debug(Module module) const;
@@ -116,7 +117,9 @@ public:
 	uint16_t GetToolHeatersInUse() const;
 
 	OutputBuffer *GetStatusResponse(uint8_t type, ResponseSource source);
+	OutputBuffer *GetBinaryStatusResponse(ResponseSource source);
 	OutputBuffer *GetConfigResponse();
+	void ConfigResponseChanged() { ++configResponseVersion; }		// Called when something that the config response reports has changed
 	OutputBuffer *GetLegacyStatusResponse(uint8_t type, int seq);
 	OutputBuffer *GetFilesResponse(const char* dir, unsigned int startAt, bool flagsDirs);
 	OutputBuffer *GetFilelistResponse(const char* dir, unsigned int startAt);
@@ -140,16 +143,29 @@ public:
 	void KickHeatTaskWatchdog() { heatTaskIdleTicks = 0; }
 #endif
 
+	char GetStatusCharacter() const;						// Return the status character that M408 reports
+
 protected:
 	DECLARE_OBJECT_MODEL
 
 private:
 	static void EncodeString(StringRef& response, const char* src, size_t spaceToLeave, bool allowControlChars = false, char prefix = 0);
 
-	char GetStatusCharacter() const;
+	void SetSpinningModule(Module m);			// Record the time spent by the module that was spinning and start timing the next one
+	void ResetModuleSpinTimes();
+	bool ModuleSpinIsDue(Module m, uint32_t interval);
+	void SendDiagnosticsSection(MessageType mtype, unsigned int section);
 
 	static constexpr uint32_t MaxTicksInSpinState = 20000;	// timeout before we reset the processor
 	static constexpr uint32_t HighTicksInSpinState = 16000;	// how long before we warn that timeout is approaching
+	static constexpr unsigned int NumDiagnosticsSections = 7;
+	static constexpr unsigned int MinFreeBuffersForDiagnostics = 4;	// how many output buffers must be free before we send the next diagnostics section
+	static constexpr uint32_t MaxDiagnosticsWaitMillis = 1000;	// if they don't become free in this time then we send it anyway
+
+	// Minimum intervals in milliseconds between calls to the Spin functions of the modules that don't need attention on every pass of the main loop
+	static constexpr uint32_t PrintMonitorSpinInterval = 50;		// the print monitor does its own sampling at longer intervals
+	static constexpr uint32_t FilamentSensorsSpinInterval = 10;	// the Duet3D filament monitors buffer 64 edges, which is at least 32ms of data
+	static constexpr uint32_t DisplaySpinInterval = 5;			// the display polls the rotary encoder, so it needs to spin often enough to keep up with it
 
 	Platform* platform;
 	Network* network;
@@ -168,8 +184,11 @@ private:
  	Display *display;
 #endif
 
- 	Mutex toolListMutex, messageBoxMutex;
+ 	Mutex toolListMutex, messageBoxMutex, configResponseMutex;
+	static constexpr size_t MaxIndexedTools = 32;	// tools numbered below this can be looked up directly in the tool table
+
 	Tool* toolList;								// the tool list is sorted in order of increasing tool number
+	Tool* toolTable[MaxIndexedTools];			// the tools with numbers below MaxIndexedTools, indexed by tool number
 	Tool* currentTool;
 	uint32_t lastWarningMillis;					// When we last sent a warning message for things that can happen very often
 
@@ -182,6 +201,15 @@ private:
 #endif
 	Module spinningModule;
 	uint32_t fastLoop, slowLoop;
+	uint32_t moduleSpinStartTime;				// The step clock time at which the spinning module started its Spin function
+	uint64_t moduleSpinTotalTimes[numModules];	// The step clocks spent in each module's Spin function since we last reported them
+	uint32_t moduleSpinMaxTimes[numModules];	// The longest time in step clocks that each module's Spin function took since we last reported them
+	uint32_t lastModuleSpinMillis[numModules];	// When we last called the Spin function of each module that doesn't spin on every pass
+
+	// The phases of starting up, in the order they happen, and the millis() time at which each one finished
+	enum BootPhase : uint8_t { bootPlatform = 0, bootModules, bootMountSd, bootConfig, bootNetwork, numBootPhases };
+	static const char * const bootPhaseName[numBootPhases];
+	uint32_t bootPhaseEndMillis[numBootPhases];
 
 	uint32_t debug;
 	bool stopped;
@@ -198,8 +226,19 @@ private:
 
 	MessageBox mbox;					// message box data
 
+	// Cached config response. The OutputBuffers of a response are used up as it is sent, so we keep a copy of the text instead of a chain.
+	OutputBuffer *MakeConfigResponse();
+	char *configResponseText;
+	size_t configResponseLength;
+	size_t configResponseCapacity;
+	uint32_t configResponseCachedVersion;
+	volatile uint32_t configResponseVersion;
+
 	// Deferred diagnostics
-	MessageType diagnosticsDestination;
+	MessageType diagnosticsDestination;			// where the next report is to go, set by Diagnostics() which may be called by other tasks
+	MessageType diagnosticsMessageType;			// where the report we are sending is going
+	unsigned int nextDiagnosticsSection;		// the next section of that report to send, or NumDiagnosticsSections if we have finished
+	uint32_t whenLastDiagnosticsSection;
 	bool justSentDiagnostics;
 };
 
@@ -43,6 +43,15 @@ typedef uint16_t PwmFrequency;		// type used to represent a PWM frequency. 0 som
 #include "General/StringFunctions.h"
 #include "General/BitMap.h"
 
+// Attribute for the functions that the step interrupt runs. If SUPPORT_RAM_STEP_ISR is set then the startup code copies them to RAM along with the other
+// RAMFUNCs, so that step timing doesn't depend on flash wait states or on whether the code is still in the cache. The functions are called from flash code
+// and call flash code, which is too far away for a BL instruction, hence long_call.
+#if SUPPORT_RAM_STEP_ISR && (SAM4E || SAME70)
+# define STEP_ISR_CODE	__attribute__ ((hot, noinline, long_call, section(".ramfunc")))
+#else
+# define STEP_ISR_CODE	__attribute__ ((hot))
+#endif
+
 // Module numbers and names, used for diagnostics and debug
 // All of these including noModule must be <= 15 because we 'or' the module number into the software reset code
 enum Module : uint8_t
@@ -92,6 +101,7 @@ class GCodeQueue;
 class FilamentMonitor;
 class RandomProbePointSet;
 class Logger;
+class DataLogger;
 
 #if SUPPORT_IOBITS
 class PortControl;
@@ -268,9 +278,16 @@ constexpr float RadiansToDegrees = 180.0/3.141592653589793;
 
 #define DEGREE_SYMBOL	"\xC2\xB0"									// degree-symbol encoding in UTF8
 
-// Type of an offset in a file
+// Type of an offset in a file. This must be the same size as FSIZE_t in FatFS, which is 64 bits when exFAT is enabled.
+#ifdef __LPC17xx__
 typedef uint32_t FilePosition;
 const FilePosition noFilePosition = 0xFFFFFFFF;
+#define PRIuFilePos		PRIu32
+#else
+typedef uint64_t FilePosition;
+const FilePosition noFilePosition = 0xFFFFFFFFFFFFFFFFull;
+#define PRIuFilePos		PRIu64
+#endif
 
 #ifdef RTOS
 
@@ -280,12 +297,15 @@ namespace TaskPriority
 	static constexpr int SpinPriority = 1;							// priority for tasks that rarely block
 	static constexpr int HeatPriority = 2;
 	static constexpr int DhtPriority = 2;
+	static constexpr int SpiSensorPriority = 2;
 	static constexpr int TmcPriority = 2;
 	static constexpr int AinPriority = 2;
+	static constexpr int FileWriterPriority = 2;
 	static constexpr int DueXPriority = 3;
 	static constexpr int LaserPriority = 3;
 	static constexpr int CanSenderPriority = 3;
 	static constexpr int CanReceiverPriority = 3;
+	static constexpr int MovePriority = 4;							// the Move task must prepare moves in time even when other tasks are busy
 }
 
 #endif
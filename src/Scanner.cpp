@@ -172,13 +172,14 @@ void Scanner::Spin()
 
 		case ScannerState::Uploading:
 		{
-			// Write incoming scan data from USB to the file
-			int bytesToRead = SERIAL_MAIN_DEVICE.available();
+			// Write incoming scan data from USB to the file. Never read more than the upload size, because the scanner may send commands after the data.
+			size_t bytesToRead = min<size_t>(SERIAL_MAIN_DEVICE.available(), uploadBytesLeft);
+			bool ok = true;
 			FileWriteBuffer *buf = fileBeingUploaded->GetWriteBuffer();
 			if (buf != nullptr)
 			{
-				// Copy whole blocks from the USB RX buffer
-				if (bytesToRead > (int)buf->BytesLeft())
+				// Copy whole blocks from the USB RX buffer straight into the file write buffer
+				if (bytesToRead > buf->BytesLeft())
 				{
 					bytesToRead = buf->BytesLeft();
 				}
@@ -189,45 +190,30 @@ void Scanner::Spin()
 
 				// Note we call FileStore::Write here instead of FileStore::Flush because we
 				// do not want to update the FS table every time an upload buffer is written
-				if ((buf->BytesLeft() == 0 || uploadBytesLeft == 0) && !fileBeingUploaded->Write(buf->Data(), 0))
-				{
-					fileBeingUploaded->Close();
-					fileBeingUploaded = nullptr;
-					platform.Delete(SCANS_DIRECTORY, uploadFilename);
-
-					platform.Message(ErrorMessage, "Failed to write scan file\n");
-					SetState(ScannerState::Idle);
-					break;
-				}
+				ok = (buf->BytesLeft() != 0 && uploadBytesLeft != 0) || fileBeingUploaded->Write(buf->Data(), 0);
 			}
-			else
+			else if (bytesToRead != 0)
 			{
-				// Write data character by character if there is no file write buffer available
-				while (bytesToRead > 0)
+				// There is no file write buffer available, so copy the data through a small local buffer instead of one character at a time
+				char chunk[64];
+				if (bytesToRead > sizeof(chunk))
 				{
-					char b = static_cast<char>(SERIAL_MAIN_DEVICE.read());
-					bytesToRead--;
+					bytesToRead = sizeof(chunk);
+				}
+				SERIAL_MAIN_DEVICE.readBytes(chunk, bytesToRead);
+				uploadBytesLeft -= bytesToRead;
+				ok = fileBeingUploaded->Write(chunk, bytesToRead);
+			}
 
-					if (fileBeingUploaded->Write(&b, sizeof(char)))
-					{
-						uploadBytesLeft--;
-						if (uploadBytesLeft == 0)
-						{
-							// Upload complete
-							break;
-						}
-					}
-					else
-					{
-						fileBeingUploaded->Close();
-						fileBeingUploaded = nullptr;
-						platform.Delete(SCANS_DIRECTORY, uploadFilename);
+			if (!ok)
+			{
+				fileBeingUploaded->Close();
+				fileBeingUploaded = nullptr;
+				platform.Delete(SCANS_DIRECTORY, uploadFilename);
 
-						platform.Message(ErrorMessage, "Failed to write scan file\n");
-						SetState(ScannerState::Idle);
-						break;
-					}
-				}
+				platform.Message(ErrorMessage, "Failed to write scan file\n");
+				SetState(ScannerState::Idle);
+				break;
 			}
 
 			// Have we finished this upload?
@@ -249,14 +235,20 @@ void Scanner::Spin()
 		default:
 			// Pick up incoming commands only if the GCodeBuffer is idle.
 			// The GCodes class will do the processing for us.
-			if (serialGCode->IsIdle() && SERIAL_MAIN_DEVICE.available() > 0)
+			// Read all the characters that are waiting, until we have processed a command that changes the state or gives the GCodeBuffer something to do.
+			while (serialGCode->IsIdle() && SERIAL_MAIN_DEVICE.available() > 0)
 			{
 				char b = static_cast<char>(SERIAL_MAIN_DEVICE.read());
 				if (b == '\n' || b == '\r')
 				{
 					buffer[bufferPointer] = 0;
+					const ScannerState oldState = state;
 					ProcessCommand();
 					bufferPointer = 0;
+					if (state != oldState)
+					{
+						break;							// in particular, if we are uploading then the following bytes are data
+					}
 				}
 				else
 				{
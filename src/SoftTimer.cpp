@@ -8,60 +8,124 @@
 #include "SoftTimer.h"
 #include "Movement/StepTimer.h"
 
-SoftTimer * volatile SoftTimer::pendingList = nullptr;
+SoftTimer *SoftTimer::pendingHeap[MaxPendingTimers];
+size_t SoftTimer::numPending = 0;
 
-SoftTimer::SoftTimer() : next(nullptr), callback(nullptr)
+SoftTimer::SoftTimer() : heapIndex(NotPending), callback(nullptr)
 {
 }
 
 // Schedule a callback at a particular tick count, returning true if it was not scheduled because it is already due or imminent.
-// There must be no callback already scheduled for this timer, else the linked list will get messed up. If in doubt, call CancelCallback before calling this.
+// If a callback is already scheduled for this timer, it is replaced.
 bool SoftTimer::ScheduleCallback(Ticks when, Callback cb, void *param)
 {
+	const uint32_t baseprio = ChangeBasePriority(NvicPriorityStep);
+	if (IsPending())
+	{
+		Remove(heapIndex);
+	}
+
 	whenDue = when;
 	callback = cb;
 	cbParam = param;
 
-	const uint32_t baseprio = ChangeBasePriority(NvicPriorityStep);
-	const Ticks now = GetTimerTicksNow();
-	const int32_t howSoon = (int32_t)(when - now);
-	SoftTimer** ppst = const_cast<SoftTimer**>(&pendingList);
-	if (*ppst == nullptr || howSoon < (int32_t)((*ppst)->whenDue - now))
+	if (numPending == MaxPendingTimers)
 	{
-		// No other callbacks are scheduled, or this one is due earlier than the first existing one
-		if (StepTimer::ScheduleSoftTimerInterrupt(when))
-		{
-			RestoreBasePriority(baseprio);
-			return true;
-		}
+		// We should never have this many timers. Tell the caller it's due, because that's better than losing the callback.
+		RestoreBasePriority(baseprio);
+		return true;
 	}
-	else
+
+	Insert(this);
+	if (heapIndex == 0 && StepTimer::ScheduleSoftTimerInterrupt(when))
 	{
-		while (*ppst != nullptr && (int32_t)((*ppst)->whenDue - now) < howSoon)
-		{
-			ppst = &((*ppst)->next);
-		}
+		// This is now the soonest callback and it is already due
+		Remove(0);
+		RestoreBasePriority(baseprio);
+		return true;
 	}
 
-	next = *ppst;
-	*ppst = this;
 	RestoreBasePriority(baseprio);
 	return false;
 }
 
 // Cancel any scheduled callback for this timer. Harmless if there is no callback scheduled.
+// If this timer was the soonest, we may get an interrupt at the time it was due. The ISR allows for that.
 void SoftTimer::CancelCallback()
 {
 	const uint32_t baseprio = ChangeBasePriority(NvicPriorityStep);
-	for (SoftTimer** ppst = const_cast<SoftTimer**>(&pendingList); *ppst != nullptr; ppst = &((*ppst)->next))
+	if (IsPending())
+	{
+		Remove(heapIndex);
+	}
+	RestoreBasePriority(baseprio);
+}
+
+// Heap management. These must be called with the step interrupt disabled, or from the ISR.
+/*static*/ void SoftTimer::Place(SoftTimer *tmr, size_t index)
+{
+	pendingHeap[index] = tmr;
+	tmr->heapIndex = index;
+}
+
+/*static*/ void SoftTimer::Insert(SoftTimer *tmr)
+{
+	Place(tmr, numPending);
+	++numPending;
+	SiftUp(tmr->heapIndex);
+}
+
+/*static*/ void SoftTimer::Remove(size_t index)
+{
+	pendingHeap[index]->heapIndex = NotPending;
+	--numPending;
+	if (index != numPending)
+	{
+		// Move the last timer into the gap. It may need to go either way.
+		Place(pendingHeap[numPending], index);
+		SiftUp(index);
+		SiftDown(pendingHeap[index]->heapIndex);
+	}
+}
+
+/*static*/ void SoftTimer::SiftUp(size_t index)
+{
+	SoftTimer * const tmr = pendingHeap[index];
+	while (index != 0)
 	{
-		if (*ppst == this)
+		const size_t parent = (index - 1)/2;
+		if (!tmr->IsDueBefore(pendingHeap[parent]))
 		{
-			*ppst = this->next;		// unlink this from the pending list
 			break;
 		}
+		Place(pendingHeap[parent], index);
+		index = parent;
 	}
-	RestoreBasePriority(baseprio);
+	Place(tmr, index);
+}
+
+/*static*/ void SoftTimer::SiftDown(size_t index)
+{
+	SoftTimer * const tmr = pendingHeap[index];
+	for (;;)
+	{
+		size_t child = (2 * index) + 1;
+		if (child >= numPending)
+		{
+			break;
+		}
+		if (child + 1 < numPending && pendingHeap[child + 1]->IsDueBefore(pendingHeap[child]))
+		{
+			++child;
+		}
+		if (!pendingHeap[child]->IsDueBefore(tmr))
+		{
+			break;
+		}
+		Place(pendingHeap[child], index);
+		index = child;
+	}
+	Place(tmr, index);
 }
 
 // Get the current tick count
@@ -79,30 +143,23 @@ void SoftTimer::CancelCallback()
 // ISR called from Platform. May sometimes get called prematurely.
 /*static*/ void SoftTimer::Interrupt()
 {
-	for (;;)
+	while (numPending != 0)
 	{
-		SoftTimer * const tmr = pendingList;
-		if (tmr == nullptr)
-		{
-			break;
-		}
+		SoftTimer * const tmr = pendingHeap[0];
 
-		// On the first iteration, the timer at the head of the list is probably expired.
+		// On the first iteration, the timer at the root of the heap is probably expired.
 		// Try to schedule another interrupt for it, if we get a true return then it has indeed expired and we need to execute the callback.
 		// On subsequent iterations this just sets up the interrupt for the next timer that is due to expire.
 		if (StepTimer::ScheduleSoftTimerInterrupt(tmr->whenDue))
 		{
-			pendingList = tmr->next;														// remove it from the pending list
+			Remove(0);
 			if (tmr->callback != nullptr && tmr->callback(tmr->cbParam, tmr->whenDue))		// execute its callback
 			{
-				// Schedule another callback for this timer
-				SoftTimer** ppst = const_cast<SoftTimer**>(&pendingList);
-				while (*ppst != nullptr && (int32_t)(tmr->whenDue - (*ppst)->whenDue) > 0)
+				// Schedule another callback for this timer, unless the callback has already done so
+				if (!tmr->IsPending())
 				{
-					ppst = &((*ppst)->next);
+					Insert(tmr);
 				}
-				tmr->next = *ppst;
-				*ppst = tmr;
 			}
 		}
 		else
@@ -11,7 +11,9 @@
 #include "RepRapFirmware.h"
 
 
-// Class to implement a software timer
+// Class to implement a software timer.
+// The pending timers are kept in a binary heap ordered by due time, so that scheduling and cancelling a callback take O(log n) time
+// and only the soonest one needs to be programmed into the step timer compare register.
 class SoftTimer
 {
 public:
@@ -26,6 +28,9 @@ public:
 	// Cancel any scheduled callbacks
 	void CancelCallback();
 
+	// Return true if a callback is scheduled
+	bool IsPending() const { return heapIndex != NotPending; }
+
 	// Get the current tick count
 	static Ticks GetTimerTicksNow();
 
@@ -36,12 +41,24 @@ public:
 	static void Interrupt();
 
 private:
-	SoftTimer *next;
+	static constexpr size_t MaxPendingTimers = 16;
+	static constexpr size_t NotPending = 0xFFFFFFFF;
+
+	bool IsDueBefore(const SoftTimer *other) const { return (int32_t)(whenDue - other->whenDue) < 0; }
+
+	static void Insert(SoftTimer *tmr);
+	static void Remove(size_t index);
+	static void SiftUp(size_t index);
+	static void SiftDown(size_t index);
+	static void Place(SoftTimer *tmr, size_t index);
+
+	size_t heapIndex;									// where this timer is in the heap, or NotPending
 	Ticks whenDue;
 	Callback callback;
 	void *cbParam;
 
-	static SoftTimer * volatile pendingList;			// list of pending callbacks, soonest first
+	static SoftTimer *pendingHeap[MaxPendingTimers];	// heap of pending callbacks, soonest at the root
+	static size_t numPending;
 };
 
 #endif /* SRC_SOFTTIMER_H_ */
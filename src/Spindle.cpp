@@ -6,6 +6,8 @@
  */
 
 #include "Spindle.h"
+#include "Platform.h"
+#include "RepRap.h"
 
 bool Spindle::SetPins(LogicalPin lpf, LogicalPin lpr, bool invert)
 {
@@ -31,9 +33,9 @@ void Spindle::SetPwmFrequency(float freq)
 	spindleForwardPort.SetFrequency(freq);
 }
 
-void Spindle::SetRpm(float rpm)
+void Spindle::WritePwm(float rpm, float trim)
 {
-	const float pwm = abs(rpm / maxRpm);
+	const float pwm = (rpm == 0.0) ? 0.0 : constrain<float>(fabsf(rpm / maxRpm) + trim, 0.0, 1.0);
 	if (rpm >= 0.0)
 	{
 		spindleReversePort.WriteAnalog(0.0);
@@ -44,14 +46,91 @@ void Spindle::SetRpm(float rpm)
 		spindleReversePort.WriteAnalog(pwm);
 		spindleForwardPort.WriteAnalog(0.0);
 	}
-	currentRpm = configuredRpm = rpm;
+}
+
+// Set the commanded RPM. If we have a ramp rate or a tacho, Spin moves the speed towards it.
+void Spindle::SetRpm(float rpm)
+{
+	if (WaitsForSpeed())
+	{
+		if (!running)
+		{
+			running = true;
+			lastSpinTime = millis();
+		}
+		configuredRpm = rpm;
+		Spin();
+	}
+	else
+	{
+		WritePwm(rpm, 0.0);
+		currentRpm = configuredRpm = rampedRpm = rpm;
+		running = true;
+	}
+}
+
+// Return true if the spindle has reached the commanded speed, or as near as we can tell
+bool Spindle::IsAtSpeed() const
+{
+	if (rampedRpm != configuredRpm)
+	{
+		return false;
+	}
+	return tachoNumber < 0 || fabsf(currentRpm - configuredRpm) <= max<float>(AtSpeedTolerance * fabsf(configuredRpm), MinAtSpeedTolerance);
 }
 
 void Spindle::TurnOff()
 {
 	spindleReversePort.WriteAnalog(0.0);
 	spindleForwardPort.WriteAnalog(0.0);
-	currentRpm = 0.0;
+	running = false;
+	rampedRpm = pwmTrim = 0.0;
+	if (tachoNumber < 0)
+	{
+		currentRpm = 0.0;
+	}
+}
+
+// Ramp the speed and apply the RPM feedback. Called from Platform::Spin.
+void Spindle::Spin()
+{
+	if (tachoNumber >= 0)
+	{
+		const float measuredRpm = (float)(reprap.GetPlatform().GetFanRPM(tachoNumber) * 2)/tachoPulsesPerRev;		// GetFanRPM assumes 2 pulses per rev
+		currentRpm = (rampedRpm < 0.0) ? -measuredRpm : measuredRpm;
+	}
+
+	if (running && WaitsForSpeed())
+	{
+		const uint32_t now = millis();
+		const float dt = (now - lastSpinTime) * MillisToSeconds;
+		lastSpinTime = now;
+
+		if (rampRate > 0.0)
+		{
+			const float maxChange = rampRate * dt;
+			rampedRpm += constrain<float>(configuredRpm - rampedRpm, -maxChange, maxChange);
+		}
+		else
+		{
+			rampedRpm = configuredRpm;
+		}
+
+		if (tachoNumber >= 0 && rampedRpm != 0.0)
+		{
+			// Integrate the speed error into a PWM correction, so that the spindle reaches the speed we ask for even if its speed isn't proportional to PWM
+			pwmTrim = constrain<float>(pwmTrim + (RpmFeedbackGain * dt * (fabsf(rampedRpm) - fabsf(currentRpm)))/maxRpm, -MaxPwmTrim, MaxPwmTrim);
+		}
+		else
+		{
+			pwmTrim = 0.0;
+			if (tachoNumber < 0)
+			{
+				currentRpm = rampedRpm;
+			}
+		}
+		WritePwm(rampedRpm, pwmTrim);
+	}
 }
 
 // End
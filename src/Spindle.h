@@ -14,13 +14,28 @@
 class Spindle
 {
 private:
+	static constexpr float RpmFeedbackGain = 1.0;			// PWM correction per second for an RPM error equal to maxRpm
+	static constexpr float MaxPwmTrim = 0.5;				// limit on the PWM correction from the RPM feedback
+	static constexpr float AtSpeedTolerance = 0.05;		// fraction of the commanded RPM that the measured RPM must be within
+	static constexpr float MinAtSpeedTolerance = 50.0;		// lower limit on the at-speed tolerance in RPM, so that we can reach low speeds
+
 	PwmPort spindleForwardPort, spindleReversePort;
 	bool inverted;
+	bool running;
 	float currentRpm, configuredRpm, maxRpm;
+	float rampedRpm;										// the RPM we are asking for, which moves towards configuredRpm at rampRate
+	float rampRate;											// RPM per second, or zero to change speed immediately
+	float pwmTrim;											// correction to the PWM from the RPM feedback
+	uint32_t lastSpinTime;
 	int toolNumber;
+	int tachoNumber;										// the tacho that measures our speed, or -1 if none
+	unsigned int tachoPulsesPerRev;
+
+	void WritePwm(float rpm, float trim);
 
 public:
-	Spindle() : inverted(false), currentRpm(0.0), configuredRpm(0.0), maxRpm(DefaultMaxSpindleRpm), toolNumber(-1) { }
+	Spindle() : inverted(false), running(false), currentRpm(0.0), configuredRpm(0.0), maxRpm(DefaultMaxSpindleRpm),
+				rampedRpm(0.0), rampRate(0.0), pwmTrim(0.0), lastSpinTime(0), toolNumber(-1), tachoNumber(-1), tachoPulsesPerRev(2) { }
 
 	bool SetPins(LogicalPin lpr, LogicalPin lpf, bool invert);
 	void GetPins(LogicalPin& lpf, LogicalPin& lpr, bool& invert) const;
@@ -30,12 +45,17 @@ public:
 
 	void SetPwmFrequency(float freq);
 	void SetMaxRpm(float max) { maxRpm = max; }
+	void SetRampRate(float rate) { rampRate = rate; }
+	void SetTacho(int tacho, unsigned int pulsesPerRev) { tachoNumber = tacho; tachoPulsesPerRev = pulsesPerRev; }
 
 	float GetCurrentRpm() const { return currentRpm; }
 	float GetRpm() const { return configuredRpm; }
 	void SetRpm(float rpm);
+	bool WaitsForSpeed() const { return rampRate > 0.0 || tachoNumber >= 0; }
+	bool IsAtSpeed() const;
 
 	void TurnOff();
+	void Spin();
 };
 
 #endif
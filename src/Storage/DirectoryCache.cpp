@@ -0,0 +1,109 @@
+/*
+ * DirectoryCache.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "DirectoryCache.h"
+
+#if SUPPORT_DIRECTORY_CACHE
+
+#include "MassStorage.h"
+#include "Tasks.h"
+#include "Movement/Move.h"
+#include <strings.h>
+
+static_assert(DirectoryCacheSize <= 65536, "DirectoryCacheSize too large for 16-bit name offsets");
+
+DirectoryCache::DirectoryCache() : buffer(nullptr), numEntries(0), namesStart(0), startGeneration(0), generation(0), isValid(false)
+{
+}
+
+bool DirectoryCache::IsValidFor(const char *directory) const
+{
+	return isValid && StringEqualsIgnoreCase(directoryName.c_str(), directory);
+}
+
+// Start building a listing. We allocate the buffer the first time we need it and keep it, to avoid fragmenting the heap.
+bool DirectoryCache::Start(const char *directory)
+{
+	if (buffer == nullptr)
+	{
+		if (Tasks::GetNeverUsedRam() < DirectoryCacheSize + MinRamToLeave)
+		{
+			return false;
+		}
+		buffer = new uint32_t[DirectoryCacheSize/sizeof(uint32_t)];
+	}
+
+	isValid = false;
+	startGeneration = generation;
+	numEntries = 0;
+	namesStart = DirectoryCacheSize;
+	directoryName.copy(directory);
+	return true;
+}
+
+// Add an entry, keeping the entries sorted by name. Directories on SD cards rarely hold more than a few hundred files, so an insertion sort is good enough.
+bool DirectoryCache::Add(const FileInfo& fileInfo)
+{
+	const size_t nameLength = fileInfo.fileName.strlen() + 1;
+	if ((numEntries + 1) * sizeof(Entry) + nameLength > namesStart)
+	{
+		return false;
+	}
+
+	namesStart -= nameLength;
+	memcpy(reinterpret_cast<char*>(buffer) + namesStart, fileInfo.fileName.c_str(), nameLength);
+
+	// Find where the new entry goes by binary search
+	Entry * const entries = Entries();
+	size_t low = 0, high = numEntries;
+	while (low < high)
+	{
+		const size_t mid = (low + high)/2;
+		if (strcasecmp(Name(entries[mid]), fileInfo.fileName.c_str()) <= 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	memmove(entries + low + 1, entries + low, (numEntries - low) * sizeof(Entry));
+	Entry& e = entries[low];
+	e.lastModified = fileInfo.lastModified;
+	e.size = fileInfo.size;
+	e.nameOffset = namesStart;
+	e.isDirectory = fileInfo.isDirectory;
+	++numEntries;
+	return true;
+}
+
+// Finish building the listing. If a file was changed while we were reading the directory then the listing may be out of date, so don't use it.
+void DirectoryCache::Finish()
+{
+	isValid = (generation == startGeneration);
+}
+
+bool DirectoryCache::GetEntry(unsigned int index, FileInfo& fileInfo) const
+{
+	if (index >= numEntries)
+	{
+		return false;
+	}
+
+	const Entry& e = Entries()[index];
+	fileInfo.fileName.copy(Name(e));
+	fileInfo.size = e.size;
+	fileInfo.lastModified = e.lastModified;
+	fileInfo.isDirectory = e.isDirectory;
+	return true;
+}
+
+#endif
+
+// End
@@ -0,0 +1,58 @@
+/*
+ * DirectoryCache.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_STORAGE_DIRECTORYCACHE_H_
+#define SRC_STORAGE_DIRECTORYCACHE_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_DIRECTORY_CACHE
+
+#include <ctime>
+
+struct FileInfo;
+
+// Class to hold a sorted listing of one directory, so that web clients can fetch a large directory a page at a time without the SD card being read from the start for each page.
+// Hidden files (those whose names start with '.') are left out. The listing is discarded when any file is written, deleted or renamed.
+// The caller must own the directory search mutex when calling any of these functions except Invalidate, which may be called at any time.
+class DirectoryCache
+{
+public:
+	DirectoryCache();
+
+	bool IsValidFor(const char *directory) const;				// return true if we hold a listing of this directory
+	bool Start(const char *directory);							// start building a listing, returning false if there isn't enough memory
+	bool Add(const FileInfo& fileInfo);							// add an entry in name order, returning false if there isn't room for it
+	void Finish();												// finish building the listing
+	bool GetEntry(unsigned int index, FileInfo& fileInfo) const;	// retrieve an entry, returning false if there are no more
+	void Invalidate() { ++generation; isValid = false; }
+	unsigned int GetNumEntries() const { return numEntries; }
+
+private:
+	struct Entry
+	{
+		time_t lastModified;
+		FilePosition size;
+		uint16_t nameOffset;									// offset of the null-terminated name from the start of the buffer
+		bool isDirectory;
+	};
+
+	Entry *Entries() const { return reinterpret_cast<Entry*>(buffer); }
+	const char *Name(const Entry& e) const { return reinterpret_cast<const char*>(buffer) + e.nameOffset; }
+
+	uint32_t *buffer;											// entries are stored from the start of the buffer and names from the end
+	size_t numEntries;
+	size_t namesStart;											// offset of the first byte of the lowest name in the buffer
+	String<MaxFilenameLength> directoryName;
+	uint32_t startGeneration;									// the value of generation when we started building the listing
+	volatile uint32_t generation;								// incremented whenever the listing is invalidated
+	volatile bool isValid;
+};
+
+#endif
+
+#endif /* SRC_STORAGE_DIRECTORYCACHE_H_ */
@@ -19,13 +19,14 @@ class FileData
 public:
 	friend class FileGCodeInput;
 
-	FileData() : f(nullptr) {}
+	FileData() : f(nullptr), formatChecked(false), isBinaryGCode(false) {}
 
 	// Set this to refer to a newly-opened file
 	void Set(FileStore* pfile)
 	{
 		Close();	// close any existing file
 		f = pfile;
+		formatChecked = isBinaryGCode = false;
 	}
 
 	bool IsLive() const { return f != nullptr; }
@@ -97,11 +98,18 @@ public:
 		return f->Length();
 	}
 
+	bool Truncate()
+	{
+		return f->Truncate();
+	}
+
 	// Assignment operator
 	void CopyFrom(const FileData& other)
 	{
 		Close();
 		f = other.f;
+		formatChecked = other.formatChecked;
+		isBinaryGCode = other.isBinaryGCode;
 		if (f != nullptr)
 		{
 			f->Duplicate();
@@ -113,15 +121,20 @@ public:
 	{
 		Close();
 		f = other.f;
+		formatChecked = other.formatChecked;
+		isBinaryGCode = other.isBinaryGCode;
 		other.Init();
 	}
 
 private:
 	FileStore *f;
+	bool formatChecked;				// true if FileGCodeInput has checked whether this is a binary G-code file
+	bool isBinaryGCode;				// true if this is a binary G-code file
 
 	void Init()
 	{
 		f = nullptr;
+		formatChecked = isBinaryGCode = false;
 	}
 
 	// Private assignment operator to prevent us assigning these objects
@@ -11,6 +11,65 @@
 #include "Platform.h"
 #include "PrintMonitor.h"
 #include "GCodes/GCodes.h"
+#include "CRC32.h"
+
+// Record in the file info index. The index is a hash table held in a file in the system directory, so that we don't have to parse a G-code file again
+// each time a client asks for its information. A record is only used if the file size and last modified time still match, so we don't need to
+// update the index when files are deleted or overwritten.
+struct FileInfoIndexRecord
+{
+	static constexpr uint32_t Magic = 0x46494932;			// "FII2", change this if the record format changes
+
+	uint32_t magic;
+	uint32_t pathHash;
+	FilePosition fileSize;
+	uint32_t lastModifiedTime;
+	float layerHeight;
+	float firstLayerHeight;
+	float objectHeight;
+	float filamentNeeded[MaxExtruders];
+	uint32_t printTime;
+	uint32_t simulatedTime;
+	uint32_t numFilaments;
+	char generatedBy[52];
+
+	bool Matches(uint32_t hash, const GCodeFileInfo& info) const
+	{
+		return magic == Magic && pathHash == hash && fileSize == info.fileSize && lastModifiedTime == (uint32_t)info.lastModifiedTime;
+	}
+};
+
+static_assert(FileInfoIndexProbes * sizeof(FileInfoIndexRecord) <= GCODE_READ_SIZE, "File info index probes don't fit in the parse buffer");
+
+// Find the first place in the null-terminated buffer where any of the strings occurs, scanning the buffer only once.
+// If more than one string matches at that place then the earliest one in the table wins, so a string that is a leading substring of another must come after it.
+// Return nullptr if none of them occurs, else set 'index' to the index of the string that matched.
+/*static*/ const char *FileInfoParser::FindFirstOf(const char *buf, const char * const strings[], size_t numStrings, size_t& index)
+{
+	uint32_t firstChars[256/32] = { 0 };				// bitmap of the first characters of the strings, so that we only compare strings at a few places
+	for (size_t i = 0; i < numStrings; ++i)
+	{
+		const uint8_t c = (uint8_t)strings[i][0];
+		firstChars[c >> 5] |= 1u << (c & 31);
+	}
+
+	for (const char *p = buf; *p != 0; ++p)
+	{
+		const uint8_t c = (uint8_t)*p;
+		if ((firstChars[c >> 5] & (1u << (c & 31))) != 0)
+		{
+			for (size_t i = 0; i < numStrings; ++i)
+			{
+				if (strings[i][0] == *p && StringStartsWith(p, strings[i]))
+				{
+					index = i;
+					return p;
+				}
+			}
+		}
+	}
+	return nullptr;
+}
 
 void GCodeFileInfo::Init()
 {
@@ -100,6 +159,19 @@ bool FileInfoParser::GetFileInfo(const char *filePath, GCodeFileInfo& info, bool
 			info = parsedFileInfo;
 			return true;
 		}
+
+		// If we have parsed this file before and it hasn't changed since, use the information we saved
+		if (FindIndexedFileInfo(filePath))
+		{
+			fileBeingParsed->Close();
+			info = parsedFileInfo;
+			return true;
+		}
+		// We read the end of the file first, so make the seeks fast if the file is large
+		if (fileBeingParsed->Length() > GCODE_HEADER_SIZE + GCODE_FOOTER_SIZE)
+		{
+			(void)fileBeingParsed->EnableFastSeek();
+		}
 		parseState = parsingHeader;
 	}
 
@@ -333,6 +405,7 @@ bool FileInfoParser::GetFileInfo(const char *filePath, GCodeFileInfo& info, bool
 					parseState = notParsing;
 					fileBeingParsed->Close();
 					parsedFileInfo.incomplete = false;
+					StoreIndexedFileInfo(filePath);
 					info = parsedFileInfo;
 					return true;
 				}
@@ -364,6 +437,124 @@ bool FileInfoParser::GetFileInfo(const char *filePath, GCodeFileInfo& info, bool
 	return false;
 }
 
+// Return the hash of a file path that we use to look it up in the file info index. File names are not case sensitive, and "0:" is the default volume.
+/*static*/ uint32_t FileInfoParser::HashFilePath(const char *filePath)
+{
+	if (filePath[0] == '0' && filePath[1] == ':')
+	{
+		filePath += 2;
+	}
+	CRC32 crc;
+	while (*filePath != 0)
+	{
+		crc.Update((char)tolower(*filePath++));
+	}
+	return crc.Get();
+}
+
+// Look for the information about a file in the file info index. On entry, parsedFileInfo holds the size and last modified time of the file.
+// If we find a matching record then copy the information into parsedFileInfo and return true.
+// This uses the parse buffer, so it must only be called when we are not parsing a file.
+bool FileInfoParser::FindIndexedFileInfo(const char *filePath)
+{
+	FileStore * const indexFile = reprap.GetPlatform().OpenSysFile(FILE_INFO_INDEX_FILE, OpenMode::read);
+	if (indexFile == nullptr)
+	{
+		return false;
+	}
+
+	const uint32_t hash = HashFilePath(filePath);
+	const size_t firstSlot = hash % (FileInfoIndexSlots - FileInfoIndexProbes + 1);
+	FileInfoIndexRecord * const records = reinterpret_cast<FileInfoIndexRecord*>(buf32);
+	const int bytesRead = (indexFile->Seek(firstSlot * sizeof(FileInfoIndexRecord)))
+							? indexFile->Read(reinterpret_cast<char*>(records), FileInfoIndexProbes * sizeof(FileInfoIndexRecord))
+								: -1;
+	indexFile->Close();
+
+	for (size_t i = 0; bytesRead > 0 && i < (size_t)bytesRead/sizeof(FileInfoIndexRecord); ++i)
+	{
+		const FileInfoIndexRecord& rec = records[i];
+		if (rec.Matches(hash, parsedFileInfo))
+		{
+			parsedFileInfo.layerHeight = rec.layerHeight;
+			parsedFileInfo.firstLayerHeight = rec.firstLayerHeight;
+			parsedFileInfo.objectHeight = rec.objectHeight;
+			for (size_t extr = 0; extr < MaxExtruders; ++extr)
+			{
+				parsedFileInfo.filamentNeeded[extr] = rec.filamentNeeded[extr];
+			}
+			parsedFileInfo.printTime = rec.printTime;
+			parsedFileInfo.simulatedTime = rec.simulatedTime;
+			parsedFileInfo.numFilaments = rec.numFilaments;
+			parsedFileInfo.generatedBy.copy(rec.generatedBy);
+			parsedFileInfo.incomplete = false;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Save the information we have just parsed in the file info index, replacing any old record for the same file.
+// This uses the parse buffer, so it must only be called when we have finished parsing the file.
+void FileInfoParser::StoreIndexedFileInfo(const char *filePath)
+{
+	FileStore * const indexFile = reprap.GetPlatform().OpenSysFile(FILE_INFO_INDEX_FILE, OpenMode::append);
+	if (indexFile == nullptr)
+	{
+		return;
+	}
+
+	// Choose the record to replace: the old one for this file if there is one, else an unused one, else the first one
+	const uint32_t hash = HashFilePath(filePath);
+	const size_t firstSlot = hash % (FileInfoIndexSlots - FileInfoIndexProbes + 1);
+	const FilePosition firstSlotPos = firstSlot * sizeof(FileInfoIndexRecord);
+	FileInfoIndexRecord * const records = reinterpret_cast<FileInfoIndexRecord*>(buf32);
+	const size_t recordsRead = (firstSlotPos < indexFile->Length() && indexFile->Seek(firstSlotPos))
+								? max<int>(indexFile->Read(reinterpret_cast<char*>(records), FileInfoIndexProbes * sizeof(FileInfoIndexRecord)), 0)/sizeof(FileInfoIndexRecord)
+									: 0;
+	size_t slotToUse = recordsRead;								// the first record beyond the end of the index file, if there is one within range
+	for (size_t i = 0; i < recordsRead; ++i)
+	{
+		if (records[i].magic == FileInfoIndexRecord::Magic && records[i].pathHash == hash)
+		{
+			slotToUse = i;
+			break;
+		}
+		if (records[i].magic != FileInfoIndexRecord::Magic && slotToUse == recordsRead)
+		{
+			slotToUse = i;
+		}
+	}
+	if (slotToUse == FileInfoIndexProbes)
+	{
+		slotToUse = 0;
+	}
+
+	FileInfoIndexRecord& rec = records[0];
+	rec.magic = FileInfoIndexRecord::Magic;
+	rec.pathHash = hash;
+	rec.fileSize = parsedFileInfo.fileSize;
+	rec.lastModifiedTime = (uint32_t)parsedFileInfo.lastModifiedTime;
+	rec.layerHeight = parsedFileInfo.layerHeight;
+	rec.firstLayerHeight = parsedFileInfo.firstLayerHeight;
+	rec.objectHeight = parsedFileInfo.objectHeight;
+	for (size_t extr = 0; extr < MaxExtruders; ++extr)
+	{
+		rec.filamentNeeded[extr] = parsedFileInfo.filamentNeeded[extr];
+	}
+	rec.printTime = parsedFileInfo.printTime;
+	rec.simulatedTime = parsedFileInfo.simulatedTime;
+	rec.numFilaments = parsedFileInfo.numFilaments;
+	SafeStrncpy(rec.generatedBy, parsedFileInfo.generatedBy.c_str(), ARRAY_SIZE(rec.generatedBy));
+
+	// Seeking beyond the end of the file extends it. The records we skip over may contain rubbish, but they won't have the right magic number.
+	if (!indexFile->Seek(firstSlotPos + slotToUse * sizeof(FileInfoIndexRecord)) || !indexFile->Write(reinterpret_cast<const char*>(&rec), sizeof(rec)))
+	{
+		reprap.GetPlatform().Message(WarningMessage, "Failed to update file info index\n");
+	}
+	indexFile->Close();
+}
+
 // Scan the buffer for a G1 Zxxx command. The buffer is null-terminated.
 bool FileInfoParser::FindFirstLayerHeight(const char* buf, size_t len)
 {
@@ -548,35 +739,27 @@ bool FileInfoParser::FindLayerHeight(const char *buf, size_t len)
 
 	if (*buf != 0)
 	{
-		++buf;														// make sure we can look back 1 character after we find a match
-		for (const char * lhStr : layerHeightStrings)				// search for each string in turn
+		const char *pos = buf + 1;									// make sure we can look back 1 character after we find a match
+		size_t index;
+		while ((pos = FindFirstOf(pos, layerHeightStrings, ARRAY_SIZE(layerHeightStrings), index)) != nullptr)
 		{
-			const char *pos = buf;
-			for(;;)													// loop until success or strstr returns null
+			const char c = pos[-1];									// fetch the previous character
+			if (c == ' ' || c == ';' || c == '\t')					// check we are not in the middle of a word
 			{
-				pos = strstr(pos, lhStr);
-				if (pos == nullptr)
+				const char *valPtr = pos + strlen(layerHeightStrings[index]);	// skip the string we matched
+				while (strchr(" \t=:,", *valPtr) != nullptr)		// skip the possible separators
 				{
-					break;											// didn't find this string in the buffer, so try the next string
+					++valPtr;
 				}
-
-				const char c = pos[-1];								// fetch the previous character
-				pos += strlen(lhStr);				// skip the string we matched
-				if (c == ' ' || c == ';' || c == '\t')				// check we are not in the middle of a word
+				const char *tailPtr;
+				const float val = SafeStrtof(valPtr, &tailPtr);
+				if (tailPtr != valPtr)								// if we found and converted a number
 				{
-					while (strchr(" \t=:,", *pos) != nullptr)		// skip the possible separators
-					{
-						++pos;
-					}
-					const char *tailPtr;
-					const float val = SafeStrtof(pos, &tailPtr);
-					if (tailPtr != pos)								// if we found and converted a number
-					{
-						parsedFileInfo.layerHeight = val;
-						return true;
-					}
+					parsedFileInfo.layerHeight = val;
+					return true;
 				}
 			}
+			++pos;													// carry on looking after the start of this match
 		}
 	}
 
@@ -594,18 +777,8 @@ bool FileInfoParser::FindSlicerInfo(const char* buf, size_t len)
 		";Generated with "	// Cura (new)
 	};
 
-	size_t index = 0;
-	const char* pos;
-	do
-	{
-		pos = strstr(buf, GeneratedByStrings[index]);
-		if (pos != nullptr)
-		{
-			break;
-		}
-		++index;
-	} while (index < ARRAY_SIZE(GeneratedByStrings));
-
+	size_t index;
+	const char* pos = FindFirstOf(buf, GeneratedByStrings, ARRAY_SIZE(GeneratedByStrings), index);
 	if (pos != nullptr)
 	{
 		const char* introString = "";
@@ -642,108 +815,99 @@ unsigned int FileInfoParser::FindFilamentUsed(const char* buf, size_t len)
 	unsigned int filamentsFound = 0;
 	const size_t maxFilaments = reprap.GetGCodes().GetNumExtruders();
 
-	// Look for filament usage as generated by Slic3r and Cura
-	const char* const filamentUsedStr1 = "ilament used";			// comment string used by slic3r and Cura, followed by filament used and "mm"
+	// Look for filament usage as generated by Slic3r, Cura and Ideamaker
+	static const char * const FilamentUsedStrings[] =
+	{
+		"ilament used",			// comment string used by slic3r and Cura, followed by filament used and "mm"
+		";Material#"			// comment string used by Ideamaker, e.g. ";Material#1 Used: 868.0"
+	};
+
 	const char* p = buf;
-	while (filamentsFound < maxFilaments &&	(p = strstr(p, filamentUsedStr1)) != nullptr)
+	size_t index;
+	while (filamentsFound < maxFilaments &&	(p = FindFirstOf(p, FilamentUsedStrings, ARRAY_SIZE(FilamentUsedStrings), index)) != nullptr)
 	{
-		p += strlen(filamentUsedStr1);
-		while(strchr(" [m]:=\t", *p) != nullptr)					// Prusa slicer now uses "; filament used [mm] = 4235.9"
+		p += strlen(FilamentUsedStrings[index]);
+		if (index == 0)
 		{
-			++p;	// this allows for " = " from default slic3r comment and ": " from default Cura comment
-		}
-		while (isDigit(*p))
-		{
-			const char* q;
-			parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, &q);
-			p = q;
-			if (*p == 'm')
+			while(strchr(" [m]:=\t", *p) != nullptr)				// Prusa slicer now uses "; filament used [mm] = 4235.9"
 			{
-				++p;
+				++p;	// this allows for " = " from default slic3r comment and ": " from default Cura comment
+			}
+			while (isDigit(*p))
+			{
+				const char* q;
+				parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, &q);
+				p = q;
 				if (*p == 'm')
 				{
 					++p;
+					if (*p == 'm')
+					{
+						++p;
+					}
+					else
+					{
+						parsedFileInfo.filamentNeeded[filamentsFound] *= 1000.0;		// Cura outputs filament used in metres not mm
+					}
 				}
-				else
+				++filamentsFound;
+				while (strchr(", \t", *p) != nullptr)
 				{
-					parsedFileInfo.filamentNeeded[filamentsFound] *= 1000.0;		// Cura outputs filament used in metres not mm
+					++p;
 				}
 			}
-			++filamentsFound;
-			while (strchr(", \t", *p) != nullptr)
-			{
-				++p;
-			}
 		}
-	}
-
-	// Look for filament usage string generated by Ideamaker
-	const char* const filamentUsedStr2 = ";Material#";			// comment string used by Ideamaker, e.g. ";Material#1 Used: 868.0"
-	p = buf;
-	while (filamentsFound < maxFilaments &&	(p = strstr(p, filamentUsedStr2)) != nullptr)
-	{
-		p += strlen(filamentUsedStr2);
-		const char *q;
-		unsigned long num = SafeStrtoul(p, &q);
-		if (q != p && num < maxFilaments)
+		else
 		{
-			p = q;
-			while(strchr(" Used:\t", *p) != nullptr)
+			const char *q;
+			unsigned long num = SafeStrtoul(p, &q);
+			if (q != p && num < maxFilaments)
 			{
-				++p;	// this allows for " Used: "
-			}
-			if (isDigit(*p))
-			{
-				parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, nullptr);
-				++filamentsFound;
+				p = q;
+				while(strchr(" Used:\t", *p) != nullptr)
+				{
+					++p;	// this allows for " Used: "
+				}
+				if (isDigit(*p))
+				{
+					parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, nullptr);
+					++filamentsFound;
+				}
 			}
 		}
 	}
 
-	// Look for filament usage as generated by S3D
+	// Look for filament usage as generated by S3D and recent KISSlicer versions
 	if (filamentsFound == 0)
 	{
-		const char *filamentLengthStr = "ilament length";	// comment string used by S3D
-		p = buf;
-		while (filamentsFound < maxFilaments &&	(p = strstr(p, filamentLengthStr)) != nullptr)
+		static const char * const FilamentLengthStrings[] =
 		{
-			p += strlen(filamentLengthStr);
-			while(strchr(" :=\t", *p) != nullptr)
-			{
-				++p;
-			}
-			if (isDigit(*p))
-			{
-				parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, nullptr); // S3D reports filament usage in mm, no conversion needed
-				++filamentsFound;
-			}
-		}
-	}
+			"ilament length",	// comment string used by S3D
+			";    Ext "			// comment string used by KISSlicer
+		};
 
-	// Look for filament usage as generated by recent KISSlicer versions
-	if (filamentsFound == 0)
-	{
-		const char *filamentLengthStr = ";    Ext ";
 		p = buf;
-		while (filamentsFound < maxFilaments && (p = strstr(p, filamentLengthStr)) != nullptr)
+		while (filamentsFound < maxFilaments &&	(p = FindFirstOf(p, FilamentLengthStrings, ARRAY_SIZE(FilamentLengthStrings), index)) != nullptr)
 		{
-			p += strlen(filamentLengthStr);
-			if (*p == '#')
+			p += strlen(FilamentLengthStrings[index]);
+			if (index == 1)
 			{
-				++p;				// later KISSlicer versions add a # here
-			}
-			while(isdigit(*p))
-			{
-				++p;
+				if (*p == '#')
+				{
+					++p;				// later KISSlicer versions add a # here
+				}
+				while(isdigit(*p))
+				{
+					++p;
+				}
 			}
 			while(strchr(" :=\t", *p) != nullptr)
 			{
 				++p;
 			}
-
 			if (isDigit(*p))
 			{
-				parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, nullptr);
+				parsedFileInfo.filamentNeeded[filamentsFound] = SafeStrtof(p, nullptr);	// S3D and KISSlicer report filament usage in mm, no conversion needed
 				++filamentsFound;
 			}
 		}
@@ -778,67 +942,65 @@ bool FileInfoParser::FindPrintTime(const char* buf, size_t len)
 													// also KISSSlicer 2 alpha	"; Calculated-during-export Build Time: 130.62 minutes"
 	};
 
-	for (const char * ptStr : PrintTimeStrings)
+	size_t index;
+	const char* pos = FindFirstOf(buf, PrintTimeStrings, ARRAY_SIZE(PrintTimeStrings), index);
+	if (pos != nullptr)
 	{
-		const char* pos = strstr(buf, ptStr);
-		if (pos != nullptr)
+		pos += strlen(PrintTimeStrings[index]);
+		while (strchr(" \t=:", *pos))
+		{
+			++pos;
+		}
+		const char * const q = pos;
+		float hours = 0.0, minutes = 0.0;
+		float secs = SafeStrtod(pos, &pos);
+		if (q != pos)
 		{
-			pos += strlen(ptStr);
-			while (strchr(" \t=:", *pos))
+			while (*pos == ' ')
 			{
 				++pos;
 			}
-			const char * const q = pos;
-			float hours = 0.0, minutes = 0.0;
-			float secs = SafeStrtod(pos, &pos);
-			if (q != pos)
+			if (*pos == 'h')
 			{
+				hours = secs;
+				if (StringStartsWithIgnoreCase(pos, "hours"))		// S3D
+				{
+					pos += 5;
+				}
+				else if (StringStartsWithIgnoreCase(pos, "hour"))	// S3D now prints "1 hour 42 minutes"
+				{
+					pos += 4;
+				}
+				else
+				{
+					++pos;
+				}
+				secs = SafeStrtod(pos, &pos);
 				while (*pos == ' ')
 				{
 					++pos;
 				}
-				if (*pos == 'h')
+			}
+			if (*pos == 'm')
+			{
+				minutes = secs;
+				if (StringStartsWithIgnoreCase(pos, "minutes"))
 				{
-					hours = secs;
-					if (StringStartsWithIgnoreCase(pos, "hours"))		// S3D
-					{
-						pos += 5;
-					}
-					else if (StringStartsWithIgnoreCase(pos, "hour"))	// S3D now prints "1 hour 42 minutes"
-					{
-						pos += 4;
-					}
-					else
-					{
-						++pos;
-					}
-					secs = SafeStrtod(pos, &pos);
-					while (*pos == ' ')
-					{
-						++pos;
-					}
+					pos += 7;
 				}
-				if (*pos == 'm')
+				else if (StringStartsWithIgnoreCase(pos, "minute"))	// assume S3D also prints "1 minute"
 				{
-					minutes = secs;
-					if (StringStartsWithIgnoreCase(pos, "minutes"))
-					{
-						pos += 7;
-					}
-					else if (StringStartsWithIgnoreCase(pos, "minute"))	// assume S3D also prints "1 minute"
-					{
-						pos += 6;
-					}
-					else
-					{
-						++pos;
-					}
-					secs = SafeStrtod(pos, &pos);
+					pos += 6;
+				}
+				else
+				{
+					++pos;
 				}
+				secs = SafeStrtod(pos, &pos);
 			}
-			parsedFileInfo.printTime = lrintf((hours * 60.0 + minutes) * 60.0 + secs);
-			return true;
 		}
+		parsedFileInfo.printTime = lrintf((hours * 60.0 + minutes) * 60.0 + secs);
+		return true;
 	}
 	return false;
 }
@@ -14,7 +14,9 @@
 const FilePosition GCODE_HEADER_SIZE = 20000uL;		// How many bytes to read from the header - I (DC) have a Kisslicer file with a layer height comment 14Kb from the start
 const FilePosition GCODE_FOOTER_SIZE = 400000uL;	// How many bytes to read from the footer
 
-#if SAM4E || SAM4S || SAME70
+#if SAM4E || SAME70
+const size_t GCODE_READ_SIZE = 4096;				// How many bytes to read in one go in GetFileInfo() (should be a multiple of 512 for read efficiency)
+#elif SAM4S
 const size_t GCODE_READ_SIZE = 2048;				// How many bytes to read in one go in GetFileInfo() (should be a multiple of 512 for read efficiency)
 #else
 const size_t GCODE_READ_SIZE = 1024;				// How many bytes to read in one go in GetFileInfo() (should be a multiple of 512 for read efficiency)
@@ -27,6 +29,9 @@ const size_t GCODE_OVERLAP_SIZE = 100;				// Size of the overlapping buffer for
 const uint32_t MAX_FILEINFO_PROCESS_TIME = 200;		// Maximum time to spend polling for file info in each call
 const uint32_t MaxFileParseInterval = 4000;			// Maximum interval between repeat requests to parse a file
 
+const size_t FileInfoIndexSlots = 512;				// Number of records in the file info index, which should be more than the number of G-code files on the card
+const size_t FileInfoIndexProbes = 4;				// Number of consecutive records that a file's information may be stored in
+
 // Struct to hold Gcode file information
 struct GCodeFileInfo
 {
@@ -75,6 +80,12 @@ private:
 	bool FindPrintTime(const char* buf, size_t len);
 	bool FindSimulatedTime(const char* buf, size_t len);
 	unsigned int FindFilamentUsed(const char* buf, size_t len);
+	static const char *FindFirstOf(const char *buf, const char * const strings[], size_t numStrings, size_t& index);
+
+	// File info index methods
+	static uint32_t HashFilePath(const char *filePath);
+	bool FindIndexedFileInfo(const char *filePath);
+	void StoreIndexedFileInfo(const char *filePath);
 
 	// We parse G-Code files in multiple stages. These variables hold the required information
 	Mutex parserMutex;
@@ -8,9 +8,11 @@
 #include "Libraries/Fatfs/diskio.h"
 #include "Movement/StepTimer.h"
 
+static_assert(sizeof(FilePosition) == sizeof(FSIZE_t), "FilePosition must be the same size as the FatFS file size type");
+
 uint32_t FileStore::longestWriteTime = 0;
 
-FileStore::FileStore() : writeBuffer(nullptr)
+FileStore::FileStore() : writeBuffer(nullptr), clusterMap(nullptr)
 {
 	Init();
 }
@@ -20,6 +22,11 @@ void FileStore::Init()
 	usageMode = FileUseMode::free;
 	openCount = 0;
 	closeRequested = false;
+#if HAS_ASYNC_FILE_WRITES
+	pendingWrites = 0;
+	pendingBytes = 0;
+	asyncWriteStatus = FR_OK;
+#endif
 }
 
 // Invalidate the file if it uses the specified FATFS object
@@ -27,6 +34,7 @@ bool FileStore::Invalidate(const FATFS *fs, bool doClose)
 {
 	if (file.obj.fs == fs)
 	{
+		(void)FinishPendingWrites();						// this doesn't wait, because InternalUnmount drained the queued writes before it took the volume mutex
 		if (doClose)
 		{
 			(void)ForceClose();
@@ -119,6 +127,9 @@ bool FileStore::Open(const char* filePath, OpenMode mode, uint32_t preAllocSize)
 
 	crc.Reset();
 	calcCrc = (mode == OpenMode::writeWithCrc);
+#if HAS_ASYNC_FILE_WRITES
+	asyncWriteStatus = FR_OK;
+#endif
 	usageMode = (writing) ? FileUseMode::readWrite : FileUseMode::readOnly;
 	openCount = 1;
 	if (preAllocSize != 0 && (mode == OpenMode::write || mode == OpenMode::writeWithCrc))
@@ -132,6 +143,23 @@ bool FileStore::Open(const char* filePath, OpenMode mode, uint32_t preAllocSize)
 	return true;
 }
 
+#if SUPPORT_MACRO_CACHE
+
+// Open a file that is held in the macro cache. The caller has already added a reference to the cache entry.
+// This is protected - only MassStorage can access it.
+void FileStore::OpenCached(MacroCache::Entry *entry)
+{
+	writeBuffer = nullptr;
+	file.obj.fs = nullptr;							// so that unmounting the card doesn't invalidate us and Delete doesn't think that we have the file open
+	cacheEntry = entry;
+	cachePosition = 0;
+	calcCrc = false;
+	usageMode = FileUseMode::cached;
+	openCount = 1;
+}
+
+#endif
+
 void FileStore::Duplicate()
 {
 	switch (usageMode)
@@ -142,6 +170,7 @@ void FileStore::Duplicate()
 
 	case FileUseMode::readOnly:
 	case FileUseMode::readWrite:
+	case FileUseMode::cached:
 		{
 			const irqflags_t flags = cpu_irq_save();
 			++openCount;
@@ -169,6 +198,7 @@ bool FileStore::Close()
 
 	case FileUseMode::readOnly:
 	case FileUseMode::readWrite:
+	case FileUseMode::cached:
 		{
 			const irqflags_t flags = cpu_irq_save();
 			if (openCount > 1)
@@ -210,10 +240,27 @@ bool FileStore::Close()
 
 bool FileStore::ForceClose()
 {
+#if SUPPORT_MACRO_CACHE
+	if (usageMode == FileUseMode::cached)
+	{
+		reprap.GetPlatform().GetMassStorage()->ReleaseCachedFile(cacheEntry);
+		cacheEntry = nullptr;
+		usageMode = FileUseMode::free;
+		closeRequested = false;
+		openCount = 0;
+		return true;
+	}
+#endif
+
 	bool ok = true;
 	if (usageMode == FileUseMode::readWrite)
 	{
 		ok = Flush();
+#if SUPPORT_MACRO_CACHE
+		// Someone may have read and cached this file while we were writing it, and we don't know its name, so discard everything
+		reprap.GetPlatform().GetMassStorage()->InvalidateMacroCache();
+#endif
+		reprap.GetPlatform().GetMassStorage()->InvalidateDirectoryListing();			// the file size and date have changed
 	}
 
 	if (writeBuffer != nullptr)
@@ -222,6 +269,13 @@ bool FileStore::ForceClose()
 		writeBuffer = nullptr;
 	}
 
+	if (clusterMap != nullptr)
+	{
+		file.cltbl = nullptr;
+		reprap.GetPlatform().GetMassStorage()->ReleaseClusterMap(clusterMap);
+		clusterMap = nullptr;
+	}
+
 	const FRESULT fr = f_close(&file);
 	usageMode = FileUseMode::free;
 	closeRequested = false;
@@ -239,7 +293,17 @@ bool FileStore::Seek(FilePosition pos)
 
 	case FileUseMode::readOnly:
 	case FileUseMode::readWrite:
-		return f_lseek(&file, pos) == FR_OK;
+		return FinishPendingWrites() == FR_OK && f_lseek(&file, pos) == FR_OK;
+
+#if SUPPORT_MACRO_CACHE
+	case FileUseMode::cached:
+		if (pos > cacheEntry->GetLength())
+		{
+			return false;
+		}
+		cachePosition = pos;
+		return true;
+#endif
 
 	case FileUseMode::invalidated:
 	default:
@@ -249,6 +313,12 @@ bool FileStore::Seek(FilePosition pos)
 
 FilePosition FileStore::Position() const
 {
+#if SUPPORT_MACRO_CACHE
+	if (usageMode == FileUseMode::cached)
+	{
+		return cachePosition;
+	}
+#endif
 	return (usageMode == FileUseMode::readOnly || usageMode == FileUseMode::readWrite) ? file.fptr : 0;
 }
 
@@ -276,7 +346,22 @@ FilePosition FileStore::Length() const
 		return f_size(&file);
 
 	case FileUseMode::readWrite:
+#if HAS_ASYNC_FILE_WRITES
+		if (writeBuffer != nullptr)
+		{
+			// Read pendingBytes before the file size, so that if the file writer task writes a buffer in between then we count it twice instead of not at all
+			const size_t bytesPending = pendingBytes;
+			return f_size(&file) + bytesPending + writeBuffer->BytesStored();
+		}
+		return f_size(&file);
+#else
 		return (writeBuffer != nullptr) ? f_size(&file) + writeBuffer->BytesStored() : f_size(&file);
+#endif
+
+#if SUPPORT_MACRO_CACHE
+	case FileUseMode::cached:
+		return cacheEntry->GetLength();
+#endif
 
 	case FileUseMode::invalidated:
 	default:
@@ -303,7 +388,11 @@ int FileStore::Read(char* extBuf, size_t nBytes)
 	case FileUseMode::readWrite:
 		{
 			UINT bytes_read;
-			FRESULT readStatus = f_read(&file, extBuf, nBytes, &bytes_read);
+			FRESULT readStatus = FinishPendingWrites();
+			if (readStatus == FR_OK)
+			{
+				readStatus = f_read(&file, extBuf, nBytes, &bytes_read);
+			}
 			if (readStatus != FR_OK)
 			{
 				reprap.GetPlatform().MessageF(ErrorMessage, "Cannot read file, error code %d\n", (int)readStatus);
@@ -312,6 +401,16 @@ int FileStore::Read(char* extBuf, size_t nBytes)
 			return (int)bytes_read;
 		}
 
+#if SUPPORT_MACRO_CACHE
+	case FileUseMode::cached:
+		{
+			const size_t bytesRead = min<size_t>(nBytes, cacheEntry->GetLength() - cachePosition);
+			memcpy(extBuf, cacheEntry->GetContents() + cachePosition, bytesRead);
+			cachePosition += bytesRead;
+			return (int)bytesRead;
+		}
+#endif
+
 	case FileUseMode::invalidated:
 	default:
 		return -1;
@@ -398,25 +497,52 @@ bool FileStore::Write(const char *s, size_t len)
 			}
 			else
 			{
-				do
+#if HAS_ASYNC_FILE_WRITES
+				writeStatus = asyncWriteStatus;					// fail if the file writer task couldn't write data that we gave it earlier
+#endif
+				while (writeStatus == FR_OK)
 				{
-					size_t bytesStored = writeBuffer->Store(s + totalBytesWritten, len - totalBytesWritten);
-					if (writeBuffer->BytesLeft() == 0)
+					// If the buffer is empty and we have been given at least a buffer full of data, write whole sectors straight from the caller's memory
+					if (writeBuffer->BytesStored() == 0)
 					{
-						const size_t bytesToWrite = writeBuffer->BytesStored();
-						size_t bytesWritten;
-						writeStatus = Store(writeBuffer->Data(), bytesToWrite, &bytesWritten);
-						writeBuffer->DataTaken();
+						const size_t directBytes = GetDirectWriteLength(s + totalBytesWritten, len - totalBytesWritten);
+						if (directBytes != 0)
+						{
+							writeStatus = FinishPendingWrites();
+							if (writeStatus != FR_OK)
+							{
+								break;
+							}
+							size_t bytesWritten;
+							writeStatus = Store(s + totalBytesWritten, directBytes, &bytesWritten);
+							if (bytesWritten != directBytes)
+							{
+								break;
+							}
+							totalBytesWritten += directBytes;
+							if (totalBytesWritten == len)
+							{
+								break;
+							}
+							continue;
+						}
+					}
 
-						if (bytesToWrite != bytesWritten)
+					const size_t bytesStored = writeBuffer->Store(s + totalBytesWritten, len - totalBytesWritten);
+					if (writeBuffer->BytesLeft() == 0)
+					{
+						writeStatus = WriteBufferedData(false);
+						if (writeStatus != FR_OK)
 						{
-							// Something went wrong
 							break;
 						}
 					}
 					totalBytesWritten += bytesStored;
+					if (totalBytesWritten == len)
+					{
+						break;
+					}
 				}
-				while (writeStatus == FR_OK && totalBytesWritten != len);
 			}
 
 			if ((writeStatus != FR_OK) || (totalBytesWritten != len))
@@ -433,6 +559,106 @@ bool FileStore::Write(const char *s, size_t len)
 	}
 }
 
+// Return how many bytes of the data we have been asked to write we can pass directly to the file system without copying them into the write buffer.
+// The file system only transfers whole sectors directly from our memory, and the SD card interface needs a 32-bit aligned source to use DMA efficiently.
+// We only bypass the buffer when we have at least as much data as the buffer holds, so that we don't use more SD card write commands than we otherwise would.
+size_t FileStore::GetDirectWriteLength(const char *s, size_t len) const
+{
+	return (len >= FileWriteBufLen && (reinterpret_cast<uint32_t>(s) & 3) == 0 && file.fptr % FF_MIN_SS == 0)
+			? len - (len % FF_MIN_SS)
+				: 0;
+}
+
+// Write the contents of the write buffer to the file. If waitForCompletion is false and there is a free buffer to carry on with,
+// pass the full buffer to the file writer task instead, so that we don't have to wait for the SD card.
+// A short write is reported as FR_DENIED because FatFS returns FR_OK when the card is full.
+FRESULT FileStore::WriteBufferedData(bool waitForCompletion)
+{
+#if HAS_ASYNC_FILE_WRITES
+	if (!waitForCompletion && writeBuffer->BytesStored() != 0)
+	{
+		FileWriteBuffer * const newBuffer = reprap.GetPlatform().GetMassStorage()->AllocateWriteBuffer();
+		if (newBuffer != nullptr)
+		{
+			bool queued = false;
+			{
+				TaskCriticalSectionLocker lock;
+				if (!reprap.GetPlatform().GetMassStorage()->IsUnmounting(file.obj.fs))
+				{
+					++pendingWrites;
+					pendingBytes += writeBuffer->BytesStored();
+					queued = true;
+				}
+			}
+			if (queued)
+			{
+				writeBuffer->SetOwner(this);
+				reprap.GetPlatform().GetMassStorage()->QueueWriteBuffer(writeBuffer);
+				writeBuffer = newBuffer;
+				return FR_OK;
+			}
+			reprap.GetPlatform().GetMassStorage()->ReleaseWriteBuffer(newBuffer);	// the volume is being unmounted, so write synchronously
+		}
+	}
+#endif
+
+	FRESULT writeStatus = FinishPendingWrites();
+	const size_t bytesToWrite = writeBuffer->BytesStored();
+	if (writeStatus == FR_OK && bytesToWrite != 0)
+	{
+		size_t bytesWritten;
+		writeStatus = Store(writeBuffer->Data(), bytesToWrite, &bytesWritten);
+		if (writeStatus == FR_OK && bytesWritten != bytesToWrite)
+		{
+			writeStatus = FR_DENIED;
+		}
+	}
+	writeBuffer->DataTaken();
+	return writeStatus;
+}
+
+// Wait until the file writer task has written all the buffers we gave it, and return the status of those writes.
+// We must do this before anything else uses the file object, because the file writer task uses it too.
+FRESULT FileStore::FinishPendingWrites()
+{
+#if HAS_ASYNC_FILE_WRITES
+	while (pendingWrites != 0)
+	{
+		delay(1);
+	}
+	return asyncWriteStatus;
+#else
+	return FR_OK;
+#endif
+}
+
+#if HAS_ASYNC_FILE_WRITES
+
+// This is called by the file writer task to write a buffer that we queued. Only the first error is recorded.
+void FileStore::WriteQueuedBuffer(FileWriteBuffer *buffer)
+{
+	const size_t bytesToWrite = buffer->BytesStored();
+	if (asyncWriteStatus == FR_OK)
+	{
+		size_t bytesWritten;
+		FRESULT writeStatus = Store(buffer->Data(), bytesToWrite, &bytesWritten);
+		if (writeStatus == FR_OK && bytesWritten != bytesToWrite)
+		{
+			writeStatus = FR_DENIED;
+		}
+		asyncWriteStatus = writeStatus;
+	}
+	buffer->DataTaken();
+	buffer->SetOwner(nullptr);
+	reprap.GetPlatform().GetMassStorage()->ReleaseWriteBuffer(buffer);
+
+	TaskCriticalSectionLocker lock;
+	pendingBytes -= bytesToWrite;
+	--pendingWrites;
+}
+
+#endif
+
 bool FileStore::Flush()
 {
 	switch (usageMode)
@@ -442,23 +668,17 @@ bool FileStore::Flush()
 		return false;
 
 	case FileUseMode::readOnly:
+	case FileUseMode::cached:
 		return true;
 
 	case FileUseMode::readWrite:
 		if (writeBuffer != nullptr)
 		{
-			const size_t bytesToWrite = writeBuffer->BytesStored();
-			if (bytesToWrite != 0)
+			const FRESULT writeStatus = WriteBufferedData(true);
+			if (writeStatus != FR_OK)
 			{
-				size_t bytesWritten;
-				const FRESULT writeStatus = Store(writeBuffer->Data(), bytesToWrite, &bytesWritten);
-				writeBuffer->DataTaken();
-
-				if ((writeStatus != FR_OK) || (bytesToWrite != bytesWritten))
-				{
-					reprap.GetPlatform().MessageF(ErrorMessage, "Failed to flush data to file, error code %d. Card may be full.\n", (int)writeStatus);
-					return false;
-				}
+				reprap.GetPlatform().MessageF(ErrorMessage, "Failed to flush data to file, error code %d. Card may be full.\n", (int)writeStatus);
+				return false;
 			}
 		}
 		return f_sync(&file) == FR_OK;
@@ -476,6 +696,7 @@ bool FileStore::Truncate()
 	{
 	case FileUseMode::free:
 	case FileUseMode::readOnly:
+	case FileUseMode::cached:
 		INTERNAL_ERROR;
 		return false;
 
@@ -506,33 +727,48 @@ unsigned int FileStore::GetAndClearMaxRetryCount()
 	return DiskioGetAndClearMaxRetryCount();
 }
 
-#if 0	// not currently used
+float FileStore::GetLongestWriteTime()
+{
+	return (float)longestWriteTime * StepTimer::StepClocksToMillis;
+}
 
-// Provide a cluster map for fast seeking. Needs _USE_FASTSEEK defined as 1 in conf_fatfs to make any difference.
-// The first element of the table must be set to the total number of 32-bit entries in the table before calling this.
-bool FileStore::SetClusterMap(uint32_t tbl[])
+unsigned int FileStore::GetMaxRetryCount()
 {
-	switch (usageMode)
+	return DiskioGetMaxRetryCount();
+}
+
+// Build a cluster map for fast seeking. Following the cluster chain of a large file takes a long time, so this makes resuming a print
+// part way through a file and reading the end of a file much faster. We only do this for files that are open for reading only,
+// because FatFS can't extend a file in fast seek mode.
+bool FileStore::EnableFastSeek()
+{
+	if (usageMode != FileUseMode::readOnly || clusterMap != nullptr)
+	{
+		return clusterMap != nullptr;
+	}
+
+	clusterMap = reprap.GetPlatform().GetMassStorage()->AllocateClusterMap();
+	if (clusterMap == nullptr)
 	{
-	case FileUseMode::free:
-		INTERNAL_ERROR;
 		return false;
+	}
 
-	case FileUseMode::readOnly:
-	case FileUseMode::readWrite:
+	clusterMap->table[0] = ClusterMapEntries;
+	file.cltbl = clusterMap->table;
+	const FRESULT ret = f_lseek(&file, CREATE_LINKMAP);
+	if (ret != FR_OK)
+	{
+		// Probably the file has too many fragments to fit in the map, so carry on without it
+		if (reprap.Debug(moduleStorage))
 		{
-			file.cltbl = tbl;
-			const FRESULT ret = f_lseek(&file, CREATE_LINKMAP);
-//			debugPrintf("ret %d need %u\n", (int)ret, tbl[0]);
-			return ret == FR_OK;
+			debugPrintf("Fast seek map failed, code %d, need %" PRIu32 " entries\n", (int)ret, (uint32_t)clusterMap->table[0]);
 		}
-
-	case FileUseMode::invalidated:
-	default:
+		file.cltbl = nullptr;
+		reprap.GetPlatform().GetMassStorage()->ReleaseClusterMap(clusterMap);
+		clusterMap = nullptr;
 		return false;
 	}
+	return true;
 }
 
-#endif
-
 // End
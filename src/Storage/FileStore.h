@@ -6,9 +6,19 @@
 #include "Core.h"
 #include "Libraries/Fatfs/ff.h"
 #include "CRC32.h"
+#include "MacroCache.h"
+#include "FileWriteBuffer.h"
 
 class Platform;
-class FileWriteBuffer;
+
+// Cluster link map table used by FatFS to seek within a file without following the cluster chain
+struct ClusterMap
+{
+	ClusterMap(ClusterMap *n) : next(n) { }
+
+	ClusterMap *next;
+	DWORD table[ClusterMapEntries];
+};
 
 enum class OpenMode : uint8_t
 {
@@ -23,7 +33,15 @@ enum class FileUseMode : uint8_t
 	free,			// file object is free
 	readOnly,		// file object is in use for reading only
 	readWrite,		// file object is in use for reading and writing
-	invalidated		// file object is in use but file system has been invalidated
+	invalidated,	// file object is in use but file system has been invalidated
+	cached			// file object is in use for reading a file held in the macro cache
+};
+
+// Who a file is opened for. Some entries in the file table are kept for jobs, so that web requests and uploads can't stop a print from running its macros.
+enum class FileUser : uint8_t
+{
+	general,		// anything that isn't a job, e.g. a web request, an upload or the log file
+	job				// the file being printed, a macro, the resume file, or the next queued job
 };
 
 class FileStore
@@ -61,26 +79,48 @@ public:
 	bool IsOpenOn(const FATFS *fs) const;			// Return true if the file is open on the specified file system
 	uint32_t GetCRC32() const;
 
-#if 0	// not currently used
-	bool SetClusterMap(uint32_t[]);					// Provide a cluster map for fast seeking
-#endif
+	bool EnableFastSeek();							// Build a cluster map so that seeks don't need to follow the cluster chain, returning true if successful
 	static float GetAndClearLongestWriteTime();		// Return the longest time it took to write a block to a file, in milliseconds
 	static unsigned int GetAndClearMaxRetryCount();	// Return the highest SD card retry count that resulted in a successful transfer
+	static float GetLongestWriteTime();				// As above but without clearing them
+	static unsigned int GetMaxRetryCount();
 	friend class MassStorage;
 
 private:
 	void Init();
+#if SUPPORT_MACRO_CACHE
+	void OpenCached(MacroCache::Entry *entry);
+#endif
 	FRESULT Store(const char *s, size_t len, size_t *bytesWritten); // Write data to the non-volatile storage
+	FRESULT WriteBufferedData(bool waitForCompletion);				// Write the contents of the write buffer, or queue it if we can and waitForCompletion is false
+	FRESULT FinishPendingWrites();									// Wait until the file writer task has written all our queued buffers
+#if HAS_ASYNC_FILE_WRITES
+	void WriteQueuedBuffer(FileWriteBuffer *buffer);				// Called by the file writer task to write a buffer that we queued
+#endif
+	size_t GetDirectWriteLength(const char *s, size_t len) const;
 
     FIL file;
 	FileWriteBuffer *writeBuffer;
+	ClusterMap *clusterMap;
 	volatile unsigned int openCount;
 	volatile bool closeRequested;
 	bool calcCrc;
 	FileUseMode usageMode;
+	FileUser user;									// who we were opened for, only valid when usageMode is not free
 
 	CRC32 crc;
 
+#if HAS_ASYNC_FILE_WRITES
+	volatile unsigned int pendingWrites;			// how many of our buffers are queued for the file writer task
+	volatile size_t pendingBytes;					// how much data those buffers hold
+	volatile FRESULT asyncWriteStatus;				// the first error that the file writer task got when writing our data
+#endif
+
+#if SUPPORT_MACRO_CACHE
+	MacroCache::Entry *cacheEntry;					// the cached file we are reading, if usageMode is cached
+	FilePosition cachePosition;
+#endif
+
 	static uint32_t longestWriteTime;
 };
 
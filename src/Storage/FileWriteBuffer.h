@@ -10,9 +10,12 @@
 
 #include "RepRapFirmware.h"
 
-#if SAM4E || SAM4S || SAME70
-const size_t NumFileWriteBuffers = 2;					// Number of write buffers
+#if SAME70
+const size_t NumFileWriteBuffers = 4;					// Number of write buffers
 const size_t FileWriteBufLen = 8192;					// Size of each write buffer
+#elif SAM4E || SAM4S
+const size_t NumFileWriteBuffers = 3;
+const size_t FileWriteBufLen = 8192;
 #elif defined(__LPC17xx__)
 const size_t NumFileWriteBuffers = 1;
 const size_t FileWriteBufLen = 2*256; //4096; save some memory on LPC for networking
@@ -21,16 +24,27 @@ const size_t NumFileWriteBuffers = 1;
 const size_t FileWriteBufLen = 4096;
 #endif
 
+// When we have enough buffers, full buffers are passed to the file writer task so that the caller doesn't have to wait for the SD card
+#if defined(RTOS) && (SAM4E || SAM4S || SAME70)
+# define HAS_ASYNC_FILE_WRITES	1
+#else
+# define HAS_ASYNC_FILE_WRITES	0
+#endif
+
+class FileStore;
+
 // Class to cache data that is about to be written to the SD card. This is NOT a ring buffer,
 // instead it just provides simple interfaces to cache a certain amount of data so that fewer
 // f_write() calls are needed. This effectively improves upload speeds.
 class FileWriteBuffer
 {
 public:
-	FileWriteBuffer(FileWriteBuffer *n) : next(n), index(0) { }
+	FileWriteBuffer(FileWriteBuffer *n) : next(n), owner(nullptr), index(0) { }
 
 	FileWriteBuffer *Next() const { return next; }
 	void SetNext(FileWriteBuffer *n) { next = n; }
+	FileStore *GetOwner() const { return owner; }			// Return the file that a queued buffer is to be written to
+	void SetOwner(FileStore *f) { owner = f; }
 
 	char *Data() { return reinterpret_cast<char *>(data32); }
 	const char *Data() const { return reinterpret_cast<const char *>(data32); }
@@ -43,6 +57,7 @@ public:
 
 private:
 	FileWriteBuffer *next;
+	FileStore *owner;
 
 	size_t index;
 	uint32_t data32[FileWriteBufLen / sizeof(uint32_t)];	// 32-bit aligned buffer for better HSMCI performance
@@ -0,0 +1,187 @@
+/*
+ * MacroCache.cpp
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#include "MacroCache.h"
+
+#if SUPPORT_MACRO_CACHE
+
+#include "Platform.h"
+#include "RepRap.h"
+#include "Tasks.h"
+#include "Movement/Move.h"
+
+MacroCache::Entry::~Entry()
+{
+	delete[] path;
+}
+
+MacroCache::MacroCache() : entries(nullptr), bytesUsed(0), generation(0), hits(0), misses(0)
+{
+}
+
+// Skip the volume at the start of a path if it is the default one, so that "0:/sys/pause.g" and "/sys/pause.g" refer to the same entry
+/*static*/ const char *MacroCache::SkipVolume(const char *filePath)
+{
+	return (filePath[0] == '0' && filePath[1] == ':') ? filePath + 2 : filePath;
+}
+
+// Find the entry for a file and add a reference to it. The caller must call Release when it has finished with the entry.
+MacroCache::Entry *MacroCache::Find(const char *filePath)
+{
+	filePath = SkipVolume(filePath);
+	for (Entry **link = &entries; *link != nullptr; link = &(*link)->next)
+	{
+		Entry * const entry = *link;
+		if (StringEqualsIgnoreCase(entry->path, filePath))
+		{
+			// Move it to the front of the list, so that the entries that haven't been used for longest are the first to be discarded
+			*link = entry->next;
+			entry->next = entries;
+			entries = entry;
+			++entry->refCount;
+			++hits;
+			return entry;
+		}
+	}
+	++misses;
+	return nullptr;
+}
+
+void MacroCache::Release(Entry *entry)
+{
+	--entry->refCount;
+	if (entry->refCount == 0 && entry->isStale)
+	{
+		delete entry;
+	}
+}
+
+// Add an entry for a file. 'gen' is the generation number that the caller read before it started reading the file.
+// If it has changed then the file may have been written since then, so we don't cache what the caller read.
+void MacroCache::Add(const char *filePath, const char *data, FilePosition len, uint32_t gen)
+{
+	if (gen != generation || len > MaxCachedMacroFileSize)
+	{
+		return;
+	}
+
+	filePath = SkipVolume(filePath);
+	for (const Entry *entry = entries; entry != nullptr; entry = entry->next)
+	{
+		if (StringEqualsIgnoreCase(entry->path, filePath))
+		{
+			return;												// another task has already added it
+		}
+	}
+
+	const size_t pathLength = strlen(filePath) + 1;
+	const size_t bytesNeeded = sizeof(Entry) + pathLength + len;
+	if (bytesNeeded > MacroCacheSize)
+	{
+		return;
+	}
+	MakeRoom(bytesNeeded);
+	if (Tasks::GetNeverUsedRam() < bytesNeeded + MinRamToLeave)
+	{
+		return;
+	}
+
+	Entry * const entry = new Entry(entries);
+	entry->path = new char[pathLength + len];
+	memcpy(entry->path, filePath, pathLength);
+	if (data != nullptr)
+	{
+		char * const contents = entry->path + pathLength;
+		memcpy(contents, data, len);
+		entry->contents = contents;
+		entry->length = len;
+	}
+	entries = entry;
+	bytesUsed += bytesNeeded;
+}
+
+// Discard any entry for a file because the file is being written
+void MacroCache::Invalidate(const char *filePath)
+{
+	++generation;
+	filePath = SkipVolume(filePath);
+	Entry **link = &entries;
+	while (*link != nullptr)
+	{
+		if (StringEqualsIgnoreCase((*link)->path, filePath))
+		{
+			Discard(link);
+		}
+		else
+		{
+			link = &(*link)->next;
+		}
+	}
+}
+
+void MacroCache::InvalidateAll()
+{
+	++generation;
+	while (entries != nullptr)
+	{
+		Discard(&entries);
+	}
+}
+
+// Remove an entry from the list. If it is still being read then it is deleted when the last reader releases it.
+void MacroCache::Discard(Entry **link)
+{
+	Entry * const entry = *link;
+	*link = entry->next;
+	bytesUsed -= sizeof(Entry) + strlen(entry->path) + 1 + entry->length;
+	if (entry->refCount == 0)
+	{
+		delete entry;
+	}
+	else
+	{
+		entry->isStale = true;
+	}
+}
+
+// Discard the least recently used entries until there is room for a new one
+void MacroCache::MakeRoom(size_t bytesNeeded)
+{
+	while (entries != nullptr && bytesUsed + bytesNeeded > MacroCacheSize)
+	{
+		Entry **link = &entries;
+		while ((*link)->next != nullptr)
+		{
+			link = &(*link)->next;
+		}
+		Discard(link);
+	}
+}
+
+// Report the statistics and clear them
+void MacroCache::Diagnostics(MessageType mtype)
+{
+	unsigned int numCached = 0, numMissing = 0;
+	for (const Entry *entry = entries; entry != nullptr; entry = entry->next)
+	{
+		if (entry->Exists())
+		{
+			++numCached;
+		}
+		else
+		{
+			++numMissing;
+		}
+	}
+	reprap.GetPlatform().MessageF(mtype, "Macro cache: %u files, %u missing files, %u bytes, %" PRIu32 " hits, %" PRIu32 " misses\n",
+									numCached, numMissing, bytesUsed, hits, misses);
+	hits = misses = 0;
+}
+
+#endif
+
+// End
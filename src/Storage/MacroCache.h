@@ -0,0 +1,71 @@
+/*
+ * MacroCache.h
+ *
+ *  Created on: 14 Oct 2019
+ *      Author: David
+ */
+
+#ifndef SRC_STORAGE_MACROCACHE_H_
+#define SRC_STORAGE_MACROCACHE_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_MACRO_CACHE
+
+#include "MessageType.h"
+
+// Class to keep copies of small macro files in RAM, so that tool change and pause macros that are run many times during a print don't have to be read from SD card each time.
+// We also remember macro files that don't exist, because most tool changes look for tfree, tpre and tpost files that the user hasn't provided.
+// Entries are discarded when a file of the same name is written, and all entries are discarded when any file is deleted or renamed or the card is mounted or unmounted.
+// The caller must own the file system mutex when calling any of these functions, because the cache is shared between tasks.
+class MacroCache
+{
+public:
+	class Entry
+	{
+	public:
+		friend class MacroCache;
+
+		bool Exists() const { return contents != nullptr; }
+		const char *GetContents() const { return contents; }
+		FilePosition GetLength() const { return length; }
+
+	private:
+		Entry(Entry *n) : next(n), path(nullptr), contents(nullptr), length(0), refCount(0), isStale(false) { }
+		~Entry();
+
+		Entry *next;
+		char *path;												// the path, followed by the file contents if the file exists
+		const char *contents;									// the file contents, or nullptr if the file doesn't exist
+		FilePosition length;
+		unsigned int refCount;									// how many open files are reading from this entry
+		bool isStale;											// true if this entry has been discarded but is still being read
+	};
+
+	MacroCache();
+
+	Entry *Find(const char *filePath);							// find an entry and add a reference to it, returning nullptr if the file isn't cached
+	void Release(Entry *entry);									// remove a reference that was added by Find
+	uint32_t GetGeneration() const { return generation; }
+	void Add(const char *filePath, const char *data, FilePosition len, uint32_t gen);	// add an entry, or pass nullptr data for a file that doesn't exist
+	void Invalidate(const char *filePath);						// discard any entry for this file
+	void InvalidateAll();
+	void Diagnostics(MessageType mtype);
+
+private:
+	static const char *SkipVolume(const char *filePath);
+
+	void Discard(Entry **link);
+	void MakeRoom(size_t bytesNeeded);
+
+	Entry *entries;												// the entries in most recently used order
+	size_t bytesUsed;											// the total size of the cached files
+	uint32_t generation;										// incremented whenever we discard entries, so that we don't add an entry from a file that has since changed
+
+	// Statistics
+	uint32_t hits, misses;
+};
+
+#endif
+
+#endif /* SRC_STORAGE_MACROCACHE_H_ */
@@ -2,6 +2,7 @@
 #include "Platform.h"
 #include "RepRap.h"
 #include "sd_mmc.h"
+#include "Libraries/Fatfs/diskio.h"
 
 // Check that the LFN configuration in FatFS is sufficient
 static_assert(FF_MAX_LFN >= MaxFilenameLength, "FF_MAX_LFN too small");
@@ -14,6 +15,20 @@ static_assert(FF_MAX_LFN >= MaxFilenameLength, "FF_MAX_LFN too small");
 // No function should need to take both the file table mutex and the find buffer mutex.
 // No function in here should be called when the caller already owns the shared SPI mutex.
 
+#if HAS_ASYNC_FILE_WRITES
+
+# include "Tasks.h"
+
+constexpr size_t FileWriterTaskStackWords = 400;			// task stack size in dwords, must be large enough for f_write
+static Task<FileWriterTaskStackWords> fileWriterTask;
+
+extern "C" void FileWriterLoop(void * pvParameters)
+{
+	reprap.GetPlatform().GetMassStorage()->FileWriterTask();
+}
+
+#endif
+
 // Static helper functions - not declared as class members to avoid having to include sd_mmc.h everywhere
 static const char* TranslateCardType(card_type_t ct)
 {
@@ -59,7 +74,11 @@ static const char* TranslateCardError(sd_mmc_err_t err)
 }
 
 // Mass Storage class
-MassStorage::MassStorage(Platform* p) : freeWriteBuffers(nullptr)
+MassStorage::MassStorage(Platform* p) : freeWriteBuffers(nullptr),
+#if HAS_ASYNC_FILE_WRITES
+	pendingWriteBuffers(nullptr), lastPendingWriteBuffer(nullptr), unmountingFileSystem(nullptr),
+#endif
+	freeClusterMaps(nullptr), numClusterMaps(0), maxFilesInUse(0), listingIndex(0), listingActive(false)
 {
 }
 
@@ -71,6 +90,9 @@ void MassStorage::Init()
 	// Create the mutexes
 	fsMutex.Create("FileSystem");
 	dirMutex.Create("DirSearch");
+#if SUPPORT_SECTOR_CACHE
+	DiskioInitCache();
+#endif
 
 	for (size_t i = 0; i < NumFileWriteBuffers; ++i)
 	{
@@ -89,12 +111,18 @@ void MassStorage::Init()
 
 	sd_mmc_init(SdWriteProtectPins, SdSpiCSPins);		// initialize SD MMC stack
 
+#if HAS_ASYNC_FILE_WRITES
+	fileWriterTask.Create(FileWriterLoop, "FILEWR", nullptr, TaskPriority::FileWriterPriority);
+#endif
+
 	// We no longer mount the SD card here because it may take a long time if it fails
 }
 
+// The write buffer list is protected by a critical section instead of the file system mutex, because the file writer task releases buffers
+// while the main task may own the file system mutex and be waiting for it.
 FileWriteBuffer *MassStorage::AllocateWriteBuffer()
 {
-	MutexLocker lock(fsMutex);
+	TaskCriticalSectionLocker lock;
 	if (freeWriteBuffers == nullptr)
 	{
 		return nullptr;
@@ -108,27 +136,230 @@ FileWriteBuffer *MassStorage::AllocateWriteBuffer()
 
 void MassStorage::ReleaseWriteBuffer(FileWriteBuffer *buffer)
 {
-	MutexLocker lock(fsMutex);
+	TaskCriticalSectionLocker lock;
 	buffer->SetNext(freeWriteBuffers);
 	freeWriteBuffers = buffer;
 }
 
-FileStore* MassStorage::OpenFile(const char* filePath, OpenMode mode, uint32_t preAllocSize)
+#if HAS_ASYNC_FILE_WRITES
+
+// Add a full buffer to the end of the queue for the file writer task. The owner of the buffer must already have been set.
+void MassStorage::QueueWriteBuffer(FileWriteBuffer *buffer)
 {
+	buffer->SetNext(nullptr);
 	{
-		MutexLocker lock(fsMutex);
-		for (size_t i = 0; i < MAX_FILES; i++)
+		TaskCriticalSectionLocker lock;
+		if (pendingWriteBuffers == nullptr)
+		{
+			pendingWriteBuffers = buffer;
+		}
+		else
+		{
+			lastPendingWriteBuffer->SetNext(buffer);
+		}
+		lastPendingWriteBuffer = buffer;
+	}
+	fileWriterTask.Give();
+}
+
+// Write queued buffers to the SD card in the order they were queued, so that the buffers of each file are written in sequence
+void MassStorage::FileWriterTask()
+{
+	for (;;)
+	{
+		TaskBase::Take(Mutex::TimeoutUnlimited);
+		while (pendingWriteBuffers != nullptr)
 		{
-			if (files[i].usageMode == FileUseMode::free)
+			FileWriteBuffer *buffer;
 			{
-				return (files[i].Open(filePath, mode, preAllocSize)) ? &files[i]: nullptr;
+				TaskCriticalSectionLocker lock;
+				buffer = pendingWriteBuffers;
+				pendingWriteBuffers = buffer->Next();
 			}
+			buffer->GetOwner()->WriteQueuedBuffer(buffer);
+		}
+	}
+}
+
+#endif
+
+// Allocate a cluster map. We only create them when they are first needed, because many users never print large files.
+ClusterMap *MassStorage::AllocateClusterMap()
+{
+	MutexLocker lock(fsMutex);
+	if (freeClusterMaps == nullptr)
+	{
+		if (numClusterMaps == MaxClusterMaps)
+		{
+			return nullptr;
+		}
+		freeClusterMaps = new ClusterMap(nullptr);
+		++numClusterMaps;
+	}
+
+	ClusterMap * const map = freeClusterMaps;
+	freeClusterMaps = map->next;
+	map->next = nullptr;
+	return map;
+}
+
+void MassStorage::ReleaseClusterMap(ClusterMap *map)
+{
+	MutexLocker lock(fsMutex);
+	map->next = freeClusterMaps;
+	freeClusterMaps = map;
+}
+
+// Find a free file entry for the specified user. General users may not take the entries that are reserved for jobs.
+FileStore *MassStorage::AllocateFile(FileUser user)
+{
+	FileStore *freeFile = nullptr;
+	unsigned int numInUse = 0, numGeneralInUse = 0;
+	for (FileStore& f : files)
+	{
+		if (f.usageMode == FileUseMode::free)
+		{
+			if (freeFile == nullptr)
+			{
+				freeFile = &f;
+			}
+		}
+		else
+		{
+			++numInUse;
+			if (f.user == FileUser::general)
+			{
+				++numGeneralInUse;
+			}
+		}
+	}
+
+	if (freeFile == nullptr || (user == FileUser::general && numGeneralInUse >= MAX_FILES - FilesReservedForJobs))
+	{
+		return nullptr;
+	}
+	freeFile->user = user;
+	if (numInUse + 1 > maxFilesInUse)
+	{
+		maxFilesInUse = numInUse + 1;
+	}
+	return freeFile;
+}
+
+FileStore* MassStorage::OpenFile(const char* filePath, OpenMode mode, uint32_t preAllocSize, FileUser user)
+{
+	{
+		MutexLocker lock(fsMutex);
+		if (mode != OpenMode::read)
+		{
+#if SUPPORT_MACRO_CACHE
+			macroCache.Invalidate(filePath);
+#endif
+			InvalidateDirectoryListing();
+		}
+		FileStore * const f = AllocateFile(user);
+		if (f != nullptr)
+		{
+			return (f->Open(filePath, mode, preAllocSize)) ? f : nullptr;
 		}
 	}
 	reprap.GetPlatform().Message(ErrorMessage, "Max open file count exceeded.\n");
 	return nullptr;
 }
 
+#if SUPPORT_MACRO_CACHE
+
+// Open a macro file for reading. If it is in the macro cache then we read it from RAM, which avoids searching the directory on the SD card.
+// Otherwise we open it on the SD card, and if it is small enough we add a copy of it to the cache so that it will be quicker to open next time.
+// We also cache the fact that the file doesn't exist, so that tool changes don't search the card for tfree, tpre and tpost files that aren't there.
+FileStore* MassStorage::OpenMacroFile(const char* filePath)
+{
+	uint32_t generation;
+	{
+		MutexLocker lock(fsMutex);
+		MacroCache::Entry * const entry = macroCache.Find(filePath);
+		if (entry != nullptr)
+		{
+			if (!entry->Exists())
+			{
+				macroCache.Release(entry);
+				return nullptr;
+			}
+			FileStore * const f = AllocateFile(FileUser::job);
+			if (f != nullptr)
+			{
+				f->OpenCached(entry);
+				return f;
+			}
+			macroCache.Release(entry);
+			reprap.GetPlatform().Message(ErrorMessage, "Max open file count exceeded.\n");
+			return nullptr;
+		}
+		generation = macroCache.GetGeneration();
+	}
+
+	FileStore * const f = OpenFile(filePath, OpenMode::read, 0, FileUser::job);
+	if (f == nullptr)
+	{
+		if (!FileExists(filePath))			// don't cache the file as missing if we failed to open it for another reason
+		{
+			MutexLocker lock(fsMutex);
+			macroCache.Add(filePath, nullptr, 0, generation);
+		}
+		return nullptr;
+	}
+
+	const FilePosition length = f->Length();
+	if (length <= MaxCachedMacroFileSize)
+	{
+		char * const buffer = new char[length + 1];			// add 1 so that we don't allocate zero bytes for an empty file
+		const bool ok = f->Read(buffer, length) == (int)length && f->Seek(0);
+		if (ok)
+		{
+			MutexLocker lock(fsMutex);
+			macroCache.Add(filePath, buffer, length, generation);
+		}
+		delete[] buffer;
+		if (!ok)
+		{
+			f->Close();
+			return nullptr;
+		}
+	}
+	return f;
+}
+
+void MassStorage::ReleaseCachedFile(MacroCache::Entry *entry)
+{
+	MutexLocker lock(fsMutex);
+	macroCache.Release(entry);
+}
+
+void MassStorage::InvalidateMacroCache()
+{
+	MutexLocker lock(fsMutex);
+	macroCache.InvalidateAll();
+}
+
+void MassStorage::MacroCacheDiagnostics(MessageType mtype)
+{
+	MutexLocker lock(fsMutex);
+	macroCache.Diagnostics(mtype);
+}
+
+#endif
+
+#if SUPPORT_SECTOR_CACHE
+
+void MassStorage::SectorCacheDiagnostics(MessageType mtype)
+{
+	unsigned int hits, misses;
+	DiskioGetAndClearCacheStats(hits, misses);
+	reprap.GetPlatform().MessageF(mtype, "Sector cache: %u entries, %u hits, %u misses\n", (unsigned int)SectorCacheEntries, hits, misses);
+}
+
+#endif
+
 // Close all files
 void MassStorage::CloseAllFiles()
 {
@@ -256,6 +487,110 @@ void MassStorage::AbandonFindNext()
 	}
 }
 
+// Get entry 'index' of a directory listing, not counting hidden files. Return false if there is no such entry.
+// Fetching the entries in order is fast even if the directory doesn't fit in the cache, because we carry on from where the previous walk of the directory got to.
+// The caller must call EndDirectoryListing when it has finished, because a walk of the directory owns the directory search mutex.
+bool MassStorage::GetDirectoryEntry(const char *directory, unsigned int index, FileInfo& fileInfo)
+{
+	MutexLocker lock(dirMutex, 10000);
+	if (!lock)
+	{
+		return false;
+	}
+
+#if SUPPORT_DIRECTORY_CACHE
+	if (!dirCache.IsValidFor(directory) && !listingActive)
+	{
+		BuildDirectoryCache(directory);
+	}
+	if (dirCache.IsValidFor(directory))
+	{
+		return dirCache.GetEntry(index, fileInfo);
+	}
+#endif
+
+	if (listingActive && index == listingIndex && StringEqualsIgnoreCase(listingDirectory.c_str(), directory))
+	{
+		if (!FindNext(fileInfo))
+		{
+			listingActive = false;
+			return false;
+		}
+	}
+	else
+	{
+		EndDirectoryListing();
+		if (!FindFirst(directory, fileInfo))
+		{
+			return false;
+		}
+		listingActive = true;
+		listingDirectory.copy(directory);
+		listingIndex = 0;
+	}
+
+	for (;;)
+	{
+		if (fileInfo.fileName[0] != '.')							// ignore Mac resource files and Linux hidden files
+		{
+			++listingIndex;
+			if (listingIndex > index)
+			{
+				return true;
+			}
+		}
+		if (!FindNext(fileInfo))
+		{
+			listingActive = false;
+			return false;
+		}
+	}
+}
+
+void MassStorage::EndDirectoryListing()
+{
+	if (listingActive)
+	{
+		listingActive = false;
+		AbandonFindNext();
+	}
+}
+
+// Discard the directory listing because a file has been created, written, deleted or renamed
+void MassStorage::InvalidateDirectoryListing()
+{
+#if SUPPORT_DIRECTORY_CACHE
+	dirCache.Invalidate();
+#endif
+}
+
+#if SUPPORT_DIRECTORY_CACHE
+
+// Read a directory into the cache. If it doesn't fit then the cache is left invalid and GetDirectoryEntry walks the directory instead.
+// The caller must own the directory search mutex.
+void MassStorage::BuildDirectoryCache(const char *directory)
+{
+	if (!dirCache.Start(directory))
+	{
+		return;
+	}
+
+	FileInfo fileInfo;
+	bool gotFile = FindFirst(directory, fileInfo);
+	while (gotFile)
+	{
+		if (fileInfo.fileName[0] != '.' && !dirCache.Add(fileInfo))
+		{
+			AbandonFindNext();
+			return;
+		}
+		gotFile = FindNext(fileInfo);
+	}
+	dirCache.Finish();
+}
+
+#endif
+
 // Month names. The first entry is used for invalid month numbers.
 static const char *monthNames[13] = { "???", "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
@@ -274,6 +609,10 @@ bool MassStorage::Delete(const char* filePath)
 	// Start new scope to lock the filesystem for the minimum time
 	{
 		MutexLocker lock(fsMutex);
+#if SUPPORT_MACRO_CACHE
+		macroCache.InvalidateAll();
+#endif
+		InvalidateDirectoryListing();
 
 		// First check whether the file is open - don't allow it to be deleted if it is, because that may corrupt the file system
 		FIL file;
@@ -323,6 +662,7 @@ bool MassStorage::MakeDirectory(const char *parentDir, const char *dirName)
 	{
 		return false;
 	}
+	InvalidateDirectoryListing();
 	if (f_mkdir(location.c_str()) != FR_OK)
 	{
 		reprap.GetPlatform().MessageF(ErrorMessage, "Failed to create directory %s\n", location.c_str());
@@ -333,6 +673,7 @@ bool MassStorage::MakeDirectory(const char *parentDir, const char *dirName)
 
 bool MassStorage::MakeDirectory(const char *directory)
 {
+	InvalidateDirectoryListing();
 	if (f_mkdir(directory) != FR_OK)
 	{
 		reprap.GetPlatform().MessageF(ErrorMessage, "Failed to create directory %s\n", directory);
@@ -351,7 +692,12 @@ bool MassStorage::Rename(const char *oldFilename, const char *newFilename)
 		// We are assuming that the user isn't really trying to rename across volumes. This is a safe assumption when the client is DWC.
 		newFilename += 2;
 	}
-	if (f_rename(oldFilename, newFilename) != FR_OK)
+	const FRESULT renameReturn = f_rename(oldFilename, newFilename);
+#if SUPPORT_MACRO_CACHE
+	InvalidateMacroCache();								// we may have renamed a directory, so don't just invalidate the old and new file names
+#endif
+	InvalidateDirectoryListing();
+	if (renameReturn != FR_OK)
 	{
 		reprap.GetPlatform().MessageF(ErrorMessage, "Failed to rename file or directory %s to %s\n", oldFilename, newFilename);
 		return false;
@@ -412,6 +758,7 @@ bool MassStorage::SetLastModifiedTime(const char *filePath, time_t time)
 	FILINFO fno;
     fno.fdate = (WORD)(((timeInfo->tm_year - 80) * 512U) | (timeInfo->tm_mon + 1) * 32U | timeInfo->tm_mday);
     fno.ftime = (WORD)(timeInfo->tm_hour * 2048U | timeInfo->tm_min * 32U | timeInfo->tm_sec / 2U);
+	InvalidateDirectoryListing();
     const bool ok = (f_utime(filePath, &fno) == FR_OK);
     if (!ok)
 	{
@@ -434,6 +781,10 @@ GCodeResult MassStorage::Mount(size_t card, const StringRef& reply, bool reportS
 	SdCardInfo& inf = info[card];
 	MutexLocker lock1(fsMutex);
 	MutexLocker lock2(inf.volMutex);
+#if SUPPORT_MACRO_CACHE
+	macroCache.InvalidateAll();
+#endif
+	InvalidateDirectoryListing();
 	if (!inf.mounting)
 	{
 		if (inf.isMounted)
@@ -483,7 +834,11 @@ GCodeResult MassStorage::Mount(size_t card, const StringRef& reply, bool reportS
 	const FRESULT mounted = f_mount(&inf.fileSystem, path, 1);
 	if (mounted == FR_NO_FILESYSTEM)
 	{
+#if FF_FS_EXFAT
+		reply.printf("Cannot mount SD card %u: no FAT or exFAT filesystem found on card", card);
+#else
 		reply.printf("Cannot mount SD card %u: no FAT filesystem found on card (EXFAT is not supported)", card);
+#endif
 		return GCodeResult::error;
 	}
 	if (mounted != FR_OK)
@@ -506,7 +861,14 @@ GCodeResult MassStorage::Mount(size_t card, const StringRef& reply, bool reportS
 		{
 			capUnits = "Mb";
 		}
-		reply.printf("%s card mounted in slot %u, capacity %.2f%s", TranslateCardType(sd_mmc_get_type(card)), card, (double)capacity, capUnits);
+		const char * const fsType = (inf.fileSystem.fs_type == FS_FAT12) ? "FAT12"
+									: (inf.fileSystem.fs_type == FS_FAT16) ? "FAT16"
+#if FF_FS_EXFAT
+										: (inf.fileSystem.fs_type == FS_EXFAT) ? "exFAT"
+#endif
+											: "FAT32";
+		reply.printf("%s card mounted in slot %u, capacity %.2f%s, %s, cluster size %" PRIu32 "Kb",
+						TranslateCardType(sd_mmc_get_type(card)), card, (double)capacity, capUnits, fsType, ((uint32_t)inf.fileSystem.csize * 512u)/1024u);
 	}
 
 	return GCodeResult::ok;
@@ -594,17 +956,52 @@ bool MassStorage::IsCardDetected(size_t card) const
 unsigned int MassStorage::InternalUnmount(size_t card, bool doClose)
 {
 	SdCardInfo& inf = info[card];
+#if HAS_ASYNC_FILE_WRITES
+	FinishQueuedWrites(&inf.fileSystem);
+#endif
 	MutexLocker lock1(fsMutex);
 	MutexLocker lock2(inf.volMutex);
+#if SUPPORT_MACRO_CACHE
+	macroCache.InvalidateAll();
+#endif
+	InvalidateDirectoryListing();
 	const unsigned int invalidated = InvalidateFiles(&inf.fileSystem, doClose);
 	const char path[3] = { (char)('0' + card), ':', 0 };
 	f_mount(nullptr, path, 0);
 	memset(&inf.fileSystem, 0, sizeof(inf.fileSystem));
+#if SUPPORT_SECTOR_CACHE
+	DiskioInvalidateCache(card);
+#endif
 	sd_mmc_unmount(card);
 	inf.isMounted = false;
+#if HAS_ASYNC_FILE_WRITES
+	unmountingFileSystem = nullptr;
+#endif
 	return invalidated;
 }
 
+#if HAS_ASYNC_FILE_WRITES
+
+// Stop any more writes to the file system being queued, then wait until the file writer task has written the ones already queued.
+// This must be called before we take the volume mutex, because the file writer task needs that mutex to write the buffers.
+// Mount calls InternalUnmount with the mutexes held, but only when no files are open, so there is nothing to wait for then.
+void MassStorage::FinishQueuedWrites(const FATFS *fs)
+{
+	{
+		TaskCriticalSectionLocker lock;
+		unmountingFileSystem = fs;
+	}
+	for (FileStore & fil : files)
+	{
+		if (fil.file.obj.fs == fs)
+		{
+			(void)fil.FinishPendingWrites();
+		}
+	}
+}
+
+#endif
+
 unsigned int MassStorage::GetNumFreeFiles() const
 {
 	unsigned int numFreeFiles = 0;
@@ -619,6 +1016,21 @@ unsigned int MassStorage::GetNumFreeFiles() const
 	return numFreeFiles;
 }
 
+unsigned int MassStorage::GetAndClearMaxFilesInUse()
+{
+	MutexLocker lock(fsMutex);
+	const unsigned int ret = maxFilesInUse;
+	maxFilesInUse = 0;
+	for (const FileStore & fil : files)
+	{
+		if (fil.usageMode != FileUseMode::free)
+		{
+			++maxFilesInUse;
+		}
+	}
+	return ret;
+}
+
 void MassStorage::Spin()
 {
 	for (size_t card = 0; card < NumSdCards; ++card)
@@ -8,6 +8,7 @@
 #include "GCodes/GCodeResult.h"
 #include "FileStore.h"
 #include "FileInfoParser.h"
+#include "DirectoryCache.h"
 #include "RTOSIface/RTOSIface.h"
 
 #include <ctime>
@@ -16,7 +17,7 @@
 struct FileInfo
 {
 	time_t lastModified;
-	uint32_t size;
+	FilePosition size;
 	String<MaxFilenameLength> fileName;
 	bool isDirectory;
 };
@@ -27,10 +28,19 @@ public:
 	static bool CombineName(const StringRef& out, const char* directory, const char* fileName);		// returns false if error i.e. filename too long
 	static const char* GetMonthName(const uint8_t month);
 
-	FileStore* OpenFile(const char* filePath, OpenMode mode, uint32_t preAllocSize);
+	FileStore* OpenFile(const char* filePath, OpenMode mode, uint32_t preAllocSize, FileUser user = FileUser::general);
+#if SUPPORT_MACRO_CACHE
+	FileStore* OpenMacroFile(const char* filePath);								// Open a macro file for reading, using the macro cache if possible
+	void MacroCacheDiagnostics(MessageType mtype);
+#endif
+#if SUPPORT_SECTOR_CACHE
+	void SectorCacheDiagnostics(MessageType mtype);
+#endif
 	bool FindFirst(const char *directory, FileInfo &file_info);
 	bool FindNext(FileInfo &file_info);
 	void AbandonFindNext();
+	bool GetDirectoryEntry(const char *directory, unsigned int index, FileInfo& fileInfo);	// Get an entry of a directory listing, not counting hidden files
+	void EndDirectoryListing();														// Call this when you have finished calling GetDirectoryEntry
 	bool Delete(const char* filePath);
 	bool MakeDirectory(const char *parentDir, const char *dirName);
 	bool MakeDirectory(const char *directory);
@@ -49,10 +59,14 @@ public:
 	bool AnyFileOpen(const FATFS *fs) const;										// Return true if any files are open on the file system
 	void CloseAllFiles();
 	unsigned int GetNumFreeFiles() const;
+	unsigned int GetAndClearMaxFilesInUse();										// Return the highest number of file entries that were in use at once since we were last asked
 	void Spin();
 	const Mutex& GetVolumeMutex(size_t vol) const { return info[vol].volMutex; }
 	bool GetFileInfo(const char *filePath, GCodeFileInfo& info, bool quitEarly) { return infoParser.GetFileInfo(filePath, info, quitEarly); }
 	void RecordSimulationTime(const char *printingFilePath, uint32_t simSeconds);	// Append the simulated printing time to the end of the file
+#if HAS_ASYNC_FILE_WRITES
+	[[noreturn]] void FileWriterTask();											// Body of the task that writes queued buffers to the SD card
+#endif
 
 	enum class InfoResult : uint8_t
 	{
@@ -72,6 +86,17 @@ protected:
 
 	FileWriteBuffer *AllocateWriteBuffer();
 	void ReleaseWriteBuffer(FileWriteBuffer *buffer);
+#if HAS_ASYNC_FILE_WRITES
+	void QueueWriteBuffer(FileWriteBuffer *buffer);
+	bool IsUnmounting(const FATFS *fs) const { return fs == unmountingFileSystem; }	// must be called in a task critical section
+#endif
+	ClusterMap *AllocateClusterMap();
+	void ReleaseClusterMap(ClusterMap *map);
+#if SUPPORT_MACRO_CACHE
+	void ReleaseCachedFile(MacroCache::Entry *entry);
+	void InvalidateMacroCache();
+#endif
+	void InvalidateDirectoryListing();
 
 private:
 	enum class CardDetectState : uint8_t
@@ -95,6 +120,13 @@ private:
 	};
 
 	unsigned int InternalUnmount(size_t card, bool doClose);
+#if HAS_ASYNC_FILE_WRITES
+	void FinishQueuedWrites(const FATFS *fs);
+#endif
+	FileStore *AllocateFile(FileUser user);										// Find a free file entry that this user may have, or return nullptr. Must be called with fsMutex held.
+#if SUPPORT_DIRECTORY_CACHE
+	void BuildDirectoryCache(const char *directory);
+#endif
 	static time_t ConvertTimeStamp(uint16_t fdate, uint16_t ftime);
 
 	SdCardInfo info[NumSdCards];
@@ -103,8 +135,25 @@ private:
 
 	FileInfoParser infoParser;
 	DIR findDir;
+	String<MaxFilenameLength> listingDirectory;									// the directory that GetDirectoryEntry is walking when it isn't cached
+	unsigned int listingIndex;													// the index of the next visible entry of that walk
+	bool listingActive;															// true if we are part way through that walk and own the directory search mutex
+#if SUPPORT_DIRECTORY_CACHE
+	DirectoryCache dirCache;
+#endif
 	FileWriteBuffer *freeWriteBuffers;
+#if HAS_ASYNC_FILE_WRITES
+	FileWriteBuffer * volatile pendingWriteBuffers;								// buffers waiting to be written by the file writer task, oldest first
+	FileWriteBuffer *lastPendingWriteBuffer;									// only valid when pendingWriteBuffers != nullptr
+	const FATFS * volatile unmountingFileSystem;								// the file system we are unmounting, to which no more writes may be queued
+#endif
+	ClusterMap *freeClusterMaps;
+	size_t numClusterMaps;
 	FileStore files[MAX_FILES];
+	unsigned int maxFilesInUse;
+#if SUPPORT_MACRO_CACHE
+	MacroCache macroCache;
+#endif
 };
 
 #endif
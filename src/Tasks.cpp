@@ -9,6 +9,7 @@
 #include "RepRap.h"
 #include "Platform.h"
 #include "Hardware/Cache.h"
+#include "Movement/StepTimer.h"
 
 #include <malloc.h>
 
@@ -37,6 +38,24 @@ constexpr unsigned int IdleTaskStackWords = 60;
 static Task<IdleTaskStackWords> idleTask;
 static Task<MainTaskStackWords> mainTask;
 
+#if configGENERATE_RUN_TIME_STATS
+
+// FreeRTOSConfig.h must define portGET_RUN_TIME_COUNTER_VALUE() to call this, and portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() to do nothing.
+// We use the step clock because it is already running and ticks at just under 1MHz, so the counts of the low-priority tasks don't wrap round too often.
+// FreeRTOS charges time spent in interrupt service routines to the task that was interrupted.
+extern "C" uint32_t GetRunTimeCounterValue()
+{
+	return StepTimer::GetInterruptClocks();
+}
+
+// The run time counters of the tasks when we last reported them, so that we can report the CPU usage since then
+constexpr size_t MaxReportedTasks = 12;
+static TaskHandle reportedTaskHandles[MaxReportedTasks] = { 0 };
+static uint32_t reportedTaskRunTimes[MaxReportedTasks];
+static uint32_t lastRunTimeReportTime = 0;
+
+#endif
+
 static Mutex spiMutex;
 static Mutex i2cMutex;
 static Mutex sysDirMutex;
@@ -294,7 +313,15 @@ namespace Tasks
 		}	// end memory stats scope
 
 #ifdef RTOS
+# if configGENERATE_RUN_TIME_STATS
+		const uint32_t now = GetRunTimeCounterValue();
+		const uint32_t runTimeSinceLastReport = now - lastRunTimeReportTime;
+		lastRunTimeReportTime = now;
+		p.Message(mtype, "Tasks (state,stack free,CPU%):");
+		size_t taskIndex = 0;
+# else
 		p.Message(mtype, "Tasks:");
+# endif
 		for (const TaskBase *t = TaskBase::GetTaskList(); t != nullptr; t = t->GetNext())
 		{
 			TaskStatus_t taskDetails;
@@ -304,8 +331,25 @@ namespace Tasks
 												: (taskDetails.eCurrentState == eBlocked) ? "blocked"
 													: (taskDetails.eCurrentState == eSuspended) ? "suspended"
 														: "invalid";
+# if configGENERATE_RUN_TIME_STATS
+			// Work out the CPU usage since the last report. Tasks are never deleted, so each one keeps its slot in the table.
+			float cpuPercent = 0.0;
+			if (taskIndex < MaxReportedTasks)
+			{
+				if (reportedTaskHandles[taskIndex] == taskDetails.xHandle && runTimeSinceLastReport != 0)
+				{
+					cpuPercent = (float)(taskDetails.ulRunTimeCounter - reportedTaskRunTimes[taskIndex]) * 100.0/(float)runTimeSinceLastReport;
+				}
+				reportedTaskHandles[taskIndex] = taskDetails.xHandle;
+				reportedTaskRunTimes[taskIndex] = taskDetails.ulRunTimeCounter;
+				++taskIndex;
+			}
+			p.MessageF(mtype, " %s(%s,%u,%.1f)",
+				taskDetails.pcTaskName, stateText, (unsigned int)(taskDetails.usStackHighWaterMark * sizeof(StackType_t)), (double)cpuPercent);
+# else
 			p.MessageF(mtype, " %s(%s,%u)",
 				taskDetails.pcTaskName, stateText, (unsigned int)(taskDetails.usStackHighWaterMark * sizeof(StackType_t)));
+# endif
 		}
 		p.Message(mtype, "\nOwned mutexes:");
 
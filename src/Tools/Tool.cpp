@@ -32,6 +32,7 @@
 #include "RepRap.h"
 
 Tool * Tool::freelist = nullptr;
+uint32_t Tool::lastMixVersion = 0;
 
 // Create a new tool and return a pointer to it. If an error occurs, put an error message in 'reply' and return nullptr.
 /*static*/ Tool *Tool::Create(unsigned int toolNumber, const char *name, int32_t d[], size_t dCount, int32_t h[], size_t hCount, AxesBitmap xMap, AxesBitmap yMap, FansBitmap fanMap, const StringRef& reply)
@@ -128,6 +129,7 @@ Tool * Tool::freelist = nullptr;
 		t->drives[drive] = d[drive];
 		t->mix[drive] = (drive == 0) ? 1.0 : 0.0;		// initial mix ratio is 1:0:0
 	}
+	t->mixVersion = ++lastMixVersion;
 
 	for (size_t heater = 0; heater < t->heaterCount; heater++)
 	{
@@ -352,6 +354,20 @@ void Tool::Standby()
 	state = ToolState::standby;
 }
 
+// Start heating this tool to its active temperatures ahead of selecting it, without disturbing any heaters that the current tool is using
+void Tool::Preheat(const Tool *currentTool)
+{
+	for (size_t heater = 0; heater < heaterCount; heater++)
+	{
+		if (currentTool == nullptr || !currentTool->UsesHeater(heaters[heater]))
+		{
+			reprap.GetHeat().SetActiveTemperature(heaters[heater], activeTemperatures[heater]);
+			reprap.GetHeat().SetStandbyTemperature(heaters[heater], standbyTemperatures[heater]);
+			reprap.GetHeat().Activate(heaters[heater]);
+		}
+	}
+}
+
 // May be called from ISR
 bool Tool::ToolCanDrive(bool extrude)
 {
@@ -397,6 +413,7 @@ void Tool::DefineMix(const float m[])
 	{
 		mix[drive] = m[drive];
 	}
+	mixVersion = ++lastMixVersion;
 }
 
 // Write the tool's settings to file returning true if successful. The settings written leave the tool selected unless it is off.
@@ -67,6 +67,7 @@ public:
 	int Number() const;
 	void DefineMix(const float m[]);
 	const float* GetMix() const;
+	uint32_t GetMixVersion() const { return mixVersion; }			// Return a number that changes whenever the mix of this or any new tool is set
 	float MaxFeedrate() const;
 	void Print(const StringRef& reply) const;
 	AxesBitmap GetXAxisMap() const { return xMapping; }
@@ -86,6 +87,7 @@ public:
 
 	void IterateExtruders(std::function<void(unsigned int)> f) const;
 	void IterateHeaters(std::function<void(int)> f) const;
+	void Preheat(const Tool *currentTool);
 
 	friend class RepRap;
 
@@ -99,6 +101,7 @@ protected:
 
 private:
 	static Tool *freelist;
+	static uint32_t lastMixVersion;
 
 	Tool() : next(nullptr), filament(nullptr), name(nullptr) { }
 
@@ -112,6 +115,7 @@ private:
 	const char *name;
 	float offset[MaxAxes];
 	float mix[MaxExtrudersPerTool];
+	uint32_t mixVersion;
 	float activeTemperatures[MaxHeatersPerTool];
 	float standbyTemperatures[MaxHeatersPerTool];
 	uint8_t driveCount;
@@ -18,10 +18,11 @@ void ZProbe::Init(float h)
 	calibTemperature = 20.0;
 	temperatureCoefficient = 0.0;	// no default temperature correction
 	diveHeight = DefaultZDive;
-	probeSpeed = DefaultProbingSpeed;
+	probeSpeed = fastProbeSpeed = DefaultProbingSpeed;
 	travelSpeed = DefaultZProbeTravelSpeed;
 	recoveryTime = 0.0;
 	tolerance = DefaultZProbeTolerance;
+	sensitivity = 0.0;				// not calibrated, so we can't probe while moving
 	maxTaps = DefaultZProbeTaps;
 	inputChannel = 0;
 	invertReading = turnHeatersOff = saveToConfigOverride = false;
@@ -32,10 +33,21 @@ float ZProbe::GetStopHeight(float temperature) const
 	return ((temperature - calibTemperature) * temperatureCoefficient) + triggerHeight;
 }
 
+// Convert a reading of an analog probe taken with the nozzle at Z=probeHeight to a bed height error, assuming that the reading varies linearly with height near the trigger height
+float ZProbe::GetHeightError(int reading, float probeHeight, float temperature) const
+{
+	return probeHeight - GetStopHeight(temperature) + (float)(reading - adcValue)/sensitivity;
+}
+
 bool ZProbe::WriteParameters(FileStore *f, unsigned int probeType) const
 {
 	String<ScratchStringLength> scratchString;
-	scratchString.printf("G31 T%u P%d X%.1f Y%.1f Z%.2f\n", probeType, adcValue, (double)xOffset, (double)yOffset, (double)triggerHeight);
+	scratchString.printf("G31 T%u P%d X%.1f Y%.1f Z%.2f", probeType, adcValue, (double)xOffset, (double)yOffset, (double)triggerHeight);
+	if (sensitivity != 0.0)
+	{
+		scratchString.catf(" K%.1f", (double)sensitivity);
+	}
+	scratchString.cat('\n');
 	return f->Write(scratchString.c_str());
 }
 
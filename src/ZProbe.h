@@ -35,9 +35,11 @@ public:
 	float temperatureCoefficient;	// the variation of height with bed temperature
 	float diveHeight;				// the dive height we use when probing
 	float probeSpeed;				// the initial speed of probing
+	float fastProbeSpeed;			// the speed of the approach tap if we probe at two speeds, else the same as probeSpeed
 	float travelSpeed;				// the speed at which we travel to the probe point
 	float recoveryTime;				// Z probe recovery time
 	float tolerance;				// maximum difference between probe heights when doing >1 taps
+	float sensitivity;				// how much the reading of an analog probe increases per mm that it gets closer to the bed, near the trigger height. Zero if not calibrated.
 	int16_t adcValue;				// the target ADC value, after inversion if enabled
 	uint16_t maxTaps : 5,			// maximum probes at each point
 			invertReading : 1,		// true if we need to invert the reading
@@ -46,9 +48,11 @@ public:
 			inputChannel : 4;		// input channel, use when the selected Z probe type is a switch
 
 	static constexpr unsigned int MaxTapsLimit = 31;	// must be low enough to fit in the maxTaps field
+	static constexpr int MaxReading = 1000;				// the highest reading that Platform::GetZProbeReading returns
 
 	void Init(float h);
 	float GetStopHeight(float temperature) const;
+	float GetHeightError(int reading, float probeHeight, float temperature) const;
 	bool WriteParameters(FileStore *f, unsigned int probeType) const;
 };
 